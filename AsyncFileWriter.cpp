@@ -0,0 +1,148 @@
+#include "AsyncFileWriter.h"
+
+#include <algorithm>
+
+const size_t AsyncFileWriter::kChunkBytes;
+
+//---------------------------------------------------------------------
+AsyncFileWriter::AsyncFileWriter(WriterFileSystem& fileSystem, const FileWriterOptions& options,
+    const FileWriteDoneFunction& done)
+    : fileSystem_(fileSystem), options_(options), done_(done)
+{
+    if (options_.maxQueuedFiles == 0)
+        options_.maxQueuedFiles = 1;
+    writer_ = std::thread([this] { WriterLoop(); });
+}
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+    Finish();
+}
+
+// Files stay counted against the limits until they are written, not just
+// until the writer takes them, so the file being written still holds back
+// the capture side.
+bool AsyncFileWriter::Submit(FileWriteRequest request)
+{
+    const size_t size = request.data.size();
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto hasRoom = [&]
+        {
+            return closed_ || (Pending() < options_.maxQueuedFiles &&
+                (queuedBytes_ == 0 || queuedBytes_ + size <= options_.maxQueuedBytes));
+        };
+    if (!hasRoom())
+    {
+        stats_.submitStalls++;
+        notFull_.wait(lock, hasRoom);
+    }
+    if (closed_)
+        return false;
+
+    Job job;
+    job.request = std::move(request);
+    job.queued = std::chrono::steady_clock::now();
+    queue_.push_back(std::move(job));
+    submitted_++;
+    queuedBytes_ += size;
+    const size_t depth = Pending();
+    stats_.maxQueuedFiles = (std::max)(stats_.maxQueuedFiles, depth);
+    stats_.maxQueuedBytes = (std::max)(stats_.maxQueuedBytes, queuedBytes_);
+    if (options_.stats)
+        options_.stats->NoteWriteQueueDepth(depth);
+    notEmpty_.notify_one();
+    return true;
+}
+
+void AsyncFileWriter::Finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notEmpty_.notify_all();
+        notFull_.notify_all();
+    }
+    if (writer_.joinable())
+        writer_.join();
+}
+
+size_t AsyncFileWriter::QueuedFiles() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return Pending();
+}
+
+FileWriterStats AsyncFileWriter::Stats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+//---------------------------------------------------------------------
+void AsyncFileWriter::WriterLoop()
+{
+    for (;;)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            notEmpty_.wait(lock, [&] { return closed_ || !queue_.empty(); });
+            if (queue_.empty())
+                return;
+            job = std::move(queue_.front());
+            queue_.pop_front();
+        }
+
+        const FileWriteRequest& request = job.request;
+        if (options_.stats)
+            options_.stats->Record(StatStage::WriteQueue, std::chrono::steady_clock::now() - job.queued);
+        bool ok;
+        {
+            StageTimer timer(options_.stats, StatStage::Write);
+            if (options_.atomicRename)
+            {
+                const std::wstring temp = request.fileName + L".tmp";
+                ok = WriteOne(request, temp) && fileSystem_.Replace(temp, request.fileName, options_.writeThrough);
+                if (!ok)
+                    fileSystem_.Remove(temp);
+            }
+            else
+            {
+                ok = WriteOne(request, request.fileName);
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (ok)
+            {
+                stats_.filesWritten++;
+                stats_.bytesWritten += request.data.size();
+            }
+            else
+            {
+                stats_.filesFailed++;
+            }
+            queuedBytes_ -= request.data.size();
+            notFull_.notify_all();
+        }
+        if (done_)
+            done_(request, ok);
+    }
+}
+
+bool AsyncFileWriter::WriteOne(const FileWriteRequest& request, const std::wstring& path)
+{
+    FileCreateOptions create;
+    create.preallocate = options_.preallocate ? request.data.size() : 0;
+    create.writeThrough = options_.writeThrough;
+    create.noBuffering = options_.noBuffering;
+    std::unique_ptr<WritableFile> file = fileSystem_.Create(path, create);
+    if (!file)
+        return false;
+
+    bool ok = true;
+    const uint8_t* data = request.data.data();
+    for (size_t offset = 0; ok && offset < request.data.size(); offset += kChunkBytes)
+        ok = file->Write(data + offset, (std::min)(kChunkBytes, request.data.size() - offset));
+    return file->Close() && ok;
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "CaptureStats.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Write-behind for encoded images. The capture side hands over a finished
+// buffer and carries on; one writer thread puts the files on disk in the
+// order they were submitted, so a slow or network-backed -dir no longer
+// holds up grabbing and encoding. Submit blocks once too many files or
+// bytes are waiting, which is the backpressure the capture pipeline sees.
+//
+// Each file is written under a temporary name next to its target and
+// renamed over it once complete, so readers never see a half-written
+// image, even if the process dies mid-write.
+
+struct FileCreateOptions
+{
+    uint64_t preallocate = 0;           // Final size, reserved up front; 0: don't.
+    bool writeThrough = false;          // Each write reaches the device before it returns.
+    bool noBuffering = false;           // Bypass the system file cache.
+};
+
+// An open file. Write is called with chunks of at most
+// AsyncFileWriter::kChunkBytes; every chunk but the last is a multiple of
+// 4096 bytes, so unbuffered implementations only need to pad the tail.
+class WritableFile
+{
+public:
+    virtual ~WritableFile() {}
+    virtual bool Write(const uint8_t* data, size_t size) = 0;
+    // Flush and close; the file is complete once this succeeds.
+    virtual bool Close() = 0;
+};
+
+// The file operations the writer needs, so it can run against a fake.
+class WriterFileSystem
+{
+public:
+    virtual ~WriterFileSystem() {}
+    virtual std::unique_ptr<WritableFile> Create(const std::wstring& path, const FileCreateOptions& options) = 0;
+    // Move from over to, replacing to if it exists, in one step.
+    virtual bool Replace(const std::wstring& from, const std::wstring& to, bool writeThrough) = 0;
+    virtual void Remove(const std::wstring& path) = 0;
+};
+
+struct FileWriteRequest
+{
+    std::wstring fileName;
+    std::vector<uint8_t> data;
+    std::chrono::steady_clock::time_point grabStarted;  // Passed through for end-to-end timing.
+    bool sideOutput = false;            // Passed through: a by-product (thumbnail), not a frame.
+};
+
+// Called on the writer thread once per file, in submit order.
+typedef std::function<void(const FileWriteRequest& request, bool ok)> FileWriteDoneFunction;
+
+struct FileWriterOptions
+{
+    size_t maxQueuedFiles = 16;         // Submit blocks beyond either limit.
+    size_t maxQueuedBytes = 256u << 20;
+    bool preallocate = true;
+    bool writeThrough = false;
+    bool noBuffering = false;
+    bool atomicRename = true;           // Write <name>.tmp, then rename it over <name>.
+    CaptureStats* stats = nullptr;      // Receives write latency and queue wait.
+};
+
+struct FileWriterStats
+{
+    uint64_t filesWritten = 0;
+    uint64_t filesFailed = 0;
+    uint64_t bytesWritten = 0;
+    size_t maxQueuedFiles = 0;          // Deepest the queue got.
+    size_t maxQueuedBytes = 0;
+    uint64_t submitStalls = 0;          // Submits that had to wait for room.
+};
+
+class AsyncFileWriter
+{
+public:
+    static const size_t kChunkBytes = 1 << 20;
+
+    AsyncFileWriter(WriterFileSystem& fileSystem, const FileWriterOptions& options,
+        const FileWriteDoneFunction& done);
+    ~AsyncFileWriter();
+
+    // Queue a file, waiting while the queue is full. A single buffer larger
+    // than maxQueuedBytes is still taken once the queue is empty. False
+    // after Finish.
+    bool Submit(FileWriteRequest request);
+
+    // Write everything queued, then stop the writer thread.
+    void Finish();
+
+    size_t QueuedFiles() const;
+    FileWriterStats Stats() const;
+
+private:
+    AsyncFileWriter(const AsyncFileWriter&) = delete;
+    AsyncFileWriter& operator=(const AsyncFileWriter&) = delete;
+
+    struct Job
+    {
+        FileWriteRequest request;
+        std::chrono::steady_clock::time_point queued;
+    };
+
+    // Submitted but not yet written; called with mutex_ held.
+    size_t Pending() const
+    {
+        return static_cast<size_t>(submitted_ - stats_.filesWritten - stats_.filesFailed);
+    }
+
+    void WriterLoop();
+    bool WriteOne(const FileWriteRequest& request, const std::wstring& path);
+
+    WriterFileSystem& fileSystem_;
+    FileWriterOptions options_;
+    FileWriteDoneFunction done_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable notFull_;
+    std::condition_variable notEmpty_;
+    std::deque<Job> queue_;
+    uint64_t submitted_ = 0;
+    size_t queuedBytes_ = 0;
+    bool closed_ = false;
+    FileWriterStats stats_;
+
+    std::thread writer_;
+};
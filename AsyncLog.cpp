@@ -0,0 +1,214 @@
+#include "AsyncLog.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace
+{
+    const size_t kSlots = 256;          // Power of two.
+    const size_t kLineChars = 512;      // Longer lines go to the slot's overflow string.
+
+    std::atomic<std::wostream*> logOutput(&std::wcout);
+
+    struct LogSlot
+    {
+        std::atomic<size_t> sequence;
+        size_t length;
+        wchar_t text[kLineChars];
+        std::wstring overflow;          // The whole line when it does not fit in text.
+    };
+
+    //-----------------------------------------------------------------
+    // Bounded multi-producer ring with a single consumer. Each slot's
+    // sequence number says whose turn it is: equal to the write position
+    // when free, one past it once filled. Producers claim a position with
+    // a compare-exchange and never wait on each other or on the console.
+    class LogRing
+    {
+    public:
+        LogRing() : enqueuePos_(0), dequeuePos_(0), queued_(0), written_(0), dropped_(0), stopping_(false)
+        {
+            for (size_t i = 0; i < kSlots; i++)
+                slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        ~LogRing()
+        {
+            if (drain_.joinable())
+            {
+                stopping_.store(true);
+                drain_.join();
+            }
+        }
+
+        void Push(const wchar_t* text, size_t length, bool mustDeliver)
+        {
+            std::call_once(started_, [this]() { drain_ = std::thread([this]() { Drain(); }); });
+            while (!TryPush(text, length))
+            {
+                if (!mustDeliver)
+                {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                std::this_thread::yield();
+            }
+        }
+
+        void Flush()
+        {
+            uint64_t target = queued_.load();
+            while (written_.load() < target)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        uint64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    private:
+        bool TryPush(const wchar_t* text, size_t length)
+        {
+            size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+            LogSlot* slot;
+            for (;;)
+            {
+                slot = &slots_[pos & (kSlots - 1)];
+                size_t sequence = slot->sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+                if (diff == 0)
+                {
+                    if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        break;
+                }
+                else if (diff < 0)
+                {
+                    return false;   // Full.
+                }
+                else
+                {
+                    pos = enqueuePos_.load(std::memory_order_relaxed);
+                }
+            }
+
+            // The slot is ours until its sequence is published, and the drain
+            // thread's once it is popped, so the overflow string needs no lock.
+            if (length > kLineChars)
+                slot->overflow.assign(text, length);
+            else
+                std::copy(text, text + length, slot->text);
+            slot->length = length;
+            slot->sequence.store(pos + 1, std::memory_order_release);
+            queued_.fetch_add(1);
+            return true;
+        }
+
+        bool TryPop(LogSlot*& slot, size_t& pos)
+        {
+            pos = dequeuePos_;
+            slot = &slots_[pos & (kSlots - 1)];
+            return slot->sequence.load(std::memory_order_acquire) == pos + 1;
+        }
+
+        void Release(LogSlot* slot, size_t pos)
+        {
+            slot->sequence.store(pos + kSlots, std::memory_order_release);
+            dequeuePos_ = pos + 1;
+        }
+
+        void Drain()
+        {
+            for (;;)
+            {
+                bool wrote = false;
+                LogSlot* slot;
+                size_t pos;
+                std::wostream& output = *logOutput.load();
+                while (TryPop(slot, pos))
+                {
+                    if (slot->length > kLineChars)
+                    {
+                        output.write(slot->overflow.data(), static_cast<std::streamsize>(slot->length));
+                        std::wstring().swap(slot->overflow);
+                    }
+                    else
+                    {
+                        output.write(slot->text, static_cast<std::streamsize>(slot->length));
+                    }
+                    Release(slot, pos);
+                    written_.fetch_add(1);
+                    wrote = true;
+                }
+                if (wrote)
+                    output.flush();
+                else if (stopping_.load())
+                    break;
+                else
+                    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+        }
+
+        LogSlot slots_[kSlots];
+        std::atomic<size_t> enqueuePos_;
+        size_t dequeuePos_;                 // Drain thread only.
+        std::atomic<uint64_t> queued_;
+        std::atomic<uint64_t> written_;
+        std::atomic<uint64_t> dropped_;
+        std::atomic<bool> stopping_;
+        std::once_flag started_;
+        std::thread drain_;
+    };
+
+    LogRing& Ring()
+    {
+        static LogRing ring;
+        return ring;
+    }
+}
+
+//---------------------------------------------------------------------
+LogLine::LogLine(bool mustDeliver)
+    : mustDeliver_(mustDeliver)
+{
+    thread_local std::wostringstream stream;
+    stream.str(std::wstring());
+    stream.clear();
+    stream.flags(std::ios_base::dec | std::ios_base::skipws);
+    stream.fill(L' ');
+    stream.precision(6);
+    stream_ = &stream;
+}
+
+LogLine::LogLine(LogLine&& other)
+    : stream_(other.stream_), mustDeliver_(other.mustDeliver_)
+{
+    other.stream_ = nullptr;
+}
+
+LogLine::~LogLine()
+{
+    if (!stream_)
+        return;
+    const std::wstring text = stream_->str();
+    if (!text.empty())
+        Ring().Push(text.data(), text.size(), mustDeliver_);
+}
+
+void FlushLog()
+{
+    Ring().Flush();
+}
+
+uint64_t LogLinesDropped()
+{
+    return Ring().Dropped();
+}
+
+void SetLogToStderr()
+{
+    logOutput.store(&std::wcerr);
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <sstream>
+
+//---------------------------------------------------------------------
+// Console output for the capture path. A finished line is copied into a
+// fixed lock-free ring and a background thread writes it to std::wcout,
+// so a slow or paused console never stalls a grab or an encoder.
+//
+//   if (verbose)
+//       LogInfo() << L"[INFO] Wrote " << size << L" bytes.\n";
+//
+// The line is queued when the temporary is destroyed. Lines from one
+// thread keep their order, and long lines are written whole. LogInfo
+// lines are dropped (and counted) when the ring is full; LogResult lines
+// wait for room, for output the user must see. Errors still go straight
+// to std::cerr.
+
+class LogLine
+{
+public:
+    explicit LogLine(bool mustDeliver);
+    LogLine(LogLine&& other);
+    ~LogLine();
+
+    template <typename T>
+    LogLine& operator<<(const T& value)
+    {
+        if (stream_)
+            *stream_ << value;
+        return *this;
+    }
+
+    LogLine& operator<<(std::wostream& (*manipulator)(std::wostream&))
+    {
+        if (stream_)
+            manipulator(*stream_);
+        return *this;
+    }
+
+private:
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    std::wostringstream* stream_;   // Per-thread, reused between lines.
+    bool mustDeliver_;
+};
+
+inline LogLine LogInfo() { return LogLine(false); }
+inline LogLine LogResult() { return LogLine(true); }
+
+// Block until every line queued so far has been written to the console.
+void FlushLog();
+
+// Lines lost because the ring was full.
+uint64_t LogLinesDropped();
+
+// Write log lines to std::wcerr from now on; used when stdout carries a
+// -o - frame stream.
+void SetLogToStderr();
@@ -0,0 +1,218 @@
+#include "BandedCapture.h"
+#include "PixelConvert.h"
+#include "QoiCodec.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    // Encoded bytes are handed to the writer once this many are waiting.
+    const size_t kWriteChunkBytes = size_t(1) << 20;
+    const size_t kWriteAlignment = 4096;
+
+    void PutU16LE(uint8_t* p, uint32_t value)
+    {
+        p[0] = static_cast<uint8_t>(value);
+        p[1] = static_cast<uint8_t>(value >> 8);
+    }
+
+    void PutU32LE(uint8_t* p, uint32_t value)
+    {
+        p[0] = static_cast<uint8_t>(value);
+        p[1] = static_cast<uint8_t>(value >> 8);
+        p[2] = static_cast<uint8_t>(value >> 16);
+        p[3] = static_cast<uint8_t>(value >> 24);
+    }
+
+    class PngRowStreamEncoder : public RowStreamEncoder
+    {
+    public:
+        explicit PngRowStreamEncoder(const PngOptions& options) : options_(options) {}
+
+        bool Begin(int width, int height, FrameFormat format, std::vector<uint8_t>& out) override
+        {
+            PngOptions options = options_;
+            options.keepAlpha = options_.keepAlpha && format == FrameFormat::Bgra32;
+            return encoder_.Begin(width, height, options, out);
+        }
+
+        bool AddRows(const FrameView& rows, std::vector<uint8_t>& out) override
+        {
+            return encoder_.AddRows(rows, out);
+        }
+
+        bool Finish(std::vector<uint8_t>& out) override
+        {
+            return encoder_.Finish(out);
+        }
+
+    private:
+        PngOptions options_;
+        PngStreamEncoder encoder_;
+    };
+
+    class QoiRowStreamEncoder : public RowStreamEncoder
+    {
+    public:
+        bool Begin(int width, int height, FrameFormat format, std::vector<uint8_t>& out) override
+        {
+            return encoder_.Begin(width, height, format, out);
+        }
+
+        bool AddRows(const FrameView& rows, std::vector<uint8_t>& out) override
+        {
+            return encoder_.AddRows(rows, out);
+        }
+
+        bool Finish(std::vector<uint8_t>& out) override
+        {
+            return encoder_.Finish(out);
+        }
+
+    private:
+        QoiStreamEncoder encoder_;
+    };
+
+    // 24-bit BI_RGB with a negative height, so rows go out in the order
+    // they arrive. Rows are padded to a multiple of four bytes.
+    class BmpRowStreamEncoder : public RowStreamEncoder
+    {
+    public:
+        bool Begin(int width, int height, FrameFormat, std::vector<uint8_t>& out) override
+        {
+            if (width <= 0 || height <= 0)
+                return false;
+            rowBytes_ = (static_cast<size_t>(width) * 3 + 3) & ~size_t(3);
+            const uint64_t imageBytes = static_cast<uint64_t>(rowBytes_) * height;
+            if (imageBytes + kHeaderBytes > 0xFFFFFFFFu)
+                return false;
+            width_ = width;
+            height_ = height;
+            rowsDone_ = 0;
+
+            uint8_t header[kHeaderBytes] = {};
+            header[0] = 'B';
+            header[1] = 'M';
+            PutU32LE(header + 2, static_cast<uint32_t>(imageBytes + kHeaderBytes));
+            PutU32LE(header + 10, kHeaderBytes);            // Offset of the pixels
+            PutU32LE(header + 14, 40);                      // BITMAPINFOHEADER
+            PutU32LE(header + 18, static_cast<uint32_t>(width));
+            PutU32LE(header + 22, static_cast<uint32_t>(-height));   // Top-down
+            PutU16LE(header + 26, 1);                       // Planes
+            PutU16LE(header + 28, 24);                      // Bits per pixel
+            PutU32LE(header + 34, static_cast<uint32_t>(imageBytes));
+            PutU32LE(header + 38, 2835);                    // 72 DPI
+            PutU32LE(header + 42, 2835);
+            out.insert(out.end(), header, header + kHeaderBytes);
+            return true;
+        }
+
+        bool AddRows(const FrameView& rows, std::vector<uint8_t>& out) override
+        {
+            if (rows.Empty() || rows.width != width_ || rowsDone_ + rows.height > height_)
+                return false;
+            size_t used = out.size();
+            // Zero-filled, which also clears the padding.
+            out.resize(used + rowBytes_ * rows.height);
+            for (int y = 0; y < rows.height; y++, used += rowBytes_)
+                BgraToBgr(rows.Row(y), out.data() + used, width_);
+            rowsDone_ += rows.height;
+            return true;
+        }
+
+        bool Finish(std::vector<uint8_t>&) override
+        {
+            return height_ > 0 && rowsDone_ == height_;
+        }
+
+    private:
+        static const uint32_t kHeaderBytes = 54;
+
+        int width_ = 0;
+        int height_ = 0;
+        int rowsDone_ = 0;
+        size_t rowBytes_ = 0;
+    };
+
+    // Hand everything but a tail of less than kWriteAlignment to write,
+    // or all of it when final, in parts of at most kWriteChunkBytes.
+    bool Drain(std::vector<uint8_t>& pending, bool final, const BandWriteFunction& write, uint64_t& written)
+    {
+        const size_t size = final ? pending.size() : pending.size() & ~(kWriteAlignment - 1);
+        for (size_t offset = 0; offset < size; )
+        {
+            const size_t part = (std::min)(kWriteChunkBytes, size - offset);
+            if (!write(pending.data() + offset, part))
+                return false;
+            offset += part;
+            written += part;
+        }
+        pending.erase(pending.begin(), pending.begin() + size);
+        return true;
+    }
+}
+
+//---------------------------------------------------------------------
+std::unique_ptr<RowStreamEncoder> CreateRowStreamEncoder(BandFormat format, const PngOptions& png)
+{
+    switch (format)
+    {
+    case BandFormat::Qoi: return std::unique_ptr<RowStreamEncoder>(new QoiRowStreamEncoder());
+    case BandFormat::Bmp: return std::unique_ptr<RowStreamEncoder>(new BmpRowStreamEncoder());
+    default: return std::unique_ptr<RowStreamEncoder>(new PngRowStreamEncoder(png));
+    }
+}
+
+int BandRowsFor(int width, int bandRows)
+{
+    if (bandRows > 0)
+        return bandRows;
+    const size_t rowBytes = static_cast<size_t>((std::max)(width, 1)) * 4;
+    return static_cast<int>((std::max)(size_t(1), kAutoBandBytes / rowBytes));
+}
+
+bool CaptureInBands(int width, int height, RowStreamEncoder& encoder, const BandedCaptureOptions& options,
+    const BandGrabFunction& grab, const BandWriteFunction& write, uint64_t* bytesWritten)
+{
+    if (bytesWritten)
+        *bytesWritten = 0;
+    if (width <= 0 || height <= 0)
+        return false;
+
+    const int bandRows = BandRowsFor(width, options.bandRows);
+    Frame band;
+    // Room for a write chunk plus the output of one more band (at most
+    // five bytes a pixel, QOI's worst case), so the buffer never has to
+    // grow, and briefly exist twice, in the middle of a capture.
+    std::vector<uint8_t> pending;
+    pending.reserve(kWriteChunkBytes + static_cast<size_t>(width) * bandRows * 5);
+    uint64_t written = 0;
+    for (int top = 0; top < height; top += bandRows)
+    {
+        const int rows = (std::min)(bandRows, height - top);
+        if (!grab(top, rows, band) || band.Width() != width || band.Height() < rows)
+            return false;
+
+        StageTimer encodeTimer(options.stats, StatStage::Encode);
+        if (top == 0 && !encoder.Begin(width, height, band.Format(), pending))
+            return false;
+        FrameView view = band.View();
+        view.height = rows;
+        if (!encoder.AddRows(view, pending))
+            return false;
+        if (top + rows == height && !encoder.Finish(pending))
+            return false;
+        encodeTimer.Stop();
+
+        if (pending.size() >= kWriteChunkBytes || top + rows == height)
+        {
+            StageTimer writeTimer(options.stats, StatStage::Write);
+            if (!Drain(pending, top + rows == height, write, written))
+                return false;
+        }
+    }
+    if (bytesWritten)
+        *bytesWritten = written;
+    return true;
+}
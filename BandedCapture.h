@@ -0,0 +1,69 @@
+#pragma once
+
+#include "CaptureStats.h"
+#include "Frame.h"
+#include "PngEncoder.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+//---------------------------------------------------------------------
+// Bounded-memory capture for -bands. Very large targets (a 16000 x 9000
+// region is 576 MB as one frame, before any encoding) are grabbed a band
+// of rows at a time; each band goes straight into a row-streaming encoder
+// and the encoded bytes straight on to the file. Peak memory is one band,
+// a write buffer of 1 MiB plus one band's output, and the encoder's
+// scratch, however tall the image.
+//
+// The bands are grabbed one after the other, so content that moves while
+// they are taken can show a seam between two bands.
+
+enum class BandFormat
+{
+    Png,
+    Qoi,
+    Bmp
+};
+
+// Encoder that takes an image as horizontal bands, top to bottom. Every
+// call appends its part of the file to out.
+class RowStreamEncoder
+{
+public:
+    virtual ~RowStreamEncoder() {}
+    virtual bool Begin(int width, int height, FrameFormat format, std::vector<uint8_t>& out) = 0;
+    virtual bool AddRows(const FrameView& rows, std::vector<uint8_t>& out) = 0;
+    // False unless every row of the image was added.
+    virtual bool Finish(std::vector<uint8_t>& out) = 0;
+};
+
+// png options only apply to Png; BMP files are 24-bit, top-down.
+std::unique_ptr<RowStreamEncoder> CreateRowStreamEncoder(BandFormat format, const PngOptions& png = PngOptions());
+
+struct BandedCaptureOptions
+{
+    int bandRows = 0;               // 0: as many rows as fit in kAutoBandBytes.
+    CaptureStats* stats = nullptr;  // Receives encode and write times.
+};
+
+// Band size used when bandRows is 0.
+const size_t kAutoBandBytes = size_t(8) << 20;
+
+// Rows per band for an image this wide.
+int BandRowsFor(int width, int bandRows);
+
+// Fill band with rows [top, top + rows) of the image; it is reused from
+// one call to the next.
+typedef std::function<bool(int top, int rows, Frame& band)> BandGrabFunction;
+// Write the next part of the file, at most 1 MiB. Every part but the
+// last is a multiple of 4096 bytes, so unbuffered file writes can take it
+// as it is.
+typedef std::function<bool(const uint8_t* data, size_t size)> BandWriteFunction;
+
+// Grab, encode and write a width x height image band by band. Stops at
+// the first grab, encode or write that fails. bytesWritten, if given,
+// receives the file size.
+bool CaptureInBands(int width, int height, RowStreamEncoder& encoder, const BandedCaptureOptions& options,
+    const BandGrabFunction& grab, const BandWriteFunction& write, uint64_t* bytesWritten = nullptr);
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Blocking FIFO with a fixed capacity, used to hand work between pipeline
+// stages. Push blocks while the queue is full (backpressure) and Pop blocks
+// while it is empty. After Close, Push fails and Pop drains what is left.
+// The items live in a ring allocated up front, so passing them through
+// the queue does not allocate.
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : items_(capacity ? capacity : 1) {}
+
+    bool Push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [&] { return closed_ || count_ < items_.size(); });
+        if (closed_)
+            return false;
+        items_[(head_ + count_) % items_.size()] = std::move(item);
+        count_++;
+        if (count_ > highWater_)
+            highWater_ = count_;
+        notEmpty_.notify_one();
+        return true;
+    }
+
+    bool Pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [&] { return closed_ || count_ != 0; });
+        if (count_ == 0)
+            return false;
+        item = std::move(items_[head_]);
+        head_ = (head_ + 1) % items_.size();
+        count_--;
+        notFull_.notify_one();
+        return true;
+    }
+
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notFull_.notify_all();
+        notEmpty_.notify_all();
+    }
+
+    size_t Size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return count_;
+    }
+
+    // Largest number of items queued at once since construction.
+    size_t HighWater() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return highWater_;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable notFull_;
+    std::condition_variable notEmpty_;
+    std::vector<T> items_;
+    size_t head_ = 0;
+    size_t count_ = 0;
+    size_t highWater_ = 0;
+    bool closed_ = false;
+};
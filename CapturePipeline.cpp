@@ -0,0 +1,134 @@
+#include "CapturePipeline.h"
+#include "BoundedQueue.h"
+#include "FramePool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+//---------------------------------------------------------------------
+PipelineStats RunCapturePipeline(const PipelineOptions& options,
+    const PipelineGrabFunction& grab,
+    const PipelineEncodeFunction& encode,
+    const PipelineWriteFunction& write)
+{
+    PipelineStats stats;
+    if (options.frameCount <= 0)
+        return stats;
+
+    int encoderThreads = options.encoderThreads;
+    if (encoderThreads <= 0)
+        encoderThreads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    int slots = options.maxFramesInFlight > 0 ? options.maxFramesInFlight : encoderThreads + 2;
+
+    FramePool<PipelineFrame> framePool(slots);
+    BoundedQueue<PipelineFrame*> encodeQueue(slots);
+
+    // Reorder buffer between the encoders and the writer. At most slots
+    // frames are in flight, so frame i can wait at i % slots without
+    // meeting another one.
+    std::mutex writeMutex;
+    std::condition_variable writeReady;
+    std::vector<PipelineFrame*> pending(slots, nullptr);
+    int framesWritten = 0;
+    int framesFailed = 0;
+    int lastFrame = options.frameCount;     // Lowered when the run is stopped early.
+
+    auto submitForWrite = [&](PipelineFrame* frame)
+        {
+            std::lock_guard<std::mutex> lock(writeMutex);
+            pending[frame->index % slots] = frame;
+            writeReady.notify_one();
+        };
+
+    std::vector<std::thread> encoders;
+    for (int t = 0; t < encoderThreads; t++)
+    {
+        encoders.emplace_back([&]()
+            {
+                PipelineFrame* frame = nullptr;
+                while (encodeQueue.Pop(frame))
+                {
+                    frame->encoded.clear();
+                    frame->ok = encode(*frame);
+                    submitForWrite(frame);
+                }
+            });
+    }
+
+    std::thread writer([&]()
+        {
+            for (int next = 1; ; next++)
+            {
+                PipelineFrame* frame = nullptr;
+                {
+                    std::unique_lock<std::mutex> lock(writeMutex);
+                    PipelineFrame*& waiting = pending[next % slots];
+                    writeReady.wait(lock, [&] { return waiting != nullptr || next > lastFrame; });
+                    if (next > lastFrame)
+                        break;
+                    frame = waiting;
+                    waiting = nullptr;
+                }
+                write(*frame);
+                if (frame->ok)
+                    framesWritten++;
+                else
+                    framesFailed++;
+                framePool.Release(frame);
+            }
+        });
+
+    // Capture stage on the calling thread.
+    ScheduleClock& clock = options.clock ? *options.clock : SystemScheduleClock();
+    RepeatScheduler scheduler(options.interval, options.overrun, clock);
+    for (int i = 1; i <= options.frameCount; i++)
+    {
+        const FrameTiming timing = scheduler.Next();
+        if (options.stop && options.stop->load())
+        {
+            std::lock_guard<std::mutex> lock(writeMutex);
+            lastFrame = i - 1;
+            writeReady.notify_one();
+            break;
+        }
+        if (options.stats)
+        {
+            options.stats->Record(StatStage::ScheduleLag, std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double, std::milli>(timing.LatenessMs())));
+        }
+        if (framePool.Available() == 0)
+            stats.captureStalls++;
+        StageTimer poolTimer(options.stats, StatStage::PoolWait);
+        PipelineFrame* frame = framePool.Acquire();
+        poolTimer.Stop();
+        frame->index = i;
+        frame->grabStarted = std::chrono::steady_clock::now();
+        // A wait for a free slot makes the grab itself that much later;
+        // read on the schedule's clock, like the rest of the timing.
+        frame->timing = timing;
+        frame->timing.grabMs = scheduler.ElapsedMs(clock.Now());
+        frame->grabTime = std::time(nullptr);
+        frame->grabTimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        frame->ok = grab(*frame);
+        stats.framesGrabbed++;
+        if (frame->ok)
+            encodeQueue.Push(frame);
+        else
+            submitForWrite(frame);
+    }
+
+    encodeQueue.Close();
+    for (std::thread& t : encoders)
+        t.join();
+    writer.join();
+
+    stats.framesWritten = framesWritten;
+    stats.framesFailed = framesFailed;
+    stats.maxEncodeQueue = encodeQueue.HighWater();
+    stats.schedule = scheduler.Summary();
+    return stats;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "CaptureStats.h"
+#include "Frame.h"
+#include "RepeatScheduler.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Pipelined -repeat capture.
+//
+//   capture (caller thread) -> bounded queue -> N encoder threads
+//                           -> reorder buffer -> writer thread
+//
+// Grabs run on their own cadence and never wait for encoding or disk I/O
+// unless every frame slot is in flight. A fixed pool of frame slots bounds
+// memory: a slot is only recycled after its frame has been written.
+
+struct PipelineFrame
+{
+    int index = 0;                  // 1-based, in capture order.
+    std::time_t grabTime = 0;       // Wall-clock time of the grab.
+    int64_t grabTimeMs = 0;         // Same, in milliseconds since the Unix epoch.
+    std::chrono::steady_clock::time_point grabStarted;  // For end-to-end frame timing.
+    FrameTiming timing;             // Slot and lateness against the -repeat schedule.
+    bool ok = false;                // False if grab or encode failed.
+    Frame image;                    // Grabbed pixels; the slot keeps its buffer between frames.
+    std::vector<uint8_t> encoded;   // Output of the encode stage.
+};
+
+struct PipelineOptions
+{
+    int frameCount = 1;
+    double interval = 0.0;          // Seconds between grabs.
+    OverrunPolicy overrun = OverrunPolicy::CatchUp;     // When a grab starts past its slot.
+    ScheduleClock* clock = nullptr; // nullptr: SystemScheduleClock().
+    int encoderThreads = 0;         // 0: one per hardware thread.
+    int maxFramesInFlight = 0;      // 0: encoderThreads + 2.
+    CaptureStats* stats = nullptr;  // Receives schedule lag and frame pool waits.
+    const std::atomic<bool>* stop = nullptr;    // Once set, no further frames are grabbed.
+};
+
+struct PipelineStats
+{
+    int framesGrabbed = 0;
+    int framesWritten = 0;
+    int framesFailed = 0;
+    int captureStalls = 0;          // Grabs that had to wait for a free slot.
+    size_t maxEncodeQueue = 0;
+    ScheduleSummary schedule;       // Lateness, skipped slots and drift of the grabs.
+};
+
+// Fill frame.image. Runs on the capture thread.
+typedef std::function<bool(PipelineFrame& frame)> PipelineGrabFunction;
+// Fill frame.encoded from frame.image. Runs concurrently on encoder threads.
+typedef std::function<bool(PipelineFrame& frame)> PipelineEncodeFunction;
+// Called once per frame in index order, on the writer thread; frame.ok
+// tells whether there is anything to write.
+typedef std::function<void(PipelineFrame& frame)> PipelineWriteFunction;
+
+PipelineStats RunCapturePipeline(const PipelineOptions& options,
+    const PipelineGrabFunction& grab,
+    const PipelineEncodeFunction& encode,
+    const PipelineWriteFunction& write);
@@ -0,0 +1,624 @@
+#include "CaptureService.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+
+namespace
+{
+    const int kMaxDepth = 16;
+
+    // Just enough JSON for request lines: one object whose values are
+    // strings, numbers, booleans or arrays of numbers. Anything else is
+    // parsed and skipped, so clients may send extra keys.
+    class JsonCursor
+    {
+    public:
+        explicit JsonCursor(const std::string& text) : p_(text.c_str()), end_(text.c_str() + text.size()) {}
+
+        void SkipSpace()
+        {
+            while (p_ < end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\r' || *p_ == '\n'))
+                p_++;
+        }
+
+        bool Consume(char c)
+        {
+            SkipSpace();
+            if (p_ < end_ && *p_ == c)
+            {
+                p_++;
+                return true;
+            }
+            return false;
+        }
+
+        char Peek()
+        {
+            SkipSpace();
+            return p_ < end_ ? *p_ : '\0';
+        }
+
+        bool AtEnd()
+        {
+            SkipSpace();
+            return p_ == end_;
+        }
+
+        bool ReadString(std::string& out)
+        {
+            out.clear();
+            if (!Consume('"'))
+                return false;
+            while (p_ < end_ && *p_ != '"')
+            {
+                char c = *p_++;
+                if (static_cast<unsigned char>(c) < 0x20)
+                    return false;
+                if (c != '\\')
+                {
+                    out += c;
+                    continue;
+                }
+                if (p_ >= end_)
+                    return false;
+                switch (*p_++)
+                {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u':
+                {
+                    uint32_t code;
+                    if (!ReadHex4(code))
+                        return false;
+                    if (code >= 0xD800 && code < 0xDC00)
+                    {
+                        uint32_t low;
+                        if (end_ - p_ < 2 || p_[0] != '\\' || p_[1] != 'u')
+                            return false;
+                        p_ += 2;
+                        if (!ReadHex4(low) || low < 0xDC00 || low >= 0xE000)
+                            return false;
+                        code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                    }
+                    AppendUtf8(code, out);
+                    break;
+                }
+                default:
+                    return false;
+                }
+            }
+            if (p_ >= end_)
+                return false;
+            p_++;
+            return true;
+        }
+
+        bool ReadNumber(double& value)
+        {
+            SkipSpace();
+            const char* start = p_;
+            if (p_ < end_ && *p_ == '-')
+                p_++;
+            while (p_ < end_ && ((*p_ >= '0' && *p_ <= '9') || *p_ == '.' || *p_ == 'e' || *p_ == 'E' ||
+                *p_ == '+' || *p_ == '-'))
+                p_++;
+            if (p_ == start)
+                return false;
+            std::string text(start, p_);
+            char* stop = nullptr;
+            value = strtod(text.c_str(), &stop);
+            return stop == text.c_str() + text.size() && std::isfinite(value);
+        }
+
+        // The raw text of a number, for ids sent as numbers.
+        bool ReadNumberText(std::string& text)
+        {
+            SkipSpace();
+            const char* start = p_;
+            double value;
+            if (!ReadNumber(value))
+                return false;
+            text.assign(start, p_);
+            return true;
+        }
+
+        bool ReadLiteral(const char* literal)
+        {
+            SkipSpace();
+            const char* q = p_;
+            for (; *literal; literal++, q++)
+            {
+                if (q >= end_ || *q != *literal)
+                    return false;
+            }
+            p_ = q;
+            return true;
+        }
+
+        bool SkipValue(int depth)
+        {
+            if (depth > kMaxDepth)
+                return false;
+            std::string scratch;
+            double number;
+            switch (Peek())
+            {
+            case '"':
+                return ReadString(scratch);
+            case 't':
+                return ReadLiteral("true");
+            case 'f':
+                return ReadLiteral("false");
+            case 'n':
+                return ReadLiteral("null");
+            case '[':
+                Consume('[');
+                if (Consume(']'))
+                    return true;
+                do
+                {
+                    if (!SkipValue(depth + 1))
+                        return false;
+                } while (Consume(','));
+                return Consume(']');
+            case '{':
+                Consume('{');
+                if (Consume('}'))
+                    return true;
+                do
+                {
+                    if (!ReadString(scratch) || !Consume(':') || !SkipValue(depth + 1))
+                        return false;
+                } while (Consume(','));
+                return Consume('}');
+            default:
+                return ReadNumber(number);
+            }
+        }
+
+    private:
+        bool ReadHex4(uint32_t& code)
+        {
+            if (end_ - p_ < 4)
+                return false;
+            code = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                char c = *p_++;
+                code <<= 4;
+                if (c >= '0' && c <= '9')
+                    code |= c - '0';
+                else if (c >= 'a' && c <= 'f')
+                    code |= c - 'a' + 10;
+                else if (c >= 'A' && c <= 'F')
+                    code |= c - 'A' + 10;
+                else
+                    return false;
+            }
+            return true;
+        }
+
+        static void AppendUtf8(uint32_t code, std::string& out)
+        {
+            if (code < 0x80)
+            {
+                out += static_cast<char>(code);
+            }
+            else if (code < 0x800)
+            {
+                out += static_cast<char>(0xC0 | (code >> 6));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+            else if (code < 0x10000)
+            {
+                out += static_cast<char>(0xE0 | (code >> 12));
+                out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+            else
+            {
+                out += static_cast<char>(0xF0 | (code >> 18));
+                out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+                out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (code & 0x3F));
+            }
+        }
+
+        const char* p_;
+        const char* end_;
+    };
+
+    bool ReadInt(JsonCursor& json, int low, int high, int& value)
+    {
+        double number;
+        if (!json.ReadNumber(number) || number != std::floor(number) || number < low || number > high)
+            return false;
+        value = static_cast<int>(number);
+        return true;
+    }
+
+    bool ReadBool(JsonCursor& json, bool& value)
+    {
+        if (json.ReadLiteral("true"))
+            value = true;
+        else if (json.ReadLiteral("false"))
+            value = false;
+        else
+            return false;
+        return true;
+    }
+
+    bool OneOf(const std::string& value, const char* const* names)
+    {
+        for (; *names; names++)
+        {
+            if (value == *names)
+                return true;
+        }
+        return false;
+    }
+
+    void AppendJsonString(const std::string& text, std::string& out)
+    {
+        out += '"';
+        for (char c : text)
+        {
+            switch (c)
+            {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+                    out += escaped;
+                }
+                else
+                {
+                    out += c;
+                }
+            }
+        }
+        out += '"';
+    }
+}
+
+//---------------------------------------------------------------------
+bool ParseServiceRequest(const std::string& line, ServiceRequest& request, std::string& error)
+{
+    static const char* const kTargets[] = { "screen", "monitor", "region", "window", "active", "all", nullptr };
+    static const char* const kFormats[] = { "png", "jpg", "qoi", "bmp", nullptr };
+
+    request = ServiceRequest();
+    error.clear();
+    JsonCursor json(line);
+    if (!json.Consume('{'))
+    {
+        error = "request must be a JSON object";
+        return false;
+    }
+    bool haveRegion = false;
+    if (!json.Consume('}'))
+    {
+        do
+        {
+            std::string key, text;
+            if (!json.ReadString(key) || !json.Consume(':'))
+            {
+                error = "malformed JSON";
+                return false;
+            }
+            bool valid = true;
+            if (key == "id")
+            {
+                valid = json.Peek() == '"' ? json.ReadString(request.id) : json.ReadNumberText(request.id);
+            }
+            else if (key == "command")
+            {
+                valid = json.ReadString(text);
+                if (text == "capture")
+                    request.command = ServiceCommand::Capture;
+                else if (text == "ping")
+                    request.command = ServiceCommand::Ping;
+                else if (text == "quit")
+                    request.command = ServiceCommand::Quit;
+                else
+                    valid = false;
+            }
+            else if (key == "target")
+            {
+                valid = json.ReadString(request.target) && OneOf(request.target, kTargets);
+            }
+            else if (key == "monitor")
+            {
+                valid = ReadInt(json, 0, 255, request.monitor);
+            }
+            else if (key == "region")
+            {
+                valid = json.Consume('[');
+                for (int i = 0; valid && i < 4; i++)
+                    valid = (i == 0 || json.Consume(',')) && ReadInt(json, -(1 << 20), 1 << 20, request.region[i]);
+                valid = valid && json.Consume(']') && request.region[2] > 0 && request.region[3] > 0;
+                haveRegion = valid;
+            }
+            else if (key == "window")
+            {
+                valid = json.ReadString(request.window);
+            }
+            else if (key == "format")
+            {
+                valid = json.ReadString(request.format) && OneOf(request.format, kFormats);
+            }
+            else if (key == "quality")
+            {
+                valid = ReadInt(json, 0, 100, request.quality);
+            }
+            else if (key == "pointer")
+            {
+                valid = ReadBool(json, request.pointer);
+            }
+            else if (key == "path")
+            {
+                valid = json.ReadString(request.path);
+            }
+            else
+            {
+                if (!json.SkipValue(0))
+                {
+                    error = "malformed JSON";
+                    return false;
+                }
+                continue;
+            }
+            if (!valid)
+            {
+                error = "invalid value for \"" + key + "\"";
+                return false;
+            }
+        } while (json.Consume(','));
+        if (!json.Consume('}'))
+        {
+            error = "malformed JSON";
+            return false;
+        }
+    }
+    if (!json.AtEnd())
+    {
+        error = "unexpected text after the request";
+        return false;
+    }
+
+    if (request.command != ServiceCommand::Capture)
+        return true;
+    if (request.target == "monitor" && request.monitor < 0)
+        error = "target \"monitor\" needs \"monitor\"";
+    else if (request.target == "region" && !haveRegion)
+        error = "target \"region\" needs \"region\": [x, y, w, h]";
+    else if (request.target == "window" && request.window.empty())
+        error = "target \"window\" needs \"window\"";
+    return error.empty();
+}
+
+std::string FormatServiceReply(const ServiceReply& reply)
+{
+    std::string json = "{\"id\": ";
+    AppendJsonString(reply.id, json);
+    if (!reply.ok)
+    {
+        json += ", \"ok\": false, \"error\": ";
+        AppendJsonString(reply.error, json);
+        json += "}";
+        return json;
+    }
+    json += ", \"ok\": true";
+    char buffer[128];
+    if (!reply.format.empty())
+    {
+        json += ", \"format\": ";
+        AppendJsonString(reply.format, json);
+        snprintf(buffer, sizeof(buffer), ", \"width\": %d, \"height\": %d, \"bytes\": %llu",
+            reply.width, reply.height, static_cast<unsigned long long>(reply.bytes));
+        json += buffer;
+    }
+    snprintf(buffer, sizeof(buffer), ", \"ms\": %.3f", reply.milliseconds);
+    json += buffer;
+    if (!reply.path.empty())
+    {
+        json += ", \"path\": ";
+        AppendJsonString(reply.path, json);
+    }
+    if (!reply.data.empty())
+    {
+        json += ", \"data\": \"";
+        json += Base64Encode(reply.data.data(), reply.data.size());
+        json += "\"";
+    }
+    json += "}";
+    return json;
+}
+
+std::string Base64Encode(const uint8_t* data, size_t size)
+{
+    static const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out((size + 2) / 3 * 4, '=');
+    char* dst = &out[0];
+    size_t i = 0;
+    for (; i + 3 <= size; i += 3)
+    {
+        uint32_t v = (uint32_t(data[i]) << 16) | (uint32_t(data[i + 1]) << 8) | data[i + 2];
+        *dst++ = kAlphabet[v >> 18];
+        *dst++ = kAlphabet[(v >> 12) & 63];
+        *dst++ = kAlphabet[(v >> 6) & 63];
+        *dst++ = kAlphabet[v & 63];
+    }
+    if (i < size)
+    {
+        uint32_t v = uint32_t(data[i]) << 16;
+        if (i + 1 < size)
+            v |= uint32_t(data[i + 1]) << 8;
+        dst[0] = kAlphabet[v >> 18];
+        dst[1] = kAlphabet[(v >> 12) & 63];
+        if (i + 1 < size)
+            dst[2] = kAlphabet[(v >> 6) & 63];
+    }
+    return out;
+}
+
+//---------------------------------------------------------------------
+bool ServiceLineBuffer::NextLine(std::string& line)
+{
+    const size_t newline = buffer_.find('\n');
+    if (newline == std::string::npos || Overflowed())
+        return false;
+    line.assign(buffer_, 0, newline);
+    buffer_.erase(0, newline + 1);
+    if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+    return true;
+}
+
+bool ServiceLineBuffer::Overflowed() const
+{
+    // The line break does not count, nor the '\r' before it.
+    size_t length = buffer_.find('\n');
+    if (length == std::string::npos)
+        length = buffer_.size();
+    else if (length > 0 && buffer_[length - 1] == '\r')
+        length--;
+    return length > kMaxServiceRequestBytes;
+}
+
+//---------------------------------------------------------------------
+// A connection and the requests of it still being worked on.
+struct CaptureService::Client
+{
+    std::shared_ptr<ServiceConnection> connection;
+    std::mutex mutex;               // Serializes replies; guards pending.
+    std::condition_variable answered;
+    int pending = 0;
+};
+
+CaptureService::CaptureService(const ServiceHandler& handler, const ServiceOptions& options)
+    : handler_(handler), queue_(options.maxQueued), stopping_(false), served_(0)
+{
+    int workers = options.workers;
+    if (workers <= 0)
+        workers = (std::max)(1, static_cast<int>(std::thread::hardware_concurrency()));
+    for (int i = 0; i < workers; i++)
+        workers_.emplace_back(&CaptureService::WorkerLoop, this);
+}
+
+CaptureService::~CaptureService()
+{
+    Stop();
+    for (auto& worker : workers_)
+        worker.join();
+}
+
+void CaptureService::Serve(const std::shared_ptr<ServiceConnection>& connection)
+{
+    std::shared_ptr<Client> client = std::make_shared<Client>();
+    client->connection = connection;
+    std::string line;
+    while (!stopping_.load() && connection->ReadLine(line))
+    {
+        if (line.find_first_not_of(" \t\r") == std::string::npos)
+            continue;
+        const auto received = std::chrono::steady_clock::now();
+        Job job;
+        std::string error;
+        if (!ParseServiceRequest(line, job.request, error))
+        {
+            ServiceReply reply;
+            reply.id = job.request.id;
+            reply.error = error;
+            Reply(*client, reply, received);
+            continue;
+        }
+        if (job.request.command != ServiceCommand::Capture)
+        {
+            ServiceReply reply;
+            reply.id = job.request.id;
+            reply.ok = true;
+            Reply(*client, reply, received);
+            if (job.request.command == ServiceCommand::Quit)
+            {
+                Stop();
+                break;
+            }
+            continue;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(client->mutex);
+            client->pending++;
+        }
+        job.client = client;
+        job.received = received;
+        const std::string id = job.request.id;
+        if (!queue_.Push(std::move(job)))
+        {
+            {
+                std::lock_guard<std::mutex> lock(client->mutex);
+                client->pending--;
+            }
+            ServiceReply reply;
+            reply.id = id;
+            reply.error = "service is stopping";
+            Reply(*client, reply, received);
+            break;
+        }
+    }
+
+    std::unique_lock<std::mutex> lock(client->mutex);
+    client->answered.wait(lock, [&] { return client->pending == 0; });
+}
+
+void CaptureService::Stop()
+{
+    stopping_.store(true);
+    queue_.Close();
+}
+
+void CaptureService::WorkerLoop()
+{
+    Job job;
+    while (queue_.Pop(job))
+    {
+        ServiceReply reply;
+        reply.id = job.request.id;
+        handler_(job.request, reply);
+        Reply(*job.client, reply, job.received);
+        {
+            std::lock_guard<std::mutex> lock(job.client->mutex);
+            job.client->pending--;
+        }
+        job.client->answered.notify_all();
+        job.client.reset();
+    }
+}
+
+void CaptureService::Reply(Client& client, ServiceReply& reply, std::chrono::steady_clock::time_point received)
+{
+    reply.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - received).count();
+    std::string line = FormatServiceReply(reply);
+    line += '\n';
+    {
+        std::lock_guard<std::mutex> lock(client.mutex);
+        client.connection->WriteLine(line);
+    }
+    served_++;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include "BoundedQueue.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Resident capture service (-serve). Clients send one JSON request per
+// line and get one JSON reply line for each:
+//
+//   {"id": "7", "target": "monitor", "monitor": 1, "format": "jpg", "quality": 80}
+//   {"id": "7", "ok": true, "format": "jpg", "width": 1920, "height": 1080, "bytes": 183211, "ms": 21.4, "data": "<base64>"}
+//
+// Requests from every connection share one queue that a fixed set of
+// worker threads works off, so a slow encode for one client does not hold
+// up the others. Replies can therefore come back out of order; the id
+// tells them apart. The transport and the capture itself are supplied by
+// the caller, so this part only deals in lines of text.
+
+enum class ServiceCommand
+{
+    Capture,
+    Ping,           // Answered at once, without queuing.
+    Quit            // Stop the service once queued requests are answered.
+};
+
+struct ServiceRequest
+{
+    ServiceCommand command = ServiceCommand::Capture;
+    std::string id;                     // Echoed in the reply, as a string.
+    std::string target = "screen";      // screen, monitor, region, window, active or all.
+    int monitor = -1;
+    int region[4] = { 0, 0, 0, 0 };     // x, y, w, h
+    std::string window;                 // Exact title, UTF-8.
+    std::string format = "png";         // png, jpg, qoi or bmp.
+    int quality = 90;
+    bool pointer = false;
+    std::string path;                   // Save here; empty: the reply carries the image.
+};
+
+// Parse one request line. Unknown keys are ignored. On failure error says
+// why, and request.id is set if the line got that far.
+bool ParseServiceRequest(const std::string& line, ServiceRequest& request, std::string& error);
+
+struct ServiceReply
+{
+    std::string id;
+    bool ok = false;
+    std::string error;
+    std::string path;                   // Where the image was saved, if it was.
+    std::string format;
+    int width = 0;
+    int height = 0;
+    size_t bytes = 0;                   // Size of the encoded image.
+    std::vector<uint8_t> data;          // Sent inline as base64 when not empty.
+    double milliseconds = 0.0;          // From receipt to reply, queue wait included.
+};
+
+// One line of JSON, without the line break.
+std::string FormatServiceReply(const ServiceReply& reply);
+
+std::string Base64Encode(const uint8_t* data, size_t size);
+
+// Longest request line a client may send.
+const size_t kMaxServiceRequestBytes = size_t(1) << 16;
+
+// Cuts the bytes a connection receives into request lines, which end in
+// "\n" or "\r\n". A line longer than kMaxServiceRequestBytes overflows the
+// buffer, whether its end has arrived or not; the client is broken or
+// hostile and the connection should be closed.
+class ServiceLineBuffer
+{
+public:
+    void Append(const char* data, size_t size) { buffer_.append(data, size); }
+
+    // Take the next complete line, without its line break. False when
+    // none is complete, or the buffer overflowed.
+    bool NextLine(std::string& line);
+
+    bool Overflowed() const;
+
+private:
+    std::string buffer_;
+};
+
+// One client of the service.
+class ServiceConnection
+{
+public:
+    virtual ~ServiceConnection() {}
+
+    // Next request line, without the line break. False once the client is
+    // gone or the connection was cancelled.
+    virtual bool ReadLine(std::string& line) = 0;
+
+    // Send one line; the line break is included. Never called from two
+    // threads at a time, but may overlap a ReadLine.
+    virtual bool WriteLine(const std::string& line) = 0;
+};
+
+// Capture for one request: fill reply.format, size and either data or
+// path. Runs concurrently on the worker threads.
+typedef std::function<void(const ServiceRequest& request, ServiceReply& reply)> ServiceHandler;
+
+struct ServiceOptions
+{
+    int workers = 0;                    // 0: one per hardware thread.
+    size_t maxQueued = 64;              // Requests waiting for a worker before reads block.
+};
+
+class CaptureService
+{
+public:
+    CaptureService(const ServiceHandler& handler, const ServiceOptions& options);
+    ~CaptureService();
+
+    // Read requests from connection until it closes or the service stops,
+    // and return once each of them has been answered. Call on a thread of
+    // its own for every connection.
+    void Serve(const std::shared_ptr<ServiceConnection>& connection);
+
+    // Take no more requests. Queued ones are still answered before the
+    // workers exit.
+    void Stop();
+    bool Stopping() const { return stopping_.load(); }
+
+    uint64_t RequestsServed() const { return served_.load(); }
+
+private:
+    CaptureService(const CaptureService&) = delete;
+    CaptureService& operator=(const CaptureService&) = delete;
+
+    struct Client;
+    struct Job
+    {
+        std::shared_ptr<Client> client;
+        ServiceRequest request;
+        std::chrono::steady_clock::time_point received;
+    };
+
+    void WorkerLoop();
+    void Reply(Client& client, ServiceReply& reply, std::chrono::steady_clock::time_point received);
+
+    ServiceHandler handler_;
+    BoundedQueue<Job> queue_;
+    std::vector<std::thread> workers_;
+    std::atomic<bool> stopping_;
+    std::atomic<uint64_t> served_;
+};
@@ -0,0 +1,443 @@
+#include "CaptureSession.h"
+#include "AsyncLog.h"
+
+#include <cstdlib>
+#include <memory>
+#include <iostream>
+
+#ifndef PW_RENDERFULLCONTENT
+#define PW_RENDERFULLCONTENT 0x00000002
+#endif
+
+using namespace Gdiplus;
+
+//---------------------------------------------------------------------
+BOOL CALLBACK MonitorEnumProc(HMONITOR hMonitor, HDC, LPRECT lprcMonitor, LPARAM dwData)
+{
+    std::vector<MonitorInfo>* monitors = reinterpret_cast<std::vector<MonitorInfo>*>(dwData);
+    MonitorInfo mi;
+    mi.rect = *lprcMonitor;
+    monitors->push_back(mi);
+    return TRUE;
+}
+
+//---------------------------------------------------------------------
+int GetEncoderClsid(const WCHAR* format, CLSID* pClsid)
+{
+    UINT num = 0, size = 0;
+    if (GetImageEncodersSize(&num, &size) != Ok || size == 0)
+        return -1;
+
+    // Allocate the correct number of bytes.
+    ImageCodecInfo* pImageCodecInfo = reinterpret_cast<ImageCodecInfo*>(malloc(size));
+    if (!pImageCodecInfo)
+        return -1;
+
+    if (GetImageEncoders(num, size, pImageCodecInfo) != Ok) {
+        free(pImageCodecInfo);
+        return -1;
+    }
+
+    int retVal = -1;
+    for (UINT j = 0; j < num; ++j)
+    {
+        if (wcscmp(pImageCodecInfo[j].MimeType, format) == 0)
+        {
+            *pClsid = pImageCodecInfo[j].Clsid;
+            retVal = static_cast<int>(j);
+            break;
+        }
+    }
+    free(pImageCodecInfo);
+    return retVal;
+}
+
+//---------------------------------------------------------------------
+// A DIB section backing a Frame: GDI draws into it and the rest of the
+// capture reads the same memory.
+struct CaptureSession::DibSection
+{
+    HBITMAP bitmap = NULL;
+    ~DibSection()
+    {
+        if (bitmap)
+            DeleteObject(bitmap);
+    }
+};
+
+//---------------------------------------------------------------------
+CaptureSession::CaptureSession(const CaptureTarget& target, bool verbose)
+    : target_(target), verbose_(verbose)
+{
+    ZeroMemory(&encoderClsid_, sizeof(encoderClsid_));
+}
+
+CaptureSession::~CaptureSession()
+{
+    if (memoryDC_)
+        DeleteDC(memoryDC_);
+    ReleaseSource();
+}
+
+bool CaptureSession::Grab(Frame& frame)
+{
+    HWND window = NULL;
+    RECT captureRect = { 0, 0, 0, 0 };
+    StageTimer lookupTimer(stats_, StatStage::WindowLookup);
+    if (!ResolveTarget(window, captureRect))
+        return false;
+    lookupTimer.Stop();
+
+    int capW = captureRect.right - captureRect.left;
+    int capH = captureRect.bottom - captureRect.top;
+    if (capW <= 0 || capH <= 0)
+    {
+        std::cerr << "Capture area is empty." << std::endl;
+        return false;
+    }
+    if (verbose_)
+        LogInfo() << L"[INFO] Capture dimensions: " << capW << L"x" << capH << L"\n";
+
+    StageTimer grabTimer(stats_, StatStage::Grab);
+    if (!AcquireSource(window) || !EnsureFrame(frame, capW, capH))
+        return false;
+    HGDIOBJ hOld = SelectObject(memoryDC_, FrameBitmap(frame));
+    if (!hOld)
+    {
+        std::cerr << "Failed to select bitmap into DC." << std::endl;
+        return false;
+    }
+
+    // For window capture, try using PrintWindow.
+    if (window)
+    {
+        BOOL printResult = PrintWindow(window, memoryDC_, PW_RENDERFULLCONTENT);
+        if (!printResult)
+        {
+            if (verbose_)
+                LogInfo() << L"[INFO] PW_RENDERFULLCONTENT failed, trying PW_CLIENTONLY...\n";
+            printResult = PrintWindow(window, memoryDC_, PW_CLIENTONLY);
+        }
+        if (!printResult)
+        {
+            if (verbose_)
+                LogInfo() << L"[INFO] PrintWindow failed; falling back to BitBlt capture...\n";
+            // Fallback: capture the full screen instead.
+            SelectObject(memoryDC_, hOld);
+            captureRect.left = 0;
+            captureRect.top = 0;
+            captureRect.right = GetSystemMetrics(SM_CXSCREEN);
+            captureRect.bottom = GetSystemMetrics(SM_CYSCREEN);
+            capW = captureRect.right - captureRect.left;
+            capH = captureRect.bottom - captureRect.top;
+            if (!AcquireSource(NULL) || !EnsureFrame(frame, capW, capH))
+                return false;
+            hOld = SelectObject(memoryDC_, FrameBitmap(frame));
+            if (!hOld || !BitBlt(memoryDC_, 0, 0, capW, capH,
+                sourceDC_, captureRect.left, captureRect.top, SRCCOPY | CAPTUREBLT))
+            {
+                std::cerr << "Fallback BitBlt failed." << std::endl;
+                if (hOld)
+                    SelectObject(memoryDC_, hOld);
+                return false;
+            }
+        }
+    }
+    else if (!BitBlt(memoryDC_, 0, 0, capW, capH,
+        sourceDC_, captureRect.left, captureRect.top, SRCCOPY | CAPTUREBLT))
+    {
+        std::cerr << "BitBlt failed." << std::endl;
+        SelectObject(memoryDC_, hOld);
+        return false;
+    }
+    grabTimer.Stop();
+
+    if (target_.drawPointer)
+    {
+        StageTimer pointerTimer(stats_, StatStage::Pointer);
+        CURSORINFO ci = { 0 };
+        ci.cbSize = sizeof(ci);
+        if (GetCursorInfo(&ci) && (ci.flags == CURSOR_SHOWING))
+        {
+            int iconX = ci.ptScreenPos.x - captureRect.left;
+            int iconY = ci.ptScreenPos.y - captureRect.top;
+            DrawIconEx(memoryDC_, iconX, iconY, ci.hCursor, 0, 0, 0, NULL, DI_NORMAL);
+            if (verbose_)
+                LogInfo() << L"[INFO] Mouse pointer drawn.\n";
+        }
+    }
+
+    // The pixels are already in the frame; GDI only has to finish drawing.
+    StageTimer readbackTimer(stats_, StatStage::Readback);
+    SelectObject(memoryDC_, hOld);
+    GdiFlush();
+    return true;
+}
+
+//---------------------------------------------------------------------
+bool CaptureSession::BandTarget(RECT& rect)
+{
+    HWND window = NULL;
+    if (target_.kind == CaptureTargetKind::ActiveWindow || target_.kind == CaptureTargetKind::Window ||
+        !ResolveTarget(window, rect))
+    {
+        return false;
+    }
+    if (rect.right <= rect.left || rect.bottom <= rect.top)
+    {
+        std::cerr << "Capture area is empty." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool CaptureSession::GrabBand(const RECT& rect, int top, int rows, Frame& frame)
+{
+    const int capW = rect.right - rect.left;
+    StageTimer grabTimer(stats_, StatStage::Grab);
+    if (!AcquireSource(NULL) || !EnsureFrame(frame, capW, rows))
+        return false;
+    HGDIOBJ hOld = SelectObject(memoryDC_, FrameBitmap(frame));
+    if (!hOld)
+    {
+        std::cerr << "Failed to select bitmap into DC." << std::endl;
+        return false;
+    }
+    if (!BitBlt(memoryDC_, 0, 0, capW, rows, sourceDC_, rect.left, rect.top + top, SRCCOPY | CAPTUREBLT))
+    {
+        std::cerr << "BitBlt failed." << std::endl;
+        SelectObject(memoryDC_, hOld);
+        return false;
+    }
+    grabTimer.Stop();
+
+    if (target_.drawPointer)
+    {
+        // Drawn into every band it overlaps; GDI clips it to the band.
+        StageTimer pointerTimer(stats_, StatStage::Pointer);
+        CURSORINFO ci = { 0 };
+        ci.cbSize = sizeof(ci);
+        if (GetCursorInfo(&ci) && (ci.flags == CURSOR_SHOWING))
+            DrawIconEx(memoryDC_, ci.ptScreenPos.x - rect.left, ci.ptScreenPos.y - rect.top - top, ci.hCursor, 0, 0, 0, NULL, DI_NORMAL);
+    }
+
+    StageTimer readbackTimer(stats_, StatStage::Readback);
+    SelectObject(memoryDC_, hOld);
+    GdiFlush();
+    return true;
+}
+
+//---------------------------------------------------------------------
+bool CaptureSession::PrepareEncoder(const std::wstring& imageFormat)
+{
+    const WCHAR* mimeType = imageFormat == L"bmp" ? L"image/bmp" : NULL;
+    if (!mimeType || GetEncoderClsid(mimeType, &encoderClsid_) < 0)
+    {
+        std::cerr << "Image encoder not found for specified format." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------
+// Work out the window (NULL for screen targets) and the rectangle to grab.
+// Monitors are only enumerated again when their count changes, and a named
+// window is only searched for again once the cached handle dies.
+bool CaptureSession::ResolveTarget(HWND& window, RECT& rect)
+{
+    window = NULL;
+    switch (target_.kind)
+    {
+    case CaptureTargetKind::ActiveWindow:
+    case CaptureTargetKind::Window:
+        if (target_.kind == CaptureTargetKind::ActiveWindow)
+        {
+            window = GetForegroundWindow();
+        }
+        else
+        {
+            if (!window_ || !IsWindow(window_))
+                window_ = FindWindowW(NULL, target_.windowTitle.c_str());
+            window = window_;
+        }
+        if (!window)
+        {
+            std::wcerr << L"Window not found." << std::endl;
+            return false;
+        }
+        if (verbose_)
+            LogInfo() << L"[INFO] Capturing window.\n";
+        if (!GetWindowRect(window, &rect))
+        {
+            std::cerr << "Failed to get window rect." << std::endl;
+            return false;
+        }
+        return true;
+
+    case CaptureTargetKind::Monitor:
+    {
+        int count = GetSystemMetrics(SM_CMONITORS);
+        if (count != monitorCount_)
+        {
+            std::vector<MonitorInfo> monitors;
+            if (!EnumDisplayMonitors(NULL, NULL, MonitorEnumProc, (LPARAM)&monitors))
+            {
+                std::cerr << "Failed to enumerate monitors." << std::endl;
+                return false;
+            }
+            if (target_.monitorIndex < 0 || target_.monitorIndex >= static_cast<int>(monitors.size()))
+            {
+                std::cerr << "Invalid monitor index." << std::endl;
+                return false;
+            }
+            monitorRect_ = monitors[target_.monitorIndex].rect;
+            monitorCount_ = count;
+        }
+        rect = monitorRect_;
+        return true;
+    }
+
+    case CaptureTargetKind::Region:
+        rect = target_.region;
+        return true;
+
+    default:
+        rect.left = 0;
+        rect.top = 0;
+        rect.right = GetSystemMetrics(SM_CXSCREEN);
+        rect.bottom = GetSystemMetrics(SM_CYSCREEN);
+        return true;
+    }
+}
+
+// Keep the DC of the current source; only switch when the window changes.
+bool CaptureSession::AcquireSource(HWND window)
+{
+    if (sourceDC_ && sourceWindow_ == window)
+        return true;
+    ReleaseSource();
+    sourceDC_ = GetDC(window ? window : GetDesktopWindow());
+    if (!sourceDC_)
+    {
+        if (window)
+            std::cerr << "Failed to get window DC." << std::endl;
+        else
+            std::cerr << "Failed to get desktop DC." << std::endl;
+        return false;
+    }
+    sourceWindow_ = window;
+    return true;
+}
+
+// Keep the memory DC for the whole session. Each frame gets its own DIB
+// section, kept for as long as the frame and the capture size stay the same,
+// so pipeline slots never share pixels.
+bool CaptureSession::EnsureFrame(Frame& frame, int width, int height)
+{
+    if (!memoryDC_)
+    {
+        memoryDC_ = CreateCompatibleDC(sourceDC_);
+        if (!memoryDC_)
+        {
+            std::cerr << "Failed to create compatible DC." << std::endl;
+            return false;
+        }
+    }
+    if (frame.Owner() == this && frame.Width() == width && frame.Height() == height)
+        return true;
+
+    BITMAPINFO info;
+    ZeroMemory(&info, sizeof(info));
+    info.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+    info.bmiHeader.biWidth = width;
+    info.bmiHeader.biHeight = -height; // Negative height gives top-down rows.
+    info.bmiHeader.biPlanes = 1;
+    info.bmiHeader.biBitCount = 32;
+    info.bmiHeader.biCompression = BI_RGB;
+    void* bits = NULL;
+    std::shared_ptr<DibSection> dib = std::make_shared<DibSection>();
+    dib->bitmap = CreateDIBSection(memoryDC_, &info, DIB_RGB_COLORS, &bits, NULL, 0);
+    if (!dib->bitmap || !bits)
+    {
+        std::cerr << "Failed to create capture bitmap." << std::endl;
+        return false;
+    }
+    frame.Adopt(dib, this, static_cast<uint8_t*>(bits), width, height,
+        static_cast<ptrdiff_t>(width) * 4, FrameFormat::Bgrx32);
+    return true;
+}
+
+HBITMAP CaptureSession::FrameBitmap(const Frame& frame)
+{
+    return static_cast<DibSection*>(frame.Storage())->bitmap;
+}
+
+void CaptureSession::ReleaseSource()
+{
+    if (sourceDC_)
+        ReleaseDC(sourceWindow_ ? sourceWindow_ : GetDesktopWindow(), sourceDC_);
+    sourceDC_ = NULL;
+    sourceWindow_ = NULL;
+}
+
+//---------------------------------------------------------------------
+GdiMonitorSource::GdiMonitorSource(bool drawPointer, bool verbose)
+    : drawPointer_(drawPointer), verbose_(verbose)
+{
+}
+
+bool GdiMonitorSource::Monitors(std::vector<DesktopRect>& monitors)
+{
+    std::vector<MonitorInfo> found;
+    if (!EnumDisplayMonitors(NULL, NULL, MonitorEnumProc, (LPARAM)&found))
+    {
+        std::cerr << "Failed to enumerate monitors." << std::endl;
+        return false;
+    }
+    std::vector<DesktopRect> layout(found.size());
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        layout[i].left = found[i].rect.left;
+        layout[i].top = found[i].rect.top;
+        layout[i].right = found[i].rect.right;
+        layout[i].bottom = found[i].rect.bottom;
+    }
+    bool changed = layout.size() != monitors_.size();
+    for (size_t i = 0; !changed && i < layout.size(); i++)
+    {
+        changed = layout[i].left != monitors_[i].left || layout[i].top != monitors_[i].top ||
+            layout[i].right != monitors_[i].right || layout[i].bottom != monitors_[i].bottom;
+    }
+    if (changed)
+    {
+        sessions_.clear();
+        for (size_t i = 0; i < found.size(); i++)
+        {
+            CaptureTarget target;
+            target.kind = CaptureTargetKind::Region;
+            target.region = found[i].rect;
+            target.drawPointer = drawPointer_;
+            sessions_.emplace_back(new CaptureSession(target, verbose_));
+            sessions_.back()->SetStats(stats_);
+        }
+        monitors_ = layout;
+        if (verbose_)
+            LogInfo() << L"[INFO] Desktop layout: " << monitors_.size() << L" monitors.\n";
+    }
+    monitors = monitors_;
+    return true;
+}
+
+bool GdiMonitorSource::Grab(int index, Frame& frame)
+{
+    if (index < 0 || index >= static_cast<int>(sessions_.size()))
+        return false;
+    return sessions_[index]->Grab(frame);
+}
+
+void GdiMonitorSource::SetStats(CaptureStats* stats)
+{
+    stats_ = stats;
+    for (auto& session : sessions_)
+        session->SetStats(stats);
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#ifndef _WIN32_WINNT
+#define _WIN32_WINNT 0x0A00
+#endif
+
+#include <windows.h>
+#include <gdiplus.h>
+
+#include "CaptureStats.h"
+#include "DesktopCapture.h"
+#include "Frame.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Structure to store monitor information.
+struct MonitorInfo {
+    RECT rect;
+};
+
+// Callback for enumerating monitors.
+BOOL CALLBACK MonitorEnumProc(HMONITOR hMonitor, HDC, LPRECT lprcMonitor, LPARAM dwData);
+
+// Retrieve the CLSID of an image encoder (e.g., PNG, JPEG, BMP).
+int GetEncoderClsid(const WCHAR* format, CLSID* pClsid);
+
+//---------------------------------------------------------------------
+// What a capture session grabs, resolved from the command line.
+enum class CaptureTargetKind
+{
+    Screen,         // Primary screen.
+    Monitor,        // One monitor by index.
+    Region,         // Rectangle in virtual-screen coordinates.
+    ActiveWindow,   // Foreground window at the time of each grab.
+    Window          // Top-level window by exact title.
+};
+
+struct CaptureTarget
+{
+    CaptureTargetKind kind = CaptureTargetKind::Screen;
+    int monitorIndex = -1;
+    RECT region = { 0, 0, 0, 0 };
+    std::wstring windowTitle;
+    bool drawPointer = false;
+};
+
+//---------------------------------------------------------------------
+// Capture state that outlives a single frame. Created once per run, it
+// keeps the source DC, the memory DC, the resolved window
+// or monitor and the image encoder settings, so a -repeat loop only pays
+// for them again when the target or its size actually changes.
+//
+// Grab must be called from one thread at a time. The encoder accessors
+// are read-only after PrepareEncoder and safe to use from any thread.
+class CaptureSession
+{
+public:
+    CaptureSession(const CaptureTarget& target, bool verbose);
+    ~CaptureSession();
+
+    // Grab the target into frame: top-down Bgrx32 in a DIB section that
+    // GDI draws into directly, so no copy is made. A frame that already
+    // holds a buffer of this session at the right size is reused.
+    bool Grab(Frame& frame);
+
+    // -bands: the screen rectangle Grab would copy. False for window
+    // targets, which PrintWindow can only draw whole.
+    bool BandTarget(RECT& rect);
+
+    // Copy rows [top, top + rows) of rect into frame, a band as wide as
+    // rect, drawing the pointer where it falls into the band.
+    bool GrabBand(const RECT& rect, int top, int rows, Frame& frame);
+
+    // Time window lookup, BitBlt/PrintWindow, pointer drawing and readback
+    // of every grab into stats (-stats). Null turns timing off.
+    void SetStats(CaptureStats* stats) { stats_ = stats; }
+
+    // Look up the GDI+ encoder for "bmp" once. Not needed for formats
+    // encoded in-process (png, jpg, seq).
+    bool PrepareEncoder(const std::wstring& imageFormat);
+    const CLSID* EncoderClsid() const { return &encoderClsid_; }
+
+private:
+    CaptureSession(const CaptureSession&) = delete;
+    CaptureSession& operator=(const CaptureSession&) = delete;
+
+    struct DibSection;
+
+    bool ResolveTarget(HWND& window, RECT& rect);
+    bool AcquireSource(HWND window);
+    bool EnsureFrame(Frame& frame, int width, int height);
+    static HBITMAP FrameBitmap(const Frame& frame);
+    void ReleaseSource();
+
+    CaptureTarget target_;
+    bool verbose_;
+    CaptureStats* stats_ = nullptr;
+
+    // Cached target resolution.
+    HWND window_ = NULL;
+    int monitorCount_ = 0;
+    RECT monitorRect_ = { 0, 0, 0, 0 };
+
+    // Source DC, tied to sourceWindow_ (NULL for the screen).
+    HWND sourceWindow_ = NULL;
+    HDC sourceDC_ = NULL;
+
+    // Memory DC that frame bitmaps are selected into while drawing.
+    HDC memoryDC_ = NULL;
+
+    CLSID encoderClsid_;
+};
+
+//---------------------------------------------------------------------
+// The attached monitors for -all, with one CaptureSession per monitor so
+// that their grabs can run on separate threads. The layout is enumerated
+// again on every call to Monitors; sessions are only rebuilt when it
+// changes.
+class GdiMonitorSource : public MonitorSource
+{
+public:
+    GdiMonitorSource(bool drawPointer, bool verbose);
+
+    bool Monitors(std::vector<DesktopRect>& monitors) override;
+    bool Grab(int index, Frame& frame) override;
+
+    void SetStats(CaptureStats* stats);
+
+private:
+    bool drawPointer_;
+    bool verbose_;
+    CaptureStats* stats_ = nullptr;
+    std::vector<DesktopRect> monitors_;
+    std::vector<std::unique_ptr<CaptureSession>> sessions_;
+};
@@ -0,0 +1,193 @@
+#include "CaptureStats.h"
+
+#include <cstdio>
+
+//---------------------------------------------------------------------
+const char* StatStageName(StatStage stage)
+{
+    switch (stage)
+    {
+    case StatStage::Frame: return "frame";
+    case StatStage::WindowLookup: return "window_lookup";
+    case StatStage::Grab: return "grab";
+    case StatStage::Pointer: return "pointer";
+    case StatStage::Readback: return "readback";
+    case StatStage::Stitch: return "stitch";
+    case StatStage::Redact: return "redact";
+    case StatStage::Compare: return "compare";
+    case StatStage::Clipboard: return "clipboard";
+    case StatStage::Annotate: return "annotate";
+    case StatStage::Resample: return "resample";
+    case StatStage::Encode: return "encode";
+    case StatStage::Write: return "write";
+    case StatStage::WriteQueue: return "write_queue";
+    case StatStage::ChangeProbe: return "change_probe";
+    case StatStage::ScheduleLag: return "schedule_lag";
+    case StatStage::PoolWait: return "pool_wait";
+    default: return "unknown";
+    }
+}
+
+//---------------------------------------------------------------------
+// LatencyHistogram
+//---------------------------------------------------------------------
+LatencyHistogram::LatencyHistogram()
+    : count_(0), sum_(0), min_(UINT64_MAX), max_(0)
+{
+    for (int i = 0; i < kBuckets; i++)
+        buckets_[i].store(0, std::memory_order_relaxed);
+}
+
+static int HighestBit(uint64_t value)
+{
+    int bit = 0;
+    if (value >> 32) { value >>= 32; bit += 32; }
+    if (value >> 16) { value >>= 16; bit += 16; }
+    if (value >> 8) { value >>= 8; bit += 8; }
+    if (value >> 4) { value >>= 4; bit += 4; }
+    if (value >> 2) { value >>= 2; bit += 2; }
+    if (value >> 1) bit += 1;
+    return bit;
+}
+
+// Values below 2^kSubBits get a bucket each; above that, every power of
+// two is split into 2^kSubBits equal buckets.
+int LatencyHistogram::BucketIndex(uint64_t value)
+{
+    if (value < (1u << kSubBits))
+        return static_cast<int>(value);
+    int exponent = HighestBit(value);
+    int shift = exponent - kSubBits;
+    int sub = static_cast<int>(value >> shift) & ((1 << kSubBits) - 1);
+    return ((shift + 1) << kSubBits) + sub;
+}
+
+uint64_t LatencyHistogram::BucketMidpoint(int index)
+{
+    if (index < (1 << kSubBits))
+        return static_cast<uint64_t>(index);
+    int shift = (index >> kSubBits) - 1;
+    uint64_t sub = static_cast<uint64_t>(index & ((1 << kSubBits) - 1));
+    uint64_t low = ((uint64_t(1) << kSubBits) + sub) << shift;
+    return low + ((uint64_t(1) << shift) >> 1);
+}
+
+void LatencyHistogram::Record(uint64_t nanoseconds)
+{
+    buckets_[BucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(nanoseconds, std::memory_order_relaxed);
+
+    uint64_t current = min_.load(std::memory_order_relaxed);
+    while (nanoseconds < current && !min_.compare_exchange_weak(current, nanoseconds, std::memory_order_relaxed))
+    {
+    }
+    current = max_.load(std::memory_order_relaxed);
+    while (nanoseconds > current && !max_.compare_exchange_weak(current, nanoseconds, std::memory_order_relaxed))
+    {
+    }
+}
+
+uint64_t LatencyHistogram::Min() const
+{
+    return Count() ? min_.load(std::memory_order_relaxed) : 0;
+}
+
+double LatencyHistogram::Mean() const
+{
+    uint64_t count = Count();
+    return count ? static_cast<double>(sum_.load(std::memory_order_relaxed)) / count : 0.0;
+}
+
+uint64_t LatencyHistogram::Percentile(double fraction) const
+{
+    uint64_t count = Count();
+    if (count == 0)
+        return 0;
+    // Nearest-rank: the smallest sample with at least fraction of all
+    // samples at or below it.
+    uint64_t rank = static_cast<uint64_t>(fraction * count + 0.999999);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; i++)
+    {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen >= rank)
+        {
+            uint64_t value = BucketMidpoint(i);
+            if (value < Min())
+                value = Min();
+            if (value > Max())
+                value = Max();
+            return value;
+        }
+    }
+    return Max();
+}
+
+//---------------------------------------------------------------------
+// CaptureStats
+//---------------------------------------------------------------------
+CaptureStats::CaptureStats()
+    : started_(Clock::now()),
+    framesGrabbed_(0), framesSkipped_(0), framesDropped_(0), framesWritten_(0), bytesWritten_(0),
+    maxWriteQueue_(0)
+{
+}
+
+void CaptureStats::Record(StatStage stage, Clock::duration elapsed)
+{
+    int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    stages_[static_cast<int>(stage)].Record(ns > 0 ? static_cast<uint64_t>(ns) : 0);
+}
+
+void CaptureStats::NoteWriteQueueDepth(uint64_t depth)
+{
+    uint64_t current = maxWriteQueue_.load(std::memory_order_relaxed);
+    while (depth > current && !maxWriteQueue_.compare_exchange_weak(current, depth, std::memory_order_relaxed))
+    {
+    }
+}
+
+std::string CaptureStats::ToJson(uint64_t logLinesDropped) const
+{
+    const double elapsed = std::chrono::duration<double>(Clock::now() - started_).count();
+    char buffer[512];
+    std::string json = "{\n  \"tool\": \"ShotCap\",\n  \"schema\": 1,\n";
+    snprintf(buffer, sizeof(buffer),
+        "  \"elapsed_s\": %.3f,\n"
+        "  \"frames\": { \"grabbed\": %llu, \"skipped\": %llu, \"dropped\": %llu, \"written\": %llu },\n"
+        "  \"bytes_written\": %llu,\n"
+        "  \"max_write_queue\": %llu,\n"
+        "  \"log_lines_dropped\": %llu,\n"
+        "  \"stages\": {",
+        elapsed,
+        static_cast<unsigned long long>(framesGrabbed_.load()),
+        static_cast<unsigned long long>(framesSkipped_.load()),
+        static_cast<unsigned long long>(framesDropped_.load()),
+        static_cast<unsigned long long>(framesWritten_.load()),
+        static_cast<unsigned long long>(bytesWritten_.load()),
+        static_cast<unsigned long long>(maxWriteQueue_.load()),
+        static_cast<unsigned long long>(logLinesDropped));
+    json += buffer;
+
+    bool first = true;
+    for (int i = 0; i < static_cast<int>(StatStage::Count); i++)
+    {
+        const LatencyHistogram& h = stages_[i];
+        if (h.Count() == 0)
+            continue;
+        const double ms = 1e-6;
+        snprintf(buffer, sizeof(buffer),
+            "%s\n    \"%s\": { \"count\": %llu, \"min_ms\": %.3f, \"mean_ms\": %.3f, \"p50_ms\": %.3f, "
+            "\"p95_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f }",
+            first ? "" : ",", StatStageName(static_cast<StatStage>(i)),
+            static_cast<unsigned long long>(h.Count()), h.Min() * ms, h.Mean() * ms,
+            h.Percentile(0.50) * ms, h.Percentile(0.95) * ms, h.Percentile(0.99) * ms, h.Max() * ms);
+        json += buffer;
+        first = false;
+    }
+    json += first ? "}\n}\n" : "\n  }\n}\n";
+    return json;
+}
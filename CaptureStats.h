@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+//---------------------------------------------------------------------
+// Per-stage latency and frame counters for -stats. Recording is lock-free
+// (atomic counters only) and safe from any thread, so the grab, encoder
+// and writer threads of the repeat pipeline all report into one object.
+
+enum class StatStage
+{
+    Frame,          // Grab start to file written, per saved frame.
+    WindowLookup,   // Resolving the window or monitor rectangle.
+    Grab,           // BitBlt or PrintWindow into the memory DC.
+    Pointer,        // Drawing the mouse pointer.
+    Readback,       // GetDIBits into the frame buffer.
+    Stitch,         // -all: composing the monitors into one frame.
+    Redact,         // -redact, in place after the grab.
+    Compare,        // -compare-live: the diff against the reference.
+    Clipboard,
+    Annotate,
+    Resample,       // -scale and -thumb.
+    Encode,
+    Write,          // Writing a file, temp file and rename included.
+    WriteQueue,     // A file waiting for the writer thread.
+    ChangeProbe,    // -onchange tile checksum.
+    ScheduleLag,    // How late a -repeat grab started against its slot.
+    PoolWait,       // Grab waiting for a free frame buffer.
+    Count
+};
+
+const char* StatStageName(StatStage stage);
+
+// Latency histogram with 16 linear sub-buckets per power of two, so any
+// percentile is reported within about 3% of the true sample. Fixed size:
+// memory does not grow with the number of frames.
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void Record(uint64_t nanoseconds);
+
+    uint64_t Count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t Min() const;
+    uint64_t Max() const { return max_.load(std::memory_order_relaxed); }
+    double Mean() const;
+    uint64_t Percentile(double fraction) const;
+
+    static const int kSubBits = 4;
+    static const int kBuckets = (64 - kSubBits + 1) << kSubBits;
+
+private:
+    static int BucketIndex(uint64_t value);
+    static uint64_t BucketMidpoint(int index);
+
+    std::atomic<uint64_t> buckets_[kBuckets];
+    std::atomic<uint64_t> count_;
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> min_;
+    std::atomic<uint64_t> max_;
+};
+
+class CaptureStats
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    CaptureStats();
+
+    void Record(StatStage stage, Clock::duration elapsed);
+
+    void AddFrameGrabbed() { framesGrabbed_.fetch_add(1, std::memory_order_relaxed); }
+    void AddFrameSkipped() { framesSkipped_.fetch_add(1, std::memory_order_relaxed); }
+    void AddFrameDropped() { framesDropped_.fetch_add(1, std::memory_order_relaxed); }
+    void AddFrameWritten() { framesWritten_.fetch_add(1, std::memory_order_relaxed); }
+    void AddBytesWritten(uint64_t bytes) { bytesWritten_.fetch_add(bytes, std::memory_order_relaxed); }
+    // Keeps the deepest the write-behind queue got.
+    void NoteWriteQueueDepth(uint64_t depth);
+
+    // Report as JSON: counters, run time and, for every stage that ran,
+    // count and min/mean/p50/p95/p99/max in milliseconds.
+    std::string ToJson(uint64_t logLinesDropped) const;
+
+private:
+    CaptureStats(const CaptureStats&) = delete;
+    CaptureStats& operator=(const CaptureStats&) = delete;
+
+    Clock::time_point started_;
+    LatencyHistogram stages_[static_cast<int>(StatStage::Count)];
+    std::atomic<uint64_t> framesGrabbed_;
+    std::atomic<uint64_t> framesSkipped_;
+    std::atomic<uint64_t> framesDropped_;
+    std::atomic<uint64_t> framesWritten_;
+    std::atomic<uint64_t> bytesWritten_;
+    std::atomic<uint64_t> maxWriteQueue_;
+};
+
+// Times a scope into stats. With a null stats pointer it does nothing, not
+// even read the clock, so call sites need no -stats checks of their own.
+class StageTimer
+{
+public:
+    StageTimer(CaptureStats* stats, StatStage stage)
+        : stats_(stats), stage_(stage)
+    {
+        if (stats_)
+            start_ = CaptureStats::Clock::now();
+    }
+
+    ~StageTimer() { Stop(); }
+
+    // Record now instead of at the end of the scope.
+    void Stop()
+    {
+        if (stats_)
+            stats_->Record(stage_, CaptureStats::Clock::now() - start_);
+        stats_ = nullptr;
+    }
+
+private:
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    CaptureStats* stats_;
+    StatStage stage_;
+    CaptureStats::Clock::time_point start_;
+};
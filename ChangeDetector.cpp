@@ -0,0 +1,203 @@
+#include "ChangeDetector.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#if defined(SHOTCAP_SSE2)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // Alpha from GDI captures is undefined, so it is masked out.
+    const uint32_t kColorMask = 0x00FFFFFF;
+
+    uint64_t FoldSignature(const uint32_t* s1, const uint32_t* s2)
+    {
+        uint64_t h = 0xCBF29CE484222325ull;
+        for (int i = 0; i < 4; i++)
+        {
+            h = (h ^ s1[i]) * 0x100000001B3ull;
+            h = (h ^ s2[i]) * 0x100000001B3ull;
+        }
+        return h;
+    }
+
+#if defined(SHOTCAP_SSE2)
+    // Accumulate one tile row: four 32-bit lanes, s1 += pixel, s2 += s1.
+    inline void AccumulateTileRow(const uint8_t* p, int pixels, uint32_t* sum1, uint32_t* sum2)
+    {
+        const __m128i mask = _mm_set1_epi32(static_cast<int>(kColorMask));
+        __m128i s1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sum1));
+        __m128i s2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sum2));
+        int x = 0;
+        for (; x + 4 <= pixels; x += 4)
+        {
+            __m128i v = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + x * 4)), mask);
+            s1 = _mm_add_epi32(s1, v);
+            s2 = _mm_add_epi32(s2, s1);
+        }
+        if (x < pixels)
+        {
+            uint32_t tail[4] = { 0, 0, 0, 0 };
+            memcpy(tail, p + x * 4, static_cast<size_t>(pixels - x) * 4);
+            __m128i v = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tail)), mask);
+            s1 = _mm_add_epi32(s1, v);
+            s2 = _mm_add_epi32(s2, s1);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sum1), s1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sum2), s2);
+    }
+#else
+    inline void AccumulateTileRow(const uint8_t* p, int pixels, uint32_t* s1, uint32_t* s2)
+    {
+        for (int x = 0; x < pixels; x += 4)
+        {
+            for (int lane = 0; lane < 4; lane++)
+            {
+                uint32_t v = 0;
+                if (x + lane < pixels)
+                    memcpy(&v, p + (x + lane) * 4, 4);
+                s1[lane] += v & kColorMask;
+                s2[lane] += s1[lane];
+            }
+        }
+    }
+#endif
+}
+
+//---------------------------------------------------------------------
+ChangeDetector::ChangeDetector(const ChangeDetectorOptions& options)
+    : options_(options)
+{
+    options_.tileSize = std::max(options_.tileSize, 4);
+    options_.rowStep = std::max(options_.rowStep, 1);
+}
+
+double ChangeDetector::Measure(const uint8_t* pixels, int width, int height, int stride)
+{
+    if (!hasReference_ || width != width_ || height != height_)
+        return 1.0;
+
+    const int tiles = tilesX_ * tilesY_;
+    ComputeSignatures(pixels, stride, phase_, current_.data());
+    const uint64_t* reference = reference_.data() + static_cast<size_t>(phase_) * tiles;
+    phase_ = (phase_ + 1) % options_.rowStep;
+
+    uint64_t changedArea = 0;
+    for (int ty = 0; ty < tilesY_; ty++)
+    {
+        int tileH = std::min(options_.tileSize, height_ - ty * options_.tileSize);
+        for (int tx = 0; tx < tilesX_; tx++)
+        {
+            int t = ty * tilesX_ + tx;
+            if (current_[t] != reference[t])
+            {
+                int tileW = std::min(options_.tileSize, width_ - tx * options_.tileSize);
+                changedArea += static_cast<uint64_t>(tileW) * tileH;
+            }
+        }
+    }
+    return static_cast<double>(changedArea) / (static_cast<double>(width_) * height_);
+}
+
+void ChangeDetector::SetReference(const uint8_t* pixels, int width, int height, int stride)
+{
+    width_ = width;
+    height_ = height;
+    tilesX_ = (width + options_.tileSize - 1) / options_.tileSize;
+    tilesY_ = (height + options_.tileSize - 1) / options_.tileSize;
+    const size_t tiles = static_cast<size_t>(tilesX_) * tilesY_;
+    reference_.resize(tiles * options_.rowStep);
+    current_.resize(tiles);
+    sum1_.resize(static_cast<size_t>(tilesX_) * 4);
+    sum2_.resize(static_cast<size_t>(tilesX_) * 4);
+    for (int phase = 0; phase < options_.rowStep; phase++)
+        ComputeSignatures(pixels, stride, phase, reference_.data() + phase * tiles);
+    hasReference_ = width > 0 && height > 0;
+}
+
+// Signatures of every tile using rows y where (y - tileTop) % rowStep == phase.
+// Rows are walked top to bottom across all tile columns to stay cache friendly.
+void ChangeDetector::ComputeSignatures(const uint8_t* pixels, int stride, int phase, uint64_t* signatures)
+{
+    const int tile = options_.tileSize;
+    std::vector<uint32_t>& s1 = sum1_;
+    std::vector<uint32_t>& s2 = sum2_;
+    for (int ty = 0; ty < tilesY_; ty++)
+    {
+        int top = ty * tile;
+        int bottom = std::min(top + tile, height_);
+        std::fill(s1.begin(), s1.end(), 0u);
+        std::fill(s2.begin(), s2.end(), 0u);
+        for (int y = top + phase; y < bottom; y += options_.rowStep)
+        {
+            const uint8_t* row = pixels + static_cast<size_t>(y) * stride;
+            for (int tx = 0; tx < tilesX_; tx++)
+            {
+                int left = tx * tile;
+                int tileW = std::min(tile, width_ - left);
+                AccumulateTileRow(row + static_cast<size_t>(left) * 4, tileW, &s1[tx * 4], &s2[tx * 4]);
+            }
+        }
+        for (int tx = 0; tx < tilesX_; tx++)
+            signatures[ty * tilesX_ + tx] = FoldSignature(&s1[tx * 4], &s2[tx * 4]);
+    }
+}
+
+//---------------------------------------------------------------------
+int RunChangeCapture(FrameSource& source, const ChangeCaptureOptions& options,
+    const ChangeFrameCallback& onFrame)
+{
+    typedef std::chrono::steady_clock Clock;
+    const auto maxGap = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(options.maxGap));
+
+    ChangeDetector detector(options.detector);
+    Frame frame;
+    int accepted = 0;
+    ScheduleClock& clock = options.clock ? *options.clock : SystemScheduleClock();
+    RepeatScheduler scheduler(options.pollInterval, options.overrun, clock);
+    auto lastAccepted = clock.Now();
+
+    while (accepted < options.frameCount)
+    {
+        FrameTiming timing = scheduler.Next();
+        if (options.stop && options.stop->load())
+            break;
+        if (options.stats)
+        {
+            options.stats->Record(StatStage::ScheduleLag, std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double, std::milli>(timing.LatenessMs())));
+        }
+        if (!source.GrabFrame(frame))
+            break;
+        const uint8_t* pixels = frame.Data();
+        const int stride = static_cast<int>(frame.Stride());
+        auto now = clock.Now();
+        StageTimer probeTimer(options.stats, StatStage::ChangeProbe);
+        double changed = detector.Measure(pixels, frame.Width(), frame.Height(), stride);
+        probeTimer.Stop();
+        bool gapExpired = options.maxGap > 0 && now - lastAccepted >= maxGap;
+        if (accepted == 0 || gapExpired || (changed > 0 && changed >= options.threshold))
+        {
+            accepted++;
+            lastAccepted = now;
+            detector.SetReference(pixels, frame.Width(), frame.Height(), stride);
+            timing.index = accepted;
+            if (!onFrame(frame, accepted, changed, timing))
+                break;
+            if (accepted >= options.frameCount)
+                break;
+        }
+        else if (options.stats)
+        {
+            options.stats->AddFrameSkipped();
+        }
+    }
+    if (options.schedule)
+        *options.schedule = scheduler.Summary();
+    return accepted;
+}
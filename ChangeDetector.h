@@ -0,0 +1,107 @@
+#pragma once
+
+#include "CaptureStats.h"
+#include "Frame.h"
+#include "RepeatScheduler.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Source of 32 bpp frames. The screen grabber implements this on Windows;
+// synthetic sources can drive the change detector anywhere.
+class FrameSource
+{
+public:
+    virtual ~FrameSource() {}
+    // Fill frame, reusing its memory where possible.
+    virtual bool GrabFrame(Frame& frame) = 0;
+};
+
+// FrameSource over a function: the screen grab behind -onchange, or a
+// scripted run of frames.
+class CallbackFrameSource : public FrameSource
+{
+public:
+    typedef std::function<bool(Frame&)> GrabFunction;
+
+    explicit CallbackFrameSource(const GrabFunction& grab) : grab_(grab) {}
+
+    bool GrabFrame(Frame& frame) override
+    {
+        return grab_(frame);
+    }
+
+private:
+    GrabFunction grab_;
+};
+
+//---------------------------------------------------------------------
+// Cheap change probe. The frame is split into tiles and each tile is
+// reduced to a 64-bit Fletcher-style signature over every rowStep-th row
+// (alpha ignored). Successive probes rotate through the row phases, so a
+// change confined to a few rows is still seen within rowStep polls.
+struct ChangeDetectorOptions
+{
+    int tileSize = 32;      // Tile edge in pixels.
+    int rowStep = 4;        // Rows sampled per tile: 1 in rowStep.
+};
+
+class ChangeDetector
+{
+public:
+    explicit ChangeDetector(const ChangeDetectorOptions& options = ChangeDetectorOptions());
+
+    // Fraction of the frame area (0..1) covered by tiles whose signature
+    // differs from the reference. Returns 1 when there is no reference or
+    // the dimensions changed.
+    double Measure(const uint8_t* pixels, int width, int height, int stride);
+
+    // Make this frame the reference. Signatures for every row phase are
+    // computed, which costs one full pass over the frame.
+    void SetReference(const uint8_t* pixels, int width, int height, int stride);
+
+private:
+    void ComputeSignatures(const uint8_t* pixels, int stride, int phase, uint64_t* signatures);
+
+    ChangeDetectorOptions options_;
+    int width_ = 0;
+    int height_ = 0;
+    int tilesX_ = 0;
+    int tilesY_ = 0;
+    int phase_ = 0;
+    bool hasReference_ = false;
+    std::vector<uint64_t> reference_;   // [phase][tile]
+    std::vector<uint64_t> current_;     // [tile]
+    std::vector<uint32_t> sum1_;        // [tile column][lane], reused by every probe.
+    std::vector<uint32_t> sum2_;
+};
+
+//---------------------------------------------------------------------
+// Change-triggered capture loop used by -onchange.
+struct ChangeCaptureOptions
+{
+    double threshold = 0.01;    // Changed-area fraction that triggers a frame.
+    double pollInterval = 0.1;  // Seconds between probes.
+    OverrunPolicy overrun = OverrunPolicy::Stretch;     // Polls never burst after a slow frame by default.
+    ScheduleClock* clock = nullptr;     // nullptr: SystemScheduleClock().
+    double maxGap = 0.0;        // Force a keyframe after this many seconds (0 = never).
+    int frameCount = 1;         // Stop after this many accepted frames.
+    ChangeDetectorOptions detector;
+    CaptureStats* stats = nullptr;  // Receives probe timings, poll lag and skipped polls.
+    const std::atomic<bool>* stop = nullptr;    // Once set, polling ends before the next probe.
+    ScheduleSummary* schedule = nullptr;        // Receives lateness and drift of the polls.
+};
+
+// Called for every accepted frame with its 1-based index, the measured
+// change fraction and the timing of the poll that took it (slot counts
+// polls, index counts accepted frames). The frame may be modified (e.g. annotated); the new
+// reference is taken before the call. Returning false aborts the loop.
+typedef std::function<bool(Frame& frame, int frameIndex, double changed, const FrameTiming& timing)> ChangeFrameCallback;
+
+// Poll source until frameCount frames were accepted or a grab fails.
+// Returns the number of accepted frames.
+int RunChangeCapture(FrameSource& source, const ChangeCaptureOptions& options,
+    const ChangeFrameCallback& onFrame);
@@ -0,0 +1,222 @@
+#include "Checksum.h"
+#include "CpuFeatures.h"
+
+#if defined(SHOTCAP_X86)
+#include <emmintrin.h>
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+//---------------------------------------------------------------------
+// Slicing-by-4 lookup tables, built once on first use.
+struct Crc32Tables
+{
+    uint32_t t[4][256];
+
+    Crc32Tables()
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+            t[0][n] = c;
+        }
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            for (int k = 1; k < 4; k++)
+                t[k][n] = (t[k - 1][n] >> 8) ^ t[0][t[k - 1][n] & 0xFF];
+        }
+    }
+};
+
+static const Crc32Tables& GetCrc32Tables()
+{
+    static const Crc32Tables tables;
+    return tables;
+}
+
+// Works on the raw (non-inverted) register value.
+static uint32_t Crc32Table(uint32_t state, const uint8_t* data, size_t size)
+{
+    const Crc32Tables& tables = GetCrc32Tables();
+    while (size >= 4)
+    {
+        state ^= static_cast<uint32_t>(data[0]) | (static_cast<uint32_t>(data[1]) << 8) |
+            (static_cast<uint32_t>(data[2]) << 16) | (static_cast<uint32_t>(data[3]) << 24);
+        state = tables.t[3][state & 0xFF] ^ tables.t[2][(state >> 8) & 0xFF] ^
+            tables.t[1][(state >> 16) & 0xFF] ^ tables.t[0][state >> 24];
+        data += 4;
+        size -= 4;
+    }
+    while (size--)
+        state = tables.t[0][(state ^ *data++) & 0xFF] ^ (state >> 8);
+    return state;
+}
+
+#if defined(SHOTCAP_X86)
+//---------------------------------------------------------------------
+// PCLMULQDQ folding (Intel white paper "Fast CRC Computation for Generic
+// Polynomials Using PCLMULQDQ"). Folds four 128-bit lanes in parallel,
+// then reduces to 32 bits with a Barrett step. size must be a multiple of
+// 16 and at least 64.
+SHOTCAP_TARGET("pclmul,sse4.1")
+static uint32_t Crc32Clmul(uint32_t state, const uint8_t* data, size_t size)
+{
+    alignas(16) static const uint64_t k1k2[] = { 0x0154442bd4ull, 0x01c6e41596ull };
+    alignas(16) static const uint64_t k3k4[] = { 0x01751997d0ull, 0x00ccaa009eull };
+    alignas(16) static const uint64_t k5k0[] = { 0x0163cd6124ull, 0x0000000000ull };
+    alignas(16) static const uint64_t poly[] = { 0x01db710641ull, 0x01f7011641ull };
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8, y5, y6, y7, y8;
+
+    x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x00));
+    x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x10));
+    x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x20));
+    x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(state)));
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+    data += 64;
+    size -= 64;
+
+    while (size >= 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        y5 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x00));
+        y6 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x10));
+        y7 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x20));
+        y8 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 0x30));
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), y5);
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), y6);
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), y7);
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), y8);
+        data += 64;
+        size -= 64;
+    }
+
+    // Fold the four lanes into one.
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // Remaining 16-byte blocks.
+    while (size >= 16)
+    {
+        x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        data += 16;
+        size -= 16;
+    }
+
+    // 128 -> 64 bits.
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+    x0 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits.
+    x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+#endif
+
+//---------------------------------------------------------------------
+uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t size)
+{
+    uint32_t state = ~crc;
+#if defined(SHOTCAP_X86)
+    static const bool useClmul = GetCpuFeatures().pclmul && GetCpuFeatures().sse41;
+    if (useClmul && size >= 64)
+    {
+        size_t chunk = size & ~static_cast<size_t>(15);
+        state = Crc32Clmul(state, data, chunk);
+        data += chunk;
+        size -= chunk;
+    }
+#endif
+    return ~Crc32Table(state, data, size);
+}
+
+//---------------------------------------------------------------------
+uint32_t Adler32(uint32_t adler, const uint8_t* data, size_t size)
+{
+    // Largest n such that 255n(n+1)/2 + (n+1)(BASE-1) fits in 32 bits.
+    const uint32_t kBase = 65521;
+    const size_t kNmax = 5552;
+
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+    while (size > 0)
+    {
+        size_t n = size < kNmax ? size : kNmax;
+        size -= n;
+        while (n >= 8)
+        {
+            a += data[0]; b += a;
+            a += data[1]; b += a;
+            a += data[2]; b += a;
+            a += data[3]; b += a;
+            a += data[4]; b += a;
+            a += data[5]; b += a;
+            a += data[6]; b += a;
+            a += data[7]; b += a;
+            data += 8;
+            n -= 8;
+        }
+        while (n--)
+        {
+            a += *data++;
+            b += a;
+        }
+        a %= kBase;
+        b %= kBase;
+    }
+    return (b << 16) | a;
+}
+
+// zlib's adler32_combine: the checksum of A followed by B from those of A
+// and B and the length of B.
+uint32_t Adler32Combine(uint32_t adler1, uint32_t adler2, uint64_t size2)
+{
+    const uint32_t kBase = 65521;
+    uint32_t remainder = static_cast<uint32_t>(size2 % kBase);
+    uint32_t a = adler1 & 0xFFFF;
+    uint32_t b = static_cast<uint32_t>((static_cast<uint64_t>(remainder) * a) % kBase);
+    a += (adler2 & 0xFFFF) + kBase - 1;
+    b += (adler1 >> 16) + (adler2 >> 16) + kBase - remainder;
+    if (a >= kBase)
+        a -= kBase;
+    if (a >= kBase)
+        a -= kBase;
+    if (b >= 2 * kBase)
+        b -= 2 * kBase;
+    if (b >= kBase)
+        b -= kBase;
+    return (b << 16) | a;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+//---------------------------------------------------------------------
+// CRC-32 (ISO-HDLC polynomial, as used by PNG and zip) and Adler-32.
+// Both follow the zlib calling convention: pass 0 (CRC) or 1 (Adler) for
+// the first call and feed the previous result back in to continue.
+
+// Uses carry-less multiplication folding when the CPU supports PCLMULQDQ
+// and a slicing-by-4 table otherwise.
+uint32_t Crc32(uint32_t crc, const uint8_t* data, size_t size);
+
+uint32_t Adler32(uint32_t adler, const uint8_t* data, size_t size);
+
+// Adler-32 of two buffers back to back, from the checksum of each and the
+// size of the second, so pieces can be checksummed in parallel.
+uint32_t Adler32Combine(uint32_t adler1, uint32_t adler2, uint64_t size2);
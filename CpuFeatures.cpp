@@ -0,0 +1,79 @@
+#include "CpuFeatures.h"
+
+#if defined(SHOTCAP_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(SHOTCAP_X86)
+//---------------------------------------------------------------------
+// Thin wrappers over the compiler-specific cpuid/xgetbv intrinsics.
+static void QueryCpuid(int leaf, int subLeaf, unsigned int regs[4])
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuidex(info, leaf, subLeaf);
+    for (int i = 0; i < 4; i++)
+        regs[i] = static_cast<unsigned int>(info[i]);
+#else
+    if (!__get_cpuid_count(static_cast<unsigned int>(leaf), static_cast<unsigned int>(subLeaf),
+        &regs[0], &regs[1], &regs[2], &regs[3]))
+    {
+        regs[0] = regs[1] = regs[2] = regs[3] = 0;
+    }
+#endif
+}
+
+static unsigned long long QueryXcr0()
+{
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int eax = 0, edx = 0;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (static_cast<unsigned long long>(edx) << 32) | eax;
+#endif
+}
+
+static CpuFeatures DetectCpuFeatures()
+{
+    CpuFeatures features;
+    unsigned int regs[4] = { 0, 0, 0, 0 };
+    QueryCpuid(0, 0, regs);
+    unsigned int maxLeaf = regs[0];
+    if (maxLeaf < 1)
+        return features;
+
+    QueryCpuid(1, 0, regs);
+    features.sse2 = (regs[3] & (1u << 26)) != 0;
+    features.ssse3 = (regs[2] & (1u << 9)) != 0;
+    features.sse41 = (regs[2] & (1u << 19)) != 0;
+    features.sse42 = (regs[2] & (1u << 20)) != 0;
+    features.pclmul = (regs[2] & (1u << 1)) != 0;
+
+    // AVX2 additionally requires the OS to save the YMM state (OSXSAVE + XCR0).
+    bool osxsave = (regs[2] & (1u << 27)) != 0;
+    bool avx = (regs[2] & (1u << 28)) != 0;
+    if (maxLeaf >= 7 && osxsave && avx && (QueryXcr0() & 0x6) == 0x6)
+    {
+        QueryCpuid(7, 0, regs);
+        features.avx2 = (regs[1] & (1u << 5)) != 0;
+    }
+    return features;
+}
+#else
+static CpuFeatures DetectCpuFeatures()
+{
+    return CpuFeatures();
+}
+#endif
+
+//---------------------------------------------------------------------
+const CpuFeatures& GetCpuFeatures()
+{
+    static const CpuFeatures features = DetectCpuFeatures();
+    return features;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+//---------------------------------------------------------------------
+// CPU feature detection shared by the SIMD code paths.
+// Everything in here is portable: it builds with MSVC on Windows and with
+// GCC/Clang on Linux so the encoders can be benchmarked headless.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SHOTCAP_X86 1
+#endif
+
+// SSE2 is part of the x64 baseline and the default for 32-bit MSVC builds.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SHOTCAP_SSE2 1
+#endif
+
+// GCC/Clang need a per-function target attribute to emit instructions that
+// are above the compile-time baseline; MSVC accepts the intrinsics as-is.
+#if defined(__GNUC__) || defined(__clang__)
+#define SHOTCAP_TARGET(features) __attribute__((target(features)))
+#else
+#define SHOTCAP_TARGET(features)
+#endif
+
+struct CpuFeatures
+{
+    bool sse2 = false;
+    bool ssse3 = false;
+    bool sse41 = false;
+    bool sse42 = false;
+    bool pclmul = false;
+    bool avx2 = false;
+};
+
+// Detected once on first use and cached for the lifetime of the process.
+const CpuFeatures& GetCpuFeatures();
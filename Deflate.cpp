@@ -0,0 +1,801 @@
+#include "Deflate.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace
+{
+    const int kMinMatch = 3;
+    const int kMaxMatch = 258;
+    const size_t kWindowSize = 32768;
+    const size_t kWindowMask = kWindowSize - 1;
+    const int kHashBits = 15;
+    const size_t kHashSize = size_t(1) << kHashBits;
+
+    // Input is compressed once this much is pending; the window slides once
+    // at least this much history can be discarded.
+    const size_t kProcessChunk = size_t(1) << 16;
+    const size_t kSlideThreshold = 8 * kWindowSize;
+
+    // A block is closed when it reaches either limit.
+    const size_t kMaxBlockSymbols = size_t(1) << 15;
+    const size_t kMaxBlockBytes = size_t(1) << 20;
+
+    const int kLitLenCodes = 286;
+    const int kDistCodes = 30;
+    const int kCodeLenCodes = 19;
+    const int kMaxCodeBits = 15;
+    const int kMaxCodeLenBits = 7;
+
+    const int kLengthBase[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    const int kLengthExtra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    const int kDistBase[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    const int kDistExtra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    const uint8_t kCodeLenOrder[kCodeLenCodes] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    //---------------------------------------------------------------------
+    // Huffman code construction.
+
+    // Compute code lengths limited to maxBits. Frequencies are flattened
+    // and the tree rebuilt until it fits, which is simple and close enough
+    // to optimal for the block sizes used here. Scratch space lives on the
+    // stack so building a block's codes never touches the heap.
+    void BuildCodeLengths(const uint32_t* freq, int count, int maxBits, uint8_t* lengths)
+    {
+        uint32_t weights[kLitLenCodes];
+        int symbols[kLitLenCodes];
+        uint64_t nodeWeight[2 * kLitLenCodes];
+        int parent[2 * kLitLenCodes];
+        int depth[2 * kLitLenCodes];
+        memcpy(weights, freq, sizeof(uint32_t) * count);
+        for (;;)
+        {
+            std::fill(lengths, lengths + count, static_cast<uint8_t>(0));
+            int leaves = 0;
+            for (int i = 0; i < count; i++)
+            {
+                if (weights[i] != 0)
+                    symbols[leaves++] = i;
+            }
+            if (leaves == 0)
+                return;
+            if (leaves == 1)
+            {
+                lengths[symbols[0]] = 1;
+                return;
+            }
+            // Ties break on symbol index; std::stable_sort could allocate.
+            std::sort(symbols, symbols + leaves,
+                [&](int a, int b) { return weights[a] < weights[b] || (weights[a] == weights[b] && a < b); });
+
+            // Two-queue construction: leaves are sorted, internal nodes are
+            // created in non-decreasing weight order.
+            int total = 2 * leaves - 1;
+            std::fill(parent, parent + total, -1);
+            std::fill(depth, depth + total, 0);
+            for (int i = 0; i < leaves; i++)
+                nodeWeight[i] = weights[symbols[i]];
+            int nextLeaf = 0, nextNode = leaves, end = leaves;
+            auto takeSmallest = [&]() -> int
+                {
+                    if (nextLeaf < leaves && (nextNode >= end || nodeWeight[nextLeaf] <= nodeWeight[nextNode]))
+                        return nextLeaf++;
+                    return nextNode++;
+                };
+            while (end < total)
+            {
+                int a = takeSmallest();
+                int b = takeSmallest();
+                nodeWeight[end] = nodeWeight[a] + nodeWeight[b];
+                parent[a] = end;
+                parent[b] = end;
+                end++;
+            }
+            int maxDepth = 0;
+            for (int i = total - 2; i >= 0; i--)
+            {
+                depth[i] = depth[parent[i]] + 1;
+                if (i < leaves)
+                    maxDepth = std::max(maxDepth, depth[i]);
+            }
+            if (maxDepth <= maxBits)
+            {
+                for (int i = 0; i < leaves; i++)
+                    lengths[symbols[i]] = static_cast<uint8_t>(depth[i]);
+                return;
+            }
+            for (int i = 0; i < count; i++)
+            {
+                if (weights[i] != 0)
+                    weights[i] = (weights[i] + 1) >> 1;
+            }
+        }
+    }
+
+    // Assign canonical codes, stored bit-reversed for LSB-first output.
+    void BuildCodes(const uint8_t* lengths, int count, uint16_t* codes)
+    {
+        int blCount[kMaxCodeBits + 1] = { 0 };
+        for (int i = 0; i < count; i++)
+            blCount[lengths[i]]++;
+        blCount[0] = 0;
+        int nextCode[kMaxCodeBits + 2] = { 0 };
+        int code = 0;
+        for (int bits = 1; bits <= kMaxCodeBits; bits++)
+        {
+            code = (code + blCount[bits - 1]) << 1;
+            nextCode[bits] = code;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            int len = lengths[i];
+            if (len == 0)
+            {
+                codes[i] = 0;
+                continue;
+            }
+            int c = nextCode[len]++;
+            int reversed = 0;
+            for (int b = 0; b < len; b++)
+            {
+                reversed = (reversed << 1) | (c & 1);
+                c >>= 1;
+            }
+            codes[i] = static_cast<uint16_t>(reversed);
+        }
+    }
+
+    // Inflaters want at least two codes in a tree to keep it complete.
+    void EnsureTwoCodes(uint32_t* freq, int count)
+    {
+        int used = 0;
+        for (int i = 0; i < count && used < 2; i++)
+        {
+            if (freq[i] != 0)
+                used++;
+        }
+        for (int i = 0; i < count && used < 2; i++)
+        {
+            if (freq[i] == 0)
+            {
+                freq[i] = 1;
+                used++;
+            }
+        }
+    }
+
+    //---------------------------------------------------------------------
+    // Static lookup tables for length/distance symbols and the fixed codes.
+    struct DeflateTables
+    {
+        uint8_t lengthCode[kMaxMatch + 1];
+        uint8_t distCodeLow[256];
+        uint8_t distCodeHigh[256];
+        uint8_t fixedLitLenBits[288];
+        uint16_t fixedLitLenCodes[288];
+        uint8_t fixedDistBits[kDistCodes];
+        uint16_t fixedDistCodes[kDistCodes];
+
+        DeflateTables()
+        {
+            for (int code = 0; code < 29; code++)
+            {
+                int last = (code == 28) ? kMaxMatch : kLengthBase[code] + (1 << kLengthExtra[code]) - 1;
+                for (int len = kLengthBase[code]; len <= last && len <= kMaxMatch; len++)
+                    lengthCode[len] = static_cast<uint8_t>(code);
+            }
+            // Distances are looked up as (dist - 1) directly below 256 and as
+            // (dist - 1) >> 7 above, where every code has at least 7 extra bits.
+            for (int code = 0; code < kDistCodes; code++)
+            {
+                int first = kDistBase[code] - 1;
+                int last = first + (1 << kDistExtra[code]) - 1;
+                for (int d = first; d <= last; d++)
+                {
+                    if (d < 256)
+                        distCodeLow[d] = static_cast<uint8_t>(code);
+                    else
+                        distCodeHigh[d >> 7] = static_cast<uint8_t>(code);
+                }
+            }
+            for (int i = 0; i < 288; i++)
+                fixedLitLenBits[i] = static_cast<uint8_t>(i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8);
+            BuildCodes(fixedLitLenBits, 288, fixedLitLenCodes);
+            for (int i = 0; i < kDistCodes; i++)
+                fixedDistBits[i] = 5;
+            BuildCodes(fixedDistBits, kDistCodes, fixedDistCodes);
+        }
+
+        int DistCode(int dist) const
+        {
+            int d = dist - 1;
+            return d < 256 ? distCodeLow[d] : distCodeHigh[d >> 7];
+        }
+    };
+
+    const DeflateTables& GetDeflateTables()
+    {
+        static const DeflateTables tables;
+        return tables;
+    }
+
+    //---------------------------------------------------------------------
+    inline int CountTrailingZeros(uint64_t value)
+    {
+#if defined(_MSC_VER) && defined(_M_X64)
+        unsigned long index;
+        _BitScanForward64(&index, value);
+        return static_cast<int>(index);
+#elif defined(_MSC_VER)
+        unsigned long index;
+        if (_BitScanForward(&index, static_cast<unsigned long>(value)))
+            return static_cast<int>(index);
+        _BitScanForward(&index, static_cast<unsigned long>(value >> 32));
+        return static_cast<int>(index) + 32;
+#else
+        return __builtin_ctzll(value);
+#endif
+    }
+
+    // Length of the common prefix of a and b, up to maxLen. Assumes a
+    // little-endian target, which covers every platform ShotCap builds for.
+    inline int MatchLength(const uint8_t* a, const uint8_t* b, int maxLen)
+    {
+        int len = 0;
+        while (len + 8 <= maxLen)
+        {
+            uint64_t x, y;
+            memcpy(&x, a + len, 8);
+            memcpy(&y, b + len, 8);
+            uint64_t diff = x ^ y;
+            if (diff != 0)
+                return len + (CountTrailingZeros(diff) >> 3);
+            len += 8;
+        }
+        while (len < maxLen && a[len] == b[len])
+            len++;
+        return len;
+    }
+
+    inline uint32_t HashAt(const uint8_t* p)
+    {
+        uint32_t v = static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+            (static_cast<uint32_t>(p[2]) << 16);
+        return (v * 2654435761u) >> (32 - kHashBits);
+    }
+}
+
+//---------------------------------------------------------------------
+bool ParseCompressionLevel(const std::string& text, CompressionLevel& level)
+{
+    if (text == "fast")
+        level = CompressionLevel::Fast;
+    else if (text == "default")
+        level = CompressionLevel::Default;
+    else if (text == "max")
+        level = CompressionLevel::Max;
+    else
+        return false;
+    return true;
+}
+
+//---------------------------------------------------------------------
+DeflateStream::DeflateStream(CompressionLevel level)
+    : head_(kHashSize, 0), prev_(kWindowSize, 0)
+{
+    symbols_.reserve(kMaxBlockSymbols);
+    Reset(level);
+}
+
+void DeflateStream::Reset(CompressionLevel level)
+{
+    switch (level)
+    {
+    case CompressionLevel::Fast:
+        maxChain_ = 8;
+        niceLength_ = 32;
+        goodLength_ = 4;
+        maxLazy_ = 16;      // In greedy mode: longest match whose positions are all hashed.
+        lazy_ = false;
+        break;
+    case CompressionLevel::Max:
+        maxChain_ = 4096;
+        niceLength_ = kMaxMatch;
+        goodLength_ = 32;
+        maxLazy_ = kMaxMatch;
+        lazy_ = true;
+        break;
+    default:
+        maxChain_ = 128;
+        niceLength_ = 128;
+        goodLength_ = 8;
+        maxLazy_ = 16;
+        lazy_ = true;
+        break;
+    }
+
+    // clear() and fill() keep the allocations from the previous stream.
+    window_.clear();
+    std::fill(head_.begin(), head_.end(), 0u);
+    std::fill(prev_.begin(), prev_.end(), 0u);
+    symbols_.clear();
+    memset(litLenFreq_, 0, sizeof(litLenFreq_));
+    memset(distFreq_, 0, sizeof(distFreq_));
+    cursor_ = 0;
+    blockStart_ = 0;
+    blockBytes_ = 0;
+    hashed_ = 0;
+    matchAvailable_ = false;
+    prevLength_ = 0;
+    prevDistance_ = 0;
+    bitBuffer_ = 0;
+    bitCount_ = 0;
+    finished_ = false;
+}
+
+void DeflateStream::Write(const uint8_t* data, size_t size, std::vector<uint8_t>& out)
+{
+    if (finished_ || size == 0)
+        return;
+    window_.insert(window_.end(), data, data + size);
+    if (window_.size() - cursor_ >= kProcessChunk + kMaxMatch)
+        Process(false, out);
+}
+
+void DeflateStream::Finish(std::vector<uint8_t>& out)
+{
+    if (finished_)
+        return;
+    Process(true, out);
+    EmitBlock(true, out);
+    AlignToByte(out);
+    finished_ = true;
+}
+
+void DeflateStream::SetDictionary(const uint8_t* data, size_t size)
+{
+    if (finished_ || cursor_ != 0 || !window_.empty())
+        return;
+    if (size > kWindowSize)
+    {
+        data += size - kWindowSize;
+        size = kWindowSize;
+    }
+    window_.assign(data, data + size);
+    for (size_t pos = 0; pos + kMinMatch <= size; pos++)
+        InsertHash(pos);
+    cursor_ = size;
+    blockStart_ = size;
+}
+
+void DeflateStream::Flush(std::vector<uint8_t>& out)
+{
+    if (finished_)
+        return;
+    Process(true, out);
+    if (blockBytes_ > 0)
+        EmitBlock(false, out);
+    PutBits(0, 3, out);         // Stored, not final
+    AlignToByte(out);
+    static const uint8_t kEmptyStored[4] = { 0x00, 0x00, 0xFF, 0xFF };
+    out.insert(out.end(), kEmptyStored, kEmptyStored + 4);
+}
+
+//---------------------------------------------------------------------
+// Compress pending input. Without flush, the last kMaxMatch bytes stay
+// buffered so every match search sees full lookahead.
+void DeflateStream::Process(bool flush, std::vector<uint8_t>& out)
+{
+    SlideWindow();
+    size_t size = window_.size();
+    size_t end = flush ? size : (size > static_cast<size_t>(kMaxMatch) ? size - kMaxMatch : 0);
+    if (cursor_ < end)
+    {
+        if (lazy_)
+            CompressLazy(end, out);
+        else
+            CompressGreedy(end, out);
+    }
+    if (flush && matchAvailable_)
+    {
+        // Resolve the lazy candidate left at the end of the input.
+        if (prevLength_ >= kMinMatch)
+        {
+            AddMatch(prevLength_, prevDistance_, out);
+            cursor_ = cursor_ - 1 + prevLength_;
+        }
+        else
+        {
+            AddLiteral(window_[cursor_ - 1], out);
+        }
+        matchAvailable_ = false;
+        prevLength_ = 0;
+    }
+}
+
+void DeflateStream::CompressGreedy(size_t end, std::vector<uint8_t>& out)
+{
+    size_t pos = cursor_;
+    while (pos < end)
+    {
+        InsertHash(pos);
+        int distance = 0;
+        int length = FindMatch(pos, kMinMatch - 1, distance);
+        if (length >= kMinMatch)
+        {
+            AddMatch(length, distance, out);
+            if (length <= maxLazy_)
+            {
+                for (size_t p = pos + 1; p < pos + length; p++)
+                    InsertHash(p);
+            }
+            pos += length;
+        }
+        else
+        {
+            AddLiteral(window_[pos], out);
+            pos++;
+        }
+    }
+    cursor_ = pos;
+}
+
+// zlib-style lazy evaluation: a match is only taken if the match starting
+// one byte later is not longer.
+void DeflateStream::CompressLazy(size_t end, std::vector<uint8_t>& out)
+{
+    size_t pos = cursor_;
+    while (pos < end)
+    {
+        InsertHash(pos);
+        int distance = 0;
+        int length = 0;
+        if (!matchAvailable_ || prevLength_ < maxLazy_)
+            length = FindMatch(pos, matchAvailable_ ? std::max(prevLength_, kMinMatch - 1) : kMinMatch - 1, distance);
+
+        if (matchAvailable_ && prevLength_ >= kMinMatch && length <= prevLength_)
+        {
+            AddMatch(prevLength_, prevDistance_, out);
+            size_t matchEnd = pos - 1 + prevLength_;
+            for (size_t p = pos + 1; p < matchEnd; p++)
+                InsertHash(p);
+            pos = matchEnd;
+            matchAvailable_ = false;
+            prevLength_ = 0;
+            continue;
+        }
+        if (matchAvailable_)
+            AddLiteral(window_[pos - 1], out);
+        matchAvailable_ = true;
+        prevLength_ = length;
+        prevDistance_ = distance;
+        pos++;
+    }
+    cursor_ = pos;
+}
+
+void DeflateStream::InsertHash(size_t pos)
+{
+    if (pos < hashed_ || pos + kMinMatch > window_.size())
+        return;
+    uint32_t h = HashAt(&window_[pos]);
+    prev_[pos & kWindowMask] = head_[h];
+    head_[h] = static_cast<uint32_t>(pos + 1);
+    hashed_ = pos + 1;
+}
+
+// Returns the longest match at pos that is longer than prevLength, or 0.
+int DeflateStream::FindMatch(size_t pos, int prevLength, int& distance) const
+{
+    size_t avail = window_.size() - pos;
+    int maxLen = avail < static_cast<size_t>(kMaxMatch) ? static_cast<int>(avail) : kMaxMatch;
+    if (maxLen < kMinMatch || prevLength >= maxLen)
+        return 0;
+
+    int best = prevLength;
+    int chain = maxChain_;
+    if (prevLength >= goodLength_)
+        chain >>= 2;
+    int nice = std::min(niceLength_, maxLen);
+    size_t minPos = pos > kWindowSize ? pos - kWindowSize : 0;
+    const uint8_t* scan = &window_[pos];
+
+    uint32_t entry = head_[HashAt(scan)];
+    if (entry == pos + 1)
+        entry = prev_[pos & kWindowMask];
+    while (entry != 0 && chain-- > 0)
+    {
+        size_t cand = entry - 1;
+        if (cand < minPos || cand >= pos)
+            break;
+        const uint8_t* match = &window_[cand];
+        if (match[best] == scan[best] && match[0] == scan[0] && match[1] == scan[1])
+        {
+            int len = MatchLength(match, scan, maxLen);
+            if (len > best)
+            {
+                best = len;
+                distance = static_cast<int>(pos - cand);
+                if (len >= nice)
+                    break;
+            }
+        }
+        uint32_t next = prev_[cand & kWindowMask];
+        if (next >= entry)
+            break;
+        entry = next;
+    }
+    return best > prevLength ? best : 0;
+}
+
+void DeflateStream::AddLiteral(uint8_t value, std::vector<uint8_t>& out)
+{
+    Symbol s = { value, 0 };
+    symbols_.push_back(s);
+    litLenFreq_[value]++;
+    blockBytes_ += 1;
+    if (symbols_.size() >= kMaxBlockSymbols || blockBytes_ >= kMaxBlockBytes)
+        EmitBlock(false, out);
+}
+
+void DeflateStream::AddMatch(int length, int distance, std::vector<uint8_t>& out)
+{
+    const DeflateTables& tables = GetDeflateTables();
+    Symbol s = { static_cast<uint16_t>(length), static_cast<uint16_t>(distance) };
+    symbols_.push_back(s);
+    litLenFreq_[257 + tables.lengthCode[length]]++;
+    distFreq_[tables.DistCode(distance)]++;
+    blockBytes_ += length;
+    if (symbols_.size() >= kMaxBlockSymbols || blockBytes_ >= kMaxBlockBytes)
+        EmitBlock(false, out);
+}
+
+//---------------------------------------------------------------------
+// Write the open block using the cheapest of dynamic, fixed and stored.
+void DeflateStream::EmitBlock(bool final, std::vector<uint8_t>& out)
+{
+    const DeflateTables& tables = GetDeflateTables();
+    litLenFreq_[256]++;
+
+    uint8_t litLenBits[kLitLenCodes];
+    uint8_t distBits[kDistCodes];
+    uint16_t litLenCodes[kLitLenCodes];
+    uint16_t distCodes[kDistCodes];
+    uint32_t distFreq[kDistCodes];
+    memcpy(distFreq, distFreq_, sizeof(distFreq));
+    EnsureTwoCodes(distFreq, kDistCodes);
+    uint32_t litLenFreq[kLitLenCodes];
+    memcpy(litLenFreq, litLenFreq_, sizeof(litLenFreq));
+    EnsureTwoCodes(litLenFreq, kLitLenCodes);
+    BuildCodeLengths(litLenFreq, kLitLenCodes, kMaxCodeBits, litLenBits);
+    BuildCodeLengths(distFreq, kDistCodes, kMaxCodeBits, distBits);
+    BuildCodes(litLenBits, kLitLenCodes, litLenCodes);
+    BuildCodes(distBits, kDistCodes, distCodes);
+
+    int hlit = kLitLenCodes;
+    while (hlit > 257 && litLenBits[hlit - 1] == 0)
+        hlit--;
+    int hdist = kDistCodes;
+    while (hdist > 1 && distBits[hdist - 1] == 0)
+        hdist--;
+
+    // Run-length encode the concatenated code lengths.
+    uint8_t allBits[kLitLenCodes + kDistCodes];
+    memcpy(allBits, litLenBits, hlit);
+    memcpy(allBits + hlit, distBits, hdist);
+    int allCount = hlit + hdist;
+    // Each code length produces at most one symbol.
+    std::pair<uint8_t, uint8_t> clSymbols[kLitLenCodes + kDistCodes];      // (symbol, extra value)
+    int clCount = 0;
+    uint32_t clFreq[kCodeLenCodes] = { 0 };
+    for (int i = 0; i < allCount;)
+    {
+        uint8_t value = allBits[i];
+        int run = 1;
+        while (i + run < allCount && allBits[i + run] == value)
+            run++;
+        i += run;
+        if (value == 0)
+        {
+            while (run >= 11)
+            {
+                int r = std::min(run, 138);
+                clSymbols[clCount++] = std::make_pair(static_cast<uint8_t>(18), static_cast<uint8_t>(r - 11));
+                run -= r;
+            }
+            if (run >= 3)
+            {
+                clSymbols[clCount++] = std::make_pair(static_cast<uint8_t>(17), static_cast<uint8_t>(run - 3));
+                run = 0;
+            }
+        }
+        else
+        {
+            clSymbols[clCount++] = std::make_pair(value, static_cast<uint8_t>(0));
+            run--;
+            while (run >= 3)
+            {
+                int r = std::min(run, 6);
+                clSymbols[clCount++] = std::make_pair(static_cast<uint8_t>(16), static_cast<uint8_t>(r - 3));
+                run -= r;
+            }
+        }
+        while (run-- > 0)
+            clSymbols[clCount++] = std::make_pair(value, static_cast<uint8_t>(0));
+    }
+    for (int i = 0; i < clCount; i++)
+        clFreq[clSymbols[i].first]++;
+    uint8_t clBits[kCodeLenCodes];
+    uint16_t clCodes[kCodeLenCodes];
+    BuildCodeLengths(clFreq, kCodeLenCodes, kMaxCodeLenBits, clBits);
+    BuildCodes(clBits, kCodeLenCodes, clCodes);
+    int hclen = kCodeLenCodes;
+    while (hclen > 4 && clBits[kCodeLenOrder[hclen - 1]] == 0)
+        hclen--;
+
+    // Cost of each block type in bits.
+    uint64_t extraBits = 0;
+    for (int i = 0; i < 29; i++)
+        extraBits += static_cast<uint64_t>(litLenFreq_[257 + i]) * kLengthExtra[i];
+    for (int i = 0; i < kDistCodes; i++)
+        extraBits += static_cast<uint64_t>(distFreq_[i]) * kDistExtra[i];
+    uint64_t dynamicBits = 3 + 5 + 5 + 4 + 3 * static_cast<uint64_t>(hclen) + extraBits;
+    for (int i = 0; i < kCodeLenCodes; i++)
+        dynamicBits += static_cast<uint64_t>(clFreq[i]) * clBits[i];
+    dynamicBits += 2 * static_cast<uint64_t>(clFreq[16]) + 3 * static_cast<uint64_t>(clFreq[17]) +
+        7 * static_cast<uint64_t>(clFreq[18]);
+    uint64_t fixedBits = 3 + extraBits;
+    for (int i = 0; i < kLitLenCodes; i++)
+    {
+        dynamicBits += static_cast<uint64_t>(litLenFreq_[i]) * litLenBits[i];
+        fixedBits += static_cast<uint64_t>(litLenFreq_[i]) * tables.fixedLitLenBits[i];
+    }
+    for (int i = 0; i < kDistCodes; i++)
+    {
+        dynamicBits += static_cast<uint64_t>(distFreq_[i]) * distBits[i];
+        fixedBits += static_cast<uint64_t>(distFreq_[i]) * 5;
+    }
+    size_t storedChunks = blockBytes_ == 0 ? 1 : (blockBytes_ + 65534) / 65535;
+    uint64_t storedBits = storedChunks * (3 + 7 + 32) + 8 * static_cast<uint64_t>(blockBytes_);
+
+    if (storedBits < dynamicBits && storedBits < fixedBits)
+    {
+        const uint8_t* data = window_.data() + blockStart_;
+        size_t remaining = blockBytes_;
+        do
+        {
+            size_t chunk = std::min(remaining, static_cast<size_t>(65535));
+            remaining -= chunk;
+            PutBits((final && remaining == 0) ? 1 : 0, 1, out);
+            PutBits(0, 2, out);
+            AlignToByte(out);
+            out.push_back(static_cast<uint8_t>(chunk & 0xFF));
+            out.push_back(static_cast<uint8_t>(chunk >> 8));
+            out.push_back(static_cast<uint8_t>(~chunk & 0xFF));
+            out.push_back(static_cast<uint8_t>((~chunk >> 8) & 0xFF));
+            out.insert(out.end(), data, data + chunk);
+            data += chunk;
+        } while (remaining > 0);
+    }
+    else
+    {
+        const uint8_t* lBits = litLenBits;
+        const uint16_t* lCodes = litLenCodes;
+        const uint8_t* dBits = distBits;
+        const uint16_t* dCodes = distCodes;
+        if (fixedBits <= dynamicBits)
+        {
+            PutBits(final ? 1 : 0, 1, out);
+            PutBits(1, 2, out);
+            lBits = tables.fixedLitLenBits;
+            lCodes = tables.fixedLitLenCodes;
+            dBits = tables.fixedDistBits;
+            dCodes = tables.fixedDistCodes;
+        }
+        else
+        {
+            PutBits(final ? 1 : 0, 1, out);
+            PutBits(2, 2, out);
+            PutBits(hlit - 257, 5, out);
+            PutBits(hdist - 1, 5, out);
+            PutBits(hclen - 4, 4, out);
+            for (int i = 0; i < hclen; i++)
+                PutBits(clBits[kCodeLenOrder[i]], 3, out);
+            for (int i = 0; i < clCount; i++)
+            {
+                const auto& s = clSymbols[i];
+                PutBits(clCodes[s.first], clBits[s.first], out);
+                if (s.first == 16)
+                    PutBits(s.second, 2, out);
+                else if (s.first == 17)
+                    PutBits(s.second, 3, out);
+                else if (s.first == 18)
+                    PutBits(s.second, 7, out);
+            }
+        }
+        for (const Symbol& s : symbols_)
+        {
+            if (s.dist == 0)
+            {
+                PutBits(lCodes[s.litLen], lBits[s.litLen], out);
+                continue;
+            }
+            int lc = tables.lengthCode[s.litLen];
+            PutBits(lCodes[257 + lc], lBits[257 + lc], out);
+            if (kLengthExtra[lc])
+                PutBits(s.litLen - kLengthBase[lc], kLengthExtra[lc], out);
+            int dc = tables.DistCode(s.dist);
+            PutBits(dCodes[dc], dBits[dc], out);
+            if (kDistExtra[dc])
+                PutBits(s.dist - kDistBase[dc], kDistExtra[dc], out);
+        }
+        PutBits(lCodes[256], lBits[256], out);
+    }
+
+    symbols_.clear();
+    memset(litLenFreq_, 0, sizeof(litLenFreq_));
+    memset(distFreq_, 0, sizeof(distFreq_));
+    blockStart_ += blockBytes_;
+    blockBytes_ = 0;
+}
+
+//---------------------------------------------------------------------
+// Drop history that can no longer be referenced. The amount dropped is a
+// multiple of the window size so prev_ slots stay valid.
+void DeflateStream::SlideWindow()
+{
+    size_t keepFrom = std::min(cursor_ > kWindowSize ? cursor_ - kWindowSize : 0, blockStart_);
+    size_t drop = keepFrom & ~kWindowMask;
+    if (drop < kSlideThreshold)
+        return;
+    window_.erase(window_.begin(), window_.begin() + drop);
+    cursor_ -= drop;
+    blockStart_ -= drop;
+    hashed_ = hashed_ > drop ? hashed_ - drop : 0;
+    uint32_t d = static_cast<uint32_t>(drop);
+    for (uint32_t& entry : head_)
+        entry = entry > d ? entry - d : 0;
+    for (uint32_t& entry : prev_)
+        entry = entry > d ? entry - d : 0;
+}
+
+//---------------------------------------------------------------------
+void DeflateStream::PutBits(uint32_t value, int count, std::vector<uint8_t>& out)
+{
+    bitBuffer_ |= static_cast<uint64_t>(value) << bitCount_;
+    bitCount_ += count;
+    if (bitCount_ >= 32)
+    {
+        uint32_t word = static_cast<uint32_t>(bitBuffer_);
+        out.push_back(static_cast<uint8_t>(word));
+        out.push_back(static_cast<uint8_t>(word >> 8));
+        out.push_back(static_cast<uint8_t>(word >> 16));
+        out.push_back(static_cast<uint8_t>(word >> 24));
+        bitBuffer_ >>= 32;
+        bitCount_ -= 32;
+    }
+}
+
+void DeflateStream::AlignToByte(std::vector<uint8_t>& out)
+{
+    while (bitCount_ > 0)
+    {
+        out.push_back(static_cast<uint8_t>(bitBuffer_));
+        bitBuffer_ >>= 8;
+        bitCount_ = bitCount_ > 8 ? bitCount_ - 8 : 0;
+    }
+    bitBuffer_ = 0;
+}
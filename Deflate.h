@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Compression presets shared by the in-process encoders (-compress).
+enum class CompressionLevel
+{
+    Fast,       // Greedy matching, short hash chains.
+    Default,    // Lazy matching, moderate chains.
+    Max         // Lazy matching, long chains.
+};
+
+// Parse "fast", "default" or "max" (case-sensitive, lower case).
+bool ParseCompressionLevel(const std::string& text, CompressionLevel& level);
+
+//---------------------------------------------------------------------
+// Streaming raw deflate (RFC 1951) compressor.
+//
+// Input is buffered internally and compressed in blocks; each block is
+// emitted with whichever of dynamic Huffman, fixed Huffman or stored
+// coding is smallest. Output bytes are appended to the caller's vector.
+// The zlib/PNG wrapper (header and Adler-32) is the caller's job.
+class DeflateStream
+{
+public:
+    explicit DeflateStream(CompressionLevel level);
+
+    // Start a new stream, keeping the window and hash table allocations.
+    void Reset(CompressionLevel level);
+
+    // Compress size bytes. Output may lag behind input until Finish().
+    void Write(const uint8_t* data, size_t size, std::vector<uint8_t>& out);
+
+    // Compress everything buffered and write the final block.
+    void Finish(std::vector<uint8_t>& out);
+
+    // Let matches refer back into data (its last 32 KiB), as if it had been
+    // compressed just before. Call right after Reset(), before any Write().
+    void SetDictionary(const uint8_t* data, size_t size);
+
+    // Compress everything buffered and close the block with an empty stored
+    // block (a zlib sync flush), leaving the output byte-aligned. Streams
+    // flushed this way can be joined back to back, the last one ending with
+    // Finish(); a stream primed with the tail of the one before it keeps
+    // most of the ratio of a single stream.
+    void Flush(std::vector<uint8_t>& out);
+
+private:
+    struct Symbol
+    {
+        uint16_t litLen;    // Literal byte, or match length when dist != 0.
+        uint16_t dist;      // Match distance, 0 for literals.
+    };
+
+    void Process(bool flush, std::vector<uint8_t>& out);
+    void CompressGreedy(size_t end, std::vector<uint8_t>& out);
+    void CompressLazy(size_t end, std::vector<uint8_t>& out);
+    void InsertHash(size_t pos);
+    int FindMatch(size_t pos, int prevLength, int& distance) const;
+    void AddLiteral(uint8_t value, std::vector<uint8_t>& out);
+    void AddMatch(int length, int distance, std::vector<uint8_t>& out);
+    void EmitBlock(bool final, std::vector<uint8_t>& out);
+    void SlideWindow();
+
+    void PutBits(uint32_t value, int count, std::vector<uint8_t>& out);
+    void AlignToByte(std::vector<uint8_t>& out);
+
+    // Level parameters.
+    int maxChain_;
+    int niceLength_;
+    int goodLength_;
+    int maxLazy_;
+    bool lazy_;
+
+    // Sliding window: history (up to 32 KiB) followed by pending input.
+    std::vector<uint8_t> window_;
+    size_t cursor_ = 0;         // Next position to compress.
+    size_t blockStart_ = 0;     // First input byte of the open block.
+    size_t blockBytes_ = 0;     // Input bytes covered by the open block.
+    size_t hashed_ = 0;         // Positions below this are in the hash chains.
+
+    // Hash chains hold position + 1, so 0 means "empty".
+    std::vector<uint32_t> head_;
+    std::vector<uint32_t> prev_;
+
+    // Symbols of the open block and their frequencies.
+    std::vector<Symbol> symbols_;
+    uint32_t litLenFreq_[286];
+    uint32_t distFreq_[30];
+
+    // Lazy matching carries one pending match across Process() calls.
+    bool matchAvailable_ = false;
+    int prevLength_ = 0;
+    int prevDistance_ = 0;
+
+    uint64_t bitBuffer_ = 0;
+    int bitCount_ = 0;
+    bool finished_ = false;
+};
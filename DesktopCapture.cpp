@@ -0,0 +1,180 @@
+#include "DesktopCapture.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    const int kRowsPerBand = 64;
+
+    // Part of one desktop row that monitor covers, in desktop x.
+    struct Span
+    {
+        int left;
+        int right;
+        int monitor;
+    };
+
+    // Spans of the monitors that cover desktop row y, left to right. Where
+    // monitors overlap (mirrored displays) the span met first keeps its pixels.
+    void RowSpans(const std::vector<DesktopRect>& monitors, const DesktopRect& bounds, int y,
+        std::vector<Span>& spans)
+    {
+        spans.clear();
+        for (size_t i = 0; i < monitors.size(); i++)
+        {
+            const DesktopRect& m = monitors[i];
+            if (y >= m.top && y < m.bottom && m.right > m.left)
+                spans.push_back({ m.left - bounds.left, m.right - bounds.left, static_cast<int>(i) });
+        }
+        std::sort(spans.begin(), spans.end(), [](const Span& a, const Span& b)
+            {
+                return a.left < b.left || (a.left == b.left && a.monitor < b.monitor);
+            });
+    }
+
+    void FillPixels(uint8_t* dst, int count, uint32_t color)
+    {
+        uint32_t* px = reinterpret_cast<uint32_t*>(dst);
+        std::fill(px, px + count, color);
+    }
+}
+
+//---------------------------------------------------------------------
+DesktopRect DesktopBounds(const std::vector<DesktopRect>& monitors)
+{
+    DesktopRect bounds;
+    bool first = true;
+    for (const DesktopRect& m : monitors)
+    {
+        if (m.Width() <= 0 || m.Height() <= 0)
+            continue;
+        if (first)
+        {
+            bounds = m;
+            first = false;
+            continue;
+        }
+        bounds.left = (std::min)(bounds.left, m.left);
+        bounds.top = (std::min)(bounds.top, m.top);
+        bounds.right = (std::max)(bounds.right, m.right);
+        bounds.bottom = (std::max)(bounds.bottom, m.bottom);
+    }
+    return bounds;
+}
+
+// Sweep the horizontal edges: between two of them every row is covered
+// by the same set of monitors.
+uint64_t DesktopGapPixels(const std::vector<DesktopRect>& monitors)
+{
+    const DesktopRect bounds = DesktopBounds(monitors);
+    std::vector<int> edges;
+    for (const DesktopRect& m : monitors)
+    {
+        if (m.Width() <= 0 || m.Height() <= 0)
+            continue;
+        edges.push_back(m.top);
+        edges.push_back(m.bottom);
+    }
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    uint64_t gaps = 0;
+    std::vector<Span> spans;
+    for (size_t e = 0; e + 1 < edges.size(); e++)
+    {
+        RowSpans(monitors, bounds, edges[e], spans);
+        int covered = 0;
+        int x = 0;
+        for (const Span& span : spans)
+        {
+            covered += (std::max)(0, span.right - (std::max)(x, span.left));
+            x = (std::max)(x, span.right);
+        }
+        gaps += static_cast<uint64_t>(bounds.Width() - covered) * (edges[e + 1] - edges[e]);
+    }
+    return gaps;
+}
+
+//---------------------------------------------------------------------
+DesktopCapture::DesktopCapture(MonitorSource& source, const DesktopCaptureOptions& options)
+    : source_(source), options_(options)
+{
+}
+
+bool DesktopCapture::Grab()
+{
+    if (!source_.Monitors(monitors_) || monitors_.empty())
+        return false;
+    frames_.resize(monitors_.size());
+
+    std::vector<char> grabbed(monitors_.size(), 0);
+    auto grabMonitor = [&](int index) { grabbed[index] = source_.Grab(index, frames_[index]) ? 1 : 0; };
+    const int count = MonitorCount();
+    if (options_.threads == 1 || count == 1)
+    {
+        for (int index = 0; index < count; index++)
+            grabMonitor(index);
+    }
+    else
+    {
+        SharedThreadPool().ParallelFor(count, grabMonitor, options_.threads);
+    }
+    return std::find(grabbed.begin(), grabbed.end(), 0) == grabbed.end();
+}
+
+// Each output row is written exactly once: spans of monitor pixels are
+// copied in and the gaps between them filled, so nothing is cleared first.
+bool DesktopCapture::Stitch(Frame& desktop) const
+{
+    const DesktopRect bounds = Bounds();
+    const int width = bounds.Width();
+    const int height = bounds.Height();
+    if (frames_.size() != monitors_.size() || width <= 0 || height <= 0)
+        return false;
+    desktop.Allocate(width, height, FrameFormat::Bgrx32);
+    const FrameView out = desktop.View();
+
+    auto stitchBand = [&](int band)
+        {
+            std::vector<Span> spans;
+            const int yEnd = (std::min)(height, (band + 1) * kRowsPerBand);
+            for (int y = band * kRowsPerBand; y < yEnd; y++)
+            {
+                uint8_t* dst = out.Row(y);
+                RowSpans(monitors_, bounds, bounds.top + y, spans);
+                int x = 0;
+                for (const Span& span : spans)
+                {
+                    const FrameView src = frames_[span.monitor].View();
+                    const int srcY = bounds.top + y - monitors_[span.monitor].top;
+                    // A grab smaller than its rectangle leaves the rest as a gap.
+                    const int right = srcY < src.height
+                        ? (std::min)(span.right, span.left + src.width) : span.left;
+                    const int left = (std::max)(x, span.left);
+                    if (left > x)
+                        FillPixels(dst + x * 4, left - x, options_.gapColor);
+                    if (right > left)
+                    {
+                        memcpy(dst + left * 4, src.Row(srcY) + (left - span.left) * 4,
+                            static_cast<size_t>(right - left) * 4);
+                    }
+                    x = (std::max)(x, (std::max)(left, right));
+                }
+                if (x < width)
+                    FillPixels(dst + x * 4, width - x, options_.gapColor);
+            }
+        };
+    const int bands = (height + kRowsPerBand - 1) / kRowsPerBand;
+    if (options_.threads == 1 || bands == 1)
+    {
+        for (int band = 0; band < bands; band++)
+            stitchBand(band);
+    }
+    else
+    {
+        SharedThreadPool().ParallelFor(bands, stitchBand, options_.threads);
+    }
+    return true;
+}
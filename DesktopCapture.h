@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Frame.h"
+
+#include <cstdint>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Whole virtual-desktop capture (-all). Every monitor is grabbed on its
+// own thread; the frames are then either saved one by one or stitched
+// into one image of the desktop's bounding box, with the parts no monitor
+// covers (staggered or L-shaped layouts) filled with a single colour.
+//
+// Rectangles are in physical pixels. The tool runs per-monitor DPI aware,
+// so Windows reports them that way and monitors at different scale
+// factors line up without any resampling.
+
+// Rectangle in virtual-desktop coordinates; right and bottom are exclusive.
+struct DesktopRect
+{
+    int left = 0;
+    int top = 0;
+    int right = 0;
+    int bottom = 0;
+
+    int Width() const { return right - left; }
+    int Height() const { return bottom - top; }
+};
+
+// Where monitors and their pixels come from. The tool grabs them with
+// GDI; the bench feeds synthetic layouts.
+class MonitorSource
+{
+public:
+    virtual ~MonitorSource() {}
+
+    // Rectangles of the attached monitors, in enumeration order.
+    virtual bool Monitors(std::vector<DesktopRect>& monitors) = 0;
+
+    // Grab monitor index into frame, at the size of its rectangle. Called
+    // concurrently for different monitors, never for the same one twice
+    // at a time.
+    virtual bool Grab(int index, Frame& frame) = 0;
+};
+
+// Bounding box of the monitors; empty when there are none.
+DesktopRect DesktopBounds(const std::vector<DesktopRect>& monitors);
+
+// Pixels of the bounding box that no monitor covers.
+uint64_t DesktopGapPixels(const std::vector<DesktopRect>& monitors);
+
+struct DesktopCaptureOptions
+{
+    int threads = 0;                    // 0: spread over the shared pool; 1: caller only.
+    uint32_t gapColor = 0xFF000000;     // 0xAARRGGBB of the uncovered parts.
+};
+
+// Grabs every monitor of a source. Monitor frames keep their buffers from
+// one grab to the next while the layout stays the same. Not thread-safe.
+class DesktopCapture
+{
+public:
+    DesktopCapture(MonitorSource& source, const DesktopCaptureOptions& options);
+
+    // Refresh the layout and grab all monitors in parallel. Fails if any
+    // monitor fails.
+    bool Grab();
+
+    int MonitorCount() const { return static_cast<int>(monitors_.size()); }
+    const DesktopRect& MonitorRect(int index) const { return monitors_[index]; }
+    FrameView MonitorView(int index) const { return frames_[index].View(); }
+    DesktopRect Bounds() const { return DesktopBounds(monitors_); }
+
+    // Compose the last grab into desktop as one Bgrx32 frame of Bounds()
+    // size, in horizontal bands on the shared pool.
+    bool Stitch(Frame& desktop) const;
+
+private:
+    MonitorSource& source_;
+    DesktopCaptureOptions options_;
+    std::vector<DesktopRect> monitors_;
+    std::vector<Frame> frames_;
+};
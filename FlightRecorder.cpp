@@ -0,0 +1,214 @@
+#include "FlightRecorder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+namespace
+{
+    const char kMagic[8] = { 'S', 'H', 'O', 'T', 'R', 'I', 'N', 'G' };
+    const uint32_t kVersion = 1;
+    const size_t kHeaderSize = 64;
+    const size_t kSlotSize = 32;
+    const size_t kFormatChars = 8;
+
+    // Header fields.
+    const size_t kSlotsAt = 12;
+    const size_t kDataBytesAt = 16;
+    const size_t kFormatAt = 24;
+    const size_t kAppendedAt = 32;
+
+    // Slot fields.
+    const size_t kTimestampAt = 8;
+    const size_t kOffsetAt = 16;
+    const size_t kSizeAt = 24;
+
+    void PutU32(uint8_t* p, uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            p[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+
+    void PutU64(uint8_t* p, uint64_t value)
+    {
+        PutU32(p, static_cast<uint32_t>(value));
+        PutU32(p + 4, static_cast<uint32_t>(value >> 32));
+    }
+
+    uint32_t GetU32(const uint8_t* p)
+    {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+
+    uint64_t GetU64(const uint8_t* p)
+    {
+        return uint64_t(GetU32(p)) | (uint64_t(GetU32(p + 4)) << 32);
+    }
+}
+
+//---------------------------------------------------------------------
+size_t FlightRing::BytesFor(int slots, uint64_t dataBytes)
+{
+    return kHeaderSize + static_cast<size_t>(slots) * kSlotSize + static_cast<size_t>(dataBytes);
+}
+
+bool FlightRing::Create(uint8_t* base, size_t size, int slots, const char* format)
+{
+    if (!base || slots <= 0 || size <= BytesFor(slots, 0) || strlen(format) >= kFormatChars)
+        return false;
+    memset(base, 0, BytesFor(slots, 0));
+    memcpy(base, kMagic, sizeof(kMagic));
+    PutU32(base + 8, kVersion);
+    PutU32(base + kSlotsAt, static_cast<uint32_t>(slots));
+    PutU64(base + kDataBytesAt, size - BytesFor(slots, 0));
+    memcpy(base + kFormatAt, format, strlen(format));
+
+    base_ = base;
+    slots_ = slots;
+    dataBytes_ = size - BytesFor(slots, 0);
+    data_ = base + BytesFor(slots, 0);
+    oldest_ = next_ = 1;
+    writeOffset_ = 0;
+    return true;
+}
+
+bool FlightRing::Open(uint8_t* base, size_t size)
+{
+    if (!base || size < kHeaderSize || memcmp(base, kMagic, sizeof(kMagic)) != 0 || GetU32(base + 8) != kVersion)
+        return false;
+    uint32_t slots = GetU32(base + kSlotsAt);
+    uint64_t dataBytes = GetU64(base + kDataBytesAt);
+    if (slots == 0 || slots > 0x7FFFFFFF || dataBytes > size || size < BytesFor(static_cast<int>(slots), dataBytes))
+        return false;
+
+    base_ = base;
+    slots_ = static_cast<int>(slots);
+    dataBytes_ = dataBytes;
+    data_ = base + BytesFor(slots_, 0);
+
+    // Rebuild the live range from whatever slots still hold a frame. Only
+    // the newest one and the slots - 1 sequences before it can be live.
+    auto heldSequence = [&](int i) -> uint64_t
+        {
+            uint64_t sequence = GetU64(base_ + kHeaderSize + static_cast<size_t>(i) * kSlotSize);
+            return sequence != 0 && sequence < (uint64_t(1) << 62) && Holds(sequence) ? sequence : 0;
+        };
+    uint64_t newest = 0;
+    for (int i = 0; i < slots_; i++)
+        newest = (std::max)(newest, heldSequence(i));
+    if (newest == 0)
+    {
+        oldest_ = next_ = 1;
+        writeOffset_ = 0;
+        return true;
+    }
+    uint64_t oldest = newest;
+    for (int i = 0; i < slots_; i++)
+    {
+        uint64_t sequence = heldSequence(i);
+        if (sequence != 0 && newest - sequence < slots)
+            oldest = (std::min)(oldest, sequence);
+    }
+    const uint8_t* slot = Slot(newest);
+    oldest_ = oldest;
+    next_ = newest + 1;
+    writeOffset_ = GetU64(slot + kOffsetAt) + GetU32(slot + kSizeAt);
+    return true;
+}
+
+uint8_t* FlightRing::Slot(uint64_t sequence) const
+{
+    return base_ + kHeaderSize + static_cast<size_t>(sequence % static_cast<uint64_t>(slots_)) * kSlotSize;
+}
+
+// Whether the slot of sequence holds that frame, inside the data area.
+bool FlightRing::Holds(uint64_t sequence) const
+{
+    const uint8_t* slot = Slot(sequence);
+    uint64_t offset = GetU64(slot + kOffsetAt);
+    uint32_t frameSize = GetU32(slot + kSizeAt);
+    return GetU64(slot) == sequence && frameSize != 0 && offset <= dataBytes_ && frameSize <= dataBytes_ - offset;
+}
+
+void FlightRing::Evict()
+{
+    if (Holds(oldest_))
+        PutU64(Slot(oldest_), 0);
+    oldest_++;
+}
+
+bool FlightRing::Append(const uint8_t* data, size_t size, int64_t timestampMs)
+{
+    if (!base_ || size == 0 || size > dataBytes_ || size > 0xFFFFFFFFu)
+        return false;
+
+    uint64_t offset = writeOffset_;
+    if (offset + size > dataBytes_)
+    {
+        // Wrap. Frames still sitting past the write position are the oldest
+        // ones; drop them too so the frames held stay one run in order.
+        while (oldest_ < next_)
+        {
+            if (Holds(oldest_) && GetU64(Slot(oldest_) + kOffsetAt) < writeOffset_)
+                break;
+            Evict();
+        }
+        offset = 0;
+    }
+
+    // Drop the oldest frames while they overlap the new bytes or hold the slot it needs.
+    while (oldest_ < next_)
+    {
+        const uint8_t* slot = Slot(oldest_);
+        if (Holds(oldest_))
+        {
+            uint64_t frameOffset = GetU64(slot + kOffsetAt);
+            uint64_t frameEnd = frameOffset + GetU32(slot + kSizeAt);
+            bool overlaps = frameOffset < offset + size && offset < frameEnd;
+            bool slotNeeded = next_ - oldest_ >= static_cast<uint64_t>(slots_);
+            if (!overlaps && !slotNeeded)
+                break;
+        }
+        Evict();
+    }
+
+    uint8_t* slot = Slot(next_);
+    PutU64(slot, 0);
+    memcpy(data_ + offset, data, size);
+    PutU64(slot + kTimestampAt, static_cast<uint64_t>(timestampMs));
+    PutU64(slot + kOffsetAt, offset);
+    PutU32(slot + kSizeAt, static_cast<uint32_t>(size));
+    // The sequence marks the slot valid, so it must land after the rest.
+    std::atomic_thread_fence(std::memory_order_release);
+    PutU64(slot, next_);
+    PutU64(base_ + kAppendedAt, next_);
+
+    writeOffset_ = offset + size;
+    next_++;
+    return true;
+}
+
+void FlightRing::Snapshot(std::vector<FlightFrame>& frames) const
+{
+    frames.clear();
+    for (uint64_t sequence = oldest_; sequence < next_; sequence++)
+    {
+        if (!Holds(sequence))
+            continue;
+        const uint8_t* slot = Slot(sequence);
+        FlightFrame frame;
+        frame.sequence = sequence;
+        frame.timestampMs = static_cast<int64_t>(GetU64(slot + kTimestampAt));
+        const uint8_t* bytes = data_ + GetU64(slot + kOffsetAt);
+        frame.bytes.assign(bytes, bytes + GetU32(slot + kSizeAt));
+        frames.push_back(std::move(frame));
+    }
+}
+
+std::string FlightRing::Format() const
+{
+    if (!base_)
+        return std::string();
+    const char* format = reinterpret_cast<const char*>(base_ + kFormatAt);
+    return std::string(format, std::find(format, format + kFormatChars, '\0'));
+}
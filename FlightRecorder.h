@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Ring of the newest encoded frames for -flightrec, kept in one block of
+// memory laid out at setup (a mapped file in the tool), so recording does
+// no allocation or file I/O of its own once it runs.
+//
+//   header   "SHOTRING", version, slot count, data size, format tag,
+//            frames appended
+//   slots    per slot: sequence (0 = empty), timestamp, data offset, size
+//   data     encoded frames back to back, wrapping to the start when the
+//            next one does not fit before the end
+//
+// Frame n (1-based) goes to slot n % slots. The oldest frames give up
+// their slot or their bytes to new ones, so the ring always holds the
+// newest frames that fit. A slot's sequence is cleared before its frame's
+// bytes are overwritten and set last when a frame is added, so a ring
+// left behind by a crashed run still reads back consistently. Integers
+// are little-endian.
+
+struct FlightFrame
+{
+    uint64_t sequence = 0;
+    int64_t timestampMs = 0;        // As given to Append (the tool uses Unix time).
+    std::vector<uint8_t> bytes;
+};
+
+class FlightRing
+{
+public:
+    // Memory needed for a ring of slots frames and dataBytes of frame data.
+    static size_t BytesFor(int slots, uint64_t dataBytes);
+
+    // Lay out an empty ring over size bytes at base. format is the file
+    // extension of the stored frames ("png", "jpg", ...; 7 chars at most).
+    bool Create(uint8_t* base, size_t size, int slots, const char* format);
+
+    // Attach to a ring created earlier, e.g. the file of a crashed run.
+    // Slots that do not describe a frame inside the data area are ignored.
+    bool Open(uint8_t* base, size_t size);
+
+    // Store one encoded frame, dropping the oldest frames it needs room
+    // from. Fails only if the frame is larger than the whole data area.
+    bool Append(const uint8_t* data, size_t size, int64_t timestampMs);
+
+    // Copy the frames held now, oldest first.
+    void Snapshot(std::vector<FlightFrame>& frames) const;
+
+    std::string Format() const;
+    int SlotCount() const { return slots_; }
+    uint64_t DataBytes() const { return dataBytes_; }
+    int FrameCount() const { return static_cast<int>(next_ - oldest_); }    // Counts gaps of a reopened ring.
+    uint64_t FramesAppended() const { return next_ - 1; }
+
+private:
+    uint8_t* Slot(uint64_t sequence) const;
+    bool Holds(uint64_t sequence) const;
+    void Evict();
+
+    uint8_t* base_ = nullptr;
+    uint8_t* data_ = nullptr;
+    int slots_ = 0;
+    uint64_t dataBytes_ = 0;
+    uint64_t oldest_ = 1;           // Sequence of the oldest frame held.
+    uint64_t next_ = 1;             // Sequence the next frame gets.
+    uint64_t writeOffset_ = 0;      // Where the next frame's bytes go.
+};
@@ -0,0 +1,103 @@
+#include "Frame.h"
+#include "PixelConvert.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+static std::atomic<uint64_t> g_frameCopies(0);
+
+//---------------------------------------------------------------------
+FrameView FrameView::Crop(int x, int y, int w, int h) const
+{
+    int left = (std::max)(x, 0);
+    int top = (std::max)(y, 0);
+    int right = (std::min)(x + w, width);
+    int bottom = (std::min)(y + h, height);
+    FrameView view;
+    view.format = format;
+    view.stride = stride;
+    if (Empty() || right <= left || bottom <= top)
+        return view;
+    view.data = Row(top) + left * 4;
+    view.width = right - left;
+    view.height = bottom - top;
+    return view;
+}
+
+//---------------------------------------------------------------------
+void Frame::Allocate(int width, int height, FrameFormat format)
+{
+    size_t bytes = static_cast<size_t>(width) * height * 4;
+    if (heap_.capacity() < bytes)
+    {
+        // Fresh storage instead of growing: the old contents are not needed.
+        std::vector<uint8_t>().swap(heap_);
+        heap_.reserve(bytes);
+    }
+    heap_.resize(bytes);
+    storage_.reset();
+    owner_ = nullptr;
+    data_ = heap_.data();
+    width_ = width;
+    height_ = height;
+    stride_ = static_cast<ptrdiff_t>(width) * 4;
+    format_ = format;
+}
+
+void Frame::Adopt(std::shared_ptr<void> storage, const void* owner,
+    uint8_t* data, int width, int height, ptrdiff_t stride, FrameFormat format)
+{
+    storage_ = std::move(storage);
+    owner_ = owner;
+    data_ = data;
+    width_ = width;
+    height_ = height;
+    stride_ = stride;
+    format_ = format;
+}
+
+void Frame::Reset()
+{
+    storage_.reset();
+    owner_ = nullptr;
+    data_ = nullptr;
+    width_ = 0;
+    height_ = 0;
+    stride_ = 0;
+}
+
+FrameView Frame::View() const
+{
+    FrameView view;
+    view.data = data_;
+    view.width = width_;
+    view.height = height_;
+    view.stride = stride_;
+    view.format = format_;
+    return view;
+}
+
+//---------------------------------------------------------------------
+bool CopyFrame(const FrameView& src, const FrameView& dst)
+{
+    if (src.Empty() || src.width != dst.width || src.height != dst.height)
+        return false;
+    g_frameCopies.fetch_add(1, std::memory_order_relaxed);
+
+    const size_t rowBytes = static_cast<size_t>(src.width) * 4;
+    const bool setAlpha = src.format == FrameFormat::Bgrx32 && dst.format == FrameFormat::Bgra32;
+    for (int y = 0; y < src.height; y++)
+    {
+        uint8_t* out = dst.Row(y);
+        memcpy(out, src.Row(y), rowBytes);
+        if (setAlpha)
+            ForceOpaque(out, src.width);
+    }
+    return true;
+}
+
+uint64_t FrameCopyCount()
+{
+    return g_frameCopies.load(std::memory_order_relaxed);
+}
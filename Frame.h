@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Pixel memory shared by every stage of a capture. The grabber writes a
+// Frame once; annotation, clipboard export and the encoders all work on
+// FrameViews of that same memory. Pixels are only ever copied through
+// CopyFrame, which counts the copies (FrameCopyCount) so the number of
+// full-frame copies per capture can be checked.
+
+enum class FrameFormat
+{
+    Bgrx32,     // B, G, R, unused. What GDI produces; the 4th byte is undefined.
+    Bgra32      // B, G, R, alpha.
+};
+
+// A window onto pixel rows. Does not own the memory. Rows are stride bytes
+// apart; a negative stride walks the memory bottom-up.
+struct FrameView
+{
+    uint8_t* data = nullptr;
+    int width = 0;
+    int height = 0;
+    ptrdiff_t stride = 0;
+    FrameFormat format = FrameFormat::Bgrx32;
+
+    bool Empty() const { return !data || width <= 0 || height <= 0; }
+    uint8_t* Row(int y) const { return data + y * stride; }
+
+    // The w x h rectangle at (x, y), clipped to this view.
+    FrameView Crop(int x, int y, int w, int h) const;
+};
+
+class Frame
+{
+public:
+    Frame() {}
+    Frame(Frame&&) = default;
+    Frame& operator=(Frame&&) = default;
+
+    // Point the frame at its own top-down buffer of the given size. The
+    // buffer is reused while it is large enough, and its contents are
+    // undefined afterwards.
+    void Allocate(int width, int height, FrameFormat format);
+
+    // Point the frame at memory owned elsewhere. storage keeps it alive
+    // for as long as the frame uses it (it may be null if the caller does
+    // that itself); owner tags where it came from, so an allocator can
+    // recognise and reuse its own buffers.
+    void Adopt(std::shared_ptr<void> storage, const void* owner,
+        uint8_t* data, int width, int height, ptrdiff_t stride, FrameFormat format);
+
+    void Reset();
+
+    FrameView View() const;
+    uint8_t* Data() const { return data_; }
+    int Width() const { return width_; }
+    int Height() const { return height_; }
+    ptrdiff_t Stride() const { return stride_; }
+    FrameFormat Format() const { return format_; }
+    bool Empty() const { return !data_; }
+
+    const void* Owner() const { return owner_; }
+    void* Storage() const { return storage_.get(); }
+
+private:
+    Frame(const Frame&) = delete;
+    Frame& operator=(const Frame&) = delete;
+
+    std::vector<uint8_t> heap_;
+    std::shared_ptr<void> storage_;
+    const void* owner_ = nullptr;
+    uint8_t* data_ = nullptr;
+    int width_ = 0;
+    int height_ = 0;
+    ptrdiff_t stride_ = 0;
+    FrameFormat format_ = FrameFormat::Bgrx32;
+};
+
+// Copy the pixels of src into dst. Both must have the same size; the
+// format of dst is kept (Bgrx32 to Bgra32 sets alpha to 255).
+bool CopyFrame(const FrameView& src, const FrameView& dst);
+
+// Number of CopyFrame calls so far, from all threads.
+uint64_t FrameCopyCount();
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "BoundedQueue.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Fixed set of reusable frame objects. All of them are created up front;
+// Acquire hands out a free one (blocking while every frame is in use) and
+// Release returns it. Frames keep their buffers between uses, so once the
+// pool has warmed up, capturing into it does not allocate.
+template <typename T>
+class FramePool
+{
+public:
+    explicit FramePool(size_t count)
+        : free_(count ? count : 1)
+    {
+        if (count == 0)
+            count = 1;
+        for (size_t i = 0; i < count; i++)
+        {
+            frames_.emplace_back(new T());
+            free_.Push(frames_.back().get());
+        }
+    }
+
+    T* Acquire()
+    {
+        T* frame = nullptr;
+        free_.Pop(frame);
+        return frame;
+    }
+
+    void Release(T* frame)
+    {
+        free_.Push(frame);
+    }
+
+    size_t Capacity() const { return frames_.size(); }
+    size_t Available() const { return free_.Size(); }
+
+private:
+    std::vector<std::unique_ptr<T>> frames_;
+    BoundedQueue<T*> free_;
+};
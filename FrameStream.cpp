@@ -0,0 +1,202 @@
+#include "FrameStream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    const char kBoundary[] = "--shotcap\r\n";
+    const char kFrameTag[] = "FRAME\n";
+
+    void PutU32LE(uint8_t* p, uint32_t value)
+    {
+        p[0] = static_cast<uint8_t>(value);
+        p[1] = static_cast<uint8_t>(value >> 8);
+        p[2] = static_cast<uint8_t>(value >> 16);
+        p[3] = static_cast<uint8_t>(value >> 24);
+    }
+
+    void Append(std::vector<uint8_t>& out, const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        out.insert(out.end(), bytes, bytes + size);
+    }
+
+    // Full-range BT.601 in 16-bit fixed point, the JFIF conversion the
+    // JPEG encoder uses, so mjpeg and y4m streams show the same colours.
+    inline uint8_t Luma(int r, int g, int b)
+    {
+        return static_cast<uint8_t>((19595 * r + 38470 * g + 7471 * b + 32768) >> 16);
+    }
+
+    inline uint8_t ChromaB(int r, int g, int b)
+    {
+        return static_cast<uint8_t>((-11059 * r - 21709 * g + 32768 * b + (128 << 16) + 32767) >> 16);
+    }
+
+    inline uint8_t ChromaR(int r, int g, int b)
+    {
+        return static_cast<uint8_t>((32768 * r - 27439 * g - 5329 * b + (128 << 16) + 32767) >> 16);
+    }
+
+    // Append Y, Cb and Cr planes. 4:2:0 chroma is taken from the 2x2
+    // average; odd edges repeat the last column or row.
+    void AppendYuvPlanes(const FrameView& frame, bool subsample, std::vector<uint8_t>& out)
+    {
+        const int w = frame.width;
+        const int h = frame.height;
+        const int cw = subsample ? (w + 1) / 2 : w;
+        const int ch = subsample ? (h + 1) / 2 : h;
+        const size_t lumaSize = static_cast<size_t>(w) * h;
+        const size_t chromaSize = static_cast<size_t>(cw) * ch;
+        size_t base = out.size();
+        out.resize(base + lumaSize + 2 * chromaSize);
+        uint8_t* yPlane = out.data() + base;
+        uint8_t* cbPlane = yPlane + lumaSize;
+        uint8_t* crPlane = cbPlane + chromaSize;
+
+        for (int y = 0; y < h; y++)
+        {
+            const uint8_t* px = frame.Row(y);
+            uint8_t* yRow = yPlane + static_cast<size_t>(y) * w;
+            for (int x = 0; x < w; x++, px += 4)
+                yRow[x] = Luma(px[2], px[1], px[0]);
+        }
+
+        if (!subsample)
+        {
+            for (int y = 0; y < h; y++)
+            {
+                const uint8_t* px = frame.Row(y);
+                size_t offset = static_cast<size_t>(y) * w;
+                for (int x = 0; x < w; x++, px += 4)
+                {
+                    cbPlane[offset + x] = ChromaB(px[2], px[1], px[0]);
+                    crPlane[offset + x] = ChromaR(px[2], px[1], px[0]);
+                }
+            }
+            return;
+        }
+
+        for (int cy = 0; cy < ch; cy++)
+        {
+            const uint8_t* row0 = frame.Row(2 * cy);
+            const uint8_t* row1 = frame.Row((std::min)(2 * cy + 1, h - 1));
+            size_t offset = static_cast<size_t>(cy) * cw;
+            for (int cx = 0; cx < cw; cx++)
+            {
+                const int x0 = 2 * cx * 4;
+                const int x1 = (std::min)(2 * cx + 1, w - 1) * 4;
+                int b = row0[x0] + row0[x1] + row1[x0] + row1[x1];
+                int g = row0[x0 + 1] + row0[x1 + 1] + row1[x0 + 1] + row1[x1 + 1];
+                int r = row0[x0 + 2] + row0[x1 + 2] + row1[x0 + 2] + row1[x1 + 2];
+                r = (r + 2) >> 2;
+                g = (g + 2) >> 2;
+                b = (b + 2) >> 2;
+                cbPlane[offset + cx] = ChromaB(r, g, b);
+                crPlane[offset + cx] = ChromaR(r, g, b);
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------------------
+bool ParseStreamFormat(const char* name, StreamFormat& format)
+{
+    if (strcmp(name, "mjpeg") == 0)
+        format = StreamFormat::Mjpeg;
+    else if (strcmp(name, "raw") == 0)
+        format = StreamFormat::Raw;
+    else if (strcmp(name, "y4m") == 0)
+        format = StreamFormat::Y4m;
+    else
+        return false;
+    return true;
+}
+
+void SetStreamInterval(StreamOptions& options, double intervalSeconds)
+{
+    // Microsecond precision, reduced; no interval (single shots) means 1 fps.
+    long long num = 1000000;
+    long long den = intervalSeconds > 0.0 ? std::llround(intervalSeconds * 1000000.0) : num;
+    if (den <= 0)
+        den = 1;
+    for (long long a = num, b = den; ; )
+    {
+        if (b == 0)
+        {
+            num /= a;
+            den /= a;
+            break;
+        }
+        long long t = a % b;
+        a = b;
+        b = t;
+    }
+    options.rateNumerator = static_cast<int>(num);
+    options.rateDenominator = static_cast<int>(den);
+}
+
+void BeginStream(const StreamOptions& options, int width, int height, std::vector<uint8_t>& out)
+{
+    out.clear();
+    if (options.format != StreamFormat::Y4m)
+        return;
+    char header[128];
+    int length = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 %s XCOLORRANGE=FULL\n",
+        width, height, options.rateNumerator, options.rateDenominator,
+        options.jpeg.subsampling == ChromaSubsampling::Yuv420 ? "C420jpeg" : "C444");
+    Append(out, header, static_cast<size_t>(length));
+}
+
+//---------------------------------------------------------------------
+bool FrameStreamEncoder::Encode(const FrameView& frame, const StreamOptions& options, int index,
+    int64_t timestampMs, std::vector<uint8_t>& out)
+{
+    out.clear();
+    if (frame.Empty())
+        return false;
+
+    switch (options.format)
+    {
+    case StreamFormat::Mjpeg:
+    {
+        if (!jpeg_.Encode(frame, options.jpeg, jpegBytes_))
+            return false;
+        char header[160];
+        int length = snprintf(header, sizeof(header),
+            "%sContent-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp: %lld\r\n\r\n",
+            kBoundary, static_cast<unsigned>(jpegBytes_.size()), static_cast<long long>(timestampMs));
+        out.reserve(length + jpegBytes_.size() + 2);
+        Append(out, header, static_cast<size_t>(length));
+        Append(out, jpegBytes_.data(), jpegBytes_.size());
+        Append(out, "\r\n", 2);
+        return true;
+    }
+    case StreamFormat::Raw:
+    {
+        const size_t rowBytes = static_cast<size_t>(frame.width) * 4;
+        out.resize(kRawStreamHeaderSize + rowBytes * frame.height);
+        uint8_t* p = out.data();
+        memcpy(p, "SCFR", 4);
+        PutU32LE(p + 4, static_cast<uint32_t>(kRawStreamHeaderSize));
+        PutU32LE(p + 8, static_cast<uint32_t>(frame.width));
+        PutU32LE(p + 12, static_cast<uint32_t>(frame.height));
+        PutU32LE(p + 16, static_cast<uint32_t>(index));
+        PutU32LE(p + 20, frame.format == FrameFormat::Bgra32 ? 1u : 0u);
+        PutU32LE(p + 24, static_cast<uint32_t>(static_cast<uint64_t>(timestampMs)));
+        PutU32LE(p + 28, static_cast<uint32_t>(static_cast<uint64_t>(timestampMs) >> 32));
+        p += kRawStreamHeaderSize;
+        for (int y = 0; y < frame.height; y++, p += rowBytes)
+            memcpy(p, frame.Row(y), rowBytes);
+        return true;
+    }
+    case StreamFormat::Y4m:
+        Append(out, kFrameTag, sizeof(kFrameTag) - 1);
+        AppendYuvPlanes(frame, options.jpeg.subsampling == ChromaSubsampling::Yuv420, out);
+        return true;
+    }
+    return false;
+}
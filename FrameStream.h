@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Frame.h"
+#include "JpegEncoder.h"
+
+#include <cstdint>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Self-delimiting frame streams for -o / -stream: every frame becomes one
+// record that can be written straight to stdout or a pipe, so other tools
+// can read the capture without touching the file system.
+//
+//   mjpeg  multipart JPEG, as read by "ffmpeg -f mpjpeg -i -":
+//            --shotcap\r\n
+//            Content-Type: image/jpeg\r\n
+//            Content-Length: <n>\r\n
+//            X-Timestamp: <ms since the Unix epoch>\r\n
+//            \r\n
+//            <n bytes of JPEG>\r\n
+//
+//   raw    a 32-byte little-endian header followed by the pixels, top-down
+//          BGRA with no row padding (width * height * 4 bytes):
+//            0  "SCFR"
+//            4  header size (32); skip any bytes past the fields below
+//            8  width
+//           12  height
+//           16  frame index (1-based, capture order)
+//           20  pixel format: 0 = BGRX (alpha undefined), 1 = BGRA
+//           24  timestamp, ms since the Unix epoch (int64)
+//
+//   y4m    YUV4MPEG2 with full-range BT.601 (JFIF) colour, 4:2:0 or 4:4:4
+//          planes; one stream header, then "FRAME\n" and the planes for
+//          every frame. All frames must have the size given in the header.
+
+enum class StreamFormat
+{
+    Mjpeg,
+    Raw,
+    Y4m
+};
+
+struct StreamOptions
+{
+    StreamFormat format = StreamFormat::Mjpeg;
+    JpegOptions jpeg;           // mjpeg frames; jpeg.subsampling also picks the y4m planes.
+    int rateNumerator = 1;      // y4m frame rate (nominal; frames are not resampled).
+    int rateDenominator = 1;
+};
+
+const size_t kRawStreamHeaderSize = 32;
+
+// Parse "mjpeg", "raw" or "y4m".
+bool ParseStreamFormat(const char* name, StreamFormat& format);
+
+// Set the y4m frame rate from the capture interval in seconds.
+void SetStreamInterval(StreamOptions& options, double intervalSeconds);
+
+// Bytes that open a stream of width x height frames (the y4m header;
+// nothing for mjpeg and raw).
+void BeginStream(const StreamOptions& options, int width, int height, std::vector<uint8_t>& out);
+
+// Reusable per-thread encoder for stream records. Not thread-safe.
+class FrameStreamEncoder
+{
+public:
+    // Replace out with the complete record for one frame.
+    bool Encode(const FrameView& frame, const StreamOptions& options, int index, int64_t timestampMs,
+        std::vector<uint8_t>& out);
+
+private:
+    JpegEncoder jpeg_;
+    std::vector<uint8_t> jpegBytes_;
+};
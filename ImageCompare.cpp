@@ -0,0 +1,421 @@
+#include "ImageCompare.h"
+#include "CpuFeatures.h"
+#include "PixelConvert.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(SHOTCAP_X86)
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // Images smaller than this are compared on the calling thread; handing
+    // them to the pool costs more than it saves.
+    const int kMinParallelPixels = 1 << 16;
+    const int kRowsPerTask = 32;
+    const uint32_t kChangedColour = 0xFFFF0000;     // Red, as B | G << 8 | R << 16 | A << 24.
+    const uint32_t kBoxColour = 0xFFFF00FF;         // Magenta.
+    // Unchanged pixels are drawn at (grey + kFade + 1) / 2.
+    const int kFade = 192;
+
+    void RunTasks(int count, const std::function<void(int)>& task, int threads, int64_t pixels)
+    {
+        if (threads == 1 || count == 1 || pixels < kMinParallelPixels)
+        {
+            for (int i = 0; i < count; i++)
+                task(i);
+        }
+        else
+        {
+            SharedThreadPool().ParallelFor(count, task, threads);
+        }
+    }
+
+    inline int LowestBit(uint32_t value)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, value);
+        return static_cast<int>(index);
+#else
+        return __builtin_ctz(value);
+#endif
+    }
+
+    inline int HighestBit(uint32_t value)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanReverse(&index, value);
+        return static_cast<int>(index);
+#else
+        return 31 - __builtin_clz(value);
+#endif
+    }
+
+    inline int PopCount16(uint32_t value)
+    {
+        value = value - ((value >> 1) & 0x5555);
+        value = (value & 0x3333) + ((value >> 2) & 0x3333);
+        value = (value + (value >> 4)) & 0x0F0F;
+        return static_cast<int>((value + (value >> 8)) & 0x1F);
+    }
+
+    inline int PixelDifference(const uint8_t* a, const uint8_t* b)
+    {
+        const int blue = std::abs(a[0] - b[0]);
+        const int green = std::abs(a[1] - b[1]);
+        const int red = std::abs(a[2] - b[2]);
+        return (std::max)(blue, (std::max)(green, red));
+    }
+
+    //---------------------------------------------------------------------
+    // Changed pixels of one row, as one 16-bit mask per tile (see
+    // CompareRowFunction), from pixel x, a multiple of the tile size, to
+    // the end.
+    int ScalarDiffRow(const uint8_t* a, const uint8_t* b, int x, int width, int tolerance, uint16_t* masks)
+    {
+        int largest = 0;
+        for (; x < width; x += kCompareTileSize)
+        {
+            const int end = (std::min)(x + kCompareTileSize, width);
+            uint32_t mask = 0;
+            for (int i = x; i < end; i++)
+            {
+                const int difference = PixelDifference(a + i * 4, b + i * 4);
+                largest = (std::max)(largest, difference);
+                if (difference > tolerance)
+                    mask |= 1u << (i - x);
+            }
+            masks[x / kCompareTileSize] = static_cast<uint16_t>(mask);
+        }
+        return largest;
+    }
+
+    int PlainDiffRow(const uint8_t* a, const uint8_t* b, int width, int tolerance, uint16_t* masks)
+    {
+        return ScalarDiffRow(a, b, 0, width, tolerance, masks);
+    }
+
+#if defined(SHOTCAP_SSE2)
+    // Largest channel difference of four pixels, in the low byte of each
+    // 32-bit lane.
+    inline __m128i Sse2Difference4(__m128i a, __m128i b)
+    {
+        __m128i difference = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+        difference = _mm_and_si128(difference, _mm_set1_epi32(0x00FFFFFF));
+        difference = _mm_max_epu8(difference, _mm_srli_epi32(difference, 8));
+        difference = _mm_max_epu8(difference, _mm_srli_epi32(difference, 16));
+        return _mm_and_si128(difference, _mm_set1_epi32(0xFF));
+    }
+
+    int Sse2DiffRow(const uint8_t* a, const uint8_t* b, int width, int tolerance, uint16_t* masks)
+    {
+        int x = 0;
+        const __m128i limit = _mm_set1_epi32(tolerance);
+        __m128i peak = _mm_setzero_si128();
+        for (; x + kCompareTileSize <= width; x += kCompareTileSize)
+        {
+            int mask = 0;
+            for (int i = 0; i < kCompareTileSize / 4; i++)
+            {
+                const __m128i difference = Sse2Difference4(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x * 4) + i),
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x * 4) + i));
+                peak = _mm_max_epi16(peak, difference);
+                mask |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(difference, limit))) << (i * 4);
+            }
+            masks[x / kCompareTileSize] = static_cast<uint16_t>(mask);
+        }
+        peak = _mm_max_epi16(peak, _mm_srli_si128(peak, 8));
+        peak = _mm_max_epi16(peak, _mm_srli_si128(peak, 4));
+        return (std::max)(_mm_cvtsi128_si32(peak), ScalarDiffRow(a, b, x, width, tolerance, masks));
+    }
+#endif
+
+#if defined(SHOTCAP_X86)
+    // The same eight pixels at a time.
+    SHOTCAP_TARGET("avx2")
+    int Avx2DiffRow(const uint8_t* a, const uint8_t* b, int width, int tolerance, uint16_t* masks)
+    {
+        const __m256i colour = _mm256_set1_epi32(0x00FFFFFF);
+        const __m256i lowByte = _mm256_set1_epi32(0xFF);
+        const __m256i limit = _mm256_set1_epi32(tolerance);
+        __m256i peak = _mm256_setzero_si256();
+        int x = 0;
+        for (; x + kCompareTileSize <= width; x += kCompareTileSize)
+        {
+            int mask = 0;
+            for (int i = 0; i < kCompareTileSize / 8; i++)
+            {
+                const __m256i pa = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + x * 4) + i);
+                const __m256i pb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + x * 4) + i);
+                __m256i difference = _mm256_and_si256(_mm256_or_si256(_mm256_subs_epu8(pa, pb), _mm256_subs_epu8(pb, pa)), colour);
+                difference = _mm256_max_epu8(difference, _mm256_srli_epi32(difference, 8));
+                difference = _mm256_max_epu8(difference, _mm256_srli_epi32(difference, 16));
+                difference = _mm256_and_si256(difference, lowByte);
+                peak = _mm256_max_epi32(peak, difference);
+                mask |= _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(difference, limit))) << (i * 8);
+            }
+            masks[x / kCompareTileSize] = static_cast<uint16_t>(mask);
+        }
+        __m128i half = _mm_max_epi32(_mm256_castsi256_si128(peak), _mm256_extracti128_si256(peak, 1));
+        half = _mm_max_epi32(half, _mm_srli_si128(half, 8));
+        half = _mm_max_epi32(half, _mm_srli_si128(half, 4));
+        return (std::max)(_mm_cvtsi128_si32(half), ScalarDiffRow(a, b, x, width, tolerance, masks));
+    }
+#endif
+
+    //---------------------------------------------------------------------
+    // Changed pixels of one tile and their bounds within it, right and
+    // bottom exclusive.
+    struct Tile
+    {
+        uint16_t count = 0;
+        uint8_t left = kCompareTileSize;
+        uint8_t top = kCompareTileSize;
+        uint8_t right = 0;
+        uint8_t bottom = 0;
+    };
+
+    void AddToRect(DesktopRect& rect, const DesktopRect& part, bool first)
+    {
+        if (first)
+        {
+            rect = part;
+            return;
+        }
+        rect.left = (std::min)(rect.left, part.left);
+        rect.top = (std::min)(rect.top, part.top);
+        rect.right = (std::max)(rect.right, part.right);
+        rect.bottom = (std::max)(rect.bottom, part.bottom);
+    }
+
+    // Merge tiles with changes into boxes, one per group of tiles that
+    // touch, also diagonally.
+    void MergeTiles(const std::vector<Tile>& tiles, int tilesX, int tilesY, CompareResult& result)
+    {
+        std::vector<uint8_t> seen(tiles.size(), 0);
+        std::vector<int> pending;
+        for (size_t start = 0; start < tiles.size(); start++)
+        {
+            if (!tiles[start].count || seen[start])
+                continue;
+            DiffBox box;
+            seen[start] = 1;
+            pending.push_back(static_cast<int>(start));
+            while (!pending.empty())
+            {
+                const int index = pending.back();
+                pending.pop_back();
+                const int tx = index % tilesX;
+                const int ty = index / tilesX;
+                const Tile& tile = tiles[index];
+                DesktopRect part;
+                part.left = tx * kCompareTileSize + tile.left;
+                part.top = ty * kCompareTileSize + tile.top;
+                part.right = tx * kCompareTileSize + tile.right;
+                part.bottom = ty * kCompareTileSize + tile.bottom;
+                AddToRect(box.rect, part, box.pixels == 0);
+                box.pixels += tile.count;
+
+                for (int ny = (std::max)(ty - 1, 0); ny <= (std::min)(ty + 1, tilesY - 1); ny++)
+                {
+                    for (int nx = (std::max)(tx - 1, 0); nx <= (std::min)(tx + 1, tilesX - 1); nx++)
+                    {
+                        const int neighbour = ny * tilesX + nx;
+                        if (tiles[neighbour].count && !seen[neighbour])
+                        {
+                            seen[neighbour] = 1;
+                            pending.push_back(neighbour);
+                        }
+                    }
+                }
+            }
+            AddToRect(result.bounds, box.rect, result.changedPixels == 0);
+            result.changedPixels += box.pixels;
+            result.boxes.push_back(box);
+        }
+    }
+
+    //---------------------------------------------------------------------
+    // One row of the diff image: changed pixels red, the rest the faded
+    // grey of b (grey holds its luma).
+    void MarkRow(const uint8_t* a, const uint8_t* b, const uint8_t* grey, int width, int tolerance, uint8_t* out)
+    {
+        int x = 0;
+#if defined(SHOTCAP_SSE2)
+        const __m128i limit = _mm_set1_epi32(tolerance);
+        const __m128i fade = _mm_set1_epi8(static_cast<char>(kFade));
+        const __m128i opaque = _mm_set1_epi32(static_cast<int>(0xFF000000));
+        const __m128i changedColour = _mm_set1_epi32(static_cast<int>(kChangedColour));
+        for (; x + 4 <= width; x += 4)
+        {
+            const __m128i changed = _mm_cmpgt_epi32(Sse2Difference4(
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x * 4)),
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + x * 4))), limit);
+            int luma;
+            memcpy(&luma, grey + x, 4);
+            __m128i faded = _mm_avg_epu8(_mm_cvtsi32_si128(luma), fade);
+            faded = _mm_unpacklo_epi8(faded, faded);
+            faded = _mm_or_si128(_mm_unpacklo_epi16(faded, faded), opaque);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4),
+                _mm_or_si128(_mm_and_si128(changed, changedColour), _mm_andnot_si128(changed, faded)));
+        }
+#endif
+        for (; x < width; x++)
+        {
+            uint32_t colour = kChangedColour;
+            if (PixelDifference(a + x * 4, b + x * 4) <= tolerance)
+                colour = 0xFF000000 | ((grey[x] + kFade + 1) >> 1) * 0x010101u;
+            memcpy(out + x * 4, &colour, 4);
+        }
+    }
+
+    // Set the pixels of a line that are not marked as changed.
+    void DrawLine(const FrameView& view, int x, int y, int dx, int dy, int length)
+    {
+        for (int i = 0; i < length; i++, x += dx, y += dy)
+        {
+            uint8_t* pixel = view.Row(y) + x * 4;
+            uint32_t colour;
+            memcpy(&colour, pixel, 4);
+            if (colour != kChangedColour)
+                memcpy(pixel, &kBoxColour, 4);
+        }
+    }
+
+    // Outline rect one pixel outside it, leaving out sides on the image edge.
+    void OutlineBox(const FrameView& view, const DesktopRect& rect)
+    {
+        const int left = (std::max)(rect.left - 1, 0);
+        const int top = (std::max)(rect.top - 1, 0);
+        const int right = (std::min)(rect.right + 1, view.width);
+        const int bottom = (std::min)(rect.bottom + 1, view.height);
+        if (rect.top > 0)
+            DrawLine(view, left, rect.top - 1, 1, 0, right - left);
+        if (rect.bottom < view.height)
+            DrawLine(view, left, rect.bottom, 1, 0, right - left);
+        if (rect.left > 0)
+            DrawLine(view, rect.left - 1, top, 0, 1, bottom - top);
+        if (rect.right < view.width)
+            DrawLine(view, rect.right, top, 0, 1, bottom - top);
+    }
+}
+
+//---------------------------------------------------------------------
+CompareRowFunction CompareRowKernelFor(CompareKernelLevel level)
+{
+    switch (level)
+    {
+    case CompareKernelLevel::Scalar:
+        return PlainDiffRow;
+#if defined(SHOTCAP_SSE2)
+    case CompareKernelLevel::Sse2:
+        return GetCpuFeatures().sse2 ? Sse2DiffRow : nullptr;
+#endif
+#if defined(SHOTCAP_X86)
+    case CompareKernelLevel::Avx2:
+        return GetCpuFeatures().avx2 ? Avx2DiffRow : nullptr;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+//---------------------------------------------------------------------
+bool CompareImages(const FrameView& a, const FrameView& b, int tolerance,
+    CompareResult& result, int threads)
+{
+    result = CompareResult();
+    if (a.width != b.width || a.height != b.height)
+        return false;
+    if (a.Empty() || b.Empty())
+        return true;
+    tolerance = (std::min)((std::max)(tolerance, 0), 255);
+
+    static const CompareRowFunction diffRow = []()
+        {
+            const CompareKernelLevel levels[] = { CompareKernelLevel::Avx2, CompareKernelLevel::Sse2 };
+            for (CompareKernelLevel level : levels)
+            {
+                if (CompareRowFunction kernel = CompareRowKernelFor(level))
+                    return kernel;
+            }
+            return PlainDiffRow;
+        }();
+    const int tilesX = (a.width + kCompareTileSize - 1) / kCompareTileSize;
+    const int tilesY = (a.height + kCompareTileSize - 1) / kCompareTileSize;
+    std::vector<Tile> tiles(static_cast<size_t>(tilesX) * tilesY);
+    std::vector<int> largest(tilesY, 0);
+
+    // One task per row of tiles, so no two tasks touch the same tile.
+    RunTasks(tilesY, [&](int ty)
+        {
+            thread_local std::vector<uint16_t> masks;
+            masks.resize(tilesX);
+            Tile* tileRow = &tiles[static_cast<size_t>(ty) * tilesX];
+            const int top = ty * kCompareTileSize;
+            const int rows = (std::min)(kCompareTileSize, a.height - top);
+            int peak = 0;
+            for (int r = 0; r < rows; r++)
+            {
+                peak = (std::max)(peak, diffRow(a.Row(top + r), b.Row(top + r), a.width, tolerance, masks.data()));
+                for (int tx = 0; tx < tilesX; tx++)
+                {
+                    const uint32_t mask = masks[tx];
+                    if (!mask)
+                        continue;
+                    Tile& tile = tileRow[tx];
+                    if (!tile.count)
+                        tile.top = static_cast<uint8_t>(r);
+                    tile.bottom = static_cast<uint8_t>(r + 1);
+                    tile.left = static_cast<uint8_t>((std::min)(static_cast<int>(tile.left), LowestBit(mask)));
+                    tile.right = static_cast<uint8_t>((std::max)(static_cast<int>(tile.right), HighestBit(mask) + 1));
+                    tile.count = static_cast<uint16_t>(tile.count + PopCount16(mask));
+                }
+            }
+            largest[ty] = peak;
+        }, threads, static_cast<int64_t>(a.width) * a.height);
+
+    result.maxDifference = *std::max_element(largest.begin(), largest.end());
+    MergeTiles(tiles, tilesX, tilesY, result);
+    return true;
+}
+
+//---------------------------------------------------------------------
+void RenderDiff(const FrameView& a, const FrameView& b, int tolerance,
+    const CompareResult& result, Frame& out, int threads)
+{
+    out.Allocate(b.width, b.height, FrameFormat::Bgra32);
+    const FrameView view = out.View();
+    if (view.Empty())
+        return;
+    tolerance = (std::min)((std::max)(tolerance, 0), 255);
+
+    const int tasks = (b.height + kRowsPerTask - 1) / kRowsPerTask;
+    RunTasks(tasks, [&](int task)
+        {
+            thread_local std::vector<uint8_t> grey;
+            grey.resize(b.width);
+            const int end = (std::min)(b.height, (task + 1) * kRowsPerTask);
+            for (int y = task * kRowsPerTask; y < end; y++)
+            {
+                BgraToGray(b.Row(y), grey.data(), b.width);
+                MarkRow(a.Row(y), b.Row(y), grey.data(), b.width, tolerance, view.Row(y));
+            }
+        }, threads, static_cast<int64_t>(b.width) * b.height);
+
+    for (const DiffBox& box : result.boxes)
+        OutlineBox(view, box.rect);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "DesktopCapture.h"
+#include "Frame.h"
+
+#include <cstdint>
+#include <vector>
+
+//---------------------------------------------------------------------
+// -compare: the pixel difference of two images of the same size, for
+// visual-regression checks. A pixel has changed when one of its colour
+// channels differs by more than the tolerance. Alpha, and the unused
+// fourth byte of Bgrx32, are ignored, so a grab compares equal to the
+// PNG it was saved as.
+//
+// Rows are compared sixteen pixels at a time (SSE2, or AVX2 where
+// available), in bands of kCompareTileSize rows spread over the shared
+// thread pool. Changed pixels are counted per kCompareTileSize square
+// tile, and tiles with changes that touch, also diagonally, are merged
+// into one box. Changes closer together than a tile therefore end up in
+// the same box, and every box is the exact bounds of its pixels.
+
+const int kCompareTileSize = 16;
+
+struct DiffBox
+{
+    DesktopRect rect;               // Image pixels.
+    uint64_t pixels = 0;            // Changed pixels inside rect.
+};
+
+struct CompareResult
+{
+    uint64_t changedPixels = 0;
+    int maxDifference = 0;          // Largest channel difference of any pixel, changed or not.
+    DesktopRect bounds;             // Of all changed pixels; empty when there are none.
+    std::vector<DiffBox> boxes;     // Top to bottom, by their first tile.
+};
+
+// Compare a with b. False when they differ in size.
+// threads as in PngOptions: 0 for the whole pool, 1 for the caller only.
+bool CompareImages(const FrameView& a, const FrameView& b, int tolerance,
+    CompareResult& result, int threads = 0);
+
+// The highlighted diff of a and b as a Bgra32 image: b in faded grey,
+// changed pixels in red and every box of result outlined in magenta
+// just outside it. a and b must have the same size.
+void RenderDiff(const FrameView& a, const FrameView& b, int tolerance,
+    const CompareResult& result, Frame& out, int threads = 0);
+
+//---------------------------------------------------------------------
+// The row kernels behind CompareImages, for tests and benchmarks that
+// compare levels. A kernel compares width pixels of a and b, sets bit i
+// of masks[t] when pixel t * kCompareTileSize + i has changed, and
+// returns the largest difference in the row.
+enum class CompareKernelLevel
+{
+    Scalar,
+    Sse2,
+    Avx2
+};
+
+typedef int (*CompareRowFunction)(const uint8_t* a, const uint8_t* b, int width, int tolerance, uint16_t* masks);
+
+// The kernel for one level, or null when this CPU or build cannot run it.
+CompareRowFunction CompareRowKernelFor(CompareKernelLevel level);
@@ -0,0 +1,345 @@
+#include "Inflate.h"
+#include "Checksum.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    const int kMaxCodeBits = 15;
+    const int kFastBits = 10;
+
+    const int kLengthBase[29] = {
+        3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    const int kLengthExtra[29] = {
+        0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+        3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    const int kDistBase[30] = {
+        1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+        257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    const int kDistExtra[30] = {
+        0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+        7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    const uint8_t kCodeLenOrder[19] = {
+        16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    //---------------------------------------------------------------------
+    // LSB-first bit reader. Reading past the end yields zero bits; Overrun()
+    // reports whether any of them were actually consumed.
+    class BitReader
+    {
+    public:
+        BitReader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+        void Need(int count)
+        {
+            while (count_ < count)
+            {
+                uint64_t byte = pos_ < size_ ? data_[pos_] : 0;
+                pos_++;
+                bits_ |= byte << count_;
+                count_ += 8;
+            }
+        }
+
+        uint32_t Peek(int count) const { return static_cast<uint32_t>(bits_ & ((uint64_t(1) << count) - 1)); }
+        void Drop(int count) { bits_ >>= count; count_ -= count; }
+
+        uint32_t Bits(int count)
+        {
+            if (count == 0)
+                return 0;
+            Need(count);
+            uint32_t value = Peek(count);
+            Drop(count);
+            return value;
+        }
+
+        // Discard the rest of the current byte and hand back whole bytes
+        // still buffered, so stored blocks can be copied from data directly.
+        void AlignToByte()
+        {
+            Drop(count_ & 7);
+            pos_ -= count_ / 8;
+            bits_ = 0;
+            count_ = 0;
+        }
+
+        const uint8_t* Data() const { return data_; }
+        size_t Position() const { return pos_; }
+        void Skip(size_t bytes) { pos_ += bytes; }
+        size_t Size() const { return size_; }
+
+        // Bytes consumed so far, including any partial byte.
+        size_t Consumed() const { return pos_ - count_ / 8; }
+        bool Overrun() const { return Consumed() > size_; }
+
+    private:
+        const uint8_t* data_;
+        size_t size_;
+        size_t pos_ = 0;
+        uint64_t bits_ = 0;
+        int count_ = 0;
+    };
+
+    //---------------------------------------------------------------------
+    // Canonical Huffman decoder: a kFastBits lookup table for short codes
+    // and a bit-by-bit canonical walk for the rest.
+    struct Huffman
+    {
+        uint16_t count[kMaxCodeBits + 1];
+        uint16_t symbol[288];
+        uint16_t fast[1 << kFastBits];      // (length << 9) | symbol, 0 if longer.
+    };
+
+    bool BuildHuffman(Huffman& h, const uint8_t* lengths, int n)
+    {
+        memset(h.count, 0, sizeof(h.count));
+        for (int i = 0; i < n; i++)
+            h.count[lengths[i]]++;
+        h.count[0] = 0;
+
+        // Reject over-subscribed sets; incomplete ones are allowed (a
+        // single distance code is legal and common).
+        int left = 1;
+        for (int len = 1; len <= kMaxCodeBits; len++)
+        {
+            left <<= 1;
+            left -= h.count[len];
+            if (left < 0)
+                return false;
+        }
+
+        uint16_t offs[kMaxCodeBits + 2];
+        offs[1] = 0;
+        for (int len = 1; len <= kMaxCodeBits; len++)
+            offs[len + 1] = static_cast<uint16_t>(offs[len] + h.count[len]);
+        for (int i = 0; i < n; i++)
+        {
+            if (lengths[i] != 0)
+                h.symbol[offs[lengths[i]]++] = static_cast<uint16_t>(i);
+        }
+
+        memset(h.fast, 0, sizeof(h.fast));
+        int code = 0;
+        int index = 0;
+        for (int len = 1; len <= kFastBits; len++)
+        {
+            for (int k = 0; k < h.count[len]; k++, code++, index++)
+            {
+                // Codes are sent MSB first; the table is indexed LSB first.
+                int reversed = 0;
+                for (int b = 0; b < len; b++)
+                    reversed |= ((code >> b) & 1) << (len - 1 - b);
+                uint16_t entry = static_cast<uint16_t>((len << 9) | h.symbol[index]);
+                for (int fill = reversed; fill < (1 << kFastBits); fill += 1 << len)
+                    h.fast[fill] = entry;
+            }
+            code <<= 1;
+        }
+        return true;
+    }
+
+    int Decode(BitReader& in, const Huffman& h)
+    {
+        in.Need(kMaxCodeBits);
+        uint16_t entry = h.fast[in.Peek(kFastBits)];
+        if (entry)
+        {
+            in.Drop(entry >> 9);
+            return entry & 511;
+        }
+        uint32_t bits = in.Peek(kMaxCodeBits);
+        int code = 0, first = 0, index = 0;
+        for (int len = 1; len <= kMaxCodeBits; len++)
+        {
+            code |= (bits >> (len - 1)) & 1;
+            int count = h.count[len];
+            if (code - first < count)
+            {
+                in.Drop(len);
+                return h.symbol[index + (code - first)];
+            }
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+
+    bool BuildFixedTables(Huffman& litLen, Huffman& dist)
+    {
+        uint8_t lengths[288];
+        int i = 0;
+        for (; i < 144; i++) lengths[i] = 8;
+        for (; i < 256; i++) lengths[i] = 9;
+        for (; i < 280; i++) lengths[i] = 7;
+        for (; i < 288; i++) lengths[i] = 8;
+        if (!BuildHuffman(litLen, lengths, 288))
+            return false;
+        for (i = 0; i < 30; i++)
+            lengths[i] = 5;
+        return BuildHuffman(dist, lengths, 30);
+    }
+
+    bool ReadDynamicTables(BitReader& in, Huffman& litLen, Huffman& dist)
+    {
+        int hlit = static_cast<int>(in.Bits(5)) + 257;
+        int hdist = static_cast<int>(in.Bits(5)) + 1;
+        int hclen = static_cast<int>(in.Bits(4)) + 4;
+        if (hlit > 286 || hdist > 30)
+            return false;
+
+        uint8_t lengths[286 + 30];
+        memset(lengths, 0, 19);
+        for (int i = 0; i < hclen; i++)
+            lengths[kCodeLenOrder[i]] = static_cast<uint8_t>(in.Bits(3));
+        Huffman codeLen;
+        if (!BuildHuffman(codeLen, lengths, 19))
+            return false;
+
+        int total = hlit + hdist;
+        for (int i = 0; i < total;)
+        {
+            int symbol = Decode(in, codeLen);
+            if (symbol < 0)
+                return false;
+            if (symbol < 16)
+            {
+                lengths[i++] = static_cast<uint8_t>(symbol);
+                continue;
+            }
+            uint8_t value = 0;
+            int repeat;
+            if (symbol == 16)
+            {
+                if (i == 0)
+                    return false;
+                value = lengths[i - 1];
+                repeat = 3 + static_cast<int>(in.Bits(2));
+            }
+            else if (symbol == 17)
+            {
+                repeat = 3 + static_cast<int>(in.Bits(3));
+            }
+            else
+            {
+                repeat = 11 + static_cast<int>(in.Bits(7));
+            }
+            if (i + repeat > total)
+                return false;
+            while (repeat--)
+                lengths[i++] = value;
+        }
+        if (lengths[256] == 0)
+            return false;
+        return BuildHuffman(litLen, lengths, hlit) && BuildHuffman(dist, lengths + hlit, hdist);
+    }
+
+    bool InflateBlock(BitReader& in, const Huffman& litLen, const Huffman& dist,
+        std::vector<uint8_t>& out, size_t start, size_t maxOutput)
+    {
+        for (;;)
+        {
+            int symbol = Decode(in, litLen);
+            if (symbol < 0 || in.Overrun())
+                return false;
+            if (symbol < 256)
+            {
+                if (out.size() >= maxOutput)
+                    return false;
+                out.push_back(static_cast<uint8_t>(symbol));
+                continue;
+            }
+            if (symbol == 256)
+                return true;
+
+            symbol -= 257;
+            if (symbol >= 29)
+                return false;
+            size_t length = kLengthBase[symbol] + in.Bits(kLengthExtra[symbol]);
+            int distSymbol = Decode(in, dist);
+            if (distSymbol < 0 || distSymbol >= 30)
+                return false;
+            size_t distance = kDistBase[distSymbol] + in.Bits(kDistExtra[distSymbol]);
+            size_t have = out.size() - start;
+            if (distance > have || length > maxOutput - out.size())
+                return false;
+
+            // Byte-wise copy: source and destination may overlap.
+            size_t from = out.size() - distance;
+            out.resize(out.size() + length);
+            uint8_t* p = out.data();
+            size_t to = out.size() - length;
+            for (size_t k = 0; k < length; k++)
+                p[to + k] = p[from + k];
+        }
+    }
+}
+
+//---------------------------------------------------------------------
+bool InflateRaw(const uint8_t* data, size_t size, std::vector<uint8_t>& out, size_t maxOutput)
+{
+    const size_t start = out.size();
+    if (maxOutput != SIZE_MAX)
+        maxOutput += start;
+    BitReader in(data, size);
+    Huffman litLen, dist;
+    bool last = false;
+    while (!last)
+    {
+        last = in.Bits(1) != 0;
+        uint32_t type = in.Bits(2);
+        if (type == 0)
+        {
+            in.AlignToByte();
+            if (in.Size() - (std::min)(in.Size(), in.Position()) < 4)
+                return false;
+            const uint8_t* p = in.Data() + in.Position();
+            uint32_t len = p[0] | (p[1] << 8);
+            uint32_t nlen = p[2] | (p[3] << 8);
+            if (len != (~nlen & 0xFFFF))
+                return false;
+            in.Skip(4);
+            if (in.Size() - in.Position() < len || len > maxOutput - out.size())
+                return false;
+            out.insert(out.end(), in.Data() + in.Position(), in.Data() + in.Position() + len);
+            in.Skip(len);
+        }
+        else if (type == 1)
+        {
+            if (!BuildFixedTables(litLen, dist) || !InflateBlock(in, litLen, dist, out, start, maxOutput))
+                return false;
+        }
+        else if (type == 2)
+        {
+            if (!ReadDynamicTables(in, litLen, dist) || !InflateBlock(in, litLen, dist, out, start, maxOutput))
+                return false;
+        }
+        else
+        {
+            return false;
+        }
+        if (in.Overrun())
+            return false;
+    }
+    return true;
+}
+
+bool InflateZlib(const uint8_t* data, size_t size, std::vector<uint8_t>& out, size_t maxOutput)
+{
+    if (size < 6)
+        return false;
+    // CM must be deflate with a window of at most 32K; FDICT is unsupported.
+    if ((data[0] & 0x0F) != 8 || (data[0] >> 4) > 7 || (data[1] & 0x20) ||
+        ((data[0] << 8) | data[1]) % 31 != 0)
+        return false;
+    const size_t start = out.size();
+    if (!InflateRaw(data + 2, size - 6, out, maxOutput))
+        return false;
+    const uint8_t* t = data + size - 4;
+    uint32_t expected = (uint32_t(t[0]) << 24) | (uint32_t(t[1]) << 16) | (uint32_t(t[2]) << 8) | t[3];
+    return Adler32(1, out.data() + start, out.size() - start) == expected;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Raw deflate (RFC 1951) decompressor, the counterpart of DeflateStream.
+// Decoded bytes are appended to out. Returns false on malformed input or
+// when the output would grow past maxOutput bytes.
+bool InflateRaw(const uint8_t* data, size_t size, std::vector<uint8_t>& out,
+    size_t maxOutput = SIZE_MAX);
+
+// Same for a zlib stream (RFC 1950): checks the header and the Adler-32
+// trailer. Preset dictionaries are not supported.
+bool InflateZlib(const uint8_t* data, size_t size, std::vector<uint8_t>& out,
+    size_t maxOutput = SIZE_MAX);
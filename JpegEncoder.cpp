@@ -0,0 +1,766 @@
+#include "JpegEncoder.h"
+#include "CpuFeatures.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(SHOTCAP_X86)
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // Natural (row-major) index of the k-th coefficient in zigzag order.
+    const uint8_t kZigzag[64] = {
+        0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+        12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+        35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+        58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63 };
+
+    // ITU T.81 Annex K tables, natural order.
+    const uint8_t kLumaQuant[64] = {
+        16, 11, 10, 16, 24, 40, 51, 61,
+        12, 12, 14, 19, 26, 58, 60, 55,
+        14, 13, 16, 24, 40, 57, 69, 56,
+        14, 17, 22, 29, 51, 87, 80, 62,
+        18, 22, 37, 56, 68, 109, 103, 77,
+        24, 35, 55, 64, 81, 104, 113, 92,
+        49, 64, 78, 87, 103, 121, 120, 101,
+        72, 92, 95, 98, 112, 100, 103, 99 };
+
+    const uint8_t kChromaQuant[64] = {
+        17, 18, 24, 47, 99, 99, 99, 99,
+        18, 21, 26, 66, 99, 99, 99, 99,
+        24, 26, 56, 99, 99, 99, 99, 99,
+        47, 66, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99 };
+
+    const uint8_t kDcLumaBits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+    const uint8_t kDcChromaBits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+    const uint8_t kDcValues[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+    const uint8_t kAcLumaBits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7D };
+    const uint8_t kAcLumaValues[162] = {
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+        0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+        0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+        0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+        0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+        0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+        0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+        0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+        0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+        0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+        0xF9, 0xFA };
+
+    const uint8_t kAcChromaBits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+    const uint8_t kAcChromaValues[162] = {
+        0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+        0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0,
+        0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+        0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+        0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+        0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+        0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+        0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+        0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+        0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+        0xF9, 0xFA };
+
+    // Aim for this many restart intervals per image so every core gets a
+    // few; each costs a marker and at most a byte of padding.
+    const int kTargetBands = 32;
+
+    //---------------------------------------------------------------------
+    // Huffman code and length per symbol, from a DHT-style bits/values pair.
+    struct HuffmanCodes
+    {
+        uint16_t code[256];
+        uint8_t size[256];
+
+        HuffmanCodes(const uint8_t* bits, const uint8_t* values)
+        {
+            memset(code, 0, sizeof(code));
+            memset(size, 0, sizeof(size));
+            int next = 0;
+            uint16_t value = 0;
+            for (int length = 1; length <= 16; length++)
+            {
+                for (int i = 0; i < bits[length - 1]; i++, next++)
+                {
+                    code[values[next]] = value++;
+                    size[values[next]] = static_cast<uint8_t>(length);
+                }
+                value <<= 1;
+            }
+        }
+    };
+
+    struct HuffmanTables
+    {
+        HuffmanCodes dcLuma{ kDcLumaBits, kDcValues };
+        HuffmanCodes acLuma{ kAcLumaBits, kAcLumaValues };
+        HuffmanCodes dcChroma{ kDcChromaBits, kDcValues };
+        HuffmanCodes acChroma{ kAcChromaBits, kAcChromaValues };
+    };
+
+    const HuffmanTables& GetHuffmanTables()
+    {
+        static const HuffmanTables tables;
+        return tables;
+    }
+
+    // IJG quality scaling, as used by GDI+ and libjpeg.
+    void ScaleQuantTable(const uint8_t* base, int quality, uint8_t* table)
+    {
+        quality = (std::min)((std::max)(quality, 1), 100);
+        int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+        for (int i = 0; i < 64; i++)
+            table[i] = static_cast<uint8_t>((std::min)((std::max)((base[i] * scale + 50) / 100, 1), 255));
+    }
+
+    inline int BitLength(unsigned value)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        return _BitScanReverse(&index, value) ? static_cast<int>(index) + 1 : 0;
+#else
+        return value ? 32 - __builtin_clz(value) : 0;
+#endif
+    }
+
+    inline int CountTrailingZeros(uint64_t value)
+    {
+#if defined(_MSC_VER) && defined(_M_X64)
+        unsigned long index;
+        _BitScanForward64(&index, value);
+        return static_cast<int>(index);
+#elif defined(_MSC_VER)
+        unsigned long index;
+        if (_BitScanForward(&index, static_cast<unsigned long>(value)))
+            return static_cast<int>(index);
+        _BitScanForward(&index, static_cast<unsigned long>(value >> 32));
+        return static_cast<int>(index) + 32;
+#else
+        return __builtin_ctzll(value);
+#endif
+    }
+
+    //---------------------------------------------------------------------
+    // Colour conversion: one BGRX row to level-shifted Y, Cb, Cr (JFIF,
+    // full range) with 14-bit fixed-point weights. The SSE2 path computes
+    // exactly the same integers.
+    const int kYR = 4899, kYG = 9617, kYB = 1868;
+    const int kCbR = -2765, kCbG = -5427, kCbB = 8192;
+    const int kCrR = 8192, kCrG = -6860, kCrB = -1332;
+    const int kRound = 1 << 13;
+    const int kYBias = kRound - (128 << 14);
+
+    void ConvertRowScalar(const uint8_t* src, int begin, int end, int16_t* y, int16_t* cb, int16_t* cr)
+    {
+        for (int x = begin; x < end; x++)
+        {
+            int b = src[x * 4], g = src[x * 4 + 1], r = src[x * 4 + 2];
+            y[x] = static_cast<int16_t>((kYR * r + kYG * g + kYB * b + kYBias) >> 14);
+            cb[x] = static_cast<int16_t>((kCbR * r + kCbG * g + kCbB * b + kRound) >> 14);
+            cr[x] = static_cast<int16_t>((kCrR * r + kCrG * g + kCrB * b + kRound) >> 14);
+        }
+    }
+
+#if defined(SHOTCAP_SSE2)
+    // Four pixels' weighted sums: B/R pair up in one 16-bit multiply-add,
+    // G/alpha (alpha weighted 0) in the other.
+    inline __m128i WeightedSum(__m128i br, __m128i ga, __m128i weightsBR, __m128i weightsG, __m128i bias)
+    {
+        return _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(_mm_madd_epi16(br, weightsBR), _mm_madd_epi16(ga, weightsG)), bias), 14);
+    }
+
+    void ConvertRow(const uint8_t* src, int width, int16_t* y, int16_t* cb, int16_t* cr)
+    {
+        const __m128i lowBytes = _mm_set1_epi32(0x00FF00FF);
+        const __m128i yBR = _mm_setr_epi16(kYB, kYR, kYB, kYR, kYB, kYR, kYB, kYR);
+        const __m128i yG = _mm_set1_epi32(kYG);
+        const __m128i cbBR = _mm_setr_epi16(kCbB, kCbR, kCbB, kCbR, kCbB, kCbR, kCbB, kCbR);
+        const __m128i cbG = _mm_set1_epi32(kCbG & 0xFFFF);
+        const __m128i crBR = _mm_setr_epi16(kCrB, kCrR, kCrB, kCrR, kCrB, kCrR, kCrB, kCrR);
+        const __m128i crG = _mm_set1_epi32(kCrG & 0xFFFF);
+        const __m128i yBias = _mm_set1_epi32(kYBias);
+        const __m128i cBias = _mm_set1_epi32(kRound);
+        int x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+            __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4 + 16));
+            __m128i br0 = _mm_and_si128(p0, lowBytes), ga0 = _mm_and_si128(_mm_srli_epi32(p0, 8), lowBytes);
+            __m128i br1 = _mm_and_si128(p1, lowBytes), ga1 = _mm_and_si128(_mm_srli_epi32(p1, 8), lowBytes);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y + x), _mm_packs_epi32(
+                WeightedSum(br0, ga0, yBR, yG, yBias), WeightedSum(br1, ga1, yBR, yG, yBias)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(cb + x), _mm_packs_epi32(
+                WeightedSum(br0, ga0, cbBR, cbG, cBias), WeightedSum(br1, ga1, cbBR, cbG, cBias)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(cr + x), _mm_packs_epi32(
+                WeightedSum(br0, ga0, crBR, crG, cBias), WeightedSum(br1, ga1, crBR, crG, cBias)));
+        }
+        ConvertRowScalar(src, x, width, y, cb, cr);
+    }
+#else
+    void ConvertRow(const uint8_t* src, int width, int16_t* y, int16_t* cb, int16_t* cr)
+    {
+        ConvertRowScalar(src, 0, width, y, cb, cr);
+    }
+#endif
+
+    //---------------------------------------------------------------------
+    // Forward DCT: the IJG "islow" integer transform (Loeffler, Ligtenberg
+    // and Moschytz), output scaled up by 8, followed by quantisation with
+    // reciprocals that already include that factor.
+    const int kConstBits = 13;
+    const int kPass1Bits = 2;
+    const int kFix0298631336 = 2446;
+    const int kFix0390180644 = 3196;
+    const int kFix0541196100 = 4433;
+    const int kFix0765366865 = 6270;
+    const int kFix0899976223 = 7373;
+    const int kFix1175875602 = 9633;
+    const int kFix1501321110 = 12299;
+    const int kFix1847759065 = 15137;
+    const int kFix1961570560 = 16069;
+    const int kFix2053119869 = 16819;
+    const int kFix2562915447 = 20995;
+    const int kFix3072711336 = 25172;
+
+    inline int Descale(int x, int n)
+    {
+        return (x + (1 << (n - 1))) >> n;
+    }
+
+    // One 8-point transform over d[0], d[step], ... d[7 * step]. The even
+    // outputs 0 and 4 are shifted left by evenShift, or descaled when it
+    // is negative; the rest are descaled by oddShift.
+    inline void Dct1D(int* d, int step, int evenShift, int oddShift)
+    {
+        int tmp0 = d[0] + d[7 * step], tmp7 = d[0] - d[7 * step];
+        int tmp1 = d[step] + d[6 * step], tmp6 = d[step] - d[6 * step];
+        int tmp2 = d[2 * step] + d[5 * step], tmp5 = d[2 * step] - d[5 * step];
+        int tmp3 = d[3 * step] + d[4 * step], tmp4 = d[3 * step] - d[4 * step];
+
+        int tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+        int tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+        d[0] = evenShift >= 0 ? (tmp10 + tmp11) * (1 << evenShift) : Descale(tmp10 + tmp11, -evenShift);
+        d[4 * step] = evenShift >= 0 ? (tmp10 - tmp11) * (1 << evenShift) : Descale(tmp10 - tmp11, -evenShift);
+
+        int z1 = (tmp12 + tmp13) * kFix0541196100;
+        d[2 * step] = Descale(z1 + tmp13 * kFix0765366865, oddShift);
+        d[6 * step] = Descale(z1 - tmp12 * kFix1847759065, oddShift);
+
+        z1 = tmp4 + tmp7;
+        int z2 = tmp5 + tmp6;
+        int z3 = tmp4 + tmp6;
+        int z4 = tmp5 + tmp7;
+        int z5 = (z3 + z4) * kFix1175875602;
+        tmp4 *= kFix0298631336;
+        tmp5 *= kFix2053119869;
+        tmp6 *= kFix3072711336;
+        tmp7 *= kFix1501321110;
+        z1 *= -kFix0899976223;
+        z2 *= -kFix2562915447;
+        z3 = z3 * -kFix1961570560 + z5;
+        z4 = z4 * -kFix0390180644 + z5;
+        d[7 * step] = Descale(tmp4 + z1 + z3, oddShift);
+        d[5 * step] = Descale(tmp5 + z2 + z4, oddShift);
+        d[3 * step] = Descale(tmp6 + z2 + z3, oddShift);
+        d[step] = Descale(tmp7 + z1 + z4, oddShift);
+    }
+
+    // Transform and quantise the 8x8 block at src (rows stride samples
+    // apart) into out, natural order.
+    void ForwardDctScalar(const int16_t* src, ptrdiff_t stride, const float* reciprocals, int16_t* out)
+    {
+        int d[64];
+        for (int row = 0; row < 8; row++)
+        {
+            for (int col = 0; col < 8; col++)
+                d[row * 8 + col] = src[row * stride + col];
+        }
+        for (int row = 0; row < 8; row++)
+            Dct1D(d + row * 8, 1, kPass1Bits, kConstBits - kPass1Bits);
+        for (int col = 0; col < 8; col++)
+            Dct1D(d + col, 8, -kPass1Bits, kConstBits + kPass1Bits);
+        for (int i = 0; i < 64; i++)
+            out[i] = static_cast<int16_t>(std::nearbyint(static_cast<float>(d[i]) * reciprocals[i]));
+    }
+
+#if defined(SHOTCAP_X86)
+    // AVX2: eight 1-D transforms at once, one block row or column per
+    // lane, with a transpose before each pass. Same integer arithmetic as
+    // the scalar code, so the same output.
+    SHOTCAP_TARGET("avx2")
+    inline void Transpose8x8(__m256i* r)
+    {
+        __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]), t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+        __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]), t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+        __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]), t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+        __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]), t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+        __m256i u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2);
+        __m256i u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3);
+        __m256i u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6);
+        __m256i u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+        r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+        r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+        r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+        r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+        r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+        r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+        r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+        r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+    }
+
+    SHOTCAP_TARGET("avx2")
+    inline __m256i Avx2Descale(__m256i x, int n)
+    {
+        return _mm256_srai_epi32(_mm256_add_epi32(x, _mm256_set1_epi32(1 << (n - 1))), n);
+    }
+
+    SHOTCAP_TARGET("avx2")
+    inline __m256i Avx2Mul(__m256i x, int c)
+    {
+        return _mm256_mullo_epi32(x, _mm256_set1_epi32(c));
+    }
+
+    SHOTCAP_TARGET("avx2")
+    inline void Avx2Dct1D(__m256i* d, bool firstPass)
+    {
+        const int oddShift = firstPass ? kConstBits - kPass1Bits : kConstBits + kPass1Bits;
+        __m256i tmp0 = _mm256_add_epi32(d[0], d[7]), tmp7 = _mm256_sub_epi32(d[0], d[7]);
+        __m256i tmp1 = _mm256_add_epi32(d[1], d[6]), tmp6 = _mm256_sub_epi32(d[1], d[6]);
+        __m256i tmp2 = _mm256_add_epi32(d[2], d[5]), tmp5 = _mm256_sub_epi32(d[2], d[5]);
+        __m256i tmp3 = _mm256_add_epi32(d[3], d[4]), tmp4 = _mm256_sub_epi32(d[3], d[4]);
+
+        __m256i tmp10 = _mm256_add_epi32(tmp0, tmp3), tmp13 = _mm256_sub_epi32(tmp0, tmp3);
+        __m256i tmp11 = _mm256_add_epi32(tmp1, tmp2), tmp12 = _mm256_sub_epi32(tmp1, tmp2);
+        if (firstPass)
+        {
+            d[0] = _mm256_slli_epi32(_mm256_add_epi32(tmp10, tmp11), kPass1Bits);
+            d[4] = _mm256_slli_epi32(_mm256_sub_epi32(tmp10, tmp11), kPass1Bits);
+        }
+        else
+        {
+            d[0] = Avx2Descale(_mm256_add_epi32(tmp10, tmp11), kPass1Bits);
+            d[4] = Avx2Descale(_mm256_sub_epi32(tmp10, tmp11), kPass1Bits);
+        }
+
+        __m256i z1 = Avx2Mul(_mm256_add_epi32(tmp12, tmp13), kFix0541196100);
+        d[2] = Avx2Descale(_mm256_add_epi32(z1, Avx2Mul(tmp13, kFix0765366865)), oddShift);
+        d[6] = Avx2Descale(_mm256_sub_epi32(z1, Avx2Mul(tmp12, kFix1847759065)), oddShift);
+
+        z1 = _mm256_add_epi32(tmp4, tmp7);
+        __m256i z2 = _mm256_add_epi32(tmp5, tmp6);
+        __m256i z3 = _mm256_add_epi32(tmp4, tmp6);
+        __m256i z4 = _mm256_add_epi32(tmp5, tmp7);
+        __m256i z5 = Avx2Mul(_mm256_add_epi32(z3, z4), kFix1175875602);
+        tmp4 = Avx2Mul(tmp4, kFix0298631336);
+        tmp5 = Avx2Mul(tmp5, kFix2053119869);
+        tmp6 = Avx2Mul(tmp6, kFix3072711336);
+        tmp7 = Avx2Mul(tmp7, kFix1501321110);
+        z1 = Avx2Mul(z1, -kFix0899976223);
+        z2 = Avx2Mul(z2, -kFix2562915447);
+        z3 = _mm256_add_epi32(Avx2Mul(z3, -kFix1961570560), z5);
+        z4 = _mm256_add_epi32(Avx2Mul(z4, -kFix0390180644), z5);
+        d[7] = Avx2Descale(_mm256_add_epi32(_mm256_add_epi32(tmp4, z1), z3), oddShift);
+        d[5] = Avx2Descale(_mm256_add_epi32(_mm256_add_epi32(tmp5, z2), z4), oddShift);
+        d[3] = Avx2Descale(_mm256_add_epi32(_mm256_add_epi32(tmp6, z2), z3), oddShift);
+        d[1] = Avx2Descale(_mm256_add_epi32(_mm256_add_epi32(tmp7, z1), z4), oddShift);
+    }
+
+    SHOTCAP_TARGET("avx2")
+    void ForwardDctAvx2(const int16_t* src, ptrdiff_t stride, const float* reciprocals, int16_t* out)
+    {
+        __m256i d[8];
+        for (int row = 0; row < 8; row++)
+            d[row] = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + row * stride)));
+        Transpose8x8(d);
+        Avx2Dct1D(d, true);
+        Transpose8x8(d);
+        Avx2Dct1D(d, false);
+        for (int row = 0; row < 8; row += 2)
+        {
+            __m256i q0 = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(d[row]), _mm256_loadu_ps(reciprocals + row * 8)));
+            __m256i q1 = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(d[row + 1]), _mm256_loadu_ps(reciprocals + row * 8 + 8)));
+            __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(q0, q1), 0xD8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + row * 8), packed);
+        }
+    }
+#endif
+
+    typedef void (*ForwardDctFunction)(const int16_t*, ptrdiff_t, const float*, int16_t*);
+
+    ForwardDctFunction SelectForwardDct()
+    {
+#if defined(SHOTCAP_X86)
+        if (GetCpuFeatures().avx2)
+            return ForwardDctAvx2;
+#endif
+        return ForwardDctScalar;
+    }
+
+    //---------------------------------------------------------------------
+    // Entropy coder output. Bits collect MSB-first in a 64-bit register and
+    // leave four bytes at a time; 0xFF bytes get the 0x00 stuffing byte.
+    class BitWriter
+    {
+    public:
+        explicit BitWriter(std::vector<uint8_t>& out) : out_(out) { out_.clear(); }
+
+        // Room for n more bytes without further checks.
+        void Reserve(size_t n)
+        {
+            if (out_.size() < pos_ + n)
+                out_.resize((std::max)(out_.size() * 2, pos_ + n));
+        }
+
+        void Put(uint32_t code, int size)
+        {
+            buffer_ = (buffer_ << size) | code;
+            bits_ += size;
+            if (bits_ >= 32)
+            {
+                bits_ -= 32;
+                uint32_t word = static_cast<uint32_t>(buffer_ >> bits_);
+                // Fast path unless one of the four bytes is 0xFF.
+                uint32_t inverted = ~word;
+                if (((inverted - 0x01010101u) & ~inverted & 0x80808080u) == 0)
+                {
+                    uint8_t* p = out_.data() + pos_;
+                    p[0] = static_cast<uint8_t>(word >> 24);
+                    p[1] = static_cast<uint8_t>(word >> 16);
+                    p[2] = static_cast<uint8_t>(word >> 8);
+                    p[3] = static_cast<uint8_t>(word);
+                    pos_ += 4;
+                }
+                else
+                {
+                    for (int shift = 24; shift >= 0; shift -= 8)
+                        PutByte(static_cast<uint8_t>(word >> shift));
+                }
+            }
+        }
+
+        // Pad the last byte with 1 bits and trim the output to size.
+        void Finish()
+        {
+            Reserve(16);
+            int pad = (8 - (bits_ & 7)) & 7;
+            if (pad)
+                Put((1u << pad) - 1, pad);
+            while (bits_ >= 8)
+            {
+                bits_ -= 8;
+                PutByte(static_cast<uint8_t>(buffer_ >> bits_));
+            }
+            out_.resize(pos_);
+        }
+
+    private:
+        void PutByte(uint8_t byte)
+        {
+            out_[pos_++] = byte;
+            if (byte == 0xFF)
+                out_[pos_++] = 0;
+        }
+
+        std::vector<uint8_t>& out_;
+        size_t pos_ = 0;
+        uint64_t buffer_ = 0;
+        int bits_ = 0;
+    };
+
+    // Worst case for one block: 64 codes of up to 16 + 11 bits, every byte
+    // stuffed.
+    const size_t kMaxBlockBytes = 64 * 27 / 8 * 2 + 8;
+
+    inline void PutValue(BitWriter& writer, const HuffmanCodes& codes, int run, int value)
+    {
+        unsigned magnitude = static_cast<unsigned>(value < 0 ? -value : value);
+        int nbits = BitLength(magnitude);
+        int symbol = (run << 4) | nbits;
+        writer.Put(codes.code[symbol], codes.size[symbol]);
+        if (nbits)
+            writer.Put(static_cast<uint32_t>(value < 0 ? value - 1 : value) & ((1u << nbits) - 1), nbits);
+    }
+
+    void EncodeBlock(BitWriter& writer, const int16_t* coefficients, int& lastDc,
+        const HuffmanCodes& dc, const HuffmanCodes& ac)
+    {
+        int16_t zigzag[64];
+        uint64_t nonZero = 0;
+        for (int k = 1; k < 64; k++)
+        {
+            zigzag[k] = coefficients[kZigzag[k]];
+            if (zigzag[k])
+                nonZero |= uint64_t(1) << k;
+        }
+
+        PutValue(writer, dc, 0, coefficients[0] - lastDc);
+        lastDc = coefficients[0];
+
+        int last = 0;
+        while (nonZero)
+        {
+            int k = CountTrailingZeros(nonZero);
+            nonZero &= nonZero - 1;
+            int run = k - last - 1;
+            for (; run > 15; run -= 16)
+                writer.Put(ac.code[0xF0], ac.size[0xF0]);
+            PutValue(writer, ac, run, zigzag[k]);
+            last = k;
+        }
+        if (last != 63)
+            writer.Put(ac.code[0x00], ac.size[0x00]);
+    }
+
+    //---------------------------------------------------------------------
+    struct EncodeSetup
+    {
+        FrameView frame;
+        bool subsample;
+        int mcuSize;            // 8 or 16 pixels square.
+        int mcusX;
+        int mcuRows;
+        int rowsPerBand;
+        float lumaReciprocals[64];
+        float chromaReciprocals[64];
+    };
+
+    // Level-shifted samples of one MCU row: full-resolution Y and chroma,
+    // then chroma reduced to the MCU grid.
+    struct BandScratch
+    {
+        std::vector<int16_t> y, cb, cr, cbSmall, crSmall;
+    };
+
+    void EncodeBand(const EncodeSetup& setup, int band, std::vector<uint8_t>& out)
+    {
+        static const ForwardDctFunction forwardDct = SelectForwardDct();
+        const HuffmanTables& huffman = GetHuffmanTables();
+        thread_local BandScratch scratch;
+
+        const FrameView& frame = setup.frame;
+        const int mcuSize = setup.mcuSize;
+        const int paddedWidth = setup.mcusX * mcuSize;
+        const size_t planeSize = static_cast<size_t>(paddedWidth) * mcuSize;
+        scratch.y.resize(planeSize);
+        scratch.cb.resize(planeSize);
+        scratch.cr.resize(planeSize);
+        scratch.cbSmall.resize(planeSize / 4);
+        scratch.crSmall.resize(planeSize / 4);
+
+        const int firstRow = band * setup.rowsPerBand;
+        const int lastRow = (std::min)(firstRow + setup.rowsPerBand, setup.mcuRows);
+        BitWriter writer(out);
+        writer.Reserve(static_cast<size_t>(lastRow - firstRow) * setup.mcusX * mcuSize * mcuSize / 2);
+        int dcY = 0, dcCb = 0, dcCr = 0;
+        int16_t coefficients[64];
+
+        for (int mcuRow = firstRow; mcuRow < lastRow; mcuRow++)
+        {
+            // Edge pixels are repeated out to whole MCUs.
+            for (int line = 0; line < mcuSize; line++)
+            {
+                int srcY = (std::min)(mcuRow * mcuSize + line, frame.height - 1);
+                size_t offset = static_cast<size_t>(line) * paddedWidth;
+                int16_t* y = scratch.y.data() + offset;
+                int16_t* cb = scratch.cb.data() + offset;
+                int16_t* cr = scratch.cr.data() + offset;
+                ConvertRow(frame.Row(srcY), frame.width, y, cb, cr);
+                for (int x = frame.width; x < paddedWidth; x++)
+                {
+                    y[x] = y[frame.width - 1];
+                    cb[x] = cb[frame.width - 1];
+                    cr[x] = cr[frame.width - 1];
+                }
+            }
+
+            const int16_t* cbPlane = scratch.cb.data();
+            const int16_t* crPlane = scratch.cr.data();
+            int chromaStride = paddedWidth;
+            if (setup.subsample)
+            {
+                chromaStride = paddedWidth / 2;
+                for (int line = 0; line < 8; line++)
+                {
+                    const int16_t* cb0 = scratch.cb.data() + static_cast<size_t>(line * 2) * paddedWidth;
+                    const int16_t* cr0 = scratch.cr.data() + static_cast<size_t>(line * 2) * paddedWidth;
+                    int16_t* cbOut = scratch.cbSmall.data() + static_cast<size_t>(line) * chromaStride;
+                    int16_t* crOut = scratch.crSmall.data() + static_cast<size_t>(line) * chromaStride;
+                    for (int x = 0; x < chromaStride; x++)
+                    {
+                        cbOut[x] = static_cast<int16_t>((cb0[2 * x] + cb0[2 * x + 1] +
+                            cb0[paddedWidth + 2 * x] + cb0[paddedWidth + 2 * x + 1] + 2) >> 2);
+                        crOut[x] = static_cast<int16_t>((cr0[2 * x] + cr0[2 * x + 1] +
+                            cr0[paddedWidth + 2 * x] + cr0[paddedWidth + 2 * x + 1] + 2) >> 2);
+                    }
+                }
+                cbPlane = scratch.cbSmall.data();
+                crPlane = scratch.crSmall.data();
+            }
+
+            writer.Reserve(static_cast<size_t>(setup.mcusX) * (setup.subsample ? 6 : 3) * kMaxBlockBytes);
+            for (int mcu = 0; mcu < setup.mcusX; mcu++)
+            {
+                for (int by = 0; by < mcuSize; by += 8)
+                {
+                    for (int bx = 0; bx < mcuSize; bx += 8)
+                    {
+                        forwardDct(scratch.y.data() + static_cast<size_t>(by) * paddedWidth + mcu * mcuSize + bx,
+                            paddedWidth, setup.lumaReciprocals, coefficients);
+                        EncodeBlock(writer, coefficients, dcY, huffman.dcLuma, huffman.acLuma);
+                    }
+                }
+                forwardDct(cbPlane + mcu * 8, chromaStride, setup.chromaReciprocals, coefficients);
+                EncodeBlock(writer, coefficients, dcCb, huffman.dcChroma, huffman.acChroma);
+                forwardDct(crPlane + mcu * 8, chromaStride, setup.chromaReciprocals, coefficients);
+                EncodeBlock(writer, coefficients, dcCr, huffman.dcChroma, huffman.acChroma);
+            }
+        }
+        writer.Finish();
+    }
+
+    //---------------------------------------------------------------------
+    // Marker segments.
+    void PutU16(std::vector<uint8_t>& out, int value)
+    {
+        out.push_back(static_cast<uint8_t>(value >> 8));
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    void PutMarker(std::vector<uint8_t>& out, uint8_t marker, int payloadSize)
+    {
+        out.push_back(0xFF);
+        out.push_back(marker);
+        if (payloadSize >= 0)
+            PutU16(out, payloadSize + 2);
+    }
+
+    void PutHuffmanTable(std::vector<uint8_t>& out, uint8_t classAndId, const uint8_t* bits, const uint8_t* values)
+    {
+        int count = 0;
+        for (int i = 0; i < 16; i++)
+            count += bits[i];
+        out.push_back(classAndId);
+        out.insert(out.end(), bits, bits + 16);
+        out.insert(out.end(), values, values + count);
+    }
+
+    void WriteHeaders(std::vector<uint8_t>& out, const EncodeSetup& setup,
+        const uint8_t* lumaQuant, const uint8_t* chromaQuant, int restartInterval)
+    {
+        PutMarker(out, 0xD8, -1);                       // SOI
+
+        static const uint8_t kJfif[14] = { 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };
+        PutMarker(out, 0xE0, sizeof(kJfif));            // APP0, 1:1 aspect, no thumbnail
+        out.insert(out.end(), kJfif, kJfif + sizeof(kJfif));
+
+        PutMarker(out, 0xDB, 2 * 65);                   // DQT, zigzag order
+        out.push_back(0);
+        for (int k = 0; k < 64; k++)
+            out.push_back(lumaQuant[kZigzag[k]]);
+        out.push_back(1);
+        for (int k = 0; k < 64; k++)
+            out.push_back(chromaQuant[kZigzag[k]]);
+
+        PutMarker(out, 0xC0, 15);                       // SOF0, baseline
+        out.push_back(8);
+        PutU16(out, setup.frame.height);
+        PutU16(out, setup.frame.width);
+        out.push_back(3);
+        const uint8_t lumaSampling = setup.subsample ? 0x22 : 0x11;
+        const uint8_t components[9] = { 1, lumaSampling, 0, 2, 0x11, 1, 3, 0x11, 1 };
+        out.insert(out.end(), components, components + 9);
+
+        PutMarker(out, 0xC4, 2 * (17 + 12) + 2 * (17 + 162));     // DHT
+        PutHuffmanTable(out, 0x00, kDcLumaBits, kDcValues);
+        PutHuffmanTable(out, 0x10, kAcLumaBits, kAcLumaValues);
+        PutHuffmanTable(out, 0x01, kDcChromaBits, kDcValues);
+        PutHuffmanTable(out, 0x11, kAcChromaBits, kAcChromaValues);
+
+        if (restartInterval > 0)
+        {
+            PutMarker(out, 0xDD, 2);                    // DRI
+            PutU16(out, restartInterval);
+        }
+
+        PutMarker(out, 0xDA, 10);                       // SOS
+        static const uint8_t kScan[10] = { 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 };
+        out.insert(out.end(), kScan, kScan + sizeof(kScan));
+    }
+}
+
+//---------------------------------------------------------------------
+bool JpegEncoder::Encode(const FrameView& frame, const JpegOptions& options, std::vector<uint8_t>& out)
+{
+    out.clear();
+    if (frame.Empty() || frame.width > 65535 || frame.height > 65535)
+        return false;
+
+    EncodeSetup setup;
+    setup.frame = frame;
+    setup.subsample = options.subsampling == ChromaSubsampling::Yuv420;
+    setup.mcuSize = setup.subsample ? 16 : 8;
+    setup.mcusX = (frame.width + setup.mcuSize - 1) / setup.mcuSize;
+    setup.mcuRows = (frame.height + setup.mcuSize - 1) / setup.mcuSize;
+    // A restart interval counts MCUs and must fit in 16 bits.
+    setup.rowsPerBand = (setup.mcuRows + kTargetBands - 1) / kTargetBands;
+    setup.rowsPerBand = (std::max)(1, (std::min)(setup.rowsPerBand, 65535 / setup.mcusX));
+    const int bands = (setup.mcuRows + setup.rowsPerBand - 1) / setup.rowsPerBand;
+
+    uint8_t lumaQuant[64], chromaQuant[64];
+    ScaleQuantTable(kLumaQuant, options.quality, lumaQuant);
+    ScaleQuantTable(kChromaQuant, options.quality, chromaQuant);
+    for (int i = 0; i < 64; i++)
+    {
+        setup.lumaReciprocals[i] = 1.0f / (lumaQuant[i] * 8);
+        setup.chromaReciprocals[i] = 1.0f / (chromaQuant[i] * 8);
+    }
+
+    if (bands_.size() < static_cast<size_t>(bands))
+        bands_.resize(bands);
+    auto encodeBand = [&](int band) { EncodeBand(setup, band, bands_[band]); };
+    if (options.threads == 1 || bands == 1)
+    {
+        for (int band = 0; band < bands; band++)
+            encodeBand(band);
+    }
+    else
+    {
+        SharedThreadPool().ParallelFor(bands, encodeBand, options.threads);
+    }
+
+    size_t total = 0;
+    for (int band = 0; band < bands; band++)
+        total += bands_[band].size() + 2;
+    out.reserve(total + 1024);
+    WriteHeaders(out, setup, lumaQuant, chromaQuant, bands > 1 ? setup.rowsPerBand * setup.mcusX : 0);
+    for (int band = 0; band < bands; band++)
+    {
+        if (band > 0)
+            PutMarker(out, static_cast<uint8_t>(0xD0 + (band - 1) % 8), -1);   // RSTn
+        out.insert(out.end(), bands_[band].begin(), bands_[band].end());
+    }
+    PutMarker(out, 0xD9, -1);                           // EOI
+    return true;
+}
+
+bool EncodeJpeg(const FrameView& frame, const JpegOptions& options, std::vector<uint8_t>& out)
+{
+    JpegEncoder encoder;
+    return encoder.Encode(frame, options, out);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Frame.h"
+
+#include <cstdint>
+#include <vector>
+
+//---------------------------------------------------------------------
+// In-process baseline JPEG (JFIF) encoder working directly on captured
+// pixel buffers.
+//
+// The image is cut into bands of whole MCU rows, one restart interval
+// each. Bands share nothing (restart markers reset the DC predictors), so
+// colour conversion, DCT, quantisation and Huffman coding of all bands run
+// in parallel and the results are joined with RSTn markers into a single
+// stream. The band size depends only on the image size, so the output is
+// the same whatever the thread count.
+
+enum class ChromaSubsampling
+{
+    Yuv444,     // Full-resolution colour; best for text and UI.
+    Yuv420      // Colour at half resolution both ways; what GDI+ writes.
+};
+
+struct JpegOptions
+{
+    int quality = 90;           // 0-100, IJG scaling of the Annex K tables like GDI+.
+    ChromaSubsampling subsampling = ChromaSubsampling::Yuv420;
+    int threads = 0;            // Upper bound on threads; 0 = shared pool, 1 = caller only.
+};
+
+// Reusable encoder. Band buffers are kept between calls, so encoding frames
+// of the same size does not allocate once they have grown to fit. Not
+// thread-safe; use one per thread.
+class JpegEncoder
+{
+public:
+    // Input is 32 bpp BGRX/BGRA, any stride; alpha is ignored.
+    bool Encode(const FrameView& frame, const JpegOptions& options, std::vector<uint8_t>& out);
+
+private:
+    std::vector<std::vector<uint8_t>> bands_;
+};
+
+// One-shot helper around a temporary JpegEncoder.
+bool EncodeJpeg(const FrameView& frame, const JpegOptions& options, std::vector<uint8_t>& out);
@@ -0,0 +1,268 @@
+#include "Palette.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+#if defined(SHOTCAP_SSE2)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    const int kMaxColors = 256;
+    const int kTableBits = 10;
+    const size_t kTableSize = size_t(1) << kTableBits;
+    const size_t kBucketCount = size_t(1) << 15;
+    const uint32_t kOpaque = 0xFF000000u;
+
+    inline uint32_t LoadPixel(const uint8_t* p)
+    {
+        uint32_t px;
+        memcpy(&px, p, 4);
+        return px;
+    }
+
+    inline size_t HashColor(uint32_t color)
+    {
+        return (color * 2654435761u) >> (32 - kTableBits);
+    }
+
+    // 5 bits per channel of a 0x..RRGGBB colour.
+    inline size_t Bucket(uint32_t color)
+    {
+        return ((color >> 9) & 0x7C00) | ((color >> 6) & 0x03E0) | ((color >> 3) & 0x001F);
+    }
+
+    // How many pixels from row[x] on, up to width, equal px once alphaMask
+    // is OR-ed in. Screens are mostly runs, so they are skipped four pixels
+    // at a time instead of being looked up one by one.
+    int RunLength(const uint8_t* row, int x, int width, uint32_t px, uint32_t alphaMask)
+    {
+        int start = x;
+#if defined(SHOTCAP_SSE2)
+        const __m128i target = _mm_set1_epi32(static_cast<int>(px));
+        const __m128i mask = _mm_set1_epi32(static_cast<int>(alphaMask));
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128i v = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x * 4)), mask);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(v, target)) != 0xFFFF)
+                break;
+        }
+#endif
+        while (x < width && (LoadPixel(row + x * 4) | alphaMask) == px)
+            x++;
+        return x - start;
+    }
+}
+
+//---------------------------------------------------------------------
+bool ParsePaletteMode(const std::string& text, PaletteMode& mode)
+{
+    if (text == "off")
+        mode = PaletteMode::Off;
+    else if (text == "auto")
+        mode = PaletteMode::Auto;
+    else if (text == "lossy")
+        mode = PaletteMode::Lossy;
+    else
+        return false;
+    return true;
+}
+
+//---------------------------------------------------------------------
+IndexedPalette::IndexedPalette()
+    : keys_(kTableSize, 0), slots_(kTableSize, -1)
+{
+    colors_.reserve(kMaxColors);
+}
+
+int IndexedPalette::Find(uint32_t color) const
+{
+    for (size_t h = HashColor(color); ; h = (h + 1) & (kTableSize - 1))
+    {
+        if (slots_[h] < 0)
+            return -1;
+        if (keys_[h] == color)
+            return slots_[h];
+    }
+}
+
+int IndexedPalette::Insert(uint32_t color)
+{
+    size_t h = HashColor(color);
+    while (slots_[h] >= 0)
+        h = (h + 1) & (kTableSize - 1);
+    keys_[h] = color;
+    slots_[h] = static_cast<int16_t>(colors_.size());
+    colors_.push_back(color);
+    return slots_[h];
+}
+
+bool IndexedPalette::BuildExact(const uint8_t* pixels, int width, int height, ptrdiff_t stride, bool alpha)
+{
+    colors_.clear();
+    std::fill(slots_.begin(), slots_.end(), static_cast<int16_t>(-1));
+    quantized_ = false;
+    alphaMask_ = alpha ? 0 : kOpaque;
+    if (!pixels || width <= 0 || height <= 0)
+        return false;
+
+    uint32_t last = LoadPixel(pixels) | alphaMask_;
+    Insert(last);
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t* row = pixels + y * stride;
+        int x = 0;
+        while (x < width)
+        {
+            uint32_t px = LoadPixel(row + x * 4) | alphaMask_;
+            if (px == last)
+            {
+                x += RunLength(row, x, width, px, alphaMask_);
+                continue;
+            }
+            if (Find(px) < 0)
+            {
+                if (colors_.size() >= kMaxColors)
+                    return false;
+                Insert(px);
+            }
+            last = px;
+            x++;
+        }
+    }
+    return true;
+}
+
+bool IndexedPalette::BuildQuantized(const uint8_t* pixels, int width, int height, ptrdiff_t stride,
+    double minCoverage)
+{
+    colors_.clear();
+    std::fill(slots_.begin(), slots_.end(), static_cast<int16_t>(-1));
+    quantized_ = true;
+    alphaMask_ = kOpaque;
+    if (!pixels || width <= 0 || height <= 0)
+        return false;
+
+    bucketCount_.assign(kBucketCount, 0);
+    bucketSum_.assign(kBucketCount * 3, 0);
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t* row = pixels + y * stride;
+        int x = 0;
+        while (x < width)
+        {
+            uint32_t px = LoadPixel(row + x * 4) | kOpaque;
+            int run = RunLength(row, x, width, px, kOpaque);
+            size_t bucket = Bucket(px);
+            bucketCount_[bucket] += run;
+            bucketSum_[bucket * 3] += static_cast<uint64_t>((px >> 16) & 0xFF) * run;
+            bucketSum_[bucket * 3 + 1] += static_cast<uint64_t>((px >> 8) & 0xFF) * run;
+            bucketSum_[bucket * 3 + 2] += static_cast<uint64_t>(px & 0xFF) * run;
+            x += run;
+        }
+    }
+
+    std::vector<uint32_t> used;
+    for (size_t bucket = 0; bucket < kBucketCount; bucket++)
+    {
+        if (bucketCount_[bucket] != 0)
+            used.push_back(static_cast<uint32_t>(bucket));
+    }
+    const size_t chosen = (std::min)(used.size(), static_cast<size_t>(kMaxColors));
+    std::partial_sort(used.begin(), used.begin() + chosen, used.end(),
+        [&](uint32_t a, uint32_t b)
+        {
+            return bucketCount_[a] > bucketCount_[b] || (bucketCount_[a] == bucketCount_[b] && a < b);
+        });
+    uint64_t covered = 0;
+    for (size_t i = 0; i < chosen; i++)
+        covered += bucketCount_[used[i]];
+    if (static_cast<double>(covered) < minCoverage * static_cast<double>(width) * height)
+        return false;
+
+    // Average colour of every bucket seen, as 0xFFRRGGBB.
+    auto average = [&](uint32_t bucket) -> uint32_t
+        {
+            uint64_t count = bucketCount_[bucket];
+            uint32_t r = static_cast<uint32_t>((bucketSum_[bucket * 3] + count / 2) / count);
+            uint32_t g = static_cast<uint32_t>((bucketSum_[bucket * 3 + 1] + count / 2) / count);
+            uint32_t b = static_cast<uint32_t>((bucketSum_[bucket * 3 + 2] + count / 2) / count);
+            return kOpaque | (r << 16) | (g << 8) | b;
+        };
+    bucketIndex_.assign(kBucketCount, 0);
+    for (size_t i = 0; i < chosen; i++)
+    {
+        bucketIndex_[used[i]] = static_cast<uint8_t>(i);
+        colors_.push_back(average(used[i]));
+    }
+    for (size_t i = chosen; i < used.size(); i++)
+    {
+        uint32_t color = average(used[i]);
+        int best = 0;
+        int bestDistance = INT_MAX;
+        for (int k = 0; k < static_cast<int>(chosen); k++)
+        {
+            int dr = static_cast<int>((color >> 16) & 0xFF) - static_cast<int>((colors_[k] >> 16) & 0xFF);
+            int dg = static_cast<int>((color >> 8) & 0xFF) - static_cast<int>((colors_[k] >> 8) & 0xFF);
+            int db = static_cast<int>(color & 0xFF) - static_cast<int>(colors_[k] & 0xFF);
+            int distance = 2 * dr * dr + 4 * dg * dg + db * db;
+            if (distance < bestDistance)
+            {
+                bestDistance = distance;
+                best = k;
+            }
+        }
+        bucketIndex_[used[i]] = static_cast<uint8_t>(best);
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------
+int IndexedPalette::BitDepth() const
+{
+    size_t size = colors_.size();
+    return size <= 2 ? 1 : size <= 4 ? 2 : size <= 16 ? 4 : 8;
+}
+
+size_t IndexedPalette::RowBytes(int width) const
+{
+    return (static_cast<size_t>(width) * BitDepth() + 7) / 8;
+}
+
+int IndexedPalette::IndexOf(uint32_t pixel) const
+{
+    if (quantized_)
+        return bucketIndex_[Bucket(pixel)];
+    int index = Find(pixel | alphaMask_);
+    return index < 0 ? 0 : index;
+}
+
+void IndexedPalette::MapRow(const uint8_t* src, int width, uint8_t* dst) const
+{
+    const int bits = BitDepth();
+    if (bits < 8)
+        memset(dst, 0, RowBytes(width));
+    uint32_t last = LoadPixel(src) ^ 1;     // Anything but the first pixel.
+    int index = 0;
+    for (int x = 0; x < width; x++)
+    {
+        uint32_t px = LoadPixel(src + x * 4);
+        if (px != last)
+        {
+            index = IndexOf(px);
+            last = px;
+        }
+        if (bits == 8)
+        {
+            dst[x] = static_cast<uint8_t>(index);
+        }
+        else
+        {
+            size_t bit = static_cast<size_t>(x) * bits;
+            dst[bit >> 3] |= static_cast<uint8_t>(index << (8 - bits - (bit & 7)));
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Colour analysis for indexed PNG (-palette). Application UIs rarely use
+// more than a few hundred colours, and with 256 or fewer a frame can be
+// stored losslessly as 1, 2, 4 or 8-bit palette indices instead of 24 or
+// 32-bit pixels.
+
+enum class PaletteMode
+{
+    Off,        // Always truecolour.
+    Auto,       // Indexed when the frame has at most 256 colours.
+    Lossy       // Auto, else quantize frames whose colours nearly fit.
+};
+
+// Parse "off", "auto" or "lossy".
+bool ParsePaletteMode(const std::string& text, PaletteMode& mode);
+
+// The palette of one frame of 32 bpp BGRA/BGRX pixels. Reusable; not
+// thread-safe.
+class IndexedPalette
+{
+public:
+    IndexedPalette();
+
+    // Collect the distinct colours, in order of first appearance. Fails as
+    // soon as a 257th turns up. alpha = false ignores the 4th byte.
+    bool BuildExact(const uint8_t* pixels, int width, int height, ptrdiff_t stride, bool alpha);
+
+    // Lossy fallback for opaque frames: the 256 most common colours at 5
+    // bits per channel, each the average of the pixels it stands for; the
+    // rest map to the nearest of them. Fails when those 256 cover less than
+    // minCoverage (0-1) of the pixels.
+    bool BuildQuantized(const uint8_t* pixels, int width, int height, ptrdiff_t stride, double minCoverage);
+
+    int Size() const { return static_cast<int>(colors_.size()); }
+    uint32_t Color(int index) const { return colors_[index]; }     // 0xAARRGGBB
+    bool Quantized() const { return quantized_; }
+
+    // Smallest PNG bit depth (1, 2, 4 or 8) that holds every index.
+    int BitDepth() const;
+
+    // Bytes of one row of packed indices.
+    size_t RowBytes(int width) const;
+
+    // Indices of width pixels, packed MSB first at BitDepth() bits and
+    // zero-padded to a whole byte. Every pixel must be one the palette was
+    // built from.
+    void MapRow(const uint8_t* src, int width, uint8_t* dst) const;
+
+private:
+    int Find(uint32_t color) const;
+    int Insert(uint32_t color);
+    int IndexOf(uint32_t pixel) const;
+
+    std::vector<uint32_t> colors_;
+    bool quantized_ = false;
+    uint32_t alphaMask_ = 0;            // OR-ed into pixels: 0xFF000000 ignores alpha.
+
+    // Open-addressed colour -> index table, at most a quarter full.
+    std::vector<uint32_t> keys_;
+    std::vector<int16_t> slots_;
+
+    // Quantized mode: 15-bit colour bucket -> index, and the histogram.
+    std::vector<uint8_t> bucketIndex_;
+    std::vector<uint32_t> bucketCount_;
+    std::vector<uint64_t> bucketSum_;
+};
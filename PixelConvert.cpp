@@ -0,0 +1,537 @@
+#include "PixelConvert.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(SHOTCAP_X86)
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    //---------------------------------------------------------------------
+    // Scalar reference kernels. The SIMD versions hand their leftover
+    // pixels to these, so they must stay exact for any width.
+    void ScalarBgraToRgb(const uint8_t* src, uint8_t* dst, int width)
+    {
+        for (int x = 0; x < width; x++, src += 4, dst += 3)
+        {
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+        }
+    }
+
+    void ScalarBgraToRgba(const uint8_t* src, uint8_t* dst, int width)
+    {
+        for (int x = 0; x < width; x++, src += 4, dst += 4)
+        {
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+            dst[3] = src[3];
+        }
+    }
+
+    void ScalarBgraToBgr(const uint8_t* src, uint8_t* dst, int width)
+    {
+        for (int x = 0; x < width; x++, src += 4, dst += 3)
+        {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+        }
+    }
+
+    void ScalarBgrToBgra(const uint8_t* src, uint8_t* dst, int width)
+    {
+        for (int x = 0; x < width; x++, src += 3, dst += 4)
+        {
+            dst[0] = src[0];
+            dst[1] = src[1];
+            dst[2] = src[2];
+            dst[3] = 0xFF;
+        }
+    }
+
+    // 5- and 6-bit channels are widened by repeating their top bits, so 0
+    // maps to 0 and the maximum maps to 255.
+    void ScalarBgr555ToBgra(const uint8_t* src, uint8_t* dst, int width)
+    {
+        for (int x = 0; x < width; x++, src += 2, dst += 4)
+        {
+            unsigned v = src[0] | (src[1] << 8);
+            unsigned b = v & 0x1F, g = (v >> 5) & 0x1F, r = (v >> 10) & 0x1F;
+            dst[0] = static_cast<uint8_t>((b << 3) | (b >> 2));
+            dst[1] = static_cast<uint8_t>((g << 3) | (g >> 2));
+            dst[2] = static_cast<uint8_t>((r << 3) | (r >> 2));
+            dst[3] = 0xFF;
+        }
+    }
+
+    void ScalarBgr565ToBgra(const uint8_t* src, uint8_t* dst, int width)
+    {
+        for (int x = 0; x < width; x++, src += 2, dst += 4)
+        {
+            unsigned v = src[0] | (src[1] << 8);
+            unsigned b = v & 0x1F, g = (v >> 5) & 0x3F, r = v >> 11;
+            dst[0] = static_cast<uint8_t>((b << 3) | (b >> 2));
+            dst[1] = static_cast<uint8_t>((g << 2) | (g >> 4));
+            dst[2] = static_cast<uint8_t>((r << 3) | (r >> 2));
+            dst[3] = 0xFF;
+        }
+    }
+
+    // BT.601 weights scaled to 256: 29 B + 150 G + 77 R.
+    const int kGrayB = 29;
+    const int kGrayG = 150;
+    const int kGrayR = 77;
+
+    void ScalarBgraToGray(const uint8_t* src, uint8_t* dst, int width)
+    {
+        for (int x = 0; x < width; x++, src += 4)
+            dst[x] = static_cast<uint8_t>((kGrayB * src[0] + kGrayG * src[1] + kGrayR * src[2] + 128) >> 8);
+    }
+
+    void ScalarForceOpaque(uint8_t* pixels, int width)
+    {
+        for (int x = 0; x < width; x++)
+            pixels[x * 4 + 3] = 0xFF;
+    }
+
+    void SwapBytes(uint8_t* a, uint8_t* b, size_t size)
+    {
+        uint8_t chunk[256];
+        while (size > 0)
+        {
+            size_t n = (std::min)(size, sizeof(chunk));
+            memcpy(chunk, a, n);
+            memcpy(a, b, n);
+            memcpy(b, chunk, n);
+            a += n;
+            b += n;
+            size -= n;
+        }
+    }
+
+    void ScalarFlipRows(uint8_t* data, size_t rowBytes, int height, ptrdiff_t stride)
+    {
+        for (int y = 0; y < height / 2; y++)
+            SwapBytes(data + y * stride, data + (height - 1 - y) * stride, rowBytes);
+    }
+
+#if defined(SHOTCAP_X86)
+    //---------------------------------------------------------------------
+    // SSE2: byte swaps done with shifts and masks, 16-bit multiplies.
+    SHOTCAP_TARGET("sse2")
+    void Sse2BgraToRgba(const uint8_t* src, uint8_t* dst, int width)
+    {
+        const __m128i agMask = _mm_set1_epi32(static_cast<int>(0xFF00FF00));
+        const __m128i rbMask = _mm_set1_epi32(0x00FF00FF);
+        int x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+            __m128i rb = _mm_and_si128(v, rbMask);
+            __m128i out = _mm_or_si128(_mm_and_si128(v, agMask),
+                _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), out);
+        }
+        ScalarBgraToRgba(src + x * 4, dst + x * 4, width - x);
+    }
+
+    SHOTCAP_TARGET("sse2")
+    void Sse2ForceOpaque(uint8_t* pixels, int width)
+    {
+        const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+        int x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128i* p = reinterpret_cast<__m128i*>(pixels + x * 4);
+            _mm_storeu_si128(p, _mm_or_si128(_mm_loadu_si128(p), alpha));
+        }
+        ScalarForceOpaque(pixels + x * 4, width - x);
+    }
+
+    // Luma of four pixels as 32-bit lanes: B and R pair up in one 16-bit
+    // multiply-add, G (with alpha weighted 0) in another.
+    SHOTCAP_TARGET("sse2")
+    inline __m128i Sse2Luma4(__m128i v)
+    {
+        const __m128i lowBytes = _mm_set1_epi32(0x00FF00FF);
+        const __m128i weightsBR = _mm_set1_epi32((kGrayR << 16) | kGrayB);
+        const __m128i weightsG = _mm_set1_epi32(kGrayG);
+        const __m128i round = _mm_set1_epi32(128);
+        __m128i br = _mm_madd_epi16(_mm_and_si128(v, lowBytes), weightsBR);
+        __m128i g = _mm_madd_epi16(_mm_and_si128(_mm_srli_epi32(v, 8), lowBytes), weightsG);
+        return _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(br, g), round), 8);
+    }
+
+    SHOTCAP_TARGET("sse2")
+    void Sse2BgraToGray(const uint8_t* src, uint8_t* dst, int width)
+    {
+        int x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            const __m128i* in = reinterpret_cast<const __m128i*>(src + x * 4);
+            __m128i y0 = Sse2Luma4(_mm_loadu_si128(in + 0));
+            __m128i y1 = Sse2Luma4(_mm_loadu_si128(in + 1));
+            __m128i y2 = Sse2Luma4(_mm_loadu_si128(in + 2));
+            __m128i y3 = Sse2Luma4(_mm_loadu_si128(in + 3));
+            __m128i packed = _mm_packus_epi16(_mm_packs_epi32(y0, y1), _mm_packs_epi32(y2, y3));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), packed);
+        }
+        ScalarBgraToGray(src + x * 4, dst + x, width - x);
+    }
+
+    // Eight 16-bit pixels to BGRA, given the three channels already widened
+    // to 8 significant bits in 16-bit lanes.
+    SHOTCAP_TARGET("sse2")
+    inline void Sse2StoreBgra8(__m128i b, __m128i g, __m128i r, uint8_t* dst)
+    {
+        __m128i bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+        __m128i ra = _mm_or_si128(r, _mm_set1_epi16(static_cast<short>(0xFF00)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_unpacklo_epi16(bg, ra));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), _mm_unpackhi_epi16(bg, ra));
+    }
+
+    SHOTCAP_TARGET("sse2")
+    void Sse2Bgr555ToBgra(const uint8_t* src, uint8_t* dst, int width)
+    {
+        const __m128i mask5 = _mm_set1_epi16(0x1F);
+        int x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 2));
+            __m128i b = _mm_and_si128(v, mask5);
+            __m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), mask5);
+            __m128i r = _mm_and_si128(_mm_srli_epi16(v, 10), mask5);
+            b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+            g = _mm_or_si128(_mm_slli_epi16(g, 3), _mm_srli_epi16(g, 2));
+            r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+            Sse2StoreBgra8(b, g, r, dst + x * 4);
+        }
+        ScalarBgr555ToBgra(src + x * 2, dst + x * 4, width - x);
+    }
+
+    SHOTCAP_TARGET("sse2")
+    void Sse2Bgr565ToBgra(const uint8_t* src, uint8_t* dst, int width)
+    {
+        const __m128i mask5 = _mm_set1_epi16(0x1F);
+        const __m128i mask6 = _mm_set1_epi16(0x3F);
+        int x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 2));
+            __m128i b = _mm_and_si128(v, mask5);
+            __m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), mask6);
+            __m128i r = _mm_srli_epi16(v, 11);
+            b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+            g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+            r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+            Sse2StoreBgra8(b, g, r, dst + x * 4);
+        }
+        ScalarBgr565ToBgra(src + x * 2, dst + x * 4, width - x);
+    }
+
+    SHOTCAP_TARGET("sse2")
+    void Sse2FlipRows(uint8_t* data, size_t rowBytes, int height, ptrdiff_t stride)
+    {
+        for (int y = 0; y < height / 2; y++)
+        {
+            uint8_t* a = data + y * stride;
+            uint8_t* b = data + (height - 1 - y) * stride;
+            size_t i = 0;
+            for (; i + 16 <= rowBytes; i += 16)
+            {
+                __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+                __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(a + i), vb);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(b + i), va);
+            }
+            SwapBytes(a + i, b + i, rowBytes - i);
+        }
+    }
+
+    //---------------------------------------------------------------------
+    // SSSE3: PSHUFB does any byte permutation within 16 bytes.
+    // Packs 16 pixels (four registers of four) into 48 bytes. Each register
+    // holds its 12 bytes at the bottom and zeros above.
+    SHOTCAP_TARGET("ssse3")
+    inline void Ssse3Store48(__m128i p0, __m128i p1, __m128i p2, __m128i p3, uint8_t* dst)
+    {
+        __m128i* out = reinterpret_cast<__m128i*>(dst);
+        _mm_storeu_si128(out + 0, _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+        _mm_storeu_si128(out + 1, _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+        _mm_storeu_si128(out + 2, _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+    }
+
+    SHOTCAP_TARGET("ssse3")
+    void Ssse3Pack32To24(const uint8_t* src, uint8_t* dst, int width, __m128i shuffle,
+        void (*tail)(const uint8_t*, uint8_t*, int))
+    {
+        int x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            const __m128i* in = reinterpret_cast<const __m128i*>(src + x * 4);
+            Ssse3Store48(
+                _mm_shuffle_epi8(_mm_loadu_si128(in + 0), shuffle),
+                _mm_shuffle_epi8(_mm_loadu_si128(in + 1), shuffle),
+                _mm_shuffle_epi8(_mm_loadu_si128(in + 2), shuffle),
+                _mm_shuffle_epi8(_mm_loadu_si128(in + 3), shuffle),
+                dst + x * 3);
+        }
+        tail(src + x * 4, dst + x * 3, width - x);
+    }
+
+    SHOTCAP_TARGET("ssse3")
+    void Ssse3BgraToRgb(const uint8_t* src, uint8_t* dst, int width)
+    {
+        const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        Ssse3Pack32To24(src, dst, width, shuffle, ScalarBgraToRgb);
+    }
+
+    SHOTCAP_TARGET("ssse3")
+    void Ssse3BgraToBgr(const uint8_t* src, uint8_t* dst, int width)
+    {
+        const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        Ssse3Pack32To24(src, dst, width, shuffle, ScalarBgraToBgr);
+    }
+
+    SHOTCAP_TARGET("ssse3")
+    void Ssse3BgraToRgba(const uint8_t* src, uint8_t* dst, int width)
+    {
+        const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        int x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), _mm_shuffle_epi8(v, shuffle));
+        }
+        ScalarBgraToRgba(src + x * 4, dst + x * 4, width - x);
+    }
+
+    SHOTCAP_TARGET("ssse3")
+    void Ssse3BgrToBgra(const uint8_t* src, uint8_t* dst, int width)
+    {
+        const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+        int x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            const __m128i* in = reinterpret_cast<const __m128i*>(src + x * 3);
+            __m128i in0 = _mm_loadu_si128(in + 0);
+            __m128i in1 = _mm_loadu_si128(in + 1);
+            __m128i in2 = _mm_loadu_si128(in + 2);
+            __m128i* out = reinterpret_cast<__m128i*>(dst + x * 4);
+            _mm_storeu_si128(out + 0, _mm_or_si128(_mm_shuffle_epi8(in0, shuffle), alpha));
+            _mm_storeu_si128(out + 1, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(in1, in0, 12), shuffle), alpha));
+            _mm_storeu_si128(out + 2, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(in2, in1, 8), shuffle), alpha));
+            _mm_storeu_si128(out + 3, _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(in2, 4), shuffle), alpha));
+        }
+        ScalarBgrToBgra(src + x * 3, dst + x * 4, width - x);
+    }
+
+    //---------------------------------------------------------------------
+    // AVX2: the SSSE3 shuffles on two 128-bit lanes at once.
+    SHOTCAP_TARGET("avx2")
+    void Avx2Pack32To24(const uint8_t* src, uint8_t* dst, int width, __m256i shuffle,
+        void (*tail)(const uint8_t*, uint8_t*, int))
+    {
+        // After the in-lane shuffle each lane holds 12 bytes; gathering
+        // dwords 0-2 and 4-6 makes them contiguous.
+        const __m256i gather = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+        int x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x * 4));
+            v = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(v, shuffle), gather);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 3), _mm256_castsi256_si128(v));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x * 3 + 16), _mm256_extracti128_si256(v, 1));
+        }
+        tail(src + x * 4, dst + x * 3, width - x);
+    }
+
+    SHOTCAP_TARGET("avx2")
+    void Avx2BgraToRgb(const uint8_t* src, uint8_t* dst, int width)
+    {
+        const __m256i shuffle = _mm256_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+        Avx2Pack32To24(src, dst, width, shuffle, ScalarBgraToRgb);
+    }
+
+    SHOTCAP_TARGET("avx2")
+    void Avx2BgraToBgr(const uint8_t* src, uint8_t* dst, int width)
+    {
+        const __m256i shuffle = _mm256_setr_epi8(
+            0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+            0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        Avx2Pack32To24(src, dst, width, shuffle, ScalarBgraToBgr);
+    }
+
+    SHOTCAP_TARGET("avx2")
+    void Avx2BgraToRgba(const uint8_t* src, uint8_t* dst, int width)
+    {
+        const __m256i shuffle = _mm256_setr_epi8(
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+            2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        int x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x * 4));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x * 4), _mm256_shuffle_epi8(v, shuffle));
+        }
+        ScalarBgraToRgba(src + x * 4, dst + x * 4, width - x);
+    }
+
+    SHOTCAP_TARGET("avx2")
+    void Avx2ForceOpaque(uint8_t* pixels, int width)
+    {
+        const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+        int x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            __m256i* p = reinterpret_cast<__m256i*>(pixels + x * 4);
+            _mm256_storeu_si256(p, _mm256_or_si256(_mm256_loadu_si256(p), alpha));
+        }
+        ScalarForceOpaque(pixels + x * 4, width - x);
+    }
+
+    SHOTCAP_TARGET("avx2")
+    inline __m256i Avx2Luma8(__m256i v)
+    {
+        const __m256i lowBytes = _mm256_set1_epi32(0x00FF00FF);
+        const __m256i weightsBR = _mm256_set1_epi32((kGrayR << 16) | kGrayB);
+        const __m256i weightsG = _mm256_set1_epi32(kGrayG);
+        const __m256i round = _mm256_set1_epi32(128);
+        __m256i br = _mm256_madd_epi16(_mm256_and_si256(v, lowBytes), weightsBR);
+        __m256i g = _mm256_madd_epi16(_mm256_and_si256(_mm256_srli_epi32(v, 8), lowBytes), weightsG);
+        return _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(br, g), round), 8);
+    }
+
+    SHOTCAP_TARGET("avx2")
+    void Avx2BgraToGray(const uint8_t* src, uint8_t* dst, int width)
+    {
+        // The packs work per 128-bit lane; the final permute puts the four
+        // pixel groups of each input register back in order.
+        const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+        int x = 0;
+        for (; x + 32 <= width; x += 32)
+        {
+            const __m256i* in = reinterpret_cast<const __m256i*>(src + x * 4);
+            __m256i y0 = Avx2Luma8(_mm256_loadu_si256(in + 0));
+            __m256i y1 = Avx2Luma8(_mm256_loadu_si256(in + 1));
+            __m256i y2 = Avx2Luma8(_mm256_loadu_si256(in + 2));
+            __m256i y3 = Avx2Luma8(_mm256_loadu_si256(in + 3));
+            __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(y0, y1), _mm256_packs_epi32(y2, y3));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x), _mm256_permutevar8x32_epi32(packed, order));
+        }
+        ScalarBgraToGray(src + x * 4, dst + x, width - x);
+    }
+
+    SHOTCAP_TARGET("avx2")
+    void Avx2FlipRows(uint8_t* data, size_t rowBytes, int height, ptrdiff_t stride)
+    {
+        for (int y = 0; y < height / 2; y++)
+        {
+            uint8_t* a = data + y * stride;
+            uint8_t* b = data + (height - 1 - y) * stride;
+            size_t i = 0;
+            for (; i + 32 <= rowBytes; i += 32)
+            {
+                __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+                __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(a + i), vb);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(b + i), va);
+            }
+            SwapBytes(a + i, b + i, rowBytes - i);
+        }
+    }
+#endif
+
+    //---------------------------------------------------------------------
+    // Each level takes the best kernel available to it; conversions
+    // without a faster version reuse the one from the level below.
+    const PixelKernels kScalarKernels = {
+        "scalar",
+        ScalarBgraToRgb, ScalarBgraToRgba, ScalarBgraToBgr, ScalarBgrToBgra,
+        ScalarBgr555ToBgra, ScalarBgr565ToBgra, ScalarBgraToGray,
+        ScalarForceOpaque, ScalarFlipRows };
+
+#if defined(SHOTCAP_X86)
+    const PixelKernels kSse2Kernels = {
+        "sse2",
+        ScalarBgraToRgb, Sse2BgraToRgba, ScalarBgraToBgr, ScalarBgrToBgra,
+        Sse2Bgr555ToBgra, Sse2Bgr565ToBgra, Sse2BgraToGray,
+        Sse2ForceOpaque, Sse2FlipRows };
+
+    const PixelKernels kSsse3Kernels = {
+        "ssse3",
+        Ssse3BgraToRgb, Ssse3BgraToRgba, Ssse3BgraToBgr, Ssse3BgrToBgra,
+        Sse2Bgr555ToBgra, Sse2Bgr565ToBgra, Sse2BgraToGray,
+        Sse2ForceOpaque, Sse2FlipRows };
+
+    const PixelKernels kAvx2Kernels = {
+        "avx2",
+        Avx2BgraToRgb, Avx2BgraToRgba, Avx2BgraToBgr, Ssse3BgrToBgra,
+        Sse2Bgr555ToBgra, Sse2Bgr565ToBgra, Avx2BgraToGray,
+        Avx2ForceOpaque, Avx2FlipRows };
+#endif
+}
+
+//---------------------------------------------------------------------
+const PixelKernels* PixelKernelsFor(PixelKernelLevel level)
+{
+    const CpuFeatures& cpu = GetCpuFeatures();
+    switch (level)
+    {
+    case PixelKernelLevel::Scalar:
+        return &kScalarKernels;
+#if defined(SHOTCAP_X86)
+    case PixelKernelLevel::Sse2:
+        return cpu.sse2 ? &kSse2Kernels : nullptr;
+    case PixelKernelLevel::Ssse3:
+        return cpu.sse2 && cpu.ssse3 ? &kSsse3Kernels : nullptr;
+    case PixelKernelLevel::Avx2:
+        return cpu.sse2 && cpu.ssse3 && cpu.avx2 ? &kAvx2Kernels : nullptr;
+#endif
+    default:
+        (void)cpu;
+        return nullptr;
+    }
+}
+
+const PixelKernels& ActivePixelKernels()
+{
+    static const PixelKernels* kernels = []()
+        {
+            const PixelKernelLevel levels[] = {
+                PixelKernelLevel::Avx2, PixelKernelLevel::Ssse3, PixelKernelLevel::Sse2 };
+            for (PixelKernelLevel level : levels)
+            {
+                if (const PixelKernels* k = PixelKernelsFor(level))
+                    return k;
+            }
+            return &kScalarKernels;
+        }();
+    return *kernels;
+}
+
+//---------------------------------------------------------------------
+void BgraToRgb(const uint8_t* src, uint8_t* dst, int width) { ActivePixelKernels().bgraToRgb(src, dst, width); }
+void BgraToRgba(const uint8_t* src, uint8_t* dst, int width) { ActivePixelKernels().bgraToRgba(src, dst, width); }
+void BgraToBgr(const uint8_t* src, uint8_t* dst, int width) { ActivePixelKernels().bgraToBgr(src, dst, width); }
+void BgrToBgra(const uint8_t* src, uint8_t* dst, int width) { ActivePixelKernels().bgrToBgra(src, dst, width); }
+void Bgr555ToBgra(const uint8_t* src, uint8_t* dst, int width) { ActivePixelKernels().bgr555ToBgra(src, dst, width); }
+void Bgr565ToBgra(const uint8_t* src, uint8_t* dst, int width) { ActivePixelKernels().bgr565ToBgra(src, dst, width); }
+void BgraToGray(const uint8_t* src, uint8_t* dst, int width) { ActivePixelKernels().bgraToGray(src, dst, width); }
+void ForceOpaque(uint8_t* pixels, int width) { ActivePixelKernels().forceOpaque(pixels, width); }
+
+void FlipRows(uint8_t* data, size_t rowBytes, int height, ptrdiff_t stride)
+{
+    ActivePixelKernels().flipRows(data, rowBytes, height, stride);
+}
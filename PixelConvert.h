@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+//---------------------------------------------------------------------
+// Row kernels for the pixel layouts ShotCap deals with: 32 bpp BGRA/BGRX
+// from GDI, packed 24 bpp BGR (sequence files), 16 bpp 555/565 DIBs, and
+// the RGB(A) byte order PNG wants. Each call converts one row of width
+// pixels; src and dst must not overlap.
+//
+// The implementation is picked once per process from the CPU features:
+// AVX2, then SSSE3, then SSE2, then plain C++. Every level produces
+// exactly the same bytes as the scalar one.
+
+void BgraToRgb(const uint8_t* src, uint8_t* dst, int width);    // 32 -> 24, swap R/B
+void BgraToRgba(const uint8_t* src, uint8_t* dst, int width);   // 32 -> 32, swap R/B
+void BgraToBgr(const uint8_t* src, uint8_t* dst, int width);    // 32 -> 24, drop alpha
+void BgrToBgra(const uint8_t* src, uint8_t* dst, int width);    // 24 -> 32, alpha 255
+void Bgr555ToBgra(const uint8_t* src, uint8_t* dst, int width); // 16 -> 32, alpha 255
+void Bgr565ToBgra(const uint8_t* src, uint8_t* dst, int width); // 16 -> 32, alpha 255
+void BgraToGray(const uint8_t* src, uint8_t* dst, int width);   // BT.601 luma, 8 bpp
+
+// Set alpha to 255 in place.
+void ForceOpaque(uint8_t* pixels, int width);
+
+// Reverse the order of height rows of rowBytes each, in place, turning a
+// bottom-up DIB into a top-down one and back.
+void FlipRows(uint8_t* data, size_t rowBytes, int height, ptrdiff_t stride);
+
+//---------------------------------------------------------------------
+// The kernel tables behind the functions above, for tests and benchmarks
+// that compare levels.
+enum class PixelKernelLevel
+{
+    Scalar,
+    Sse2,
+    Ssse3,
+    Avx2
+};
+
+struct PixelKernels
+{
+    const char* name;
+    void (*bgraToRgb)(const uint8_t*, uint8_t*, int);
+    void (*bgraToRgba)(const uint8_t*, uint8_t*, int);
+    void (*bgraToBgr)(const uint8_t*, uint8_t*, int);
+    void (*bgrToBgra)(const uint8_t*, uint8_t*, int);
+    void (*bgr555ToBgra)(const uint8_t*, uint8_t*, int);
+    void (*bgr565ToBgra)(const uint8_t*, uint8_t*, int);
+    void (*bgraToGray)(const uint8_t*, uint8_t*, int);
+    void (*forceOpaque)(uint8_t*, int);
+    void (*flipRows)(uint8_t*, size_t, int, ptrdiff_t);
+};
+
+// The table used by the functions above.
+const PixelKernels& ActivePixelKernels();
+
+// The table for one level, or null when this CPU or build cannot run it.
+const PixelKernels* PixelKernelsFor(PixelKernelLevel level);
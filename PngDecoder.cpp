@@ -0,0 +1,448 @@
+#include "PngDecoder.h"
+#include "Checksum.h"
+#include "CpuFeatures.h"
+#include "Inflate.h"
+#include "PixelConvert.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(SHOTCAP_SSE2)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    const uint8_t kSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    // Same limit as DecodeQoi: 1.6 GB of decoded pixels.
+    const uint64_t kMaxPixels = 400000000;
+
+    // Adam7 passes: first column and row, and the steps between them.
+    const int kPassX[7] = { 0, 4, 0, 2, 0, 1, 0 };
+    const int kPassY[7] = { 0, 0, 4, 0, 2, 0, 1 };
+    const int kPassStepX[7] = { 8, 8, 4, 4, 2, 2, 1 };
+    const int kPassStepY[7] = { 8, 8, 8, 4, 4, 2, 2 };
+
+    uint32_t GetU32BE(const uint8_t* p)
+    {
+        return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+            (static_cast<uint32_t>(p[2]) << 8) | p[3];
+    }
+
+    struct PngHeader
+    {
+        uint32_t width = 0;
+        uint32_t height = 0;
+        int bitDepth = 0;
+        int colorType = 0;
+        bool interlaced = false;
+
+        int Samples() const
+        {
+            switch (colorType)
+            {
+            case 2: return 3;
+            case 4: return 2;
+            case 6: return 4;
+            default: return 1;      // Grey, palette.
+            }
+        }
+
+        // Filter stride: bytes per complete pixel, at least one.
+        int FilterBytes() const { return (std::max)(1, Samples() * bitDepth / 8); }
+        uint64_t RowBytes(uint32_t pixels) const { return (static_cast<uint64_t>(pixels) * Samples() * bitDepth + 7) / 8; }
+    };
+
+    bool ValidDepth(int colorType, int depth)
+    {
+        switch (colorType)
+        {
+        case 0: return depth == 1 || depth == 2 || depth == 4 || depth == 8 || depth == 16;
+        case 3: return depth == 1 || depth == 2 || depth == 4 || depth == 8;
+        case 2:
+        case 4:
+        case 6: return depth == 8 || depth == 16;
+        default: return false;
+        }
+    }
+
+    // PLTE and tRNS, resolved to what a pixel decodes to.
+    struct ColourTable
+    {
+        uint32_t palette[256];          // BGRA; entries past the PLTE are opaque black.
+        int paletteSize = 0;
+        bool hasKey = false;            // tRNS for grey and truecolour: this colour is transparent.
+        uint32_t key[3] = { 0, 0, 0 };  // At the file's bit depth.
+    };
+
+    uint8_t Paeth(uint8_t a, uint8_t b, uint8_t c)
+    {
+        const int pa = std::abs(b - c);
+        const int pb = std::abs(a - c);
+        const int pc = std::abs(a + b - 2 * c);
+        return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+    }
+
+#if defined(SHOTCAP_SSE2)
+    // Sub, Avg and Paeth of 8-bit RGB and RGBA rows a pixel at a time, each
+    // pixel in the low lanes of a register, as libpng's SSE2 filters do.
+    template <int Bytes>
+    inline __m128i LoadPixel(const uint8_t* p)
+    {
+        int value = 0;
+        memcpy(&value, p, Bytes);
+        return _mm_cvtsi32_si128(value);
+    }
+
+    template <int Bytes>
+    inline void StorePixel(uint8_t* p, __m128i pixel)
+    {
+        const int value = _mm_cvtsi128_si32(pixel);
+        memcpy(p, &value, Bytes);
+    }
+
+    inline __m128i Abs16(__m128i value)
+    {
+        return _mm_max_epi16(value, _mm_sub_epi16(_mm_setzero_si128(), value));
+    }
+
+    template <int Bytes>
+    bool Sse2Unfilter(uint8_t filter, uint8_t* row, const uint8_t* prior, size_t rowBytes)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i a = zero;
+        switch (filter)
+        {
+        case 1:
+            for (size_t i = 0; i < rowBytes; i += Bytes)
+            {
+                a = _mm_add_epi8(a, LoadPixel<Bytes>(row + i));
+                StorePixel<Bytes>(row + i, a);
+            }
+            return true;
+        case 3:
+            for (size_t i = 0; i < rowBytes; i += Bytes)
+            {
+                const __m128i b = LoadPixel<Bytes>(prior + i);
+                // avg_epu8 rounds up; the filter rounds down.
+                const __m128i mean = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+                a = _mm_add_epi8(mean, LoadPixel<Bytes>(row + i));
+                StorePixel<Bytes>(row + i, a);
+            }
+            return true;
+        case 4:
+        {
+            // 16-bit lanes; c is the pixel above and to the left.
+            __m128i c = zero;
+            for (size_t i = 0; i < rowBytes; i += Bytes)
+            {
+                const __m128i b = _mm_unpacklo_epi8(LoadPixel<Bytes>(prior + i), zero);
+                const __m128i towardsA = _mm_sub_epi16(b, c);
+                const __m128i towardsB = _mm_sub_epi16(a, c);
+                const __m128i pa = Abs16(towardsA);
+                const __m128i pb = Abs16(towardsB);
+                const __m128i pc = Abs16(_mm_add_epi16(towardsA, towardsB));
+                const __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+                const __m128i useA = _mm_cmpeq_epi16(smallest, pa);
+                const __m128i useB = _mm_andnot_si128(useA, _mm_cmpeq_epi16(smallest, pb));
+                const __m128i nearest = _mm_or_si128(_mm_or_si128(_mm_and_si128(useA, a), _mm_and_si128(useB, b)),
+                    _mm_andnot_si128(_mm_or_si128(useA, useB), c));
+                // Byte adds leave the high half of each lane zero.
+                a = _mm_add_epi8(_mm_unpacklo_epi8(LoadPixel<Bytes>(row + i), zero), nearest);
+                StorePixel<Bytes>(row + i, _mm_packus_epi16(a, a));
+                c = b;
+            }
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+#endif
+
+    // Undo the filter of one row in place; prior is the row above, already
+    // unfiltered (zeros for the first row of an image or pass).
+    bool Unfilter(uint8_t filter, uint8_t* row, const uint8_t* prior, size_t rowBytes, size_t bpp)
+    {
+#if defined(SHOTCAP_SSE2)
+        if ((bpp == 3 || bpp == 4) && (filter == 1 || filter == 3 || filter == 4))
+            return bpp == 3 ? Sse2Unfilter<3>(filter, row, prior, rowBytes) : Sse2Unfilter<4>(filter, row, prior, rowBytes);
+#endif
+        const size_t lead = (std::min)(bpp, rowBytes);
+        switch (filter)
+        {
+        case 0:
+            return true;
+        case 1:
+            for (size_t i = bpp; i < rowBytes; i++)
+                row[i] = static_cast<uint8_t>(row[i] + row[i - bpp]);
+            return true;
+        case 2:
+        {
+            size_t i = 0;
+#if defined(SHOTCAP_SSE2)
+            for (; i + 16 <= rowBytes; i += 16)
+            {
+                __m128i* out = reinterpret_cast<__m128i*>(row + i);
+                _mm_storeu_si128(out, _mm_add_epi8(_mm_loadu_si128(out),
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(prior + i))));
+            }
+#endif
+            for (; i < rowBytes; i++)
+                row[i] = static_cast<uint8_t>(row[i] + prior[i]);
+            return true;
+        }
+        case 3:
+            for (size_t i = 0; i < lead; i++)
+                row[i] = static_cast<uint8_t>(row[i] + (prior[i] >> 1));
+            for (size_t i = bpp; i < rowBytes; i++)
+                row[i] = static_cast<uint8_t>(row[i] + ((row[i - bpp] + prior[i]) >> 1));
+            return true;
+        case 4:
+            for (size_t i = 0; i < lead; i++)
+                row[i] = static_cast<uint8_t>(row[i] + prior[i]);
+            for (size_t i = bpp; i < rowBytes; i++)
+                row[i] = static_cast<uint8_t>(row[i] + Paeth(row[i - bpp], prior[i], prior[i - bpp]));
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    inline uint32_t Sample(const uint8_t* row, size_t index, int depth)
+    {
+        switch (depth)
+        {
+        case 8: return row[index];
+        case 16: return (static_cast<uint32_t>(row[index * 2]) << 8) | row[index * 2 + 1];
+        default:
+        {
+            const size_t bit = index * depth;
+            return (row[bit >> 3] >> (8 - depth - (bit & 7))) & ((1u << depth) - 1);
+        }
+        }
+    }
+
+    inline uint32_t To8Bit(uint32_t value, int depth)
+    {
+        return depth == 16 ? value >> 8 : depth == 8 ? value : value * 255 / ((1u << depth) - 1);
+    }
+
+    // Decode count pixels of an unfiltered row to BGRA, step pixels apart
+    // in out. scratch holds at least count * 4 bytes.
+    void ConvertRow(const uint8_t* row, uint32_t count, const PngHeader& header, const ColourTable& colours,
+        uint8_t* out, size_t step, uint8_t* scratch)
+    {
+        const int depth = header.bitDepth;
+        if (step == 1 && depth == 8 && header.colorType == 6)
+        {
+            BgraToRgba(row, out, static_cast<int>(count));      // Swapping R and B works both ways.
+            return;
+        }
+        if (step == 1 && depth == 8 && header.colorType == 2 && !colours.hasKey)
+        {
+            BgrToBgra(row, scratch, static_cast<int>(count));
+            BgraToRgba(scratch, out, static_cast<int>(count));
+            return;
+        }
+
+        for (uint32_t x = 0; x < count; x++, out += step * 4)
+        {
+            uint32_t b, g, r, a = 255;
+            switch (header.colorType)
+            {
+            case 0:
+            {
+                const uint32_t grey = Sample(row, x, depth);
+                if (colours.hasKey && grey == colours.key[0])
+                    a = 0;
+                b = g = r = To8Bit(grey, depth);
+                break;
+            }
+            case 2:
+            {
+                const uint32_t rs = Sample(row, x * 3, depth);
+                const uint32_t gs = Sample(row, x * 3 + 1, depth);
+                const uint32_t bs = Sample(row, x * 3 + 2, depth);
+                if (colours.hasKey && rs == colours.key[0] && gs == colours.key[1] && bs == colours.key[2])
+                    a = 0;
+                r = To8Bit(rs, depth);
+                g = To8Bit(gs, depth);
+                b = To8Bit(bs, depth);
+                break;
+            }
+            case 3:
+            {
+                const uint32_t colour = colours.palette[Sample(row, x, depth)];
+                memcpy(out, &colour, 4);
+                continue;
+            }
+            case 4:
+                b = g = r = To8Bit(Sample(row, x * 2, depth), depth);
+                a = To8Bit(Sample(row, x * 2 + 1, depth), depth);
+                break;
+            default:
+                r = To8Bit(Sample(row, x * 4, depth), depth);
+                g = To8Bit(Sample(row, x * 4 + 1, depth), depth);
+                b = To8Bit(Sample(row, x * 4 + 2, depth), depth);
+                a = To8Bit(Sample(row, x * 4 + 3, depth), depth);
+                break;
+            }
+            out[0] = static_cast<uint8_t>(b);
+            out[1] = static_cast<uint8_t>(g);
+            out[2] = static_cast<uint8_t>(r);
+            out[3] = static_cast<uint8_t>(a);
+        }
+    }
+
+    bool ReadHeader(const uint8_t* body, uint32_t length, PngHeader& header)
+    {
+        if (length != 13)
+            return false;
+        header.width = GetU32BE(body);
+        header.height = GetU32BE(body + 4);
+        header.bitDepth = body[8];
+        header.colorType = body[9];
+        header.interlaced = body[12] == 1;
+        return header.width > 0 && header.height > 0 && header.width <= 0x7FFFFFFF && header.height <= 0x7FFFFFFF &&
+            static_cast<uint64_t>(header.width) * header.height <= kMaxPixels &&
+            ValidDepth(header.colorType, header.bitDepth) && body[10] == 0 && body[11] == 0 && body[12] <= 1;
+    }
+}
+
+//---------------------------------------------------------------------
+bool DecodePng(const uint8_t* data, size_t size, std::vector<uint8_t>& pixels,
+    int& width, int& height, int& channels)
+{
+    if (size < sizeof(kSignature) || memcmp(data, kSignature, sizeof(kSignature)) != 0)
+        return false;
+
+    PngHeader header;
+    ColourTable colours;
+    for (int i = 0; i < 256; i++)
+        colours.palette[i] = 0xFF000000;
+    uint8_t paletteAlpha[256];
+    memset(paletteAlpha, 255, sizeof(paletteAlpha));
+    bool seenHeader = false, seenEnd = false, transparency = false;
+    std::vector<uint8_t> compressed;
+
+    for (size_t pos = sizeof(kSignature); !seenEnd; )
+    {
+        if (size - pos < 12)
+            return false;
+        const uint32_t length = GetU32BE(data + pos);
+        const uint8_t* type = data + pos + 4;
+        const uint8_t* body = type + 4;
+        if (length > size - pos - 12 || GetU32BE(body + length) != Crc32(0, type, length + 4))
+            return false;
+        pos += 12 + static_cast<size_t>(length);
+
+        const bool isHeader = memcmp(type, "IHDR", 4) == 0;
+        if (isHeader != !seenHeader)
+            return false;
+        if (isHeader)
+        {
+            if (!ReadHeader(body, length, header))
+                return false;
+            seenHeader = true;
+        }
+        else if (memcmp(type, "PLTE", 4) == 0)
+        {
+            if (length == 0 || length % 3 != 0 || length > 256 * 3)
+                return false;
+            colours.paletteSize = static_cast<int>(length / 3);
+            for (int i = 0; i < colours.paletteSize; i++)
+            {
+                const uint8_t* rgb = body + i * 3;
+                colours.palette[i] = (static_cast<uint32_t>(rgb[0]) << 16) | (static_cast<uint32_t>(rgb[1]) << 8) | rgb[2];
+            }
+        }
+        else if (memcmp(type, "tRNS", 4) == 0)
+        {
+            if (header.colorType == 3 && length <= 256)
+                memcpy(paletteAlpha, body, length);
+            else if (header.colorType == 0 && length == 2)
+                colours.key[0] = (static_cast<uint32_t>(body[0]) << 8) | body[1];
+            else if (header.colorType == 2 && length == 6)
+            {
+                for (int c = 0; c < 3; c++)
+                    colours.key[c] = (static_cast<uint32_t>(body[c * 2]) << 8) | body[c * 2 + 1];
+            }
+            else
+                return false;
+            colours.hasKey = header.colorType != 3;
+            transparency = true;
+        }
+        else if (memcmp(type, "IDAT", 4) == 0)
+        {
+            compressed.insert(compressed.end(), body, body + length);
+        }
+        else if (memcmp(type, "IEND", 4) == 0)
+        {
+            seenEnd = true;
+        }
+        else if (!(type[0] & 0x20))
+        {
+            return false;       // An unknown critical chunk.
+        }
+    }
+    if (compressed.empty() || (header.colorType == 3 && colours.paletteSize == 0))
+        return false;
+    for (int i = 0; i < 256; i++)
+        colours.palette[i] = (colours.palette[i] & 0x00FFFFFF) | (static_cast<uint32_t>(paletteAlpha[i]) << 24);
+
+    // Every pass is a small image of its own: rows of a filter byte and
+    // the packed samples.
+    const int passes = header.interlaced ? 7 : 1;
+    uint64_t expected = 0;
+    for (int pass = 0; pass < passes; pass++)
+    {
+        const uint32_t x0 = header.interlaced ? kPassX[pass] : 0, dx = header.interlaced ? kPassStepX[pass] : 1;
+        const uint32_t y0 = header.interlaced ? kPassY[pass] : 0, dy = header.interlaced ? kPassStepY[pass] : 1;
+        if (header.width > x0 && header.height > y0)
+        {
+            const uint32_t passWidth = (header.width - x0 + dx - 1) / dx;
+            const uint32_t passHeight = (header.height - y0 + dy - 1) / dy;
+            expected += passHeight * (1 + header.RowBytes(passWidth));
+        }
+    }
+    if (expected > SIZE_MAX / 2)
+        return false;
+    std::vector<uint8_t> raw;
+    raw.reserve(static_cast<size_t>(expected));
+    if (!InflateZlib(compressed.data(), compressed.size(), raw, static_cast<size_t>(expected)) || raw.size() != expected)
+        return false;
+    compressed = std::vector<uint8_t>();
+
+    width = static_cast<int>(header.width);
+    height = static_cast<int>(header.height);
+    channels = header.colorType == 4 || header.colorType == 6 || transparency ? 4 : 3;
+    pixels.resize(static_cast<size_t>(header.width) * header.height * 4);
+    std::vector<uint8_t> zeros(static_cast<size_t>(header.RowBytes(header.width)), 0);
+    std::vector<uint8_t> scratch(static_cast<size_t>(header.width) * 4);
+    const size_t bpp = header.FilterBytes();
+
+    uint8_t* row = raw.data();
+    for (int pass = 0; pass < passes; pass++)
+    {
+        const uint32_t x0 = header.interlaced ? kPassX[pass] : 0, dx = header.interlaced ? kPassStepX[pass] : 1;
+        const uint32_t y0 = header.interlaced ? kPassY[pass] : 0, dy = header.interlaced ? kPassStepY[pass] : 1;
+        if (header.width <= x0 || header.height <= y0)
+            continue;
+        const uint32_t passWidth = (header.width - x0 + dx - 1) / dx;
+        const size_t rowBytes = static_cast<size_t>(header.RowBytes(passWidth));
+        const uint8_t* prior = zeros.data();
+        for (uint32_t y = y0; y < header.height; y += dy)
+        {
+            uint8_t* samples = row + 1;
+            if (!Unfilter(row[0], samples, prior, rowBytes, bpp))
+                return false;
+            ConvertRow(samples, passWidth, header, colours,
+                &pixels[(static_cast<size_t>(y) * header.width + x0) * 4], dx, scratch.data());
+            prior = samples;
+            row += 1 + rowBytes;
+        }
+    }
+    return true;
+}
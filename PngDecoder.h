@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//---------------------------------------------------------------------
+// PNG decoder for -compare, so baselines can be read from disk into
+// memory without going through GDI+. Handles every colour type and bit
+// depth of the PNG specification, tRNS transparency and Adam7
+// interlacing; 16-bit samples are cut to their high byte. Chunk CRCs are
+// checked, ancillary chunks other than tRNS (gamma, colour profiles,
+// text) are skipped. Portable: builds and runs on Linux for the bench.
+
+// Decode a PNG file into top-down 32 bpp BGRA (alpha 255 where the file
+// has none). channels is 4 when the file carries alpha (an alpha channel
+// or tRNS) and 3 otherwise. Fails on anything truncated or malformed.
+bool DecodePng(const uint8_t* data, size_t size, std::vector<uint8_t>& pixels,
+    int& width, int& height, int& channels);
@@ -0,0 +1,620 @@
+#include "PngEncoder.h"
+#include "Checksum.h"
+#include "CpuFeatures.h"
+#include "PixelConvert.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(SHOTCAP_SSE2)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    enum PngFilter
+    {
+        FilterNone = 0,
+        FilterSub = 1,
+        FilterUp = 2,
+        FilterAvg = 3,
+        FilterPaeth = 4,
+        FilterCount = 5
+    };
+
+    // IDAT payload is written in chunks of at most this size.
+    const size_t kIdatChunkSize = size_t(1) << 18;
+
+    // Strips hold at least this much filtered data; each one costs a block
+    // restart and a priming window, so small images stay in one strip.
+    const size_t kMinStripBytes = size_t(1) << 19;
+    const int kMaxStrips = 64;
+
+    // Deflate history a primed strip can refer back into.
+    const size_t kDictionaryBytes = 32768;
+
+    // -palette lossy only quantizes frames whose 256 most common colours
+    // (at 5 bits per channel) cover this much of the image; anything with
+    // more colour than that, like a photo, would visibly band.
+    const double kLossyCoverage = 0.99;
+
+    void AppendU32BE(std::vector<uint8_t>& out, uint32_t value)
+    {
+        out.push_back(static_cast<uint8_t>(value >> 24));
+        out.push_back(static_cast<uint8_t>(value >> 16));
+        out.push_back(static_cast<uint8_t>(value >> 8));
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    void WriteChunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t size)
+    {
+        AppendU32BE(out, static_cast<uint32_t>(size));
+        size_t typeOffset = out.size();
+        out.insert(out.end(), type, type + 4);
+        if (size > 0)
+            out.insert(out.end(), data, data + size);
+        AppendU32BE(out, Crc32(0, out.data() + typeOffset, size + 4));
+    }
+
+    void WriteIdat(std::vector<uint8_t>& out, const std::vector<uint8_t>& data)
+    {
+        for (size_t offset = 0; offset < data.size(); offset += kIdatChunkSize)
+            WriteChunk(out, "IDAT", data.data() + offset, (std::min)(kIdatChunkSize, data.size() - offset));
+    }
+
+    //---------------------------------------------------------------------
+    // BGRA -> RGB / RGBA for one scanline.
+    void ConvertRow(const uint8_t* src, int width, bool keepAlpha, uint8_t* dst)
+    {
+        if (keepAlpha)
+            BgraToRgba(src, dst, width);
+        else
+            BgraToRgb(src, dst, width);
+    }
+
+    //---------------------------------------------------------------------
+    // Scanline filters. cur and prior are preceded by bpp zero bytes so the
+    // left neighbours of the first pixel need no special case. Every filter
+    // is computed and scored with the usual minimum-sum-of-absolute-values
+    // heuristic, treating residuals as signed bytes.
+    inline uint8_t PaethPredictor(int a, int b, int c)
+    {
+        int pa = std::abs(b - c);
+        int pb = std::abs(a - c);
+        int pc = std::abs(a + b - 2 * c);
+        if (pa <= pb && pa <= pc)
+            return static_cast<uint8_t>(a);
+        return static_cast<uint8_t>(pb <= pc ? b : c);
+    }
+
+    inline uint32_t ResidualCost(uint8_t v)
+    {
+        return v < 128 ? v : 256u - v;
+    }
+
+    void FilterRowScalar(const uint8_t* cur, const uint8_t* prior, size_t begin, size_t length, int bpp,
+        uint8_t* const* out, uint64_t* costs)
+    {
+        for (size_t i = begin; i < length; i++)
+        {
+            uint8_t x = cur[i];
+            uint8_t a = cur[static_cast<ptrdiff_t>(i) - bpp];
+            uint8_t b = prior[i];
+            uint8_t c = prior[static_cast<ptrdiff_t>(i) - bpp];
+            uint8_t sub = static_cast<uint8_t>(x - a);
+            uint8_t up = static_cast<uint8_t>(x - b);
+            uint8_t avg = static_cast<uint8_t>(x - ((a + b) >> 1));
+            uint8_t paeth = static_cast<uint8_t>(x - PaethPredictor(a, b, c));
+            out[FilterSub][i] = sub;
+            out[FilterUp][i] = up;
+            out[FilterAvg][i] = avg;
+            out[FilterPaeth][i] = paeth;
+            costs[FilterNone] += ResidualCost(x);
+            costs[FilterSub] += ResidualCost(sub);
+            costs[FilterUp] += ResidualCost(up);
+            costs[FilterAvg] += ResidualCost(avg);
+            costs[FilterPaeth] += ResidualCost(paeth);
+        }
+    }
+
+#if defined(SHOTCAP_SSE2)
+    inline __m128i Abs16(__m128i v)
+    {
+        return _mm_max_epi16(v, _mm_sub_epi16(_mm_setzero_si128(), v));
+    }
+
+    inline __m128i Select(__m128i mask, __m128i ifSet, __m128i ifClear)
+    {
+        return _mm_or_si128(_mm_and_si128(mask, ifSet), _mm_andnot_si128(mask, ifClear));
+    }
+
+    // Paeth predictor on eight 16-bit lanes.
+    inline __m128i PaethPredictor16(__m128i a, __m128i b, __m128i c)
+    {
+        __m128i bc = _mm_sub_epi16(b, c);
+        __m128i ac = _mm_sub_epi16(a, c);
+        __m128i pa = Abs16(bc);
+        __m128i pb = Abs16(ac);
+        __m128i pc = Abs16(_mm_add_epi16(bc, ac));
+        __m128i smallest = _mm_min_epi16(pa, _mm_min_epi16(pb, pc));
+        __m128i result = Select(_mm_cmpeq_epi16(pb, smallest), b, c);
+        return Select(_mm_cmpeq_epi16(pa, smallest), a, result);
+    }
+
+    // min(v, -v) as unsigned bytes, summed into two 64-bit lanes. A lane
+    // grows by at most 1024 per 16 bytes, so the low 32 bits never wrap
+    // for any realistic row length.
+    inline __m128i AccumulateCost(__m128i sum, __m128i v)
+    {
+        __m128i zero = _mm_setzero_si128();
+        __m128i magnitude = _mm_min_epu8(v, _mm_sub_epi8(zero, v));
+        return _mm_add_epi64(sum, _mm_sad_epu8(magnitude, zero));
+    }
+
+    inline uint64_t HorizontalSum(__m128i v)
+    {
+        return static_cast<uint64_t>(_mm_cvtsi128_si32(v)) +
+            static_cast<uint64_t>(_mm_cvtsi128_si32(_mm_srli_si128(v, 8)));
+    }
+
+    // Filters 16 bytes per iteration; returns how many bytes were handled.
+    size_t FilterRowSse2(const uint8_t* cur, const uint8_t* prior, size_t length, int bpp,
+        uint8_t* const* out, uint64_t* costs)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi8(1);
+        __m128i sums[FilterCount];
+        for (int f = 0; f < FilterCount; f++)
+            sums[f] = zero;
+
+        size_t i = 0;
+        for (; i + 16 <= length; i += 16)
+        {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + i));
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(cur + i - bpp));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prior + i));
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(prior + i - bpp));
+
+            __m128i sub = _mm_sub_epi8(x, a);
+            __m128i up = _mm_sub_epi8(x, b);
+            // _mm_avg_epu8 rounds up; PNG's Avg predictor rounds down.
+            __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+            __m128i avg = _mm_sub_epi8(x, average);
+            __m128i predLo = PaethPredictor16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero),
+                _mm_unpacklo_epi8(c, zero));
+            __m128i predHi = PaethPredictor16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero),
+                _mm_unpackhi_epi8(c, zero));
+            __m128i paeth = _mm_sub_epi8(x, _mm_packus_epi16(predLo, predHi));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out[FilterSub] + i), sub);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out[FilterUp] + i), up);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out[FilterAvg] + i), avg);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out[FilterPaeth] + i), paeth);
+
+            sums[FilterNone] = AccumulateCost(sums[FilterNone], x);
+            sums[FilterSub] = AccumulateCost(sums[FilterSub], sub);
+            sums[FilterUp] = AccumulateCost(sums[FilterUp], up);
+            sums[FilterAvg] = AccumulateCost(sums[FilterAvg], avg);
+            sums[FilterPaeth] = AccumulateCost(sums[FilterPaeth], paeth);
+        }
+        for (int f = 0; f < FilterCount; f++)
+            costs[f] += HorizontalSum(sums[f]);
+        return i;
+    }
+#endif
+
+    // Filter one scanline and return the chosen filter type; the filtered
+    // bytes are in out[type] (or cur itself for FilterNone).
+    int FilterRow(const uint8_t* cur, const uint8_t* prior, size_t length, int bpp, uint8_t* const* out)
+    {
+        uint64_t costs[FilterCount] = { 0, 0, 0, 0, 0 };
+        size_t done = 0;
+#if defined(SHOTCAP_SSE2)
+        done = FilterRowSse2(cur, prior, length, bpp, out, costs);
+#endif
+        FilterRowScalar(cur, prior, done, length, bpp, out, costs);
+
+        int best = FilterNone;
+        for (int f = FilterSub; f < FilterCount; f++)
+        {
+            if (costs[f] < costs[best])
+                best = f;
+        }
+        return best;
+    }
+}
+
+//---------------------------------------------------------------------
+namespace
+{
+    struct StripSetup
+    {
+        // Rows from firstRow on are in pixels; the few just above it that
+        // strips are primed with may come from history instead.
+        const uint8_t* pixels;
+        ptrdiff_t stride;
+        int firstRow;
+        const uint8_t* history;
+        size_t historyStride;
+        int historyRow;             // Row held at the start of history.
+        int width;
+        int height;
+        int stripBase;              // First row of strip 0.
+        int endRow;                 // Strips stop here.
+        bool keepAlpha;
+        int bpp;
+        size_t rowBytes;
+        CompressionLevel level;
+        int rowsPerStrip;
+        uint8_t zlibHeader[2];      // Opens the first strip.
+        const IndexedPalette* palette;  // Rows are packed indices when set.
+
+        const uint8_t* Row(int y) const
+        {
+            if (y >= firstRow)
+                return pixels + (y - firstRow) * stride;
+            return history + static_cast<size_t>(y - historyRow) * historyStride;
+        }
+    };
+}
+
+// Scratch space and output of one strip.
+struct PngStrip
+{
+    PngStrip() : deflate(CompressionLevel::Default) {}
+
+    // Filter one converted row into line (filter byte first).
+    void FilterInto(const StripSetup& setup)
+    {
+        if (setup.palette)
+        {
+            line[0] = FilterNone;
+            memcpy(line.data() + 1, cur, setup.rowBytes);
+            return;
+        }
+        uint8_t* filterOut[FilterCount] = {
+            nullptr,
+            filtered.data(),
+            filtered.data() + setup.rowBytes,
+            filtered.data() + 2 * setup.rowBytes,
+            filtered.data() + 3 * setup.rowBytes };
+        int filter = FilterRow(cur, prior, setup.rowBytes, setup.bpp, filterOut);
+        line[0] = static_cast<uint8_t>(filter);
+        memcpy(line.data() + 1, filter == FilterNone ? cur : filterOut[filter], setup.rowBytes);
+    }
+
+    void ConvertInto(const StripSetup& setup, int y, uint8_t* row)
+    {
+        const uint8_t* src = setup.Row(y);
+        if (setup.palette)
+            setup.palette->MapRow(src, setup.width, row);
+        else
+            ConvertRow(src, setup.width, setup.keepAlpha, row);
+    }
+
+    void Encode(const StripSetup& setup, int index, bool last)
+    {
+        const size_t lineBytes = setup.rowBytes + 1;
+        const int y0 = setup.stripBase + index * setup.rowsPerStrip;
+        const int y1 = (std::min)(setup.endRow, y0 + setup.rowsPerStrip);
+
+        // Current and previous scanline, each preceded by bpp zero bytes.
+        rows.assign(2 * (setup.rowBytes + setup.bpp), 0);
+        cur = rows.data() + setup.bpp;
+        prior = rows.data() + setup.rowBytes + 2 * setup.bpp;
+        filtered.resize(4 * setup.rowBytes);
+        line.resize(lineBytes);
+        deflate.Reset(setup.level);
+        out.clear();
+        if (y0 == 0)
+            out.insert(out.end(), setup.zlibHeader, setup.zlibHeader + 2);
+
+        // Rows above the strip are filtered again (the filter choice depends
+        // only on the pixels) to rebuild the tail of the stream before it.
+        const int primeRows = (std::min)(y0, static_cast<int>((kDictionaryBytes + lineBytes - 1) / lineBytes));
+        if (primeRows > 0)
+        {
+            dictionary.clear();
+            if (y0 - primeRows > 0)
+                ConvertInto(setup, y0 - primeRows - 1, prior);
+            for (int y = y0 - primeRows; y < y0; y++)
+            {
+                ConvertInto(setup, y, cur);
+                FilterInto(setup);
+                dictionary.insert(dictionary.end(), line.begin(), line.end());
+                std::swap(cur, prior);
+            }
+            deflate.SetDictionary(dictionary.data(), dictionary.size());
+        }
+
+        adler = 1;
+        for (int y = y0; y < y1; y++)
+        {
+            ConvertInto(setup, y, cur);
+            FilterInto(setup);
+            adler = Adler32(adler, line.data(), lineBytes);
+            deflate.Write(line.data(), lineBytes, out);
+            std::swap(cur, prior);
+        }
+        if (last)
+            deflate.Finish(out);
+        else
+            deflate.Flush(out);
+        size = static_cast<uint64_t>(y1 - y0) * lineBytes;
+    }
+
+    DeflateStream deflate;
+    std::vector<uint8_t> rows;
+    std::vector<uint8_t> filtered;
+    std::vector<uint8_t> line;
+    std::vector<uint8_t> dictionary;
+    uint8_t* cur = nullptr;
+    uint8_t* prior = nullptr;
+
+    std::vector<uint8_t> out;       // This strip's part of the deflate stream.
+    uint32_t adler = 1;             // Adler-32 of the strip's filtered bytes.
+    uint64_t size = 0;
+};
+
+//---------------------------------------------------------------------
+namespace
+{
+    void SetZlibHeader(CompressionLevel level, uint8_t* header)
+    {
+        // FLEVEL only advertises the effort, any value is valid.
+        header[0] = 0x78;
+        switch (level)
+        {
+        case CompressionLevel::Fast: header[1] = 0x01; break;
+        case CompressionLevel::Max: header[1] = 0xDA; break;
+        default: header[1] = 0x9C; break;
+        }
+    }
+
+    // Signature and IHDR.
+    void WriteHeader(std::vector<uint8_t>& out, int width, int height, int bitDepth, int colorType)
+    {
+        static const uint8_t kSignature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        out.insert(out.end(), kSignature, kSignature + 8);
+
+        uint8_t ihdr[13];
+        ihdr[0] = static_cast<uint8_t>(width >> 24);
+        ihdr[1] = static_cast<uint8_t>(width >> 16);
+        ihdr[2] = static_cast<uint8_t>(width >> 8);
+        ihdr[3] = static_cast<uint8_t>(width);
+        ihdr[4] = static_cast<uint8_t>(height >> 24);
+        ihdr[5] = static_cast<uint8_t>(height >> 16);
+        ihdr[6] = static_cast<uint8_t>(height >> 8);
+        ihdr[7] = static_cast<uint8_t>(height);
+        ihdr[8] = static_cast<uint8_t>(bitDepth);
+        ihdr[9] = static_cast<uint8_t>(colorType);
+        ihdr[10] = 0;                               // Compression
+        ihdr[11] = 0;                               // Filter method
+        ihdr[12] = 0;                               // No interlace
+        WriteChunk(out, "IHDR", ihdr, sizeof(ihdr));
+    }
+
+    // Compress rows stripBase to endRow of setup as strips spread over the
+    // pool. last: the final strip ends the deflate stream. Returns the
+    // number of strips used. With only one thread to run them, strips
+    // would cost their priming and flushes for nothing, so the rows go out
+    // as a single strip.
+    int EncodeStrips(std::vector<std::unique_ptr<PngStrip>>& strips, StripSetup& setup, int threads, bool last)
+    {
+        const int rows = setup.endRow - setup.stripBase;
+        const size_t bytes = (setup.rowBytes + 1) * rows;
+        const bool oneThread = threads == 1 || SharedThreadPool().Concurrency() == 1;
+        int count = oneThread ? 1 : static_cast<int>((std::min)(static_cast<size_t>(kMaxStrips),
+            (std::max)(size_t(1), bytes / kMinStripBytes)));
+        setup.rowsPerStrip = (rows + count - 1) / count;
+        count = (rows + setup.rowsPerStrip - 1) / setup.rowsPerStrip;
+
+        while (strips.size() < static_cast<size_t>(count))
+            strips.emplace_back(new PngStrip());
+        auto encodeStrip = [&](int index) { strips[index]->Encode(setup, index, last && index == count - 1); };
+        if (threads == 1 || count == 1)
+        {
+            for (int index = 0; index < count; index++)
+                encodeStrip(index);
+        }
+        else
+        {
+            SharedThreadPool().ParallelFor(count, encodeStrip, threads);
+        }
+        return count;
+    }
+}
+
+//---------------------------------------------------------------------
+PngEncoder::PngEncoder()
+{
+}
+
+PngEncoder::~PngEncoder()
+{
+}
+
+bool PngEncoder::Encode(const uint8_t* pixels, int width, int height, int stride,
+    const PngOptions& options, std::vector<uint8_t>& out)
+{
+    out.clear();
+    // A negative stride walks bottom-up rows, as FrameView allows.
+    if (!pixels || width <= 0 || height <= 0 || (stride < 0 ? -stride : stride) < width * 4)
+        return false;
+
+    StripSetup setup;
+    setup.pixels = pixels;
+    setup.stride = stride;
+    setup.firstRow = 0;
+    setup.history = nullptr;
+    setup.historyStride = 0;
+    setup.historyRow = 0;
+    setup.width = width;
+    setup.height = height;
+    setup.stripBase = 0;
+    setup.endRow = height;
+    setup.keepAlpha = options.keepAlpha;
+    setup.level = options.level;
+    setup.palette = nullptr;
+    if (options.palette != PaletteMode::Off)
+    {
+        if (palette_.BuildExact(pixels, width, height, stride, options.keepAlpha) ||
+            (options.palette == PaletteMode::Lossy && !options.keepAlpha &&
+                palette_.BuildQuantized(pixels, width, height, stride, kLossyCoverage)))
+        {
+            setup.palette = &palette_;
+        }
+    }
+    if (setup.palette)
+    {
+        setup.bpp = 1;
+        setup.rowBytes = palette_.RowBytes(width);
+    }
+    else
+    {
+        setup.bpp = options.keepAlpha ? 4 : 3;
+        setup.rowBytes = static_cast<size_t>(width) * setup.bpp;
+    }
+    SetZlibHeader(options.level, setup.zlibHeader);
+
+    const int strips = EncodeStrips(strips_, setup, options.threads, true);
+
+    uint32_t adler = 1;
+    size_t compressed = 0;
+    for (int index = 0; index < strips; index++)
+    {
+        adler = Adler32Combine(adler, strips_[index]->adler, strips_[index]->size);
+        compressed += strips_[index]->out.size();
+    }
+    AppendU32BE(strips_[strips - 1]->out, adler);
+
+    out.reserve(compressed + 64 + 12 * (compressed / kIdatChunkSize + strips));
+    // Color type: indexed, RGBA or RGB.
+    WriteHeader(out, width, height, setup.palette ? palette_.BitDepth() : 8,
+        setup.palette ? 3 : options.keepAlpha ? 6 : 2);
+
+    if (setup.palette)
+    {
+        // PLTE, and tRNS up to the last entry that is not opaque.
+        uint8_t plte[3 * 256];
+        uint8_t trns[256];
+        int alphaEntries = 0;
+        for (int i = 0; i < palette_.Size(); i++)
+        {
+            uint32_t color = palette_.Color(i);
+            plte[3 * i] = static_cast<uint8_t>(color >> 16);
+            plte[3 * i + 1] = static_cast<uint8_t>(color >> 8);
+            plte[3 * i + 2] = static_cast<uint8_t>(color);
+            trns[i] = static_cast<uint8_t>(color >> 24);
+            if (trns[i] != 255)
+                alphaEntries = i + 1;
+        }
+        WriteChunk(out, "PLTE", plte, 3 * static_cast<size_t>(palette_.Size()));
+        if (alphaEntries > 0)
+            WriteChunk(out, "tRNS", trns, alphaEntries);
+    }
+
+    for (int index = 0; index < strips; index++)
+        WriteIdat(out, strips_[index]->out);
+    WriteChunk(out, "IEND", nullptr, 0);
+    return true;
+}
+
+bool PngEncoder::Encode(const FrameView& frame, const PngOptions& options, std::vector<uint8_t>& out)
+{
+    PngOptions frameOptions = options;
+    frameOptions.keepAlpha = options.keepAlpha && frame.format == FrameFormat::Bgra32;
+    return Encode(frame.data, frame.width, frame.height, static_cast<int>(frame.stride), frameOptions, out);
+}
+
+bool EncodePng(const uint8_t* pixels, int width, int height, int stride,
+    const PngOptions& options, std::vector<uint8_t>& out)
+{
+    PngEncoder encoder;
+    return encoder.Encode(pixels, width, height, stride, options, out);
+}
+
+//---------------------------------------------------------------------
+PngStreamEncoder::PngStreamEncoder()
+{
+}
+
+PngStreamEncoder::~PngStreamEncoder()
+{
+}
+
+bool PngStreamEncoder::Begin(int width, int height, const PngOptions& options, std::vector<uint8_t>& out)
+{
+    if (width <= 0 || height <= 0)
+        return false;
+    width_ = width;
+    height_ = height;
+    options_ = options;
+    rowsDone_ = 0;
+    adler_ = 1;
+    SetZlibHeader(options.level, zlibHeader_);
+
+    // A strip is primed with up to 32 KiB of filtered rows above it, and
+    // filtering the first of those needs the row before it as well.
+    const size_t lineBytes = static_cast<size_t>(width) * (options.keepAlpha ? 4 : 3) + 1;
+    historyCapacity_ = static_cast<int>((kDictionaryBytes + lineBytes - 1) / lineBytes) + 1;
+    historyCount_ = 0;
+    history_.resize(static_cast<size_t>(historyCapacity_) * width * 4);
+    nextHistory_.resize(history_.size());
+
+    WriteHeader(out, width, height, 8, options.keepAlpha ? 6 : 2);
+    return true;
+}
+
+bool PngStreamEncoder::AddRows(const FrameView& rows, std::vector<uint8_t>& out)
+{
+    if (rows.Empty() || rows.width != width_ || rowsDone_ + rows.height > height_)
+        return false;
+
+    StripSetup setup;
+    setup.pixels = rows.data;
+    setup.stride = rows.stride;
+    setup.firstRow = rowsDone_;
+    setup.history = history_.data();
+    setup.historyStride = static_cast<size_t>(width_) * 4;
+    setup.historyRow = rowsDone_ - historyCount_;
+    setup.width = width_;
+    setup.height = height_;
+    setup.stripBase = rowsDone_;
+    setup.endRow = rowsDone_ + rows.height;
+    setup.keepAlpha = options_.keepAlpha;
+    setup.bpp = options_.keepAlpha ? 4 : 3;
+    setup.rowBytes = static_cast<size_t>(width_) * setup.bpp;
+    setup.level = options_.level;
+    setup.zlibHeader[0] = zlibHeader_[0];
+    setup.zlibHeader[1] = zlibHeader_[1];
+    setup.palette = nullptr;
+
+    const bool last = setup.endRow == height_;
+    const int strips = EncodeStrips(strips_, setup, options_.threads, last);
+    for (int index = 0; index < strips; index++)
+        adler_ = Adler32Combine(adler_, strips_[index]->adler, strips_[index]->size);
+    if (last)
+        AppendU32BE(strips_[strips - 1]->out, adler_);
+    for (int index = 0; index < strips; index++)
+        WriteIdat(out, strips_[index]->out);
+
+    // Keep the last rows seen for priming the first strip of the next band.
+    const int keepFrom = (std::max)(0, setup.endRow - historyCapacity_);
+    for (int y = keepFrom; y < setup.endRow; y++)
+        memcpy(&nextHistory_[(y - keepFrom) * setup.historyStride], setup.Row(y), setup.historyStride);
+    history_.swap(nextHistory_);
+    historyCount_ = setup.endRow - keepFrom;
+    rowsDone_ = setup.endRow;
+    return true;
+}
+
+bool PngStreamEncoder::Finish(std::vector<uint8_t>& out)
+{
+    if (rowsDone_ != height_ || height_ == 0)
+        return false;
+    WriteChunk(out, "IEND", nullptr, 0);
+    return true;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "Deflate.h"
+#include "Frame.h"
+#include "Palette.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+//---------------------------------------------------------------------
+// In-process PNG encoder working directly on captured pixel buffers.
+//
+// Input is 32 bpp BGRA (the layout of a top-down GDI DIB), any stride.
+// Each scanline is filtered with whichever of None/Sub/Up/Avg/Paeth gives
+// the smallest sum of absolute residuals, then deflated.
+//
+// Large images are cut into horizontal strips that are filtered and
+// deflated on separate threads, like pigz does for gzip. Each strip's
+// deflate stream is primed with the filtered bytes just above it and ends
+// in a sync flush, so the strips join into one ordinary zlib stream whose
+// Adler-32 is combined from theirs. The strip height depends only on the
+// image size, so the output is the same for any number of threads above
+// one. With threads = 1, or on a single-core machine, the image is
+// deflated as one strip instead, which is smaller and faster there.
+//
+// With a palette mode set, frames of at most 256 colours are written as
+// 1/2/4/8-bit indexed PNG instead, unfiltered as palette images compress
+// best that way.
+
+struct PngOptions
+{
+    CompressionLevel level = CompressionLevel::Default;
+    bool keepAlpha = false;     // Write RGBA instead of RGB (screen grabs carry no alpha).
+    int threads = 0;            // Upper bound on threads; 0 = shared pool, 1 = caller only.
+    PaletteMode palette = PaletteMode::Off;
+};
+
+struct PngStrip;
+
+// Reusable encoder. Scratch rows, deflate windows and compressed strips
+// are kept between calls, so encoding frames of the same size does not
+// allocate once they have grown to fit. Not thread-safe; use one per thread.
+class PngEncoder
+{
+public:
+    PngEncoder();
+    ~PngEncoder();
+
+    bool Encode(const uint8_t* pixels, int width, int height, int stride,
+        const PngOptions& options, std::vector<uint8_t>& out);
+
+    // Same, for a frame view. keepAlpha only applies to Bgra32 frames.
+    bool Encode(const FrameView& frame, const PngOptions& options, std::vector<uint8_t>& out);
+
+private:
+    PngEncoder(const PngEncoder&) = delete;
+    PngEncoder& operator=(const PngEncoder&) = delete;
+
+    std::vector<std::unique_ptr<PngStrip>> strips_;
+    IndexedPalette palette_;
+};
+
+// One-shot helper around a temporary PngEncoder.
+bool EncodePng(const uint8_t* pixels, int width, int height, int stride,
+    const PngOptions& options, std::vector<uint8_t>& out);
+
+// Row-at-a-time PNG for -bands: the image arrives as horizontal bands,
+// top to bottom, and leaves as IDAT chunks, so neither the pixels nor the
+// file ever have to be in memory whole. Each band is cut into strips and
+// compressed in parallel like Encode does; the strip at the top of a band
+// is primed from the last rows of the one before, which the encoder keeps.
+// Palette output needs every colour up front, so this is truecolour only.
+class PngStreamEncoder
+{
+public:
+    PngStreamEncoder();
+    ~PngStreamEncoder();
+
+    // Start a width x height image; appends the signature and IHDR.
+    // options.palette is ignored.
+    bool Begin(int width, int height, const PngOptions& options, std::vector<uint8_t>& out);
+
+    // Compress the next rows and append them as IDAT chunks. rows must be
+    // as wide as the image; the band sizes may vary.
+    bool AddRows(const FrameView& rows, std::vector<uint8_t>& out);
+
+    // Append IEND. False unless every row of the image was added.
+    bool Finish(std::vector<uint8_t>& out);
+
+private:
+    PngStreamEncoder(const PngStreamEncoder&) = delete;
+    PngStreamEncoder& operator=(const PngStreamEncoder&) = delete;
+
+    int width_ = 0;
+    int height_ = 0;
+    PngOptions options_;
+    uint8_t zlibHeader_[2];
+    int rowsDone_ = 0;
+    uint32_t adler_ = 1;
+
+    std::vector<std::unique_ptr<PngStrip>> strips_;
+    std::vector<uint8_t> history_;      // Last rows added, 32 bpp.
+    std::vector<uint8_t> nextHistory_;
+    int historyCapacity_ = 0;
+    int historyCount_ = 0;
+};
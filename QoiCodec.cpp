@@ -0,0 +1,334 @@
+#include "QoiCodec.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(SHOTCAP_SSE2)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    const uint8_t kOpIndex = 0x00;
+    const uint8_t kOpDiff = 0x40;
+    const uint8_t kOpLuma = 0x80;
+    const uint8_t kOpRun = 0xC0;
+    const uint8_t kOpRgb = 0xFE;
+    const uint8_t kOpRgba = 0xFF;
+    const uint8_t kMask2 = 0xC0;
+
+    const size_t kHeaderSize = 14;
+    const uint8_t kEndMarker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    const int kMaxRun = 62;
+
+    // Limit from the reference implementation: 400 million pixels.
+    const uint64_t kMaxPixels = 400000000;
+
+    // Pixels are handled as little-endian BGRA words, the frame layout.
+    const uint32_t kOpaque = 0xFF000000u;
+
+    inline int ColorHash(uint32_t px)
+    {
+        uint32_t b = px & 0xFF, g = (px >> 8) & 0xFF, r = (px >> 16) & 0xFF, a = px >> 24;
+        return static_cast<int>((r * 3 + g * 5 + b * 7 + a * 11) & 63);
+    }
+
+    inline uint32_t LoadPixel(const uint8_t* p)
+    {
+        uint32_t px;
+        memcpy(&px, p, 4);
+        return px;
+    }
+
+    void PutU32BE(uint8_t* p, uint32_t value)
+    {
+        p[0] = static_cast<uint8_t>(value >> 24);
+        p[1] = static_cast<uint8_t>(value >> 16);
+        p[2] = static_cast<uint8_t>(value >> 8);
+        p[3] = static_cast<uint8_t>(value);
+    }
+
+    uint32_t GetU32BE(const uint8_t* p)
+    {
+        return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+            (static_cast<uint32_t>(p[2]) << 8) | p[3];
+    }
+
+    // How many pixels from row[x] on, up to width, equal px once alphaMask
+    // is OR-ed in. Runs are the bulk of a screen, so they are compared four
+    // pixels at a time.
+    int RunLength(const uint8_t* row, int x, int width, uint32_t px, uint32_t alphaMask)
+    {
+        int start = x;
+#if defined(SHOTCAP_SSE2)
+        const __m128i target = _mm_set1_epi32(static_cast<int>(px));
+        const __m128i mask = _mm_set1_epi32(static_cast<int>(alphaMask));
+        for (; x + 4 <= width; x += 4)
+        {
+            __m128i v = _mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x * 4)), mask);
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(v, target)) != 0xFFFF)
+                break;
+        }
+#endif
+        while (x < width && (LoadPixel(row + x * 4) | alphaMask) == px)
+            x++;
+        return x - start;
+    }
+
+    inline uint8_t* PutRun(uint8_t* p, int64_t run)
+    {
+        for (; run >= kMaxRun; run -= kMaxRun)
+            *p++ = static_cast<uint8_t>(kOpRun | (kMaxRun - 1));
+        if (run > 0)
+            *p++ = static_cast<uint8_t>(kOpRun | (run - 1));
+        return p;
+    }
+}
+
+//---------------------------------------------------------------------
+bool QoiStreamEncoder::Begin(int width, int height, FrameFormat format, std::vector<uint8_t>& out)
+{
+    if (width <= 0 || height <= 0 || static_cast<uint64_t>(width) * height > kMaxPixels)
+        return false;
+    width_ = width;
+    height_ = height;
+    alpha_ = format == FrameFormat::Bgra32;
+    rowsDone_ = 0;
+    memset(index_, 0, sizeof(index_));
+    prev_ = kOpaque;
+    run_ = 0;
+
+    const size_t headerAt = out.size();
+    out.resize(headerAt + kHeaderSize);
+    uint8_t* p = out.data() + headerAt;
+    memcpy(p, "qoif", 4);
+    PutU32BE(p + 4, static_cast<uint32_t>(width));
+    PutU32BE(p + 8, static_cast<uint32_t>(height));
+    p[12] = static_cast<uint8_t>(alpha_ ? 4 : 3);
+    p[13] = 0;                                          // sRGB with linear alpha
+    return true;
+}
+
+bool QoiStreamEncoder::AddRows(const FrameView& rows, std::vector<uint8_t>& out)
+{
+    if (rows.Empty() || rows.width != width_ || rowsDone_ + rows.height > height_)
+        return false;
+
+    const uint32_t alphaMask = alpha_ ? 0 : kOpaque;
+    // Worst case per row: every pixel a full RGB(A) chunk.
+    const size_t maxRowBytes = static_cast<size_t>(width_) * (alpha_ ? 5 : 4);
+    uint32_t* index = index_;
+    uint32_t prev = prev_;
+    int64_t run = run_;                                 // Runs carry over row ends.
+    size_t used = out.size();
+    uint8_t* p = out.data() + used;
+    for (int y = 0; y < rows.height; y++)
+    {
+        // Grown row by row: sizing for the whole frame up front would
+        // zero-fill far more memory than screen content ever needs.
+        used = p - out.data();
+        size_t needed = used + maxRowBytes + static_cast<size_t>(run / kMaxRun) + 1 + sizeof(kEndMarker);
+        if (out.size() < needed)
+        {
+            out.resize((std::max)(needed, out.size() + out.size() / 2));
+            p = out.data() + used;
+        }
+
+        const uint8_t* row = rows.Row(y);
+        int x = 0;
+        while (x < width_)
+        {
+            uint32_t px = LoadPixel(row + x * 4) | alphaMask;
+            if (px == prev)
+            {
+                int n = RunLength(row, x, width_, px, alphaMask);
+                run += n;
+                x += n;
+                continue;
+            }
+            if (run > 0)
+            {
+                p = PutRun(p, run);
+                run = 0;
+            }
+
+            int hash = ColorHash(px);
+            if (index[hash] == px)
+            {
+                *p++ = static_cast<uint8_t>(kOpIndex | hash);
+            }
+            else
+            {
+                index[hash] = px;
+                if ((px >> 24) == (prev >> 24))
+                {
+                    int vr = static_cast<int8_t>(((px >> 16) & 0xFF) - ((prev >> 16) & 0xFF));
+                    int vg = static_cast<int8_t>(((px >> 8) & 0xFF) - ((prev >> 8) & 0xFF));
+                    int vb = static_cast<int8_t>((px & 0xFF) - (prev & 0xFF));
+                    int vgr = vr - vg;
+                    int vgb = vb - vg;
+                    if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2)
+                    {
+                        *p++ = static_cast<uint8_t>(kOpDiff | ((vr + 2) << 4) | ((vg + 2) << 2) | (vb + 2));
+                    }
+                    else if (vgr > -9 && vgr < 8 && vg > -33 && vg < 32 && vgb > -9 && vgb < 8)
+                    {
+                        *p++ = static_cast<uint8_t>(kOpLuma | (vg + 32));
+                        *p++ = static_cast<uint8_t>(((vgr + 8) << 4) | (vgb + 8));
+                    }
+                    else
+                    {
+                        *p++ = kOpRgb;
+                        *p++ = static_cast<uint8_t>(px >> 16);
+                        *p++ = static_cast<uint8_t>(px >> 8);
+                        *p++ = static_cast<uint8_t>(px);
+                    }
+                }
+                else
+                {
+                    *p++ = kOpRgba;
+                    *p++ = static_cast<uint8_t>(px >> 16);
+                    *p++ = static_cast<uint8_t>(px >> 8);
+                    *p++ = static_cast<uint8_t>(px);
+                    *p++ = static_cast<uint8_t>(px >> 24);
+                }
+            }
+            prev = px;
+            x++;
+        }
+    }
+    out.resize(p - out.data());
+    prev_ = prev;
+    run_ = run;
+    rowsDone_ += rows.height;
+    return true;
+}
+
+bool QoiStreamEncoder::Finish(std::vector<uint8_t>& out)
+{
+    if (rowsDone_ != height_ || height_ == 0)
+        return false;
+    const size_t used = out.size();
+    out.resize(used + static_cast<size_t>(run_ / kMaxRun) + 1 + sizeof(kEndMarker));
+    uint8_t* p = PutRun(out.data() + used, run_);
+    memcpy(p, kEndMarker, sizeof(kEndMarker));
+    p += sizeof(kEndMarker);
+    out.resize(p - out.data());
+    run_ = 0;
+    return true;
+}
+
+//---------------------------------------------------------------------
+bool EncodeQoi(const FrameView& frame, std::vector<uint8_t>& out)
+{
+    out.clear();
+    if (frame.Empty())
+        return false;
+    QoiStreamEncoder encoder;
+    return encoder.Begin(frame.width, frame.height, frame.format, out) &&
+        encoder.AddRows(frame, out) && encoder.Finish(out);
+}
+
+//---------------------------------------------------------------------
+bool DecodeQoi(const uint8_t* data, size_t size, std::vector<uint8_t>& pixels,
+    int& width, int& height, int& channels)
+{
+    if (size < kHeaderSize + sizeof(kEndMarker) || memcmp(data, "qoif", 4) != 0)
+        return false;
+    uint32_t w = GetU32BE(data + 4);
+    uint32_t h = GetU32BE(data + 8);
+    channels = data[12];
+    if (w == 0 || h == 0 || w > 0x7FFFFFFF || h > 0x7FFFFFFF || (channels != 3 && channels != 4) || data[13] > 1 ||
+        static_cast<uint64_t>(w) * h > kMaxPixels)
+        return false;
+    width = static_cast<int>(w);
+    height = static_cast<int>(h);
+
+    const size_t count = static_cast<size_t>(w) * h;
+    // No chunk stands for more than a run of kMaxRun pixels, so a header
+    // claiming more than the data can hold fails before the allocation.
+    if ((count + kMaxRun - 1) / kMaxRun > size - kHeaderSize - sizeof(kEndMarker))
+        return false;
+    pixels.resize(count * 4);
+    uint8_t* outPixel = pixels.data();
+
+    // Chunks may not run into the end marker.
+    const uint8_t* p = data + kHeaderSize;
+    const uint8_t* end = data + size - sizeof(kEndMarker);
+    uint32_t index[64] = {};
+    uint32_t px = kOpaque;
+    size_t i = 0;
+    while (i < count)
+    {
+        if (p >= end)
+            return false;
+        uint8_t op = *p++;
+        size_t repeat = 1;
+        if (op == kOpRgb)
+        {
+            if (end - p < 3)
+                return false;
+            px = (px & kOpaque) | (static_cast<uint32_t>(p[0]) << 16) | (static_cast<uint32_t>(p[1]) << 8) | p[2];
+            p += 3;
+        }
+        else if (op == kOpRgba)
+        {
+            if (end - p < 4)
+                return false;
+            px = (static_cast<uint32_t>(p[3]) << 24) | (static_cast<uint32_t>(p[0]) << 16) |
+                (static_cast<uint32_t>(p[1]) << 8) | p[2];
+            p += 4;
+        }
+        else if ((op & kMask2) == kOpIndex)
+        {
+            px = index[op];
+        }
+        else if ((op & kMask2) == kOpDiff)
+        {
+            uint32_t r = ((px >> 16) + ((op >> 4) & 3) - 2) & 0xFF;
+            uint32_t g = ((px >> 8) + ((op >> 2) & 3) - 2) & 0xFF;
+            uint32_t b = (px + (op & 3) - 2) & 0xFF;
+            px = (px & kOpaque) | (r << 16) | (g << 8) | b;
+        }
+        else if ((op & kMask2) == kOpLuma)
+        {
+            if (p >= end)
+                return false;
+            int vg = (op & 0x3F) - 32;
+            int vgr = (*p >> 4) - 8;
+            int vgb = (*p & 0x0F) - 8;
+            p++;
+            uint32_t r = ((px >> 16) + vg + vgr) & 0xFF;
+            uint32_t g = ((px >> 8) + vg) & 0xFF;
+            uint32_t b = (px + vg + vgb) & 0xFF;
+            px = (px & kOpaque) | (r << 16) | (g << 8) | b;
+        }
+        else
+        {
+            repeat = (op & 0x3F) + 1;
+            if (repeat > count - i)
+                return false;
+        }
+        index[ColorHash(px)] = px;
+
+        uint32_t value = channels == 3 ? px | kOpaque : px;
+        for (size_t k = 0; k < repeat; k++, outPixel += 4)
+            memcpy(outPixel, &value, 4);
+        i += repeat;
+    }
+    return memcmp(p, kEndMarker, sizeof(kEndMarker)) == 0;
+}
+
+bool DecodeQoi(const uint8_t* data, size_t size, std::vector<uint8_t>& pixels, FrameView& frame)
+{
+    int width = 0, height = 0, channels = 0;
+    if (!DecodeQoi(data, size, pixels, width, height, channels))
+        return false;
+    frame.data = pixels.data();
+    frame.width = width;
+    frame.height = height;
+    frame.stride = static_cast<ptrdiff_t>(width) * 4;
+    frame.format = channels == 4 ? FrameFormat::Bgra32 : FrameFormat::Bgrx32;
+    return true;
+}
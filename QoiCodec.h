@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Frame.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+//---------------------------------------------------------------------
+// QOI ("Quite OK Image", qoiformat.org) for -format qoi: lossless, one
+// pass, no entropy coder. Screen content is mostly runs and repeats of a
+// few colours, which QOI stores in one byte each, so encoding runs close
+// to memory speed. Files follow the published spec and open in any QOI
+// reader; -topng converts them to PNG later.
+
+// Encode a frame. Bgrx32 frames are written as 3-channel RGB, Bgra32
+// frames as 4-channel RGBA.
+bool EncodeQoi(const FrameView& frame, std::vector<uint8_t>& out);
+
+// Row-at-a-time encoding for -bands: the same file as EncodeQoi, built
+// from horizontal bands given top to bottom, each appended to out as it
+// is encoded. Colour index, previous pixel and pending run carry over
+// from band to band.
+class QoiStreamEncoder
+{
+public:
+    // Start a width x height image; appends the header.
+    bool Begin(int width, int height, FrameFormat format, std::vector<uint8_t>& out);
+    // Encode the next rows, which must be as wide as the image.
+    bool AddRows(const FrameView& rows, std::vector<uint8_t>& out);
+    // Append the final run and the end marker. False unless every row of
+    // the image was added.
+    bool Finish(std::vector<uint8_t>& out);
+
+private:
+    int width_ = 0;
+    int height_ = 0;
+    bool alpha_ = false;
+    int rowsDone_ = 0;
+    uint32_t index_[64];
+    uint32_t prev_ = 0;
+    int64_t run_ = 0;
+};
+
+// Decode a QOI file into top-down 32 bpp BGRA (alpha 255 for 3-channel
+// files). channels is 3 or 4 as stored in the header. Fails on anything
+// truncated or malformed, or without the end marker after the last chunk.
+bool DecodeQoi(const uint8_t* data, size_t size, std::vector<uint8_t>& pixels,
+    int& width, int& height, int& channels);
+
+// Same, with the pixels described as a frame: Bgra32 for 4-channel files,
+// Bgrx32 for 3-channel ones. -topng encodes this frame as PNG.
+bool DecodeQoi(const uint8_t* data, size_t size, std::vector<uint8_t>& pixels, FrameView& frame);
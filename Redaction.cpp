@@ -0,0 +1,597 @@
+#include "Redaction.h"
+#include "CpuFeatures.h"
+#include "RegionFanOut.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sstream>
+
+#if defined(SHOTCAP_X86)
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    // Areas smaller than this are redacted on the calling thread; handing
+    // them to the pool costs more than it saves.
+    const int kMinParallelPixels = 1 << 16;
+    const int kRowsPerTask = 32;     // A multiple of kStripPixels.
+    // Blur lines handled side by side: one cache line of each row.
+    const int kStripPixels = 16;
+    const int kBlurPasses = 2;
+
+    bool ParseInt(const char*& p, int& value)
+    {
+        char* end = nullptr;
+        errno = 0;
+        long parsed = strtol(p, &end, 10);
+        if (end == p || errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX)
+            return false;
+        value = static_cast<int>(parsed);
+        p = end;
+        return true;
+    }
+
+    std::string Trim(const std::string& text)
+    {
+        const char* space = " \t\r";
+        size_t first = text.find_first_not_of(space);
+        if (first == std::string::npos)
+            return std::string();
+        return text.substr(first, text.find_last_not_of(space) - first + 1);
+    }
+
+    bool ParseColour(const std::string& text, uint32_t& colour)
+    {
+        const char* p = text.c_str();
+        if (*p == '#')
+            p++;
+        if (strlen(p) != 6 || strspn(p, "0123456789abcdefABCDEF") != 6)
+            return false;
+        const uint32_t rgb = static_cast<uint32_t>(strtoul(p, nullptr, 16));
+        colour = 0xFF000000 | rgb;      // RRGGBB is already B | G << 8 | R << 16.
+        return true;
+    }
+
+    void RunTasks(int count, const std::function<void(int)>& task, int threads, int64_t pixels)
+    {
+        if (threads == 1 || count == 1 || pixels < kMinParallelPixels)
+        {
+            for (int i = 0; i < count; i++)
+                task(i);
+        }
+        else
+        {
+            SharedThreadPool().ParallelFor(count, task, threads);
+        }
+    }
+
+    //---------------------------------------------------------------------
+    void FillRow(uint8_t* row, int width, uint32_t colour)
+    {
+        int x = 0;
+#if defined(SHOTCAP_SSE2)
+        const __m128i value = _mm_set1_epi32(static_cast<int>(colour));
+        for (; x + 4 <= width; x += 4)
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(row + x * 4), value);
+#endif
+        for (; x < width; x++)
+            memcpy(row + x * 4, &colour, 4);
+    }
+
+    //---------------------------------------------------------------------
+    // Add the channels of one row to per-column totals.
+    void AddRowToColumns(const uint8_t* row, int width, uint32_t* columns)
+    {
+        int x = 0;
+#if defined(SHOTCAP_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        for (; x + 4 <= width; x += 4, row += 16, columns += 16)
+        {
+            const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row));
+            const __m128i lo = _mm_unpacklo_epi8(pixels, zero);
+            const __m128i hi = _mm_unpackhi_epi8(pixels, zero);
+            __m128i* out = reinterpret_cast<__m128i*>(columns);
+            _mm_storeu_si128(out + 0, _mm_add_epi32(_mm_loadu_si128(out + 0), _mm_unpacklo_epi16(lo, zero)));
+            _mm_storeu_si128(out + 1, _mm_add_epi32(_mm_loadu_si128(out + 1), _mm_unpackhi_epi16(lo, zero)));
+            _mm_storeu_si128(out + 2, _mm_add_epi32(_mm_loadu_si128(out + 2), _mm_unpacklo_epi16(hi, zero)));
+            _mm_storeu_si128(out + 3, _mm_add_epi32(_mm_loadu_si128(out + 3), _mm_unpackhi_epi16(hi, zero)));
+        }
+#endif
+        for (; x < width; x++, row += 4, columns += 4)
+        {
+            columns[0] += row[0];
+            columns[1] += row[1];
+            columns[2] += row[2];
+            columns[3] += row[3];
+        }
+    }
+
+    uint32_t CellAverage(const uint32_t* columns, int width, int rows)
+    {
+        uint32_t sum[4] = { 0, 0, 0, 0 };
+        for (int x = 0; x < width; x++, columns += 4)
+        {
+            sum[0] += columns[0];
+            sum[1] += columns[1];
+            sum[2] += columns[2];
+            sum[3] += columns[3];
+        }
+        const uint32_t count = static_cast<uint32_t>(width) * rows;
+        uint32_t colour = 0;
+        for (int c = 0; c < 4; c++)
+            colour |= ((sum[c] + count / 2) / count) << (c * 8);
+        return colour;
+    }
+
+    //---------------------------------------------------------------------
+    // Box blur of radius r: the mean of the 2r + 1 samples around each
+    // pixel, with samples past the ends repeating the edge pixel. The sums
+    // fit 16-bit lanes for n up to 255, so the mean is a 16-bit multiply
+    // by a rounded-up reciprocal, (sum + n / 2) * multiplier >> (16 + shift),
+    // with the shift chosen to use all 16 bits of the multiplier. It gives
+    // back any flat colour exactly and is never more than one off a true
+    // rounded mean. Every code path computes exactly this.
+    struct BoxDivisor
+    {
+        explicit BoxDivisor(int radius)
+            : count(2 * radius + 1), bias(static_cast<uint16_t>(count / 2))
+        {
+            while (((uint32_t(1) << (17 + shift)) + count - 1) / count <= 65535)
+                shift++;
+            multiplier = static_cast<uint16_t>(((uint32_t(1) << (16 + shift)) + count - 1) / count);
+        }
+
+        uint8_t Mean(uint32_t sum) const
+        {
+            return static_cast<uint8_t>((std::min)(255u, (((sum + bias) * multiplier) >> 16) >> shift));
+        }
+
+        int count;
+        uint16_t bias;
+        uint16_t multiplier = 0;
+        int shift = 0;
+    };
+
+#if defined(SHOTCAP_SSE2)
+    // BoxDivisor in registers, built once per pass.
+    struct BoxDivisor16
+    {
+        explicit BoxDivisor16(const BoxDivisor& divisor)
+            : bias(_mm_set1_epi16(static_cast<short>(divisor.bias))),
+              multiplier(_mm_set1_epi16(static_cast<short>(divisor.multiplier))),
+              shift(_mm_cvtsi32_si128(divisor.shift))
+        {
+        }
+
+        __m128i Mean(__m128i sum) const
+        {
+            return _mm_srl_epi16(_mm_mulhi_epu16(_mm_add_epi16(sum, bias), multiplier), shift);
+        }
+
+        __m128i bias;
+        __m128i multiplier;
+        __m128i shift;
+    };
+#endif
+
+    //---------------------------------------------------------------------
+    // Both blur directions work on the same layout: kStripPixels lines side
+    // by side, sample i of all of them in the kLineBytes at i * kLineBytes.
+    // A column strip is that layout already; rows are interleaved into it
+    // by RowsToLines. Every buffer has radius + 1 copies of its first and
+    // last sample in front and behind, so the pass itself never clamps.
+    const ptrdiff_t kLineBytes = kStripPixels * 4;
+
+    // One pass over length samples of lines, their means to out + i * outStride.
+    typedef void (*BlurLinesFunction)(const uint8_t* lines, uint8_t* out, ptrdiff_t outStride, int length,
+        int radius, const BoxDivisor& divisor);
+
+    void BaseBlurLines(const uint8_t* lines, uint8_t* out, ptrdiff_t outStride, int length,
+        int radius, const BoxDivisor& divisor)
+    {
+#if defined(SHOTCAP_SSE2)
+        // Two pixels fill the eight 16-bit lanes of one sum.
+        const int vectors = kStripPixels / 4;
+        const BoxDivisor16 mean16(divisor);
+        const __m128i zero = _mm_setzero_si128();
+        __m128i sum[vectors * 2];
+        for (int i = 0; i < vectors * 2; i++)
+            sum[i] = zero;
+        for (int k = -radius; k <= radius; k++)
+        {
+            const __m128i* sample = reinterpret_cast<const __m128i*>(lines + k * kLineBytes);
+            for (int i = 0; i < vectors; i++)
+            {
+                const __m128i values = _mm_loadu_si128(sample + i);
+                sum[i * 2] = _mm_add_epi16(sum[i * 2], _mm_unpacklo_epi8(values, zero));
+                sum[i * 2 + 1] = _mm_add_epi16(sum[i * 2 + 1], _mm_unpackhi_epi8(values, zero));
+            }
+        }
+        const __m128i* add = reinterpret_cast<const __m128i*>(lines + (radius + 1) * kLineBytes);
+        const __m128i* remove = reinterpret_cast<const __m128i*>(lines - radius * kLineBytes);
+        for (int y = 0; y < length; y++, out += outStride, add += vectors, remove += vectors)
+        {
+            for (int i = 0; i < vectors; i++)
+            {
+                __m128i& lo = sum[i * 2];
+                __m128i& hi = sum[i * 2 + 1];
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out) + i,
+                    _mm_packus_epi16(mean16.Mean(lo), mean16.Mean(hi)));
+                const __m128i a = _mm_loadu_si128(add + i);
+                const __m128i r = _mm_loadu_si128(remove + i);
+                lo = _mm_sub_epi16(_mm_add_epi16(lo, _mm_unpacklo_epi8(a, zero)), _mm_unpacklo_epi8(r, zero));
+                hi = _mm_sub_epi16(_mm_add_epi16(hi, _mm_unpackhi_epi8(a, zero)), _mm_unpackhi_epi8(r, zero));
+            }
+        }
+#else
+        uint32_t sum[kLineBytes] = {};
+        for (int k = -radius; k <= radius; k++)
+            for (int c = 0; c < kLineBytes; c++)
+                sum[c] += lines[k * kLineBytes + c];
+        const uint8_t* add = lines + (radius + 1) * kLineBytes;
+        const uint8_t* remove = lines - radius * kLineBytes;
+        for (int y = 0; y < length; y++, out += outStride, add += kLineBytes, remove += kLineBytes)
+        {
+            for (int c = 0; c < kLineBytes; c++)
+            {
+                out[c] = divisor.Mean(sum[c]);
+                sum[c] += add[c] - remove[c];
+            }
+        }
+#endif
+    }
+
+#if defined(SHOTCAP_X86)
+    // The same with sixteen 16-bit lanes: four pixels per sum.
+    SHOTCAP_TARGET("avx2")
+    void Avx2BlurLines(const uint8_t* lines, uint8_t* out, ptrdiff_t outStride, int length,
+        int radius, const BoxDivisor& divisor)
+    {
+        const int vectors = kStripPixels / 4;
+        const __m256i bias = _mm256_set1_epi16(static_cast<short>(divisor.bias));
+        const __m256i multiplier = _mm256_set1_epi16(static_cast<short>(divisor.multiplier));
+        const __m128i shift = _mm_cvtsi32_si128(divisor.shift);
+        __m256i sum[vectors];
+        for (int i = 0; i < vectors; i++)
+            sum[i] = _mm256_setzero_si256();
+        for (int k = -radius; k <= radius; k++)
+        {
+            const __m128i* sample = reinterpret_cast<const __m128i*>(lines + k * kLineBytes);
+            for (int i = 0; i < vectors; i++)
+                sum[i] = _mm256_add_epi16(sum[i], _mm256_cvtepu8_epi16(_mm_loadu_si128(sample + i)));
+        }
+        const __m128i* add = reinterpret_cast<const __m128i*>(lines + (radius + 1) * kLineBytes);
+        const __m128i* remove = reinterpret_cast<const __m128i*>(lines - radius * kLineBytes);
+        for (int y = 0; y < length; y++, out += outStride, add += vectors, remove += vectors)
+        {
+            for (int i = 0; i < vectors; i += 2)
+            {
+                const __m256i mean0 = _mm256_srl_epi16(_mm256_mulhi_epu16(_mm256_add_epi16(sum[i], bias), multiplier), shift);
+                const __m256i mean1 = _mm256_srl_epi16(_mm256_mulhi_epu16(_mm256_add_epi16(sum[i + 1], bias), multiplier), shift);
+                // packus works within each 128-bit half; put the quarters
+                // back in order.
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out) + i / 2,
+                    _mm256_permute4x64_epi64(_mm256_packus_epi16(mean0, mean1), 0xD8));
+            }
+            for (int i = 0; i < vectors; i++)
+            {
+                sum[i] = _mm256_sub_epi16(_mm256_add_epi16(sum[i], _mm256_cvtepu8_epi16(_mm_loadu_si128(add + i))),
+                    _mm256_cvtepu8_epi16(_mm_loadu_si128(remove + i)));
+            }
+        }
+    }
+#endif
+
+    BlurLinesFunction PickBlurLines()
+    {
+#if defined(SHOTCAP_X86)
+        if (GetCpuFeatures().avx2)
+            return Avx2BlurLines;
+#endif
+        return BaseBlurLines;
+    }
+
+    // Fill in the radius + 1 samples before and after length samples.
+    void PadLines(uint8_t* lines, int length, int radius)
+    {
+        for (int k = 1; k <= radius + 1; k++)
+        {
+            memcpy(lines - k * kLineBytes, lines, kLineBytes);
+            memcpy(lines + (length - 1 + k) * kLineBytes, lines + (length - 1) * kLineBytes, kLineBytes);
+        }
+    }
+
+    // Interleave kStripPixels rows of width pixels: pixel x of rows[j]
+    // goes to lines + x * kLineBytes + j * 4. Four rows at a time, that is
+    // a 4 x 4 transpose of 32-bit pixels.
+    void RowsToLines(uint8_t* const* rows, int width, uint8_t* lines)
+    {
+        for (int group = 0; group < kStripPixels / 4; group++, rows += 4, lines += 16)
+        {
+            int x = 0;
+            uint8_t* out = lines;
+#if defined(SHOTCAP_SSE2)
+            for (; x + 4 <= width; x += 4, out += 4 * kLineBytes)
+            {
+                const __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[0] + x * 4));
+                const __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[1] + x * 4));
+                const __m128i r2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[2] + x * 4));
+                const __m128i r3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[3] + x * 4));
+                const __m128i t0 = _mm_unpacklo_epi32(r0, r1);
+                const __m128i t1 = _mm_unpacklo_epi32(r2, r3);
+                const __m128i t2 = _mm_unpackhi_epi32(r0, r1);
+                const __m128i t3 = _mm_unpackhi_epi32(r2, r3);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi64(t0, t1));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + kLineBytes), _mm_unpackhi_epi64(t0, t1));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * kLineBytes), _mm_unpacklo_epi64(t2, t3));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 3 * kLineBytes), _mm_unpackhi_epi64(t2, t3));
+            }
+#endif
+            for (; x < width; x++, out += kLineBytes)
+                for (int j = 0; j < 4; j++)
+                    memcpy(out + j * 4, rows[j] + x * 4, 4);
+        }
+    }
+
+    // The reverse of RowsToLines for the first count rows.
+    void LinesToRows(const uint8_t* lines, int width, uint8_t* const* rows, int count)
+    {
+        for (int group = 0; group * 4 < count; group++, rows += 4, lines += 16)
+        {
+            const int groupRows = (std::min)(4, count - group * 4);
+            int x = 0;
+            const uint8_t* in = lines;
+#if defined(SHOTCAP_SSE2)
+            for (; x + 4 <= width; x += 4, in += 4 * kLineBytes)
+            {
+                const __m128i p0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+                const __m128i p1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + kLineBytes));
+                const __m128i p2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 2 * kLineBytes));
+                const __m128i p3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 3 * kLineBytes));
+                const __m128i t0 = _mm_unpacklo_epi32(p0, p1);
+                const __m128i t1 = _mm_unpacklo_epi32(p2, p3);
+                const __m128i t2 = _mm_unpackhi_epi32(p0, p1);
+                const __m128i t3 = _mm_unpackhi_epi32(p2, p3);
+                const __m128i row[4] = { _mm_unpacklo_epi64(t0, t1), _mm_unpackhi_epi64(t0, t1),
+                    _mm_unpacklo_epi64(t2, t3), _mm_unpackhi_epi64(t2, t3) };
+                for (int j = 0; j < groupRows; j++)
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(rows[j] + x * 4), row[j]);
+            }
+#endif
+            for (; x < width; x++, in += kLineBytes)
+                for (int j = 0; j < groupRows; j++)
+                    memcpy(rows[j] + x * 4, in + j * 4, 4);
+        }
+    }
+
+    // kBlurPasses over lines, length samples after the padding, the last
+    // one into out at outStride; with out null, into scratch (also padded)
+    // at kLineBytes. scratch is the size of lines, and both are
+    // overwritten. Returns where the result went.
+    uint8_t* BlurLines(uint8_t* lines, uint8_t* scratch, uint8_t* out, ptrdiff_t outStride, int length,
+        int radius, const BoxDivisor& divisor)
+    {
+        static const BlurLinesFunction blurLines = PickBlurLines();
+        const ptrdiff_t pad = (radius + 1) * kLineBytes;
+        for (int pass = 0; pass < kBlurPasses; pass++)
+        {
+            PadLines(lines + pad, length, radius);
+            const bool last = pass + 1 == kBlurPasses;
+            if (last && out)
+            {
+                blurLines(lines + pad, out, outStride, length, radius, divisor);
+                return out;
+            }
+            blurLines(lines + pad, scratch + pad, kLineBytes, length, radius, divisor);
+            if (last)
+                return scratch + pad;
+            std::swap(lines, scratch);
+        }
+        return nullptr;
+    }
+}
+
+//---------------------------------------------------------------------
+bool ParseRedactStyle(const std::string& text, RedactStyle& style)
+{
+    style = RedactStyle();
+    const size_t colon = text.find(':');
+    const std::string name = text.substr(0, colon);
+    const std::string argument = colon == std::string::npos ? std::string() : text.substr(colon + 1);
+    if (colon != std::string::npos && argument.empty())
+        return false;
+
+    if (name == "fill")
+    {
+        style.mode = RedactMode::Fill;
+        return argument.empty() || ParseColour(argument, style.colour);
+    }
+    if (name == "pixelate")
+        style.mode = RedactMode::Pixelate;
+    else if (name == "blur")
+        style.mode = RedactMode::Blur;
+    else
+        return false;
+    if (argument.empty())
+        return true;
+    const char* p = argument.c_str();
+    return ParseInt(p, style.size) && *p == '\0' && style.size >= 1 && style.size <= kMaxRedactSize;
+}
+
+bool ParseRedactManifest(const std::string& text, const RedactStyle& defaultStyle,
+    std::vector<RedactRegion>& regions, std::string& error)
+{
+    std::istringstream lines(text);
+    std::string line;
+    for (int number = 1; std::getline(lines, line); number++)
+    {
+        line = Trim(line);
+        if (line.empty() || line[0] == '#')
+            continue;
+        size_t split = line.find_first_of(" \t");
+        RedactRegion region;
+        if (!ParseRegion(line.substr(0, split), region.rect))
+        {
+            error = "line " + std::to_string(number) + ": expected x,y,w,h";
+            return false;
+        }
+        region.style = defaultStyle;
+        if (split != std::string::npos && !ParseRedactStyle(Trim(line.substr(split)), region.style))
+        {
+            error = "line " + std::to_string(number) + ": unknown redaction style";
+            return false;
+        }
+        regions.push_back(region);
+    }
+    if (regions.empty())
+    {
+        error = "no regions";
+        return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------
+void FillArea(const FrameView& area, uint32_t colour, int threads)
+{
+    if (area.Empty())
+        return;
+    const int tasks = (area.height + kRowsPerTask - 1) / kRowsPerTask;
+    RunTasks(tasks, [&](int task)
+        {
+            const int end = (std::min)(area.height, (task + 1) * kRowsPerTask);
+            for (int y = task * kRowsPerTask; y < end; y++)
+                FillRow(area.Row(y), area.width, colour);
+        }, threads, static_cast<int64_t>(area.width) * area.height);
+}
+
+void PixelateArea(const FrameView& area, int block, int phaseX, int phaseY, int threads)
+{
+    if (area.Empty() || block < 1)
+        return;
+    // Cells are block x block, except that the first row and column of
+    // them start phase pixels in and the last ones stop at the edge.
+    const int firstRows = (std::min)(area.height, block - phaseY % block);
+    const int firstColumns = block - phaseX % block;
+    const int cellRows = 1 + (area.height - firstRows + block - 1) / block;
+    RunTasks(cellRows, [&](int cellRow)
+        {
+            const int top = cellRow == 0 ? 0 : firstRows + (cellRow - 1) * block;
+            const int rows = (std::min)(area.height - top, cellRow == 0 ? firstRows : block);
+            thread_local std::vector<uint32_t> columns;
+            columns.assign(static_cast<size_t>(area.width) * 4, 0);
+            for (int y = top; y < top + rows; y++)
+                AddRowToColumns(area.Row(y), area.width, columns.data());
+
+            for (int left = 0, width = (std::min)(area.width, firstColumns); left < area.width;
+                left += width, width = (std::min)(area.width - left, block))
+            {
+                const uint32_t colour = CellAverage(&columns[static_cast<size_t>(left) * 4], width, rows);
+                for (int y = top; y < top + rows; y++)
+                    FillRow(area.Row(y) + left * 4, width, colour);
+            }
+        }, threads, static_cast<int64_t>(area.width) * area.height);
+}
+
+void BlurArea(const FrameView& area, int radius, int threads)
+{
+    if (area.Empty() || radius < 1)
+        return;
+    radius = (std::min)(radius, kMaxRedactSize);
+    const BoxDivisor divisor(radius);
+    const int64_t pixels = static_cast<int64_t>(area.width) * area.height;
+
+    // Across the rows, kStripPixels at a time, interleaved into lines.
+    // A task's last group repeats its last row to make up the number.
+    const size_t rowBytes = static_cast<size_t>(area.width + 2 * (radius + 1)) * kLineBytes;
+    const int rowTasks = (area.height + kRowsPerTask - 1) / kRowsPerTask;
+    RunTasks(rowTasks, [&](int task)
+        {
+            thread_local std::vector<uint8_t> lines, scratch;
+            lines.resize(rowBytes);
+            scratch.resize(rowBytes);
+            const int end = (std::min)(area.height, (task + 1) * kRowsPerTask);
+            for (int y = task * kRowsPerTask; y < end; y += kStripPixels)
+            {
+                const int count = (std::min)(kStripPixels, end - y);
+                uint8_t* rows[kStripPixels];
+                for (int j = 0; j < kStripPixels; j++)
+                    rows[j] = area.Row(y + (std::min)(j, count - 1));
+                RowsToLines(rows, area.width, lines.data() + (radius + 1) * kLineBytes);
+                const uint8_t* result = BlurLines(lines.data(), scratch.data(), nullptr, 0, area.width, radius, divisor);
+                LinesToRows(result, area.width, rows, count);
+            }
+        }, threads, pixels);
+
+    // Down the columns, a strip of kStripPixels at a time. A last strip
+    // narrower than that is padded with its edge column, and its result
+    // copied out.
+    const size_t stripBytes = static_cast<size_t>(area.height + 2 * (radius + 1)) * kLineBytes;
+    const int strips = (area.width + kStripPixels - 1) / kStripPixels;
+    RunTasks(strips, [&](int strip)
+        {
+            thread_local std::vector<uint8_t> lines, scratch;
+            lines.resize(stripBytes);
+            scratch.resize(stripBytes);
+            const int left = strip * kStripPixels;
+            const int width = (std::min)(kStripPixels, area.width - left);
+            uint8_t* copy = lines.data() + (radius + 1) * kLineBytes;
+            for (int y = 0; y < area.height; y++, copy += kLineBytes)
+            {
+                const uint8_t* row = area.Row(y) + left * 4;
+                memcpy(copy, row, width * 4);
+                for (int x = width; x < kStripPixels; x++)
+                    memcpy(copy + x * 4, row + (width - 1) * 4, 4);
+            }
+            if (width == kStripPixels)
+            {
+                BlurLines(lines.data(), scratch.data(), area.Row(0) + left * 4, area.stride, area.height, radius, divisor);
+                return;
+            }
+            const uint8_t* result = BlurLines(lines.data(), scratch.data(), nullptr, 0, area.height, radius, divisor);
+            for (int y = 0; y < area.height; y++)
+                memcpy(area.Row(y) + left * 4, result + y * kLineBytes, width * 4);
+        }, threads, pixels);
+}
+
+//---------------------------------------------------------------------
+void ApplyRedactions(const FrameView& frame, int originX, int originY,
+    const std::vector<RedactRegion>& regions, int threads)
+{
+    if (frame.Empty())
+        return;
+    for (const RedactRegion& region : regions)
+    {
+        const int left = (std::max)(region.rect.left, originX);
+        const int top = (std::max)(region.rect.top, originY);
+        const int right = (std::min)(region.rect.right, originX + frame.width);
+        const int bottom = (std::min)(region.rect.bottom, originY + frame.height);
+        if (left >= right || top >= bottom)
+            continue;
+        const FrameView area = frame.Crop(left - originX, top - originY, right - left, bottom - top);
+
+        const RedactStyle& style = region.style;
+        switch (style.mode)
+        {
+        case RedactMode::Pixelate:
+        {
+            const int block = style.size > 0 ? style.size : kDefaultPixelateBlock;
+            PixelateArea(area, block, (left - region.rect.left) % block, (top - region.rect.top) % block, threads);
+            break;
+        }
+        case RedactMode::Blur:
+            BlurArea(area, style.size > 0 ? style.size : kDefaultBlurRadius, threads);
+            break;
+        default:
+            FillArea(area, style.colour, threads);
+            break;
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "DesktopCapture.h"
+#include "Frame.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------
+// -redact: mask rectangles of a frame in place, straight after the grab,
+// so the clipboard, the encoders and the file never see what was under
+// them. Three styles:
+//
+//   fill       solid colour; the only one that removes the content outright
+//   pixelate   every block x block cell becomes its average colour
+//   blur       two passes of a separable box blur (close to a tent filter)
+//
+// Large blocks and radii make text unreadable, but small ones can leave
+// enough of its shape to guess from, so use fill for anything secret.
+//
+// Rectangles are in image pixels, (0, 0) being the top-left pixel of the
+// captured image. Blur takes sixteen rows or columns side by side and
+// slides its window down all of them at once (SSE2, or AVX2 where
+// available); pixelate sums whole rows of cells in SSE2. Both spread
+// their rows and column strips over the shared thread pool.
+
+enum class RedactMode
+{
+    Fill,
+    Pixelate,
+    Blur
+};
+
+struct RedactStyle
+{
+    RedactMode mode = RedactMode::Fill;
+    int size = 0;                   // Pixelate block or blur radius in pixels; 0 for the default.
+    uint32_t colour = 0xFF000000;   // Fill, as B | G << 8 | R << 16 | A << 24.
+};
+
+struct RedactRegion
+{
+    DesktopRect rect;               // Image pixels.
+    RedactStyle style;
+};
+
+// Defaults and limits for RedactStyle::size.
+const int kDefaultPixelateBlock = 16;
+const int kDefaultBlurRadius = 12;
+// Blur sums stay within 16 bits up to this radius.
+const int kMaxRedactSize = 127;
+
+// "fill", "fill:RRGGBB", "pixelate", "pixelate:<block>", "blur" or
+// "blur:<radius>".
+bool ParseRedactStyle(const std::string& text, RedactStyle& style);
+
+// One rectangle per line: "x,y,w,h" and optionally a style after
+// whitespace; lines without one get defaultStyle. Blank lines and lines
+// starting with '#' are skipped. On failure error names the line.
+bool ParseRedactManifest(const std::string& text, const RedactStyle& defaultStyle,
+    std::vector<RedactRegion>& regions, std::string& error);
+
+// Redact every region that overlaps frame, whose top-left pixel is at
+// (originX, originY) in image coordinates; a band or one monitor of a
+// larger image passes its offset. Pixelate cells are laid out from each
+// region's own top-left corner, so the pieces of an image redacted in
+// parts share one grid. A cell or blur cut by the edge of a piece only
+// averages what lies on its own side.
+// threads as in PngOptions: 0 for the whole pool, 1 for the caller only.
+void ApplyRedactions(const FrameView& frame, int originX, int originY,
+    const std::vector<RedactRegion>& regions, int threads = 0);
+
+// The styles on their own, over the whole of area.
+void FillArea(const FrameView& area, uint32_t colour, int threads = 0);
+// (phaseX, phaseY): how far into its first cell the area starts.
+void PixelateArea(const FrameView& area, int block, int phaseX, int phaseY, int threads = 0);
+void BlurArea(const FrameView& area, int radius, int threads = 0);
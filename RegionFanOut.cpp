@@ -0,0 +1,116 @@
+#include "RegionFanOut.h"
+#include "ThreadPool.h"
+
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <sstream>
+
+namespace
+{
+    bool ParseInt(const char*& p, int& value)
+    {
+        char* end = nullptr;
+        errno = 0;
+        long parsed = strtol(p, &end, 10);
+        if (end == p || errno == ERANGE || parsed < INT_MIN || parsed > INT_MAX)
+            return false;
+        value = static_cast<int>(parsed);
+        p = end;
+        return true;
+    }
+
+    std::string Trim(const std::string& text)
+    {
+        const char* space = " \t\r";
+        size_t first = text.find_first_not_of(space);
+        if (first == std::string::npos)
+            return std::string();
+        return text.substr(first, text.find_last_not_of(space) - first + 1);
+    }
+}
+
+//---------------------------------------------------------------------
+bool ParseRegion(const std::string& text, DesktopRect& rect)
+{
+    int values[4];
+    const char* p = text.c_str();
+    for (int i = 0; i < 4; i++)
+    {
+        while (*p == ' ')
+            p++;
+        if (i > 0 && *p++ != ',')
+            return false;
+        if (!ParseInt(p, values[i]))
+            return false;
+    }
+    while (*p == ' ')
+        p++;
+    if (*p != '\0' || values[2] <= 0 || values[3] <= 0)
+        return false;
+    // The right and bottom edges must be ints too.
+    if (values[0] > INT_MAX - values[2] || values[1] > INT_MAX - values[3])
+        return false;
+    rect.left = values[0];
+    rect.top = values[1];
+    rect.right = values[0] + values[2];
+    rect.bottom = values[1] + values[3];
+    return true;
+}
+
+bool ParseRegionManifest(const std::string& text, std::vector<RegionSpec>& regions, std::string& error)
+{
+    std::istringstream lines(text);
+    std::string line;
+    for (int number = 1; std::getline(lines, line); number++)
+    {
+        line = Trim(line);
+        if (line.empty() || line[0] == '#')
+            continue;
+        size_t split = line.find_first_of(" \t");
+        RegionSpec region;
+        if (!ParseRegion(line.substr(0, split), region.rect))
+        {
+            error = "line " + std::to_string(number) + ": expected x,y,w,h";
+            return false;
+        }
+        if (split != std::string::npos)
+            region.fileName = Trim(line.substr(split));
+        regions.push_back(region);
+    }
+    if (regions.empty())
+    {
+        error = "no regions";
+        return false;
+    }
+    return true;
+}
+
+FrameView RegionView(const FrameView& grab, const DesktopRect& bounds, const DesktopRect& region)
+{
+    return grab.Crop(region.left - bounds.left, region.top - bounds.top, region.Width(), region.Height());
+}
+
+int FanOutRegions(const FrameView& grab, const DesktopRect& bounds, const std::vector<RegionSpec>& regions,
+    const RegionEncodeFunction& encode, int threads)
+{
+    std::atomic<int> failed(0);
+    auto encodeRegion = [&](int index)
+        {
+            FrameView crop = RegionView(grab, bounds, regions[index].rect);
+            if (crop.Empty() || !encode(index, crop))
+                failed++;
+        };
+    const int count = static_cast<int>(regions.size());
+    if (threads == 1 || count == 1)
+    {
+        for (int index = 0; index < count; index++)
+            encodeRegion(index);
+    }
+    else
+    {
+        SharedThreadPool().ParallelFor(count, encodeRegion, threads);
+    }
+    return failed.load();
+}
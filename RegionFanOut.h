@@ -0,0 +1,42 @@
+#pragma once
+
+#include "DesktopCapture.h"
+#include "Frame.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Many regions from one grab (repeated -r, or -regions <file>). Only the
+// bounding box of all regions is grabbed, once, so every crop shows the
+// same moment. Each region is then a view into that frame, without a
+// copy, and the crops are encoded on the shared pool in parallel.
+
+struct RegionSpec
+{
+    DesktopRect rect;               // Screen coordinates.
+    std::string fileName;           // UTF-8; empty: numbered after the output file.
+};
+
+// Parse "x,y,w,h"; w and h must be positive, and the right and bottom
+// edges must fit in an int.
+bool ParseRegion(const std::string& text, DesktopRect& rect);
+
+// A manifest has one region per line: "x,y,w,h" and optionally a file
+// name after whitespace. Blank lines and lines starting with '#' are
+// skipped. On failure error names the line.
+bool ParseRegionManifest(const std::string& text, std::vector<RegionSpec>& regions, std::string& error);
+
+// The part of grab, a capture of bounds, that shows region. Clipped to
+// the grab; empty if they do not overlap.
+FrameView RegionView(const FrameView& grab, const DesktopRect& bounds, const DesktopRect& region);
+
+// Called once per region with its view; runs concurrently.
+typedef std::function<bool(int index, const FrameView& crop)> RegionEncodeFunction;
+
+// Run encode for every region, spread over the shared pool (threads as
+// in PngOptions: 0 for all of it, 1 for the caller only). Returns how
+// many calls failed; empty crops fail without a call.
+int FanOutRegions(const FrameView& grab, const DesktopRect& bounds, const std::vector<RegionSpec>& regions,
+    const RegionEncodeFunction& encode, int threads = 0);
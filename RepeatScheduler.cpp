@@ -0,0 +1,184 @@
+#include "RepeatScheduler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+
+namespace
+{
+    class SteadyScheduleClock : public ScheduleClock
+    {
+    public:
+        TimePoint Now() override
+        {
+            return std::chrono::steady_clock::now();
+        }
+
+        // A sleep can overshoot by a timer tick, so it stops short of the
+        // deadline and the last stretch is spent yielding.
+        void SleepUntil(TimePoint deadline) override
+        {
+            const auto margin = std::chrono::milliseconds(2);
+            if (deadline - Now() > margin)
+                std::this_thread::sleep_until(deadline - margin);
+            while (Now() < deadline)
+                std::this_thread::yield();
+        }
+    };
+
+    double ToMs(std::chrono::steady_clock::duration elapsed)
+    {
+        return std::chrono::duration<double, std::milli>(elapsed).count();
+    }
+}
+
+//---------------------------------------------------------------------
+bool ParseOverrunPolicy(const std::string& text, OverrunPolicy& policy)
+{
+    if (text == "catch-up")
+        policy = OverrunPolicy::CatchUp;
+    else if (text == "skip")
+        policy = OverrunPolicy::Skip;
+    else if (text == "stretch")
+        policy = OverrunPolicy::Stretch;
+    else
+        return false;
+    return true;
+}
+
+const char* OverrunPolicyName(OverrunPolicy policy)
+{
+    switch (policy)
+    {
+    case OverrunPolicy::CatchUp: return "catch-up";
+    case OverrunPolicy::Skip: return "skip";
+    default: return "stretch";
+    }
+}
+
+ScheduleClock& SystemScheduleClock()
+{
+    static SteadyScheduleClock clock;
+    return clock;
+}
+
+//---------------------------------------------------------------------
+RepeatScheduler::RepeatScheduler(double intervalSeconds, OverrunPolicy policy, ScheduleClock& clock)
+    : interval_((std::max)(0.0, intervalSeconds)), policy_(policy), clock_(clock)
+{
+}
+
+RepeatScheduler::TimePoint RepeatScheduler::SlotTime(int64_t slot) const
+{
+    return gridStart_ + std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval_ * static_cast<double>(slot));
+}
+
+// Lateness is always measured against the slot the frame was meant for,
+// so a stretched frame still shows how late it was before the grid moved.
+FrameTiming RepeatScheduler::Next()
+{
+    FrameTiming timing;
+    timing.index = ++index_;
+    TimePoint due;
+    if (index_ == 1)
+    {
+        start_ = gridStart_ = due = clock_.Now();
+        slot_ = 0;
+    }
+    else
+    {
+        slot_++;
+        due = SlotTime(slot_);
+        const TimePoint now = clock_.Now();
+        if (now > due && interval_.count() > 0.0)
+        {
+            if (policy_ == OverrunPolicy::Skip)
+            {
+                // Drop every slot whose whole period has already gone by.
+                const int64_t missed = static_cast<int64_t>(std::floor((now - due) / interval_));
+                slot_ += missed;
+                due = SlotTime(slot_);
+                timing.slotsSkipped = static_cast<int>(missed);
+                slotsSkipped_ += missed;
+            }
+            else if (policy_ == OverrunPolicy::Stretch)
+            {
+                gridStart_ += now - due;
+            }
+        }
+        clock_.SleepUntil(SlotTime(slot_));
+    }
+
+    timing.slot = slot_;
+    timing.scheduledMs = ElapsedMs(due);
+    timing.grabMs = ElapsedMs(clock_.Now());
+    const double lateness = timing.LatenessMs();
+    latenessTotalMs_ += lateness;
+    latenessMaxMs_ = (std::max)(latenessMaxMs_, lateness);
+    lastStartMs_ = timing.grabMs;
+    return timing;
+}
+
+double RepeatScheduler::ElapsedMs(TimePoint time) const
+{
+    return ToMs(time - start_);
+}
+
+ScheduleSummary RepeatScheduler::Summary() const
+{
+    ScheduleSummary summary;
+    summary.frames = index_;
+    summary.slotsSkipped = slotsSkipped_;
+    if (index_ > 0)
+    {
+        summary.meanLatenessMs = latenessTotalMs_ / index_;
+        summary.maxLatenessMs = latenessMaxMs_;
+        summary.driftMs = lastStartMs_ - slot_ * interval_.count() * 1000.0;
+    }
+    return summary;
+}
+
+//---------------------------------------------------------------------
+std::string FormatTimingHeader(TimingLogFormat format, double intervalSeconds, OverrunPolicy policy)
+{
+    if (format == TimingLogFormat::Csv)
+        return "frame,slot,scheduled_ms,grab_ms,late_ms,skipped_slots,unix_ms\n";
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "{\n  \"interval_ms\": %.3f,\n  \"overrun\": \"%s\",\n  \"frames\": [",
+        intervalSeconds * 1000.0, OverrunPolicyName(policy));
+    return buffer;
+}
+
+std::string FormatTimingRow(TimingLogFormat format, const FrameTiming& timing, int64_t unixMs, bool first)
+{
+    char buffer[256];
+    if (format == TimingLogFormat::Csv)
+    {
+        snprintf(buffer, sizeof(buffer), "%d,%lld,%.3f,%.3f,%.3f,%d,%lld\n",
+            timing.index, static_cast<long long>(timing.slot), timing.scheduledMs, timing.grabMs,
+            timing.LatenessMs(), timing.slotsSkipped, static_cast<long long>(unixMs));
+    }
+    else
+    {
+        snprintf(buffer, sizeof(buffer),
+            "%s\n    { \"frame\": %d, \"slot\": %lld, \"scheduled_ms\": %.3f, \"grab_ms\": %.3f, "
+            "\"late_ms\": %.3f, \"skipped_slots\": %d, \"unix_ms\": %lld }",
+            first ? "" : ",", timing.index, static_cast<long long>(timing.slot), timing.scheduledMs,
+            timing.grabMs, timing.LatenessMs(), timing.slotsSkipped, static_cast<long long>(unixMs));
+    }
+    return buffer;
+}
+
+std::string FormatTimingFooter(TimingLogFormat format, const ScheduleSummary& summary)
+{
+    if (format == TimingLogFormat::Csv)
+        return std::string();
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer),
+        "\n  ],\n  \"summary\": { \"frames\": %d, \"skipped_slots\": %lld, \"mean_late_ms\": %.3f, "
+        "\"max_late_ms\": %.3f, \"drift_ms\": %.3f }\n}\n",
+        summary.frames, static_cast<long long>(summary.slotsSkipped), summary.meanLatenessMs,
+        summary.maxLatenessMs, summary.driftMs);
+    return buffer;
+}
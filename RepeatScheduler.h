@@ -0,0 +1,116 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+//---------------------------------------------------------------------
+// Deadline scheduler for -repeat. Frame n is due at start + n * interval,
+// computed from the start every time rather than by adding up intervals,
+// so there is no drift from rounding however long the run. What happens
+// after a frame runs past the next deadline is the overrun policy:
+//
+//   catch-up   grab the missed slots back to back until on time again
+//   skip       drop the slots that have passed and grab for the current one
+//   stretch    restart the grid at the late grab; nothing is dropped or
+//              bunched, the rest of the run simply shifts
+//
+// Every frame gets a FrameTiming record (slot, due time, actual start),
+// which -timing writes to a sidecar file. The clock is injectable so the
+// policies can be checked without waiting in real time.
+
+enum class OverrunPolicy
+{
+    CatchUp,
+    Skip,
+    Stretch
+};
+
+bool ParseOverrunPolicy(const std::string& text, OverrunPolicy& policy);
+const char* OverrunPolicyName(OverrunPolicy policy);
+
+class ScheduleClock
+{
+public:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    virtual ~ScheduleClock() {}
+    virtual TimePoint Now() = 0;
+    // Return at deadline or shortly after; at once if it has passed.
+    virtual void SleepUntil(TimePoint deadline) = 0;
+};
+
+// The steady clock. Sleeps until shortly before a deadline and yields for
+// the rest, so deadlines are met to well under a millisecond as long as
+// the system timer is at 1 ms (timeBeginPeriod on Windows).
+ScheduleClock& SystemScheduleClock();
+
+struct FrameTiming
+{
+    int index = 0;                  // 1-based frame number.
+    int64_t slot = 0;               // 0-based slot on the interval grid.
+    double scheduledMs = 0.0;       // When the slot was due, since the first frame.
+    double grabMs = 0.0;            // When the frame started, since the first frame.
+    int slotsSkipped = 0;           // Slots dropped just before this frame (skip).
+
+    double LatenessMs() const { return grabMs - scheduledMs; }
+};
+
+struct ScheduleSummary
+{
+    int frames = 0;
+    int64_t slotsSkipped = 0;
+    double meanLatenessMs = 0.0;
+    double maxLatenessMs = 0.0;
+    // Last start against where its slot lies on the grid the run started
+    // with: lateness plus, under stretch, how far the grid has moved.
+    double driftMs = 0.0;
+};
+
+class RepeatScheduler
+{
+public:
+    typedef ScheduleClock::TimePoint TimePoint;
+
+    RepeatScheduler(double intervalSeconds, OverrunPolicy policy, ScheduleClock& clock = SystemScheduleClock());
+
+    // Wait until the next frame is due and return its timing, with grabMs
+    // set to now. The first frame is due at once.
+    FrameTiming Next();
+
+    // Milliseconds from the first frame to time.
+    double ElapsedMs(TimePoint time) const;
+
+    ScheduleSummary Summary() const;
+
+private:
+    TimePoint SlotTime(int64_t slot) const;
+
+    std::chrono::duration<double> interval_;
+    OverrunPolicy policy_;
+    ScheduleClock& clock_;
+
+    TimePoint start_;               // First frame.
+    TimePoint gridStart_;           // Slot 0 of the current grid; moves on stretch.
+    int64_t slot_ = -1;
+    int index_ = 0;
+
+    int64_t slotsSkipped_ = 0;
+    double latenessTotalMs_ = 0.0;
+    double latenessMaxMs_ = 0.0;
+    double lastStartMs_ = 0.0;
+};
+
+// -timing sidecar: one row per frame, as CSV or as a JSON document.
+enum class TimingLogFormat
+{
+    Csv,
+    Json
+};
+
+// Header, and for JSON the opening of the document.
+std::string FormatTimingHeader(TimingLogFormat format, double intervalSeconds, OverrunPolicy policy);
+// One frame; unixMs is the wall-clock time of its grab. first: the first row.
+std::string FormatTimingRow(TimingLogFormat format, const FrameTiming& timing, int64_t unixMs, bool first);
+// For JSON the summary and the end of the document; nothing for CSV.
+std::string FormatTimingFooter(TimingLogFormat format, const ScheduleSummary& summary);
@@ -0,0 +1,439 @@
+#include "Resampler.h"
+#include "CpuFeatures.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#if defined(SHOTCAP_X86)
+#include <emmintrin.h>
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    const int kRowsPerBand = 32;        // Output rows per thread pool item.
+    const int kEncodeSteps = 1 << 14;   // Resolution of the linear -> 8-bit table.
+    const double kPi = 3.14159265358979323846;
+
+    //---------------------------------------------------------------------
+    // Filter kernels, on the input grid spread by the reduction factor.
+    double FilterSupport(ResampleFilter filter)
+    {
+        switch (filter)
+        {
+        case ResampleFilter::Box: return 0.5;
+        case ResampleFilter::Bilinear: return 1.0;
+        default: return 3.0;
+        }
+    }
+
+    double Sinc(double x)
+    {
+        if (x == 0.0)
+            return 1.0;
+        x *= kPi;
+        return std::sin(x) / x;
+    }
+
+    double FilterWeight(ResampleFilter filter, double x)
+    {
+        switch (filter)
+        {
+        case ResampleFilter::Box:
+            return x >= -0.5 && x < 0.5 ? 1.0 : 0.0;
+        case ResampleFilter::Bilinear:
+            x = std::fabs(x);
+            return x < 1.0 ? 1.0 - x : 0.0;
+        default:
+            return x > -3.0 && x < 3.0 ? Sinc(x) * Sinc(x / 3.0) : 0.0;
+        }
+    }
+
+    //---------------------------------------------------------------------
+    // 8-bit values to floats on 0..1 and back. Colour channels go through
+    // the sRGB curve in linear-light mode; the fourth byte never does.
+    struct ResampleTables
+    {
+        float decodeSrgb[256];
+        float decodeUnit[256];
+        uint8_t encodeSrgb[kEncodeSteps + 1];
+        uint8_t encodeUnit[kEncodeSteps + 1];
+
+        ResampleTables()
+        {
+            for (int i = 0; i < 256; i++)
+            {
+                double v = i / 255.0;
+                decodeSrgb[i] = static_cast<float>(v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4));
+                decodeUnit[i] = static_cast<float>(v);
+            }
+            for (int i = 0; i <= kEncodeSteps; i++)
+            {
+                double v = static_cast<double>(i) / kEncodeSteps;
+                double s = v <= 0.0031308 ? v * 12.92 : 1.055 * std::pow(v, 1.0 / 2.4) - 0.055;
+                encodeSrgb[i] = static_cast<uint8_t>(std::lround(s * 255.0));
+                encodeUnit[i] = static_cast<uint8_t>(std::lround(v * 255.0));
+            }
+        }
+    };
+
+    const ResampleTables& Tables()
+    {
+        static const ResampleTables tables;
+        return tables;
+    }
+
+    void DecodeRow(const uint8_t* src, int width, const float* colour, const float* alpha, float* out)
+    {
+        for (int x = 0; x < width; x++, src += 4, out += 4)
+        {
+            out[0] = colour[src[0]];
+            out[1] = colour[src[1]];
+            out[2] = colour[src[2]];
+            out[3] = alpha[src[3]];
+        }
+    }
+
+    int EncodeIndex(float v, int steps)
+    {
+        v = v * steps + 0.5f;
+        return v <= 0.0f ? 0 : v >= static_cast<float>(steps) ? steps : static_cast<int>(v);
+    }
+
+    void EncodeRow(const float* in, int width, const uint8_t* colour, uint8_t* dst)
+    {
+        int x = 0;
+#if defined(SHOTCAP_SSE2)
+        // Clamp and scale four channels at once; the table lookups stay scalar.
+        const __m128 scale = _mm_setr_ps(kEncodeSteps, kEncodeSteps, kEncodeSteps, 255.0f);
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 zero = _mm_setzero_ps();
+        alignas(16) int index[4];
+        for (; x < width; x++, in += 4, dst += 4)
+        {
+            __m128 v = _mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in), zero), _mm_set1_ps(1.0f)), scale), half);
+            _mm_store_si128(reinterpret_cast<__m128i*>(index), _mm_cvttps_epi32(v));
+            dst[0] = colour[index[0]];
+            dst[1] = colour[index[1]];
+            dst[2] = colour[index[2]];
+            dst[3] = static_cast<uint8_t>(index[3]);
+        }
+#endif
+        for (; x < width; x++, in += 4, dst += 4)
+        {
+            dst[0] = colour[EncodeIndex(in[0], kEncodeSteps)];
+            dst[1] = colour[EncodeIndex(in[1], kEncodeSteps)];
+            dst[2] = colour[EncodeIndex(in[2], kEncodeSteps)];
+            dst[3] = static_cast<uint8_t>(EncodeIndex(in[3], 255));
+        }
+    }
+
+    //---------------------------------------------------------------------
+    // Horizontal pass: one output pixel (four floats) per tap sum.
+    void HorizontalRow(const float* in, int dstWidth, const int* start, const int* count,
+        const float* weights, int maxTaps, float* out)
+    {
+        for (int x = 0; x < dstWidth; x++, weights += maxTaps, out += 4)
+        {
+            const float* p = in + start[x] * 4;
+            const int taps = count[x];
+#if defined(SHOTCAP_SSE2)
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < taps; k++)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(p + k * 4)));
+            _mm_storeu_ps(out, sum);
+#else
+            float b = 0.0f, g = 0.0f, r = 0.0f, a = 0.0f;
+            for (int k = 0; k < taps; k++, p += 4)
+            {
+                b += weights[k] * p[0];
+                g += weights[k] * p[1];
+                r += weights[k] * p[2];
+                a += weights[k] * p[3];
+            }
+            out[0] = b;
+            out[1] = g;
+            out[2] = r;
+            out[3] = a;
+#endif
+        }
+    }
+
+    //---------------------------------------------------------------------
+    // Vertical pass over a whole row of floats, one ResampleKernelLevel
+    // each; see ResampleVerticalFunction.
+    void ScalarVertical(const float* const* rows, const float* weights, int taps, float* out, int begin, int count)
+    {
+        for (int i = begin; i < count; i++)
+        {
+            float sum = 0.0f;
+            for (int k = 0; k < taps; k++)
+                sum += weights[k] * rows[k][i];
+            out[i] = sum;
+        }
+    }
+
+#if defined(SHOTCAP_SSE2)
+    void Sse2Vertical(const float* const* rows, const float* weights, int taps, float* out, int count)
+    {
+        int i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 sum = _mm_setzero_ps();
+            for (int k = 0; k < taps; k++)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(rows[k] + i)));
+            _mm_storeu_ps(out + i, sum);
+        }
+        ScalarVertical(rows, weights, taps, out, i, count);
+    }
+#endif
+
+    void PlainVertical(const float* const* rows, const float* weights, int taps, float* out, int count)
+    {
+        ScalarVertical(rows, weights, taps, out, 0, count);
+    }
+
+#if defined(SHOTCAP_X86)
+    SHOTCAP_TARGET("avx2")
+    void Avx2Vertical(const float* const* rows, const float* weights, int taps, float* out, int count)
+    {
+        int i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256 sum = _mm256_setzero_ps();
+            for (int k = 0; k < taps; k++)
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[k]), _mm256_loadu_ps(rows[k] + i)));
+            _mm256_storeu_ps(out + i, sum);
+        }
+        ScalarVertical(rows, weights, taps, out, i, count);
+    }
+#endif
+
+    bool ParseDimension(const char*& p, int& value)
+    {
+        char* end = nullptr;
+        long parsed = strtol(p, &end, 10);
+        if (end == p || parsed < 0 || parsed > 65535)
+            return false;
+        value = static_cast<int>(parsed);
+        p = end;
+        return true;
+    }
+}
+
+//---------------------------------------------------------------------
+ResampleVerticalFunction ResampleVerticalKernelFor(ResampleKernelLevel level)
+{
+    switch (level)
+    {
+    case ResampleKernelLevel::Scalar:
+        return PlainVertical;
+#if defined(SHOTCAP_SSE2)
+    case ResampleKernelLevel::Sse2:
+        return GetCpuFeatures().sse2 ? Sse2Vertical : nullptr;
+#endif
+#if defined(SHOTCAP_X86)
+    case ResampleKernelLevel::Avx2:
+        return GetCpuFeatures().avx2 ? Avx2Vertical : nullptr;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+//---------------------------------------------------------------------
+ResampleFilter ChooseResampleFilter(int srcSize, int dstSize)
+{
+    if (dstSize < srcSize)
+        return srcSize % dstSize == 0 ? ResampleFilter::Box : ResampleFilter::Lanczos3;
+    return dstSize == srcSize ? ResampleFilter::Box : ResampleFilter::Bilinear;
+}
+
+// Output i is centred on input (i + 0.5) * scale; when shrinking, the
+// kernel is stretched by the same factor so it averages everything the
+// output pixel covers. Weights are normalised to sum to one, and zero
+// weights at either end are dropped.
+void Resampler::PrepareAxis(Axis& axis, int srcSize, int dstSize, ResampleFilter filter)
+{
+    if (filter == ResampleFilter::Auto)
+        filter = ChooseResampleFilter(srcSize, dstSize);
+    if (axis.srcSize == srcSize && axis.dstSize == dstSize && axis.filter == filter)
+        return;
+
+    const double scale = static_cast<double>(srcSize) / dstSize;
+    const double spread = (std::max)(scale, 1.0);
+    const double support = FilterSupport(filter) * spread;
+    axis.srcSize = srcSize;
+    axis.dstSize = dstSize;
+    axis.filter = filter;
+    axis.maxTaps = static_cast<int>(std::ceil(support)) * 2 + 1;
+    axis.start.assign(dstSize, 0);
+    axis.count.assign(dstSize, 0);
+    axis.weights.assign(static_cast<size_t>(dstSize) * axis.maxTaps, 0.0f);
+
+    std::vector<double> taps(axis.maxTaps);
+    for (int i = 0; i < dstSize; i++)
+    {
+        const double center = (i + 0.5) * scale;
+        int first = (std::max)(0, static_cast<int>(std::floor(center - support + 0.5)));
+        int last = (std::min)(srcSize, static_cast<int>(std::floor(center + support + 0.5)));
+        last = (std::min)(last, first + axis.maxTaps);
+        double total = 0.0;
+        for (int x = first; x < last; x++)
+        {
+            taps[x - first] = FilterWeight(filter, (x + 0.5 - center) / spread);
+            total += taps[x - first];
+        }
+        int begin = 0, end = last - first;
+        while (begin < end && taps[begin] == 0.0)
+            begin++;
+        while (end > begin && taps[end - 1] == 0.0)
+            end--;
+        if (begin == end || total == 0.0)
+        {
+            // Nothing under the kernel: take the nearest input.
+            axis.start[i] = (std::min)(srcSize - 1, static_cast<int>(center));
+            axis.count[i] = 1;
+            axis.weights[static_cast<size_t>(i) * axis.maxTaps] = 1.0f;
+            continue;
+        }
+        axis.start[i] = first + begin;
+        axis.count[i] = end - begin;
+        float* weights = &axis.weights[static_cast<size_t>(i) * axis.maxTaps];
+        for (int k = begin; k < end; k++)
+            weights[k - begin] = static_cast<float>(taps[k] / total);
+    }
+}
+
+// Each band of output rows runs the horizontal pass over just the input
+// rows its vertical taps reach, then the vertical pass row by row. Bands
+// share nothing, so they run in parallel; the cost is redoing the few
+// input rows where neighbouring bands' taps overlap.
+bool Resampler::Resample(const FrameView& src, const FrameView& dst, const ResampleOptions& options)
+{
+    if (src.Empty() || dst.Empty())
+        return false;
+    if (src.width == dst.width && src.height == dst.height)
+        return CopyFrame(src, dst);
+
+    PrepareAxis(horizontal_, src.width, dst.width, options.filter);
+    PrepareAxis(vertical_, src.height, dst.height, options.filter);
+
+    static const ResampleVerticalFunction vertical = []()
+        {
+            const ResampleKernelLevel levels[] = { ResampleKernelLevel::Avx2, ResampleKernelLevel::Sse2 };
+            for (ResampleKernelLevel level : levels)
+            {
+                if (ResampleVerticalFunction kernel = ResampleVerticalKernelFor(level))
+                    return kernel;
+            }
+            return PlainVertical;
+        }();
+    const ResampleTables& tables = Tables();
+    const float* decode = options.linearLight ? tables.decodeSrgb : tables.decodeUnit;
+    const uint8_t* encode = options.linearLight ? tables.encodeSrgb : tables.encodeUnit;
+    const Axis& across = horizontal_;
+    const Axis& down = vertical_;
+    const int rowFloats = dst.width * 4;
+
+    auto resampleBand = [&](int band)
+        {
+            const int yBegin = band * kRowsPerBand;
+            const int yEnd = (std::min)(dst.height, yBegin + kRowsPerBand);
+            const int firstRow = down.start[yBegin];
+            int lastRow = firstRow;
+            for (int y = yBegin; y < yEnd; y++)
+                lastRow = (std::max)(lastRow, down.start[y] + down.count[y]);
+
+            thread_local std::vector<float> decoded;
+            thread_local std::vector<float> rows;
+            thread_local std::vector<float> out;
+            thread_local std::vector<const float*> taps;
+            decoded.resize(static_cast<size_t>(src.width) * 4);
+            rows.resize(static_cast<size_t>(lastRow - firstRow) * rowFloats);
+            out.resize(rowFloats);
+            taps.resize(down.maxTaps);
+
+            for (int y = firstRow; y < lastRow; y++)
+            {
+                DecodeRow(src.Row(y), src.width, decode, tables.decodeUnit, decoded.data());
+                HorizontalRow(decoded.data(), dst.width, across.start.data(), across.count.data(),
+                    across.weights.data(), across.maxTaps, &rows[static_cast<size_t>(y - firstRow) * rowFloats]);
+            }
+            for (int y = yBegin; y < yEnd; y++)
+            {
+                for (int k = 0; k < down.count[y]; k++)
+                    taps[k] = &rows[static_cast<size_t>(down.start[y] + k - firstRow) * rowFloats];
+                vertical(taps.data(), &down.weights[static_cast<size_t>(y) * down.maxTaps], down.count[y],
+                    out.data(), rowFloats);
+                EncodeRow(out.data(), dst.width, encode, dst.Row(y));
+            }
+        };
+
+    const int bands = (dst.height + kRowsPerBand - 1) / kRowsPerBand;
+    if (options.threads == 1 || bands == 1)
+    {
+        for (int band = 0; band < bands; band++)
+            resampleBand(band);
+    }
+    else
+    {
+        SharedThreadPool().ParallelFor(bands, resampleBand, options.threads);
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------
+bool ParseScaleSpec(const std::string& text, ScaleSpec& spec)
+{
+    spec = ScaleSpec();
+    const char* p = text.c_str();
+    if (text.find_first_of("xX") == std::string::npos)
+    {
+        char* end = nullptr;
+        spec.factor = strtod(p, &end);
+        return end != p && *end == '\0' && spec.factor > 0.0 && spec.factor <= 16.0;
+    }
+    if (!ParseDimension(p, spec.width) || (*p != 'x' && *p != 'X'))
+        return false;
+    p++;
+    return ParseDimension(p, spec.height) && *p == '\0' && (spec.width > 0 || spec.height > 0);
+}
+
+bool ScaledSize(const ScaleSpec& spec, int width, int height, int& scaledWidth, int& scaledHeight)
+{
+    if (spec.factor > 0.0)
+    {
+        scaledWidth = static_cast<int>(std::lround(width * spec.factor));
+        scaledHeight = static_cast<int>(std::lround(height * spec.factor));
+    }
+    else if (spec.width > 0 && spec.height > 0)
+    {
+        scaledWidth = spec.width;
+        scaledHeight = spec.height;
+    }
+    else if (spec.width > 0)
+    {
+        scaledWidth = spec.width;
+        scaledHeight = static_cast<int>(std::lround(static_cast<double>(height) * spec.width / width));
+    }
+    else
+    {
+        scaledHeight = spec.height;
+        scaledWidth = static_cast<int>(std::lround(static_cast<double>(width) * spec.height / height));
+    }
+    return scaledWidth > 0 && scaledHeight > 0;
+}
+
+void FitSize(int boxWidth, int boxHeight, int width, int height, int& fitWidth, int& fitHeight)
+{
+    double factor = 1.0;
+    if (boxWidth > 0)
+        factor = (std::min)(factor, static_cast<double>(boxWidth) / width);
+    if (boxHeight > 0)
+        factor = (std::min)(factor, static_cast<double>(boxHeight) / height);
+    fitWidth = (std::max)(1, static_cast<int>(std::lround(width * factor)));
+    fitHeight = (std::max)(1, static_cast<int>(std::lround(height * factor)));
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "Frame.h"
+
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Image resizing for -scale and -thumb. Two separable passes (across the
+// rows, then down the columns) with the filter picked per axis:
+//
+//   - box when shrinking by a whole factor (every output pixel is the plain
+//     average of a k x k block, the sharpest result for exact halving etc.)
+//   - Lanczos-3 for any other reduction
+//   - bilinear for enlarging, which does not ring around UI text
+//
+// Filtering happens in linear light: the 8-bit sRGB values are decoded
+// first and encoded again at the end, so thin bright text on a dark
+// background does not fade when shrunk. The output is cut into bands of
+// rows spread over the shared thread pool; the taps run four channels at
+// a time in SSE2 and, where available, eight floats at a time in AVX2.
+
+enum class ResampleFilter
+{
+    Auto,           // Per axis, as above.
+    Box,
+    Bilinear,
+    Lanczos3
+};
+
+struct ResampleOptions
+{
+    ResampleFilter filter = ResampleFilter::Auto;
+    bool linearLight = true;        // False filters the sRGB values as they are.
+    int threads = 0;                // As in PngOptions: 0 for the whole pool, 1 for the caller only.
+};
+
+class Resampler
+{
+public:
+    // Resize src into dst, which sets the output size and must not overlap
+    // src. Both are 32 bpp; the fourth byte is filtered like alpha (no
+    // gamma), so Bgrx32 stays undefined and Bgra32 stays meaningful.
+    bool Resample(const FrameView& src, const FrameView& dst, const ResampleOptions& options = ResampleOptions());
+
+private:
+    // Filter taps of one axis: output i reads count[i] inputs from
+    // start[i] on, weighted by weights[i * maxTaps + k].
+    struct Axis
+    {
+        int srcSize = 0;
+        int dstSize = 0;
+        ResampleFilter filter = ResampleFilter::Auto;
+        int maxTaps = 0;
+        std::vector<int> start;
+        std::vector<int> count;
+        std::vector<float> weights;
+    };
+
+    // Recomputed only when sizes or filter change, so repeated frames of
+    // one size reuse them.
+    static void PrepareAxis(Axis& axis, int srcSize, int dstSize, ResampleFilter filter);
+
+    Axis horizontal_;
+    Axis vertical_;
+};
+
+// The filter Auto stands for when resizing one axis from srcSize to dstSize.
+ResampleFilter ChooseResampleFilter(int srcSize, int dstSize);
+
+//---------------------------------------------------------------------
+// The vertical pass behind Resample, for tests and benchmarks that compare
+// levels: out[i] is the sum over k < taps of weights[k] * rows[k][i], for
+// i < count. Every level adds the taps in the same order, so they agree
+// exactly.
+enum class ResampleKernelLevel
+{
+    Scalar,
+    Sse2,
+    Avx2
+};
+
+typedef void (*ResampleVerticalFunction)(const float* const* rows, const float* weights, int taps, float* out,
+    int count);
+
+// The pass for one level, or null when this CPU or build cannot run it.
+ResampleVerticalFunction ResampleVerticalKernelFor(ResampleKernelLevel level);
+
+// -scale argument: a factor ("0.5") or a size ("1280x720", where 0 for one
+// side keeps the aspect ratio).
+struct ScaleSpec
+{
+    double factor = 0.0;            // 0: use width and height.
+    int width = 0;
+    int height = 0;
+};
+
+bool ParseScaleSpec(const std::string& text, ScaleSpec& spec);
+
+// Output size for a width x height image; false if it comes out empty.
+bool ScaledSize(const ScaleSpec& spec, int width, int height, int& scaledWidth, int& scaledHeight);
+
+// Largest size with the aspect ratio of width x height that fits into
+// boxWidth x boxHeight (0: no limit on that side), never larger than the
+// image itself.
+void FitSize(int boxWidth, int boxHeight, int width, int height, int& fitWidth, int& fitHeight);
@@ -0,0 +1,386 @@
+#include "SeqContainer.h"
+#include "Inflate.h"
+#include "PixelConvert.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    const char kFileMagic[8] = { 'S', 'H', 'O', 'T', 'S', 'E', 'Q', '1' };
+    const char kIndexMagic[8] = { 'S', 'E', 'Q', 'I', 'N', 'D', 'E', 'X' };
+    const uint32_t kVersion = 1;
+
+    const size_t kHeaderSize = 28;
+    const size_t kRecordHeaderSize = 20;
+    const size_t kIndexEntrySize = 20;
+    const size_t kTrailerSize = 24;
+
+    const uint8_t kRecordKey = 0;
+    const uint8_t kRecordDelta = 1;
+
+    // Dimension limit for files being read; keeps size arithmetic in range.
+    const uint32_t kMaxDimension = 1 << 16;
+
+    void PutU32(std::vector<uint8_t>& out, uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+
+    void PutU64(std::vector<uint8_t>& out, uint64_t value)
+    {
+        for (int i = 0; i < 8; i++)
+            out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+
+    uint32_t GetU32(const uint8_t* p)
+    {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+
+    uint64_t GetU64(const uint8_t* p)
+    {
+        return uint64_t(GetU32(p)) | (uint64_t(GetU32(p + 4)) << 32);
+    }
+
+    // Tile t of a packed BGR frame is copied out to / pasted in from a
+    // buffer holding just the tile's rows back to back.
+    void CopyTile(const uint8_t* frame, int width, int height, int tileSize, int tilesX, int t,
+        uint8_t* dst)
+    {
+        int left = (t % tilesX) * tileSize;
+        int top = (t / tilesX) * tileSize;
+        size_t rowBytes = static_cast<size_t>((std::min)(tileSize, width - left)) * 3;
+        int rows = (std::min)(tileSize, height - top);
+        for (int y = 0; y < rows; y++, dst += rowBytes)
+            memcpy(dst, frame + (static_cast<size_t>(top + y) * width + left) * 3, rowBytes);
+    }
+
+    void PasteTile(uint8_t* frame, int width, int height, int tileSize, int tilesX, int t,
+        const uint8_t* src)
+    {
+        int left = (t % tilesX) * tileSize;
+        int top = (t / tilesX) * tileSize;
+        size_t rowBytes = static_cast<size_t>((std::min)(tileSize, width - left)) * 3;
+        int rows = (std::min)(tileSize, height - top);
+        for (int y = 0; y < rows; y++, src += rowBytes)
+            memcpy(frame + (static_cast<size_t>(top + y) * width + left) * 3, src, rowBytes);
+    }
+
+    size_t TileBytes(int width, int height, int tileSize, int tilesX, int t)
+    {
+        int left = (t % tilesX) * tileSize;
+        int top = (t / tilesX) * tileSize;
+        return static_cast<size_t>((std::min)(tileSize, width - left)) * (std::min)(tileSize, height - top) * 3;
+    }
+}
+
+//---------------------------------------------------------------------
+SeqWriter::SeqWriter(const SeqOptions& options)
+    : options_(options), deflate_(options.level)
+{
+    options_.tileSize = (std::max)(options_.tileSize, 4);
+    options_.keyframeInterval = (std::max)(options_.keyframeInterval, 1);
+}
+
+bool SeqWriter::AddFrame(const uint8_t* pixels, int width, int height, int stride,
+    int64_t timestampMs, std::vector<uint8_t>& out)
+{
+    // A negative stride walks bottom-up rows, as FrameView allows.
+    if (finished_ || !pixels || width <= 0 || height <= 0 || (stride < 0 ? -stride : stride) < width * 4)
+        return false;
+
+    if (index_.empty())
+    {
+        width_ = width;
+        height_ = height;
+        tilesX_ = (width + options_.tileSize - 1) / options_.tileSize;
+        tilesY_ = (height + options_.tileSize - 1) / options_.tileSize;
+        out.insert(out.end(), kFileMagic, kFileMagic + 8);
+        PutU32(out, kVersion);
+        PutU32(out, static_cast<uint32_t>(width));
+        PutU32(out, static_cast<uint32_t>(height));
+        PutU32(out, static_cast<uint32_t>(options_.tileSize));
+        PutU32(out, static_cast<uint32_t>(options_.keyframeInterval));
+        bytesWritten_ += kHeaderSize;
+    }
+    else if (width != width_ || height != height_)
+    {
+        return false;
+    }
+
+    // Drop alpha while copying into the packed frame.
+    current_.resize(static_cast<size_t>(width) * height * 3);
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t* src = pixels + static_cast<ptrdiff_t>(y) * stride;
+        BgraToBgr(src, current_.data() + static_cast<size_t>(y) * width * 3, width);
+    }
+
+    const uint32_t frame = static_cast<uint32_t>(index_.size());
+    const int tiles = tilesX_ * tilesY_;
+    bool keyframe = frame == 0 || frame - lastKeyframe_ >= static_cast<uint32_t>(options_.keyframeInterval);
+
+    raw_.clear();
+    if (!keyframe)
+    {
+        // Tile list first, then the tile pixels in the same order.
+        PutU32(raw_, 0);
+        const size_t rowBytes = static_cast<size_t>(width_) * 3;
+        size_t dataBytes = 0;
+        int changed = 0;
+        for (int t = 0; t < tiles; t++)
+        {
+            int left = (t % tilesX_) * options_.tileSize;
+            int top = (t / tilesX_) * options_.tileSize;
+            size_t spanBytes = static_cast<size_t>((std::min)(options_.tileSize, width_ - left)) * 3;
+            int rows = (std::min)(options_.tileSize, height_ - top);
+            size_t offset = top * rowBytes + static_cast<size_t>(left) * 3;
+            for (int y = 0; y < rows; y++, offset += rowBytes)
+            {
+                if (memcmp(current_.data() + offset, reference_.data() + offset, spanBytes) != 0)
+                {
+                    PutU32(raw_, static_cast<uint32_t>(t));
+                    dataBytes += TileBytes(width_, height_, options_.tileSize, tilesX_, t);
+                    changed++;
+                    break;
+                }
+            }
+        }
+
+        // A delta covering most of the frame gains nothing over a keyframe.
+        if (dataBytes * 2 > current_.size())
+        {
+            keyframe = true;
+        }
+        else
+        {
+            for (int i = 0; i < 4; i++)
+                raw_[i] = static_cast<uint8_t>(static_cast<uint32_t>(changed) >> (8 * i));
+            size_t at = raw_.size();
+            raw_.resize(at + dataBytes);
+            for (int i = 0; i < changed; i++)
+            {
+                int t = static_cast<int>(GetU32(raw_.data() + 4 + 4 * i));
+                CopyTile(current_.data(), width_, height_, options_.tileSize, tilesX_, t, raw_.data() + at);
+                at += TileBytes(width_, height_, options_.tileSize, tilesX_, t);
+            }
+        }
+    }
+    if (keyframe)
+    {
+        raw_.assign(current_.begin(), current_.end());
+        lastKeyframe_ = frame;
+    }
+
+    payload_.clear();
+    deflate_.Reset(options_.level);
+    deflate_.Write(raw_.data(), raw_.size(), payload_);
+    deflate_.Finish(payload_);
+
+    IndexEntry entry;
+    entry.offset = bytesWritten_;
+    entry.timestampMs = timestampMs;
+    entry.keyframe = lastKeyframe_;
+    index_.push_back(entry);
+
+    out.push_back(keyframe ? kRecordKey : kRecordDelta);
+    out.push_back(0);
+    out.push_back(0);
+    out.push_back(0);
+    PutU32(out, static_cast<uint32_t>(raw_.size()));
+    PutU32(out, static_cast<uint32_t>(payload_.size()));
+    PutU64(out, static_cast<uint64_t>(timestampMs));
+    out.insert(out.end(), payload_.begin(), payload_.end());
+    bytesWritten_ += kRecordHeaderSize + payload_.size();
+
+    reference_.swap(current_);
+    return true;
+}
+
+bool SeqWriter::AddFrame(const FrameView& frame, int64_t timestampMs, std::vector<uint8_t>& out)
+{
+    return AddFrame(frame.data, frame.width, frame.height, static_cast<int>(frame.stride), timestampMs, out);
+}
+
+void SeqWriter::Finish(std::vector<uint8_t>& out)
+{
+    if (finished_ || index_.empty())
+        return;
+    finished_ = true;
+    uint64_t indexOffset = bytesWritten_;
+    for (const IndexEntry& entry : index_)
+    {
+        PutU64(out, entry.offset);
+        PutU64(out, static_cast<uint64_t>(entry.timestampMs));
+        PutU32(out, entry.keyframe);
+    }
+    PutU64(out, indexOffset);
+    PutU32(out, static_cast<uint32_t>(index_.size()));
+    PutU32(out, 0);
+    out.insert(out.end(), kIndexMagic, kIndexMagic + 8);
+    bytesWritten_ += index_.size() * kIndexEntrySize + kTrailerSize;
+}
+
+//---------------------------------------------------------------------
+bool SeqReader::Open(const SeqReadFunction& read, uint64_t fileSize)
+{
+    read_ = read;
+    fileSize_ = fileSize;
+    index_.clear();
+    canvasFrame_ = -1;
+    recovered_ = false;
+
+    uint8_t header[kHeaderSize];
+    if (fileSize < kHeaderSize || !read_(0, header, kHeaderSize) ||
+        memcmp(header, kFileMagic, 8) != 0 || GetU32(header + 8) != kVersion)
+        return false;
+    uint32_t width = GetU32(header + 12);
+    uint32_t height = GetU32(header + 16);
+    uint32_t tileSize = GetU32(header + 20);
+    if (width == 0 || height == 0 || width > kMaxDimension || height > kMaxDimension ||
+        tileSize < 4 || tileSize > kMaxDimension)
+        return false;
+    width_ = static_cast<int>(width);
+    height_ = static_cast<int>(height);
+    tileSize_ = static_cast<int>(tileSize);
+
+    uint8_t trailer[kTrailerSize];
+    if (fileSize >= kHeaderSize + kTrailerSize && read_(fileSize - kTrailerSize, trailer, kTrailerSize) &&
+        memcmp(trailer + 16, kIndexMagic, 8) == 0)
+    {
+        uint64_t indexOffset = GetU64(trailer);
+        uint32_t count = GetU32(trailer + 8);
+        if (indexOffset >= kHeaderSize && indexOffset <= fileSize - kTrailerSize &&
+            (fileSize - kTrailerSize - indexOffset) == static_cast<uint64_t>(count) * kIndexEntrySize)
+        {
+            std::vector<uint8_t> table(static_cast<size_t>(count) * kIndexEntrySize);
+            if (table.empty() || read_(indexOffset, table.data(), table.size()))
+            {
+                index_.resize(count);
+                bool valid = true;
+                for (uint32_t i = 0; i < count; i++)
+                {
+                    const uint8_t* p = table.data() + static_cast<size_t>(i) * kIndexEntrySize;
+                    index_[i].offset = GetU64(p);
+                    index_[i].timestampMs = static_cast<int64_t>(GetU64(p + 8));
+                    index_[i].keyframe = GetU32(p + 16);
+                    valid = valid && index_[i].keyframe <= i && index_[i].offset < indexOffset;
+                }
+                if (valid)
+                    return true;
+                index_.clear();
+            }
+        }
+    }
+
+    // No usable index (the run was interrupted): rebuild it from the records.
+    recovered_ = true;
+    return ScanRecords();
+}
+
+bool SeqReader::ScanRecords()
+{
+    uint64_t offset = kHeaderSize;
+    uint32_t keyframe = 0;
+    uint8_t record[kRecordHeaderSize];
+    while (offset + kRecordHeaderSize <= fileSize_ && read_(offset, record, kRecordHeaderSize))
+    {
+        uint64_t payloadSize = GetU32(record + 8);
+        if (record[0] > kRecordDelta || offset + kRecordHeaderSize + payloadSize > fileSize_)
+            break;
+        if (record[0] == kRecordKey)
+            keyframe = static_cast<uint32_t>(index_.size());
+        else if (index_.empty())
+            break;
+        IndexEntry entry;
+        entry.offset = offset;
+        entry.timestampMs = static_cast<int64_t>(GetU64(record + 12));
+        entry.keyframe = keyframe;
+        index_.push_back(entry);
+        offset += kRecordHeaderSize + payloadSize;
+    }
+    return !index_.empty();
+}
+
+bool SeqReader::ReadFrame(int frame, std::vector<uint8_t>& pixels)
+{
+    if (frame < 0 || frame >= FrameCount())
+        return false;
+
+    int from = static_cast<int>(index_[frame].keyframe);
+    if (canvasFrame_ >= from && canvasFrame_ <= frame)
+        from = canvasFrame_ + 1;
+    for (int f = from; f <= frame; f++)
+    {
+        if (!ApplyRecord(f))
+        {
+            canvasFrame_ = -1;
+            return false;
+        }
+        canvasFrame_ = f;
+    }
+
+    pixels.resize(static_cast<size_t>(width_) * height_ * 4);
+    for (int y = 0; y < height_; y++)
+    {
+        BgrToBgra(canvas_.data() + static_cast<size_t>(y) * width_ * 3,
+            pixels.data() + static_cast<size_t>(y) * width_ * 4, width_);
+    }
+    return true;
+}
+
+// Decode record frame on top of canvas_, which must hold frame - 1 unless
+// the record is a keyframe.
+bool SeqReader::ApplyRecord(int frame)
+{
+    uint8_t record[kRecordHeaderSize];
+    uint64_t offset = index_[frame].offset;
+    if (offset + kRecordHeaderSize > fileSize_ || !read_(offset, record, kRecordHeaderSize))
+        return false;
+    uint32_t rawSize = GetU32(record + 4);
+    uint32_t payloadSize = GetU32(record + 8);
+    if (offset + kRecordHeaderSize + payloadSize > fileSize_)
+        return false;
+
+    const size_t frameBytes = static_cast<size_t>(width_) * height_ * 3;
+    const int tilesX = (width_ + tileSize_ - 1) / tileSize_;
+    const int tilesY = (height_ + tileSize_ - 1) / tileSize_;
+    const uint32_t tiles = static_cast<uint32_t>(tilesX) * tilesY;
+    if (rawSize > frameBytes + 4 + static_cast<size_t>(tiles) * 4)
+        return false;
+    payload_.resize(payloadSize);
+    if (payloadSize && !read_(offset + kRecordHeaderSize, payload_.data(), payloadSize))
+        return false;
+    raw_.clear();
+    if (!InflateRaw(payload_.data(), payload_.size(), raw_, rawSize) || raw_.size() != rawSize)
+        return false;
+
+    if (record[0] == kRecordKey)
+    {
+        if (rawSize != frameBytes)
+            return false;
+        canvas_.swap(raw_);
+        return true;
+    }
+
+    if (record[0] != kRecordDelta || canvas_.size() != frameBytes || rawSize < 4)
+        return false;
+    uint32_t changed = GetU32(raw_.data());
+    if (changed > tiles || 4 + static_cast<size_t>(changed) * 4 > rawSize)
+        return false;
+    size_t at = 4 + static_cast<size_t>(changed) * 4;
+    for (uint32_t i = 0; i < changed; i++)
+    {
+        uint32_t t = GetU32(raw_.data() + 4 + 4 * i);
+        if (t >= tiles)
+            return false;
+        size_t bytes = TileBytes(width_, height_, tileSize_, tilesX, static_cast<int>(t));
+        if (at + bytes > rawSize)
+            return false;
+        PasteTile(canvas_.data(), width_, height_, tileSize_, tilesX, static_cast<int>(t), raw_.data() + at);
+        at += bytes;
+    }
+    return at == rawSize;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "Deflate.h"
+#include "Frame.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Frame sequence container written by -format seq: a whole -repeat run
+// in one file.
+//
+//   header   "SHOTSEQ1", version, width, height, tile size, keyframe interval
+//   records  per frame: type, raw size, payload size, timestamp, payload
+//   index    per frame: record offset, timestamp, keyframe number
+//   trailer  index offset, frame count, "SEQINDEX"
+//
+// Keyframes store every pixel. Other frames store only the tiles that
+// differ from the previous frame. Payloads are raw deflate, pixels are
+// BGR (alpha is dropped) and all integers are little-endian. A file cut
+// short before its index is written can still be read by scanning the
+// records.
+
+struct SeqOptions
+{
+    int tileSize = 32;
+    int keyframeInterval = 100;     // At most this many frames per keyframe.
+    CompressionLevel level = CompressionLevel::Fast;
+};
+
+class SeqWriter
+{
+public:
+    explicit SeqWriter(const SeqOptions& options = SeqOptions());
+
+    // Append the bytes for one 32 bpp BGRA frame to out; the caller owns
+    // the file. The first frame fixes the dimensions and later frames must
+    // match them. timestampMs is stored as given (the tool uses Unix time).
+    bool AddFrame(const uint8_t* pixels, int width, int height, int stride,
+        int64_t timestampMs, std::vector<uint8_t>& out);
+    bool AddFrame(const FrameView& frame, int64_t timestampMs, std::vector<uint8_t>& out);
+
+    // Append the frame index and trailer.
+    void Finish(std::vector<uint8_t>& out);
+
+    int FrameCount() const { return static_cast<int>(index_.size()); }
+    uint64_t BytesWritten() const { return bytesWritten_; }
+
+private:
+    struct IndexEntry
+    {
+        uint64_t offset;
+        int64_t timestampMs;
+        uint32_t keyframe;
+    };
+
+    SeqOptions options_;
+    int width_ = 0;
+    int height_ = 0;
+    int tilesX_ = 0;
+    int tilesY_ = 0;
+    uint32_t lastKeyframe_ = 0;
+    uint64_t bytesWritten_ = 0;
+    bool finished_ = false;
+    std::vector<IndexEntry> index_;
+    std::vector<uint8_t> reference_;    // Previous frame, BGR.
+    std::vector<uint8_t> current_;      // Frame being added, BGR.
+    std::vector<uint8_t> raw_;          // Payload before compression.
+    std::vector<uint8_t> payload_;
+    DeflateStream deflate_;
+};
+
+//---------------------------------------------------------------------
+// Random access to a .seq file through a read callback, so the caller
+// decides how the file is opened. Reads must return exactly size bytes.
+typedef std::function<bool(uint64_t offset, void* buffer, size_t size)> SeqReadFunction;
+
+class SeqReader
+{
+public:
+    bool Open(const SeqReadFunction& read, uint64_t fileSize);
+
+    int Width() const { return width_; }
+    int Height() const { return height_; }
+    int FrameCount() const { return static_cast<int>(index_.size()); }
+    int64_t Timestamp(int frame) const { return index_[frame].timestampMs; }
+    bool IndexRecovered() const { return recovered_; }
+
+    // Reconstruct frame (0-based) as top-down 32 bpp BGRA, alpha 255.
+    // Decoding starts at the frame's keyframe, or continues from the last
+    // frame read when that is on the way.
+    bool ReadFrame(int frame, std::vector<uint8_t>& pixels);
+
+private:
+    struct IndexEntry
+    {
+        uint64_t offset;
+        int64_t timestampMs;
+        uint32_t keyframe;
+    };
+
+    bool ScanRecords();
+    bool ApplyRecord(int frame);
+
+    SeqReadFunction read_;
+    uint64_t fileSize_ = 0;
+    int width_ = 0;
+    int height_ = 0;
+    int tileSize_ = 0;
+    bool recovered_ = false;
+    std::vector<IndexEntry> index_;
+    std::vector<uint8_t> canvas_;       // Last decoded frame, BGR.
+    int canvasFrame_ = -1;
+    std::vector<uint8_t> payload_;
+    std::vector<uint8_t> raw_;
+};
@@ -25,9 +25,45 @@
 #include <algorithm>
 #include <chrono>
 #include <thread>
+#include <cstdint>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <climits>
+#include <map>
+#include <iterator>
+#include <cmath>
+#include <mmsystem.h>  // For timeBeginPeriod
+
+#include "AsyncFileWriter.h"
+#include "AsyncLog.h"
+#include "BandedCapture.h"
+#include "CapturePipeline.h"
+#include "CaptureService.h"
+#include "CaptureSession.h"
+#include "CaptureStats.h"
+#include "ChangeDetector.h"
+#include "DesktopCapture.h"
+#include "FlightRecorder.h"
+#include "Frame.h"
+#include "FrameStream.h"
+#include "ImageCompare.h"
+#include "JpegEncoder.h"
+#include "PngDecoder.h"
+#include "PngEncoder.h"
+#include "QoiCodec.h"
+#include "Redaction.h"
+#include "RegionFanOut.h"
+#include "RepeatScheduler.h"
+#include "Resampler.h"
+#include "SeqContainer.h"
+#include "TextOverlay.h"
+#include "ThreadPool.h"
 
 #pragma comment (lib, "gdiplus.lib")
 #pragma comment (lib, "Shcore.lib")  // For DPI functions
+#pragma comment (lib, "ole32.lib")   // For CreateStreamOnHGlobal
+#pragma comment (lib, "winmm.lib")   // For timeBeginPeriod
 
 using namespace Gdiplus;
 
@@ -35,6 +71,42 @@ using namespace Gdiplus;
 // Global variable to store the selected rectangle (interactive mode)
 static RECT g_selRect = { 0, 0, 0, 0 };
 
+// Set to end a -repeat run early (stream reader gone, -flightrec stopped)
+// or to stop -serve.
+static std::atomic<bool> g_stopCapture(false);
+// Set by Ctrl+Break or a "dump" line on stdin during -flightrec.
+static std::atomic<bool> g_flightDumpRequested(false);
+
+//---------------------------------------------------------------------
+// Console control handler for -flightrec: Ctrl+Break dumps the ring,
+// Ctrl+C stops recording cleanly instead of killing the process.
+BOOL WINAPI FlightRecorderCtrlHandler(DWORD ctrlType)
+{
+    if (ctrlType == CTRL_BREAK_EVENT)
+    {
+        g_flightDumpRequested.store(true);
+        return TRUE;
+    }
+    if (ctrlType == CTRL_C_EVENT)
+    {
+        g_stopCapture.store(true);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// Console control handler for -serve: Ctrl+C or Ctrl+Break stops taking
+// requests; those already queued are still answered.
+BOOL WINAPI ServiceCtrlHandler(DWORD ctrlType)
+{
+    if (ctrlType == CTRL_C_EVENT || ctrlType == CTRL_BREAK_EVENT)
+    {
+        g_stopCapture.store(true);
+        return TRUE;
+    }
+    return FALSE;
+}
+
 //---------------------------------------------------------------------
 // Window Procedure for the interactive selection overlay.
 LRESULT CALLBACK SelectionWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
@@ -133,23 +205,20 @@ RECT GetSelectionRect(HINSTANCE hInstance)
 }
 
 //---------------------------------------------------------------------
-// Helper: Convert an HBITMAP to a DIB stored in global memory (for clipboard).
-HGLOBAL CreateDIBFromHBITMAP(HBITMAP hBitmap)
+// Helper: Copy a frame into a bottom-up DIB stored in global memory (for
+// the clipboard, which must own its copy).
+HGLOBAL CreateDIBFromFrame(const FrameView& frame)
 {
-    BITMAP bm;
-    if (!GetObject(hBitmap, sizeof(bm), &bm))
-        return NULL;
     BITMAPINFOHEADER bi;
     ZeroMemory(&bi, sizeof(bi));
     bi.biSize = sizeof(BITMAPINFOHEADER);
-    bi.biWidth = bm.bmWidth;
-    bi.biHeight = bm.bmHeight;
+    bi.biWidth = frame.width;
+    bi.biHeight = frame.height;
     bi.biPlanes = 1;
-    bi.biBitCount = bm.bmBitsPixel;
+    bi.biBitCount = 32;
     bi.biCompression = BI_RGB;
-    int lineBytes = ((bm.bmWidth * bm.bmBitsPixel + 31) & ~31) / 8;
-    DWORD dwSize = lineBytes * bm.bmHeight;
-    DWORD dwMemSize = sizeof(BITMAPINFOHEADER) + dwSize;
+    size_t lineBytes = static_cast<size_t>(frame.width) * 4;
+    size_t dwMemSize = sizeof(BITMAPINFOHEADER) + lineBytes * frame.height;
     HGLOBAL hMem = GlobalAlloc(GMEM_MOVEABLE, dwMemSize);
     if (!hMem)
         return NULL;
@@ -160,249 +229,1484 @@ HGLOBAL CreateDIBFromHBITMAP(HBITMAP hBitmap)
         return NULL;
     }
     memcpy(pMem, &bi, sizeof(BITMAPINFOHEADER));
-    LPVOID pBits = (LPBYTE)pMem + sizeof(BITMAPINFOHEADER);
-    HDC hDC = GetDC(NULL);
-    if (!hDC)
-    {
-        GlobalUnlock(hMem);
-        GlobalFree(hMem);
-        return NULL;
-    }
-    BITMAPINFO* pbi = (BITMAPINFO*)pMem;
-    if (!GetDIBits(hDC, hBitmap, 0, bm.bmHeight, pBits, pbi, DIB_RGB_COLORS))
-    {
-        ReleaseDC(NULL, hDC);
-        GlobalUnlock(hMem);
-        GlobalFree(hMem);
-        return NULL;
-    }
-    ReleaseDC(NULL, hDC);
+    // Walk the DIB rows bottom-up so the frame's top row lands last.
+    FrameView dib;
+    dib.width = frame.width;
+    dib.height = frame.height;
+    dib.stride = -static_cast<ptrdiff_t>(lineBytes);
+    dib.data = (LPBYTE)pMem + sizeof(BITMAPINFOHEADER) + lineBytes * (frame.height - 1);
+    dib.format = frame.format;
+    CopyFrame(frame, dib);
     GlobalUnlock(hMem);
     return hMem;
 }
 
 //---------------------------------------------------------------------
-// Helper: Retrieve the CLSID of an image encoder (e.g., PNG, JPEG, BMP).
-int GetEncoderClsid(const WCHAR* format, CLSID* pClsid)
+// Helper: Write a buffer to a file, replacing any existing file.
+bool WriteBufferToFile(const std::wstring& fileName, const std::vector<uint8_t>& data)
 {
-    UINT num = 0, size = 0;
-    if (GetImageEncodersSize(&num, &size) != Ok || size == 0)
-        return -1;
+    HANDLE hFile = CreateFileW(fileName.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+    DWORD written = 0;
+    BOOL ok = data.empty() || WriteFile(hFile, data.data(), static_cast<DWORD>(data.size()), &written, NULL);
+    CloseHandle(hFile);
+    return ok && written == data.size();
+}
 
-    // Allocate the correct number of bytes.
-    ImageCodecInfo* pImageCodecInfo = reinterpret_cast<ImageCodecInfo*>(malloc(size));
-    if (!pImageCodecInfo)
-        return -1;
+//---------------------------------------------------------------------
+// Win32 files for the write-behind writer (AsyncFileWriter.h).
+namespace
+{
+    const size_t kSectorBytes = 4096;   // A multiple of every sector size in use.
 
-    if (GetImageEncoders(num, size, pImageCodecInfo) != Ok) {
-        free(pImageCodecInfo);
-        return -1;
+    class Win32WritableFile : public WritableFile
+    {
+    public:
+        Win32WritableFile(HANDLE handle, bool noBuffering)
+            : handle_(handle), noBuffering_(noBuffering), bounce_(nullptr), size_(0)
+        {
+        }
+
+        ~Win32WritableFile()
+        {
+            if (handle_ != INVALID_HANDLE_VALUE)
+                CloseHandle(handle_);
+            if (bounce_)
+                VirtualFree(bounce_, 0, MEM_RELEASE);
+        }
+
+        // Unbuffered writes must be whole sectors from aligned memory, so
+        // they go through a page-aligned buffer; the padding of the last
+        // chunk is cut off again in Close.
+        bool Write(const uint8_t* data, size_t size) override
+        {
+            size_ += size;
+            if (!noBuffering_)
+                return WriteAll(data, size);
+            if (!bounce_)
+            {
+                bounce_ = static_cast<uint8_t*>(VirtualAlloc(NULL, AsyncFileWriter::kChunkBytes,
+                    MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+                if (!bounce_)
+                    return false;
+            }
+            const size_t padded = (size + kSectorBytes - 1) / kSectorBytes * kSectorBytes;
+            memcpy(bounce_, data, size);
+            memset(bounce_ + size, 0, padded - size);
+            return WriteAll(bounce_, padded);
+        }
+
+        bool Close() override
+        {
+            bool ok = true;
+            if (noBuffering_ && size_ % kSectorBytes != 0)
+            {
+                FILE_END_OF_FILE_INFO end;
+                end.EndOfFile.QuadPart = static_cast<LONGLONG>(size_);
+                ok = SetFileInformationByHandle(handle_, FileEndOfFileInfo, &end, sizeof(end)) != 0;
+            }
+            ok = CloseHandle(handle_) && ok;
+            handle_ = INVALID_HANDLE_VALUE;
+            return ok;
+        }
+
+    private:
+        bool WriteAll(const uint8_t* data, size_t size)
+        {
+            DWORD written = 0;
+            return size == 0 ||
+                (WriteFile(handle_, data, static_cast<DWORD>(size), &written, NULL) && written == size);
+        }
+
+        HANDLE handle_;
+        bool noBuffering_;
+        uint8_t* bounce_;
+        uint64_t size_;
+    };
+
+    class Win32WriterFileSystem : public WriterFileSystem
+    {
+    public:
+        std::unique_ptr<WritableFile> Create(const std::wstring& path, const FileCreateOptions& options) override
+        {
+            DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN;
+            if (options.writeThrough)
+                flags |= FILE_FLAG_WRITE_THROUGH;
+            if (options.noBuffering)
+                flags |= FILE_FLAG_NO_BUFFERING;
+            HANDLE handle = CreateFileW(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, flags, NULL);
+            if (handle == INVALID_HANDLE_VALUE)
+                return nullptr;
+            if (options.preallocate)
+            {
+                // Reserve the space in one extent; a failure only costs fragmentation.
+                FILE_ALLOCATION_INFO allocation;
+                allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(options.preallocate);
+                SetFileInformationByHandle(handle, FileAllocationInfo, &allocation, sizeof(allocation));
+            }
+            return std::unique_ptr<WritableFile>(new Win32WritableFile(handle, options.noBuffering));
+        }
+
+        bool Replace(const std::wstring& from, const std::wstring& to, bool writeThrough) override
+        {
+            DWORD flags = MOVEFILE_REPLACE_EXISTING | (writeThrough ? MOVEFILE_WRITE_THROUGH : 0);
+            return MoveFileExW(from.c_str(), to.c_str(), flags) != 0;
+        }
+
+        void Remove(const std::wstring& path) override
+        {
+            DeleteFileW(path.c_str());
+        }
+    };
+}
+
+//---------------------------------------------------------------------
+// Helper: Open the target of -o. "-" is stdout; \\.\pipe\<name> connects to
+// that pipe, or creates it and waits for a reader if nobody serves it yet;
+// anything else is a file.
+bool OpenStreamOutput(const std::wstring& target, bool verbose, HANDLE& handle)
+{
+    if (target == L"-")
+    {
+        handle = GetStdHandle(STD_OUTPUT_HANDLE);
+        if (handle == NULL || handle == INVALID_HANDLE_VALUE || GetFileType(handle) == FILE_TYPE_CHAR)
+        {
+            std::cerr << "-o - needs stdout redirected to a file or a pipe." << std::endl;
+            return false;
+        }
+        return true;
     }
 
-    int retVal = -1;
-    for (UINT j = 0; j < num; ++j)
+    const std::wstring pipePrefix = L"\\\\.\\pipe\\";
+    if (target.compare(0, pipePrefix.size(), pipePrefix) == 0)
     {
-        if (wcscmp(pImageCodecInfo[j].MimeType, format) == 0)
+        handle = CreateFileW(target.c_str(), GENERIC_WRITE, 0, NULL, OPEN_EXISTING, 0, NULL);
+        if (handle != INVALID_HANDLE_VALUE)
+            return true;
+        handle = CreateNamedPipeW(target.c_str(), PIPE_ACCESS_OUTBOUND, PIPE_TYPE_BYTE | PIPE_WAIT,
+            1, 1 << 20, 0, 0, NULL);
+        if (handle == INVALID_HANDLE_VALUE)
+        {
+            std::wcerr << L"Failed to create pipe (" << target << L")." << std::endl;
+            return false;
+        }
+        if (verbose)
+            LogInfo() << L"[INFO] Waiting for a reader on " << target << L"...\n";
+        if (!ConnectNamedPipe(handle, NULL) && GetLastError() != ERROR_PIPE_CONNECTED)
         {
-            *pClsid = pImageCodecInfo[j].Clsid;
-            retVal = static_cast<int>(j);
-            break;
+            std::wcerr << L"Failed to connect pipe (" << target << L")." << std::endl;
+            CloseHandle(handle);
+            return false;
         }
+        return true;
     }
-    free(pImageCodecInfo);
-    return retVal;
-}
 
+    handle = CreateFileW(target.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        std::wcerr << L"Failed to create stream file (" << target << L")." << std::endl;
+        return false;
+    }
+    return true;
+}
 
 //---------------------------------------------------------------------
-// Print usage instructions.
-void printUsage()
+// Helper: Write a whole buffer to a stream; pipes may take it in pieces.
+bool WriteToStream(HANDLE handle, const uint8_t* data, size_t size)
 {
-    std::cout << "Usage: ShotCap.exe [options]\n"
-        << "Options:\n"
-        << "  -f <filename>         Output file name (default: screenshot.png)\n"
-        << "  -dir <directory>      Output directory (default: current directory)\n"
-        << "  -d <delay>            Delay in seconds before capturing (default: 0)\n"
-        << "  -r <x,y,w,h>          Capture region (default: full screen)\n"
-        << "  -select               Interactively select a region with the mouse\n"
-        << "  -format <format>      Image format: png, jpg, bmp (default: png)\n"
-        << "  -quality <0-100>      JPEG quality (only for -format jpg, default: 90)\n"
-        << "  -w <window_title>     Capture a specific window by its title\n"
-        << "  -active               Capture the active (foreground) window\n"
-        << "  -m <monitor_index>    Capture a specific monitor (0-based index)\n"
-        << "  -clipboard            Copy captured image to clipboard\n"
-        << "  -show                 Open the captured image after saving\n"
-        << "  -p                    Include the mouse pointer in the screenshot\n"
-        << "  -timestamp            Annotate screenshot with current date/time\n"
-        << "  -repeat <i> <n>       Repeat capture every i seconds for n times\n"
-        << "  -listmonitors         List available monitors and exit\n"
-        << "  -listwindows          List visible top-level windows and exit\n"
-        << "  -vl                   Enable verbose logging\n"
-        << "  -v, --version         Show current shotcap version\n"
-        << "  -h, --help            Display this help message\n";
+    while (size > 0)
+    {
+        DWORD chunk = static_cast<DWORD>((std::min)(size, static_cast<size_t>(1) << 30));
+        DWORD written = 0;
+        if (!WriteFile(handle, data, chunk, &written, NULL) || written == 0)
+            return false;
+        data += written;
+        size -= written;
+    }
+    return true;
 }
 
 //---------------------------------------------------------------------
-// Utility: Split a string by a delimiter.
-std::vector<std::string> split(const std::string& s, char delimiter)
+// Helper: Create a file of the given size and map all of it for writing.
+// Returns the view, or NULL; close with UnmapViewOfFile and both handles.
+uint8_t* MapNewFile(const std::wstring& fileName, size_t size, HANDLE& hFile, HANDLE& hMapping)
 {
-    std::vector<std::string> tokens;
-    std::istringstream tokenStream(s);
-    std::string token;
-    while (std::getline(tokenStream, token, delimiter))
-        tokens.push_back(token);
-    return tokens;
+    hMapping = NULL;
+    hFile = CreateFileW(fileName.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return NULL;
+    const uint64_t size64 = size;
+    hMapping = CreateFileMappingW(hFile, NULL, PAGE_READWRITE, static_cast<DWORD>(size64 >> 32),
+        static_cast<DWORD>(size64), NULL);
+    void* view = hMapping ? MapViewOfFile(hMapping, FILE_MAP_WRITE, 0, 0, size) : NULL;
+    if (!view)
+    {
+        if (hMapping)
+            CloseHandle(hMapping);
+        CloseHandle(hFile);
+        hMapping = NULL;
+        hFile = INVALID_HANDLE_VALUE;
+    }
+    return static_cast<uint8_t*>(view);
 }
 
 //---------------------------------------------------------------------
-// Structure to store monitor information.
-struct MonitorInfo {
-    RECT rect;
-};
+// Helper: Save flight recorder frames, oldest first, as prefix_001.ext,
+// prefix_002.ext, ... Returns the number of files written.
+int SaveFlightFrames(const std::vector<FlightFrame>& frames, const std::wstring& prefix, const std::wstring& extension)
+{
+    int saved = 0;
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        std::wstringstream ss;
+        ss << prefix << L"_" << std::setfill(L'0') << std::setw(3) << (i + 1) << L"." << extension;
+        if (WriteBufferToFile(ss.str(), frames[i].bytes))
+            saved++;
+        else
+            std::wcerr << L"Failed to save " << ss.str() << L"." << std::endl;
+    }
+    return saved;
+}
 
-// Callback for enumerating monitors.
-BOOL CALLBACK MonitorEnumProc(HMONITOR hMonitor, HDC, LPRECT lprcMonitor, LPARAM dwData)
+//---------------------------------------------------------------------
+// Helper: Read a whole file into a buffer.
+bool ReadFileToBuffer(const std::wstring& fileName, std::vector<uint8_t>& data)
 {
-    std::vector<MonitorInfo>* monitors = reinterpret_cast<std::vector<MonitorInfo>*>(dwData);
-    MonitorInfo mi;
-    mi.rect = *lprcMonitor;
-    monitors->push_back(mi);
-    return TRUE;
+    HANDLE hFile = CreateFileW(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER fileSize;
+    bool ok = GetFileSizeEx(hFile, &fileSize) && fileSize.QuadPart <= MAXDWORD;
+    if (ok)
+    {
+        data.resize(static_cast<size_t>(fileSize.QuadPart));
+        DWORD got = 0;
+        ok = data.empty() || (ReadFile(hFile, data.data(), static_cast<DWORD>(data.size()), &got, NULL) && got == data.size());
+    }
+    CloseHandle(hFile);
+    return ok;
 }
 
 //---------------------------------------------------------------------
-// Callback for enumerating top-level windows.
-BOOL CALLBACK EnumWindowsProc(HWND hWnd, LPARAM lParam)
+// Helper: Convert QOI captures to PNG. pattern is a file or a wildcard
+// such as C:\caps\*.qoi; every PNG is written next to its QOI file (or
+// into outputDir) with the same name. Files are converted in parallel.
+// Returns the number of files that failed.
+int ConvertQoiToPng(const std::wstring& pattern, const std::wstring& outputDir, CompressionLevel level,
+    PaletteMode palette, bool verbose)
 {
-    if (IsWindowVisible(hWnd))
+    size_t slash = pattern.find_last_of(L"\\/");
+    std::wstring folder = slash == std::wstring::npos ? L"" : pattern.substr(0, slash + 1);
+    std::vector<std::wstring> inputs;
+    WIN32_FIND_DATAW found;
+    HANDLE hFind = FindFirstFileW(pattern.c_str(), &found);
+    if (hFind != INVALID_HANDLE_VALUE)
     {
-        const int len = 256;
-        wchar_t title[len] = { 0 };
-        GetWindowTextW(hWnd, title, len);
-        if (wcslen(title) > 0)
+        do
         {
-            std::wstringstream* ss = reinterpret_cast<std::wstringstream*>(lParam);
-            *ss << L"Handle: " << hWnd << L" | Title: " << title << std::endl;
-        }
+            if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+                inputs.push_back(folder + found.cFileName);
+        } while (FindNextFileW(hFind, &found));
+        FindClose(hFind);
     }
-    return TRUE;
+    if (inputs.empty())
+    {
+        std::wcerr << L"No files match " << pattern << L"." << std::endl;
+        return 1;
+    }
+    std::sort(inputs.begin(), inputs.end());
+    if (verbose)
+        std::wcout << L"[INFO] Converting " << inputs.size() << L" QOI file(s) to PNG...\n";
+
+    std::atomic<int> failed(0);
+    std::mutex consoleMutex;
+    SharedThreadPool().ParallelFor(static_cast<int>(inputs.size()), [&](int i)
+        {
+            const std::wstring& qoiPath = inputs[i];
+            size_t nameStart = qoiPath.find_last_of(L"\\/");
+            nameStart = nameStart == std::wstring::npos ? 0 : nameStart + 1;
+            size_t dot = qoiPath.find_last_of(L'.');
+            std::wstring base = (dot != std::wstring::npos && dot > nameStart) ? qoiPath.substr(0, dot) : qoiPath;
+            std::wstring pngPath = outputDir.empty() ? base + L".png"
+                : outputDir + L"\\" + base.substr(nameStart) + L".png";
+
+            std::vector<uint8_t> data, pixels, encoded;
+            FrameView frame;
+            std::wstring error;
+            if (!ReadFileToBuffer(qoiPath, data))
+                error = L"Failed to read " + qoiPath + L".";
+            else if (!DecodeQoi(data.data(), data.size(), pixels, frame))
+                error = L"Not a valid QOI file (" + qoiPath + L").";
+            else
+            {
+                // One encoder per pool thread keeps its buffers warm across files.
+                thread_local PngEncoder pngEncoder;
+                PngOptions pngOptions;
+                pngOptions.level = level;
+                pngOptions.keepAlpha = true;
+                pngOptions.palette = palette;
+                if (!pngEncoder.Encode(frame, pngOptions, encoded) || !WriteBufferToFile(pngPath, encoded))
+                    error = L"Failed to save " + pngPath + L".";
+            }
+
+            std::lock_guard<std::mutex> lock(consoleMutex);
+            if (!error.empty())
+            {
+                failed++;
+                std::wcerr << error << std::endl;
+            }
+            else
+            {
+                std::wcout << qoiPath << L" converted to " << pngPath << std::endl;
+            }
+        });
+    return failed.load();
 }
 
 //---------------------------------------------------------------------
-// Annotate the captured image with a timestamp (or custom text) at bottom-right.
-void AnnotateImage(Bitmap* bmp, const std::wstring& text, bool verbose)
+// Helper: Reconstruct one frame (1-based) of a sequence file and save it as PNG.
+bool ExtractSeqFrame(const std::wstring& seqPath, int frameNumber, const std::wstring& pngPath,
+    CompressionLevel level, PaletteMode palette, bool verbose)
 {
-    Graphics graphics(bmp);
-    graphics.SetSmoothingMode(SmoothingModeAntiAlias);
-    graphics.SetTextRenderingHint(TextRenderingHintAntiAlias);
+    HANDLE hFile = CreateFileW(seqPath.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        std::wcerr << L"Failed to open sequence file (" << seqPath << L")." << std::endl;
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(hFile, &fileSize))
+    {
+        CloseHandle(hFile);
+        std::wcerr << L"Failed to read sequence file (" << seqPath << L")." << std::endl;
+        return false;
+    }
 
-    Font font(L"Arial", 20);
-    SolidBrush brush(Color(255, 255, 255, 255)); // White
-    SolidBrush shadowBrush(Color(128, 0, 0, 0));   // Black shadow
+    auto readAt = [&](uint64_t offset, void* buffer, size_t size) -> bool
+        {
+            LARGE_INTEGER pos;
+            pos.QuadPart = static_cast<LONGLONG>(offset);
+            DWORD got = 0;
+            return SetFilePointerEx(hFile, pos, NULL, FILE_BEGIN) &&
+                ReadFile(hFile, buffer, static_cast<DWORD>(size), &got, NULL) && got == size;
+        };
 
-    RectF layoutRect(0, 0, static_cast<REAL>(bmp->GetWidth()), static_cast<REAL>(bmp->GetHeight()));
-    StringFormat format;
-    format.SetAlignment(StringAlignmentFar);
-    format.SetLineAlignment(StringAlignmentFar);
-    RectF bound;
-    graphics.MeasureString(text.c_str(), -1, &font, layoutRect, &format, &bound);
+    SeqReader reader;
+    std::vector<uint8_t> pixels;
+    std::vector<uint8_t> encoded;
+    bool ok = reader.Open(readAt, static_cast<uint64_t>(fileSize.QuadPart));
+    if (!ok)
+    {
+        std::wcerr << L"Not a valid sequence file (" << seqPath << L")." << std::endl;
+    }
+    else if (frameNumber < 1 || frameNumber > reader.FrameCount())
+    {
+        std::wcerr << L"Frame " << frameNumber << L" is out of range (1-" << reader.FrameCount() << L")." << std::endl;
+        ok = false;
+    }
+    else
+    {
+        if (verbose && reader.IndexRecovered())
+            std::wcout << L"[INFO] Sequence index missing; rebuilt it from " << reader.FrameCount() << L" frame records.\n";
+        ok = reader.ReadFrame(frameNumber - 1, pixels);
+        if (!ok)
+            std::wcerr << L"Failed to decode frame " << frameNumber << L"; the sequence file is damaged." << std::endl;
+    }
+    CloseHandle(hFile);
+    if (!ok)
+        return false;
 
-    float margin = 10.0f;
-    PointF position(static_cast<REAL>(bmp->GetWidth()) - bound.Width - margin,
-        static_cast<REAL>(bmp->GetHeight()) - bound.Height - margin);
+    PngOptions pngOptions;
+    pngOptions.level = level;
+    pngOptions.palette = palette;
+    if (!EncodePng(pixels.data(), reader.Width(), reader.Height(), reader.Width() * 4, pngOptions, encoded) ||
+        !WriteBufferToFile(pngPath, encoded))
+    {
+        std::wcerr << L"Failed to save frame (" << pngPath << L")." << std::endl;
+        return false;
+    }
+    std::wcout << L"Frame " << frameNumber << L" extracted as " << pngPath << std::endl;
+    return true;
+}
 
-    graphics.DrawString(text.c_str(), -1, &font, PointF(position.X + 2, position.Y + 2), &format, &shadowBrush);
-    graphics.DrawString(text.c_str(), -1, &font, position, &format, &brush);
+//---------------------------------------------------------------------
+// Helper: Encode a GDI+ image into a memory buffer instead of a file.
+bool SaveImageToBuffer(Image* image, const CLSID* encoderClsid, const EncoderParameters* params,
+    std::vector<uint8_t>& out)
+{
+    IStream* stream = NULL;
+    if (CreateStreamOnHGlobal(NULL, TRUE, &stream) != S_OK)
+        return false;
+    bool ok = image->Save(stream, encoderClsid, params) == Ok;
+    if (ok)
+    {
+        STATSTG stat;
+        HGLOBAL hMem = NULL;
+        ok = stream->Stat(&stat, STATFLAG_NONAME) == S_OK && GetHGlobalFromStream(stream, &hMem) == S_OK;
+        const BYTE* data = ok ? static_cast<const BYTE*>(GlobalLock(hMem)) : NULL;
+        if (data)
+        {
+            out.assign(data, data + static_cast<size_t>(stat.cbSize.QuadPart));
+            GlobalUnlock(hMem);
+        }
+        ok = data != NULL;
+    }
+    stream->Release();
+    return ok;
+}
 
-    if (verbose)
-        std::wcout << L"[INFO] Timestamp annotation applied: " << text << std::endl;
+//---------------------------------------------------------------------
+// Helper: Convert UTF-8 (request fields of -serve) to UTF-16.
+std::wstring Utf8ToWide(const std::string& text)
+{
+    if (text.empty())
+        return std::wstring();
+    int len = MultiByteToWideChar(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), NULL, 0);
+    std::wstring wide(len, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, text.c_str(), static_cast<int>(text.size()), &wide[0], len);
+    return wide;
 }
 
 //---------------------------------------------------------------------
-// Main function.
-int main(int argc, char* argv[])
+// Helper: Insert suffix between the name and the extension of a file
+// ("shot.png" + "_thumb" is "shot_thumb.png").
+std::wstring AppendToFileStem(const std::wstring& fileName, const std::wstring& suffix)
 {
-    // --- DPI Awareness Setup ---
-    if (!SetProcessDpiAwarenessContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2))
-        SetProcessDPIAware();
-    // --------------------------------
+    size_t dot = fileName.find_last_of(L'.');
+    size_t slash = fileName.find_last_of(L"\\/");
+    if (dot == std::wstring::npos || (slash != std::wstring::npos && dot < slash))
+        return fileName + suffix;
+    return fileName.substr(0, dot) + suffix + fileName.substr(dot);
+}
 
-    // Default parameters.
-    std::wstring outputFile = L"screenshot.png";
-    std::wstring outputDir = L""; // Current directory if empty.
-    double delaySeconds = 0.0;
-    bool regionSpecified = false;
-    int regionX = 0, regionY = 0, regionW = 0, regionH = 0;
-    std::wstring imageFormat = L"png";
-    std::wstring windowTitle = L"";
-    int monitorIndex = -1;
-    bool copyToClipboard = false;
-    bool showAfterCapture = false;
-    bool capturePointer = false;
-    bool annotateTimestamp = false;
-    bool captureActiveWindow = false;
-    bool repeatEnabled = false;
-    double repeatInterval = 0.0;
-    int repeatCount = 0;
-    int jpegQuality = 90;
-    bool verbose = false;
-    bool listMonitors = false;
-    bool listWindows = false;
-    bool interactiveSelect = false;
+//---------------------------------------------------------------------
+// Helper: Image format for the extension of a file name (png, jpg, bmp or
+// qoi), or fallback for any other.
+std::wstring FormatFromFileName(const std::wstring& fileName, const std::wstring& fallback)
+{
+    size_t dot = fileName.find_last_of(L'.');
+    size_t slash = fileName.find_last_of(L"\\/");
+    if (dot == std::wstring::npos || (slash != std::wstring::npos && dot < slash))
+        return fallback;
+    std::wstring extension = fileName.substr(dot + 1);
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::towlower);
+    if (extension == L"jpeg")
+        extension = L"jpg";
+    if (extension == L"png" || extension == L"jpg" || extension == L"bmp" || extension == L"qoi")
+        return extension;
+    return fallback;
+}
 
-    // Parse command-line arguments.
-    for (int i = 1; i < argc; i++)
+//---------------------------------------------------------------------
+// -compare: what a pair may differ by, and where diff images go.
+struct CompareSettings
+{
+    int tolerance = 0;              // Largest channel difference that still counts as equal.
+    double maxDiff = 0.0;           // Changed pixels a pair may have and still pass...
+    bool maxDiffPercent = false;    // ...or, if set, a percentage of its pixels.
+    std::wstring diffPath;          // -diff: a file for one pair, a directory for a batch.
+};
+
+enum class CompareOutcome
+{
+    Pass,
+    Fail,
+    Error
+};
+
+// An image read by -compare. The buffers are kept between pairs, so a
+// batch does not allocate and fault in two frames' worth of pages per pair.
+struct LoadedImage
+{
+    std::vector<uint8_t> file;
+    std::vector<uint8_t> pixels;
+    FrameView view;
+};
+
+//---------------------------------------------------------------------
+// Helper: Decode an image file for -compare. PNG and QOI are decoded in
+// memory; anything else GDI+ reads (bmp, jpg) is drawn straight into the
+// pixel buffer by LockBits. GDI+ must be started.
+bool LoadImageFile(const std::wstring& fileName, LoadedImage& image, std::wstring& error)
+{
+    static const uint8_t kPngMagic[4] = { 0x89, 'P', 'N', 'G' };
+    image.view = FrameView();
+    image.view.format = FrameFormat::Bgra32;
+    int channels = 0;
+    if (!ReadFileToBuffer(fileName, image.file))
     {
-        std::string arg = argv[i];
-        if (arg == "-h" || arg == "--help")
+        error = L"Failed to read " + fileName + L".";
+        return false;
+    }
+    const bool png = image.file.size() >= 4 && memcmp(image.file.data(), kPngMagic, 4) == 0;
+    const bool qoi = image.file.size() >= 4 && memcmp(image.file.data(), "qoif", 4) == 0;
+    if (png || qoi)
+    {
+        bool decoded = png
+            ? DecodePng(image.file.data(), image.file.size(), image.pixels, image.view.width, image.view.height, channels)
+            : DecodeQoi(image.file.data(), image.file.size(), image.pixels, image.view.width, image.view.height, channels);
+        if (!decoded)
         {
-            printUsage();
-            return 0;
+            error = std::wstring(L"Not a valid ") + (png ? L"PNG" : L"QOI") + L" file (" + fileName + L").";
+            return false;
         }
-        else if (arg == "--version" || arg == "-v")
+    }
+    else
+    {
+        Bitmap bitmap(fileName.c_str());
+        if (bitmap.GetLastStatus() != Ok)
         {
-            std::wcout << L"ShotCap version 1.3\n";
-            return 0;
+            error = L"Unsupported image file (" + fileName + L").";
+            return false;
         }
-        else if (arg == "-f" && i + 1 < argc)
+        image.view.width = static_cast<int>(bitmap.GetWidth());
+        image.view.height = static_cast<int>(bitmap.GetHeight());
+        image.pixels.resize(static_cast<size_t>(image.view.width) * image.view.height * 4);
+        BitmapData data;
+        data.Width = static_cast<UINT>(image.view.width);
+        data.Height = static_cast<UINT>(image.view.height);
+        data.Stride = image.view.width * 4;
+        data.PixelFormat = PixelFormat32bppARGB;
+        data.Scan0 = image.pixels.data();
+        Rect rect(0, 0, image.view.width, image.view.height);
+        if (image.pixels.empty() ||
+            bitmap.LockBits(&rect, ImageLockModeRead | ImageLockModeUserInputBuf, PixelFormat32bppARGB, &data) != Ok)
         {
-            int len = MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, NULL, 0);
-            wchar_t* buffer = new wchar_t[len];
-            MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, buffer, len);
-            outputFile = buffer;
-            delete[] buffer;
-            i++;
+            error = L"Failed to decode " + fileName + L".";
+            return false;
         }
-        else if (arg == "-dir" && i + 1 < argc)
+        bitmap.UnlockBits(&data);
+    }
+    image.view.data = image.pixels.data();
+    image.view.stride = static_cast<ptrdiff_t>(image.view.width) * 4;
+    return true;
+}
+
+//---------------------------------------------------------------------
+// Helper: Compare a (the baseline) with b, describe the outcome in report
+// and, if diffPath is set and they differ, save the highlighted diff there
+// (QOI for a .qoi name, PNG otherwise). threads as in PngOptions.
+CompareOutcome CompareViews(const FrameView& a, const FrameView& b, const std::wstring& name,
+    const CompareSettings& settings, const std::wstring& diffPath, int threads, std::wstring& report)
+{
+    // Boxes listed per failing pair; the rest are only counted.
+    const size_t kMaxBoxesListed = 10;
+    std::wstringstream ss;
+    CompareResult result;
+    if (!CompareImages(a, b, settings.tolerance, result, threads))
+    {
+        ss << L"FAIL " << name << L": sizes differ (" << a.width << L"x" << a.height << L" and "
+            << b.width << L"x" << b.height << L")\n";
+        report = ss.str();
+        return CompareOutcome::Fail;
+    }
+
+    const uint64_t pixels = static_cast<uint64_t>(a.width) * a.height;
+    const double allowed = settings.maxDiffPercent ? settings.maxDiff * pixels / 100.0 : settings.maxDiff;
+    const bool pass = static_cast<double>(result.changedPixels) <= allowed;
+    ss << (pass ? L"PASS " : L"FAIL ") << name << L": " << result.changedPixels << L" of " << pixels
+        << L" pixels differ (" << std::fixed << std::setprecision(3)
+        << (pixels ? 100.0 * result.changedPixels / pixels : 0.0) << L"%), max difference " << result.maxDifference;
+    if (result.changedPixels > 0)
+    {
+        const DesktopRect& r = result.bounds;
+        ss << L", " << result.boxes.size() << L" area(s) within " << r.left << L"," << r.top << L","
+            << r.Width() << L"," << r.Height();
+    }
+    ss << L"\n";
+    if (!pass)
+    {
+        for (size_t i = 0; i < result.boxes.size() && i < kMaxBoxesListed; i++)
         {
-            int len = MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, NULL, 0);
-            wchar_t* buffer = new wchar_t[len];
-            MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, buffer, len);
-            outputDir = buffer;
-            delete[] buffer;
-            i++;
+            const DesktopRect& r = result.boxes[i].rect;
+            ss << L"  " << r.left << L"," << r.top << L"," << r.Width() << L"," << r.Height() << L"  "
+                << result.boxes[i].pixels << L" pixels\n";
         }
-        else if (arg == "-d" && i + 1 < argc)
+        if (result.boxes.size() > kMaxBoxesListed)
+            ss << L"  ... and " << result.boxes.size() - kMaxBoxesListed << L" more\n";
+    }
+
+    if (!diffPath.empty() && result.changedPixels > 0)
+    {
+        thread_local Frame diff;
+        thread_local PngEncoder pngEncoder;
+        RenderDiff(a, b, settings.tolerance, result, diff, threads);
+        std::vector<uint8_t> encoded;
+        bool encodedOk;
+        if (FormatFromFileName(diffPath, L"png") == L"qoi")
         {
-            delaySeconds = std::stod(argv[i + 1]);
-            i++;
+            encodedOk = EncodeQoi(diff.View(), encoded);
         }
-        else if (arg == "-r" && i + 1 < argc)
+        else
         {
-            auto parts = split(argv[i + 1], ',');
-            if (parts.size() == 4)
+            PngOptions pngOptions;
+            pngOptions.level = CompressionLevel::Fast;
+            pngOptions.threads = threads;
+            encodedOk = pngEncoder.Encode(diff.View(), pngOptions, encoded);
+        }
+        if (!encodedOk || !WriteBufferToFile(diffPath, encoded))
+        {
+            report = ss.str() + L"Failed to save diff image (" + diffPath + L").\n";
+            return CompareOutcome::Error;
+        }
+        ss << L"  diff saved as " << diffPath << L"\n";
+    }
+    report = ss.str();
+    return pass ? CompareOutcome::Pass : CompareOutcome::Fail;
+}
+
+//---------------------------------------------------------------------
+// Helper: Print a multi-line report as one LogResult line per line, so a
+// long list of boxes is queued as separate log lines.
+void LogReport(const std::wstring& report)
+{
+    size_t start = 0;
+    while (start < report.size())
+    {
+        size_t end = report.find(L'\n', start);
+        end = end == std::wstring::npos ? report.size() : end + 1;
+        LogResult() << report.substr(start, end - start);
+        start = end;
+    }
+}
+
+//---------------------------------------------------------------------
+// Helper: Files (not directories) directly inside folder, sorted by name.
+std::vector<std::wstring> ListFiles(const std::wstring& folder)
+{
+    std::vector<std::wstring> names;
+    WIN32_FIND_DATAW found;
+    HANDLE hFind = FindFirstFileW((folder + L"\\*").c_str(), &found);
+    if (hFind != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            if (!(found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+                names.push_back(found.cFileName);
+        } while (FindNextFileW(hFind, &found));
+        FindClose(hFind);
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+bool IsDirectory(const std::wstring& path)
+{
+    DWORD attributes = GetFileAttributesW(path.c_str());
+    return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+//---------------------------------------------------------------------
+// Helper: -compare of two files, or of two directories by file name.
+// Pairs of a batch are spread over the shared pool, each compared on one
+// thread; a single pair uses the whole pool. A file that is only in one
+// of the directories fails. Returns 0 when every pair passes, 1 when any
+// differs, -1 on errors.
+int RunCompare(const std::wstring& pathA, const std::wstring& pathB, const CompareSettings& settings, bool verbose)
+{
+    const bool batch = IsDirectory(pathA);
+    if (batch != IsDirectory(pathB))
+    {
+        std::cerr << "-compare takes two files or two directories.\n";
+        return -1;
+    }
+    if (batch && !settings.diffPath.empty() && !IsDirectory(settings.diffPath) &&
+        !CreateDirectoryW(settings.diffPath.c_str(), NULL))
+    {
+        std::wcerr << L"Failed to create diff directory (" << settings.diffPath << L")." << std::endl;
+        return -1;
+    }
+
+    // Every name in either directory, each once; a single pair is named
+    // after both files.
+    std::vector<std::wstring> names;
+    if (batch)
+    {
+        std::vector<std::wstring> namesA = ListFiles(pathA), namesB = ListFiles(pathB);
+        std::set_union(namesA.begin(), namesA.end(), namesB.begin(), namesB.end(), std::back_inserter(names));
+        if (names.empty())
+        {
+            std::wcerr << L"No files in " << pathA << L" or " << pathB << L"." << std::endl;
+            return -1;
+        }
+        if (verbose)
+            LogInfo() << L"[INFO] Comparing " << names.size() << L" file(s) of " << pathA << L" and " << pathB << L"...\n";
+    }
+    else
+    {
+        names.push_back(pathA + L" and " + pathB);
+    }
+
+    std::vector<std::wstring> reports(names.size());
+    std::vector<CompareOutcome> outcomes(names.size(), CompareOutcome::Error);
+    auto comparePair = [&](int i)
+        {
+            const std::wstring fileA = batch ? pathA + L"\\" + names[i] : pathA;
+            const std::wstring fileB = batch ? pathB + L"\\" + names[i] : pathB;
+            const int threads = batch ? 1 : 0;
+            std::wstring diffPath = settings.diffPath;
+            if (batch && !diffPath.empty())
+            {
+                size_t dot = names[i].find_last_of(L'.');
+                diffPath += L"\\" + names[i].substr(0, dot) + L".png";
+            }
+            const bool inA = GetFileAttributesW(fileA.c_str()) != INVALID_FILE_ATTRIBUTES;
+            const bool inB = GetFileAttributesW(fileB.c_str()) != INVALID_FILE_ATTRIBUTES;
+            if (batch && !(inA && inB))
+            {
+                reports[i] = L"FAIL " + names[i] + L": only in " + (inA ? pathA : pathB) + L"\n";
+                outcomes[i] = CompareOutcome::Fail;
+                return;
+            }
+            // Kept per pool thread, so the buffers are reused across pairs.
+            thread_local LoadedImage imageA, imageB;
+            std::wstring error;
+            if (!LoadImageFile(fileA, imageA, error) || !LoadImageFile(fileB, imageB, error))
+            {
+                reports[i] = error + L"\n";
+                return;
+            }
+            outcomes[i] = CompareViews(imageA.view, imageB.view, names[i], settings, diffPath, threads, reports[i]);
+        };
+    if (batch)
+        SharedThreadPool().ParallelFor(static_cast<int>(names.size()), comparePair);
+    else
+        comparePair(0);
+
+    int passed = 0, failed = 0, errors = 0;
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        if (outcomes[i] == CompareOutcome::Error)
+        {
+            errors++;
+            std::wcerr << reports[i];
+        }
+        else
+        {
+            (outcomes[i] == CompareOutcome::Pass ? passed : failed)++;
+            if (outcomes[i] == CompareOutcome::Fail || verbose || !batch)
+                LogReport(reports[i]);
+        }
+    }
+    if (batch)
+    {
+        LogResult() << names.size() << L" pair(s) compared: " << passed << L" passed, " << failed << L" failed"
+            << (errors ? L", " + std::to_wstring(errors) + L" error(s)" : std::wstring()) << L"\n";
+    }
+    return errors ? -1 : failed ? 1 : 0;
+}
+
+//---------------------------------------------------------------------
+// One -serve client on an overlapped pipe instance. Synchronous I/O on
+// one handle is serialized by Windows, so a reply could not be written
+// while the reader waits for the next request; overlapped I/O allows both.
+// Setting stopEvent aborts a waiting read, never a write.
+class PipeConnection : public ServiceConnection
+{
+public:
+    PipeConnection(HANDLE pipe, HANDLE stopEvent)
+        : pipe_(pipe), stopEvent_(stopEvent)
+    {
+        readEvent_ = CreateEventW(NULL, TRUE, FALSE, NULL);
+        writeEvent_ = CreateEventW(NULL, TRUE, FALSE, NULL);
+    }
+
+    ~PipeConnection()
+    {
+        // Closing without DisconnectNamedPipe lets the client still read
+        // the last replies.
+        CloseHandle(pipe_);
+        CloseHandle(readEvent_);
+        CloseHandle(writeEvent_);
+    }
+
+    bool ReadLine(std::string& line) override
+    {
+        for (;;)
+        {
+            if (lines_.NextLine(line))
+                return true;
+            if (lines_.Overflowed())
+                return false;
+            char chunk[4096];
+            DWORD got = 0;
+            if (!Transfer(false, chunk, sizeof(chunk), got) || got == 0)
+                return false;
+            lines_.Append(chunk, got);
+        }
+    }
+
+    bool WriteLine(const std::string& line) override
+    {
+        const char* data = line.data();
+        size_t size = line.size();
+        while (size > 0)
+        {
+            DWORD chunk = static_cast<DWORD>((std::min)(size, static_cast<size_t>(1) << 20));
+            DWORD written = 0;
+            if (!Transfer(true, const_cast<char*>(data), chunk, written) || written == 0)
+                return false;
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
+
+private:
+    bool Transfer(bool write, char* data, DWORD size, DWORD& done)
+    {
+        OVERLAPPED ov;
+        ZeroMemory(&ov, sizeof(ov));
+        ov.hEvent = write ? writeEvent_ : readEvent_;
+        BOOL ok = write ? WriteFile(pipe_, data, size, NULL, &ov) : ReadFile(pipe_, data, size, NULL, &ov);
+        if (!ok && GetLastError() != ERROR_IO_PENDING)
+            return false;
+        if (!write)
+        {
+            HANDLE events[2] = { ov.hEvent, stopEvent_ };
+            if (WaitForMultipleObjects(2, events, FALSE, INFINITE) != WAIT_OBJECT_0)
+                CancelIoEx(pipe_, &ov);
+        }
+        return GetOverlappedResult(pipe_, &ov, &done, TRUE) != FALSE;
+    }
+
+    HANDLE pipe_;
+    HANDLE stopEvent_;
+    HANDLE readEvent_;
+    HANDLE writeEvent_;
+    ServiceLineBuffer lines_;
+};
+
+//---------------------------------------------------------------------
+// Capture side of -serve. A capture session stays open for every distinct
+// target, so repeated requests skip the DC, bitmap and monitor setup; each
+// is locked only for its grab, and encoding runs on the worker threads in
+// parallel.
+class ServiceCapture
+{
+public:
+    ServiceCapture(CompressionLevel level, PaletteMode palette, bool verbose)
+        : level_(level), palette_(palette), verbose_(verbose)
+    {
+        ZeroMemory(&bmpClsid_, sizeof(bmpClsid_));
+        haveBmp_ = GetEncoderClsid(L"image/bmp", &bmpClsid_) >= 0;
+    }
+
+    void Handle(const ServiceRequest& request, ServiceReply& reply)
+    {
+        // Frames keep their DIB section between requests of a worker.
+        thread_local Frame frame;
+        if (!Grab(request, frame))
+        {
+            reply.error = "capture failed";
+            return;
+        }
+        std::vector<uint8_t> encoded;
+        if (!Encode(request, frame.View(), encoded))
+        {
+            reply.error = "encoding failed";
+            return;
+        }
+        reply.format = request.format;
+        reply.width = frame.Width();
+        reply.height = frame.Height();
+        reply.bytes = encoded.size();
+        if (request.path.empty())
+        {
+            reply.data = std::move(encoded);
+        }
+        else if (WriteBufferToFile(Utf8ToWide(request.path), encoded))
+        {
+            reply.path = request.path;
+        }
+        else
+        {
+            reply.error = "failed to write " + request.path;
+            return;
+        }
+        reply.ok = true;
+        if (verbose_)
+        {
+            LogInfo() << L"[INFO] Request " << Utf8ToWide(request.id) << L": " << frame.Width() << L"x"
+                << frame.Height() << L" " << Utf8ToWide(request.format) << L", " << reply.bytes << L" bytes.\n";
+        }
+    }
+
+private:
+    static const size_t kMaxWarmTargets = 32;
+
+    struct WarmTarget
+    {
+        std::mutex mutex;               // Held for the grab only.
+        std::unique_ptr<CaptureSession> session;
+        std::unique_ptr<GdiMonitorSource> monitors;
+        std::unique_ptr<DesktopCapture> desktop;
+    };
+
+    void Prepare(const ServiceRequest& request, WarmTarget& warm)
+    {
+        if (request.target == "all")
+        {
+            warm.monitors.reset(new GdiMonitorSource(request.pointer, verbose_));
+            warm.desktop.reset(new DesktopCapture(*warm.monitors, DesktopCaptureOptions()));
+            return;
+        }
+        CaptureTarget target;
+        target.drawPointer = request.pointer;
+        if (request.target == "monitor")
+        {
+            target.kind = CaptureTargetKind::Monitor;
+            target.monitorIndex = request.monitor;
+        }
+        else if (request.target == "region")
+        {
+            target.kind = CaptureTargetKind::Region;
+            target.region.left = request.region[0];
+            target.region.top = request.region[1];
+            target.region.right = request.region[0] + request.region[2];
+            target.region.bottom = request.region[1] + request.region[3];
+        }
+        else if (request.target == "window")
+        {
+            target.kind = CaptureTargetKind::Window;
+            target.windowTitle = Utf8ToWide(request.window);
+        }
+        else if (request.target == "active")
+        {
+            target.kind = CaptureTargetKind::ActiveWindow;
+        }
+        warm.session.reset(new CaptureSession(target, verbose_));
+    }
+
+    bool Grab(const ServiceRequest& request, Frame& frame)
+    {
+        std::ostringstream key;
+        key << request.target << '|' << request.monitor << '|' << request.region[0] << ',' << request.region[1] << ','
+            << request.region[2] << ',' << request.region[3] << '|' << request.pointer << '|' << request.window;
+        WarmTarget* warm = nullptr;
+        std::unique_ptr<WarmTarget> oneOff;
+        {
+            std::lock_guard<std::mutex> lock(targetsMutex_);
+            auto found = targets_.find(key.str());
+            if (found != targets_.end())
+            {
+                warm = found->second.get();
+            }
+            else if (targets_.size() < kMaxWarmTargets)
+            {
+                std::unique_ptr<WarmTarget>& slot = targets_[key.str()];
+                slot.reset(new WarmTarget());
+                Prepare(request, *slot);
+                warm = slot.get();
+            }
+        }
+        if (!warm)
+        {
+            // Too many distinct targets to keep them all open.
+            oneOff.reset(new WarmTarget());
+            Prepare(request, *oneOff);
+            warm = oneOff.get();
+        }
+
+        std::lock_guard<std::mutex> lock(warm->mutex);
+        if (warm->desktop)
+            return warm->desktop->Grab() && warm->desktop->Stitch(frame);
+        return warm->session->Grab(frame);
+    }
+
+    bool Encode(const ServiceRequest& request, const FrameView& frame, std::vector<uint8_t>& encoded)
+    {
+        if (request.format == "png")
+        {
+            thread_local PngEncoder pngEncoder;
+            PngOptions pngOptions;
+            pngOptions.level = level_;
+            pngOptions.palette = palette_;
+            return pngEncoder.Encode(frame, pngOptions, encoded);
+        }
+        if (request.format == "jpg")
+        {
+            thread_local JpegEncoder jpegEncoder;
+            JpegOptions jpegOptions;
+            jpegOptions.quality = request.quality;
+            return jpegEncoder.Encode(frame, jpegOptions, encoded);
+        }
+        if (request.format == "qoi")
+            return EncodeQoi(frame, encoded);
+        if (!haveBmp_)
+            return false;
+        Bitmap bmp(frame.width, frame.height, static_cast<INT>(frame.stride), PixelFormat32bppRGB, frame.data);
+        return SaveImageToBuffer(&bmp, &bmpClsid_, NULL, encoded);
+    }
+
+    CompressionLevel level_;
+    PaletteMode palette_;
+    bool verbose_;
+    CLSID bmpClsid_;
+    bool haveBmp_;
+    std::mutex targetsMutex_;
+    std::map<std::string, std::unique_ptr<WarmTarget>> targets_;
+};
+
+//---------------------------------------------------------------------
+// Helper: Run -serve until a "quit" request or Ctrl+C. Every client gets
+// its own instance of the pipe and a thread that reads its requests; the
+// captures run on the service's worker threads.
+int RunCaptureService(const std::wstring& name, CompressionLevel level, PaletteMode palette, bool verbose)
+{
+    const std::wstring pipePrefix = L"\\\\.\\pipe\\";
+    const std::wstring pipeName = name.compare(0, pipePrefix.size(), pipePrefix) == 0 ? name : pipePrefix + name;
+    HANDLE stopEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    HANDLE connectEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+    if (!stopEvent || !connectEvent)
+    {
+        std::cerr << "Failed to create service events." << std::endl;
+        return -1;
+    }
+
+    struct ClientThread
+    {
+        std::thread thread;
+        std::shared_ptr<std::atomic<bool>> done;
+    };
+    std::vector<ClientThread> clients;
+    int result = 0;
+    {
+        ServiceCapture capture(level, palette, verbose);
+        CaptureService service([&capture](const ServiceRequest& request, ServiceReply& reply)
+            {
+                capture.Handle(request, reply);
+            }, ServiceOptions());
+        SetConsoleCtrlHandler(ServiceCtrlHandler, TRUE);
+
+        bool firstInstance = true;
+        while (!service.Stopping() && !g_stopCapture.load())
+        {
+            HANDLE pipe = CreateNamedPipeW(pipeName.c_str(),
+                PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | (firstInstance ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+                PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                PIPE_UNLIMITED_INSTANCES, 1 << 16, 1 << 16, 0, NULL);
+            if (pipe == INVALID_HANDLE_VALUE)
+            {
+                std::wcerr << L"Failed to create pipe (" << pipeName << L")." << std::endl;
+                result = -1;
+                break;
+            }
+            if (firstInstance)
+                LogResult() << L"Serving capture requests on " << pipeName << L"\n";
+            firstInstance = false;
+
+            // Wait for a client, looking at the stop flags in between.
+            OVERLAPPED ov;
+            ZeroMemory(&ov, sizeof(ov));
+            ResetEvent(connectEvent);
+            ov.hEvent = connectEvent;
+            BOOL connected = ConnectNamedPipe(pipe, &ov);
+            DWORD error = connected ? 0 : GetLastError();
+            if (!connected && error == ERROR_IO_PENDING)
+            {
+                while (WaitForSingleObject(connectEvent, 200) == WAIT_TIMEOUT && !service.Stopping() && !g_stopCapture.load())
+                {
+                }
+                DWORD unused = 0;
+                connected = GetOverlappedResult(pipe, &ov, &unused, FALSE);
+                if (!connected)
+                {
+                    CancelIoEx(pipe, &ov);
+                    GetOverlappedResult(pipe, &ov, &unused, TRUE);
+                }
+            }
+            else if (!connected && error == ERROR_PIPE_CONNECTED)
+            {
+                connected = TRUE;
+            }
+            if (!connected)
+            {
+                CloseHandle(pipe);
+                continue;
+            }
+            if (verbose)
+                LogInfo() << L"[INFO] Client connected.\n";
+
+            std::shared_ptr<ServiceConnection> connection(new PipeConnection(pipe, stopEvent));
+            ClientThread client;
+            client.done = std::make_shared<std::atomic<bool>>(false);
+            std::shared_ptr<std::atomic<bool>> done = client.done;
+            client.thread = std::thread([&service, connection, done]()
+                {
+                    service.Serve(connection);
+                    done->store(true);
+                });
+            clients.push_back(std::move(client));
+
+            // Join the threads of clients that have gone.
+            for (size_t i = 0; i < clients.size();)
+            {
+                if (clients[i].done->load())
+                {
+                    clients[i].thread.join();
+                    clients.erase(clients.begin() + i);
+                }
+                else
+                {
+                    i++;
+                }
+            }
+        }
+
+        // Readers give up; requests already queued are still answered.
+        service.Stop();
+        SetEvent(stopEvent);
+        for (auto& client : clients)
+            client.thread.join();
+        LogResult() << L"Capture service stopped after " << service.RequestsServed() << L" replies.\n";
+    }
+    CloseHandle(connectEvent);
+    CloseHandle(stopEvent);
+    return result;
+}
+
+
+//---------------------------------------------------------------------
+// Print usage instructions.
+void printUsage()
+{
+    std::cout << "Usage: ShotCap.exe [options]\n"
+        << "Options:\n"
+        << "  -f <filename>         Output file name (default: screenshot.<format>)\n"
+        << "  -dir <directory>      Output directory (default: current directory)\n"
+        << "  -d <delay>            Delay in seconds before capturing (default: 0)\n"
+        << "  -r <x,y,w,h>          Capture region (default: full screen); repeat for several\n"
+        << "                        regions, cut from one grab and saved as <name>_rNN\n"
+        << "  -regions <file>       Regions from a file, one \"x,y,w,h [file name]\" per line\n"
+        << "  -select               Interactively select a region with the mouse\n"
+        << "  -format <format>      Image format: png, jpg, bmp, seq, qoi (default: png)\n"
+        << "                        seq (with -repeat) writes one delta-encoded sequence file\n"
+        << "                        qoi is lossless and much faster to write than png\n"
+        << "  -quality <0-100>      JPEG quality (only for -format jpg, default: 90)\n"
+        << "  -chroma <420|444>     JPEG colour resolution: half (420) or full (444) (default: 420)\n"
+        << "  -compress <level>     PNG compression: fast, default, max (default: default)\n"
+        << "  -palette <mode>       Indexed PNG for frames of up to 256 colours: off, auto, or\n"
+        << "                        lossy (also quantizes frames that nearly fit) (default: auto)\n"
+        << "  -w <window_title>     Capture a specific window by its title\n"
+        << "  -active               Capture the active (foreground) window\n"
+        << "  -m <monitor_index>    Capture a specific monitor (0-based index)\n"
+        << "  -all                  Capture every monitor of the virtual desktop as one image;\n"
+        << "                        areas no monitor covers are filled with black\n"
+        << "  -split                With -all: save each monitor as its own file (<name>_monN)\n"
+        << "  -clipboard            Copy captured image to clipboard\n"
+        << "  -show                 Open the captured image after saving\n"
+        << "  -writethrough         Write image files through to the disk, past its write cache\n"
+        << "  -nocache              Write image files without the system file cache\n"
+        << "  -p                    Include the mouse pointer in the screenshot\n"
+        << "  -timestamp            Annotate screenshot with current date/time\n"
+        << "  -text <format>        Annotate with this text instead; strftime %-codes are\n"
+        << "                        replaced (default: \"%Y-%m-%d %H:%M:%S\")\n"
+        << "  -textpos <pos>        Text position: tl, tr, bl, br or x,y (default: br)\n"
+        << "  -textfont <font>      Text font: arial or pixel (built-in 5x7) (default: arial)\n"
+        << "  -scale <factor|WxH>   Resize images before saving, by a factor (0.5) or to a size;\n"
+        << "                        0 for W or H keeps the aspect ratio (1280x0)\n"
+        << "  -thumb <WxH>          Also save a thumbnail that fits WxH as <name>_thumb\n"
+        << "  -bands <rows>         Grab and save in bands of this many rows (0: automatic),\n"
+        << "                        so very large regions need little memory (png, qoi, bmp)\n"
+        << "  -redact <x,y,w,h>     Mask this rectangle of the image before it is saved or\n"
+        << "                        copied; repeat for several. A style may follow after a\n"
+        << "                        space (\"10,10,300,40 blur:8\")\n"
+        << "  -redactfile <file>    Rectangles to mask, one \"x,y,w,h [style]\" per line\n"
+        << "  -redactstyle <style>  Default for -redact: fill[:RRGGBB], pixelate[:<block>] or\n"
+        << "                        blur[:<radius>] (default: fill, black)\n"
+        << "  -repeat <i> <n>       Repeat capture every i seconds for n times\n"
+        << "  -onchange <fraction>  With -repeat: poll every i seconds and only save when at\n"
+        << "                        least this fraction (0-1) of the area changed\n"
+        << "  -maxgap <seconds>     With -onchange: save a frame at least this often\n"
+        << "  -overrun <policy>     With -repeat: what a late frame does to the schedule:\n"
+        << "                        catch-up (grab missed slots back to back), skip (drop\n"
+        << "                        them) or stretch (shift the rest of the run)\n"
+        << "                        (default: catch-up; stretch with -onchange)\n"
+        << "  -timing <file>        With -repeat: write each frame's slot, due time and actual\n"
+        << "                        grab time to a .csv or .json file\n"
+        << "  -flightrec <seconds>  With -repeat: keep only the last <seconds> of frames in a\n"
+        << "                        ring file and save them on Ctrl+Break, a \"dump\" line on\n"
+        << "                        stdin or -flighttrigger; n = 0 records until Ctrl+C or \"quit\"\n"
+        << "  -flightsize <MB>      Frame data kept by -flightrec (default: 256)\n"
+        << "  -flighttrigger <file> Also dump when this file appears (it is then deleted)\n"
+        << "  -flightdump <ring>    Save the frames held in a ring file and exit\n"
+        << "  -extract <seq> <n>    Save frame n (1-based) of a sequence file as PNG and exit\n"
+        << "  -topng <file|pattern> Convert QOI files (wildcards allowed) to PNG and exit\n"
+        << "  -compare <a> <b>      Compare two images (png, qoi, bmp, jpg), or two directories\n"
+        << "                        of them by file name, and exit: 0 if they match, 1 if not\n"
+        << "  -compare-live <ref>   Grab the target and compare it with a reference image\n"
+        << "  -tolerance <0-255>    Channel difference that still counts as equal (default: 0)\n"
+        << "  -maxdiff <n|n%>       Changed pixels a comparison may have and pass (default: 0)\n"
+        << "  -diff <file|dir>      Save a highlighted diff of images that differ (png or qoi);\n"
+        << "                        a directory when comparing directories\n"
+        << "  -o <target>           Stream frames to stdout (-), a named pipe (\\\\.\\pipe\\name)\n"
+        << "                        or one file instead of writing an image per frame\n"
+        << "  -stream <format>      Stream format: mjpeg, raw, y4m (default: mjpeg; implies -o -)\n"
+        << "  -stats <file.json>    Write per-stage timings, frame counts and bytes written\n"
+        << "  -serve <pipe>         Stay resident and take JSON capture requests, one per line,\n"
+        << "                        on \\\\.\\pipe\\<pipe> until a \"quit\" request or Ctrl+C\n"
+        << "  -listmonitors         List available monitors and exit\n"
+        << "  -listwindows          List visible top-level windows and exit\n"
+        << "  -vl                   Enable verbose logging\n"
+        << "  -v, --version         Show current shotcap version\n"
+        << "  -h, --help            Display this help message\n";
+}
+
+//---------------------------------------------------------------------
+// Callback for enumerating top-level windows.
+BOOL CALLBACK EnumWindowsProc(HWND hWnd, LPARAM lParam)
+{
+    if (IsWindowVisible(hWnd))
+    {
+        const int len = 256;
+        wchar_t title[len] = { 0 };
+        GetWindowTextW(hWnd, title, len);
+        if (wcslen(title) > 0)
+        {
+            std::wstringstream* ss = reinterpret_cast<std::wstringstream*>(lParam);
+            *ss << L"Handle: " << hWnd << L" | Title: " << title << std::endl;
+        }
+    }
+    return TRUE;
+}
+
+//---------------------------------------------------------------------
+// Glyphs for the text overlay in the look -timestamp always had: GDI+
+// anti-aliased Arial 20. Each glyph is drawn once into a scratch bitmap
+// and only its coverage is kept; TextOverlay does the rest. No GDI+
+// object outlives a call, since overlays are per-thread and may be
+// destroyed after GdiplusShutdown.
+const int kGlyphCellSize = 128;
+const REAL kGlyphFontSize = 20;
+
+class GdiPlusGlyphSource : public GlyphSource
+{
+public:
+    GdiPlusGlyphSource()
+    {
+        Font font(L"Arial", kGlyphFontSize);
+        Bitmap scratch(kGlyphCellSize, kGlyphCellSize, PixelFormat32bppARGB);
+        Graphics graphics(&scratch);
+        lineHeight_ = (std::min)(kGlyphCellSize, static_cast<int>(std::ceil(font.GetHeight(&graphics))));
+    }
+
+    int LineHeight() const override
+    {
+        return lineHeight_;
+    }
+
+    bool Rasterize(wchar_t ch, std::vector<uint8_t>& coverage, int& width, int& advance) override
+    {
+        Font font(L"Arial", kGlyphFontSize);
+        Bitmap scratch(kGlyphCellSize, kGlyphCellSize, PixelFormat32bppARGB);
+        {
+            Graphics graphics(&scratch);
+            graphics.Clear(Color(0, 0, 0, 0));
+            graphics.SetTextRenderingHint(TextRenderingHintAntiAlias);
+            StringFormat format(StringFormat::GenericTypographic());
+            format.SetFormatFlags(format.GetFormatFlags() | StringFormatFlagsMeasureTrailingSpaces);
+
+            RectF bound;
+            if (graphics.MeasureString(&ch, 1, &font, PointF(0, 0), &format, &bound) != Ok)
+                return false;
+            advance = (std::min)(kGlyphCellSize, static_cast<int>(bound.Width + 0.5f));
+            // Two columns more than the advance keep the anti-aliased right edge.
+            width = (std::min)(kGlyphCellSize, advance + 2);
+            SolidBrush brush(Color(255, 255, 255, 255));
+            graphics.DrawString(&ch, 1, &font, PointF(0, 0), &format, &brush);
+        }
+
+        if (width <= 0)
+        {
+            coverage.clear();
+            return true;
+        }
+        BitmapData data;
+        Rect rect(0, 0, kGlyphCellSize, kGlyphCellSize);
+        if (scratch.LockBits(&rect, ImageLockModeRead, PixelFormat32bppARGB, &data) != Ok)
+            return false;
+        coverage.resize(static_cast<size_t>(width) * lineHeight_);
+        for (int y = 0; y < lineHeight_; y++)
+        {
+            const uint8_t* row = static_cast<const uint8_t*>(data.Scan0) + static_cast<ptrdiff_t>(y) * data.Stride;
+            for (int x = 0; x < width; x++)
+                coverage[static_cast<size_t>(y) * width + x] = row[x * 4 + 3];
+        }
+        scratch.UnlockBits(&data);
+        return true;
+    }
+
+private:
+    int lineHeight_ = 0;
+};
+
+//---------------------------------------------------------------------
+// Whether format only uses conversions wcsftime knows; the CRT aborts on
+// any other.
+bool IsValidTimeFormat(const std::wstring& format)
+{
+    const wchar_t* known = L"aAbBcCdDeFgGhHIjmMnprRStTuUVwWxXyYzZ%";
+    for (size_t i = 0; i < format.size(); i++)
+    {
+        if (format[i] != L'%')
+            continue;
+        if (++i < format.size() && format[i] == L'#')
+            i++;
+        if (i >= format.size() || !wcschr(known, format[i]))
+            return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------
+// Main function.
+int main(int argc, char* argv[])
+{
+    // --- DPI Awareness Setup ---
+    if (!SetProcessDpiAwarenessContext(DPI_AWARENESS_CONTEXT_PER_MONITOR_AWARE_V2))
+        SetProcessDPIAware();
+    // --------------------------------
+
+    // Default parameters.
+    std::wstring outputFile = L"screenshot.png";
+    bool outputFileSpecified = false;
+    std::wstring outputDir = L""; // Current directory if empty.
+    double delaySeconds = 0.0;
+    bool regionSpecified = false;
+    int regionX = 0, regionY = 0, regionW = 0, regionH = 0;
+    std::vector<RegionSpec> regions;    // Every -r, or the -regions manifest.
+    bool regionManifest = false;
+    std::wstring imageFormat = L"png";
+    std::wstring windowTitle = L"";
+    int monitorIndex = -1;
+    bool captureAll = false;
+    bool splitMonitors = false;
+    bool copyToClipboard = false;
+    bool showAfterCapture = false;
+    bool writeThrough = false;
+    bool noFileCache = false;
+    bool capturePointer = false;
+    bool annotateTimestamp = false;
+    std::wstring textFormat = L"%Y-%m-%d %H:%M:%S";
+    TextStyle textStyle;
+    bool pixelFont = false;
+    bool scaling = false;
+    ScaleSpec scaleSpec;
+    bool thumbnails = false;
+    int thumbWidth = 0, thumbHeight = 0;
+    int bandRows = -1;                  // -bands; 0 picks the band size, negative is off.
+    std::vector<std::string> redactSpecs;   // -redact; parsed once -redactstyle is known.
+    std::wstring redactFile = L"";
+    RedactStyle redactStyle;
+    std::vector<RedactRegion> redactions;
+    bool captureActiveWindow = false;
+    bool repeatEnabled = false;
+    double repeatInterval = 0.0;
+    int repeatCount = 0;
+    double changeThreshold = -1.0; // Negative: -onchange not requested.
+    double maxGapSeconds = 0.0;
+    OverrunPolicy overrunPolicy = OverrunPolicy::CatchUp;
+    bool overrunSpecified = false;
+    std::wstring timingPath = L"";
+    int jpegQuality = 90;
+    ChromaSubsampling chromaSubsampling = ChromaSubsampling::Yuv420;
+    CompressionLevel compressionLevel = CompressionLevel::Default;
+    PaletteMode paletteMode = PaletteMode::Auto;
+    bool verbose = false;
+    bool listMonitors = false;
+    bool listWindows = false;
+    bool interactiveSelect = false;
+    std::wstring extractPath = L"";
+    int extractFrame = 0;
+    std::wstring toPngPattern = L"";
+    std::wstring streamTarget = L"";    // -o; empty when writing files.
+    StreamFormat streamFormat = StreamFormat::Mjpeg;
+    bool streamFormatSpecified = false;
+    double flightSeconds = 0.0;         // -flightrec; 0 when not recording.
+    int flightMegabytes = 256;
+    std::wstring flightTrigger = L"";
+    std::wstring flightDumpPath = L"";
+    std::wstring statsPath = L"";
+    std::wstring servePipe = L"";       // -serve; empty when taking one capture.
+    std::wstring compareA = L"", compareB = L"";    // -compare; empty when not comparing.
+    std::wstring compareLive = L"";     // -compare-live: the reference image.
+    CompareSettings compareSettings;
+    bool compareOptionGiven = false;    // -tolerance, -maxdiff or -diff.
+
+    // Parse command-line arguments.
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help")
+        {
+            printUsage();
+            return 0;
+        }
+        else if (arg == "--version" || arg == "-v")
+        {
+            std::wcout << L"ShotCap version 1.3\n";
+            return 0;
+        }
+        else if (arg == "-f" && i + 1 < argc)
+        {
+            int len = MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, NULL, 0);
+            wchar_t* buffer = new wchar_t[len];
+            MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, buffer, len);
+            outputFile = buffer;
+            delete[] buffer;
+            outputFileSpecified = true;
+            i++;
+        }
+        else if (arg == "-dir" && i + 1 < argc)
+        {
+            int len = MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, NULL, 0);
+            wchar_t* buffer = new wchar_t[len];
+            MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, buffer, len);
+            outputDir = buffer;
+            delete[] buffer;
+            i++;
+        }
+        else if (arg == "-d" && i + 1 < argc)
+        {
+            delaySeconds = std::stod(argv[i + 1]);
+            i++;
+        }
+        else if (arg == "-r" && i + 1 < argc)
+        {
+            RegionSpec region;
+            if (!ParseRegion(argv[i + 1], region.rect))
             {
-                regionX = std::stoi(parts[0]);
-                regionY = std::stoi(parts[1]);
-                regionW = std::stoi(parts[2]);
-                regionH = std::stoi(parts[3]);
-                regionSpecified = true;
+                std::cerr << "Invalid region specification. Expected format: x,y,w,h\n";
+                return -1;
             }
-            else
+            regions.push_back(region);
+            i++;
+        }
+        else if (arg == "-regions" && i + 1 < argc)
+        {
+            int len = MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, NULL, 0);
+            wchar_t* buffer = new wchar_t[len];
+            MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, buffer, len);
+            std::wstring manifestPath = buffer;
+            delete[] buffer;
+            std::vector<uint8_t> manifest;
+            std::string error;
+            if (!ReadFileToBuffer(manifestPath, manifest))
             {
-                std::cerr << "Invalid region specification. Expected format: x,y,w,h\n";
+                std::wcerr << L"Failed to read region manifest (" << manifestPath << L")." << std::endl;
+                return -1;
+            }
+            if (!ParseRegionManifest(std::string(manifest.begin(), manifest.end()), regions, error))
+            {
+                std::wcerr << L"Invalid region manifest (" << manifestPath << L"): " << Utf8ToWide(error) << std::endl;
                 return -1;
             }
+            regionManifest = true;
             i++;
         }
         else if (arg == "-select")
@@ -413,7 +1717,7 @@ int main(int argc, char* argv[])
         {
             std::string fmt = argv[i + 1];
             std::transform(fmt.begin(), fmt.end(), fmt.begin(), ::tolower);
-            if (fmt == "png" || fmt == "jpg" || fmt == "bmp")
+            if (fmt == "png" || fmt == "jpg" || fmt == "bmp" || fmt == "seq" || fmt == "qoi")
             {
                 int len = MultiByteToWideChar(CP_UTF8, 0, fmt.c_str(), -1, NULL, 0);
                 wchar_t* buffer = new wchar_t[len];
@@ -423,7 +1727,7 @@ int main(int argc, char* argv[])
             }
             else
             {
-                std::cerr << "Unsupported image format. Supported formats: png, jpg, bmp\n";
+                std::cerr << "Unsupported image format. Supported formats: png, jpg, bmp, seq, qoi\n";
                 return -1;
             }
             i++;
@@ -438,6 +1742,40 @@ int main(int argc, char* argv[])
             }
             i++;
         }
+        else if (arg == "-chroma" && i + 1 < argc)
+        {
+            std::string chroma = argv[i + 1];
+            if (chroma == "420")
+                chromaSubsampling = ChromaSubsampling::Yuv420;
+            else if (chroma == "444")
+                chromaSubsampling = ChromaSubsampling::Yuv444;
+            else
+            {
+                std::cerr << "Chroma must be 420 or 444.\n";
+                return -1;
+            }
+            i++;
+        }
+        else if (arg == "-compress" && i + 1 < argc)
+        {
+            std::string level = argv[i + 1];
+            std::transform(level.begin(), level.end(), level.begin(), ::tolower);
+            if (!ParseCompressionLevel(level, compressionLevel))
+            {
+                std::cerr << "Unsupported compression level. Supported levels: fast, default, max\n";
+                return -1;
+            }
+            i++;
+        }
+        else if (arg == "-palette" && i + 1 < argc)
+        {
+            if (!ParsePaletteMode(argv[i + 1], paletteMode))
+            {
+                std::cerr << "Palette mode must be off, auto or lossy.\n";
+                return -1;
+            }
+            i++;
+        }
         else if (arg == "-w" && i + 1 < argc)
         {
             int len = MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, NULL, 0);
@@ -456,6 +1794,14 @@ int main(int argc, char* argv[])
             monitorIndex = std::atoi(argv[i + 1]);
             i++;
         }
+        else if (arg == "-all")
+        {
+            captureAll = true;
+        }
+        else if (arg == "-split")
+        {
+            splitMonitors = true;
+        }
         else if (arg == "-clipboard")
         {
             copyToClipboard = true;
@@ -464,6 +1810,14 @@ int main(int argc, char* argv[])
         {
             showAfterCapture = true;
         }
+        else if (arg == "-writethrough")
+        {
+            writeThrough = true;
+        }
+        else if (arg == "-nocache")
+        {
+            noFileCache = true;
+        }
         else if (arg == "-p")
         {
             capturePointer = true;
@@ -472,6 +1826,101 @@ int main(int argc, char* argv[])
         {
             annotateTimestamp = true;
         }
+        else if (arg == "-text" && i + 1 < argc)
+        {
+            int len = MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, NULL, 0);
+            wchar_t* buffer = new wchar_t[len];
+            MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, buffer, len);
+            textFormat = buffer;
+            delete[] buffer;
+            if (!IsValidTimeFormat(textFormat))
+            {
+                std::cerr << "Unsupported %-conversion in -text.\n";
+                return -1;
+            }
+            annotateTimestamp = true;
+            i++;
+        }
+        else if (arg == "-textpos" && i + 1 < argc)
+        {
+            if (!ParseTextAnchor(argv[i + 1], textStyle))
+            {
+                std::cerr << "Text position must be tl, tr, bl, br or x,y.\n";
+                return -1;
+            }
+            i++;
+        }
+        else if (arg == "-textfont" && i + 1 < argc)
+        {
+            std::string font = argv[i + 1];
+            if (font == "arial")
+                pixelFont = false;
+            else if (font == "pixel")
+                pixelFont = true;
+            else
+            {
+                std::cerr << "Text font must be arial or pixel.\n";
+                return -1;
+            }
+            i++;
+        }
+        else if (arg == "-scale" && i + 1 < argc)
+        {
+            if (!ParseScaleSpec(argv[i + 1], scaleSpec))
+            {
+                std::cerr << "-scale takes a factor (such as 0.5) or a size WxH.\n";
+                return -1;
+            }
+            scaling = true;
+            i++;
+        }
+        else if (arg == "-thumb" && i + 1 < argc)
+        {
+            ScaleSpec box;
+            if (!ParseScaleSpec(argv[i + 1], box) || box.factor > 0.0)
+            {
+                std::cerr << "-thumb takes a size WxH.\n";
+                return -1;
+            }
+            thumbnails = true;
+            thumbWidth = box.width;
+            thumbHeight = box.height;
+            i++;
+        }
+        else if (arg == "-bands" && i + 1 < argc)
+        {
+            bandRows = std::atoi(argv[i + 1]);
+            if (bandRows < 0)
+            {
+                std::cerr << "Band height must be 0 (automatic) or a number of rows.\n";
+                return -1;
+            }
+            i++;
+        }
+        else if (arg == "-redact" && i + 1 < argc)
+        {
+            redactSpecs.push_back(argv[i + 1]);
+            i++;
+        }
+        else if (arg == "-redactfile" && i + 1 < argc)
+        {
+            int len = MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, NULL, 0);
+            wchar_t* buffer = new wchar_t[len];
+            MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, buffer, len);
+            redactFile = buffer;
+            delete[] buffer;
+            i++;
+        }
+        else if (arg == "-redactstyle" && i + 1 < argc)
+        {
+            if (!ParseRedactStyle(argv[i + 1], redactStyle))
+            {
+                std::cerr << "Redaction style must be fill[:RRGGBB], pixelate[:<block>] or blur[:<radius>], "
+                    "with a block or radius of 1-" << kMaxRedactSize << ".\n";
+                return -1;
+            }
+            i++;
+        }
         else if (arg == "-repeat" && i + 2 < argc)
         {
             repeatInterval = std::stod(argv[i + 1]);
@@ -479,6 +1928,183 @@ int main(int argc, char* argv[])
             repeatEnabled = true;
             i += 2;
         }
+        else if (arg == "-onchange" && i + 1 < argc)
+        {
+            changeThreshold = std::stod(argv[i + 1]);
+            if (changeThreshold < 0.0 || changeThreshold > 1.0)
+            {
+                std::cerr << "Change threshold must be between 0 and 1.\n";
+                return -1;
+            }
+            i++;
+        }
+        else if (arg == "-maxgap" && i + 1 < argc)
+        {
+            maxGapSeconds = std::stod(argv[i + 1]);
+            i++;
+        }
+        else if (arg == "-overrun" && i + 1 < argc)
+        {
+            std::string name = argv[i + 1];
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            if (!ParseOverrunPolicy(name, overrunPolicy))
+            {
+                std::cerr << "Unsupported overrun policy. Supported policies: catch-up, skip, stretch\n";
+                return -1;
+            }
+            overrunSpecified = true;
+            i++;
+        }
+        else if (arg == "-timing" && i + 1 < argc)
+        {
+            int len = MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, NULL, 0);
+            wchar_t* buffer = new wchar_t[len];
+            MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, buffer, len);
+            timingPath = buffer;
+            delete[] buffer;
+            i++;
+        }
+        else if (arg == "-extract" && i + 2 < argc)
+        {
+            int len = MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, NULL, 0);
+            wchar_t* buffer = new wchar_t[len];
+            MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, buffer, len);
+            extractPath = buffer;
+            delete[] buffer;
+            extractFrame = std::atoi(argv[i + 2]);
+            i += 2;
+        }
+        else if (arg == "-o" && i + 1 < argc)
+        {
+            int len = MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, NULL, 0);
+            wchar_t* buffer = new wchar_t[len];
+            MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, buffer, len);
+            streamTarget = buffer;
+            delete[] buffer;
+            i++;
+        }
+        else if (arg == "-stream" && i + 1 < argc)
+        {
+            std::string name = argv[i + 1];
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            if (!ParseStreamFormat(name.c_str(), streamFormat))
+            {
+                std::cerr << "Unsupported stream format. Supported formats: mjpeg, raw, y4m\n";
+                return -1;
+            }
+            streamFormatSpecified = true;
+            i++;
+        }
+        else if (arg == "-flightrec" && i + 1 < argc)
+        {
+            flightSeconds = std::stod(argv[i + 1]);
+            if (flightSeconds <= 0.0)
+            {
+                std::cerr << "Flight recorder window must be greater than 0 seconds.\n";
+                return -1;
+            }
+            i++;
+        }
+        else if (arg == "-flightsize" && i + 1 < argc)
+        {
+            flightMegabytes = std::atoi(argv[i + 1]);
+            if (flightMegabytes < 1)
+            {
+                std::cerr << "Flight recorder size must be at least 1 MB.\n";
+                return -1;
+            }
+            i++;
+        }
+        else if (arg == "-flighttrigger" && i + 1 < argc)
+        {
+            int len = MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, NULL, 0);
+            wchar_t* buffer = new wchar_t[len];
+            MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, buffer, len);
+            flightTrigger = buffer;
+            delete[] buffer;
+            i++;
+        }
+        else if (arg == "-flightdump" && i + 1 < argc)
+        {
+            int len = MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, NULL, 0);
+            wchar_t* buffer = new wchar_t[len];
+            MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, buffer, len);
+            flightDumpPath = buffer;
+            delete[] buffer;
+            i++;
+        }
+        else if (arg == "-topng" && i + 1 < argc)
+        {
+            int len = MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, NULL, 0);
+            wchar_t* buffer = new wchar_t[len];
+            MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, buffer, len);
+            toPngPattern = buffer;
+            delete[] buffer;
+            i++;
+        }
+        else if (arg == "-compare" && i + 2 < argc)
+        {
+            compareA = Utf8ToWide(argv[i + 1]);
+            compareB = Utf8ToWide(argv[i + 2]);
+            i += 2;
+        }
+        else if (arg == "-compare-live" && i + 1 < argc)
+        {
+            compareLive = Utf8ToWide(argv[i + 1]);
+            i++;
+        }
+        else if (arg == "-tolerance" && i + 1 < argc)
+        {
+            compareSettings.tolerance = std::atoi(argv[i + 1]);
+            if (compareSettings.tolerance < 0 || compareSettings.tolerance > 255)
+            {
+                std::cerr << "Tolerance must be between 0 and 255.\n";
+                return -1;
+            }
+            compareOptionGiven = true;
+            i++;
+        }
+        else if (arg == "-maxdiff" && i + 1 < argc)
+        {
+            std::string value = argv[i + 1];
+            compareSettings.maxDiffPercent = !value.empty() && value.back() == '%';
+            if (compareSettings.maxDiffPercent)
+                value.pop_back();
+            char* end = nullptr;
+            compareSettings.maxDiff = std::strtod(value.c_str(), &end);
+            if (value.empty() || *end != '\0' || compareSettings.maxDiff < 0.0 ||
+                (compareSettings.maxDiffPercent && compareSettings.maxDiff > 100.0))
+            {
+                std::cerr << "-maxdiff takes a number of pixels or a percentage (0.5%).\n";
+                return -1;
+            }
+            compareOptionGiven = true;
+            i++;
+        }
+        else if (arg == "-diff" && i + 1 < argc)
+        {
+            compareSettings.diffPath = Utf8ToWide(argv[i + 1]);
+            compareOptionGiven = true;
+            i++;
+        }
+        else if (arg == "-stats" && i + 1 < argc)
+        {
+            int len = MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, NULL, 0);
+            wchar_t* buffer = new wchar_t[len];
+            MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, buffer, len);
+            statsPath = buffer;
+            delete[] buffer;
+            i++;
+        }
+        else if (arg == "-serve" && i + 1 < argc)
+        {
+            int len = MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, NULL, 0);
+            wchar_t* buffer = new wchar_t[len];
+            MultiByteToWideChar(CP_UTF8, 0, argv[i + 1], -1, buffer, len);
+            servePipe = buffer;
+            delete[] buffer;
+            i++;
+        }
         else if (arg == "-listmonitors")
         {
             listMonitors = true;
@@ -499,6 +2125,265 @@ int main(int argc, char* argv[])
         }
     }
 
+    // One plain -r is a single region; more (or a manifest) grab their
+    // bounding box once and save every region from it.
+    const bool fanOut = regions.size() > 1 || regionManifest;
+    if (regions.size() == 1 && !regionManifest)
+    {
+        regionX = regions[0].rect.left;
+        regionY = regions[0].rect.top;
+        regionW = regions[0].rect.Width();
+        regionH = regions[0].rect.Height();
+        regionSpecified = true;
+    }
+    if (fanOut && (repeatEnabled || !streamTarget.empty() || streamFormatSpecified || interactiveSelect))
+    {
+        std::cerr << "Multiple regions cannot be combined with -repeat, -o, -stream or -select.\n";
+        return -1;
+    }
+    if (fanOut)
+    {
+        std::vector<DesktopRect> rects;
+        for (const RegionSpec& region : regions)
+            rects.push_back(region.rect);
+        const DesktopRect bounds = DesktopBounds(rects);
+        regionX = bounds.left;
+        regionY = bounds.top;
+        regionW = bounds.Width();
+        regionH = bounds.Height();
+        regionSpecified = true;
+    }
+
+    if (captureAll && (captureActiveWindow || !windowTitle.empty() || monitorIndex != -1 || regionSpecified ||
+        interactiveSelect))
+    {
+        std::cerr << "-all cannot be combined with -w, -active, -m, -r or -select.\n";
+        return -1;
+    }
+    if (splitMonitors && !captureAll)
+    {
+        std::cerr << "-split requires -all.\n";
+        return -1;
+    }
+    if (splitMonitors && (repeatEnabled || !streamTarget.empty() || streamFormatSpecified))
+    {
+        std::cerr << "-split cannot be combined with -repeat, -o or -stream.\n";
+        return -1;
+    }
+
+    // -bands never holds the whole image, so nothing that needs all of it
+    // at once (a window's PrintWindow, stitching, the clipboard, scaling,
+    // text placed relative to the full frame) can take part.
+    if (bandRows >= 0 && imageFormat != L"png" && imageFormat != L"qoi" && imageFormat != L"bmp")
+    {
+        std::cerr << "-bands supports -format png, qoi and bmp.\n";
+        return -1;
+    }
+    if (bandRows >= 0 && (repeatEnabled || !streamTarget.empty() || streamFormatSpecified || captureAll || fanOut ||
+        captureActiveWindow || !windowTitle.empty() || copyToClipboard || scaling || thumbnails || annotateTimestamp))
+    {
+        std::cerr << "-bands cannot be combined with -repeat, -o, -stream, -all, several -r, -active, -w, -clipboard, "
+            "-scale, -thumb, -timestamp or -text.\n";
+        return -1;
+    }
+
+    // -redact rectangles are in pixels of the saved image. A fan-out of
+    // several regions saves several images, and -serve takes its own
+    // requests, so neither has one image for them to refer to.
+    for (const std::string& spec : redactSpecs)
+    {
+        std::string error;
+        if (!ParseRedactManifest(spec, redactStyle, redactions, error))
+        {
+            std::cerr << "Invalid -redact \"" << spec << "\". Expected x,y,w,h and optionally a style.\n";
+            return -1;
+        }
+    }
+    if (!redactFile.empty())
+    {
+        std::vector<uint8_t> manifest;
+        std::string error;
+        if (!ReadFileToBuffer(redactFile, manifest))
+        {
+            std::wcerr << L"Failed to read redaction file (" << redactFile << L")." << std::endl;
+            return -1;
+        }
+        if (!ParseRedactManifest(std::string(manifest.begin(), manifest.end()), redactStyle, redactions, error))
+        {
+            std::wcerr << L"Invalid redaction file (" << redactFile << L"): " << Utf8ToWide(error) << std::endl;
+            return -1;
+        }
+    }
+    if (!redactions.empty() && (fanOut || !servePipe.empty()))
+    {
+        std::cerr << "-redact cannot be combined with several -r, -regions or -serve.\n";
+        return -1;
+    }
+
+    // -compare-live compares one grab, whole, with one reference image.
+    if (!compareA.empty() && !compareLive.empty())
+    {
+        std::cerr << "-compare and -compare-live cannot be combined.\n";
+        return -1;
+    }
+    if (compareOptionGiven && compareA.empty() && compareLive.empty())
+    {
+        std::cerr << "-tolerance, -maxdiff and -diff require -compare or -compare-live.\n";
+        return -1;
+    }
+    if (!compareLive.empty() && (repeatEnabled || !streamTarget.empty() || streamFormatSpecified || bandRows >= 0 ||
+        splitMonitors || fanOut || flightSeconds > 0.0 || !servePipe.empty()))
+    {
+        std::cerr << "-compare-live cannot be combined with -repeat, -o, -stream, -bands, -split, several -r, "
+            "-flightrec or -serve.\n";
+        return -1;
+    }
+
+    const bool flightRecording = flightSeconds > 0.0;
+    if (flightRecording && (!repeatEnabled || repeatInterval <= 0.0))
+    {
+        std::cerr << "-flightrec requires -repeat <i> <n> with an interval above 0 (n = 0: until stopped).\n";
+        return -1;
+    }
+    if (flightRecording && (imageFormat == L"seq" || !streamTarget.empty() || streamFormatSpecified))
+    {
+        std::cerr << "-flightrec cannot be combined with -format seq, -o or -stream.\n";
+        return -1;
+    }
+
+    if ((scaling || thumbnails) && (imageFormat == L"seq" || !streamTarget.empty() || streamFormatSpecified))
+    {
+        std::cerr << "-scale and -thumb cannot be combined with -format seq, -o or -stream.\n";
+        return -1;
+    }
+    if (thumbnails && flightRecording)
+    {
+        std::cerr << "-thumb cannot be combined with -flightrec.\n";
+        return -1;
+    }
+
+    if (changeThreshold >= 0.0 && !repeatEnabled)
+    {
+        std::cerr << "-onchange requires -repeat <i> <n>.\n";
+        return -1;
+    }
+    if ((overrunSpecified || !timingPath.empty()) && !repeatEnabled)
+    {
+        std::cerr << "-overrun and -timing require -repeat <i> <n>.\n";
+        return -1;
+    }
+    // Change polls have always let a slow frame push the next poll back
+    // rather than bursting, so that stays their default.
+    if (!overrunSpecified && changeThreshold >= 0.0)
+        overrunPolicy = OverrunPolicy::Stretch;
+    TimingLogFormat timingFormat = TimingLogFormat::Csv;
+    if (!timingPath.empty())
+    {
+        std::wstring extension;
+        size_t dot = timingPath.find_last_of(L'.');
+        if (dot != std::wstring::npos)
+            extension = timingPath.substr(dot);
+        std::transform(extension.begin(), extension.end(), extension.begin(), ::towlower);
+        if (extension == L".json")
+            timingFormat = TimingLogFormat::Json;
+        else if (extension != L".csv")
+        {
+            std::cerr << "-timing needs a .csv or .json file name.\n";
+            return -1;
+        }
+    }
+
+    // -o / -stream: frames go into one stream instead of separate files.
+    if (streamFormatSpecified && streamTarget.empty())
+        streamTarget = L"-";
+    const bool streaming = !streamTarget.empty();
+    if (streaming && imageFormat == L"seq")
+    {
+        std::cerr << "-format seq cannot be combined with -o or -stream.\n";
+        return -1;
+    }
+    // Keep stdout clean for the frames.
+    if (streamTarget == L"-")
+        SetLogToStderr();
+
+    if (imageFormat == L"seq" && !repeatEnabled)
+    {
+        std::cerr << "-format seq requires -repeat <i> <n>.\n";
+        return -1;
+    }
+
+    // Extract a frame from a sequence file if requested.
+    if (!extractPath.empty())
+    {
+        std::wstring pngPath = outputFile;
+        if (!outputFileSpecified)
+        {
+            // Default: next to the sequence file, named like a -repeat frame.
+            size_t dot = extractPath.find_last_of(L'.');
+            size_t slash = extractPath.find_last_of(L"\\/");
+            std::wstring base = (dot != std::wstring::npos && (slash == std::wstring::npos || dot > slash))
+                ? extractPath.substr(0, dot) : extractPath;
+            std::wstringstream ss;
+            ss << base << L"_" << std::setfill(L'0') << std::setw(3) << extractFrame << L".png";
+            pngPath = ss.str();
+        }
+        else if (!outputDir.empty())
+        {
+            pngPath = outputDir + L"\\" + outputFile;
+        }
+        return ExtractSeqFrame(extractPath, extractFrame, pngPath, compressionLevel, paletteMode, verbose) ? 0 : -1;
+    }
+
+    // Save the frames held in a flight recorder ring file (e.g. left by a crashed run).
+    if (!flightDumpPath.empty())
+    {
+        std::vector<uint8_t> ringBytes;
+        FlightRing ring;
+        if (!ReadFileToBuffer(flightDumpPath, ringBytes) || !ring.Open(ringBytes.data(), ringBytes.size()))
+        {
+            std::wcerr << L"Not a valid flight recorder file (" << flightDumpPath << L")." << std::endl;
+            return -1;
+        }
+        std::vector<FlightFrame> frames;
+        ring.Snapshot(frames);
+        size_t dot = flightDumpPath.find_last_of(L'.');
+        size_t slash = flightDumpPath.find_last_of(L"\\/");
+        size_t nameStart = slash == std::wstring::npos ? 0 : slash + 1;
+        std::wstring base = (dot != std::wstring::npos && dot > nameStart) ? flightDumpPath.substr(0, dot) : flightDumpPath;
+        std::wstring prefix = outputDir.empty() ? base : outputDir + L"\\" + base.substr(nameStart);
+        std::string format = ring.Format();
+        int saved = SaveFlightFrames(frames, prefix, std::wstring(format.begin(), format.end()));
+        std::wcout << saved << L" of " << frames.size() << L" frames saved as " << prefix << L"_NNN."
+            << std::wstring(format.begin(), format.end()) << std::endl;
+        return saved == static_cast<int>(frames.size()) ? 0 : -1;
+    }
+
+    // Convert QOI captures to PNG if requested.
+    if (!toPngPattern.empty())
+        return ConvertQoiToPng(toPngPattern, outputDir, compressionLevel, paletteMode, verbose) == 0 ? 0 : -1;
+
+    // -compare: diff two images, or two directories of them, and exit with
+    // 0 when they match, 1 when they differ. GDI+ reads formats other than
+    // PNG and QOI.
+    if (!compareA.empty())
+    {
+        GdiplusStartupInput gdiplusStartupInput;
+        ULONG_PTR gdiplusToken;
+        if (GdiplusStartup(&gdiplusToken, &gdiplusStartupInput, NULL) != Ok)
+        {
+            std::cerr << "Failed to initialize GDI+." << std::endl;
+            return -1;
+        }
+        int compared = RunCompare(compareA, compareB, compareSettings, verbose);
+        GdiplusShutdown(gdiplusToken);
+        FlushLog();
+        return compared;
+    }
+
+    // Single shots are named after their format unless -f was given.
+    if (!outputFileSpecified)
+        outputFile = L"screenshot." + imageFormat;
+
     // List monitors if requested.
     if (listMonitors)
     {
@@ -533,7 +2418,7 @@ int main(int argc, char* argv[])
     if (interactiveSelect)
     {
         if (verbose)
-            std::wcout << L"[INFO] Entering interactive selection mode...\n";
+            LogInfo() << L"[INFO] Entering interactive selection mode...\n";
         HINSTANCE hInstance = GetModuleHandle(NULL);
         RECT selRect = GetSelectionRect(hInstance);
         regionX = selRect.left;
@@ -543,324 +2428,842 @@ int main(int argc, char* argv[])
         regionSpecified = true;
         if (verbose)
         {
-            std::wcout << L"[INFO] Selected region: ("
-                << regionX << L"," << regionY << L","
-                << regionW << L"," << regionH << L")\n";
-        }
-    }
+            LogInfo() << L"[INFO] Selected region: ("
+                << regionX << L"," << regionY << L","
+                << regionW << L"," << regionH << L")\n";
+        }
+    }
+
+    if (verbose)
+        LogInfo() << L"[INFO] Starting ShotCap...\n";
+
+    if (delaySeconds > 0)
+    {
+        if (verbose)
+            LogInfo() << L"[INFO] Waiting for " << delaySeconds << L" seconds before capturing...\n";
+        Sleep(static_cast<DWORD>(delaySeconds * 1000));
+    }
+
+    // Initialize GDI+.
+    GdiplusStartupInput gdiplusStartupInput;
+    ULONG_PTR gdiplusToken;
+    if (GdiplusStartup(&gdiplusToken, &gdiplusStartupInput, NULL) != Ok)
+    {
+        std::cerr << "Failed to initialize GDI+." << std::endl;
+        return -1;
+    }
+
+    // -serve: stay resident and take capture requests until told to quit.
+    if (!servePipe.empty())
+    {
+        int served = RunCaptureService(servePipe, compressionLevel, paletteMode, verbose);
+        GdiplusShutdown(gdiplusToken);
+        FlushLog();
+        return served;
+    }
+
+    // Resolve the capture target once; the session keeps DCs, bitmaps and
+    // encoder lookups alive across -repeat frames.
+    CaptureTarget captureTarget;
+    if (captureActiveWindow)
+    {
+        captureTarget.kind = CaptureTargetKind::ActiveWindow;
+    }
+    else if (!windowTitle.empty())
+    {
+        captureTarget.kind = CaptureTargetKind::Window;
+        captureTarget.windowTitle = windowTitle;
+    }
+    else if (monitorIndex != -1)
+    {
+        captureTarget.kind = CaptureTargetKind::Monitor;
+        captureTarget.monitorIndex = monitorIndex;
+    }
+    else if (regionSpecified)
+    {
+        captureTarget.kind = CaptureTargetKind::Region;
+        captureTarget.region.left = regionX;
+        captureTarget.region.top = regionY;
+        captureTarget.region.right = regionX + regionW;
+        captureTarget.region.bottom = regionY + regionH;
+    }
+    captureTarget.drawPointer = capturePointer;
+    CaptureSession session(captureTarget, verbose);
+
+    // -stats: every stage reports into one collector; null keeps timing off.
+    CaptureStats captureStats;
+    CaptureStats* stats = statsPath.empty() ? nullptr : &captureStats;
+    session.SetStats(stats);
+
+    // -all: one session per monitor, grabbed in parallel and stitched into
+    // one frame (or, with -split, saved one by one).
+    GdiMonitorSource monitorSource(capturePointer, verbose);
+    monitorSource.SetStats(stats);
+    DesktopCapture desktopCapture(monitorSource, DesktopCaptureOptions());
+
+    // Multiple regions: where each one goes. Manifest names pick their
+    // format by extension; the others are numbered after the output file.
+    std::vector<std::wstring> regionFiles;
+    std::vector<std::wstring> regionFormats;
+    bool needBmpEncoder = imageFormat == L"bmp" && !streaming;
+    if (fanOut)
+    {
+        size_t dot = outputFile.find_last_of(L'.');
+        std::wstring base = dot == std::wstring::npos ? outputFile : outputFile.substr(0, dot);
+        std::wstring extension = dot == std::wstring::npos ? L"." + imageFormat : outputFile.substr(dot);
+        for (size_t i = 0; i < regions.size(); i++)
+        {
+            std::wstring name = Utf8ToWide(regions[i].fileName);
+            std::wstring format = imageFormat;
+            if (name.empty())
+            {
+                std::wstringstream ss;
+                ss << base << L"_r" << std::setfill(L'0') << std::setw(2) << (i + 1) << extension;
+                name = ss.str();
+            }
+            else
+            {
+                format = FormatFromFileName(name, imageFormat);
+            }
+            bool absolute = name.find(L':') != std::wstring::npos || name[0] == L'\\' || name[0] == L'/';
+            regionFiles.push_back(outputDir.empty() || absolute ? name : outputDir + L"\\" + name);
+            regionFormats.push_back(format);
+            if (format == L"bmp")
+                needBmpEncoder = true;
+        }
+    }
+    if (needBmpEncoder && !session.PrepareEncoder(L"bmp"))
+    {
+        GdiplusShutdown(gdiplusToken);
+        return -1;
+    }
+
+    // -o: open the stream before the first grab; a new pipe waits here for its reader.
+    HANDLE streamHandle = INVALID_HANDLE_VALUE;
+    if (streaming && !OpenStreamOutput(streamTarget, verbose, streamHandle))
+    {
+        GdiplusShutdown(gdiplusToken);
+        return -1;
+    }
+
+    // -flightrec: lay the ring out in a mapped file once; recording then
+    // only copies encoded frames into it.
+    FlightRing flightRing;
+    std::mutex flightMutex;             // Ring access: writer appends, dumps snapshot.
+    HANDLE flightFile = INVALID_HANDLE_VALUE, flightMapping = NULL;
+    uint8_t* flightView = NULL;
+    std::wstring flightPrefix = outputFile.substr(0, outputFile.find_last_of(L'.'));
+    if (!outputDir.empty())
+        flightPrefix = outputDir + L"\\" + flightPrefix;
+    if (flightRecording)
+    {
+        const int slots = static_cast<int>(std::ceil(flightSeconds / repeatInterval)) + 1;
+        const size_t ringSize = FlightRing::BytesFor(slots, static_cast<uint64_t>(flightMegabytes) << 20);
+        const std::wstring ringPath = flightPrefix + L".ring";
+        std::string format(imageFormat.begin(), imageFormat.end());
+        flightView = MapNewFile(ringPath, ringSize, flightFile, flightMapping);
+        if (!flightView || !flightRing.Create(flightView, ringSize, slots, format.c_str()))
+        {
+            std::wcerr << L"Failed to create flight recorder file (" << ringPath << L")." << std::endl;
+            GdiplusShutdown(gdiplusToken);
+            return -1;
+        }
+        SetConsoleCtrlHandler(FlightRecorderCtrlHandler, TRUE);
+        // Commands on stdin; the thread is left blocked in getline at exit.
+        std::thread([]()
+            {
+                std::string line;
+                while (std::getline(std::cin, line))
+                {
+                    line.erase(std::remove_if(line.begin(), line.end(), ::isspace), line.end());
+                    if (line == "dump")
+                        g_flightDumpRequested.store(true);
+                    else if (line == "quit")
+                        g_stopCapture.store(true);
+                }
+            }).detach();
+        if (verbose)
+        {
+            LogInfo() << L"[INFO] Flight recorder: " << slots << L" slots, " << flightMegabytes << L" MB in "
+                << ringPath << L". Ctrl+Break or \"dump\" saves them, Ctrl+C or \"quit\" stops.\n";
+        }
+    }
+
+    if (verbose && !redactions.empty())
+        LogInfo() << L"[INFO] Redacting " << redactions.size() << L" area(s) of every grab.\n";
+
+    // Lambda: Grab the configured target into a frame and redact it. Every
+    // later stage works on views of the frame's memory; only the clipboard
+    // gets a copy.
+    auto grabFrame = [&](Frame& frame) -> bool
+        {
+            bool ok;
+            if (captureAll)
+            {
+                ok = desktopCapture.Grab();
+                if (ok)
+                {
+                    StageTimer timer(stats, StatStage::Stitch);
+                    ok = desktopCapture.Stitch(frame);
+                }
+                if (ok && verbose)
+                {
+                    DesktopRect bounds = desktopCapture.Bounds();
+                    std::vector<DesktopRect> monitors;
+                    for (int i = 0; i < desktopCapture.MonitorCount(); i++)
+                        monitors.push_back(desktopCapture.MonitorRect(i));
+                    LogInfo() << L"[INFO] Virtual desktop: " << bounds.Width() << L"x" << bounds.Height() << L" at ("
+                        << bounds.left << L"," << bounds.top << L"), " << DesktopGapPixels(monitors)
+                        << L" uncovered pixels filled.\n";
+                }
+            }
+            else
+            {
+                ok = session.Grab(frame);
+            }
+            if (ok && stats)
+                stats->AddFrameGrabbed();
+            if (ok && !redactions.empty())
+            {
+                StageTimer timer(stats, StatStage::Redact);
+                ApplyRedactions(frame.View(), 0, 0, redactions);
+            }
+            return ok;
+        };
+
+    // Lambda: Copy a grabbed frame to the clipboard.
+    auto copyFrameToClipboard = [&](const FrameView& frame)
+        {
+            StageTimer timer(stats, StatStage::Clipboard);
+            if (verbose)
+                LogInfo() << L"[INFO] Copying image to clipboard...\n";
+            HGLOBAL hDib = CreateDIBFromFrame(frame);
+            if (!hDib)
+            {
+                std::cerr << "Failed to create DIB for clipboard." << std::endl;
+            }
+            else
+            {
+                if (OpenClipboard(NULL))
+                {
+                    EmptyClipboard();
+                    SetClipboardData(CF_DIB, hDib);
+                    CloseClipboard();
+                    if (verbose)
+                        LogInfo() << L"[INFO] Image copied to clipboard successfully.\n";
+                }
+                else
+                {
+                    std::cerr << "Failed to open clipboard." << std::endl;
+                    GlobalFree(hDib);
+                }
+            }
+        };
+
+    // Lambda: Draw the timestamp (or -text) of a grabbed frame into its pixels, if requested.
+    // Each encoder thread keeps its own overlay, so glyphs are rasterized once per thread.
+    auto annotateFrame = [&](const FrameView& frame, std::time_t grabTime)
+        {
+            if (!annotateTimestamp)
+                return;
+            StageTimer timer(stats, StatStage::Annotate);
+            thread_local std::unique_ptr<TextOverlay> overlay;
+            if (!overlay)
+            {
+                std::unique_ptr<GlyphSource> glyphs;
+                if (pixelFont)
+                    glyphs.reset(new BuiltinFont());
+                else
+                    glyphs.reset(new GdiPlusGlyphSource());
+                overlay.reset(new TextOverlay(std::move(glyphs), textStyle));
+            }
+            struct tm tmTime;
+            localtime_s(&tmTime, &grabTime);
+            std::wstringstream ts;
+            ts << std::put_time(&tmTime, textFormat.c_str());
+            overlay->Draw(frame, ts.str());
+            if (verbose)
+                LogInfo() << L"[INFO] Timestamp annotation applied: " << ts.str() << L"\n";
+        };
+
+    // Lambda: Encode a finished image into memory as format.
+    auto encodeImage = [&](const FrameView& frame, const std::wstring& format, std::vector<uint8_t>& encoded) -> bool
+        {
+            StageTimer timer(stats, StatStage::Encode);
+            if (format == L"png")
+            {
+                // One encoder per thread keeps its scratch buffers warm across frames.
+                thread_local PngEncoder pngEncoder;
+                PngOptions pngOptions;
+                pngOptions.level = compressionLevel;
+                pngOptions.palette = paletteMode;
+                return pngEncoder.Encode(frame, pngOptions, encoded);
+            }
+            if (format == L"jpg")
+            {
+                // Restart intervals of one frame are coded in parallel on the shared pool.
+                thread_local JpegEncoder jpegEncoder;
+                JpegOptions jpegOptions;
+                jpegOptions.quality = jpegQuality;
+                jpegOptions.subsampling = chromaSubsampling;
+                return jpegEncoder.Encode(frame, jpegOptions, encoded);
+            }
+            if (format == L"qoi")
+                return EncodeQoi(frame, encoded);
+
+            Bitmap bmp(frame.width, frame.height, static_cast<INT>(frame.stride), PixelFormat32bppRGB, frame.data);
+            return SaveImageToBuffer(&bmp, session.EncoderClsid(), NULL, encoded);
+        };
+
+    // Lambda: Resize frame into resized, fitting a box (-thumb) or by -scale.
+    // One resampler per thread keeps its filter taps between frames.
+    auto resizeFrame = [&](const FrameView& frame, bool thumbnail, Frame& resized) -> bool
+        {
+            int width, height;
+            if (thumbnail)
+                FitSize(thumbWidth, thumbHeight, frame.width, frame.height, width, height);
+            else if (!ScaledSize(scaleSpec, frame.width, frame.height, width, height))
+                return false;
+            StageTimer timer(stats, StatStage::Resample);
+            thread_local Resampler resampler;
+            resized.Allocate(width, height, frame.format);
+            return resampler.Resample(frame, resized.View());
+        };
+
+    // Lambda: Scale (-scale), annotate and encode a grabbed frame into memory
+    // as format. Called concurrently from the encoder threads of the repeat
+    // pipeline. Without -scale the text goes straight into the grab.
+    auto encodeFrameAs = [&](const FrameView& frame, std::time_t grabTime, const std::wstring& format,
+        std::vector<uint8_t>& encoded) -> bool
+        {
+            FrameView image = frame;
+            thread_local Frame scaled;
+            if (scaling)
+            {
+                if (!resizeFrame(frame, false, scaled))
+                    return false;
+                image = scaled.View();
+            }
+            annotateFrame(image, grabTime);
+            return encodeImage(image, format, encoded);
+        };
+
+    auto encodeFrame = [&](const FrameView& frame, std::time_t grabTime, std::vector<uint8_t>& encoded) -> bool
+        {
+            return encodeFrameAs(frame, grabTime, imageFormat, encoded);
+        };
+
+    // Image files are written behind the capture by a thread of their own,
+    // which reports each one once it is on disk under its final name.
+    Win32WriterFileSystem writerFileSystem;
+    FileWriterOptions writerOptions;
+    writerOptions.writeThrough = writeThrough;
+    writerOptions.noBuffering = noFileCache;
+    writerOptions.stats = stats;
+    AsyncFileWriter fileWriter(writerFileSystem, writerOptions,
+        [&](const FileWriteRequest& request, bool ok)
+        {
+            if (request.sideOutput)
+            {
+                if (!ok)
+                    std::wcerr << L"Failed to save thumbnail (" << request.fileName << L")." << std::endl;
+                else
+                    LogResult() << L"Thumbnail saved as " << request.fileName << L"\n";
+                if (stats && ok)
+                    stats->AddBytesWritten(request.data.size());
+                return;
+            }
+            if (!ok)
+            {
+                std::wcerr << L"Failed to save screenshot (" << request.fileName << L")." << std::endl;
+                if (stats)
+                    stats->AddFrameDropped();
+                return;
+            }
+            if (stats)
+            {
+                stats->AddFrameWritten();
+                stats->AddBytesWritten(request.data.size());
+                stats->Record(StatStage::Frame, CaptureStats::Clock::now() - request.grabStarted);
+            }
+            LogResult() << L"Screenshot saved as " << request.fileName << L"\n";
+            if (verbose)
+                LogInfo() << L"[INFO] Wrote " << request.data.size() << L" bytes.\n";
+
+            if (showAfterCapture)
+            {
+                if (verbose)
+                    LogInfo() << L"[INFO] Opening image...\n";
+                ShellExecuteW(NULL, L"open", request.fileName.c_str(), NULL, NULL, SW_SHOWNORMAL);
+            }
+        });
+
+    // Lambda: -thumb: shrink a grab, before any annotation, and queue it as
+    // <name>_thumb.<ext> next to the full-size image of fileName.
+    auto saveThumbnail = [&](const FrameView& frame, const std::wstring& fileName, const std::wstring& format)
+        {
+            thread_local Frame thumbnail;
+            FileWriteRequest request;
+            request.fileName = AppendToFileStem(fileName, L"_thumb");
+            request.sideOutput = true;
+            if (!resizeFrame(frame, true, thumbnail) || !encodeImage(thumbnail.View(), format, request.data))
+            {
+                std::wcerr << L"Failed to encode thumbnail (" << request.fileName << L")." << std::endl;
+                return;
+            }
+            fileWriter.Submit(std::move(request));
+        };
 
-    if (verbose)
-        std::wcout << L"[INFO] Starting ShotCap...\n";
+    // Lambda: Hand an encoded frame to the file writer; takes the buffer.
+    // Waits only while the writer is too far behind.
+    auto writeFrame = [&](const std::wstring& fileName, std::vector<uint8_t>& encoded,
+        CaptureStats::Clock::time_point grabStarted) -> bool
+        {
+            FileWriteRequest request;
+            request.fileName = fileName;
+            request.data.swap(encoded);
+            request.grabStarted = grabStarted;
+            if (!fileWriter.Submit(std::move(request)))
+            {
+                std::wcerr << L"Failed to save screenshot (" << fileName << L")." << std::endl;
+                return false;
+            }
+            return true;
+        };
 
-    if (delaySeconds > 0)
-    {
-        if (verbose)
-            std::wcout << L"[INFO] Waiting for " << delaySeconds << L" seconds before capturing...\n";
-        Sleep(static_cast<DWORD>(delaySeconds * 1000));
-    }
+    // -o / -stream: record format, plus stream state owned by the writer.
+    StreamOptions streamOptions;
+    streamOptions.format = streamFormat;
+    streamOptions.jpeg.quality = jpegQuality;
+    streamOptions.jpeg.subsampling = chromaSubsampling;
+    SetStreamInterval(streamOptions, repeatEnabled ? repeatInterval : 0.0);
+    bool streamStarted = false;
+    int streamWidth = 0, streamHeight = 0;
 
-    // Initialize GDI+.
-    GdiplusStartupInput gdiplusStartupInput;
-    ULONG_PTR gdiplusToken;
-    if (GdiplusStartup(&gdiplusToken, &gdiplusStartupInput, NULL) != Ok)
-    {
-        std::cerr << "Failed to initialize GDI+." << std::endl;
-        return -1;
-    }
+    // Lambda: Annotate a grabbed frame and pack it as one stream record.
+    // Called concurrently from the encoder threads of the repeat pipeline.
+    auto encodeStreamFrame = [&](const FrameView& frame, int index, int64_t timeMs, std::vector<uint8_t>& encoded) -> bool
+        {
+            annotateFrame(frame, static_cast<std::time_t>(timeMs / 1000));
 
-    // Lambda: Capture and save a screenshot using current settings.
-    auto captureAndSave = [&](const std::wstring& fileName) -> bool
+            StageTimer timer(stats, StatStage::Encode);
+            thread_local FrameStreamEncoder streamEncoder;
+            return streamEncoder.Encode(frame, streamOptions, index, timeMs, encoded);
+        };
+
+    // Lambda: Append a stream record to the output, in capture order.
+    auto writeStreamFrame = [&](int width, int height, const std::vector<uint8_t>& encoded) -> bool
+        {
+            if (g_stopCapture.load())
+                return false;
+            StageTimer timer(stats, StatStage::Write);
+            std::vector<uint8_t> header;
+            if (!streamStarted)
+            {
+                BeginStream(streamOptions, width, height, header);
+                streamStarted = true;
+                streamWidth = width;
+                streamHeight = height;
+            }
+            else if (streamFormat == StreamFormat::Y4m && (width != streamWidth || height != streamHeight))
+            {
+                std::wcerr << L"Frame size changed; a y4m stream needs a fixed capture size." << std::endl;
+                return false;
+            }
+            if (!WriteToStream(streamHandle, header.data(), header.size()) ||
+                !WriteToStream(streamHandle, encoded.data(), encoded.size()))
+            {
+                // The reader went away; stop grabbing instead of failing every frame.
+                g_stopCapture.store(true);
+                std::wcerr << L"Stream output closed (" << streamTarget << L"); stopping." << std::endl;
+                return false;
+            }
+            timer.Stop();
+            if (stats)
+            {
+                stats->AddFrameWritten();
+                stats->AddBytesWritten(header.size() + encoded.size());
+            }
+            if (verbose)
+                LogInfo() << L"[INFO] Streamed " << encoded.size() << L" bytes.\n";
+            return true;
+        };
+
+    // Lambda: Copy, encode and stream a grabbed frame.
+    auto streamFrame = [&](const FrameView& frame, int index, int64_t timeMs) -> bool
         {
-            HDC hSourceDC = nullptr;
-            RECT captureRect = { 0, 0, 0, 0 };
+            if (copyToClipboard)
+                copyFrameToClipboard(frame);
 
-            // For active window or specified window, use PrintWindow.
-            if (captureActiveWindow || !windowTitle.empty())
+            std::vector<uint8_t> encoded;
+            if (!encodeStreamFrame(frame, index, timeMs, encoded))
             {
-                HWND hWnd = captureActiveWindow ? GetForegroundWindow() : FindWindowW(NULL, windowTitle.c_str());
-                if (!hWnd)
-                {
-                    std::wcerr << L"Window not found." << std::endl;
-                    return false;
-                }
-                if (verbose)
-                    std::wcout << L"[INFO] Capturing window." << std::endl;
-                if (!GetWindowRect(hWnd, &captureRect))
-                {
-                    std::cerr << "Failed to get window rect." << std::endl;
-                    return false;
-                }
-                hSourceDC = GetDC(hWnd);
-                if (!hSourceDC)
-                {
-                    std::cerr << "Failed to get window DC." << std::endl;
-                    return false;
-                }
+                std::wcerr << L"Failed to encode frame " << index << L"." << std::endl;
+                return false;
+            }
+            return writeStreamFrame(frame.width, frame.height, encoded);
+        };
+
+    // Lambda: Store an encoded frame in the flight recorder ring.
+    auto recordFlightFrame = [&](const std::vector<uint8_t>& encoded, int64_t timeMs) -> bool
+        {
+            StageTimer timer(stats, StatStage::Write);
+            bool stored;
+            {
+                std::lock_guard<std::mutex> lock(flightMutex);
+                stored = flightRing.Append(encoded.data(), encoded.size(), timeMs);
             }
-            else if (monitorIndex != -1)
+            if (!stored)
             {
-                std::vector<MonitorInfo> monitors;
-                if (!EnumDisplayMonitors(NULL, NULL, MonitorEnumProc, (LPARAM)&monitors))
-                {
-                    std::cerr << "Failed to enumerate monitors." << std::endl;
-                    return false;
-                }
-                if (monitorIndex < 0 || monitorIndex >= static_cast<int>(monitors.size()))
-                {
-                    std::cerr << "Invalid monitor index." << std::endl;
-                    return false;
-                }
-                captureRect = monitors[monitorIndex].rect;
-                HWND hDesktopWnd = GetDesktopWindow();
-                hSourceDC = GetDC(hDesktopWnd);
-                if (!hSourceDC)
-                {
-                    std::cerr << "Failed to get desktop DC." << std::endl;
-                    return false;
-                }
+                std::wcerr << L"Frame of " << encoded.size() << L" bytes does not fit the flight recorder; raise -flightsize."
+                    << std::endl;
+                return false;
             }
-            else if (regionSpecified)
+            timer.Stop();
+            if (stats)
             {
-                captureRect.left = regionX;
-                captureRect.top = regionY;
-                captureRect.right = regionX + regionW;
-                captureRect.bottom = regionY + regionH;
-                HWND hDesktopWnd = GetDesktopWindow();
-                hSourceDC = GetDC(hDesktopWnd);
-                if (!hSourceDC)
-                {
-                    std::cerr << "Failed to get desktop DC." << std::endl;
-                    return false;
-                }
+                stats->AddFrameWritten();
+                stats->AddBytesWritten(encoded.size());
             }
-            else
+            return true;
+        };
+
+    // Lambda: Check the -flightrec triggers and save the ring's frames on a
+    // background thread, so recording carries on while the files are written.
+    int flightDumps = 0;
+    std::thread flightDumper;
+    auto pollFlightTriggers = [&]()
+        {
+            bool triggered = g_flightDumpRequested.exchange(false);
+            if (!flightTrigger.empty() && GetFileAttributesW(flightTrigger.c_str()) != INVALID_FILE_ATTRIBUTES)
             {
-                HWND hDesktopWnd = GetDesktopWindow();
-                hSourceDC = GetDC(hDesktopWnd);
-                if (!hSourceDC)
-                {
-                    std::cerr << "Failed to get desktop DC." << std::endl;
-                    return false;
-                }
-                captureRect.left = 0;
-                captureRect.top = 0;
-                captureRect.right = GetSystemMetrics(SM_CXSCREEN);
-                captureRect.bottom = GetSystemMetrics(SM_CYSCREEN);
+                DeleteFileW(flightTrigger.c_str());
+                triggered = true;
+            }
+            if (!triggered)
+                return;
+            std::vector<FlightFrame> frames;
+            {
+                std::lock_guard<std::mutex> lock(flightMutex);
+                flightRing.Snapshot(frames);
             }
+            if (flightDumper.joinable())
+                flightDumper.join();
+            const std::wstring prefix = flightPrefix + L"_dump" + std::to_wstring(++flightDumps);
+            flightDumper = std::thread([&imageFormat, prefix, frames = std::move(frames)]()
+                {
+                    int saved = SaveFlightFrames(frames, prefix, imageFormat);
+                    double span = frames.empty() ? 0.0 : (frames.back().timestampMs - frames.front().timestampMs) / 1000.0;
+                    LogResult() << L"Flight recorder: " << saved << L" frames (" << span << L" s) saved as "
+                        << prefix << L"_NNN." << imageFormat << L"\n";
+                });
+        };
 
-            int capW = captureRect.right - captureRect.left;
-            int capH = captureRect.bottom - captureRect.top;
-            if (verbose)
-                std::wcout << L"[INFO] Capture dimensions: " << capW << L"x" << capH << std::endl;
+    // Lambda: Copy, encode and record a grabbed frame in the flight recorder.
+    auto flightFrame = [&](const FrameView& frame, int64_t timeMs) -> bool
+        {
+            if (copyToClipboard)
+                copyFrameToClipboard(frame);
 
-            HDC hCaptureDC = CreateCompatibleDC(hSourceDC);
-            if (!hCaptureDC)
+            std::vector<uint8_t> encoded;
+            if (!encodeFrame(frame, static_cast<std::time_t>(timeMs / 1000), encoded))
             {
-                std::cerr << "Failed to create compatible DC." << std::endl;
-                if (hSourceDC)
-                    ReleaseDC(NULL, hSourceDC);
+                std::wcerr << L"Failed to encode frame for the flight recorder." << std::endl;
                 return false;
             }
-            HBITMAP hCaptureBitmap = CreateCompatibleBitmap(hSourceDC, capW, capH);
-            if (!hCaptureBitmap)
+            return recordFlightFrame(encoded, timeMs);
+        };
+
+    auto unixTimeMs = []() -> int64_t
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        };
+
+    // Lambda: Copy, annotate, encode and queue a grabbed frame for writing.
+    // The writer reports the frame from then on.
+    auto saveFrame = [&](const FrameView& frame, const std::wstring& fileName,
+        CaptureStats::Clock::time_point grabStarted) -> bool
+        {
+            if (copyToClipboard)
+                copyFrameToClipboard(frame);
+            if (thumbnails)
+                saveThumbnail(frame, fileName, imageFormat);
+
+            std::vector<uint8_t> encoded;
+            if (!encodeFrame(frame, std::time(nullptr), encoded))
             {
-                std::cerr << "Failed to create compatible bitmap." << std::endl;
-                DeleteDC(hCaptureDC);
-                if (hSourceDC)
-                    ReleaseDC(NULL, hSourceDC);
+                std::wcerr << L"Failed to encode screenshot (" << fileName << L")." << std::endl;
                 return false;
             }
-            HGDIOBJ hOld = SelectObject(hCaptureDC, hCaptureBitmap);
-            if (!hOld)
+            return writeFrame(fileName, encoded, grabStarted);
+        };
+
+    // Lambda: Capture and save a screenshot using current settings.
+    auto captureAndSave = [&](const std::wstring& fileName) -> bool
+        {
+            auto grabStarted = CaptureStats::Clock::now();
+            Frame frame;
+            bool saved = grabFrame(frame) && saveFrame(frame.View(), fileName, grabStarted);
+            if (stats && !saved)
+                stats->AddFrameDropped();
+            return saved;
+        };
+
+    // Lambda: -bands: grab, encode and write the target one band at a
+    // time, straight into <name>.tmp, which then replaces the file.
+    auto captureAndSaveBands = [&](const std::wstring& fileName) -> bool
+        {
+            auto grabStarted = CaptureStats::Clock::now();
+            RECT rect;
+            if (!session.BandTarget(rect))
             {
-                std::cerr << "Failed to select bitmap into DC." << std::endl;
-                DeleteObject(hCaptureBitmap);
-                DeleteDC(hCaptureDC);
-                if (hSourceDC)
-                    ReleaseDC(NULL, hSourceDC);
+                if (stats)
+                    stats->AddFrameDropped();
                 return false;
             }
+            const int width = rect.right - rect.left;
+            const int height = rect.bottom - rect.top;
+            if (verbose)
+            {
+                LogInfo() << L"[INFO] Capture dimensions: " << width << L"x" << height << L", in bands of "
+                    << BandRowsFor(width, bandRows) << L" rows.\n";
+            }
 
-            // For window capture, try using PrintWindow.
-            if (captureActiveWindow || !windowTitle.empty())
+            PngOptions pngOptions;
+            pngOptions.level = compressionLevel;
+            std::unique_ptr<RowStreamEncoder> encoder = CreateRowStreamEncoder(
+                imageFormat == L"qoi" ? BandFormat::Qoi : imageFormat == L"bmp" ? BandFormat::Bmp : BandFormat::Png,
+                pngOptions);
+            FileCreateOptions createOptions;
+            createOptions.writeThrough = writeThrough;
+            createOptions.noBuffering = noFileCache;
+            const std::wstring tempName = fileName + L".tmp";
+            std::unique_ptr<WritableFile> file = writerFileSystem.Create(tempName, createOptions);
+            if (!file)
             {
-                HWND hWnd = captureActiveWindow ? GetForegroundWindow() : FindWindowW(NULL, windowTitle.c_str());
-                BOOL printResult = PrintWindow(hWnd, hCaptureDC, PW_RENDERFULLCONTENT);
-                if (!printResult)
-                {
-                    if (verbose)
-                        std::wcout << L"[INFO] PW_RENDERFULLCONTENT failed, trying PW_CLIENTONLY...\n";
-                    printResult = PrintWindow(hWnd, hCaptureDC, PW_CLIENTONLY);
-                }
-                if (!printResult)
+                std::wcerr << L"Failed to save screenshot (" << fileName << L")." << std::endl;
+                if (stats)
+                    stats->AddFrameDropped();
+                return false;
+            }
+
+            BandedCaptureOptions bandOptions;
+            bandOptions.bandRows = bandRows;
+            bandOptions.stats = stats;
+            uint64_t written = 0;
+            bool saved = CaptureInBands(width, height, *encoder, bandOptions,
+                [&](int top, int rows, Frame& band) -> bool
                 {
-                    if (verbose)
-                        std::wcout << L"[INFO] PrintWindow failed; falling back to BitBlt capture...\n";
-                    // Fallback: capture full desktop and crop.
-                    SelectObject(hCaptureDC, hOld);
-                    DeleteObject(hCaptureBitmap);
-                    DeleteDC(hCaptureDC);
-                    ReleaseDC(NULL, hSourceDC);
-                    HWND hDesktopWnd = GetDesktopWindow();
-                    hSourceDC = GetDC(hDesktopWnd);
-                    captureRect.left = 0;
-                    captureRect.top = 0;
-                    captureRect.right = GetSystemMetrics(SM_CXSCREEN);
-                    captureRect.bottom = GetSystemMetrics(SM_CYSCREEN);
-                    capW = captureRect.right - captureRect.left;
-                    capH = captureRect.bottom - captureRect.top;
-                    hCaptureDC = CreateCompatibleDC(hSourceDC);
-                    hCaptureBitmap = CreateCompatibleBitmap(hSourceDC, capW, capH);
-                    hOld = SelectObject(hCaptureDC, hCaptureBitmap);
-                    if (!BitBlt(hCaptureDC, 0, 0, capW, capH,
-                        hSourceDC, captureRect.left, captureRect.top, SRCCOPY | CAPTUREBLT))
-                    {
-                        std::cerr << "Fallback BitBlt failed." << std::endl;
-                        SelectObject(hCaptureDC, hOld);
-                        DeleteObject(hCaptureBitmap);
-                        DeleteDC(hCaptureDC);
-                        ReleaseDC(NULL, hSourceDC);
+                    if (!session.GrabBand(rect, top, rows, band))
                         return false;
+                    if (!redactions.empty())
+                    {
+                        StageTimer timer(stats, StatStage::Redact);
+                        FrameView rowsView = band.View();
+                        rowsView.height = rows;
+                        ApplyRedactions(rowsView, 0, top, redactions);
                     }
-                }
+                    return true;
+                },
+                [&](const uint8_t* data, size_t size) -> bool
+                {
+                    return file->Write(data, size);
+                },
+                &written);
+            saved = file->Close() && saved;
+            saved = saved && writerFileSystem.Replace(tempName, fileName, writeThrough);
+            if (!saved)
+            {
+                writerFileSystem.Remove(tempName);
+                std::wcerr << L"Failed to save screenshot (" << fileName << L")." << std::endl;
+                if (stats)
+                    stats->AddFrameDropped();
+                return false;
             }
-            else
+            if (stats)
             {
-                if (!BitBlt(hCaptureDC, 0, 0, capW, capH,
-                    hSourceDC, captureRect.left, captureRect.top, SRCCOPY | CAPTUREBLT))
-                {
-                    std::cerr << "BitBlt failed." << std::endl;
-                    SelectObject(hCaptureDC, hOld);
-                    DeleteObject(hCaptureBitmap);
-                    DeleteDC(hCaptureDC);
-                    ReleaseDC(NULL, hSourceDC);
-                    return false;
-                }
+                stats->AddFrameGrabbed();
+                stats->AddFrameWritten();
+                stats->AddBytesWritten(written);
+                stats->Record(StatStage::Frame, CaptureStats::Clock::now() - grabStarted);
             }
+            LogResult() << L"Screenshot saved as " << fileName << L"\n";
+            if (verbose)
+                LogInfo() << L"[INFO] Wrote " << written << L" bytes.\n";
+            if (showAfterCapture)
+                ShellExecuteW(NULL, L"open", fileName.c_str(), NULL, NULL, SW_SHOWNORMAL);
+            return true;
+        };
 
-            if (capturePointer)
+    // Lambda: Multiple regions: grab their bounding box once, encode every
+    // region from a view of that frame in parallel, then write them in order.
+    auto captureAndSaveRegions = [&]() -> bool
+        {
+            auto grabStarted = CaptureStats::Clock::now();
+            Frame frame;
+            if (!grabFrame(frame))
             {
-                CURSORINFO ci = { 0 };
-                ci.cbSize = sizeof(ci);
-                if (GetCursorInfo(&ci) && (ci.flags == CURSOR_SHOWING))
-                {
-                    int iconX = ci.ptScreenPos.x - captureRect.left;
-                    int iconY = ci.ptScreenPos.y - captureRect.top;
-                    DrawIconEx(hCaptureDC, iconX, iconY, ci.hCursor, 0, 0, 0, NULL, DI_NORMAL);
-                    if (verbose)
-                        std::wcout << L"[INFO] Mouse pointer drawn.\n";
-                }
+                if (stats)
+                    stats->AddFrameDropped();
+                return false;
             }
-
             if (copyToClipboard)
-            {
-                if (verbose)
-                    std::wcout << L"[INFO] Copying image to clipboard...\n";
-                HGLOBAL hDib = CreateDIBFromHBITMAP(hCaptureBitmap);
-                if (!hDib)
-                {
-                    std::cerr << "Failed to create DIB for clipboard." << std::endl;
-                }
-                else
+                copyFrameToClipboard(frame.View());
+
+            DesktopRect bounds;
+            bounds.left = regionX;
+            bounds.top = regionY;
+            bounds.right = regionX + regionW;
+            bounds.bottom = regionY + regionH;
+            const std::time_t grabTime = std::time(nullptr);
+            std::vector<std::vector<uint8_t>> encoded(regions.size());
+            std::vector<char> encodedOk(regions.size(), 0);
+            FanOutRegions(frame.View(), bounds, regions, [&](int index, const FrameView& crop) -> bool
                 {
-                    if (OpenClipboard(NULL))
+                    if (thumbnails)
+                        saveThumbnail(crop, regionFiles[index], regionFormats[index]);
+                    bool ok;
+                    if (annotateTimestamp && !scaling)
                     {
-                        EmptyClipboard();
-                        SetClipboardData(CF_DIB, hDib);
-                        CloseClipboard();
-                        if (verbose)
-                            std::wcout << L"[INFO] Image copied to clipboard successfully.\n";
+                        // Regions may overlap, so text goes into a private copy
+                        // (-scale makes one anyway).
+                        Frame copy;
+                        copy.Allocate(crop.width, crop.height, crop.format);
+                        ok = CopyFrame(crop, copy.View()) &&
+                            encodeFrameAs(copy.View(), grabTime, regionFormats[index], encoded[index]);
                     }
                     else
                     {
-                        std::cerr << "Failed to open clipboard." << std::endl;
-                        GlobalFree(hDib);
+                        ok = encodeFrameAs(crop, grabTime, regionFormats[index], encoded[index]);
                     }
-                }
-            }
+                    encodedOk[index] = ok ? 1 : 0;
+                    return ok;
+                });
 
-            Bitmap* bmp = new Bitmap(hCaptureBitmap, NULL);
-            if (!bmp)
+            bool saved = true;
+            for (size_t i = 0; i < regions.size(); i++)
             {
-                std::cerr << "Failed to create GDI+ Bitmap." << std::endl;
-                SelectObject(hCaptureDC, hOld);
-                DeleteObject(hCaptureBitmap);
-                DeleteDC(hCaptureDC);
-                ReleaseDC(NULL, hSourceDC);
-                return false;
+                bool queued = encodedOk[i] != 0;
+                if (!queued)
+                    std::wcerr << L"Failed to encode screenshot (" << regionFiles[i] << L")." << std::endl;
+                else
+                    queued = writeFrame(regionFiles[i], encoded[i], grabStarted);
+                if (stats && !queued)
+                    stats->AddFrameDropped();
+                saved = saved && queued;
             }
+            return saved;
+        };
 
-            if (annotateTimestamp)
+    // Lambda: -all -split: grab every monitor, encode them in parallel and
+    // write one file per monitor, named <name>_mon<index>.<ext>.
+    auto captureAndSaveMonitors = [&](const std::wstring& fileName) -> bool
+        {
+            auto grabStarted = CaptureStats::Clock::now();
+            if (!desktopCapture.Grab())
             {
-                std::time_t t = std::time(nullptr);
-                struct tm tmTime;
-                localtime_s(&tmTime, &t);
-                std::wstringstream ts;
-                ts << std::put_time(&tmTime, L"%Y-%m-%d %H:%M:%S");
-                AnnotateImage(bmp, ts.str(), verbose);
+                if (stats)
+                    stats->AddFrameDropped();
+                return false;
             }
-
-            const WCHAR* mimeType = L"image/png";
-            if (imageFormat == L"jpg")
-                mimeType = L"image/jpeg";
-            else if (imageFormat == L"bmp")
-                mimeType = L"image/bmp";
-
-            CLSID encoderClsid;
-            if (GetEncoderClsid(mimeType, &encoderClsid) < 0)
+            const int count = desktopCapture.MonitorCount();
+            if (stats)
             {
-                std::cerr << "Image encoder not found for specified format." << std::endl;
-                delete bmp;
-                SelectObject(hCaptureDC, hOld);
-                DeleteObject(hCaptureBitmap);
-                DeleteDC(hCaptureDC);
-                ReleaseDC(NULL, hSourceDC);
-                return false;
+                for (int index = 0; index < count; index++)
+                    stats->AddFrameGrabbed();
             }
-
-            EncoderParameters encoderParams;
-            ULONG qualityParam = jpegQuality;
-            if (imageFormat == L"jpg")
+            // -redact places its rectangles on the desktop image -all would
+            // have saved, so each monitor is redacted at its offset in it.
+            if (!redactions.empty())
             {
-                encoderParams.Count = 1;
-                encoderParams.Parameter[0].Guid = EncoderQuality;
-                encoderParams.Parameter[0].Type = EncoderParameterValueTypeLong;
-                encoderParams.Parameter[0].NumberOfValues = 1;
-                encoderParams.Parameter[0].Value = &qualityParam;
+                StageTimer timer(stats, StatStage::Redact);
+                const DesktopRect bounds = desktopCapture.Bounds();
+                for (int index = 0; index < count; index++)
+                {
+                    const DesktopRect monitor = desktopCapture.MonitorRect(index);
+                    ApplyRedactions(desktopCapture.MonitorView(index), monitor.left - bounds.left,
+                        monitor.top - bounds.top, redactions);
+                }
             }
-            else
+            if (copyToClipboard)
             {
-                encoderParams.Count = 0;
+                Frame desktop;
+                if (desktopCapture.Stitch(desktop))
+                    copyFrameToClipboard(desktop.View());
             }
 
-            Status stat;
-            if (imageFormat == L"jpg")
-                stat = bmp->Save(fileName.c_str(), &encoderClsid, &encoderParams);
-            else
-                stat = bmp->Save(fileName.c_str(), &encoderClsid, NULL);
+            std::vector<std::wstring> monitorFiles;
+            for (int index = 0; index < count; index++)
+                monitorFiles.push_back(AppendToFileStem(fileName, L"_mon" + std::to_wstring(index)));
 
-            if (stat != Ok)
-                std::wcerr << L"Failed to save screenshot (" << fileName << L"). Status code: " << stat << std::endl;
-            else
-                std::wcout << L"Screenshot saved as " << fileName << std::endl;
+            const std::time_t grabTime = std::time(nullptr);
+            std::vector<std::vector<uint8_t>> encoded(count);
+            std::vector<char> encodedOk(count, 0);
+            SharedThreadPool().ParallelFor(count, [&](int index)
+                {
+                    const FrameView monitor = desktopCapture.MonitorView(index);
+                    if (thumbnails)
+                        saveThumbnail(monitor, monitorFiles[index], imageFormat);
+                    encodedOk[index] = encodeFrame(monitor, grabTime, encoded[index]) ? 1 : 0;
+                });
 
-            if (showAfterCapture)
+            bool saved = true;
+            for (int index = 0; index < count; index++)
             {
-                if (verbose)
-                    std::wcout << L"[INFO] Opening image...\n";
-                ShellExecuteW(NULL, L"open", fileName.c_str(), NULL, NULL, SW_SHOWNORMAL);
+                const std::wstring& monitorFile = monitorFiles[index];
+                bool queued = encodedOk[index] != 0;
+                if (!queued)
+                    std::wcerr << L"Failed to encode screenshot (" << monitorFile << L")." << std::endl;
+                else
+                    queued = writeFrame(monitorFile, encoded[index], grabStarted);
+                if (stats && !queued)
+                    stats->AddFrameDropped();
+                saved = saved && queued;
             }
+            return saved;
+        };
 
-            delete bmp;
-            SelectObject(hCaptureDC, hOld);
-            DeleteObject(hCaptureBitmap);
-            DeleteDC(hCaptureDC);
-            ReleaseDC(NULL, hSourceDC);
-            return true;
+    // Lambda: -compare-live: grab the target and compare it in memory with
+    // the reference image. Returns the exit code of -compare.
+    auto captureAndCompare = [&]() -> int
+        {
+            LoadedImage reference;
+            std::wstring error, report;
+            if (!LoadImageFile(compareLive, reference, error))
+            {
+                std::wcerr << error << std::endl;
+                return -1;
+            }
+            Frame frame;
+            if (!grabFrame(frame))
+            {
+                if (stats)
+                    stats->AddFrameDropped();
+                return -1;
+            }
+            if (copyToClipboard)
+                copyFrameToClipboard(frame.View());
+            CompareOutcome outcome;
+            {
+                StageTimer timer(stats, StatStage::Compare);
+                outcome = CompareViews(reference.view, frame.View(), compareLive + L" and the capture",
+                    compareSettings, compareSettings.diffPath, 0, report);
+            }
+            if (outcome == CompareOutcome::Error)
+            {
+                std::wcerr << report;
+                return -1;
+            }
+            LogReport(report);
+            return outcome == CompareOutcome::Pass ? 0 : 1;
         };
 
-        if (repeatEnabled && repeatCount > 0)
+        int exitCode = 0;
+        if (repeatEnabled && (repeatCount > 0 || flightRecording))
         {
+            // -flightrec with a count of 0 records until stopped.
+            const int frameLimit = repeatCount > 0 ? repeatCount : INT_MAX;
             std::wstring baseName = outputFile;
             std::wstring extension = L"";
             size_t pos = outputFile.find_last_of(L'.');
@@ -875,22 +3278,299 @@ int main(int argc, char* argv[])
                     extension = L".jpg";
                 else if (imageFormat == L"bmp")
                     extension = L".bmp";
+                else if (imageFormat == L"seq")
+                    extension = L".seq";
+                else if (imageFormat == L"qoi")
+                    extension = L".qoi";
                 else
                     extension = L".png";
             }
-            auto nextFrameTime = std::chrono::steady_clock::now();
-            for (int i = 0; i < repeatCount; i++)
+            auto frameFileName = [&](int index) -> std::wstring
+                {
+                    std::wstringstream ss;
+                    ss << baseName << L"_" << std::setfill(L'0') << std::setw(3) << index << extension;
+                    return outputDir.empty() ? ss.str() : (outputDir + L"\\" + ss.str());
+                };
+            // -format seq: every frame is appended, in capture order, to one container file.
+            const bool seqOutput = imageFormat == L"seq";
+            const std::wstring seqFileName = outputDir.empty() ? (baseName + extension)
+                : (outputDir + L"\\" + baseName + extension);
+            SeqOptions seqOptions;
+            seqOptions.level = compressionLevel;
+            SeqWriter seqWriter(seqOptions);
+            std::vector<uint8_t> seqBytes;
+            HANDLE seqFile = INVALID_HANDLE_VALUE;
+            if (seqOutput)
             {
-                std::wstringstream ss;
-                ss << baseName << L"_" << std::setfill(L'0') << std::setw(3) << i + 1 << extension;
-                std::wstring fileName = outputDir.empty() ? ss.str() : (outputDir + L"\\" + ss.str());
-                if (!captureAndSave(fileName))
+                seqFile = CreateFileW(seqFileName.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+                if (seqFile == INVALID_HANDLE_VALUE)
+                {
+                    std::wcerr << L"Failed to create sequence file (" << seqFileName << L")." << std::endl;
+                    GdiplusShutdown(gdiplusToken);
+                    return -1;
+                }
+            }
+            auto writeSeqBytes = [&]() -> bool
+                {
+                    DWORD written = 0;
+                    bool ok = seqBytes.empty() || (WriteFile(seqFile, seqBytes.data(), static_cast<DWORD>(seqBytes.size()), &written, NULL)
+                        && written == seqBytes.size());
+                    seqBytes.clear();
+                    return ok;
+                };
+            // -timing: a row per frame as it is written, the summary at the end.
+            HANDLE timingFile = INVALID_HANDLE_VALUE;
+            if (!timingPath.empty())
+            {
+                timingFile = CreateFileW(timingPath.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+                if (timingFile == INVALID_HANDLE_VALUE)
                 {
-                    std::wcerr << L"[ERROR] Capture iteration " << i + 1 << L" failed.\n";
+                    std::wcerr << L"Failed to create timing file (" << timingPath << L")." << std::endl;
+                    if (seqFile != INVALID_HANDLE_VALUE)
+                        CloseHandle(seqFile);
+                    GdiplusShutdown(gdiplusToken);
+                    return -1;
                 }
-                nextFrameTime += std::chrono::milliseconds(static_cast<int>(repeatInterval * 1000));
-                std::this_thread::sleep_until(nextFrameTime);
             }
+            bool timingOk = true;
+            auto writeTiming = [&](const std::string& text)
+                {
+                    if (timingFile == INVALID_HANDLE_VALUE || text.empty())
+                        return;
+                    DWORD written = 0;
+                    if (!WriteFile(timingFile, text.data(), static_cast<DWORD>(text.size()), &written, NULL) || written != text.size())
+                        timingOk = false;
+                };
+            int timingRows = 0;
+            auto logTiming = [&](const FrameTiming& timing, int64_t unixMs)
+                {
+                    writeTiming(FormatTimingRow(timingFormat, timing, unixMs, timingRows == 0));
+                    timingRows++;
+                };
+            writeTiming(FormatTimingHeader(timingFormat, repeatInterval, overrunPolicy));
+            ScheduleSummary schedule;
+            auto appendSeqFrame = [&](const FrameView& frame, int64_t timestampMs) -> bool
+                {
+                    StageTimer encodeTimer(stats, StatStage::Encode);
+                    if (!seqWriter.AddFrame(frame, timestampMs, seqBytes))
+                    {
+                        std::wcerr << L"Frame size changed; a sequence file needs a fixed capture size." << std::endl;
+                        return false;
+                    }
+                    encodeTimer.Stop();
+                    const size_t frameBytes = seqBytes.size();
+                    StageTimer writeTimer(stats, StatStage::Write);
+                    if (!writeSeqBytes())
+                    {
+                        std::wcerr << L"Failed to write sequence file (" << seqFileName << L")." << std::endl;
+                        return false;
+                    }
+                    writeTimer.Stop();
+                    if (stats)
+                    {
+                        stats->AddFrameWritten();
+                        stats->AddBytesWritten(frameBytes);
+                    }
+                    if (verbose)
+                        LogInfo() << L"[INFO] Sequence frame " << seqWriter.FrameCount() << L" appended.\n";
+                    return true;
+                };
+            // Deadlines are only as sharp as the system timer; ask for 1 ms
+            // while the run lasts.
+            timeBeginPeriod(1);
+            if (changeThreshold >= 0.0)
+            {
+                // Change-triggered mode: poll every interval, save only when enough changed.
+                // Change mode grabs one frame at a time, so the start of the
+                // last grab is all the frame timing needs.
+                auto grabStarted = CaptureStats::Clock::now();
+                int64_t grabUnixMs = 0;
+                CallbackFrameSource source([&](Frame& frame) -> bool
+                    {
+                        grabStarted = CaptureStats::Clock::now();
+                        grabUnixMs = unixTimeMs();
+                        if (flightRecording)
+                            pollFlightTriggers();
+                        return grabFrame(frame);
+                    });
+                ChangeCaptureOptions changeOptions;
+                changeOptions.threshold = changeThreshold;
+                changeOptions.pollInterval = repeatInterval;
+                changeOptions.overrun = overrunPolicy;
+                changeOptions.schedule = &schedule;
+                changeOptions.maxGap = maxGapSeconds;
+                changeOptions.frameCount = frameLimit;
+                changeOptions.stats = stats;
+                changeOptions.stop = &g_stopCapture;
+                RunChangeCapture(source, changeOptions,
+                    [&](Frame& frame, int index, double changed, const FrameTiming& timing) -> bool
+                    {
+                        logTiming(timing, grabUnixMs);
+                        if (verbose)
+                            LogInfo() << L"[INFO] Change detected: " << changed * 100.0 << L"% of area.\n";
+                        bool saved;
+                        bool queued = false;    // Image files are reported by the writer.
+                        if (seqOutput)
+                        {
+                            if (copyToClipboard)
+                                copyFrameToClipboard(frame.View());
+                            annotateFrame(frame.View(), std::time(nullptr));
+                            saved = appendSeqFrame(frame.View(), unixTimeMs());
+                        }
+                        else if (streaming)
+                        {
+                            saved = streamFrame(frame.View(), index, unixTimeMs());
+                        }
+                        else if (flightRecording)
+                        {
+                            saved = flightFrame(frame.View(), unixTimeMs());
+                        }
+                        else
+                        {
+                            saved = saveFrame(frame.View(), frameFileName(index), grabStarted);
+                            queued = saved;
+                        }
+                        if (stats && !saved)
+                            stats->AddFrameDropped();
+                        else if (stats && !queued)
+                            stats->Record(StatStage::Frame, CaptureStats::Clock::now() - grabStarted);
+                        if (!saved)
+                            std::wcerr << L"[ERROR] Capture iteration " << index << L" failed.\n";
+                        return !g_stopCapture.load();
+                    });
+            }
+            else
+            {
+                // Pipelined mode: grabs keep their cadence while encoder threads and
+                // an ordered writer work through the backlog.
+                PipelineOptions pipelineOptions;
+                pipelineOptions.frameCount = frameLimit;
+                pipelineOptions.interval = repeatInterval;
+                pipelineOptions.overrun = overrunPolicy;
+                pipelineOptions.stats = stats;
+                pipelineOptions.stop = &g_stopCapture;
+                PipelineStats pipelineStats = RunCapturePipeline(pipelineOptions,
+                    [&](PipelineFrame& frame) -> bool
+                    {
+                        if (flightRecording)
+                            pollFlightTriggers();
+                        if (!grabFrame(frame.image))
+                            return false;
+                        if (copyToClipboard)
+                            copyFrameToClipboard(frame.image.View());
+                        return true;
+                    },
+                    [&](PipelineFrame& frame) -> bool
+                    {
+                        // Sequence frames are delta-encoded against each other, so only
+                        // the annotation runs here; the writer does the encoding in order.
+                        if (seqOutput)
+                        {
+                            annotateFrame(frame.image.View(), frame.grabTime);
+                            return true;
+                        }
+                        if (streaming)
+                            return encodeStreamFrame(frame.image.View(), frame.index, frame.grabTimeMs, frame.encoded);
+                        if (thumbnails)
+                            saveThumbnail(frame.image.View(), frameFileName(frame.index), imageFormat);
+                        return encodeFrame(frame.image.View(), frame.grabTime, frame.encoded);
+                    },
+                    [&](PipelineFrame& frame)
+                    {
+                        logTiming(frame.timing, frame.grabTimeMs);
+                        bool saved = frame.ok;
+                        bool queued = false;    // Image files are reported by the writer.
+                        if (saved && seqOutput)
+                            saved = appendSeqFrame(frame.image.View(), frame.grabTimeMs);
+                        else if (saved && streaming)
+                            saved = writeStreamFrame(frame.image.Width(), frame.image.Height(), frame.encoded);
+                        else if (saved && flightRecording)
+                            saved = recordFlightFrame(frame.encoded, frame.grabTimeMs);
+                        else if (saved)
+                            saved = queued = writeFrame(frameFileName(frame.index), frame.encoded, frame.grabStarted);
+                        if (stats && !saved)
+                            stats->AddFrameDropped();
+                        else if (stats && !queued)
+                            stats->Record(StatStage::Frame, CaptureStats::Clock::now() - frame.grabStarted);
+                        if (!saved)
+                            std::wcerr << L"[ERROR] Capture iteration " << frame.index << L" failed.\n";
+                    });
+                if (verbose)
+                {
+                    LogInfo() << L"[INFO] Repeat finished: " << pipelineStats.framesWritten << L" written, "
+                        << pipelineStats.framesFailed << L" failed, " << pipelineStats.captureStalls << L" capture stalls.\n";
+                }
+                schedule = pipelineStats.schedule;
+            }
+            timeEndPeriod(1);
+
+            if (verbose && schedule.frames > 0)
+            {
+                LogInfo() << L"[INFO] Schedule (" << OverrunPolicyName(overrunPolicy) << L"): mean lateness "
+                    << schedule.meanLatenessMs << L" ms, max " << schedule.maxLatenessMs << L" ms, drift "
+                    << schedule.driftMs << L" ms, " << schedule.slotsSkipped << L" slots skipped.\n";
+            }
+            if (timingFile != INVALID_HANDLE_VALUE)
+            {
+                writeTiming(FormatTimingFooter(timingFormat, schedule));
+                CloseHandle(timingFile);
+                if (timingOk)
+                    LogResult() << L"Timing saved as " << timingPath << L" (" << timingRows << L" frames)\n";
+                else
+                    std::wcerr << L"Failed to write timing file (" << timingPath << L")." << std::endl;
+            }
+
+            if (seqOutput)
+            {
+                seqWriter.Finish(seqBytes);
+                bool indexed = writeSeqBytes();
+                CloseHandle(seqFile);
+                if (!indexed)
+                    std::wcerr << L"Failed to write sequence index (" << seqFileName << L")." << std::endl;
+                LogResult() << L"Sequence saved as " << seqFileName << L" (" << seqWriter.FrameCount() << L" frames, "
+                    << seqWriter.BytesWritten() << L" bytes)\n";
+            }
+
+            if (flightRecording)
+            {
+                // A trigger that came in with the last frame still gets its dump.
+                pollFlightTriggers();
+                if (flightDumper.joinable())
+                    flightDumper.join();
+                LogResult() << L"Flight recorder stopped after " << flightRing.FramesAppended() << L" frames; "
+                    << flightRing.FrameCount() << L" are kept in " << flightPrefix << L".ring\n";
+                UnmapViewOfFile(flightView);
+                CloseHandle(flightMapping);
+                CloseHandle(flightFile);
+            }
+        }
+        else if (streaming)
+        {
+            auto grabStarted = CaptureStats::Clock::now();
+            Frame frame;
+            bool streamed = grabFrame(frame) && streamFrame(frame.View(), 1, unixTimeMs());
+            if (stats && streamed)
+                stats->Record(StatStage::Frame, CaptureStats::Clock::now() - grabStarted);
+            else if (stats)
+                stats->AddFrameDropped();
+        }
+        else if (!compareLive.empty())
+        {
+            exitCode = captureAndCompare();
+        }
+        else if (fanOut)
+        {
+            captureAndSaveRegions();
+        }
+        else if (splitMonitors)
+        {
+            std::wstring fileName = outputDir.empty() ? outputFile : (outputDir + L"\\" + outputFile);
+            captureAndSaveMonitors(fileName);
+        }
+        else if (bandRows >= 0)
+        {
+            std::wstring fileName = outputDir.empty() ? outputFile : (outputDir + L"\\" + outputFile);
+            captureAndSaveBands(fileName);
         }
         else
         {
@@ -898,8 +3578,39 @@ int main(int argc, char* argv[])
             captureAndSave(fileName);
         }
 
+    fileWriter.Finish();
+    if (verbose)
+    {
+        FileWriterStats writerStats = fileWriter.Stats();
+        if (writerStats.filesWritten + writerStats.filesFailed > 0)
+        {
+            LogInfo() << L"[INFO] File writer: " << writerStats.filesWritten << L" written, "
+                << writerStats.filesFailed << L" failed, deepest queue " << writerStats.maxQueuedFiles
+                << L" files, " << writerStats.submitStalls << L" capture stalls.\n";
+        }
+    }
+
+    if (streaming && streamTarget != L"-")
+    {
+        // Let a pipe reader drain what is buffered before the pipe goes away.
+        FlushFileBuffers(streamHandle);
+        CloseHandle(streamHandle);
+    }
+
+    if (stats)
+    {
+        // Drain the console first so the report counts every lost log line.
+        FlushLog();
+        std::string json = stats->ToJson(LogLinesDropped());
+        if (WriteBufferToFile(statsPath, std::vector<uint8_t>(json.begin(), json.end())))
+            LogResult() << L"Stats saved as " << statsPath << L"\n";
+        else
+            std::wcerr << L"Failed to write stats (" << statsPath << L")." << std::endl;
+    }
+
     GdiplusShutdown(gdiplusToken);
     if (verbose)
-        std::wcout << L"[INFO] Done.\n";
-    return 0;
+        LogInfo() << L"[INFO] Done.\n";
+    FlushLog();
+    return exitCode;
 }
\ No newline at end of file
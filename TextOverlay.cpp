@@ -0,0 +1,304 @@
+#include "TextOverlay.h"
+#include "CpuFeatures.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#if defined(SHOTCAP_SSE2)
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    // 5x7 glyphs for ' ' to '~', one byte per column, bit 0 the top row.
+    const uint8_t kFont5x7[95][5] =
+    {
+        { 0x00, 0x00, 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x5F, 0x00, 0x00 }, { 0x00, 0x07, 0x00, 0x07, 0x00 },
+        { 0x14, 0x7F, 0x14, 0x7F, 0x14 }, { 0x24, 0x2A, 0x7F, 0x2A, 0x12 }, { 0x23, 0x13, 0x08, 0x64, 0x62 },
+        { 0x36, 0x49, 0x55, 0x22, 0x50 }, { 0x00, 0x05, 0x03, 0x00, 0x00 }, { 0x00, 0x1C, 0x22, 0x41, 0x00 },
+        { 0x00, 0x41, 0x22, 0x1C, 0x00 }, { 0x08, 0x2A, 0x1C, 0x2A, 0x08 }, { 0x08, 0x08, 0x3E, 0x08, 0x08 },
+        { 0x00, 0x50, 0x30, 0x00, 0x00 }, { 0x08, 0x08, 0x08, 0x08, 0x08 }, { 0x00, 0x60, 0x60, 0x00, 0x00 },
+        { 0x20, 0x10, 0x08, 0x04, 0x02 }, { 0x3E, 0x51, 0x49, 0x45, 0x3E }, { 0x00, 0x42, 0x7F, 0x40, 0x00 },
+        { 0x42, 0x61, 0x51, 0x49, 0x46 }, { 0x21, 0x41, 0x45, 0x4B, 0x31 }, { 0x18, 0x14, 0x12, 0x7F, 0x10 },
+        { 0x27, 0x45, 0x45, 0x45, 0x39 }, { 0x3C, 0x4A, 0x49, 0x49, 0x30 }, { 0x01, 0x71, 0x09, 0x05, 0x03 },
+        { 0x36, 0x49, 0x49, 0x49, 0x36 }, { 0x06, 0x49, 0x49, 0x29, 0x1E }, { 0x00, 0x36, 0x36, 0x00, 0x00 },
+        { 0x00, 0x56, 0x36, 0x00, 0x00 }, { 0x08, 0x14, 0x22, 0x41, 0x00 }, { 0x14, 0x14, 0x14, 0x14, 0x14 },
+        { 0x00, 0x41, 0x22, 0x14, 0x08 }, { 0x02, 0x01, 0x51, 0x09, 0x06 }, { 0x32, 0x49, 0x79, 0x41, 0x3E },
+        { 0x7E, 0x11, 0x11, 0x11, 0x7E }, { 0x7F, 0x49, 0x49, 0x49, 0x36 }, { 0x3E, 0x41, 0x41, 0x41, 0x22 },
+        { 0x7F, 0x41, 0x41, 0x22, 0x1C }, { 0x7F, 0x49, 0x49, 0x49, 0x41 }, { 0x7F, 0x09, 0x09, 0x09, 0x01 },
+        { 0x3E, 0x41, 0x49, 0x49, 0x7A }, { 0x7F, 0x08, 0x08, 0x08, 0x7F }, { 0x00, 0x41, 0x7F, 0x41, 0x00 },
+        { 0x20, 0x40, 0x41, 0x3F, 0x01 }, { 0x7F, 0x08, 0x14, 0x22, 0x41 }, { 0x7F, 0x40, 0x40, 0x40, 0x40 },
+        { 0x7F, 0x02, 0x0C, 0x02, 0x7F }, { 0x7F, 0x04, 0x08, 0x10, 0x7F }, { 0x3E, 0x41, 0x41, 0x41, 0x3E },
+        { 0x7F, 0x09, 0x09, 0x09, 0x06 }, { 0x3E, 0x41, 0x51, 0x21, 0x5E }, { 0x7F, 0x09, 0x19, 0x29, 0x46 },
+        { 0x46, 0x49, 0x49, 0x49, 0x31 }, { 0x01, 0x01, 0x7F, 0x01, 0x01 }, { 0x3F, 0x40, 0x40, 0x40, 0x3F },
+        { 0x1F, 0x20, 0x40, 0x20, 0x1F }, { 0x3F, 0x40, 0x38, 0x40, 0x3F }, { 0x63, 0x14, 0x08, 0x14, 0x63 },
+        { 0x07, 0x08, 0x70, 0x08, 0x07 }, { 0x61, 0x51, 0x49, 0x45, 0x43 }, { 0x00, 0x7F, 0x41, 0x41, 0x00 },
+        { 0x02, 0x04, 0x08, 0x10, 0x20 }, { 0x00, 0x41, 0x41, 0x7F, 0x00 }, { 0x04, 0x02, 0x01, 0x02, 0x04 },
+        { 0x40, 0x40, 0x40, 0x40, 0x40 }, { 0x00, 0x01, 0x02, 0x04, 0x00 }, { 0x20, 0x54, 0x54, 0x54, 0x78 },
+        { 0x7F, 0x48, 0x44, 0x44, 0x38 }, { 0x38, 0x44, 0x44, 0x44, 0x20 }, { 0x38, 0x44, 0x44, 0x48, 0x7F },
+        { 0x38, 0x54, 0x54, 0x54, 0x18 }, { 0x08, 0x7E, 0x09, 0x01, 0x02 }, { 0x0C, 0x52, 0x52, 0x52, 0x3E },
+        { 0x7F, 0x08, 0x04, 0x04, 0x78 }, { 0x00, 0x44, 0x7D, 0x40, 0x00 }, { 0x20, 0x40, 0x44, 0x3D, 0x00 },
+        { 0x7F, 0x10, 0x28, 0x44, 0x00 }, { 0x00, 0x41, 0x7F, 0x40, 0x00 }, { 0x7C, 0x04, 0x18, 0x04, 0x78 },
+        { 0x7C, 0x08, 0x04, 0x04, 0x78 }, { 0x38, 0x44, 0x44, 0x44, 0x38 }, { 0x7C, 0x14, 0x14, 0x14, 0x08 },
+        { 0x08, 0x14, 0x14, 0x18, 0x7C }, { 0x7C, 0x08, 0x04, 0x04, 0x08 }, { 0x48, 0x54, 0x54, 0x54, 0x20 },
+        { 0x04, 0x3F, 0x44, 0x40, 0x20 }, { 0x3C, 0x40, 0x40, 0x20, 0x7C }, { 0x1C, 0x20, 0x40, 0x20, 0x1C },
+        { 0x3C, 0x40, 0x30, 0x40, 0x3C }, { 0x44, 0x28, 0x10, 0x28, 0x44 }, { 0x0C, 0x50, 0x50, 0x50, 0x3C },
+        { 0x44, 0x64, 0x54, 0x4C, 0x44 }, { 0x00, 0x08, 0x36, 0x41, 0x00 }, { 0x00, 0x00, 0x7F, 0x00, 0x00 },
+        { 0x00, 0x41, 0x36, 0x08, 0x00 }, { 0x02, 0x01, 0x02, 0x04, 0x02 }
+    };
+    const int kFontColumns = 5;
+    const int kFontRows = 8;
+    const int kCellColumns = 6;     // One column of spacing.
+    const int kCellRows = 9;        // One row above the glyph.
+
+    // x / 255, rounded, for x up to 255 * 255.
+    inline uint32_t Div255(uint32_t x)
+    {
+        x += 128;
+        return (x + (x >> 8)) >> 8;
+    }
+
+    // Premultiplied BGRA of a straight 0xAARRGGBB colour at a coverage.
+    inline void Premultiply(uint32_t color, uint32_t coverage, uint8_t* out)
+    {
+        uint32_t alpha = Div255((color >> 24) * coverage);
+        out[0] = static_cast<uint8_t>(Div255((color & 0xFF) * alpha));
+        out[1] = static_cast<uint8_t>(Div255(((color >> 8) & 0xFF) * alpha));
+        out[2] = static_cast<uint8_t>(Div255(((color >> 16) & 0xFF) * alpha));
+        out[3] = static_cast<uint8_t>(alpha);
+    }
+}
+
+//---------------------------------------------------------------------
+void BlendPremultipliedRowScalar(const uint8_t* src, uint8_t* dst, int width)
+{
+    for (int x = 0; x < width; x++, src += 4, dst += 4)
+    {
+        uint32_t inverse = 255 - src[3];
+        if (inverse == 255)
+            continue;
+        for (int c = 0; c < 4; c++)
+            dst[c] = static_cast<uint8_t>(src[c] + Div255(dst[c] * inverse));
+    }
+}
+
+void BlendPremultipliedRow(const uint8_t* src, uint8_t* dst, int width)
+{
+    int x = 0;
+#if defined(SHOTCAP_SSE2)
+    // Two pixels per 16-bit half; the products stay below 2^16.
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i full = _mm_set1_epi16(255);
+    const __m128i half = _mm_set1_epi16(128);
+    for (; x + 4 <= width; x += 4)
+    {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + x * 4));
+        __m128i result = _mm_setzero_si128();
+        for (int part = 0; part < 2; part++)
+        {
+            __m128i s16 = part == 0 ? _mm_unpacklo_epi8(s, zero) : _mm_unpackhi_epi8(s, zero);
+            __m128i d16 = part == 0 ? _mm_unpacklo_epi8(d, zero) : _mm_unpackhi_epi8(d, zero);
+            __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s16, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+            __m128i t = _mm_add_epi16(_mm_mullo_epi16(d16, _mm_sub_epi16(full, alpha)), half);
+            t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+            t = _mm_add_epi16(t, s16);
+            result = part == 0 ? t : _mm_packus_epi16(result, t);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), result);
+    }
+#endif
+    BlendPremultipliedRowScalar(src + x * 4, dst + x * 4, width - x);
+}
+
+//---------------------------------------------------------------------
+BuiltinFont::BuiltinFont(int scale)
+    : scale_((std::max)(1, scale))
+{
+}
+
+int BuiltinFont::LineHeight() const
+{
+    return kCellRows * scale_;
+}
+
+bool BuiltinFont::Rasterize(wchar_t ch, std::vector<uint8_t>& coverage, int& width, int& advance)
+{
+    if (ch < 0x20 || ch > 0x7E)
+        ch = L'?';
+    const uint8_t* columns = kFont5x7[ch - 0x20];
+    width = advance = kCellColumns * scale_;
+    const int height = LineHeight();
+    coverage.assign(static_cast<size_t>(width) * height, 0);
+    for (int row = 0; row < kFontRows; row++)
+    {
+        for (int column = 0; column < kFontColumns; column++)
+        {
+            if (!(columns[column] & (1 << row)))
+                continue;
+            for (int dy = 0; dy < scale_; dy++)
+            {
+                uint8_t* out = coverage.data() + static_cast<size_t>((row + 1) * scale_ + dy) * width + column * scale_;
+                memset(out, 255, scale_);
+            }
+        }
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------
+bool ParseTextAnchor(const char* text, TextStyle& style)
+{
+    static const struct { const char* name; TextAnchor anchor; } kCorners[] =
+    {
+        { "tl", TextAnchor::TopLeft }, { "tr", TextAnchor::TopRight },
+        { "bl", TextAnchor::BottomLeft }, { "br", TextAnchor::BottomRight }
+    };
+    for (const auto& corner : kCorners)
+    {
+        if (strcmp(text, corner.name) == 0)
+        {
+            style.anchor = corner.anchor;
+            return true;
+        }
+    }
+    int x = 0, y = 0;
+    char extra = 0;
+    if (sscanf(text, "%d,%d%c", &x, &y, &extra) != 2)
+        return false;
+    style.anchor = TextAnchor::Point;
+    style.x = x;
+    style.y = y;
+    return true;
+}
+
+//---------------------------------------------------------------------
+TextOverlay::TextOverlay(std::unique_ptr<GlyphSource> glyphs, const TextStyle& style)
+    : source_(std::move(glyphs)), style_(style)
+{
+    style_.shadowOffset = (std::max)(0, style_.shadowOffset);
+}
+
+// The cell of ch, rasterized and composited over its shadow on first use.
+const TextOverlay::Glyph& TextOverlay::FindGlyph(wchar_t ch)
+{
+    auto found = glyphs_.find(ch);
+    if (found != glyphs_.end())
+        return found->second;
+
+    int width = 0, advance = 0;
+    const int lineHeight = source_->LineHeight();
+    if (!source_->Rasterize(ch, coverage_, width, advance) || width < 0 ||
+        coverage_.size() < static_cast<size_t>(width) * lineHeight)
+    {
+        width = advance = 0;
+    }
+
+    const int shift = style_.shadowOffset;
+    Glyph glyph;
+    glyph.offset = atlas_.size();
+    glyph.width = width > 0 ? width + shift : 0;
+    glyph.height = lineHeight + shift;
+    glyph.advance = advance;
+    atlas_.resize(glyph.offset + static_cast<size_t>(glyph.width) * glyph.height * 4);
+
+    auto coverageAt = [&](int x, int y) -> uint32_t
+        {
+            return x >= 0 && x < width && y >= 0 && y < lineHeight ? coverage_[static_cast<size_t>(y) * width + x] : 0;
+        };
+    uint8_t* cell = atlas_.data() + glyph.offset;
+    for (int y = 0; y < glyph.height; y++)
+    {
+        for (int x = 0; x < glyph.width; x++, cell += 4)
+        {
+            uint8_t shadow[4];
+            Premultiply(style_.shadowColor, shift > 0 ? coverageAt(x - shift, y - shift) : 0, shadow);
+            Premultiply(style_.color, coverageAt(x, y), cell);
+            BlendPremultipliedRowScalar(cell, shadow, 1);
+            memcpy(cell, shadow, 4);
+        }
+    }
+    return glyphs_.emplace(ch, glyph).first->second;
+}
+
+// Lay the cells of text out into strip_, unless it already holds it.
+void TextOverlay::Layout(const std::wstring& text)
+{
+    if (text == stripText_ && !strip_.empty())
+        return;
+
+    int pen = 0;
+    int width = 0;
+    for (wchar_t ch : text)
+    {
+        const Glyph& glyph = FindGlyph(ch);
+        width = (std::max)(width, pen + glyph.width);
+        pen += glyph.advance;
+    }
+    stripText_ = text;
+    textWidth_ = pen;
+    stripWidth_ = width;
+    stripHeight_ = source_->LineHeight() + style_.shadowOffset;
+    strip_.assign(static_cast<size_t>(stripWidth_) * stripHeight_ * 4, 0);
+
+    pen = 0;
+    for (wchar_t ch : text)
+    {
+        const Glyph& glyph = glyphs_.find(ch)->second;
+        for (int y = 0; y < glyph.height; y++)
+        {
+            const uint8_t* src = atlas_.data() + glyph.offset + static_cast<size_t>(y) * glyph.width * 4;
+            uint8_t* dst = strip_.data() + (static_cast<size_t>(y) * stripWidth_ + pen) * 4;
+            BlendPremultipliedRow(src, dst, glyph.width);
+        }
+        pen += glyph.advance;
+    }
+}
+
+void TextOverlay::Draw(const FrameView& frame, const std::wstring& text)
+{
+    if (frame.Empty() || text.empty())
+        return;
+    Layout(text);
+    if (stripWidth_ <= 0)
+        return;
+
+    const int textHeight = source_->LineHeight();
+    int left = style_.x;
+    int top = style_.y;
+    switch (style_.anchor)
+    {
+    case TextAnchor::TopLeft:
+        left = style_.margin;
+        top = style_.margin;
+        break;
+    case TextAnchor::TopRight:
+        left = frame.width - style_.margin - textWidth_;
+        top = style_.margin;
+        break;
+    case TextAnchor::BottomLeft:
+        left = style_.margin;
+        top = frame.height - style_.margin - textHeight;
+        break;
+    case TextAnchor::BottomRight:
+        left = frame.width - style_.margin - textWidth_;
+        top = frame.height - style_.margin - textHeight;
+        break;
+    case TextAnchor::Point:
+        break;
+    }
+
+    // Only the strip's rectangle, clipped, is touched.
+    const int x0 = (std::max)(left, 0);
+    const int y0 = (std::max)(top, 0);
+    const int x1 = (std::min)(left + stripWidth_, frame.width);
+    const int y1 = (std::min)(top + stripHeight_, frame.height);
+    if (x0 >= x1)
+        return;
+    for (int y = y0; y < y1; y++)
+    {
+        const uint8_t* src = strip_.data() + (static_cast<size_t>(y - top) * stripWidth_ + (x0 - left)) * 4;
+        BlendPremultipliedRow(src, frame.Row(y) + static_cast<size_t>(x0) * 4, x1 - x0);
+    }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "Frame.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Text drawn into frames for -timestamp / -text. Each glyph is rasterized
+// once into an atlas of premultiplied BGRA cells with the drop shadow
+// already composited under it. Drawing a string lays its cells out into a
+// strip (kept while the text stays the same, e.g. for every frame within
+// one second of a timestamp) and blends only that strip into the frame.
+
+// Coverage rasterizer for single glyphs. The tool renders with GDI+;
+// BuiltinFont needs nothing from the platform.
+class GlyphSource
+{
+public:
+    virtual ~GlyphSource() {}
+
+    // Height of every glyph cell in pixels.
+    virtual int LineHeight() const = 0;
+
+    // Coverage (0-255) of ch in a width x LineHeight() cell, row-major. The
+    // pen moves advance pixels on; width may be larger to keep overhangs.
+    virtual bool Rasterize(wchar_t ch, std::vector<uint8_t>& coverage, int& width, int& advance) = 0;
+};
+
+// The classic 5x7 pixel font for printable ASCII, scaled up by whole
+// pixels. Other characters are drawn as '?'.
+class BuiltinFont : public GlyphSource
+{
+public:
+    explicit BuiltinFont(int scale = 3);
+
+    int LineHeight() const override;
+    bool Rasterize(wchar_t ch, std::vector<uint8_t>& coverage, int& width, int& advance) override;
+
+private:
+    int scale_;
+};
+
+enum class TextAnchor
+{
+    TopLeft,
+    TopRight,
+    BottomLeft,
+    BottomRight,
+    Point           // Top-left corner of the text at (x, y).
+};
+
+struct TextStyle
+{
+    TextAnchor anchor = TextAnchor::BottomRight;
+    int x = 0;
+    int y = 0;
+    int margin = 10;                    // Distance from the frame edges for the corner anchors.
+    uint32_t color = 0xFFFFFFFF;        // 0xAARRGGBB, straight alpha.
+    uint32_t shadowColor = 0x80000000;
+    int shadowOffset = 2;               // Down and right; 0 for no shadow.
+};
+
+// Parse "tl", "tr", "bl", "br" or "x,y".
+bool ParseTextAnchor(const char* text, TextStyle& style);
+
+// Not thread-safe; the tool keeps one per encoder thread.
+class TextOverlay
+{
+public:
+    TextOverlay(std::unique_ptr<GlyphSource> glyphs, const TextStyle& style);
+
+    // Blend text into a 32 bpp frame, clipped to it.
+    void Draw(const FrameView& frame, const std::wstring& text);
+
+    int GlyphCount() const { return static_cast<int>(glyphs_.size()); }
+
+private:
+    struct Glyph
+    {
+        size_t offset;      // Start of the cell in atlas_.
+        int width;          // Cell size, shadow included.
+        int height;
+        int advance;
+    };
+
+    const Glyph& FindGlyph(wchar_t ch);
+    void Layout(const std::wstring& text);
+
+    std::unique_ptr<GlyphSource> source_;
+    TextStyle style_;
+    std::unordered_map<wchar_t, Glyph> glyphs_;
+    std::vector<uint8_t> atlas_;
+    std::vector<uint8_t> coverage_;
+
+    std::wstring stripText_;
+    std::vector<uint8_t> strip_;        // Premultiplied BGRA, stripWidth_ x stripHeight_.
+    int stripWidth_ = 0;
+    int stripHeight_ = 0;
+    int textWidth_ = 0;                 // Pen advance of the text, without the shadow.
+};
+
+//---------------------------------------------------------------------
+// Row kernel behind Draw: dst = src + dst * (255 - src alpha) / 255 for
+// width premultiplied BGRA pixels, rounded. SSE2 where the build has it;
+// both paths give the same bytes.
+void BlendPremultipliedRow(const uint8_t* src, uint8_t* dst, int width);
+void BlendPremultipliedRowScalar(const uint8_t* src, uint8_t* dst, int width);
@@ -0,0 +1,114 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+
+//---------------------------------------------------------------------
+struct ThreadPool::Job
+{
+    const std::function<void(int)>* task = nullptr;
+    int count = 0;
+    int helpersLeft = 0;                // Workers that may still join (guarded by mutex_).
+    std::atomic<int> next{ 0 };
+    std::atomic<int> done{ 0 };
+    std::mutex mutex;
+    std::condition_variable finished;
+};
+
+ThreadPool::ThreadPool(int threads)
+{
+    if (threads <= 0)
+        threads = (std::max)(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    for (int t = 0; t < threads; t++)
+        workers_.emplace_back([this] { WorkerLoop(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& worker : workers_)
+        worker.join();
+}
+
+// Claim and run items until none are left; the thread finishing the last
+// one wakes the caller.
+void ThreadPool::RunItems(Job& job)
+{
+    int ran = 0;
+    for (int i = job.next.fetch_add(1); i < job.count; i = job.next.fetch_add(1))
+    {
+        (*job.task)(i);
+        ran++;
+    }
+    if (ran > 0 && job.done.fetch_add(ran) + ran == job.count)
+    {
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.finished.notify_all();
+    }
+}
+
+void ThreadPool::WorkerLoop()
+{
+    for (;;)
+    {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+            if (stopping_)
+                return;
+            job = jobs_.front();
+            if (--job->helpersLeft <= 0 || job->next.load() >= job->count)
+                jobs_.pop_front();
+        }
+        RunItems(*job);
+    }
+}
+
+void ThreadPool::ParallelFor(int count, const std::function<void(int)>& task, int maxThreads)
+{
+    if (count <= 0)
+        return;
+    int helpers = (std::min)(count - 1, WorkerCount());
+    if (maxThreads > 0)
+        helpers = (std::min)(helpers, maxThreads - 1);
+    if (helpers <= 0)
+    {
+        for (int i = 0; i < count; i++)
+            task(i);
+        return;
+    }
+
+    std::shared_ptr<Job> job = std::make_shared<Job>();
+    job->task = &task;
+    job->count = count;
+    job->helpersLeft = helpers;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back(job);
+    }
+    for (int h = 0; h < helpers; h++)
+        wake_.notify_one();
+
+    RunItems(*job);
+
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->finished.wait(lock, [&] { return job->done.load() == job->count; });
+}
+
+int ThreadPool::Concurrency() const
+{
+    const int cores = static_cast<int>(std::thread::hardware_concurrency());
+    const int threads = WorkerCount() + 1;
+    return cores > 0 ? (std::min)(threads, cores) : threads;
+}
+
+ThreadPool& SharedThreadPool()
+{
+    static ThreadPool pool;
+    return pool;
+}
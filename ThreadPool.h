@@ -0,0 +1,52 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Fixed set of worker threads for splitting one frame's work into
+// independent pieces (encoder strips, restart intervals). Any number of
+// threads may call ParallelFor at the same time: jobs are served in order,
+// and the calling thread always works on its own job too, so a call makes
+// progress even when every worker is busy elsewhere.
+class ThreadPool
+{
+public:
+    // threads <= 0 starts one worker per hardware thread, less one for the
+    // caller.
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+    // Run task(0) .. task(count - 1), spread over at most maxThreads threads
+    // including the caller (0 = no limit), and return when all are done.
+    void ParallelFor(int count, const std::function<void(int)>& task, int maxThreads = 0);
+
+    int WorkerCount() const { return static_cast<int>(workers_.size()); }
+
+    // Threads that can actually run a ParallelFor side by side, the caller
+    // included: fewer than WorkerCount() + 1 on a machine with fewer cores.
+    int Concurrency() const;
+
+private:
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    struct Job;
+
+    void WorkerLoop();
+    static void RunItems(Job& job);
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<std::shared_ptr<Job>> jobs_;
+    bool stopping_ = false;
+};
+
+// Process-wide pool, started on first use.
+ThreadPool& SharedThreadPool();
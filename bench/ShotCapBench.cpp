@@ -0,0 +1,946 @@
+//---------------------------------------------------------------------
+// ShotCapBench: times the portable hot paths of ShotCap (encoders,
+// checksums, change probe, sequence container, repeat pipeline) on
+// reproducible synthetic frames. Runs headless; see CONTRIBUTING.md for
+// build instructions on Windows and Linux.
+
+#include "SyntheticFrames.h"
+
+#include "BandedCapture.h"
+#include "CapturePipeline.h"
+#include "CaptureService.h"
+#include "ChangeDetector.h"
+#include "Checksum.h"
+#include "CpuFeatures.h"
+#include "Deflate.h"
+#include "DesktopCapture.h"
+#include "ImageCompare.h"
+#include "Inflate.h"
+#include "JpegEncoder.h"
+#include "PixelConvert.h"
+#include "PngDecoder.h"
+#include "PngEncoder.h"
+#include "QoiCodec.h"
+#include "Redaction.h"
+#include "RegionFanOut.h"
+#include "Resampler.h"
+#include "SeqContainer.h"
+#include "TextOverlay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cwchar>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    double SecondsSince(Clock::time_point start)
+    {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    struct BenchContext
+    {
+        SyntheticContent content;
+        int width;
+        int height;
+        uint32_t seed;
+        const std::vector<uint8_t>* frame;      // Frame 0 of the content.
+    };
+
+    // Timed work of one iteration. Preparation done outside the timed
+    // sections does not count.
+    struct BenchRun
+    {
+        double seconds = 0.0;
+        int frames = 0;
+        size_t outputBytes = 0;
+    };
+
+    typedef std::function<void(BenchRun&)> StageRunner;
+    typedef std::function<StageRunner(const BenchContext&)> StageFactory;
+
+    struct Stage
+    {
+        const char* name;
+        const char* kind;       // "encoder", "kernel" or "pipeline"
+        StageFactory create;
+    };
+
+    const int kSequenceFrames = 8;
+
+    // threads as in PngOptions: 0 spreads the strips over the shared pool.
+    StageFactory PngStage(CompressionLevel level, int threads = 0, PaletteMode palette = PaletteMode::Off)
+    {
+        return [level, threads, palette](const BenchContext& ctx) -> StageRunner
+            {
+                std::shared_ptr<PngEncoder> encoder(new PngEncoder());
+                std::shared_ptr<std::vector<uint8_t>> out(new std::vector<uint8_t>());
+                return [=](BenchRun& run)
+                    {
+                        PngOptions options;
+                        options.level = level;
+                        options.threads = threads;
+                        options.palette = palette;
+                        auto start = Clock::now();
+                        encoder->Encode(ctx.frame->data(), ctx.width, ctx.height, ctx.width * 4, options, *out);
+                        run.seconds += SecondsSince(start);
+                        run.frames++;
+                        run.outputBytes += out->size();
+                    };
+            };
+    }
+
+    StageFactory JpegStage(ChromaSubsampling subsampling)
+    {
+        return [subsampling](const BenchContext& ctx) -> StageRunner
+            {
+                std::shared_ptr<JpegEncoder> encoder(new JpegEncoder());
+                std::shared_ptr<std::vector<uint8_t>> out(new std::vector<uint8_t>());
+                return [=](BenchRun& run)
+                    {
+                        FrameView frame;
+                        frame.data = const_cast<uint8_t*>(ctx.frame->data());
+                        frame.width = ctx.width;
+                        frame.height = ctx.height;
+                        frame.stride = ctx.width * 4;
+                        JpegOptions options;
+                        options.subsampling = subsampling;
+                        auto start = Clock::now();
+                        encoder->Encode(frame, options, *out);
+                        run.seconds += SecondsSince(start);
+                        run.frames++;
+                        run.outputBytes += out->size();
+                    };
+            };
+    }
+
+    StageRunner QoiStage(const BenchContext& ctx)
+    {
+        std::shared_ptr<std::vector<uint8_t>> out(new std::vector<uint8_t>());
+        return [=](BenchRun& run)
+            {
+                FrameView frame;
+                frame.data = const_cast<uint8_t*>(ctx.frame->data());
+                frame.width = ctx.width;
+                frame.height = ctx.height;
+                frame.stride = ctx.width * 4;
+                auto start = Clock::now();
+                EncodeQoi(frame, *out);
+                run.seconds += SecondsSince(start);
+                run.frames++;
+                run.outputBytes += out->size();
+            };
+    }
+
+    // -bands: the frame goes through the row-streaming encoder 64 rows at
+    // a time; the "grab" copies each band out of the frame and the output
+    // is only counted.
+    StageFactory BandsStage(BandFormat format)
+    {
+        return [format](const BenchContext& ctx) -> StageRunner
+            {
+                return [=](BenchRun& run)
+                    {
+                        PngOptions png;
+                        png.level = CompressionLevel::Fast;
+                        std::unique_ptr<RowStreamEncoder> encoder = CreateRowStreamEncoder(format, png);
+                        BandedCaptureOptions options;
+                        options.bandRows = 64;
+                        size_t bytes = 0;
+                        auto start = Clock::now();
+                        CaptureInBands(ctx.width, ctx.height, *encoder, options,
+                            [&](int top, int rows, Frame& band) -> bool
+                            {
+                                band.Allocate(ctx.width, rows, FrameFormat::Bgrx32);
+                                for (int y = 0; y < rows; y++)
+                                    memcpy(band.View().Row(y), ctx.frame->data() + static_cast<size_t>(top + y) * ctx.width * 4, ctx.width * 4);
+                                return true;
+                            },
+                            [&](const uint8_t*, size_t size) -> bool
+                            {
+                                bytes += size;
+                                return true;
+                            });
+                        run.seconds += SecondsSince(start);
+                        run.frames++;
+                        run.outputBytes += bytes;
+                    };
+            };
+    }
+
+    StageRunner SeqStage(const BenchContext& ctx)
+    {
+        return [=](BenchRun& run)
+            {
+                SeqOptions options;
+                options.level = CompressionLevel::Fast;
+                SeqWriter writer(options);
+                std::vector<uint8_t> pixels, out;
+                for (int i = 0; i < kSequenceFrames; i++)
+                {
+                    if (i == 0)
+                        pixels = *ctx.frame;
+                    else
+                        GenerateFrame(ctx.content, ctx.width, ctx.height, ctx.seed, i, pixels);
+                    out.clear();
+                    auto start = Clock::now();
+                    writer.AddFrame(pixels.data(), ctx.width, ctx.height, ctx.width * 4, 1000 * i, out);
+                    run.seconds += SecondsSince(start);
+                    run.frames++;
+                    run.outputBytes += out.size();
+                }
+            };
+    }
+
+    StageRunner InflateStage(const BenchContext& ctx)
+    {
+        std::shared_ptr<std::vector<uint8_t>> compressed(new std::vector<uint8_t>());
+        DeflateStream deflate(CompressionLevel::Fast);
+        deflate.Write(ctx.frame->data(), ctx.frame->size(), *compressed);
+        deflate.Finish(*compressed);
+        std::shared_ptr<std::vector<uint8_t>> out(new std::vector<uint8_t>());
+        out->reserve(ctx.frame->size());
+        return [=](BenchRun& run)
+            {
+                out->clear();
+                auto start = Clock::now();
+                InflateRaw(compressed->data(), compressed->size(), *out);
+                run.seconds += SecondsSince(start);
+                run.frames++;
+                run.outputBytes += out->size();
+            };
+    }
+
+    // -compare reading a baseline: the frame as written by -fast.
+    StageRunner PngDecodeStage(const BenchContext& ctx)
+    {
+        std::shared_ptr<std::vector<uint8_t>> png(new std::vector<uint8_t>());
+        PngEncoder encoder;
+        PngOptions options;
+        options.level = CompressionLevel::Fast;
+        encoder.Encode(ctx.frame->data(), ctx.width, ctx.height, ctx.width * 4, options, *png);
+        std::shared_ptr<std::vector<uint8_t>> pixels(new std::vector<uint8_t>());
+        return [=](BenchRun& run)
+            {
+                int width = 0, height = 0, channels = 0;
+                auto start = Clock::now();
+                DecodePng(png->data(), png->size(), *pixels, width, height, channels);
+                run.seconds += SecondsSince(start);
+                run.frames++;
+                run.outputBytes += pixels->size();
+            };
+    }
+
+    StageRunner Crc32Stage(const BenchContext& ctx)
+    {
+        return [=](BenchRun& run)
+            {
+                auto start = Clock::now();
+                volatile uint32_t crc = Crc32(0, ctx.frame->data(), ctx.frame->size());
+                (void)crc;
+                run.seconds += SecondsSince(start);
+                run.frames++;
+            };
+    }
+
+    StageRunner Adler32Stage(const BenchContext& ctx)
+    {
+        return [=](BenchRun& run)
+            {
+                auto start = Clock::now();
+                volatile uint32_t adler = Adler32(1, ctx.frame->data(), ctx.frame->size());
+                (void)adler;
+                run.seconds += SecondsSince(start);
+                run.frames++;
+            };
+    }
+
+    StageRunner ChangeProbeStage(const BenchContext& ctx)
+    {
+        std::shared_ptr<ChangeDetector> detector(new ChangeDetector());
+        detector->SetReference(ctx.frame->data(), ctx.width, ctx.height, ctx.width * 4);
+        std::shared_ptr<std::vector<uint8_t>> next(new std::vector<uint8_t>());
+        GenerateFrame(ctx.content, ctx.width, ctx.height, ctx.seed, 1, *next);
+        return [=](BenchRun& run)
+            {
+                auto start = Clock::now();
+                volatile double changed = detector->Measure(next->data(), ctx.width, ctx.height, ctx.width * 4);
+                (void)changed;
+                run.seconds += SecondsSince(start);
+                run.frames++;
+            };
+    }
+
+    // One pixel conversion over every row of the frame, with the kernels
+    // this CPU dispatches to.
+    StageFactory RowKernelStage(void (*PixelKernels::*kernel)(const uint8_t*, uint8_t*, int), int outBytes)
+    {
+        return [=](const BenchContext& ctx) -> StageRunner
+            {
+                std::shared_ptr<std::vector<uint8_t>> out(
+                    new std::vector<uint8_t>(static_cast<size_t>(ctx.width) * ctx.height * outBytes));
+                return [=](BenchRun& run)
+                    {
+                        auto convert = ActivePixelKernels().*kernel;
+                        auto start = Clock::now();
+                        for (int y = 0; y < ctx.height; y++)
+                        {
+                            convert(ctx.frame->data() + static_cast<size_t>(y) * ctx.width * 4,
+                                out->data() + static_cast<size_t>(y) * ctx.width * outBytes, ctx.width);
+                        }
+                        run.seconds += SecondsSince(start);
+                        run.frames++;
+                        run.outputBytes += out->size();
+                    };
+            };
+    }
+
+    StageRunner FlipRowsStage(const BenchContext& ctx)
+    {
+        std::shared_ptr<std::vector<uint8_t>> pixels(new std::vector<uint8_t>(*ctx.frame));
+        return [=](BenchRun& run)
+            {
+                auto start = Clock::now();
+                FlipRows(pixels->data(), static_cast<size_t>(ctx.width) * 4, ctx.height, ctx.width * 4);
+                run.seconds += SecondsSince(start);
+                run.frames++;
+            };
+    }
+
+    // A -timestamp overlay whose text changes every frame, so each run lays
+    // out and blends a new strip from the cached glyphs.
+    StageRunner TextOverlayStage(const BenchContext& ctx)
+    {
+        std::shared_ptr<std::vector<uint8_t>> pixels(new std::vector<uint8_t>(*ctx.frame));
+        std::shared_ptr<TextOverlay> overlay(
+            new TextOverlay(std::unique_ptr<GlyphSource>(new BuiltinFont()), TextStyle()));
+        std::shared_ptr<int> second(new int(0));
+        return [=](BenchRun& run)
+            {
+                FrameView view;
+                view.data = pixels->data();
+                view.width = ctx.width;
+                view.height = ctx.height;
+                view.stride = ctx.width * 4;
+                wchar_t text[32];
+                swprintf(text, 32, L"2024-06-01 12:%02d:%02d", *second / 60 % 60, *second % 60);
+                ++*second;
+                auto start = Clock::now();
+                overlay->Draw(view, text);
+                run.seconds += SecondsSince(start);
+                run.frames++;
+            };
+    }
+
+    // -redact over the whole frame, the worst case: every pixel is read and
+    // written by each pass of the style.
+    StageFactory RedactStage(RedactMode mode)
+    {
+        return [mode](const BenchContext& ctx) -> StageRunner
+            {
+                std::shared_ptr<std::vector<uint8_t>> pixels(new std::vector<uint8_t>(*ctx.frame));
+                std::vector<RedactRegion> regions(1);
+                regions[0].rect.right = ctx.width;
+                regions[0].rect.bottom = ctx.height;
+                regions[0].style.mode = mode;
+                return [=](BenchRun& run)
+                    {
+                        FrameView view;
+                        view.data = pixels->data();
+                        view.width = ctx.width;
+                        view.height = ctx.height;
+                        view.stride = ctx.width * 4;
+                        auto start = Clock::now();
+                        ApplyRedactions(view, 0, 0, regions);
+                        run.seconds += SecondsSince(start);
+                        run.frames++;
+                    };
+            };
+    }
+
+    FrameView BenchView(const std::vector<uint8_t>& pixels, const BenchContext& ctx)
+    {
+        FrameView view;
+        view.data = const_cast<uint8_t*>(pixels.data());
+        view.width = ctx.width;
+        view.height = ctx.height;
+        view.stride = ctx.width * 4;
+        return view;
+    }
+
+    // -compare of frames 0 and 1 of the content, over the whole pool; with
+    // diff, the highlighted diff image is rendered too.
+    StageFactory CompareStage(bool diff)
+    {
+        return [diff](const BenchContext& ctx) -> StageRunner
+            {
+                std::shared_ptr<std::vector<uint8_t>> next(new std::vector<uint8_t>());
+                GenerateFrame(ctx.content, ctx.width, ctx.height, ctx.seed, 1, *next);
+                std::shared_ptr<Frame> out(new Frame());
+                return [=](BenchRun& run)
+                    {
+                        const FrameView a = BenchView(*ctx.frame, ctx);
+                        const FrameView b = BenchView(*next, ctx);
+                        CompareResult result;
+                        auto start = Clock::now();
+                        CompareImages(a, b, 0, result);
+                        if (diff)
+                            RenderDiff(a, b, 0, result, *out);
+                        run.seconds += SecondsSince(start);
+                        run.frames++;
+                    };
+            };
+    }
+
+    // Monitors cut out of the synthetic frame: the frame itself as the
+    // primary, a 3/4-size one to its right set lower, and a narrow one to
+    // its left set higher, so the stitched desktop has gaps to fill.
+    class SyntheticMonitors : public MonitorSource
+    {
+    public:
+        explicit SyntheticMonitors(const BenchContext& ctx) : ctx_(ctx)
+        {
+            const int w = ctx.width, h = ctx.height;
+            layout_.resize(3);
+            layout_[0].right = w;
+            layout_[0].bottom = h;
+            layout_[1].left = w;
+            layout_[1].top = h / 4;
+            layout_[1].right = w + w * 3 / 4;
+            layout_[1].bottom = h / 4 + h * 3 / 4;
+            layout_[2].left = -h * 9 / 16;
+            layout_[2].top = -h / 8;
+            layout_[2].right = 0;
+            layout_[2].bottom = h - h / 8;
+        }
+
+        bool Monitors(std::vector<DesktopRect>& monitors) override
+        {
+            monitors = layout_;
+            return true;
+        }
+
+        // Copy the top-left corner of the frame, as a grab would copy the screen.
+        bool Grab(int index, Frame& frame) override
+        {
+            const DesktopRect& r = layout_[index];
+            FrameView source;
+            source.data = const_cast<uint8_t*>(ctx_.frame->data());
+            source.width = ctx_.width;
+            source.height = ctx_.height;
+            source.stride = ctx_.width * 4;
+            frame.Allocate(r.Width(), r.Height(), FrameFormat::Bgrx32);
+            return CopyFrame(source.Crop(0, 0, r.Width(), r.Height()), frame.View());
+        }
+
+    private:
+        BenchContext ctx_;
+        std::vector<DesktopRect> layout_;
+    };
+
+    // -all: grab three monitors in parallel and stitch them into one frame.
+    // -scale / -thumb: resize to numerator/denominator of the frame, or,
+    // with a zero denominator, to fit numerator pixels across.
+    StageFactory ResampleStage(int numerator, int denominator)
+    {
+        return [numerator, denominator](const BenchContext& ctx) -> StageRunner
+            {
+                int width, height;
+                if (denominator)
+                {
+                    width = ctx.width * numerator / denominator;
+                    height = ctx.height * numerator / denominator;
+                }
+                else
+                {
+                    FitSize(numerator, 0, ctx.width, ctx.height, width, height);
+                }
+                std::shared_ptr<Resampler> resampler(new Resampler());
+                std::shared_ptr<Frame> out(new Frame());
+                out->Allocate(width, height, FrameFormat::Bgrx32);
+                return [=](BenchRun& run)
+                    {
+                        FrameView frame;
+                        frame.data = const_cast<uint8_t*>(ctx.frame->data());
+                        frame.width = ctx.width;
+                        frame.height = ctx.height;
+                        frame.stride = ctx.width * 4;
+                        auto start = Clock::now();
+                        resampler->Resample(frame, out->View());
+                        run.seconds += SecondsSince(start);
+                        run.frames++;
+                        run.outputBytes += static_cast<size_t>(width) * height * 4;
+                    };
+            };
+    }
+
+    StageRunner DesktopStitchStage(const BenchContext& ctx)
+    {
+        std::shared_ptr<SyntheticMonitors> monitors(new SyntheticMonitors(ctx));
+        std::shared_ptr<DesktopCapture> desktop(new DesktopCapture(*monitors, DesktopCaptureOptions()));
+        std::shared_ptr<Frame> out(new Frame());
+        // The capture only keeps a reference to its source.
+        return [monitors, desktop, out](BenchRun& run)
+            {
+                auto start = Clock::now();
+                if (desktop->Grab())
+                    desktop->Stitch(*out);
+                run.seconds += SecondsSince(start);
+                run.frames++;
+                run.outputBytes += static_cast<size_t>(out->Width()) * out->Height() * 4;
+            };
+    }
+
+    // 24 overlapping regions of one grab (a 6 x 4 grid of cells half again
+    // as large as their spacing), each encoded as fast PNG in parallel.
+    StageRunner RegionFanOutStage(const BenchContext& ctx)
+    {
+        std::shared_ptr<std::vector<RegionSpec>> regions(new std::vector<RegionSpec>());
+        const int stepX = ctx.width / 6, stepY = ctx.height / 4;
+        for (int row = 0; row < 4; row++)
+        {
+            for (int column = 0; column < 6; column++)
+            {
+                RegionSpec region;
+                region.rect.left = column * stepX;
+                region.rect.top = row * stepY;
+                region.rect.right = region.rect.left + stepX * 3 / 2;
+                region.rect.bottom = region.rect.top + stepY * 3 / 2;
+                regions->push_back(region);
+            }
+        }
+        std::shared_ptr<std::vector<std::vector<uint8_t>>> encoded(
+            new std::vector<std::vector<uint8_t>>(regions->size()));
+        return [=](BenchRun& run)
+            {
+                FrameView grab;
+                grab.data = const_cast<uint8_t*>(ctx.frame->data());
+                grab.width = ctx.width;
+                grab.height = ctx.height;
+                grab.stride = ctx.width * 4;
+                DesktopRect bounds;
+                bounds.right = ctx.width;
+                bounds.bottom = ctx.height;
+                auto start = Clock::now();
+                FanOutRegions(grab, bounds, *regions, [&](int index, const FrameView& crop) -> bool
+                    {
+                        thread_local PngEncoder encoder;
+                        PngOptions png;
+                        png.level = CompressionLevel::Fast;
+                        return encoder.Encode(crop, png, (*encoded)[index]);
+                    });
+                run.seconds += SecondsSince(start);
+                run.frames++;
+                for (const auto& bytes : *encoded)
+                    run.outputBytes += bytes.size();
+            };
+    }
+
+    // The -repeat pipeline with an instant grab (one copy of the frame), fast
+    // PNG encoding on every core and a writer that only counts bytes.
+    StageRunner PipelineStage(const BenchContext& ctx)
+    {
+        return [=](BenchRun& run)
+            {
+                FrameView source;
+                source.data = const_cast<uint8_t*>(ctx.frame->data());
+                source.width = ctx.width;
+                source.height = ctx.height;
+                source.stride = ctx.width * 4;
+                PipelineOptions options;
+                options.frameCount = kSequenceFrames * 2;
+                size_t written = 0;
+                auto start = Clock::now();
+                RunCapturePipeline(options,
+                    [&](PipelineFrame& frame) -> bool
+                    {
+                        frame.image.Allocate(ctx.width, ctx.height, FrameFormat::Bgrx32);
+                        return CopyFrame(source, frame.image.View());
+                    },
+                    [&](PipelineFrame& frame) -> bool
+                    {
+                        thread_local PngEncoder encoder;
+                        PngOptions png;
+                        png.level = CompressionLevel::Fast;
+                        return encoder.Encode(frame.image.View(), png, frame.encoded);
+                    },
+                    [&](PipelineFrame& frame)
+                    {
+                        written += frame.encoded.size();
+                    });
+                run.seconds += SecondsSince(start);
+                run.frames += options.frameCount;
+                run.outputBytes += written;
+            };
+    }
+
+    // Scripted -serve client: sends its request lines and collects replies.
+    class ScriptedConnection : public ServiceConnection
+    {
+    public:
+        explicit ScriptedConnection(const std::deque<std::string>& requests) : requests_(requests) {}
+
+        bool ReadLine(std::string& line) override
+        {
+            if (requests_.empty())
+                return false;
+            line = requests_.front();
+            requests_.pop_front();
+            return true;
+        }
+
+        bool WriteLine(const std::string& line) override
+        {
+            replyBytes += line.size();
+            return true;
+        }
+
+        size_t replyBytes = 0;
+
+    private:
+        std::deque<std::string> requests_;
+    };
+
+    // -serve with inline replies: parse, queue, fast PNG on the worker
+    // threads and base64 JSON replies, for one client.
+    // -compare of two directories: each pair is read from PNG and compared
+    // on one thread, the way a batch spreads pairs over the pool.
+    StageRunner ComparePairStage(const BenchContext& ctx)
+    {
+        std::shared_ptr<std::vector<uint8_t>> pngA(new std::vector<uint8_t>());
+        std::shared_ptr<std::vector<uint8_t>> pngB(new std::vector<uint8_t>());
+        std::vector<uint8_t> next;
+        GenerateFrame(ctx.content, ctx.width, ctx.height, ctx.seed, 1, next);
+        PngEncoder encoder;
+        PngOptions options;
+        options.level = CompressionLevel::Fast;
+        encoder.Encode(ctx.frame->data(), ctx.width, ctx.height, ctx.width * 4, options, *pngA);
+        encoder.Encode(next.data(), ctx.width, ctx.height, ctx.width * 4, options, *pngB);
+        std::shared_ptr<std::vector<uint8_t>> pixelsA(new std::vector<uint8_t>());
+        std::shared_ptr<std::vector<uint8_t>> pixelsB(new std::vector<uint8_t>());
+        return [=](BenchRun& run)
+            {
+                int width = 0, height = 0, channels = 0;
+                CompareResult result;
+                auto start = Clock::now();
+                DecodePng(pngA->data(), pngA->size(), *pixelsA, width, height, channels);
+                DecodePng(pngB->data(), pngB->size(), *pixelsB, width, height, channels);
+                CompareImages(BenchView(*pixelsA, ctx), BenchView(*pixelsB, ctx), 0, result, 1);
+                run.seconds += SecondsSince(start);
+                run.frames++;
+                run.outputBytes += pngA->size() + pngB->size();
+            };
+    }
+
+    StageRunner ServiceInlineStage(const BenchContext& ctx)
+    {
+        std::shared_ptr<CaptureService> service(new CaptureService(
+            [ctx](const ServiceRequest& request, ServiceReply& reply)
+            {
+                FrameView frame;
+                frame.data = const_cast<uint8_t*>(ctx.frame->data());
+                frame.width = ctx.width;
+                frame.height = ctx.height;
+                frame.stride = ctx.width * 4;
+                thread_local PngEncoder encoder;
+                PngOptions png;
+                png.level = CompressionLevel::Fast;
+                reply.ok = encoder.Encode(frame, png, reply.data);
+                reply.format = request.format;
+                reply.width = ctx.width;
+                reply.height = ctx.height;
+                reply.bytes = reply.data.size();
+            }, ServiceOptions()));
+        return [=](BenchRun& run)
+            {
+                std::deque<std::string> requests;
+                for (int i = 0; i < kSequenceFrames * 2; i++)
+                    requests.push_back("{\"id\": " + std::to_string(i) + ", \"target\": \"screen\", \"format\": \"png\"}");
+                std::shared_ptr<ScriptedConnection> client(new ScriptedConnection(requests));
+                auto start = Clock::now();
+                service->Serve(client);
+                run.seconds += SecondsSince(start);
+                run.frames += static_cast<int>(requests.size());
+                run.outputBytes += client->replyBytes;
+            };
+    }
+
+    const std::vector<Stage>& AllStages()
+    {
+        static const std::vector<Stage> stages = {
+            { "png-fast", "encoder", PngStage(CompressionLevel::Fast) },
+            { "png-fast-1t", "encoder", PngStage(CompressionLevel::Fast, 1) },
+            { "png-fast-palette", "encoder", PngStage(CompressionLevel::Fast, 0, PaletteMode::Auto) },
+            { "png-default", "encoder", PngStage(CompressionLevel::Default) },
+            { "png-max", "encoder", PngStage(CompressionLevel::Max) },
+            { "jpeg-420", "encoder", JpegStage(ChromaSubsampling::Yuv420) },
+            { "jpeg-444", "encoder", JpegStage(ChromaSubsampling::Yuv444) },
+            { "qoi", "encoder", QoiStage },
+            { "png-fast-bands", "encoder", BandsStage(BandFormat::Png) },
+            { "qoi-bands", "encoder", BandsStage(BandFormat::Qoi) },
+            { "seq", "encoder", SeqStage },
+            { "inflate", "kernel", InflateStage },
+            { "png-decode", "kernel", PngDecodeStage },
+            { "crc32", "kernel", Crc32Stage },
+            { "adler32", "kernel", Adler32Stage },
+            { "change-probe", "kernel", ChangeProbeStage },
+            { "bgra-to-rgb", "kernel", RowKernelStage(&PixelKernels::bgraToRgb, 3) },
+            { "bgra-to-rgba", "kernel", RowKernelStage(&PixelKernels::bgraToRgba, 4) },
+            { "bgra-to-bgr", "kernel", RowKernelStage(&PixelKernels::bgraToBgr, 3) },
+            { "bgra-to-gray", "kernel", RowKernelStage(&PixelKernels::bgraToGray, 1) },
+            { "flip-rows", "kernel", FlipRowsStage },
+            { "text-overlay", "kernel", TextOverlayStage },
+            { "redact-fill", "kernel", RedactStage(RedactMode::Fill) },
+            { "redact-pixelate", "kernel", RedactStage(RedactMode::Pixelate) },
+            { "redact-blur", "kernel", RedactStage(RedactMode::Blur) },
+            { "compare", "kernel", CompareStage(false) },
+            { "compare-diff", "kernel", CompareStage(true) },
+            { "desktop-stitch", "kernel", DesktopStitchStage },
+            { "resample-half", "kernel", ResampleStage(1, 2) },
+            { "resample-2-3", "kernel", ResampleStage(2, 3) },
+            { "resample-thumb", "kernel", ResampleStage(320, 0) },
+            { "pipeline-png-fast", "pipeline", PipelineStage },
+            { "region-fanout", "pipeline", RegionFanOutStage },
+            { "compare-png-pair-1t", "pipeline", ComparePairStage },
+            { "service-inline", "pipeline", ServiceInlineStage } };
+        return stages;
+    }
+
+    struct Result
+    {
+        std::string stage;
+        std::string kind;
+        std::string content;
+        std::string size;
+        int width;
+        int height;
+        int iterations;
+        int frames;
+        double msPerFrame;
+        double mbPerSecond;
+        double outputBytes;     // Per frame.
+    };
+
+    std::vector<std::string> SplitList(const std::string& text)
+    {
+        std::vector<std::string> items;
+        std::stringstream ss(text);
+        std::string item;
+        while (std::getline(ss, item, ','))
+        {
+            if (!item.empty())
+                items.push_back(item);
+        }
+        return items;
+    }
+
+    bool Contains(const std::vector<std::string>& list, const std::string& value)
+    {
+        for (const std::string& item : list)
+        {
+            if (item == value)
+                return true;
+        }
+        return false;
+    }
+
+    void WriteJson(std::ostream& out, const std::vector<Result>& results, double minTime, int maxIterations, uint32_t seed)
+    {
+        const CpuFeatures& cpu = GetCpuFeatures();
+        auto flag = [](bool value) { return value ? "true" : "false"; };
+        out << "{\n";
+        out << "  \"tool\": \"ShotCapBench\",\n";
+        out << "  \"schema\": 1,\n";
+        out << "  \"cpu\": { \"sse2\": " << flag(cpu.sse2) << ", \"ssse3\": " << flag(cpu.ssse3)
+            << ", \"sse41\": " << flag(cpu.sse41) << ", \"sse42\": " << flag(cpu.sse42)
+            << ", \"pclmul\": " << flag(cpu.pclmul) << ", \"avx2\": " << flag(cpu.avx2)
+            << ", \"pixel_kernels\": \"" << ActivePixelKernels().name << "\" },\n";
+        out << "  \"settings\": { \"min_time\": " << minTime << ", \"max_iterations\": " << maxIterations
+            << ", \"seed\": " << seed << " },\n";
+        out << "  \"results\": [";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const Result& r = results[i];
+            char numbers[160];
+            snprintf(numbers, sizeof(numbers), "\"ms_per_frame\": %.4f, \"mb_per_s\": %.2f, \"output_bytes\": %.0f",
+                r.msPerFrame, r.mbPerSecond, r.outputBytes);
+            out << (i ? ",\n" : "\n") << "    { \"stage\": \"" << r.stage << "\", \"kind\": \"" << r.kind
+                << "\", \"content\": \"" << r.content << "\", \"size\": \"" << r.size
+                << "\", \"width\": " << r.width << ", \"height\": " << r.height
+                << ", \"iterations\": " << r.iterations << ", \"frames\": " << r.frames << ", " << numbers << " }";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+    void PrintUsage()
+    {
+        std::cout << "Usage: ShotCapBench [options]\n\n"
+            << "Options:\n"
+            << "  --sizes <list>         Frame sizes: 1080p,4k,8k (default: all)\n"
+            << "  --content <list>       Content: ui,gradient,noise,static (default: all)\n"
+            << "  --stages <list>        Stages to run (default: all, see --list)\n"
+            << "  --min-time <seconds>   Run each stage at least this long (default: 0.5)\n"
+            << "  --max-iterations <n>   Stop a stage after n iterations (default: 20)\n"
+            << "  --seed <n>             Seed for the synthetic frames (default: 1)\n"
+            << "  --json <file>          Write results as JSON; '-' writes to stdout\n"
+            << "  --list                 List stages and exit\n"
+            << "  -h, --help             Display this help message\n";
+    }
+}
+
+//---------------------------------------------------------------------
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> sizeFilter, contentFilter, stageFilter;
+    double minTime = 0.5;
+    int maxIterations = 20;
+    uint32_t seed = 1;
+    std::string jsonPath;
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (arg == "-h" || arg == "--help")
+        {
+            PrintUsage();
+            return 0;
+        }
+        else if (arg == "--list")
+        {
+            for (const Stage& stage : AllStages())
+                std::cout << stage.name << " (" << stage.kind << ")\n";
+            return 0;
+        }
+        else if (arg == "--sizes" && i + 1 < argc)
+        {
+            sizeFilter = SplitList(argv[++i]);
+        }
+        else if (arg == "--content" && i + 1 < argc)
+        {
+            contentFilter = SplitList(argv[++i]);
+        }
+        else if (arg == "--stages" && i + 1 < argc)
+        {
+            stageFilter = SplitList(argv[++i]);
+        }
+        else if (arg == "--min-time" && i + 1 < argc)
+        {
+            minTime = std::atof(argv[++i]);
+        }
+        else if (arg == "--max-iterations" && i + 1 < argc)
+        {
+            maxIterations = (std::max)(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "--seed" && i + 1 < argc)
+        {
+            seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--json" && i + 1 < argc)
+        {
+            jsonPath = argv[++i];
+        }
+        else
+        {
+            std::cerr << "Unknown argument: " << arg << "\n";
+            PrintUsage();
+            return -1;
+        }
+    }
+
+    for (const std::string& name : contentFilter)
+    {
+        SyntheticContent content;
+        if (!ParseContent(name, content))
+        {
+            std::cerr << "Unknown content type: " << name << "\n";
+            return -1;
+        }
+    }
+
+    // With --json - the table goes to stderr so stdout stays valid JSON.
+    std::ostream& table = jsonPath == "-" ? std::cerr : std::cout;
+    std::vector<Result> results;
+    std::vector<uint8_t> frame;
+    char line[200];
+    snprintf(line, sizeof(line), "%-18s %-9s %-6s %6s %12s %10s %12s\n",
+        "stage", "content", "size", "iters", "ms/frame", "MB/s", "bytes/frame");
+    table << line;
+
+    for (const SyntheticSize& size : StandardSizes())
+    {
+        if (!sizeFilter.empty() && !Contains(sizeFilter, size.name))
+            continue;
+        for (SyntheticContent content : AllContents())
+        {
+            if (!contentFilter.empty() && !Contains(contentFilter, ContentName(content)))
+                continue;
+            GenerateFrame(content, size.width, size.height, seed, 0, frame);
+            BenchContext ctx = { content, size.width, size.height, seed, &frame };
+
+            for (const Stage& stage : AllStages())
+            {
+                if (!stageFilter.empty() && !Contains(stageFilter, stage.name))
+                    continue;
+                StageRunner runner = stage.create(ctx);
+                BenchRun run;
+                int iterations = 0;
+                auto start = Clock::now();
+                while (iterations < maxIterations && (iterations == 0 || SecondsSince(start) < minTime))
+                {
+                    runner(run);
+                    iterations++;
+                }
+
+                Result r;
+                r.stage = stage.name;
+                r.kind = stage.kind;
+                r.content = ContentName(content);
+                r.size = size.name;
+                r.width = size.width;
+                r.height = size.height;
+                r.iterations = iterations;
+                r.frames = run.frames;
+                double frames = (std::max)(run.frames, 1);
+                double seconds = (std::max)(run.seconds, 1e-9);
+                r.msPerFrame = run.seconds * 1000.0 / frames;
+                r.mbPerSecond = frames * static_cast<double>(frame.size()) / seconds / 1e6;
+                r.outputBytes = run.outputBytes / frames;
+                results.push_back(r);
+
+                snprintf(line, sizeof(line), "%-18s %-9s %-6s %6d %12.3f %10.1f %12.0f\n",
+                    r.stage.c_str(), r.content.c_str(), r.size.c_str(), r.iterations,
+                    r.msPerFrame, r.mbPerSecond, r.outputBytes);
+                table << line << std::flush;
+            }
+        }
+    }
+
+    if (jsonPath == "-")
+    {
+        WriteJson(std::cout, results, minTime, maxIterations, seed);
+    }
+    else if (!jsonPath.empty())
+    {
+        std::ofstream out(jsonPath.c_str());
+        if (!out)
+        {
+            std::cerr << "Failed to open " << jsonPath << " for writing.\n";
+            return -1;
+        }
+        WriteJson(out, results, minTime, maxIterations, seed);
+    }
+    return 0;
+}
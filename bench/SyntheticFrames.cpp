@@ -0,0 +1,350 @@
+#include "SyntheticFrames.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // xorshift32: tiny, fast and identical on every platform.
+    class Rng
+    {
+    public:
+        explicit Rng(uint32_t seed) : state_(seed ? seed : 0x9E3779B9u) {}
+
+        uint32_t Next()
+        {
+            state_ ^= state_ << 13;
+            state_ ^= state_ >> 17;
+            state_ ^= state_ << 5;
+            return state_;
+        }
+
+        // 0 for an empty range, which tiny frames produce from their derived sizes.
+        int Range(int n) { return n > 0 ? static_cast<int>(Next() % static_cast<uint32_t>(n)) : 0; }
+
+    private:
+        uint32_t state_;
+    };
+
+    struct Color
+    {
+        uint8_t b, g, r;
+    };
+
+    inline Color Rgb(int r, int g, int b)
+    {
+        Color c = { static_cast<uint8_t>(b), static_cast<uint8_t>(g), static_cast<uint8_t>(r) };
+        return c;
+    }
+
+    class Canvas
+    {
+    public:
+        Canvas(std::vector<uint8_t>& pixels, int width, int height)
+            : p_(pixels.data()), width_(width), height_(height) {}
+
+        void Fill(int x, int y, int w, int h, Color c)
+        {
+            int x0 = (std::max)(x, 0), y0 = (std::max)(y, 0);
+            int x1 = (std::min)(x + w, width_), y1 = (std::min)(y + h, height_);
+            for (int yy = y0; yy < y1; yy++)
+            {
+                uint8_t* row = p_ + (static_cast<size_t>(yy) * width_ + x0) * 4;
+                for (int xx = x0; xx < x1; xx++, row += 4)
+                {
+                    row[0] = c.b;
+                    row[1] = c.g;
+                    row[2] = c.r;
+                    row[3] = 0xFF;
+                }
+            }
+        }
+
+        void Frame(int x, int y, int w, int h, Color c)
+        {
+            Fill(x, y, w, 1, c);
+            Fill(x, y + h - 1, w, 1, c);
+            Fill(x, y, 1, h, c);
+            Fill(x + w - 1, y, 1, h, c);
+        }
+
+        int Width() const { return width_; }
+        int Height() const { return height_; }
+
+    private:
+        uint8_t* p_;
+        int width_;
+        int height_;
+    };
+
+    // 64 pseudo glyphs, 5x8 pixels in a 7x12 cell; bit 39 - (y * 5 + x).
+    const int kGlyphW = 7;
+    const int kGlyphH = 12;
+
+    struct GlyphSet
+    {
+        uint64_t bits[64];
+
+        GlyphSet()
+        {
+            Rng rng(0x5EED0001u);
+            for (int i = 0; i < 64; i++)
+            {
+                bits[i] = 0;
+                // Vertical stems and a few bars look more like text than noise.
+                int stem = rng.Range(5);
+                for (int y = 0; y < 8; y++)
+                {
+                    for (int x = 0; x < 5; x++)
+                    {
+                        bool on = x == stem || (y == 0 || y == 4 || y == 7 ? rng.Range(3) == 0 : rng.Range(7) == 0);
+                        if (on)
+                            bits[i] |= uint64_t(1) << (39 - (y * 5 + x));
+                    }
+                }
+            }
+        }
+    };
+
+    const GlyphSet& Glyphs()
+    {
+        static const GlyphSet glyphs;
+        return glyphs;
+    }
+
+    void DrawGlyph(Canvas& canvas, int x, int y, int glyph, Color c)
+    {
+        uint64_t bits = Glyphs().bits[glyph & 63];
+        for (int gy = 0; gy < 8; gy++)
+        {
+            for (int gx = 0; gx < 5; gx++)
+            {
+                if (bits & (uint64_t(1) << (39 - (gy * 5 + gx))))
+                    canvas.Fill(x + gx, y + 2 + gy, 1, 1, c);
+            }
+        }
+    }
+
+    // Words of random glyphs until maxWidth is used up.
+    void DrawText(Canvas& canvas, Rng& rng, int x, int y, int maxWidth, Color c)
+    {
+        int cx = x;
+        while (cx + kGlyphW <= x + maxWidth)
+        {
+            int word = 2 + rng.Range(8);
+            for (int i = 0; i < word && cx + kGlyphW <= x + maxWidth; i++, cx += kGlyphW)
+                DrawGlyph(canvas, cx, y, rng.Range(64), c);
+            cx += kGlyphW;
+        }
+    }
+
+    void DrawUi(Canvas& canvas, uint32_t seed)
+    {
+        Rng rng(seed);
+        const int w = canvas.Width(), h = canvas.Height();
+        const Color text = Rgb(32, 32, 32);
+
+        canvas.Fill(0, 0, w, h, Rgb(0, 99, 177));                 // Desktop
+        canvas.Fill(0, h - 40, w, 40, Rgb(32, 32, 40));           // Taskbar
+        for (int i = 0; i < 12; i++)
+            canvas.Fill(8 + i * 48, h - 34, 32, 28, Rgb(60 + rng.Range(120), 60 + rng.Range(120), 60 + rng.Range(120)));
+
+        // Overlapping application windows, each with a title bar, a sidebar,
+        // toolbar buttons and paragraphs of text.
+        int windows = 3 + (w * h) / (1920 * 1080) * 2;
+        for (int i = 0; i < windows; i++)
+        {
+            int ww = w / 3 + rng.Range(w / 3);
+            int wh = h / 3 + rng.Range(h / 3);
+            int wx = rng.Range((std::max)(1, w - ww));
+            int wy = rng.Range((std::max)(1, h - 40 - wh));
+            canvas.Fill(wx, wy, ww, wh, Rgb(255, 255, 255));
+            canvas.Frame(wx, wy, ww, wh, Rgb(160, 160, 160));
+            canvas.Fill(wx + 1, wy + 1, ww - 2, 30, Rgb(240, 240, 240));
+            DrawText(canvas, rng, wx + 10, wy + 9, ww / 3, text);
+            for (int b = 0; b < 3; b++)
+                canvas.Fill(wx + ww - 40 * (b + 1), wy + 1, 38, 30, b == 0 ? Rgb(232, 17, 35) : Rgb(229, 229, 229));
+
+            int sidebar = ww / 5;
+            canvas.Fill(wx + 1, wy + 31, sidebar, wh - 32, Rgb(243, 243, 243));
+            for (int row = wy + 40; row + kGlyphH < wy + wh - 8; row += 24)
+                DrawText(canvas, rng, wx + 12, row, sidebar - 20, Rgb(60, 60, 60));
+
+            int toolbarY = wy + 36;
+            for (int b = 0; b < 8 && wx + sidebar + 16 + b * 90 + 80 < wx + ww; b++)
+            {
+                int bx = wx + sidebar + 16 + b * 90;
+                canvas.Fill(bx, toolbarY, 80, 26, Rgb(225, 225, 225));
+                canvas.Frame(bx, toolbarY, 80, 26, Rgb(173, 173, 173));
+                DrawText(canvas, rng, bx + 8, toolbarY + 7, 64, text);
+            }
+            for (int row = toolbarY + 40; row + kGlyphH < wy + wh - 8; row += 16)
+            {
+                if (rng.Range(6) == 0)
+                    continue;   // Paragraph break.
+                DrawText(canvas, rng, wx + sidebar + 16, row, ww - sidebar - 32 - rng.Range(ww / 4 + 1), text);
+            }
+        }
+    }
+
+    void DrawGradient(Canvas& canvas, std::vector<uint8_t>& pixels)
+    {
+        const int w = canvas.Width(), h = canvas.Height();
+        const double cx = w * 0.3, cy = h * 0.6, radius = std::sqrt(double(w) * w + double(h) * h);
+        for (int y = 0; y < h; y++)
+        {
+            uint8_t* row = pixels.data() + static_cast<size_t>(y) * w * 4;
+            for (int x = 0; x < w; x++, row += 4)
+            {
+                double d = std::sqrt((x - cx) * (x - cx) + (y - cy) * (y - cy)) / radius;
+                row[0] = static_cast<uint8_t>(255.0 * (1.0 - d));
+                row[1] = static_cast<uint8_t>(255.0 * y / h);
+                row[2] = static_cast<uint8_t>(255.0 * x / w);
+                row[3] = 0xFF;
+            }
+        }
+    }
+
+    // Bilinear value noise on a coarse lattice, two octaves, plus grain.
+    void DrawNoise(Canvas& canvas, std::vector<uint8_t>& pixels, uint32_t seed)
+    {
+        const int w = canvas.Width(), h = canvas.Height();
+        const int cells[2] = { 256, 32 };
+        const int weights[2] = { 200, 40 };
+        std::vector<int> accum(static_cast<size_t>(w) * 3, 0);
+        std::vector<uint8_t> lattice[2];
+        int latticeW[2];
+        Rng rng(seed);
+        for (int o = 0; o < 2; o++)
+        {
+            latticeW[o] = w / cells[o] + 2;
+            int latticeH = h / cells[o] + 2;
+            lattice[o].resize(static_cast<size_t>(latticeW[o]) * latticeH * 3);
+            for (uint8_t& v : lattice[o])
+                v = static_cast<uint8_t>(rng.Next());
+        }
+        for (int y = 0; y < h; y++)
+        {
+            std::fill(accum.begin(), accum.end(), 0);
+            for (int o = 0; o < 2; o++)
+            {
+                int cell = cells[o];
+                int ly = y / cell, fy = y % cell;
+                const uint8_t* top = lattice[o].data() + static_cast<size_t>(ly) * latticeW[o] * 3;
+                const uint8_t* bottom = top + latticeW[o] * 3;
+                for (int x = 0; x < w; x++)
+                {
+                    int lx = x / cell, fx = x % cell;
+                    for (int c = 0; c < 3; c++)
+                    {
+                        int a = top[lx * 3 + c], b = top[lx * 3 + 3 + c];
+                        int d = bottom[lx * 3 + c], e = bottom[lx * 3 + 3 + c];
+                        int upper = a * (cell - fx) + b * fx;
+                        int lower = d * (cell - fx) + e * fx;
+                        int v = (upper * (cell - fy) + lower * fy) / (cell * cell);
+                        accum[x * 3 + c] += v * weights[o] / 255;
+                    }
+                }
+            }
+            uint8_t* row = pixels.data() + static_cast<size_t>(y) * w * 4;
+            for (int x = 0; x < w; x++, row += 4)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    int v = accum[x * 3 + c] + static_cast<int>(rng.Next() % 17) - 8;
+                    row[c] = static_cast<uint8_t>((std::min)((std::max)(v, 0), 255));
+                }
+                row[3] = 0xFF;
+            }
+        }
+    }
+
+    // The parts of a mostly idle desktop that move between frames.
+    void DrawStaticChanges(Canvas& canvas, int index)
+    {
+        const int w = canvas.Width(), h = canvas.Height();
+        Rng rng(0xC10C0000u + static_cast<uint32_t>(index));
+
+        // Taskbar clock.
+        canvas.Fill(w - 90, h - 34, 80, 28, Rgb(32, 32, 40));
+        for (int i = 0; i < 5; i++)
+            DrawGlyph(canvas, w - 86 + i * kGlyphW, h - 30, rng.Range(64), Rgb(255, 255, 255));
+
+        // Blinking caret and a growing line of typed text.
+        if (index % 2 == 0)
+            canvas.Fill(w / 2 + (index % 40) * kGlyphW, h / 2, 1, kGlyphH, Rgb(0, 0, 0));
+        Rng typed(0x7E47u);
+        for (int i = 0; i < index % 40; i++)
+            DrawGlyph(canvas, w / 2 + i * kGlyphW, h / 2, typed.Range(64), Rgb(32, 32, 32));
+
+        // Pointer drifting across the screen.
+        int px = (index * 37) % (std::max)(1, w - 16);
+        int py = (index * 23) % (std::max)(1, h - 24);
+        canvas.Fill(px, py, 12, 20, Rgb(255, 255, 255));
+        canvas.Frame(px, py, 12, 20, Rgb(0, 0, 0));
+    }
+}
+
+//---------------------------------------------------------------------
+const std::vector<SyntheticSize>& StandardSizes()
+{
+    static const std::vector<SyntheticSize> sizes = {
+        { "1080p", 1920, 1080 },
+        { "4k", 3840, 2160 },
+        { "8k", 7680, 4320 } };
+    return sizes;
+}
+
+const char* ContentName(SyntheticContent content)
+{
+    switch (content)
+    {
+    case SyntheticContent::Ui: return "ui";
+    case SyntheticContent::Gradient: return "gradient";
+    case SyntheticContent::Noise: return "noise";
+    default: return "static";
+    }
+}
+
+bool ParseContent(const std::string& name, SyntheticContent& content)
+{
+    for (SyntheticContent c : AllContents())
+    {
+        if (name == ContentName(c))
+        {
+            content = c;
+            return true;
+        }
+    }
+    return false;
+}
+
+const std::vector<SyntheticContent>& AllContents()
+{
+    static const std::vector<SyntheticContent> contents = {
+        SyntheticContent::Ui, SyntheticContent::Gradient, SyntheticContent::Noise, SyntheticContent::Static };
+    return contents;
+}
+
+void GenerateFrame(SyntheticContent content, int width, int height, uint32_t seed, int index,
+    std::vector<uint8_t>& pixels)
+{
+    pixels.resize(static_cast<size_t>(width) * height * 4);
+    Canvas canvas(pixels, width, height);
+    switch (content)
+    {
+    case SyntheticContent::Ui:
+        DrawUi(canvas, seed + static_cast<uint32_t>(index));
+        break;
+    case SyntheticContent::Gradient:
+        DrawGradient(canvas, pixels);
+        break;
+    case SyntheticContent::Noise:
+        DrawNoise(canvas, pixels, seed + static_cast<uint32_t>(index));
+        break;
+    case SyntheticContent::Static:
+        DrawUi(canvas, seed);
+        DrawStaticChanges(canvas, index);
+        break;
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Reproducible desktop-like test frames for the benchmark. Frames are
+// 32 bpp BGRA, top-down, stride = width * 4, and depend only on the
+// content type, the size, the seed and the frame index.
+
+enum class SyntheticContent
+{
+    Ui,         // Flat panels, borders, buttons and rows of text.
+    Gradient,   // Smooth full-frame gradients.
+    Noise,      // Photographic: soft low-frequency colour plus grain.
+    Static      // Ui where each frame changes only a clock, a caret and the pointer.
+};
+
+struct SyntheticSize
+{
+    const char* name;
+    int width;
+    int height;
+};
+
+// 1080p, 4k and 8k.
+const std::vector<SyntheticSize>& StandardSizes();
+
+const char* ContentName(SyntheticContent content);
+bool ParseContent(const std::string& name, SyntheticContent& content);
+const std::vector<SyntheticContent>& AllContents();
+
+void GenerateFrame(SyntheticContent content, int width, int height, uint32_t seed, int index,
+    std::vector<uint8_t>& pixels);
@@ -0,0 +1,371 @@
+#include "TestHarness.h"
+
+#include "BandedCapture.h"
+#include "CapturePipeline.h"
+#include "ChangeDetector.h"
+#include "FramePool.h"
+#include "PngDecoder.h"
+#include "PngEncoder.h"
+#include "QoiCodec.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <new>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Every heap allocation in the test binary goes through here and is
+// counted, so a test can check that a warmed-up path does not allocate.
+// Each block carries its size in front of it, so the bytes alive at any
+// time and their peak are known too.
+namespace
+{
+    const size_t kSizeHeader = 16;      // Keeps the malloc alignment.
+
+    std::atomic<uint64_t> allocations(0);
+    std::atomic<size_t> liveBytes(0);
+    std::atomic<size_t> peakBytes(0);
+
+    void* CountedAllocate(size_t size)
+    {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        if (uint8_t* block = static_cast<uint8_t*>(std::malloc(size + kSizeHeader)))
+        {
+            *reinterpret_cast<size_t*>(block) = size;
+            const size_t live = liveBytes.fetch_add(size, std::memory_order_relaxed) + size;
+            size_t peak = peakBytes.load(std::memory_order_relaxed);
+            while (live > peak && !peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+            {
+            }
+            return block + kSizeHeader;
+        }
+        throw std::bad_alloc();
+    }
+
+    void CountedFree(void* memory)
+    {
+        if (!memory)
+            return;
+        uint8_t* block = static_cast<uint8_t*>(memory) - kSizeHeader;
+        liveBytes.fetch_sub(*reinterpret_cast<size_t*>(block), std::memory_order_relaxed);
+        std::free(block);
+    }
+
+    uint64_t Allocations()
+    {
+        return allocations.load();
+    }
+
+    // Restart the peak at the bytes alive now, and return those.
+    size_t StartPeakBytes()
+    {
+        const size_t live = liveBytes.load();
+        peakBytes.store(live);
+        return live;
+    }
+
+    // Most bytes alive at once since StartPeakBytes.
+    size_t PeakBytes()
+    {
+        return peakBytes.load();
+    }
+}
+
+void* operator new(size_t size) { return CountedAllocate(size); }
+void* operator new[](size_t size) { return CountedAllocate(size); }
+void operator delete(void* memory) noexcept { CountedFree(memory); }
+void operator delete[](void* memory) noexcept { CountedFree(memory); }
+void operator delete(void* memory, size_t) noexcept { CountedFree(memory); }
+void operator delete[](void* memory, size_t) noexcept { CountedFree(memory); }
+
+namespace
+{
+    void FillFrame(Frame& frame, int width, int height, int seed)
+    {
+        frame.Allocate(width, height, FrameFormat::Bgrx32);
+        for (int y = 0; y < height; y++)
+        {
+            uint8_t* row = frame.Data() + y * frame.Stride();
+            for (int x = 0; x < width * 4; x++)
+                row[x] = static_cast<uint8_t>((x / 4 + y) / 8 * 16 + seed + (x & 3) * 40);
+        }
+    }
+
+    // Pixel (x, y) of a tall generated image: panels, gradients and
+    // stripes that compress well, so the encoded file stays small.
+    void GeneratedPixel(int x, int y, uint8_t* p)
+    {
+        p[0] = static_cast<uint8_t>((x / 8) ^ (y / 32));
+        p[1] = static_cast<uint8_t>(y / 4);
+        p[2] = static_cast<uint8_t>(0x80 + x / 64);
+        p[3] = 0xFF;
+    }
+
+    bool GrabGeneratedBand(int width, int top, int rows, Frame& band)
+    {
+        band.Allocate(width, rows, FrameFormat::Bgrx32);
+        for (int y = 0; y < rows; y++)
+        {
+            uint8_t* row = band.View().Row(y);
+            for (int x = 0; x < width; x++)
+                GeneratedPixel(x, top + y, row + x * 4);
+        }
+        return true;
+    }
+
+    // Whether decoded (top-down BGRA) is the generated image.
+    bool IsGeneratedImage(const std::vector<uint8_t>& decoded, int width, int height)
+    {
+        if (decoded.size() != static_cast<size_t>(width) * height * 4)
+            return false;
+        uint8_t expected[4];
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                GeneratedPixel(x, y, expected);
+                if (memcmp(&decoded[(static_cast<size_t>(y) * width + x) * 4], expected, 3) != 0)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    struct BandedRun
+    {
+        bool ok = false;
+        bool partsAligned = true;   // Every part but the last a 4096 multiple, none over 1 MiB.
+        bool bmpMatches = true;
+        uint64_t bmpBytes = 0;
+        size_t peakBytes = 0;
+    };
+
+    // Capture the generated width x height image in bands of bandRows. The
+    // sink keeps PNG and QOI files in file, whose room must be reserved up
+    // front, and checks BMP bytes as they arrive, so only the capture's own
+    // memory shows in the peak.
+    BandedRun RunBanded(BandFormat format, int width, int height, int bandRows, std::vector<uint8_t>& file)
+    {
+        PngOptions png;
+        png.threads = 1;
+        std::unique_ptr<RowStreamEncoder> encoder = CreateRowStreamEncoder(format, png);
+        BandedCaptureOptions options;
+        options.bandRows = bandRows;
+        file.clear();
+
+        BandedRun run;
+        uint64_t written = 0;
+        const uint64_t rowBytes = (static_cast<uint64_t>(width) * 3 + 3) & ~uint64_t(3);
+        const size_t base = StartPeakBytes();
+        run.ok = CaptureInBands(width, height, *encoder, options,
+            [&](int top, int rows, Frame& band) -> bool
+            {
+                return GrabGeneratedBand(width, top, rows, band);
+            },
+            [&](const uint8_t* data, size_t size) -> bool
+            {
+                run.partsAligned = run.partsAligned && size <= (size_t(1) << 20) && written % 4096 == 0;
+                written += size;
+                if (format != BandFormat::Bmp)
+                {
+                    if (file.size() + size > file.capacity())
+                        return false;
+                    file.insert(file.end(), data, data + size);
+                    return true;
+                }
+                // 54-byte header, then top-down BGR rows padded to four bytes.
+                uint8_t expected[4];
+                for (size_t i = 0; i < size; i++, run.bmpBytes++)
+                {
+                    if (run.bmpBytes < 54)
+                        continue;
+                    const uint64_t offset = run.bmpBytes - 54;
+                    const uint64_t column = offset % rowBytes;
+                    if (column >= static_cast<uint64_t>(width) * 3)
+                        continue;
+                    GeneratedPixel(static_cast<int>(column / 3), static_cast<int>(offset / rowBytes), expected);
+                    run.bmpMatches = run.bmpMatches && data[i] == expected[column % 3];
+                }
+                return true;
+            });
+        run.peakBytes = PeakBytes() - base;
+        return run;
+    }
+
+    // Run the pipeline over frames frames of 320x200, encoded as PNG. The
+    // frames are all alike, so every slot and the encoder are warm after
+    // their first frame whichever frames they get.
+    PipelineStats RunPngPipeline(int frames)
+    {
+        PipelineOptions options;
+        options.frameCount = frames;
+        options.encoderThreads = 1;
+        return RunCapturePipeline(options,
+            [](PipelineFrame& frame) -> bool
+            {
+                FillFrame(frame.image, 320, 200, 0);
+                return true;
+            },
+            [](PipelineFrame& frame) -> bool
+            {
+                // One per encoder thread, built on that thread's first frame.
+                thread_local PngEncoder encoder;
+                PngOptions png;
+                png.threads = 1;
+                return encoder.Encode(frame.image.View(), png, frame.encoded);
+            },
+            [](PipelineFrame&)
+            {
+            });
+    }
+}
+
+TEST(FramePoolRecyclesWithoutAllocating)
+{
+    FramePool<Frame> pool(3);
+    std::vector<Frame*> taken;
+    taken.reserve(3);
+    for (int i = 0; i < 3; i++)
+    {
+        taken.push_back(pool.Acquire());
+        FillFrame(*taken.back(), 64, 32, i);
+    }
+    for (Frame* frame : taken)
+        pool.Release(frame);
+
+    const uint64_t before = Allocations();
+    for (int round = 0; round < 50; round++)
+    {
+        taken.clear();
+        for (int i = 0; i < 3; i++)
+        {
+            taken.push_back(pool.Acquire());
+            // Same size or smaller: the frame keeps its buffer.
+            FillFrame(*taken.back(), round % 2 ? 64 : 32, 32, round);
+        }
+        for (Frame* frame : taken)
+            pool.Release(frame);
+    }
+    CHECK_EQ(Allocations() - before, static_cast<uint64_t>(0));
+    CHECK_EQ(pool.Available(), static_cast<size_t>(3));
+}
+
+TEST(PngEncoderSteadyStateDoesNotAllocate)
+{
+    // threads = 1: a ParallelFor over the shared pool allocates its job.
+    PngEncoder encoder;
+    Frame frame;
+    std::vector<uint8_t> png;
+    const CompressionLevel levels[] = { CompressionLevel::Fast, CompressionLevel::Default };
+    for (CompressionLevel level : levels)
+    {
+        PngOptions options;
+        options.level = level;
+        options.threads = 1;
+        // Once every buffer has grown to fit the largest of these frames.
+        for (int i = 0; i < 3; i++)
+        {
+            FillFrame(frame, 1920, 1080, i);
+            REQUIRE(encoder.Encode(frame.View(), options, png));
+        }
+
+        const uint64_t before = Allocations();
+        for (int i = 0; i < 3; i++)
+        {
+            FillFrame(frame, 1920, 1080, i);
+            REQUIRE(encoder.Encode(frame.View(), options, png));
+        }
+        CHECK_EQ(Allocations() - before, static_cast<uint64_t>(0));
+    }
+}
+
+TEST(ChangeDetectorProbeDoesNotAllocate)
+{
+    // -onchange probes many times a second; after the first reference,
+    // neither a probe nor a new reference of the same size allocates.
+    ChangeDetector detector;
+    Frame frames[2];
+    FillFrame(frames[0], 1000, 700, 0);
+    FillFrame(frames[1], 1000, 700, 1);
+    detector.SetReference(frames[0].Data(), 1000, 700, static_cast<int>(frames[0].Stride()));
+
+    double changed[9];
+    const uint64_t before = Allocations();
+    for (int i = 0; i < 8; i++)
+    {
+        const Frame& frame = frames[i % 2];
+        changed[i] = detector.Measure(frame.Data(), 1000, 700, static_cast<int>(frame.Stride()));
+    }
+    detector.SetReference(frames[1].Data(), 1000, 700, static_cast<int>(frames[1].Stride()));
+    changed[8] = detector.Measure(frames[1].Data(), 1000, 700, static_cast<int>(frames[1].Stride()));
+    CHECK_EQ(Allocations() - before, static_cast<uint64_t>(0));
+    for (int i = 0; i < 8; i++)
+        CHECK_EQ(changed[i] > 0.0, i % 2 == 1);
+    CHECK_EQ(changed[8], 0.0);
+}
+
+TEST(CapturePipelineSteadyStateDoesNotAllocate)
+{
+    // Threads, queues and slot buffers cost the same for any run length,
+    // so the extra frames of the longer run must not allocate at all.
+    RunPngPipeline(12);
+    uint64_t before = Allocations();
+    PipelineStats shortRun = RunPngPipeline(12);
+    const uint64_t shortAllocations = Allocations() - before;
+    before = Allocations();
+    PipelineStats longRun = RunPngPipeline(60);
+    const uint64_t longAllocations = Allocations() - before;
+
+    CHECK_EQ(shortRun.framesWritten, 12);
+    CHECK_EQ(longRun.framesWritten, 60);
+    CHECK_EQ(longAllocations, shortAllocations);
+}
+
+TEST(BandedCapturePeakMemoryStaysAtBandSize)
+{
+    // 2000 x 12000 is 96 MB as one frame; bands of 64 rows are 512 KB.
+    const int width = 2000, height = 12000, bandRows = 64;
+    const size_t bandBytes = static_cast<size_t>(width) * bandRows * 4;
+    const BandFormat formats[] = { BandFormat::Png, BandFormat::Qoi, BandFormat::Bmp };
+    const char* names[] = { "png", "qoi", "bmp" };
+
+    std::vector<uint8_t> file;
+    file.reserve(size_t(16) << 20);
+    for (int f = 0; f < 3; f++)
+    {
+        const std::string what = names[f];
+        // A tenth of the height first: the peak must not grow with it.
+        const BandedRun shortRun = RunBanded(formats[f], width, height / 10, bandRows, file);
+        const BandedRun run = RunBanded(formats[f], width, height, bandRows, file);
+        if (!shortRun.ok || !run.ok || !run.partsAligned)
+        {
+            ReportFailure(__FILE__, __LINE__, what + " capture failed or wrote oversized or unaligned parts");
+            continue;
+        }
+        // One band, the write buffer (a 1 MiB chunk plus one band's output
+        // at five bytes a pixel) and the encoder's fixed scratch.
+        if (run.peakBytes > shortRun.peakBytes || run.peakBytes > bandBytes * 9 / 4 + (size_t(3) << 20))
+        {
+            ReportFailure(__FILE__, __LINE__, what + " peaked at " + std::to_string(run.peakBytes) +
+                " bytes, " + std::to_string(shortRun.peakBytes) + " for a tenth of the rows");
+        }
+
+        std::vector<uint8_t> decoded;
+        int decodedWidth = 0, decodedHeight = 0, channels = 0;
+        if (formats[f] == BandFormat::Png)
+            CHECK(DecodePng(file.data(), file.size(), decoded, decodedWidth, decodedHeight, channels));
+        else if (formats[f] == BandFormat::Qoi)
+            CHECK(DecodeQoi(file.data(), file.size(), decoded, decodedWidth, decodedHeight, channels));
+        if (formats[f] == BandFormat::Bmp)
+        {
+            CHECK(run.bmpMatches);
+            CHECK_EQ(run.bmpBytes, 54 + static_cast<uint64_t>(width) * 3 * height);
+        }
+        else if (!IsGeneratedImage(decoded, width, height))
+        {
+            ReportFailure(__FILE__, __LINE__, what + " does not decode to the generated image");
+        }
+    }
+}
@@ -0,0 +1,333 @@
+#include "TestHarness.h"
+
+#include "AsyncFileWriter.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    //-----------------------------------------------------------------
+    // In-memory file system that logs every operation. While throttled,
+    // writes wait until Release, the way a stalled disk or share would.
+    class FakeFileSystem : public WriterFileSystem
+    {
+    public:
+        class File : public WritableFile
+        {
+        public:
+            File(FakeFileSystem& owner, const std::wstring& path) : owner_(owner), path_(path) {}
+
+            bool Write(const uint8_t* data, size_t size) override
+            {
+                return owner_.WriteTo(path_, data, size);
+            }
+
+            bool Close() override
+            {
+                owner_.Log(L"close " + path_);
+                return true;
+            }
+
+        private:
+            FakeFileSystem& owner_;
+            std::wstring path_;
+        };
+
+        std::unique_ptr<WritableFile> Create(const std::wstring& path, const FileCreateOptions& options) override
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            log_.push_back(L"create " + path + L" " + std::to_wstring(options.preallocate));
+            files_[path].clear();
+            return std::unique_ptr<WritableFile>(new File(*this, path));
+        }
+
+        bool Replace(const std::wstring& from, const std::wstring& to, bool) override
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            log_.push_back(L"replace " + from + L" " + to);
+            auto it = files_.find(from);
+            if (it == files_.end())
+                return false;
+            files_[to] = std::move(it->second);
+            files_.erase(from);
+            return true;
+        }
+
+        void Remove(const std::wstring& path) override
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            log_.push_back(L"remove " + path);
+            files_.erase(path);
+        }
+
+        bool WriteTo(const std::wstring& path, const uint8_t* data, size_t size)
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            writing_ = true;
+            changed_.notify_all();
+            changed_.wait(lock, [this]() { return !throttled_; });
+            writing_ = false;
+            chunks_.push_back(size);
+            if (path.find(failName_) != std::wstring::npos && !failName_.empty())
+                return false;
+            std::vector<uint8_t>& file = files_[path];
+            file.insert(file.end(), data, data + size);
+            return true;
+        }
+
+        void Log(const std::wstring& entry)
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            log_.push_back(entry);
+        }
+
+        void Throttle()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            throttled_ = true;
+        }
+
+        void Release()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            throttled_ = false;
+            changed_.notify_all();
+        }
+
+        // Wait until the writer thread is stuck in a throttled write.
+        void WaitForStalledWrite()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            changed_.wait(lock, [this]() { return writing_; });
+        }
+
+        void FailWritesTo(const std::wstring& name) { failName_ = name; }
+
+        std::map<std::wstring, std::vector<uint8_t>> Files()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return files_;
+        }
+
+        std::vector<std::wstring> TakeLog()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::vector<std::wstring> log;
+            log.swap(log_);
+            return log;
+        }
+
+        std::vector<size_t> Chunks()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return chunks_;
+        }
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable changed_;
+        std::map<std::wstring, std::vector<uint8_t>> files_;
+        std::vector<std::wstring> log_;
+        std::vector<size_t> chunks_;
+        std::wstring failName_;
+        bool throttled_ = false;
+        bool writing_ = false;
+    };
+
+    FileWriteRequest Request(const std::wstring& name, size_t size, uint8_t seed)
+    {
+        FileWriteRequest request;
+        request.fileName = name;
+        request.data.resize(size);
+        for (size_t i = 0; i < size; i++)
+            request.data[i] = static_cast<uint8_t>(seed + i * 7);
+        return request;
+    }
+
+    // Submit from another thread, so a test can watch it block.
+    class BackgroundSubmit
+    {
+    public:
+        BackgroundSubmit(AsyncFileWriter& writer, FileWriteRequest request)
+            : returned_(false), thread_([this, &writer, request]()
+                {
+                    accepted_ = writer.Submit(request);
+                    returned_.store(true);
+                })
+        {
+        }
+
+        bool Returned() const { return returned_.load(); }
+
+        bool Join()
+        {
+            thread_.join();
+            return accepted_;
+        }
+
+    private:
+        std::atomic<bool> returned_;
+        bool accepted_ = false;
+        std::thread thread_;
+    };
+
+    // Wait (for real) until the writer reports a stalled submit.
+    bool WaitForSubmitStalls(const AsyncFileWriter& writer, uint64_t stalls)
+    {
+        for (int i = 0; i < 5000; i++)
+        {
+            if (writer.Stats().submitStalls >= stalls)
+                return true;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    }
+}
+
+TEST(FileWriterWritesTempFileThenRenames)
+{
+    FakeFileSystem fileSystem;
+    std::vector<std::wstring> done;
+    FileWriterOptions options;
+    {
+        AsyncFileWriter writer(fileSystem, options,
+            [&](const FileWriteRequest& request, bool ok)
+            {
+                done.push_back(request.fileName + (ok ? L" ok" : L" failed"));
+            });
+        CHECK(writer.Submit(Request(L"a.png", 2500000, 1)));
+        CHECK(writer.Submit(Request(L"b.png", 10, 2)));
+        writer.Finish();
+        CHECK(!writer.Submit(Request(L"c.png", 10, 3)));
+        CHECK_EQ(writer.Stats().filesWritten, static_cast<uint64_t>(2));
+        CHECK_EQ(writer.Stats().bytesWritten, static_cast<uint64_t>(2500010));
+    }
+
+    std::vector<std::wstring> expectedLog = {
+        L"create a.png.tmp 2500000", L"close a.png.tmp", L"replace a.png.tmp a.png",
+        L"create b.png.tmp 10", L"close b.png.tmp", L"replace b.png.tmp b.png" };
+    CHECK(fileSystem.TakeLog() == expectedLog);
+    std::map<std::wstring, std::vector<uint8_t>> files = fileSystem.Files();
+    CHECK_EQ(files.size(), static_cast<size_t>(2));
+    CHECK(files[L"a.png"] == Request(L"a.png", 2500000, 1).data);
+    CHECK(files[L"b.png"] == Request(L"b.png", 10, 2).data);
+    CHECK(done == (std::vector<std::wstring>{ L"a.png ok", L"b.png ok" }));
+
+    // Full chunks, then the tail.
+    std::vector<size_t> expectedChunks = { AsyncFileWriter::kChunkBytes, AsyncFileWriter::kChunkBytes,
+        2500000 - 2 * AsyncFileWriter::kChunkBytes, 10 };
+    CHECK(fileSystem.Chunks() == expectedChunks);
+}
+
+TEST(FileWriterRemovesTempFileOnFailure)
+{
+    FakeFileSystem fileSystem;
+    fileSystem.FailWritesTo(L"bad");
+    std::vector<bool> results;
+    AsyncFileWriter writer(fileSystem, FileWriterOptions(),
+        [&](const FileWriteRequest&, bool ok) { results.push_back(ok); });
+    writer.Submit(Request(L"bad.png", 100, 1));
+    writer.Submit(Request(L"good.png", 100, 2));
+    writer.Finish();
+
+    CHECK(results == (std::vector<bool>{ false, true }));
+    CHECK_EQ(writer.Stats().filesFailed, static_cast<uint64_t>(1));
+    std::map<std::wstring, std::vector<uint8_t>> files = fileSystem.Files();
+    CHECK_EQ(files.size(), static_cast<size_t>(1));
+    CHECK(files.count(L"good.png") == 1);
+    std::vector<std::wstring> log = fileSystem.TakeLog();
+    REQUIRE(log.size() >= 3);
+    CHECK(log[2] == L"remove bad.png.tmp");
+}
+
+TEST(FileWriterWritesInPlaceWithoutAtomicRename)
+{
+    FakeFileSystem fileSystem;
+    FileWriterOptions options;
+    options.atomicRename = false;
+    options.preallocate = false;
+    AsyncFileWriter writer(fileSystem, options, FileWriteDoneFunction());
+    writer.Submit(Request(L"a.png", 100, 1));
+    writer.Finish();
+    CHECK(fileSystem.TakeLog() == (std::vector<std::wstring>{ L"create a.png 0", L"close a.png" }));
+}
+
+TEST(FileWriterSubmitBlocksAtFileBudget)
+{
+    FakeFileSystem fileSystem;
+    FileWriterOptions options;
+    options.maxQueuedFiles = 2;
+    AsyncFileWriter writer(fileSystem, options, FileWriteDoneFunction());
+
+    fileSystem.Throttle();
+    CHECK(writer.Submit(Request(L"1.png", 10, 1)));
+    fileSystem.WaitForStalledWrite();
+    // The file being written still counts against the budget.
+    CHECK(writer.Submit(Request(L"2.png", 10, 2)));
+    CHECK_EQ(writer.QueuedFiles(), static_cast<size_t>(2));
+
+    BackgroundSubmit third(writer, Request(L"3.png", 10, 3));
+    CHECK(WaitForSubmitStalls(writer, 1));
+    CHECK(!third.Returned());
+    CHECK_EQ(writer.QueuedFiles(), static_cast<size_t>(2));
+
+    fileSystem.Release();
+    CHECK(third.Join());
+    writer.Finish();
+    CHECK_EQ(writer.Stats().filesWritten, static_cast<uint64_t>(3));
+    CHECK_EQ(writer.Stats().maxQueuedFiles, static_cast<size_t>(2));
+    CHECK_EQ(fileSystem.Files().size(), static_cast<size_t>(3));
+}
+
+TEST(FileWriterSubmitBlocksAtByteBudget)
+{
+    FakeFileSystem fileSystem;
+    FileWriterOptions options;
+    options.maxQueuedBytes = 1000;
+    AsyncFileWriter writer(fileSystem, options, FileWriteDoneFunction());
+
+    fileSystem.Throttle();
+    // Larger than the whole budget, but the queue is empty: taken.
+    CHECK(writer.Submit(Request(L"big.png", 5000, 1)));
+    fileSystem.WaitForStalledWrite();
+
+    BackgroundSubmit second(writer, Request(L"small.png", 600, 2));
+    CHECK(WaitForSubmitStalls(writer, 1));
+    CHECK(!second.Returned());
+
+    fileSystem.Release();
+    CHECK(second.Join());
+    writer.Finish();
+    FileWriterStats stats = writer.Stats();
+    CHECK_EQ(stats.filesWritten, static_cast<uint64_t>(2));
+    CHECK_EQ(stats.maxQueuedBytes, static_cast<size_t>(5000));
+    CHECK_EQ(stats.submitStalls, static_cast<uint64_t>(1));
+}
+
+TEST(FileWriterFinishReleasesBlockedSubmit)
+{
+    FakeFileSystem fileSystem;
+    FileWriterOptions options;
+    options.maxQueuedFiles = 1;
+    AsyncFileWriter writer(fileSystem, options, FileWriteDoneFunction());
+
+    fileSystem.Throttle();
+    CHECK(writer.Submit(Request(L"1.png", 10, 1)));
+    fileSystem.WaitForStalledWrite();
+    BackgroundSubmit second(writer, Request(L"2.png", 10, 2));
+    CHECK(WaitForSubmitStalls(writer, 1));
+
+    // Closing turns the waiting submit away instead of leaving it stuck.
+    std::thread finish([&]() { writer.Finish(); });
+    CHECK(!second.Join());
+    fileSystem.Release();
+    finish.join();
+    CHECK_EQ(fileSystem.Files().size(), static_cast<size_t>(1));
+}
@@ -0,0 +1,255 @@
+#include "TestHarness.h"
+
+#include "AsyncLog.h"
+#include "CaptureStats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // Collects what the drain thread writes, and can hold it inside a
+    // write to let the ring fill up.
+    class CaptureBuffer : public std::wstreambuf
+    {
+    public:
+        void Hold()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            held_ = true;
+            entered_ = false;
+        }
+
+        // Wait until the drain thread is stuck in a write.
+        void WaitUntilHeld()
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            changed_.wait(lock, [this]() { return entered_; });
+        }
+
+        void Release()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            held_ = false;
+            changed_.notify_all();
+        }
+
+        std::wstring Take()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            std::wstring text;
+            text.swap(text_);
+            return text;
+        }
+
+    protected:
+        std::streamsize xsputn(const wchar_t* text, std::streamsize count) override
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            entered_ = true;
+            changed_.notify_all();
+            changed_.wait(lock, [this]() { return !held_; });
+            text_.append(text, static_cast<size_t>(count));
+            return count;
+        }
+
+        int_type overflow(int_type c) override
+        {
+            if (c != traits_type::eof())
+            {
+                wchar_t ch = traits_type::to_char_type(c);
+                xsputn(&ch, 1);
+            }
+            return traits_type::not_eof(c);
+        }
+
+    private:
+        std::mutex mutex_;
+        std::condition_variable changed_;
+        std::wstring text_;
+        bool held_ = false;
+        bool entered_ = false;
+    };
+
+    // Points the log at a CaptureBuffer for the lifetime of the object.
+    class LogCapture
+    {
+    public:
+        LogCapture() : previous_(std::wcerr.rdbuf(&buffer_))
+        {
+            SetLogToStderr();
+        }
+
+        ~LogCapture()
+        {
+            FlushLog();
+            std::wcerr.rdbuf(previous_);
+        }
+
+        CaptureBuffer& Buffer() { return buffer_; }
+
+    private:
+        CaptureBuffer buffer_;
+        std::wstreambuf* previous_;
+    };
+
+    std::vector<std::wstring> SplitLines(const std::wstring& text)
+    {
+        std::vector<std::wstring> lines;
+        size_t start = 0;
+        for (size_t end; (end = text.find(L'\n', start)) != std::wstring::npos; start = end + 1)
+            lines.push_back(text.substr(start, end - start));
+        return lines;
+    }
+}
+
+TEST(AsyncLogKeepsEveryResultLineInOrderUnderContention)
+{
+    LogCapture capture;
+    const int kThreads = 8;
+    const int kLinesPerThread = 3000;
+    const std::wstring longText(2000, L'x');
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++)
+    {
+        threads.emplace_back([t, kLinesPerThread, &longText]()
+        {
+            for (int i = 0; i < kLinesPerThread; i++)
+            {
+                if (i % 500 == 0)
+                    LogResult() << L"long " << t << L" " << i << L" " << longText << L"\n";
+                else
+                    LogResult() << L"line " << t << L" " << i << L"\n";
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    FlushLog();
+
+    std::vector<int> next(kThreads, 0);
+    int longLines = 0;
+    bool wellFormed = true;
+    for (const std::wstring& line : SplitLines(capture.Buffer().Take()))
+    {
+        std::wistringstream in(line);
+        std::wstring kind, text;
+        int t = -1, i = -1;
+        in >> kind >> t >> i;
+        if (t < 0 || t >= kThreads || i != next[t])
+        {
+            wellFormed = false;
+            break;
+        }
+        next[t]++;
+        if (kind == L"long")
+        {
+            in >> text;
+            wellFormed = wellFormed && text == longText;
+            longLines++;
+        }
+    }
+    CHECK(wellFormed);
+    for (int t = 0; t < kThreads; t++)
+        CHECK_EQ(next[t], kLinesPerThread);
+    CHECK_EQ(longLines, kThreads * kLinesPerThread / 500);
+}
+
+TEST(AsyncLogCountsInfoLinesDroppedWhenFull)
+{
+    LogCapture capture;
+    CaptureBuffer& buffer = capture.Buffer();
+    uint64_t droppedBefore = LogLinesDropped();
+
+    buffer.Hold();
+    LogResult() << L"first\n";
+    buffer.WaitUntilHeld();
+
+    // The drain thread is stuck writing the first line: the ring fills
+    // and the rest of these are dropped.
+    const int kLines = 2000;
+    for (int i = 0; i < kLines; i++)
+        LogInfo() << L"info " << i << L"\n";
+    uint64_t dropped = LogLinesDropped() - droppedBefore;
+
+    buffer.Release();
+    FlushLog();
+    std::vector<std::wstring> lines = SplitLines(buffer.Take());
+
+    CHECK(dropped > 0);
+    REQUIRE(!lines.empty());
+    CHECK(lines[0] == L"first");
+    CHECK_EQ(lines.size() - 1 + dropped, static_cast<uint64_t>(kLines));
+
+    // Once there is room again, nothing is lost.
+    for (int i = 0; i < 10; i++)
+        LogInfo() << L"again " << i << L"\n";
+    FlushLog();
+    CHECK_EQ(SplitLines(buffer.Take()).size(), static_cast<size_t>(10));
+    CHECK_EQ(LogLinesDropped() - droppedBefore, dropped);
+}
+
+//---------------------------------------------------------------------
+TEST(LatencyHistogramSmallValuesAreExact)
+{
+    LatencyHistogram histogram;
+    CHECK_EQ(histogram.Percentile(0.5), static_cast<uint64_t>(0));
+    for (uint64_t value = 1; value <= 10; value++)
+        histogram.Record(value);
+    CHECK_EQ(histogram.Count(), static_cast<uint64_t>(10));
+    CHECK_EQ(histogram.Min(), static_cast<uint64_t>(1));
+    CHECK_EQ(histogram.Max(), static_cast<uint64_t>(10));
+    CHECK(histogram.Mean() == 5.5);
+    CHECK_EQ(histogram.Percentile(0.0), static_cast<uint64_t>(1));
+    CHECK_EQ(histogram.Percentile(0.5), static_cast<uint64_t>(5));
+    CHECK_EQ(histogram.Percentile(0.95), static_cast<uint64_t>(10));
+    CHECK_EQ(histogram.Percentile(1.0), static_cast<uint64_t>(10));
+}
+
+TEST(LatencyHistogramPercentilesWithinBucketError)
+{
+    // 1 us to 100 ms, log-uniform and shuffled, as frame times spread.
+    std::vector<uint64_t> samples;
+    TestRng rng(7);
+    for (int i = 0; i < 100000; i++)
+    {
+        double exponent = 3.0 + 5.0 * (rng.Next() % 1000000) / 1000000.0;
+        samples.push_back(static_cast<uint64_t>(std::pow(10.0, exponent)));
+    }
+
+    LatencyHistogram histogram;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++)
+    {
+        threads.emplace_back([t, &samples, &histogram]()
+        {
+            for (size_t i = t; i < samples.size(); i += 4)
+                histogram.Record(samples[i]);
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    std::vector<uint64_t> sorted = samples;
+    std::sort(sorted.begin(), sorted.end());
+    CHECK_EQ(histogram.Count(), static_cast<uint64_t>(sorted.size()));
+    CHECK_EQ(histogram.Min(), sorted.front());
+    CHECK_EQ(histogram.Max(), sorted.back());
+
+    const double fractions[] = { 0.01, 0.25, 0.5, 0.9, 0.95, 0.99, 0.999 };
+    for (double fraction : fractions)
+    {
+        size_t rank = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+        double exact = static_cast<double>(sorted[rank - 1]);
+        double reported = static_cast<double>(histogram.Percentile(fraction));
+        CHECK(std::fabs(reported - exact) <= exact * 0.035);
+    }
+}
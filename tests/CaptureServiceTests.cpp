@@ -0,0 +1,410 @@
+#include "TestHarness.h"
+
+#include "CaptureService.h"
+#include "QoiCodec.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // A client that sends a fixed byte stream in chunks of a given size,
+    // cut into lines by ServiceLineBuffer as the pipe connection does, and
+    // records every reply.
+    class FakeConnection : public ServiceConnection
+    {
+    public:
+        FakeConnection(const std::string& stream, size_t chunkSize)
+            : stream_(stream), chunkSize_(chunkSize)
+        {
+        }
+
+        bool ReadLine(std::string& line) override
+        {
+            for (;;)
+            {
+                if (lines_.NextLine(line))
+                {
+                    linesRead_++;
+                    return true;
+                }
+                if (lines_.Overflowed() || position_ >= stream_.size())
+                    return false;
+                const size_t size = (std::min)(chunkSize_, stream_.size() - position_);
+                lines_.Append(stream_.data() + position_, size);
+                position_ += size;
+            }
+        }
+
+        bool WriteLine(const std::string& line) override
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            replies_.push_back(line);
+            return true;
+        }
+
+        std::vector<std::string> Replies()
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return replies_;
+        }
+
+        int LinesRead() const { return linesRead_.load(); }
+
+    private:
+        std::string stream_;
+        size_t chunkSize_;
+        size_t position_ = 0;
+        ServiceLineBuffer lines_;
+        std::atomic<int> linesRead_{ 0 };
+        std::mutex mutex_;
+        std::vector<std::string> replies_;
+    };
+
+    // Stand-in for the screen: a region request gets a generated frame of
+    // its size, encoded as QOI, or a few raw bytes for the other formats.
+    void FakeCapture(const ServiceRequest& request, ServiceReply& reply)
+    {
+        reply.format = request.format;
+        reply.width = request.target == "region" ? request.region[2] : 64;
+        reply.height = request.target == "region" ? request.region[3] : 48;
+        Frame frame;
+        frame.Allocate(reply.width, reply.height, FrameFormat::Bgrx32);
+        for (int y = 0; y < reply.height; y++)
+        {
+            for (int x = 0; x < reply.width * 4; x++)
+                frame.View().Row(y)[x] = static_cast<uint8_t>(x ^ y);
+        }
+        if (request.format == "qoi")
+            EncodeQoi(frame.View(), reply.data);
+        else
+            reply.data.assign(frame.Data(), frame.Data() + 5);
+        reply.bytes = reply.data.size();
+        reply.ok = true;
+    }
+
+    // The reply with the given id, or an empty string.
+    std::string ReplyFor(const std::vector<std::string>& replies, const std::string& id)
+    {
+        const std::string key = "{\"id\": \"" + id + "\",";
+        for (const std::string& reply : replies)
+        {
+            if (reply.compare(0, key.size(), key) == 0)
+                return reply;
+        }
+        return std::string();
+    }
+
+    bool Contains(const std::string& text, const std::string& part)
+    {
+        return text.find(part) != std::string::npos;
+    }
+
+    bool Rejects(const std::string& line, const std::string& expectedError)
+    {
+        ServiceRequest request;
+        std::string error;
+        return !ParseServiceRequest(line, request, error) && Contains(error, expectedError);
+    }
+}
+
+//---------------------------------------------------------------------
+TEST(ServiceParsesRequests)
+{
+    ServiceRequest request;
+    std::string error;
+    REQUIRE(ParseServiceRequest(" { \"id\" : \"a7\", \"target\": \"region\", \"region\": [-1920, -8, 640, 480],"
+        " \"format\": \"jpg\", \"quality\": 80, \"pointer\": true, \"path\": \"C:\\\\shots\\\\a.jpg\" } ",
+        request, error));
+    CHECK(request.command == ServiceCommand::Capture);
+    CHECK_EQ(request.id, std::string("a7"));
+    CHECK_EQ(request.target, std::string("region"));
+    CHECK_EQ(request.region[0], -1920);
+    CHECK_EQ(request.region[1], -8);
+    CHECK_EQ(request.region[2], 640);
+    CHECK_EQ(request.region[3], 480);
+    CHECK_EQ(request.format, std::string("jpg"));
+    CHECK_EQ(request.quality, 80);
+    CHECK(request.pointer);
+    CHECK_EQ(request.path, std::string("C:\\shots\\a.jpg"));
+
+    // Numeric ids keep their text; unknown keys of any shape are skipped;
+    // \u escapes become UTF-8, surrogate pairs included.
+    REQUIRE(ParseServiceRequest("{\"id\": 12.50, \"extra\": {\"a\": [1, {\"b\": null}], \"c\": false},"
+        " \"target\": \"window\", \"window\": \"Caf\\u00e9 \\ud83d\\ude00\"}", request, error));
+    CHECK_EQ(request.id, std::string("12.50"));
+    CHECK_EQ(request.window, std::string("Caf\xC3\xA9 \xF0\x9F\x98\x80"));
+
+    // Defaults, and the commands that need no target.
+    REQUIRE(ParseServiceRequest("{}", request, error));
+    CHECK_EQ(request.target, std::string("screen"));
+    CHECK_EQ(request.format, std::string("png"));
+    REQUIRE(ParseServiceRequest("{\"command\": \"ping\", \"target\": \"monitor\"}", request, error));
+    CHECK(request.command == ServiceCommand::Ping);
+    REQUIRE(ParseServiceRequest("{\"command\": \"quit\"}", request, error));
+    CHECK(request.command == ServiceCommand::Quit);
+}
+
+TEST(ServiceRejectsMalformedRequests)
+{
+    CHECK(Rejects("", "JSON object"));
+    CHECK(Rejects("[1, 2]", "JSON object"));
+    CHECK(Rejects("{\"id\": \"1\"", "malformed"));
+    CHECK(Rejects("{\"id\" \"1\"}", "malformed"));
+    CHECK(Rejects("{\"id\": \"1\",}", "malformed"));
+    CHECK(Rejects("{\"id\": \"unterminated}", "invalid value for \"id\""));
+    CHECK(Rejects("{\"window\": \"tab\there\"}", "invalid value for \"window\""));
+    CHECK(Rejects("{\"id\": \"1\"} {}", "unexpected text"));
+    CHECK(Rejects("{\"x\": tru}", "malformed"));
+    CHECK(Rejects("{\"x\": 1e999}", "malformed"));
+    CHECK(Rejects("{\"x\": \"\\ud83d\"}", "malformed"));
+
+    // Nesting deeper than the parser follows.
+    std::string deep = "{\"x\": ";
+    for (int i = 0; i < 40; i++)
+        deep += "[";
+    for (int i = 0; i < 40; i++)
+        deep += "]";
+    CHECK(Rejects(deep + "}", "malformed"));
+
+    // Values out of range or of the wrong type.
+    CHECK(Rejects("{\"quality\": 101}", "\"quality\""));
+    CHECK(Rejects("{\"quality\": \"90\"}", "\"quality\""));
+    CHECK(Rejects("{\"monitor\": -1}", "\"monitor\""));
+    CHECK(Rejects("{\"monitor\": 1.5}", "\"monitor\""));
+    CHECK(Rejects("{\"region\": [0, 0, 0, 10]}", "\"region\""));
+    CHECK(Rejects("{\"region\": [0, 0, 10]}", "\"region\""));
+    CHECK(Rejects("{\"region\": [0, 0, 10, 10, 10]}", "\"region\""));
+    CHECK(Rejects("{\"region\": [0, 0, 2000000, 10]}", "\"region\""));
+    CHECK(Rejects("{\"format\": \"gif\"}", "\"format\""));
+    CHECK(Rejects("{\"target\": \"printer\"}", "\"target\""));
+    CHECK(Rejects("{\"pointer\": 1}", "\"pointer\""));
+    CHECK(Rejects("{\"command\": \"reboot\"}", "\"command\""));
+
+    // Targets without what they need.
+    CHECK(Rejects("{\"target\": \"monitor\"}", "needs \"monitor\""));
+    CHECK(Rejects("{\"target\": \"region\"}", "needs \"region\""));
+    CHECK(Rejects("{\"target\": \"window\", \"window\": \"\"}", "needs \"window\""));
+
+    // The id survives a failure after it, for the error reply; the error
+    // does not outlive the next request.
+    ServiceRequest request;
+    std::string error;
+    CHECK(!ParseServiceRequest("{\"id\": \"q\", \"quality\": -5}", request, error));
+    CHECK_EQ(request.id, std::string("q"));
+    CHECK(ParseServiceRequest("{\"id\": \"r\"}", request, error));
+    CHECK(error.empty());
+}
+
+TEST(ServiceFormatsReplies)
+{
+    const char* inputs[] = { "", "f", "fo", "foo", "foob", "fooba", "foobar" };
+    const char* encoded[] = { "", "Zg==", "Zm8=", "Zm9v", "Zm9vYg==", "Zm9vYmE=", "Zm9vYmFy" };
+    for (int i = 0; i < 7; i++)
+    {
+        const std::string input = inputs[i];
+        CHECK_EQ(Base64Encode(reinterpret_cast<const uint8_t*>(input.data()), input.size()), std::string(encoded[i]));
+    }
+
+    ServiceReply reply;
+    reply.id = "a\"b";
+    reply.error = "bad\nline\x01";
+    CHECK_EQ(FormatServiceReply(reply),
+        std::string("{\"id\": \"a\\\"b\", \"ok\": false, \"error\": \"bad\\nline\\u0001\"}"));
+
+    reply = ServiceReply();
+    reply.id = "7";
+    reply.ok = true;
+    reply.format = "png";
+    reply.width = 3;
+    reply.height = 2;
+    reply.bytes = 3;
+    reply.data = { 'f', 'o', 'o' };
+    reply.milliseconds = 1.5;
+    CHECK_EQ(FormatServiceReply(reply), std::string("{\"id\": \"7\", \"ok\": true, \"format\": \"png\", \"width\": 3,"
+        " \"height\": 2, \"bytes\": 3, \"ms\": 1.500, \"data\": \"Zm9v\"}"));
+}
+
+//---------------------------------------------------------------------
+TEST(ServiceLineBufferSplitsAndLimitsLines)
+{
+    ServiceLineBuffer lines;
+    std::string line;
+    CHECK(!lines.NextLine(line));
+    lines.Append("one\r\ntw", 7);
+    REQUIRE(lines.NextLine(line));
+    CHECK_EQ(line, std::string("one"));
+    CHECK(!lines.NextLine(line));
+    lines.Append("o\n\nthree", 8);
+    REQUIRE(lines.NextLine(line));
+    CHECK_EQ(line, std::string("two"));
+    REQUIRE(lines.NextLine(line));
+    CHECK_EQ(line, std::string(""));
+    CHECK(!lines.NextLine(line));
+    CHECK(!lines.Overflowed());
+
+    // Exactly the limit is fine, CRLF or not; one byte more is not, even
+    // when the line break is already there.
+    const std::string longest(kMaxServiceRequestBytes, 'x');
+    ServiceLineBuffer fits;
+    fits.Append(longest.data(), longest.size());
+    CHECK(!fits.Overflowed());
+    fits.Append("\r\n", 2);
+    REQUIRE(fits.NextLine(line));
+    CHECK_EQ(line.size(), kMaxServiceRequestBytes);
+
+    ServiceLineBuffer tooLong;
+    tooLong.Append(longest.data(), longest.size());
+    tooLong.Append("x\nnext\n", 7);
+    CHECK(tooLong.Overflowed());
+    CHECK(!tooLong.NextLine(line));
+}
+
+TEST(ServiceAnswersEveryRequestOnce)
+{
+    // Valid, malformed, blank and ping lines, in chunks that cut lines
+    // anywhere.
+    std::string stream;
+    for (int i = 0; i < 40; i++)
+    {
+        const std::string id = std::to_string(i);
+        if (i % 10 == 3)
+            stream += "{\"id\": \"" + id + "\", \"quality\": 500}\n";
+        else if (i % 10 == 5)
+            stream += "{\"id\": \"" + id + "\", \"command\": \"ping\"}\r\n";
+        else if (i % 10 == 7)
+            stream += "not json " + id + "\n   \n";
+        else
+            stream += "{\"id\": \"" + id + "\", \"target\": \"region\", \"region\": [0, 0, " +
+                std::to_string(8 + i) + ", 5], \"format\": \"qoi\"}\n";
+    }
+
+    for (size_t chunk : { size_t(1), size_t(7), size_t(4096) })
+    {
+        ServiceOptions options;
+        options.workers = 3;
+        options.maxQueued = 4;
+        CaptureService service(FakeCapture, options);
+        std::shared_ptr<FakeConnection> connection = std::make_shared<FakeConnection>(stream, chunk);
+        service.Serve(connection);
+
+        // Serve returns once every request it read has been answered.
+        const std::vector<std::string> replies = connection->Replies();
+        CHECK_EQ(replies.size(), static_cast<size_t>(40));
+        CHECK_EQ(service.RequestsServed(), static_cast<uint64_t>(40));
+        for (int i = 0; i < 40; i++)
+        {
+            const std::string id = std::to_string(i);
+            const std::string reply = ReplyFor(replies, id);
+            if (i % 10 == 7)
+            {
+                // Nothing to take the id from.
+                continue;
+            }
+            if (reply.empty())
+            {
+                ReportFailure(__FILE__, __LINE__, "no reply for request " + id);
+                continue;
+            }
+            if (i % 10 == 3)
+                CHECK(Contains(reply, "\"ok\": false, \"error\": \"invalid value for \\\"quality\\\"\""));
+            else if (i % 10 == 5)
+                CHECK(Contains(reply, "\"ok\": true, \"ms\": "));
+            else
+                CHECK(Contains(reply, "\"ok\": true, \"format\": \"qoi\", \"width\": " + std::to_string(8 + i) +
+                    ", \"height\": 5"));
+        }
+        int unparsed = 0;
+        for (const std::string& reply : replies)
+            unparsed += Contains(reply, "{\"id\": \"\", \"ok\": false, \"error\": \"request must be a JSON object\"}");
+        CHECK_EQ(unparsed, 4);
+    }
+}
+
+TEST(ServiceQueueBoundsRequestsInFlight)
+{
+    // One slow worker and room for two waiting requests: the reader must
+    // stop taking lines rather than queue them all.
+    ServiceOptions options;
+    options.workers = 1;
+    options.maxQueued = 2;
+    std::shared_ptr<FakeConnection> connection;
+    std::atomic<int> worstBacklog(0);
+    std::atomic<int> handled(0);
+    CaptureService service([&](const ServiceRequest& request, ServiceReply& reply)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            const int backlog = connection->LinesRead() - handled.load();
+            int worst = worstBacklog.load();
+            while (backlog > worst && !worstBacklog.compare_exchange_weak(worst, backlog))
+            {
+            }
+            FakeCapture(request, reply);
+            handled++;
+        }, options);
+
+    std::string stream;
+    for (int i = 0; i < 30; i++)
+        stream += "{\"id\": \"" + std::to_string(i) + "\"}\n";
+    connection = std::make_shared<FakeConnection>(stream, 4096);
+    service.Serve(connection);
+
+    CHECK_EQ(connection->Replies().size(), static_cast<size_t>(30));
+    // The one being handled, the queued ones and the one the reader holds.
+    CHECK(worstBacklog.load() <= 1 + 2 + 1);
+}
+
+TEST(ServiceOversizedRequestEndsTheConnection)
+{
+    std::string stream = "{\"id\": \"before\"}\n{\"id\": \"big\", \"window\": \"";
+    stream += std::string(kMaxServiceRequestBytes, 'w');
+    stream += "\"}\n{\"id\": \"after\"}\n";
+    ServiceOptions options;
+    options.workers = 2;
+    CaptureService service(FakeCapture, options);
+    std::shared_ptr<FakeConnection> connection = std::make_shared<FakeConnection>(stream, 4096);
+    service.Serve(connection);
+
+    const std::vector<std::string> replies = connection->Replies();
+    CHECK_EQ(replies.size(), static_cast<size_t>(1));
+    CHECK(!ReplyFor(replies, "before").empty());
+    CHECK_EQ(connection->LinesRead(), 1);
+}
+
+TEST(ServiceQuitAnswersQueuedRequestsFirst)
+{
+    ServiceOptions options;
+    options.workers = 1;
+    std::atomic<int> handled(0);
+    CaptureService service([&](const ServiceRequest& request, ServiceReply& reply)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            FakeCapture(request, reply);
+            handled++;
+        }, options);
+
+    std::string stream;
+    for (int i = 0; i < 3; i++)
+        stream += "{\"id\": \"" + std::to_string(i) + "\"}\n";
+    stream += "{\"id\": \"q\", \"command\": \"quit\"}\n{\"id\": \"late\"}\n";
+    std::shared_ptr<FakeConnection> connection = std::make_shared<FakeConnection>(stream, 4096);
+    service.Serve(connection);
+
+    CHECK(service.Stopping());
+    CHECK_EQ(handled.load(), 3);
+    const std::vector<std::string> replies = connection->Replies();
+    CHECK_EQ(replies.size(), static_cast<size_t>(4));
+    CHECK(Contains(ReplyFor(replies, "q"), "\"ok\": true"));
+    CHECK(ReplyFor(replies, "late").empty());
+
+    // A client that connects after the stop is not read at all.
+    std::shared_ptr<FakeConnection> another = std::make_shared<FakeConnection>("{\"id\": \"x\"}\n", 4096);
+    service.Serve(another);
+    CHECK_EQ(another->LinesRead(), 0);
+    CHECK(another->Replies().empty());
+}
@@ -0,0 +1,224 @@
+#include "TestHarness.h"
+
+#include "ChangeDetector.h"
+#include "FakeClock.h"
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+    void FillNoise(Frame& frame, int width, int height, uint32_t seed)
+    {
+        frame.Allocate(width, height, FrameFormat::Bgrx32);
+        TestRng rng(seed);
+        for (int y = 0; y < height; y++)
+        {
+            uint32_t* row = reinterpret_cast<uint32_t*>(frame.View().Row(y));
+            for (int x = 0; x < width; x++)
+                row[x] = rng.Next();
+        }
+    }
+
+    uint32_t& PixelAt(Frame& frame, int x, int y)
+    {
+        return reinterpret_cast<uint32_t*>(frame.View().Row(y))[x];
+    }
+
+    // Change one pixel in each of count tiles of a 128 x 128 frame of
+    // 32 x 32 tiles, starting at tile first.
+    void TouchTiles(Frame& frame, int first, int count)
+    {
+        for (int t = first; t < first + count; t++)
+            PixelAt(frame, (t % 4) * 32 + 5, (t / 4) * 32 + 9) ^= 0x010101;
+    }
+
+    bool Near(double a, double b)
+    {
+        return std::fabs(a - b) < 1e-9;
+    }
+}
+
+TEST(ChangeDetectorMeasuresChangedTiles)
+{
+    // 100 x 70 in 32-pixel tiles: the last column of tiles is 4 wide and
+    // the last row 6 high.
+    const int width = 100, height = 70;
+    Frame frame;
+    FillNoise(frame, width, height, 1);
+    ChangeDetector detector;
+    CHECK_EQ(detector.Measure(frame.Data(), width, height, static_cast<int>(frame.Stride())), 1.0);
+    detector.SetReference(frame.Data(), width, height, static_cast<int>(frame.Stride()));
+
+    // Unchanged, or only alpha changed: nothing, in any row phase.
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            PixelAt(frame, x, y) ^= 0xFF000000;
+    for (int poll = 0; poll < 8; poll++)
+        CHECK_EQ(detector.Measure(frame.Data(), width, height, static_cast<int>(frame.Stride())), 0.0);
+
+    // One pixel per case; over rowStep polls exactly one samples its row
+    // and reports the whole tile's area.
+    const int points[][4] = { { 0, 0, 32, 32 }, { 40, 33, 32, 32 }, { 99, 69, 4, 6 }, { 97, 10, 4, 32 },
+        { 31, 64, 32, 6 } };
+    for (const auto& point : points)
+    {
+        PixelAt(frame, point[0], point[1]) ^= 0x00000100;
+        const double area = static_cast<double>(point[2]) * point[3] / (width * height);
+        int seen = 0;
+        for (int poll = 0; poll < 4; poll++)
+        {
+            const double changed = detector.Measure(frame.Data(), width, height, static_cast<int>(frame.Stride()));
+            if (Near(changed, area))
+                seen++;
+            else if (changed != 0.0)
+                ReportFailure(__FILE__, __LINE__, "changed " + std::to_string(changed) + " at " +
+                    std::to_string(point[0]) + "," + std::to_string(point[1]));
+        }
+        if (seen != 1)
+        {
+            ReportFailure(__FILE__, __LINE__, "pixel at " + std::to_string(point[0]) + "," +
+                std::to_string(point[1]) + " seen in " + std::to_string(seen) + " of 4 polls");
+        }
+        PixelAt(frame, point[0], point[1]) ^= 0x00000100;
+    }
+
+    // Every row sampled with rowStep 1; a new size is all change.
+    ChangeDetectorOptions options;
+    options.rowStep = 1;
+    ChangeDetector everyRow(options);
+    everyRow.SetReference(frame.Data(), width, height, static_cast<int>(frame.Stride()));
+    PixelAt(frame, 50, 50) ^= 1;
+    PixelAt(frame, 51, 50) ^= 1;
+    CHECK(Near(everyRow.Measure(frame.Data(), width, height, static_cast<int>(frame.Stride())),
+        32.0 * 32 / (width * height)));
+    CHECK_EQ(everyRow.Measure(frame.Data(), width - 1, height, static_cast<int>(frame.Stride())), 1.0);
+}
+
+TEST(ChangeCaptureThresholdAndFirstFrame)
+{
+    // 128 x 128 in sixteen tiles, each 1/16 of the area, sampled on every
+    // row. Frames are scripted poll by poll.
+    Frame base;
+    FillNoise(base, 128, 128, 2);
+    struct Poll
+    {
+        int first;
+        int tiles;      // Tiles changed from base, cumulative with first.
+    };
+    const Poll script[] =
+    {
+        { 0, 0 },       // First frame: always taken, however still.
+        { 0, 0 },
+        { 0, 1 },       // 1/16 is under the threshold...
+        { 0, 1 },
+        { 0, 2 },       // ...2/16 against the last frame taken is over it.
+        { 0, 2 },
+        { 3, 1 },       // One new tile and two back to how they were: 3/16.
+        { 3, 9 },       // Eight more than the last frame taken.
+    };
+    const int polls = sizeof(script) / sizeof(script[0]);
+    int poll = 0;
+    CallbackFrameSource source([&](Frame& frame) -> bool
+        {
+            if (poll >= polls)
+                return false;
+            frame.Allocate(128, 128, FrameFormat::Bgrx32);
+            memcpy(frame.Data(), base.Data(), static_cast<size_t>(base.Stride()) * 128);
+            TouchTiles(frame, script[poll].first, script[poll].tiles);
+            poll++;
+            return true;
+        });
+
+    FakeScheduleClock clock;
+    ChangeCaptureOptions options;
+    options.threshold = 0.1;
+    options.pollInterval = 0.5;
+    options.clock = &clock;
+    options.frameCount = 100;
+    options.detector.rowStep = 1;
+    std::vector<int> acceptedPolls;
+    std::vector<double> changes;
+    const int accepted = RunChangeCapture(source, options,
+        [&](Frame&, int index, double changed, const FrameTiming& timing) -> bool
+        {
+            CHECK_EQ(index, static_cast<int>(acceptedPolls.size()) + 1);
+            acceptedPolls.push_back(static_cast<int>(timing.slot));
+            changes.push_back(changed);
+            return true;
+        });
+
+    // The grab failing after the script ends the loop.
+    CHECK_EQ(accepted, 4);
+    REQUIRE(acceptedPolls.size() == 4);
+    CHECK_EQ(acceptedPolls[0], 0);
+    CHECK_EQ(acceptedPolls[1], 4);
+    CHECK_EQ(acceptedPolls[2], 6);
+    CHECK_EQ(acceptedPolls[3], 7);
+    CHECK_EQ(changes[0], 1.0);
+    CHECK(Near(changes[1], 2.0 / 16));
+    CHECK(Near(changes[2], 3.0 / 16));
+    CHECK(Near(changes[3], 8.0 / 16));
+
+    // A zero threshold takes any change but still not a still frame; the
+    // callback can end the run.
+    poll = 0;
+    options.threshold = 0.0;
+    acceptedPolls.clear();
+    CHECK_EQ(RunChangeCapture(source, options,
+        [&](Frame&, int index, double, const FrameTiming& timing) -> bool
+        {
+            acceptedPolls.push_back(static_cast<int>(timing.slot));
+            return index < 3;
+        }), 3);
+    REQUIRE(acceptedPolls.size() == 3);
+    CHECK_EQ(acceptedPolls[1], 2);
+    CHECK_EQ(acceptedPolls[2], 4);
+}
+
+TEST(ChangeCaptureMaxGapCountsFromLastFrame)
+{
+    // Still frames but for one change: the forced frames come maxGap after
+    // the last frame taken, whatever took it.
+    Frame base;
+    FillNoise(base, 128, 128, 3);
+    int poll = 0;
+    CallbackFrameSource source([&](Frame& frame) -> bool
+        {
+            frame.Allocate(128, 128, FrameFormat::Bgrx32);
+            memcpy(frame.Data(), base.Data(), static_cast<size_t>(base.Stride()) * 128);
+            if (poll >= 2)
+                TouchTiles(frame, 0, 4);
+            poll++;
+            return true;
+        });
+
+    FakeScheduleClock clock;
+    ChangeCaptureOptions options;
+    options.threshold = 0.2;
+    options.pollInterval = 1.0;
+    options.maxGap = 2.5;
+    options.clock = &clock;
+    options.frameCount = 4;
+    options.detector.rowStep = 1;
+    std::vector<int> acceptedPolls;
+    std::vector<double> changes;
+    CHECK_EQ(RunChangeCapture(source, options,
+        [&](Frame&, int, double changed, const FrameTiming& timing) -> bool
+        {
+            acceptedPolls.push_back(static_cast<int>(timing.slot));
+            changes.push_back(changed);
+            return true;
+        }), 4);
+    CHECK_EQ(poll, 9);
+    REQUIRE(acceptedPolls.size() == 4);
+    CHECK_EQ(acceptedPolls[0], 0);
+    CHECK_EQ(acceptedPolls[1], 2);      // 4/16 changed.
+    CHECK_EQ(acceptedPolls[2], 5);      // 3 s after poll 2.
+    CHECK_EQ(acceptedPolls[3], 8);
+    CHECK(Near(changes[1], 0.25));
+    CHECK_EQ(changes[2], 0.0);
+    CHECK_EQ(changes[3], 0.0);
+}
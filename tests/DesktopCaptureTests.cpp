@@ -0,0 +1,247 @@
+#include "TestHarness.h"
+
+#include "DesktopCapture.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // Monitors at fixed rectangles whose pixels say which monitor and
+    // which desktop pixel they are. A grab can be made smaller than its
+    // rectangle, or fail.
+    class FakeMonitors : public MonitorSource
+    {
+    public:
+        explicit FakeMonitors(const std::vector<DesktopRect>& rects)
+            : rects_(rects), grabSizes_(rects.size()), fail_(rects.size(), false)
+        {
+            for (size_t i = 0; i < rects.size(); i++)
+                grabSizes_[i] = { rects[i].Width(), rects[i].Height() };
+        }
+
+        bool Monitors(std::vector<DesktopRect>& monitors) override
+        {
+            monitors = rects_;
+            return true;
+        }
+
+        bool Grab(int index, Frame& frame) override
+        {
+            grabs_++;
+            if (fail_[index])
+                return false;
+            const DesktopRect& rect = rects_[index];
+            const int width = grabSizes_[index].first;
+            const int height = grabSizes_[index].second;
+            frame.Allocate(width, height, FrameFormat::Bgrx32);
+            for (int y = 0; y < height; y++)
+            {
+                uint32_t* row = reinterpret_cast<uint32_t*>(frame.View().Row(y));
+                for (int x = 0; x < width; x++)
+                    row[x] = PixelOf(index, rect.left + x, rect.top + y);
+            }
+            return true;
+        }
+
+        static uint32_t PixelOf(int monitor, int x, int y)
+        {
+            return static_cast<uint32_t>(monitor + 1) << 24 ^ static_cast<uint32_t>(x * 2654435761u) ^
+                static_cast<uint32_t>(y * 40503u);
+        }
+
+        std::vector<std::pair<int, int>>& GrabSizes() { return grabSizes_; }
+        std::vector<bool>& Fail() { return fail_; }
+        int Grabs() const { return grabs_; }
+
+    private:
+        std::vector<DesktopRect> rects_;
+        std::vector<std::pair<int, int>> grabSizes_;
+        std::vector<bool> fail_;
+        std::atomic<int> grabs_{ 0 };
+    };
+
+    DesktopRect Rect(int left, int top, int width, int height)
+    {
+        DesktopRect rect;
+        rect.left = left;
+        rect.top = top;
+        rect.right = left + width;
+        rect.bottom = top + height;
+        return rect;
+    }
+
+    // What Stitch should make of desktop pixel (x, y): the monitor with
+    // the leftmost edge among those whose grab covers it (the first one
+    // listed on a tie), else the gap colour.
+    uint32_t ExpectedPixel(FakeMonitors& source, const std::vector<DesktopRect>& rects, int x, int y,
+        uint32_t gapColor)
+    {
+        int best = -1;
+        for (size_t i = 0; i < rects.size(); i++)
+        {
+            const DesktopRect& r = rects[i];
+            const int width = (std::min)(r.Width(), source.GrabSizes()[i].first);
+            const int height = (std::min)(r.Height(), source.GrabSizes()[i].second);
+            if (x < r.left || x >= r.left + width || y < r.top || y >= r.top + height)
+                continue;
+            if (best < 0 || r.left < rects[best].left)
+                best = static_cast<int>(i);
+        }
+        return best < 0 ? gapColor : FakeMonitors::PixelOf(best, x, y);
+    }
+
+    // Gap pixels counted one by one.
+    uint64_t CountGapPixels(const std::vector<DesktopRect>& rects)
+    {
+        const DesktopRect bounds = DesktopBounds(rects);
+        uint64_t gaps = 0;
+        for (int y = bounds.top; y < bounds.bottom; y++)
+        {
+            for (int x = bounds.left; x < bounds.right; x++)
+            {
+                bool covered = false;
+                for (const DesktopRect& r : rects)
+                    covered = covered || (x >= r.left && x < r.right && y >= r.top && y < r.bottom);
+                gaps += covered ? 0 : 1;
+            }
+        }
+        return gaps;
+    }
+
+    // Layouts with negative origins, gaps, mixed sizes and overlaps.
+    std::vector<std::vector<DesktopRect>> TestLayouts()
+    {
+        std::vector<std::vector<DesktopRect>> layouts;
+        // One monitor away from the origin.
+        layouts.push_back({ Rect(-300, -200, 160, 90) });
+        // Side by side, secondary left of the primary and taller, so the
+        // bounding box has gaps above and below the primary.
+        layouts.push_back({ Rect(0, 0, 192, 108), Rect(-120, -40, 120, 200) });
+        // Staggered row with a gap between the second and third, at
+        // different heights.
+        layouts.push_back({ Rect(0, 0, 100, 80), Rect(100, 30, 64, 64), Rect(200, -25, 90, 150) });
+        // L-shape: one stacked below the primary, shifted left.
+        layouts.push_back({ Rect(0, 0, 150, 100), Rect(-70, 100, 130, 70), Rect(150, 20, 40, 40) });
+        // Mirrored and overlapping monitors, and one of zero size.
+        layouts.push_back({ Rect(10, 10, 120, 70), Rect(10, 10, 120, 70), Rect(60, 40, 150, 90),
+            Rect(500, 500, 0, 0) });
+        // A monitor inside another, and one starting left of both.
+        layouts.push_back({ Rect(0, 0, 200, 130), Rect(40, 30, 50, 20), Rect(-33, 100, 100, 60) });
+        return layouts;
+    }
+}
+
+TEST(DesktopGapPixelsMatchesPixelCount)
+{
+    for (const std::vector<DesktopRect>& layout : TestLayouts())
+        CHECK_EQ(DesktopGapPixels(layout), CountGapPixels(layout));
+
+    CHECK_EQ(DesktopGapPixels({}), static_cast<uint64_t>(0));
+    CHECK_EQ(DesktopGapPixels({ Rect(0, 0, 1920, 1080), Rect(1920, 0, 1920, 1080) }), static_cast<uint64_t>(0));
+    // 1920x1080 left of a 2560x1440 primary, bottoms aligned.
+    CHECK_EQ(DesktopGapPixels({ Rect(0, 0, 2560, 1440), Rect(-1920, 360, 1920, 1080) }),
+        static_cast<uint64_t>(1920) * 360);
+
+    // Random layouts, overlaps and all.
+    TestRng rng(17);
+    for (int round = 0; round < 200; round++)
+    {
+        std::vector<DesktopRect> layout;
+        const int monitors = 1 + rng.Range(4);
+        for (int i = 0; i < monitors; i++)
+            layout.push_back(Rect(rng.Range(120) - 60, rng.Range(120) - 60, rng.Range(70), rng.Range(70)));
+        const uint64_t gaps = DesktopGapPixels(layout);
+        if (gaps != CountGapPixels(layout))
+        {
+            ReportFailure(__FILE__, __LINE__, "round " + std::to_string(round) + ": " + std::to_string(gaps) +
+                " gap pixels, counted " + std::to_string(CountGapPixels(layout)));
+        }
+    }
+}
+
+TEST(DesktopStitchPlacesEveryMonitor)
+{
+    for (const std::vector<DesktopRect>& layout : TestLayouts())
+    {
+        for (int threads = 0; threads <= 1; threads++)
+        {
+            FakeMonitors source(layout);
+            DesktopCaptureOptions options;
+            options.threads = threads;
+            options.gapColor = 0xFF123456;
+            DesktopCapture capture(source, options);
+            REQUIRE(capture.Grab());
+            CHECK_EQ(capture.MonitorCount(), static_cast<int>(layout.size()));
+
+            Frame desktop;
+            REQUIRE(capture.Stitch(desktop));
+            const DesktopRect bounds = capture.Bounds();
+            CHECK_EQ(desktop.Width(), bounds.Width());
+            CHECK_EQ(desktop.Height(), bounds.Height());
+            int wrong = 0;
+            for (int y = 0; y < desktop.Height(); y++)
+            {
+                const uint32_t* row = reinterpret_cast<const uint32_t*>(desktop.View().Row(y));
+                for (int x = 0; x < desktop.Width(); x++)
+                {
+                    if (row[x] != ExpectedPixel(source, layout, bounds.left + x, bounds.top + y, options.gapColor))
+                        wrong++;
+                }
+            }
+            if (wrong != 0)
+            {
+                ReportFailure(__FILE__, __LINE__, std::to_string(wrong) + " wrong pixels stitching " +
+                    std::to_string(layout.size()) + " monitors at " + std::to_string(bounds.left) + "," +
+                    std::to_string(bounds.top));
+            }
+        }
+    }
+}
+
+TEST(DesktopStitchShortGrabsLeaveGaps)
+{
+    // Grabs smaller than their rectangles (a mode change mid-grab): the
+    // missing part is gap, or the next monitor where one overlaps.
+    const std::vector<DesktopRect> layout = { Rect(-100, 0, 100, 80), Rect(-50, 20, 120, 40), Rect(70, 0, 90, 90) };
+    FakeMonitors source(layout);
+    source.GrabSizes()[0] = { 60, 70 };
+    source.GrabSizes()[2] = { 90, 10 };
+    DesktopCaptureOptions options;
+    DesktopCapture capture(source, options);
+    REQUIRE(capture.Grab());
+    Frame desktop;
+    REQUIRE(capture.Stitch(desktop));
+    const DesktopRect bounds = capture.Bounds();
+    int wrong = 0;
+    for (int y = 0; y < desktop.Height(); y++)
+    {
+        const uint32_t* row = reinterpret_cast<const uint32_t*>(desktop.View().Row(y));
+        for (int x = 0; x < desktop.Width(); x++)
+            wrong += row[x] != ExpectedPixel(source, layout, bounds.left + x, bounds.top + y, options.gapColor);
+    }
+    CHECK_EQ(wrong, 0);
+}
+
+TEST(DesktopGrabFailsWithAnyMonitorAndKeepsBuffers)
+{
+    const std::vector<DesktopRect> layout = { Rect(0, 0, 64, 48), Rect(64, 0, 32, 48), Rect(-40, 8, 40, 30) };
+    FakeMonitors source(layout);
+    DesktopCaptureOptions options;
+    DesktopCapture capture(source, options);
+    REQUIRE(capture.Grab());
+    std::vector<const uint8_t*> buffers;
+    for (int i = 0; i < capture.MonitorCount(); i++)
+        buffers.push_back(capture.MonitorView(i).data);
+
+    // Same layout: every monitor is grabbed into the memory it had.
+    REQUIRE(capture.Grab());
+    for (int i = 0; i < capture.MonitorCount(); i++)
+        CHECK(capture.MonitorView(i).data == buffers[i]);
+
+    source.Fail()[1] = true;
+    CHECK(!capture.Grab());
+    CHECK_EQ(source.Grabs(), 9);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "RepeatScheduler.h"
+
+//---------------------------------------------------------------------
+// A ScheduleClock that only moves when told to: sleeping jumps straight
+// to the deadline, and Advance stands in for the work done between
+// frames. Schedules then come out the same on every run.
+class FakeScheduleClock : public ScheduleClock
+{
+public:
+    FakeScheduleClock() : now_(std::chrono::steady_clock::now()) {}
+
+    TimePoint Now() override { return now_; }
+
+    void SleepUntil(TimePoint deadline) override
+    {
+        if (deadline > now_)
+            now_ = deadline;
+    }
+
+    void AdvanceMs(double milliseconds)
+    {
+        now_ += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double, std::milli>(milliseconds));
+    }
+
+private:
+    TimePoint now_;
+};
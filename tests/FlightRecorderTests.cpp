@@ -0,0 +1,186 @@
+#include "TestHarness.h"
+
+#include "FlightRecorder.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // Stand-in for the encoder: frame n has a size picked by the caller
+    // and bytes that say which frame they belong to.
+    std::vector<uint8_t> EncodedFrame(uint64_t sequence, size_t size)
+    {
+        std::vector<uint8_t> bytes(size);
+        for (size_t i = 0; i < size; i++)
+            bytes[i] = static_cast<uint8_t>(sequence * 31 + i);
+        return bytes;
+    }
+
+    bool Add(FlightRing& ring, uint64_t sequence, size_t size)
+    {
+        std::vector<uint8_t> bytes = EncodedFrame(sequence, size);
+        return ring.Append(bytes.data(), bytes.size(), static_cast<int64_t>(1000 * sequence));
+    }
+
+    // The snapshot holds first..last, oldest first, each frame intact.
+    bool HoldsRun(const std::vector<FlightFrame>& frames, uint64_t first, uint64_t last)
+    {
+        if (frames.size() != last - first + 1)
+            return false;
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            const FlightFrame& frame = frames[i];
+            if (frame.sequence != first + i || frame.timestampMs != static_cast<int64_t>(1000 * frame.sequence))
+                return false;
+            if (frame.bytes != EncodedFrame(frame.sequence, frame.bytes.size()))
+                return false;
+        }
+        return true;
+    }
+
+    // Slot i of a ring at base, in the layout BytesFor describes.
+    uint8_t* SlotAt(uint8_t* base, int i)
+    {
+        const size_t header = FlightRing::BytesFor(0, 0);
+        return base + header + static_cast<size_t>(i) * (FlightRing::BytesFor(1, 0) - header);
+    }
+}
+
+TEST(FlightRingKeepsNewestFramesWhenSlotsRunOut)
+{
+    std::vector<uint8_t> memory(FlightRing::BytesFor(4, 4096));
+    FlightRing ring;
+    REQUIRE(ring.Create(memory.data(), memory.size(), 4, "png"));
+    CHECK_EQ(ring.Format(), std::string("png"));
+    CHECK_EQ(ring.DataBytes(), static_cast<uint64_t>(4096));
+
+    std::vector<FlightFrame> frames;
+    for (uint64_t n = 1; n <= 10; n++)
+    {
+        REQUIRE(Add(ring, n, 100 + n));
+        ring.Snapshot(frames);
+        CHECK(HoldsRun(frames, n > 4 ? n - 3 : 1, n));
+    }
+    CHECK_EQ(ring.FrameCount(), 4);
+    CHECK_EQ(ring.FramesAppended(), static_cast<uint64_t>(10));
+}
+
+TEST(FlightRingWrapEvictsFramesInTheWay)
+{
+    std::vector<uint8_t> memory(FlightRing::BytesFor(8, 100));
+    FlightRing ring;
+    REQUIRE(ring.Create(memory.data(), memory.size(), 8, "jpg"));
+
+    std::vector<FlightFrame> frames;
+    for (uint64_t n = 1; n <= 3; n++)
+        REQUIRE(Add(ring, n, 30));
+    ring.Snapshot(frames);
+    CHECK(HoldsRun(frames, 1, 3));
+
+    // 90 bytes used: the next frame wraps to the start and takes frame 1's
+    // bytes, and frame 5 overlaps frame 2 as well.
+    REQUIRE(Add(ring, 4, 30));
+    ring.Snapshot(frames);
+    CHECK(HoldsRun(frames, 2, 4));
+    REQUIRE(Add(ring, 5, 20));
+    ring.Snapshot(frames);
+    CHECK(HoldsRun(frames, 3, 5));
+
+    // Wrapping again drops frame 3, past the write position, although the
+    // new bytes miss it: the frames held must stay one run.
+    REQUIRE(Add(ring, 6, 60));
+    ring.Snapshot(frames);
+    CHECK(HoldsRun(frames, 6, 6));
+
+    // The whole data area is the limit.
+    REQUIRE(Add(ring, 7, 100));
+    ring.Snapshot(frames);
+    CHECK(HoldsRun(frames, 7, 7));
+    CHECK(!Add(ring, 8, 101));
+    ring.Snapshot(frames);
+    CHECK(HoldsRun(frames, 7, 7));
+}
+
+TEST(FlightRingRandomSizesAlwaysHoldANewestRun)
+{
+    std::vector<uint8_t> memory(FlightRing::BytesFor(16, 5000));
+    FlightRing ring;
+    REQUIRE(ring.Create(memory.data(), memory.size(), 16, "qoi"));
+
+    TestRng rng(5);
+    std::vector<FlightFrame> frames;
+    for (uint64_t n = 1; n <= 500; n++)
+    {
+        const size_t size = 1 + rng.Range(n % 50 == 0 ? 5000 : 900);
+        REQUIRE(Add(ring, n, size));
+        ring.Snapshot(frames);
+        REQUIRE(!frames.empty());
+        CHECK(HoldsRun(frames, frames.front().sequence, n));
+        CHECK(frames.size() <= 16);
+        size_t bytes = 0;
+        for (const FlightFrame& frame : frames)
+            bytes += frame.bytes.size();
+        CHECK(bytes <= 5000);
+    }
+}
+
+TEST(FlightRingOpenRebuildsAfterATornAppend)
+{
+    std::vector<uint8_t> memory(FlightRing::BytesFor(4, 400));
+    {
+        FlightRing ring;
+        REQUIRE(ring.Create(memory.data(), memory.size(), 4, "png"));
+        for (uint64_t n = 1; n <= 6; n++)
+            REQUIRE(Add(ring, n, 90));
+        // Frame 7 was being added when the process died: its slot (which
+        // held frame 3) is cleared and its bytes are half written.
+        std::vector<uint8_t> torn = EncodedFrame(7, 90);
+        memset(SlotAt(memory.data(), 7 % 4), 0, 8);
+        memcpy(memory.data() + FlightRing::BytesFor(4, 0) + 180, torn.data(), 40);
+    }
+
+    FlightRing reopened;
+    REQUIRE(reopened.Open(memory.data(), memory.size()));
+    CHECK_EQ(reopened.Format(), std::string("png"));
+    CHECK_EQ(reopened.SlotCount(), 4);
+    std::vector<FlightFrame> frames;
+    reopened.Snapshot(frames);
+    CHECK(HoldsRun(frames, 4, 6));
+
+    // Recording carries on from the newest frame held.
+    REQUIRE(Add(reopened, 7, 90));
+    reopened.Snapshot(frames);
+    CHECK(HoldsRun(frames, 4, 7));
+    CHECK_EQ(reopened.FramesAppended(), static_cast<uint64_t>(7));
+
+    // A slot pointing outside the data area is ignored, not read. The
+    // data offset is the 64-bit field 16 bytes into the slot.
+    uint8_t* slot = SlotAt(memory.data(), 5 % 4);
+    slot[16 + 7] = 0x40;
+    FlightRing damaged;
+    REQUIRE(damaged.Open(memory.data(), memory.size()));
+    damaged.Snapshot(frames);
+    CHECK_EQ(frames.size(), static_cast<size_t>(3));
+    for (const FlightFrame& frame : frames)
+        CHECK(frame.sequence != 5 && frame.bytes == EncodedFrame(frame.sequence, 90));
+}
+
+TEST(FlightRingOpenRejectsOtherData)
+{
+    std::vector<uint8_t> memory(FlightRing::BytesFor(4, 400));
+    FlightRing ring;
+    CHECK(!ring.Open(memory.data(), memory.size()));
+    REQUIRE(ring.Create(memory.data(), memory.size(), 4, "png"));
+
+    // An empty ring opens with nothing in it.
+    FlightRing empty;
+    REQUIRE(empty.Open(memory.data(), memory.size()));
+    CHECK_EQ(empty.FrameCount(), 0);
+
+    // Too small for the slots and data the header promises.
+    FlightRing shortRing;
+    CHECK(!shortRing.Open(memory.data(), memory.size() - 1));
+    CHECK(!ring.Create(memory.data(), memory.size(), 4, "toolong!"));
+}
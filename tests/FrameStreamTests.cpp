@@ -0,0 +1,219 @@
+#include "TestHarness.h"
+
+#include "FrameStream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+    void FillFrame(Frame& frame, int width, int height, FrameFormat format, uint32_t seed)
+    {
+        frame.Allocate(width, height, format);
+        TestRng rng(seed);
+        for (int y = 0; y < height; y++)
+        {
+            uint8_t* row = frame.Data() + y * frame.Stride();
+            for (int x = 0; x < width * 4; x++)
+                row[x] = static_cast<uint8_t>(rng.Next());
+        }
+    }
+
+    uint32_t GetU32LE(const uint8_t* p)
+    {
+        return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24;
+    }
+
+    // Read the record at pos of an mjpeg stream: check the part headers and
+    // return the JPEG in it, moving pos past the record.
+    bool ReadMjpegPart(const std::vector<uint8_t>& stream, size_t& pos, int64_t timestampMs,
+        std::vector<uint8_t>& jpeg)
+    {
+        const std::string text(stream.begin() + pos, stream.end());
+        const size_t end = text.find("\r\n\r\n");
+        if (end == std::string::npos)
+            return false;
+        const std::string headers = text.substr(0, end + 2);
+        const std::string opening = "--shotcap\r\nContent-Type: image/jpeg\r\nContent-Length: ";
+        if (headers.compare(0, opening.size(), opening) != 0)
+            return false;
+        const size_t length = strtoul(headers.c_str() + opening.size(), nullptr, 10);
+        const std::string stamp = "\r\nX-Timestamp: " + std::to_string(timestampMs) + "\r\n";
+        if (headers.find(stamp) == std::string::npos)
+            return false;
+
+        const size_t body = pos + end + 4;
+        if (body + length + 2 > stream.size())
+            return false;
+        jpeg.assign(stream.begin() + body, stream.begin() + body + length);
+        if (stream[body + length] != '\r' || stream[body + length + 1] != '\n')
+            return false;
+        pos = body + length + 2;
+        return true;
+    }
+
+    // Full-range BT.601 in floating point, to check the fixed-point planes.
+    double Luma(double r, double g, double b) { return 0.299 * r + 0.587 * g + 0.114 * b; }
+    double ChromaB(double r, double g, double b) { return 128 - 0.168736 * r - 0.331264 * g + 0.5 * b; }
+    double ChromaR(double r, double g, double b) { return 128 + 0.5 * r - 0.418688 * g - 0.081312 * b; }
+
+    bool Near(uint8_t actual, double expected)
+    {
+        return std::fabs(actual - expected) <= 1.0;
+    }
+}
+
+TEST(MjpegStreamFramesPartsWithTheirLengths)
+{
+    FrameStreamEncoder encoder;
+    StreamOptions options;
+    options.jpeg.threads = 1;
+    std::vector<uint8_t> stream, record;
+    BeginStream(options, 64, 48, record);
+    CHECK(record.empty());
+
+    const int64_t stamps[] = { 1700000000123LL, 1700000000456LL, 0 };
+    Frame frame;
+    for (int i = 0; i < 3; i++)
+    {
+        FillFrame(frame, 64 + i * 7, 48, FrameFormat::Bgrx32, i + 1);
+        REQUIRE(encoder.Encode(frame.View(), options, i + 1, stamps[i], record));
+        stream.insert(stream.end(), record.begin(), record.end());
+    }
+
+    // The parts read back one after another with nothing left over.
+    size_t pos = 0;
+    std::vector<uint8_t> jpeg;
+    for (int i = 0; i < 3; i++)
+    {
+        REQUIRE(ReadMjpegPart(stream, pos, stamps[i], jpeg));
+        REQUIRE(jpeg.size() > 4);
+        CHECK(jpeg[0] == 0xFF && jpeg[1] == 0xD8);
+        CHECK(jpeg[jpeg.size() - 2] == 0xFF && jpeg[jpeg.size() - 1] == 0xD9);
+    }
+    CHECK_EQ(pos, stream.size());
+}
+
+TEST(RawStreamHeaderFields)
+{
+    FrameStreamEncoder encoder;
+    StreamOptions options;
+    options.format = StreamFormat::Raw;
+    Frame frame;
+    FillFrame(frame, 13, 5, FrameFormat::Bgra32, 9);
+    // A view with row padding: the record must not carry it.
+    FrameView view = frame.View().Crop(1, 1, 11, 4);
+
+    const int64_t stamp = 0x0000018BCFE56800LL + 77;
+    std::vector<uint8_t> record;
+    REQUIRE(encoder.Encode(view, options, 42, stamp, record));
+    REQUIRE(record.size() == kRawStreamHeaderSize + 11 * 4 * 4);
+
+    const uint8_t* p = record.data();
+    CHECK(memcmp(p, "SCFR", 4) == 0);
+    CHECK_EQ(GetU32LE(p + 4), static_cast<uint32_t>(32));
+    CHECK_EQ(GetU32LE(p + 8), static_cast<uint32_t>(11));
+    CHECK_EQ(GetU32LE(p + 12), static_cast<uint32_t>(4));
+    CHECK_EQ(GetU32LE(p + 16), static_cast<uint32_t>(42));
+    CHECK_EQ(GetU32LE(p + 20), static_cast<uint32_t>(1));
+    const int64_t readStamp = static_cast<int64_t>(GetU32LE(p + 24) | static_cast<uint64_t>(GetU32LE(p + 28)) << 32);
+    CHECK_EQ(readStamp, stamp);
+    for (int y = 0; y < 4; y++)
+        CHECK(memcmp(p + kRawStreamHeaderSize + y * 11 * 4, view.Row(y), 11 * 4) == 0);
+
+    // Bgrx32 frames say their alpha is undefined.
+    frame.Allocate(3, 2, FrameFormat::Bgrx32);
+    REQUIRE(encoder.Encode(frame.View(), options, 1, -5, record));
+    CHECK_EQ(GetU32LE(record.data() + 20), static_cast<uint32_t>(0));
+    CHECK_EQ(GetU32LE(record.data() + 28), static_cast<uint32_t>(0xFFFFFFFF));
+}
+
+TEST(Y4mStreamHeaderAndRate)
+{
+    StreamOptions options;
+    options.format = StreamFormat::Y4m;
+    SetStreamInterval(options, 0.25);
+    std::vector<uint8_t> header;
+    BeginStream(options, 640, 360, header);
+    CHECK_EQ(std::string(header.begin(), header.end()),
+        std::string("YUV4MPEG2 W640 H360 F4:1 Ip A1:1 C420jpeg XCOLORRANGE=FULL\n"));
+
+    options.jpeg.subsampling = ChromaSubsampling::Yuv444;
+    SetStreamInterval(options, 1.5);
+    BeginStream(options, 7, 3, header);
+    CHECK_EQ(std::string(header.begin(), header.end()),
+        std::string("YUV4MPEG2 W7 H3 F2:3 Ip A1:1 C444 XCOLORRANGE=FULL\n"));
+
+    // Single shots have no interval and stream at 1 fps.
+    SetStreamInterval(options, 0.0);
+    CHECK_EQ(options.rateNumerator, 1);
+    CHECK_EQ(options.rateDenominator, 1);
+}
+
+TEST(Y4mStreamOddSizeChroma)
+{
+    // 5x3 at 4:2:0: chroma is 3x2, and the last column and row of it only
+    // cover one column or row of pixels, which count twice in the average.
+    const int w = 5, h = 3;
+    Frame frame;
+    FillFrame(frame, w, h, FrameFormat::Bgrx32, 3);
+    const FrameView view = frame.View();
+
+    FrameStreamEncoder encoder;
+    StreamOptions options;
+    options.format = StreamFormat::Y4m;
+    std::vector<uint8_t> record;
+    REQUIRE(encoder.Encode(view, options, 1, 0, record));
+    const size_t tag = 6;
+    REQUIRE(record.size() == tag + w * h + 2 * 3 * 2);
+    CHECK(memcmp(record.data(), "FRAME\n", tag) == 0);
+
+    const uint8_t* yPlane = record.data() + tag;
+    const uint8_t* cbPlane = yPlane + w * h;
+    const uint8_t* crPlane = cbPlane + 3 * 2;
+    for (int y = 0; y < h; y++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            const uint8_t* px = view.Row(y) + x * 4;
+            CHECK(Near(yPlane[y * w + x], Luma(px[2], px[1], px[0])));
+        }
+    }
+    for (int cy = 0; cy < 2; cy++)
+    {
+        for (int cx = 0; cx < 3; cx++)
+        {
+            double r = 0, g = 0, b = 0;
+            for (int dy = 0; dy < 2; dy++)
+            {
+                for (int dx = 0; dx < 2; dx++)
+                {
+                    const int x = (std::min)(2 * cx + dx, w - 1);
+                    const int y = (std::min)(2 * cy + dy, h - 1);
+                    const uint8_t* px = view.Row(y) + x * 4;
+                    b += px[0] / 4.0;
+                    g += px[1] / 4.0;
+                    r += px[2] / 4.0;
+                }
+            }
+            // The encoder rounds the average before converting it.
+            CHECK(std::fabs(cbPlane[cy * 3 + cx] - ChromaB(r, g, b)) <= 1.5);
+            CHECK(std::fabs(crPlane[cy * 3 + cx] - ChromaR(r, g, b)) <= 1.5);
+        }
+    }
+
+    // 4:4:4 keeps one chroma sample per pixel.
+    options.jpeg.subsampling = ChromaSubsampling::Yuv444;
+    REQUIRE(encoder.Encode(view, options, 2, 0, record));
+    REQUIRE(record.size() == tag + 3 * w * h);
+    for (int i = 0; i < w * h; i++)
+    {
+        const uint8_t* px = view.Row(i / w) + (i % w) * 4;
+        CHECK(Near(record[tag + w * h + i], ChromaB(px[2], px[1], px[0])));
+        CHECK(Near(record[tag + 2 * w * h + i], ChromaR(px[2], px[1], px[0])));
+    }
+}
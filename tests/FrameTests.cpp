@@ -0,0 +1,211 @@
+#include "TestHarness.h"
+
+#include "CapturePipeline.h"
+#include "ChangeDetector.h"
+#include "FakeClock.h"
+#include "JpegEncoder.h"
+#include "PngDecoder.h"
+#include "PngEncoder.h"
+#include "QoiCodec.h"
+#include "SeqContainer.h"
+#include "TextOverlay.h"
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace
+{
+    // Memory the frames only borrow, like the DIB section the grabber
+    // draws into: stride may be negative for a bottom-up bitmap.
+    struct Surface
+    {
+        std::vector<uint8_t> pixels;
+        int width = 0;
+        int height = 0;
+        bool bottomUp = false;
+
+        Surface(int w, int h, bool flipped)
+            : pixels(static_cast<size_t>(w) * h * 4), width(w), height(h), bottomUp(flipped)
+        {
+        }
+
+        void Paint(int seed)
+        {
+            for (int y = 0; y < height; y++)
+            {
+                uint8_t* row = pixels.data() + static_cast<size_t>(y) * width * 4;
+                for (int x = 0; x < width * 4; x++)
+                    row[x] = static_cast<uint8_t>((x / 4 + y) / 8 * 16 + seed * 7 + (x & 3) * 40);
+            }
+        }
+
+        void LendTo(Frame& frame)
+        {
+            const ptrdiff_t rowBytes = static_cast<ptrdiff_t>(width) * 4;
+            uint8_t* top = bottomUp ? pixels.data() + (height - 1) * rowBytes : pixels.data();
+            frame.Adopt(nullptr, this, top, width, height, bottomUp ? -rowBytes : rowBytes,
+                FrameFormat::Bgrx32);
+        }
+    };
+
+    // Run every consumer of a grab over frame, as the encode stage and
+    // the -onchange callback do.
+    bool EncodeAll(Frame& frame, TextOverlay& overlay, SeqWriter& seq, std::vector<uint8_t>& out)
+    {
+        overlay.Draw(frame.View(), L"12:34:56");
+
+        PngOptions png;
+        png.threads = 1;
+        JpegOptions jpeg;
+        jpeg.threads = 1;
+        PngEncoder encoder;
+        std::vector<uint8_t> bytes;
+        return encoder.Encode(frame.View(), png, out)
+            && EncodeJpeg(frame.View(), jpeg, bytes)
+            && EncodeQoi(frame.View(), bytes)
+            && seq.AddFrame(frame.View(), 0, bytes);
+    }
+
+    bool DecodesTo(const std::vector<uint8_t>& png, const FrameView& frame)
+    {
+        std::vector<uint8_t> pixels;
+        int width = 0, height = 0, channels = 0;
+        if (!DecodePng(png.data(), png.size(), pixels, width, height, channels))
+            return false;
+        if (width != frame.width || height != frame.height)
+            return false;
+        for (int y = 0; y < height; y++)
+        {
+            const uint8_t* row = frame.Row(y);
+            for (int x = 0; x < width; x++)
+            {
+                if (memcmp(&pixels[(static_cast<size_t>(y) * width + x) * 4], row + x * 4, 3) != 0)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    class SurfaceSource : public FrameSource
+    {
+    public:
+        explicit SurfaceSource(Surface& surface) : surface_(surface) {}
+
+        bool GrabFrame(Frame& frame) override
+        {
+            // A new picture every third grab, so some polls see no change.
+            surface_.Paint(grabs_++ / 3);
+            surface_.LendTo(frame);
+            return true;
+        }
+
+    private:
+        Surface& surface_;
+        int grabs_ = 0;
+    };
+}
+
+TEST(CopyFrameIsCounted)
+{
+    Surface source(5, 3, true);
+    source.Paint(1);
+    Frame from, to;
+    source.LendTo(from);
+    to.Allocate(5, 3, FrameFormat::Bgra32);
+
+    const uint64_t before = FrameCopyCount();
+    REQUIRE(CopyFrame(from.View(), to.View()));
+    CHECK_EQ(FrameCopyCount() - before, static_cast<uint64_t>(1));
+    for (int y = 0; y < 3; y++)
+    {
+        CHECK(memcmp(to.View().Row(y), from.View().Row(y), 3) == 0);
+        CHECK_EQ(to.View().Row(y)[3], static_cast<uint8_t>(255));
+    }
+
+    // Size mismatches fail without counting.
+    Frame other;
+    other.Allocate(4, 3, FrameFormat::Bgra32);
+    CHECK(!CopyFrame(from.View(), other.View()));
+    CHECK_EQ(FrameCopyCount() - before, static_cast<uint64_t>(1));
+}
+
+TEST(PipelineEncodesGrabsWithoutCopies)
+{
+    // One surface per slot, as each slot keeps its own DIB section.
+    const int slots = 3;
+    std::vector<std::unique_ptr<Surface>> surfaces;
+    for (int i = 0; i < slots; i++)
+        surfaces.emplace_back(new Surface(96, 40, i % 2 == 1));
+
+    std::vector<std::vector<uint8_t>> written;
+    size_t nextSurface = 0;
+    TextOverlay overlay(std::unique_ptr<GlyphSource>(new BuiltinFont(1)), TextStyle());
+    SeqWriter seq;
+
+    PipelineOptions options;
+    options.frameCount = 12;
+    options.encoderThreads = 1;
+    options.maxFramesInFlight = slots;
+
+    const uint64_t before = FrameCopyCount();
+    PipelineStats stats = RunCapturePipeline(options,
+        [&](PipelineFrame& frame) -> bool
+        {
+            // A slot seen before keeps the surface it was lent.
+            Surface* surface = frame.image.Owner()
+                ? const_cast<Surface*>(static_cast<const Surface*>(frame.image.Owner()))
+                : surfaces[nextSurface++].get();
+            surface->Paint(frame.index);
+            surface->LendTo(frame.image);
+            return true;
+        },
+        [&](PipelineFrame& frame) -> bool
+        {
+            return EncodeAll(frame.image, overlay, seq, frame.encoded);
+        },
+        [&](PipelineFrame& frame)
+        {
+            // The slot is not recycled before this returns, so the
+            // surface still holds what was encoded.
+            if (frame.ok && DecodesTo(frame.encoded, frame.image.View()))
+                written.push_back(frame.encoded);
+        });
+
+    CHECK_EQ(stats.framesWritten, 12);
+    CHECK_EQ(static_cast<int>(written.size()), 12);
+    CHECK_EQ(FrameCopyCount() - before, static_cast<uint64_t>(0));
+}
+
+TEST(ChangeLoopHandsOnGrabsWithoutCopies)
+{
+    Surface surface(80, 48, true);
+    SurfaceSource source(surface);
+    TextOverlay overlay(std::unique_ptr<GlyphSource>(new BuiltinFont(1)), TextStyle());
+    SeqWriter seq;
+    FakeScheduleClock clock;
+
+    ChangeCaptureOptions options;
+    options.clock = &clock;
+    options.frameCount = 4;
+    options.detector.rowStep = 1;
+
+    int sameMemory = 0;
+    int decoded = 0;
+    std::vector<uint8_t> png;
+    const uint64_t before = FrameCopyCount();
+    const int accepted = RunChangeCapture(source, options,
+        [&](Frame& frame, int, double, const FrameTiming&) -> bool
+        {
+            if (frame.Owner() == &surface && frame.Data() == surface.pixels.data() + (48 - 1) * 80 * 4)
+                sameMemory++;
+            if (EncodeAll(frame, overlay, seq, png) && DecodesTo(png, frame.View()))
+                decoded++;
+            return true;
+        });
+
+    CHECK_EQ(accepted, 4);
+    CHECK_EQ(sameMemory, 4);
+    CHECK_EQ(decoded, 4);
+    CHECK_EQ(FrameCopyCount() - before, static_cast<uint64_t>(0));
+}
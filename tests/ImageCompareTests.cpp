@@ -0,0 +1,303 @@
+#include "TestHarness.h"
+
+#include "ImageCompare.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+    // A Bgrx32 image with random padding bytes and an optional bottom-up
+    // stride, filled with noise.
+    struct TestImage
+    {
+        std::vector<uint8_t> buffer;
+        FrameView view;
+
+        TestImage(int width, int height, int padPixels, bool bottomUp, TestRng& rng)
+        {
+            const int stride = (width + padPixels) * 4;
+            buffer.resize(static_cast<size_t>(stride) * height + 4);
+            for (uint8_t& value : buffer)
+                value = static_cast<uint8_t>(rng.Next());
+            view.width = width;
+            view.height = height;
+            view.format = FrameFormat::Bgrx32;
+            view.data = buffer.data() + 4 + (bottomUp ? static_cast<size_t>(stride) * (height - 1) : 0);
+            view.stride = bottomUp ? -stride : stride;
+        }
+
+        uint8_t* Pixel(int x, int y) { return view.Row(y) + x * 4; }
+    };
+
+    int Difference(const uint8_t* a, const uint8_t* b)
+    {
+        int largest = 0;
+        for (int c = 0; c < 3; c++)
+            largest = (std::max)(largest, std::abs(a[c] - b[c]));
+        return largest;
+    }
+
+    bool SameRect(const DesktopRect& a, const DesktopRect& b)
+    {
+        return a.left == b.left && a.top == b.top && a.right == b.right && a.bottom == b.bottom;
+    }
+
+    // The boxes the header promises, worked out the slow way: tiles with
+    // changes are flood-filled over their eight neighbours, and each
+    // group's box is the exact bounds of its changed pixels.
+    void ReferenceCompare(const FrameView& a, const FrameView& b, int tolerance, CompareResult& result)
+    {
+        result = CompareResult();
+        const int tilesX = (a.width + kCompareTileSize - 1) / kCompareTileSize;
+        const int tilesY = (a.height + kCompareTileSize - 1) / kCompareTileSize;
+        std::vector<int> counts(static_cast<size_t>(tilesX) * tilesY, 0);
+        for (int y = 0; y < a.height; y++)
+        {
+            for (int x = 0; x < a.width; x++)
+            {
+                int difference = Difference(a.Row(y) + x * 4, b.Row(y) + x * 4);
+                result.maxDifference = (std::max)(result.maxDifference, difference);
+                if (difference > tolerance)
+                    counts[(y / kCompareTileSize) * tilesX + x / kCompareTileSize]++;
+            }
+        }
+
+        std::vector<int> group(counts.size(), -1);
+        int groups = 0;
+        for (size_t i = 0; i < counts.size(); i++)
+        {
+            if (!counts[i] || group[i] >= 0)
+                continue;
+            std::vector<int> pending(1, static_cast<int>(i));
+            group[i] = groups;
+            while (!pending.empty())
+            {
+                int tile = pending.back();
+                pending.pop_back();
+                for (int dy = -1; dy <= 1; dy++)
+                {
+                    for (int dx = -1; dx <= 1; dx++)
+                    {
+                        int tx = tile % tilesX + dx, ty = tile / tilesX + dy;
+                        if (tx < 0 || ty < 0 || tx >= tilesX || ty >= tilesY)
+                            continue;
+                        int next = ty * tilesX + tx;
+                        if (counts[next] && group[next] < 0)
+                        {
+                            group[next] = groups;
+                            pending.push_back(next);
+                        }
+                    }
+                }
+            }
+            groups++;
+        }
+
+        result.boxes.resize(groups);
+        for (int y = 0; y < a.height; y++)
+        {
+            for (int x = 0; x < a.width; x++)
+            {
+                if (Difference(a.Row(y) + x * 4, b.Row(y) + x * 4) <= tolerance)
+                    continue;
+                DiffBox& box = result.boxes[group[(y / kCompareTileSize) * tilesX + x / kCompareTileSize]];
+                DesktopRect pixel = { x, y, x + 1, y + 1 };
+                for (DesktopRect* rect : { &box.rect, &result.bounds })
+                {
+                    if (rect->Width() == 0)
+                        *rect = pixel;
+                    rect->left = (std::min)(rect->left, x);
+                    rect->top = (std::min)(rect->top, y);
+                    rect->right = (std::max)(rect->right, x + 1);
+                    rect->bottom = (std::max)(rect->bottom, y + 1);
+                }
+                box.pixels++;
+                result.changedPixels++;
+            }
+        }
+    }
+}
+
+TEST(CompareRowKernelsMatchScalar)
+{
+    CompareRowFunction scalar = CompareRowKernelFor(CompareKernelLevel::Scalar);
+    REQUIRE(scalar != nullptr);
+    const CompareKernelLevel levels[] = { CompareKernelLevel::Sse2, CompareKernelLevel::Avx2 };
+    TestRng rng(11);
+    const int kMaxWidth = 80;
+    std::vector<uint8_t> a(kMaxWidth * 4 + 3), b(kMaxWidth * 4 + 3);
+    std::vector<uint16_t> expected(kMaxWidth / kCompareTileSize + 1), actual(expected.size());
+    for (CompareKernelLevel level : levels)
+    {
+        CompareRowFunction kernel = CompareRowKernelFor(level);
+        if (!kernel)
+            continue;
+        bool same = true;
+        for (int width = 0; width <= kMaxWidth && same; width++)
+        {
+            for (int trial = 0; trial < 40 && same; trial++)
+            {
+                // Unaligned rows; b close to a so every tolerance matters.
+                const int offset = trial % 4;
+                for (size_t i = 0; i < a.size(); i++)
+                {
+                    a[i] = static_cast<uint8_t>(rng.Next());
+                    b[i] = static_cast<uint8_t>(rng.Range(4) ? a[i] + rng.Range(9) - 4 : rng.Next());
+                }
+                const int tolerance = trial == 0 ? 0 : trial == 1 ? 255 : rng.Range(12);
+                const int tiles = (width + kCompareTileSize - 1) / kCompareTileSize;
+                std::fill(expected.begin(), expected.end(), 0xABCD);
+                std::fill(actual.begin(), actual.end(), 0xABCD);
+                int expectedLargest = scalar(&a[offset], &b[offset], width, tolerance, expected.data());
+                int actualLargest = kernel(&a[offset], &b[offset], width, tolerance, actual.data());
+                same = expectedLargest == actualLargest &&
+                    std::equal(expected.begin(), expected.begin() + tiles, actual.begin()) &&
+                    actual[tiles] == 0xABCD;
+            }
+        }
+        CHECK(same);
+    }
+}
+
+TEST(CompareToleranceIsExclusive)
+{
+    TestRng rng(3);
+    TestImage a(40, 20, 0, false, rng), b(40, 20, 0, false, rng);
+    for (int y = 0; y < 20; y++)
+        std::memcpy(b.view.Row(y), a.view.Row(y), 40 * 4);
+    // Alpha and the fourth Bgrx byte never count.
+    for (int y = 0; y < 20; y++)
+        for (int x = 0; x < 40; x++)
+            b.Pixel(x, y)[3] = static_cast<uint8_t>(a.Pixel(x, y)[3] ^ 0xFF);
+    a.Pixel(5, 5)[1] = 100;
+    b.Pixel(5, 5)[1] = 110;     // Differs by 10, in green.
+    a.Pixel(30, 12)[2] = 200;
+    b.Pixel(30, 12)[2] = 197;   // Differs by 3, in red.
+
+    CompareResult result;
+    REQUIRE(CompareImages(a.view, b.view, 2, result));
+    CHECK_EQ(result.changedPixels, static_cast<uint64_t>(2));
+    CHECK_EQ(result.maxDifference, 10);
+    REQUIRE(CompareImages(a.view, b.view, 3, result));
+    CHECK_EQ(result.changedPixels, static_cast<uint64_t>(1));
+    CHECK(SameRect(result.bounds, DesktopRect{ 5, 5, 6, 6 }));
+    REQUIRE(CompareImages(a.view, b.view, 10, result));
+    CHECK_EQ(result.changedPixels, static_cast<uint64_t>(0));
+    CHECK_EQ(result.maxDifference, 10);
+    CHECK(result.boxes.empty());
+    CHECK_EQ(result.bounds.Width(), 0);
+
+    TestImage c(41, 20, 0, false, rng);
+    CHECK(!CompareImages(a.view, c.view, 0, result));
+}
+
+TEST(CompareMergesTouchingTilesIntoOneBox)
+{
+    TestRng rng(5);
+    TestImage a(160, 96, 0, false, rng), b(160, 96, 0, false, rng);
+    for (int y = 0; y < 96; y++)
+        std::memcpy(b.view.Row(y), a.view.Row(y), 160 * 4);
+    auto change = [&](int x, int y) { b.Pixel(x, y)[0] = static_cast<uint8_t>(a.Pixel(x, y)[0] ^ 0x80); };
+
+    // Tiles (0,0) and (1,1) touch diagonally: one box.
+    change(3, 4);
+    change(20, 30);
+    // Tile (4,1) is two tiles away from them: a box of its own, which a
+    // change in tile (5,2), diagonally touching it, joins.
+    change(70, 17);
+    change(81, 40);
+    // Tile (9,5), the last one, alone.
+    change(159, 95);
+
+    CompareResult result;
+    REQUIRE(CompareImages(a.view, b.view, 0, result));
+    CHECK_EQ(result.changedPixels, static_cast<uint64_t>(5));
+    REQUIRE(result.boxes.size() == 3);
+    CHECK(SameRect(result.boxes[0].rect, DesktopRect{ 3, 4, 21, 31 }));
+    CHECK_EQ(result.boxes[0].pixels, static_cast<uint64_t>(2));
+    CHECK(SameRect(result.boxes[1].rect, DesktopRect{ 70, 17, 82, 41 }));
+    CHECK_EQ(result.boxes[1].pixels, static_cast<uint64_t>(2));
+    CHECK(SameRect(result.boxes[2].rect, DesktopRect{ 159, 95, 160, 96 }));
+    CHECK(SameRect(result.bounds, DesktopRect{ 3, 4, 160, 96 }));
+}
+
+TEST(CompareMatchesReferenceOnRandomImages)
+{
+    TestRng rng(17);
+    int mismatches = 0;
+    for (int trial = 0; trial < 150; trial++)
+    {
+        const int width = 1 + rng.Range(trial < 100 ? 70 : 400);
+        const int height = 1 + rng.Range(trial < 100 ? 70 : 200);
+        TestImage a(width, height, rng.Range(3), rng.Range(2) != 0, rng);
+        TestImage b(width, height, rng.Range(3), rng.Range(2) != 0, rng);
+        for (int y = 0; y < height; y++)
+            std::memcpy(b.view.Row(y), a.view.Row(y), static_cast<size_t>(width) * 4);
+        const int changes = rng.Range(4) == 0 ? width * height / 2 : rng.Range(40);
+        for (int i = 0; i < changes; i++)
+            b.Pixel(rng.Range(width), rng.Range(height))[rng.Range(3)] = static_cast<uint8_t>(rng.Next());
+        const int tolerance = rng.Range(4) == 0 ? 0 : rng.Range(256);
+
+        CompareResult expected, actual;
+        ReferenceCompare(a.view, b.view, tolerance, expected);
+        if (!CompareImages(a.view, b.view, tolerance, actual, rng.Range(3)))
+        {
+            mismatches++;
+            continue;
+        }
+        bool same = actual.changedPixels == expected.changedPixels &&
+            actual.maxDifference == expected.maxDifference &&
+            actual.boxes.size() == expected.boxes.size() &&
+            (expected.changedPixels == 0 ? actual.bounds.Width() == 0 : SameRect(actual.bounds, expected.bounds));
+        for (size_t i = 0; same && i < expected.boxes.size(); i++)
+        {
+            same = SameRect(actual.boxes[i].rect, expected.boxes[i].rect) &&
+                actual.boxes[i].pixels == expected.boxes[i].pixels;
+        }
+        if (!same)
+            mismatches++;
+    }
+    CHECK_EQ(mismatches, 0);
+}
+
+TEST(CompareRenderDiffMarksChangesAndOutlines)
+{
+    TestRng rng(23);
+    TestImage a(64, 48, 0, false, rng), b(64, 48, 1, true, rng);
+    for (int y = 0; y < 48; y++)
+        std::memcpy(b.view.Row(y), a.view.Row(y), 64 * 4);
+    for (int y = 20; y < 26; y++)
+        for (int x = 30; x < 34; x++)
+            b.Pixel(x, y)[2] = static_cast<uint8_t>(a.Pixel(x, y)[2] ^ 0x40);
+
+    CompareResult result;
+    REQUIRE(CompareImages(a.view, b.view, 0, result));
+    REQUIRE(result.boxes.size() == 1);
+    Frame out;
+    RenderDiff(a.view, b.view, 0, result, out);
+    FrameView view = out.View();
+    REQUIRE(view.width == 64 && view.height == 48);
+
+    bool ok = true;
+    for (int y = 0; y < 48; y++)
+    {
+        for (int x = 0; x < 64; x++)
+        {
+            uint32_t colour;
+            std::memcpy(&colour, view.Row(y) + x * 4, 4);
+            const bool changed = x >= 30 && x < 34 && y >= 20 && y < 26;
+            const bool outline = !changed && x >= 29 && x <= 34 && y >= 19 && y <= 26;
+            const uint8_t* p = view.Row(y) + x * 4;
+            if (changed)
+                ok = ok && colour == 0xFFFF0000;
+            else if (outline)
+                ok = ok && colour == 0xFFFF00FF;
+            else
+                ok = ok && p[0] == p[1] && p[1] == p[2] && p[0] >= 96 && p[3] == 0xFF;
+        }
+    }
+    CHECK(ok);
+}
@@ -0,0 +1,302 @@
+#include "TestHarness.h"
+
+#include "JpegEncoder.h"
+
+#include <cmath>
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <jpeglib.h>
+
+//---------------------------------------------------------------------
+// The encoder is checked against libjpeg: every stream must decode
+// without a single warning (a misplaced restart marker only warns), and
+// the decoded image must be as close to the original as libjpeg's own
+// encoder gets at the same quality and subsampling.
+
+namespace
+{
+    struct DecodeError
+    {
+        jpeg_error_mgr manager;
+        jmp_buf jump;
+    };
+
+    void ExitWithError(j_common_ptr info)
+    {
+        longjmp(reinterpret_cast<DecodeError*>(info->err)->jump, 1);
+    }
+
+    void IgnoreMessage(j_common_ptr)
+    {
+    }
+
+    // Decode jpeg to RGB with libjpeg. warnings counts the corrupt-data
+    // warnings it recovered from.
+    bool DecodeJpeg(const std::vector<uint8_t>& jpeg, std::vector<uint8_t>& rgb, int& width, int& height,
+        int& warnings)
+    {
+        jpeg_decompress_struct info;
+        DecodeError error;
+        info.err = jpeg_std_error(&error.manager);
+        error.manager.error_exit = ExitWithError;
+        error.manager.output_message = IgnoreMessage;
+        if (setjmp(error.jump))
+        {
+            jpeg_destroy_decompress(&info);
+            return false;
+        }
+        jpeg_create_decompress(&info);
+        jpeg_mem_src(&info, const_cast<unsigned char*>(jpeg.data()), static_cast<unsigned long>(jpeg.size()));
+        jpeg_read_header(&info, TRUE);
+        info.out_color_space = JCS_RGB;
+        jpeg_start_decompress(&info);
+        width = info.output_width;
+        height = info.output_height;
+        rgb.resize(static_cast<size_t>(width) * height * 3);
+        while (info.output_scanline < info.output_height)
+        {
+            JSAMPROW row = rgb.data() + static_cast<size_t>(info.output_scanline) * width * 3;
+            jpeg_read_scanlines(&info, &row, 1);
+        }
+        jpeg_finish_decompress(&info);
+        warnings = static_cast<int>(error.manager.num_warnings);
+        jpeg_destroy_decompress(&info);
+        return true;
+    }
+
+    // libjpeg's own encoder with the same settings, as the yardstick.
+    bool ReferenceJpeg(const FrameView& frame, int quality, ChromaSubsampling subsampling,
+        std::vector<uint8_t>& jpeg)
+    {
+        jpeg_compress_struct info;
+        DecodeError error;
+        info.err = jpeg_std_error(&error.manager);
+        error.manager.error_exit = ExitWithError;
+        unsigned char* buffer = nullptr;
+        unsigned long size = 0;
+        if (setjmp(error.jump))
+        {
+            jpeg_destroy_compress(&info);
+            free(buffer);
+            return false;
+        }
+        jpeg_create_compress(&info);
+        jpeg_mem_dest(&info, &buffer, &size);
+        info.image_width = frame.width;
+        info.image_height = frame.height;
+        info.input_components = 3;
+        info.in_color_space = JCS_RGB;
+        jpeg_set_defaults(&info);
+        jpeg_set_quality(&info, quality, TRUE);
+        const int sampling = subsampling == ChromaSubsampling::Yuv420 ? 2 : 1;
+        info.comp_info[0].h_samp_factor = sampling;
+        info.comp_info[0].v_samp_factor = sampling;
+        jpeg_start_compress(&info, TRUE);
+        std::vector<uint8_t> rgb(static_cast<size_t>(frame.width) * 3);
+        while (info.next_scanline < info.image_height)
+        {
+            const uint8_t* px = frame.Row(info.next_scanline);
+            for (int x = 0; x < frame.width; x++)
+            {
+                rgb[x * 3] = px[x * 4 + 2];
+                rgb[x * 3 + 1] = px[x * 4 + 1];
+                rgb[x * 3 + 2] = px[x * 4];
+            }
+            JSAMPROW row = rgb.data();
+            jpeg_write_scanlines(&info, &row, 1);
+        }
+        jpeg_finish_compress(&info);
+        jpeg.assign(buffer, buffer + size);
+        jpeg_destroy_compress(&info);
+        free(buffer);
+        return true;
+    }
+
+    double Psnr(const FrameView& frame, const std::vector<uint8_t>& rgb)
+    {
+        double squares = 0;
+        for (int y = 0; y < frame.height; y++)
+        {
+            const uint8_t* px = frame.Row(y);
+            const uint8_t* decoded = rgb.data() + static_cast<size_t>(y) * frame.width * 3;
+            for (int x = 0; x < frame.width; x++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    const double d = px[x * 4 + 2 - c] - decoded[x * 3 + c];
+                    squares += d * d;
+                }
+            }
+        }
+        const double mse = squares / (3.0 * frame.width * frame.height);
+        return mse == 0 ? 99.0 : 10.0 * std::log10(255.0 * 255.0 / mse);
+    }
+
+    // Desktop-like content: flat panels, gradients, hard-edged "text" and
+    // a noisy photo area, so both the DCT and the entropy coder get work.
+    void FillFrame(Frame& frame, int width, int height, uint32_t seed)
+    {
+        frame.Allocate(width, height, FrameFormat::Bgrx32);
+        TestRng rng(seed);
+        for (int y = 0; y < height; y++)
+        {
+            uint8_t* row = frame.Data() + y * frame.Stride();
+            for (int x = 0; x < width; x++)
+            {
+                uint8_t* p = row + x * 4;
+                const int area = (x * 3 / width) + (y * 2 / height) * 3;
+                if (area == 0 || area == 4)
+                {
+                    p[0] = 0xF3; p[1] = 0xEE; p[2] = 0xE8;
+                    if ((x / 2 + y / 3) % 5 == 0 && (y / 12) % 2 == 0)
+                        p[0] = p[1] = p[2] = 0x20;
+                }
+                else if (area == 1 || area == 5)
+                {
+                    p[0] = static_cast<uint8_t>(x * 255 / width);
+                    p[1] = static_cast<uint8_t>(y * 255 / height);
+                    p[2] = static_cast<uint8_t>(128 + (x - y) / 4);
+                }
+                else
+                {
+                    const int base = (x / 9 + y / 7) * 13;
+                    p[0] = static_cast<uint8_t>(base + rng.Range(24));
+                    p[1] = static_cast<uint8_t>(base / 2 + rng.Range(24));
+                    p[2] = static_cast<uint8_t>(200 - base / 3 + rng.Range(24));
+                }
+                p[3] = static_cast<uint8_t>(rng.Next());
+            }
+        }
+    }
+
+    std::string Describe(int quality, ChromaSubsampling subsampling)
+    {
+        return "quality " + std::to_string(quality) +
+            (subsampling == ChromaSubsampling::Yuv420 ? " 4:2:0" : " 4:4:4");
+    }
+
+    // Restart markers in the entropy-coded data after the first SOS.
+    std::vector<int> RestartMarkers(const std::vector<uint8_t>& jpeg)
+    {
+        std::vector<int> markers;
+        size_t i = 2;
+        while (i + 4 <= jpeg.size() && jpeg[i] == 0xFF && jpeg[i + 1] != 0xDA)
+            i += 2 + (jpeg[i + 2] << 8 | jpeg[i + 3]);
+        for (; i + 1 < jpeg.size(); i++)
+        {
+            if (jpeg[i] == 0xFF && jpeg[i + 1] >= 0xD0 && jpeg[i + 1] <= 0xD7)
+                markers.push_back(jpeg[i + 1] - 0xD0);
+        }
+        return markers;
+    }
+
+    int RestartInterval(const std::vector<uint8_t>& jpeg)
+    {
+        for (size_t i = 2; i + 6 <= jpeg.size() && jpeg[i] == 0xFF; i += 2 + (jpeg[i + 2] << 8 | jpeg[i + 3]))
+        {
+            if (jpeg[i + 1] == 0xDD)
+                return jpeg[i + 4] << 8 | jpeg[i + 5];
+            if (jpeg[i + 1] == 0xDA)
+                break;
+        }
+        return 0;
+    }
+}
+
+TEST(JpegDecodesCloseToLibjpegPerQuality)
+{
+    Frame frame;
+    FillFrame(frame, 333, 211, 4);
+    const int qualities[] = { 10, 50, 75, 90, 100 };
+    const ChromaSubsampling subsamplings[] = { ChromaSubsampling::Yuv420, ChromaSubsampling::Yuv444 };
+    for (ChromaSubsampling subsampling : subsamplings)
+    {
+        double previous = 0;
+        for (int quality : qualities)
+        {
+            const std::string what = Describe(quality, subsampling);
+            JpegOptions options;
+            options.quality = quality;
+            options.subsampling = subsampling;
+            std::vector<uint8_t> jpeg, reference, rgb;
+            REQUIRE(EncodeJpeg(frame.View(), options, jpeg));
+            int width = 0, height = 0, warnings = -1;
+            if (!DecodeJpeg(jpeg, rgb, width, height, warnings))
+            {
+                ReportFailure(__FILE__, __LINE__, "libjpeg rejects " + what);
+                continue;
+            }
+            CHECK_EQ(width, 333);
+            CHECK_EQ(height, 211);
+            CHECK_EQ(warnings, 0);
+            const double psnr = Psnr(frame.View(), rgb);
+
+            REQUIRE(ReferenceJpeg(frame.View(), quality, subsampling, reference));
+            REQUIRE(DecodeJpeg(reference, rgb, width, height, warnings));
+            const double referencePsnr = Psnr(frame.View(), rgb);
+            // Same tables and colour conversion; the float DCT and the
+            // chroma averaging may land a little either side.
+            if (psnr < referencePsnr - 0.5 || psnr <= previous)
+            {
+                ReportFailure(__FILE__, __LINE__, what + ": " + std::to_string(psnr) + " dB against libjpeg's " +
+                    std::to_string(referencePsnr) + " dB, " + std::to_string(previous) + " dB one step down");
+            }
+            previous = psnr;
+        }
+        // At 100 only the rounding is left, and the halved chroma.
+        if (subsampling == ChromaSubsampling::Yuv444)
+            CHECK(previous > 45.0);
+    }
+}
+
+TEST(JpegRestartIntervalsDecode)
+{
+    // 4:2:0 at 200x600 has 38 MCU rows: two rows per band, 19 bands, so
+    // the RSTn numbers wrap around twice.
+    Frame frame;
+    FillFrame(frame, 200, 600, 6);
+    JpegOptions options;
+    options.quality = 85;
+    std::vector<uint8_t> jpeg, rgb;
+    REQUIRE(EncodeJpeg(frame.View(), options, jpeg));
+    CHECK_EQ(RestartInterval(jpeg), 2 * 13);
+    const std::vector<int> markers = RestartMarkers(jpeg);
+    CHECK_EQ(markers.size(), static_cast<size_t>(18));
+    for (size_t i = 0; i < markers.size(); i++)
+        CHECK_EQ(markers[i], static_cast<int>(i % 8));
+
+    int width = 0, height = 0, warnings = -1;
+    REQUIRE(DecodeJpeg(jpeg, rgb, width, height, warnings));
+    CHECK_EQ(warnings, 0);
+    const double psnr = Psnr(frame.View(), rgb);
+    std::vector<uint8_t> reference;
+    REQUIRE(ReferenceJpeg(frame.View(), 85, ChromaSubsampling::Yuv420, reference));
+    REQUIRE(DecodeJpeg(reference, rgb, width, height, warnings));
+    CHECK(psnr >= Psnr(frame.View(), rgb) - 0.5);
+
+    // The bands depend on the image alone, not on the threads.
+    std::vector<uint8_t> single;
+    options.threads = 1;
+    REQUIRE(EncodeJpeg(frame.View(), options, single));
+    CHECK(single == jpeg);
+
+    // Small and odd sizes: partial MCUs at the edges, bands of one MCU row.
+    const int sizes[][2] = { { 1, 1 }, { 7, 9 }, { 17, 33 }, { 31, 16 } };
+    for (const auto& size : sizes)
+    {
+        FillFrame(frame, size[0], size[1], 7);
+        for (ChromaSubsampling subsampling : { ChromaSubsampling::Yuv420, ChromaSubsampling::Yuv444 })
+        {
+            options.subsampling = subsampling;
+            REQUIRE(EncodeJpeg(frame.View(), options, jpeg));
+            REQUIRE(DecodeJpeg(jpeg, rgb, width, height, warnings));
+            CHECK_EQ(warnings, 0);
+            CHECK_EQ(width, size[0]);
+            CHECK_EQ(height, size[1]);
+        }
+    }
+}
@@ -0,0 +1,210 @@
+#include "TestHarness.h"
+
+#include "PngDecoder.h"
+#include "PngEncoder.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // Colour number i of a test palette, as 0xAARRGGBB. Colours are 8
+    // apart in every channel, so no two share a bucket when quantized.
+    uint32_t TestColor(int i, bool alpha)
+    {
+        const uint32_t r = (i * 5 % 32) * 8;
+        const uint32_t g = (i / 32 % 32) * 8 + 4;
+        const uint32_t b = (i * 3 % 32) * 8 + 2;
+        const uint32_t a = alpha ? 255 - (i % 4) * 60 : 255;
+        return a << 24 | r << 16 | g << 8 | b;
+    }
+
+    void Put(uint8_t* p, uint32_t color)
+    {
+        p[0] = static_cast<uint8_t>(color);
+        p[1] = static_cast<uint8_t>(color >> 8);
+        p[2] = static_cast<uint8_t>(color >> 16);
+        p[3] = static_cast<uint8_t>(color >> 24);
+    }
+
+    // width x height using colours 0..colors-1, every one at least once.
+    void FillWithColors(Frame& frame, int width, int height, int colors, bool alpha, uint32_t seed)
+    {
+        frame.Allocate(width, height, alpha ? FrameFormat::Bgra32 : FrameFormat::Bgrx32);
+        TestRng rng(seed);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                const int n = y * width + x;
+                const int i = n < colors ? n : static_cast<int>(rng.Range(colors));
+                Put(frame.Data() + y * frame.Stride() + x * 4, TestColor(i, alpha));
+            }
+        }
+    }
+
+    struct PngHeader
+    {
+        int bitDepth = 0;
+        int colorType = 0;
+    };
+
+    PngHeader ReadHeader(const std::vector<uint8_t>& png)
+    {
+        PngHeader header;
+        if (png.size() > 25)
+        {
+            header.bitDepth = png[24];
+            header.colorType = png[25];
+        }
+        return header;
+    }
+
+    // Largest channel difference between frame and what png decodes to;
+    // -1 when it does not decode to the frame's size.
+    int MaxDifference(const std::vector<uint8_t>& png, const FrameView& frame, bool keepAlpha,
+        int* pixelsOver = nullptr, int limit = 0)
+    {
+        std::vector<uint8_t> pixels;
+        int width = 0, height = 0, channels = 0;
+        if (!DecodePng(png.data(), png.size(), pixels, width, height, channels) ||
+            width != frame.width || height != frame.height)
+            return -1;
+        int worst = 0;
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                const uint8_t* expected = frame.Row(y) + x * 4;
+                const uint8_t* actual = &pixels[(static_cast<size_t>(y) * width + x) * 4];
+                int pixelWorst = keepAlpha ? std::abs(expected[3] - actual[3]) : (actual[3] == 255 ? 0 : 255);
+                for (int c = 0; c < 3; c++)
+                    pixelWorst = (std::max)(pixelWorst, std::abs(expected[c] - actual[c]));
+                if (pixelsOver && pixelWorst > limit)
+                    (*pixelsOver)++;
+                worst = (std::max)(worst, pixelWorst);
+            }
+        }
+        return worst;
+    }
+}
+
+TEST(PaletteFramesRoundTripAsIndexedPng)
+{
+    // Colour counts at every bit depth boundary; widths that leave part
+    // of the last byte of a row unused.
+    const int counts[] = { 1, 2, 3, 4, 5, 16, 17, 255, 256 };
+    const int depths[] = { 1, 1, 2, 2, 4, 4, 8, 8, 8 };
+    const int widths[] = { 1, 13, 64, 301 };
+    PngEncoder encoder;
+    std::vector<uint8_t> png;
+    Frame frame;
+    for (int keepAlpha = 0; keepAlpha <= 1; keepAlpha++)
+    {
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+        {
+            for (int width : widths)
+            {
+                const int height = (counts[c] + width - 1) / width + 3;
+                FillWithColors(frame, width, height, counts[c], keepAlpha != 0, static_cast<uint32_t>(c * 7 + width));
+                PngOptions options;
+                options.keepAlpha = keepAlpha != 0;
+                options.palette = PaletteMode::Auto;
+                REQUIRE(encoder.Encode(frame.View(), options, png));
+
+                const std::string what = std::to_string(counts[c]) + " colours, width " + std::to_string(width) +
+                    (keepAlpha ? ", alpha" : "");
+                const PngHeader header = ReadHeader(png);
+                if (header.colorType != 3 || header.bitDepth != depths[c])
+                {
+                    ReportFailure(__FILE__, __LINE__, what + ": colour type " + std::to_string(header.colorType) +
+                        ", depth " + std::to_string(header.bitDepth));
+                }
+                if (MaxDifference(png, frame.View(), keepAlpha != 0) != 0)
+                    ReportFailure(__FILE__, __LINE__, what + ": does not decode to the frame");
+            }
+        }
+    }
+}
+
+TEST(PaletteFallsBackToTruecolour)
+{
+    PngEncoder encoder;
+    std::vector<uint8_t> png;
+    Frame frame;
+
+    // 257 colours: too many for Auto, written exactly as RGB.
+    FillWithColors(frame, 40, 30, 257, false, 1);
+    PngOptions options;
+    options.palette = PaletteMode::Auto;
+    REQUIRE(encoder.Encode(frame.View(), options, png));
+    CHECK_EQ(ReadHeader(png).colorType, 2);
+    CHECK_EQ(MaxDifference(png, frame.View(), false), 0);
+
+    // Off never indexes, whatever the frame.
+    FillWithColors(frame, 40, 30, 3, false, 2);
+    options.palette = PaletteMode::Off;
+    REQUIRE(encoder.Encode(frame.View(), options, png));
+    CHECK_EQ(ReadHeader(png).colorType, 2);
+    CHECK_EQ(MaxDifference(png, frame.View(), false), 0);
+
+    // Lossy leaves frames with alpha alone, and noise that 256 colours
+    // cannot cover.
+    FillWithColors(frame, 40, 30, 600, true, 3);
+    options.palette = PaletteMode::Lossy;
+    options.keepAlpha = true;
+    REQUIRE(encoder.Encode(frame.View(), options, png));
+    CHECK_EQ(ReadHeader(png).colorType, 6);
+    CHECK_EQ(MaxDifference(png, frame.View(), true), 0);
+
+    frame.Allocate(64, 64, FrameFormat::Bgrx32);
+    TestRng rng(4);
+    for (int y = 0; y < 64; y++)
+    {
+        for (int x = 0; x < 64 * 4; x++)
+            frame.Data()[y * frame.Stride() + x] = static_cast<uint8_t>(rng.Next());
+    }
+    options.keepAlpha = false;
+    REQUIRE(encoder.Encode(frame.View(), options, png));
+    CHECK_EQ(ReadHeader(png).colorType, 2);
+    CHECK_EQ(MaxDifference(png, frame.View(), false), 0);
+}
+
+TEST(PaletteLossyQuantizesNearlyFittingFrames)
+{
+    // 250 main colours, a shade off now and then (same 5-bit bucket), and
+    // a handful of stray colours well under 1% of the frame.
+    const int width = 200, height = 150;
+    Frame frame;
+    frame.Allocate(width, height, FrameFormat::Bgrx32);
+    TestRng rng(8);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            const int n = y * width + x;
+            uint32_t color = TestColor(n < 250 ? n : static_cast<int>(rng.Range(250)), false);
+            if (rng.Range(10) == 0)
+                color += 0x010101 * rng.Range(4);
+            if (n % 997 == 500)
+                color = 0xFF000000 | rng.Next();
+            Put(frame.Data() + y * frame.Stride() + x * 4, color);
+        }
+    }
+
+    PngEncoder encoder;
+    std::vector<uint8_t> png;
+    PngOptions options;
+    options.palette = PaletteMode::Lossy;
+    REQUIRE(encoder.Encode(frame.View(), options, png));
+    CHECK_EQ(ReadHeader(png).colorType, 3);
+    CHECK_EQ(ReadHeader(png).bitDepth, 8);
+
+    // Each bucket's colour is the average of its pixels, so the shades
+    // move by less than a bucket; only the strays may land further off.
+    int strays = 0;
+    CHECK(MaxDifference(png, frame.View(), false, &strays, 7) >= 0);
+    CHECK(strays <= width * height / 997 + 1);
+}
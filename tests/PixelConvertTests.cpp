@@ -0,0 +1,277 @@
+#include "TestHarness.h"
+
+#include "PixelConvert.h"
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+    typedef void (*RowKernel)(const uint8_t*, uint8_t*, int);
+
+    struct RowKernelCase
+    {
+        const char* name;
+        RowKernel PixelKernels::*kernel;
+        int srcBytes;       // Per pixel.
+        int dstBytes;
+    };
+
+    const RowKernelCase kRowKernels[] =
+    {
+        { "bgraToRgb", &PixelKernels::bgraToRgb, 4, 3 },
+        { "bgraToRgba", &PixelKernels::bgraToRgba, 4, 4 },
+        { "bgraToBgr", &PixelKernels::bgraToBgr, 4, 3 },
+        { "bgrToBgra", &PixelKernels::bgrToBgra, 3, 4 },
+        { "bgr555ToBgra", &PixelKernels::bgr555ToBgra, 2, 4 },
+        { "bgr565ToBgra", &PixelKernels::bgr565ToBgra, 2, 4 },
+        { "bgraToGray", &PixelKernels::bgraToGray, 4, 1 },
+    };
+
+    const PixelKernelLevel kLevels[] =
+    {
+        PixelKernelLevel::Sse2,
+        PixelKernelLevel::Ssse3,
+        PixelKernelLevel::Avx2
+    };
+
+    // Widths around every vector size the kernels use, then a few long rows.
+    const int kMaxShortWidth = 80;
+    const int kLongWidths[] = { 255, 256, 257, 1000, 1921 };
+
+    std::vector<int> TestWidths()
+    {
+        std::vector<int> widths;
+        for (int width = 0; width <= kMaxShortWidth; width++)
+            widths.push_back(width);
+        widths.insert(widths.end(), kLongWidths, kLongWidths + sizeof(kLongWidths) / sizeof(kLongWidths[0]));
+        return widths;
+    }
+
+    const uint8_t kGuard = 0xA5;
+    const int kGuardBytes = 64;
+
+    // Run one kernel on the same row at the given misalignment of source
+    // and destination; dst gets guard bytes around it to catch overruns.
+    std::vector<uint8_t> RunRow(RowKernel kernel, const std::vector<uint8_t>& row, int width,
+        const RowKernelCase& test, int srcOffset, int dstOffset)
+    {
+        std::vector<uint8_t> src(srcOffset + row.size());
+        if (!row.empty())
+            memcpy(src.data() + srcOffset, row.data(), row.size());
+        std::vector<uint8_t> dst(dstOffset + static_cast<size_t>(width) * test.dstBytes + kGuardBytes, kGuard);
+        kernel(src.data() + srcOffset, dst.data() + dstOffset, width);
+        return std::vector<uint8_t>(dst.begin() + dstOffset, dst.end());
+    }
+}
+
+TEST(ScalarKernelsMatchDefinition)
+{
+    // The scalar kernels are what every other level is checked against,
+    // so they are checked against the formats themselves: every 16-bit
+    // pixel, and random 24- and 32-bit ones.
+    const PixelKernels* scalar = PixelKernelsFor(PixelKernelLevel::Scalar);
+    REQUIRE(scalar);
+    const int count = 65536;
+    std::vector<uint8_t> src(static_cast<size_t>(count) * 4), dst(static_cast<size_t>(count) * 4);
+    for (int v = 0; v < count; v++)
+    {
+        src[v * 2] = static_cast<uint8_t>(v);
+        src[v * 2 + 1] = static_cast<uint8_t>(v >> 8);
+    }
+
+    // 5- and 6-bit channels widen by repeating their top bits: 0 stays 0,
+    // the maximum becomes 255, and nothing is more than a step off
+    // v * 255 / max.
+    int wrong555 = 0, wrong565 = 0;
+    scalar->bgr555ToBgra(src.data(), dst.data(), count);
+    for (int v = 0; v < count; v++)
+    {
+        const int channels[3] = { v & 31, (v >> 5) & 31, (v >> 10) & 31 };
+        for (int c = 0; c < 3; c++)
+        {
+            const int widened = channels[c] * 8 + channels[c] / 4;
+            wrong555 += dst[v * 4 + c] != widened || std::fabs(widened - channels[c] * 255.0 / 31) >= 1.0;
+        }
+        wrong555 += dst[v * 4 + 3] != 255;
+    }
+    scalar->bgr565ToBgra(src.data(), dst.data(), count);
+    for (int v = 0; v < count; v++)
+    {
+        const int b = v & 31, g = (v >> 5) & 63, r = v >> 11;
+        const int widened[3] = { b * 8 + b / 4, g * 4 + g / 16, r * 8 + r / 4 };
+        wrong565 += dst[v * 4] != widened[0] || dst[v * 4 + 1] != widened[1] || dst[v * 4 + 2] != widened[2] ||
+            dst[v * 4 + 3] != 255 || std::fabs(widened[1] - g * 255.0 / 63) >= 1.0;
+    }
+    CHECK_EQ(wrong555, 0);
+    CHECK_EQ(wrong565, 0);
+
+    TestRng rng(12);
+    const int width = 4099;
+    for (uint8_t& b : src)
+        b = static_cast<uint8_t>(rng.Next());
+    // Every grey level among them.
+    for (int x = 0; x < 256; x++)
+        memset(&src[x * 4], x, 3);
+
+    int wrong = 0;
+    scalar->bgraToRgb(src.data(), dst.data(), width);
+    for (int x = 0; x < width; x++)
+        wrong += dst[x * 3] != src[x * 4 + 2] || dst[x * 3 + 1] != src[x * 4 + 1] || dst[x * 3 + 2] != src[x * 4];
+    CHECK_EQ(wrong, 0);
+
+    wrong = 0;
+    scalar->bgraToRgba(src.data(), dst.data(), width);
+    for (int x = 0; x < width; x++)
+    {
+        wrong += dst[x * 4] != src[x * 4 + 2] || dst[x * 4 + 1] != src[x * 4 + 1] || dst[x * 4 + 2] != src[x * 4] ||
+            dst[x * 4 + 3] != src[x * 4 + 3];
+    }
+    CHECK_EQ(wrong, 0);
+
+    wrong = 0;
+    scalar->bgraToBgr(src.data(), dst.data(), width);
+    for (int x = 0; x < width; x++)
+        wrong += memcmp(&dst[x * 3], &src[x * 4], 3) != 0;
+    CHECK_EQ(wrong, 0);
+
+    wrong = 0;
+    scalar->bgrToBgra(src.data(), dst.data(), width);
+    for (int x = 0; x < width; x++)
+        wrong += memcmp(&dst[x * 4], &src[x * 3], 3) != 0 || dst[x * 4 + 3] != 255;
+    CHECK_EQ(wrong, 0);
+
+    // BT.601 luma rounded from weights in 256ths: within one of the exact
+    // weighting, and exact on greys.
+    wrong = 0;
+    scalar->bgraToGray(src.data(), dst.data(), width);
+    for (int x = 0; x < width; x++)
+    {
+        const uint8_t* p = &src[x * 4];
+        const int fixed = (29 * p[0] + 150 * p[1] + 77 * p[2] + 128) >> 8;
+        const double exact = 0.114 * p[0] + 0.587 * p[1] + 0.299 * p[2];
+        wrong += dst[x] != fixed || std::fabs(dst[x] - exact) >= 1.0 || (x < 256 && dst[x] != x);
+    }
+    CHECK_EQ(wrong, 0);
+
+    wrong = 0;
+    std::vector<uint8_t> opaque(src.begin(), src.begin() + width * 4);
+    scalar->forceOpaque(opaque.data(), width);
+    for (int x = 0; x < width; x++)
+        wrong += memcmp(&opaque[x * 4], &src[x * 4], 3) != 0 || opaque[x * 4 + 3] != 255;
+    CHECK_EQ(wrong, 0);
+}
+
+TEST(PixelKernelLevelsMatchScalar)
+{
+    const PixelKernels* scalar = PixelKernelsFor(PixelKernelLevel::Scalar);
+    REQUIRE(scalar);
+    TestRng rng(9);
+    const std::vector<int> widths = TestWidths();
+    for (PixelKernelLevel level : kLevels)
+    {
+        const PixelKernels* kernels = PixelKernelsFor(level);
+        if (!kernels)
+            continue;
+        for (const RowKernelCase& test : kRowKernels)
+        {
+            for (int width : widths)
+            {
+                std::vector<uint8_t> row(static_cast<size_t>(width) * test.srcBytes);
+                for (uint8_t& b : row)
+                    b = static_cast<uint8_t>(rng.Next());
+                const std::vector<uint8_t> expected = RunRow(scalar->*test.kernel, row, width, test, 0, 0);
+                for (int offset = 0; offset < 4; offset++)
+                {
+                    // Source and destination misaligned by different amounts.
+                    const std::vector<uint8_t> actual = RunRow(kernels->*test.kernel, row, width, test,
+                        offset, (offset * 3) % 4 + (width & 1) * 16);
+                    if (actual != expected)
+                    {
+                        ReportFailure(__FILE__, __LINE__, std::string(kernels->name) + " " + test.name +
+                            " differs from scalar at width " + std::to_string(width) +
+                            ", offset " + std::to_string(offset));
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(ForceOpaqueLevelsMatchScalar)
+{
+    const PixelKernels* scalar = PixelKernelsFor(PixelKernelLevel::Scalar);
+    REQUIRE(scalar);
+    TestRng rng(10);
+    for (PixelKernelLevel level : kLevels)
+    {
+        const PixelKernels* kernels = PixelKernelsFor(level);
+        if (!kernels)
+            continue;
+        for (int width : TestWidths())
+        {
+            for (int offset = 0; offset < 4; offset++)
+            {
+                std::vector<uint8_t> expected(offset + static_cast<size_t>(width) * 4 + kGuardBytes);
+                for (uint8_t& b : expected)
+                    b = static_cast<uint8_t>(rng.Next());
+                std::vector<uint8_t> actual = expected;
+                scalar->forceOpaque(expected.data() + offset, width);
+                kernels->forceOpaque(actual.data() + offset, width);
+                if (actual != expected)
+                {
+                    ReportFailure(__FILE__, __LINE__, std::string(kernels->name) +
+                        " forceOpaque differs from scalar at width " + std::to_string(width) +
+                        ", offset " + std::to_string(offset));
+                }
+            }
+        }
+    }
+}
+
+TEST(FlipRowsLevelsMatchScalar)
+{
+    const PixelKernels* scalar = PixelKernelsFor(PixelKernelLevel::Scalar);
+    REQUIRE(scalar);
+    TestRng rng(11);
+    for (PixelKernelLevel level : kLevels)
+    {
+        const PixelKernels* kernels = PixelKernelsFor(level);
+        if (!kernels)
+            continue;
+        for (int rowBytes = 0; rowBytes <= 200; rowBytes += rowBytes < 70 ? 1 : 13)
+        {
+            for (int height = 0; height <= 5; height++)
+            {
+                // Padding between rows stays where it is.
+                const ptrdiff_t stride = rowBytes + height % 3 * 5;
+                const int offset = (rowBytes + height) % 4;
+                std::vector<uint8_t> expected(offset + stride * height + kGuardBytes);
+                for (uint8_t& b : expected)
+                    b = static_cast<uint8_t>(rng.Next());
+                std::vector<uint8_t> actual = expected;
+                scalar->flipRows(expected.data() + offset, rowBytes, height, stride);
+                kernels->flipRows(actual.data() + offset, rowBytes, height, stride);
+                if (actual != expected)
+                {
+                    ReportFailure(__FILE__, __LINE__, std::string(kernels->name) +
+                        " flipRows differs from scalar at " + std::to_string(rowBytes) +
+                        " bytes x " + std::to_string(height) + " rows");
+                }
+            }
+        }
+    }
+}
+
+TEST(PixelKernelLevelsAvailableOnThisCpu)
+{
+    // Scalar always runs; the active table is one of the levels.
+    const PixelKernels& active = ActivePixelKernels();
+    bool found = PixelKernelsFor(PixelKernelLevel::Scalar) == &active;
+    for (PixelKernelLevel level : kLevels)
+        found = found || PixelKernelsFor(level) == &active;
+    CHECK(found);
+}
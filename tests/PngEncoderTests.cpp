@@ -0,0 +1,276 @@
+#include "TestHarness.h"
+
+#include "PngDecoder.h"
+#include "PngEncoder.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <png.h>
+#include <zlib.h>
+
+namespace
+{
+    // Desktop-like content: flat runs and gradients with some noise, so
+    // every filter type gets picked somewhere.
+    void FillFrame(Frame& frame, int width, int height, uint32_t seed)
+    {
+        frame.Allocate(width, height, FrameFormat::Bgra32);
+        TestRng rng(seed);
+        for (int y = 0; y < height; y++)
+        {
+            uint8_t* row = frame.Data() + y * frame.Stride();
+            for (int x = 0; x < width; x++)
+            {
+                uint8_t* p = row + x * 4;
+                const int band = (y / 37 + x / 53) % 4;
+                p[0] = static_cast<uint8_t>(band == 0 ? 0xF0 : band == 1 ? x + y : band == 2 ? rng.Next() : x * 3);
+                p[1] = static_cast<uint8_t>(band == 0 ? 0xF0 : band == 1 ? x : band == 2 ? rng.Next() : y);
+                p[2] = static_cast<uint8_t>(band == 0 ? 0xF0 : band == 1 ? y : band == 2 ? rng.Next() : x ^ y);
+                p[3] = static_cast<uint8_t>(rng.Next() | 0x80);
+            }
+        }
+    }
+
+    // Decode png and compare it with frame, alpha included when kept.
+    bool DecodesTo(const std::vector<uint8_t>& png, const FrameView& frame, bool keepAlpha)
+    {
+        std::vector<uint8_t> pixels;
+        int width = 0, height = 0, channels = 0;
+        if (!DecodePng(png.data(), png.size(), pixels, width, height, channels))
+            return false;
+        if (width != frame.width || height != frame.height || channels != (keepAlpha ? 4 : 3))
+            return false;
+        for (int y = 0; y < height; y++)
+        {
+            const uint8_t* expected = frame.Row(y);
+            const uint8_t* actual = &pixels[static_cast<size_t>(y) * width * 4];
+            for (int x = 0; x < width; x++)
+            {
+                if (std::memcmp(expected + x * 4, actual + x * 4, 3) != 0 ||
+                    actual[x * 4 + 3] != (keepAlpha ? expected[x * 4 + 3] : 0xFF))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    //---------------------------------------------------------------------
+    // The raw path is also checked without going through our own decoder:
+    // libpng must read the file back exactly, and the scanlines zlib
+    // inflates from it must be the filters the PNG spec defines.
+
+    // libpng's simplified reader; it checks the chunk CRCs and Adler-32.
+    bool DecodeWithLibpng(const std::vector<uint8_t>& png, std::vector<uint8_t>& bgra, int& width, int& height)
+    {
+        png_image image;
+        memset(&image, 0, sizeof(image));
+        image.version = PNG_IMAGE_VERSION;
+        if (!png_image_begin_read_from_memory(&image, png.data(), png.size()))
+            return false;
+        image.format = PNG_FORMAT_BGRA;
+        bgra.resize(PNG_IMAGE_SIZE(image));
+        width = static_cast<int>(image.width);
+        height = static_cast<int>(image.height);
+        return png_image_finish_read(&image, nullptr, bgra.data(), 0, nullptr) != 0;
+    }
+
+    uint32_t GetU32BE(const uint8_t* p)
+    {
+        return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+    }
+
+    // The IDAT data of png inflated with zlib: a filter type byte and the
+    // filtered bytes for every row.
+    bool InflateScanlines(const std::vector<uint8_t>& png, size_t size, std::vector<uint8_t>& lines)
+    {
+        std::vector<uint8_t> idat;
+        for (size_t at = 8; at + 12 <= png.size(); )
+        {
+            const uint32_t length = GetU32BE(&png[at]);
+            if (length > png.size() - at - 12)
+                return false;
+            if (memcmp(&png[at + 4], "IDAT", 4) == 0)
+                idat.insert(idat.end(), png.begin() + at + 8, png.begin() + at + 8 + length);
+            at += 12 + length;
+        }
+        lines.resize(size);
+        uLongf inflated = static_cast<uLongf>(size);
+        return uncompress(lines.data(), &inflated, idat.data(), static_cast<uLong>(idat.size())) == Z_OK &&
+            inflated == size;
+    }
+
+    // Rows whose filter is not the first of None, Sub, Up, Avg and Paeth
+    // with the smallest sum of residuals read as signed bytes, or whose
+    // bytes are not that filter applied to the row.
+    int WrongFilterRows(const std::vector<uint8_t>& lines, const FrameView& frame, bool keepAlpha)
+    {
+        const int bpp = keepAlpha ? 4 : 3;
+        const size_t rowBytes = static_cast<size_t>(frame.width) * bpp;
+        // bpp zero bytes before each row, and a zero row above the first.
+        std::vector<uint8_t> prior(bpp + rowBytes, 0), cur(bpp + rowBytes, 0);
+        std::vector<uint8_t> residuals[5];
+        int wrong = 0;
+        for (int y = 0; y < frame.height; y++)
+        {
+            const uint8_t* src = frame.Row(y);
+            for (int x = 0; x < frame.width; x++)
+            {
+                uint8_t* rgb = &cur[bpp + x * bpp];
+                rgb[0] = src[x * 4 + 2];
+                rgb[1] = src[x * 4 + 1];
+                rgb[2] = src[x * 4];
+                if (keepAlpha)
+                    rgb[3] = src[x * 4 + 3];
+            }
+            uint64_t costs[5] = { 0, 0, 0, 0, 0 };
+            for (int f = 0; f < 5; f++)
+                residuals[f].assign(rowBytes, 0);
+            for (size_t i = 0; i < rowBytes; i++)
+            {
+                const int x = cur[bpp + i], a = cur[i], b = prior[bpp + i], c = prior[i];
+                const int p = a + b - c;
+                const int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                const int paeth = pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+                const int predictions[5] = { 0, a, b, (a + b) / 2, paeth };
+                for (int f = 0; f < 5; f++)
+                {
+                    const uint8_t residual = static_cast<uint8_t>(x - predictions[f]);
+                    residuals[f][i] = residual;
+                    costs[f] += static_cast<uint64_t>(std::abs(static_cast<int8_t>(residual)));
+                }
+            }
+            const int best = static_cast<int>(std::min_element(costs, costs + 5) - costs);
+            const uint8_t* line = &lines[y * (rowBytes + 1)];
+            if (line[0] != best || !std::equal(residuals[best].begin(), residuals[best].end(), line + 1))
+                wrong++;
+            prior.swap(cur);
+        }
+        return wrong;
+    }
+}
+
+TEST(PngEncoderRoundTripsThroughDecoder)
+{
+    // Small images, and ones large enough to be cut into strips where
+    // there are threads to run them.
+    const int sizes[][2] = { { 1, 1 }, { 3, 7 }, { 640, 480 }, { 1500, 1100 } };
+    const CompressionLevel levels[] = { CompressionLevel::Fast, CompressionLevel::Default };
+    PngEncoder encoder;
+    std::vector<uint8_t> png;
+    for (const auto& size : sizes)
+    {
+        Frame frame;
+        FillFrame(frame, size[0], size[1], static_cast<uint32_t>(size[0] * 31 + size[1]));
+        for (CompressionLevel level : levels)
+        {
+            if (level != CompressionLevel::Fast && size[0] > 1000)
+                continue;
+            for (int threads = 0; threads <= 2; threads++)
+            {
+                for (int keepAlpha = 0; keepAlpha <= 1; keepAlpha++)
+                {
+                    PngOptions options;
+                    options.level = level;
+                    options.threads = threads;
+                    options.keepAlpha = keepAlpha != 0;
+                    REQUIRE(encoder.Encode(frame.View(), options, png));
+                    CHECK(DecodesTo(png, frame.View(), keepAlpha != 0));
+                }
+            }
+        }
+    }
+}
+
+TEST(PngEncoderOneThreadWritesOneStrip)
+{
+    // A single strip is one zlib stream without the sync flushes that end
+    // every strip, so it is never larger than the striped output.
+    Frame frame;
+    FillFrame(frame, 1500, 1100, 5);
+    PngEncoder encoder;
+    std::vector<uint8_t> striped, single;
+    PngOptions options;
+    options.level = CompressionLevel::Fast;
+    options.threads = 0;
+    REQUIRE(encoder.Encode(frame.View(), options, striped));
+    options.threads = 1;
+    REQUIRE(encoder.Encode(frame.View(), options, single));
+    CHECK(single.size() <= striped.size());
+    CHECK(DecodesTo(single, frame.View(), false));
+}
+
+TEST(PngRawPathMatchesLibpngAndFilterDefinitions)
+{
+    // Widths either side of the 16-byte filter loop, strided and bottom-up
+    // views, every level, and an image large enough to be striped.
+    const int sizes[][2] = { { 1, 1 }, { 2, 3 }, { 5, 2 }, { 17, 9 }, { 63, 40 }, { 641, 97 }, { 1500, 1100 } };
+    const CompressionLevel levels[] = { CompressionLevel::Fast, CompressionLevel::Default, CompressionLevel::Max };
+    PngEncoder encoder;
+    std::vector<uint8_t> png, decoded, lines;
+    for (const auto& size : sizes)
+    {
+        const int width = size[0], height = size[1];
+        Frame frame;
+        FillFrame(frame, width, height, static_cast<uint32_t>(width * 7 + height));
+
+        // The same pixels with padding after every row, and bottom-up.
+        const ptrdiff_t padded = static_cast<ptrdiff_t>(width) * 4 + 36;
+        std::vector<uint8_t> memory(padded * height, 0xEE);
+        for (int y = 0; y < height; y++)
+            memcpy(&memory[(height - 1 - y) * padded], frame.View().Row(y), width * 4);
+        FrameView views[2] = { frame.View(), frame.View() };
+        views[1].data = memory.data() + (height - 1) * padded;
+        views[1].stride = -padded;
+
+        for (CompressionLevel level : levels)
+        {
+            if (level == CompressionLevel::Max && width > 1000)
+                continue;
+            for (int keepAlpha = 0; keepAlpha <= 1; keepAlpha++)
+            {
+                for (int view = 0; view < 2; view++)
+                {
+                    const std::string what = std::to_string(width) + "x" + std::to_string(height) + " level " +
+                        std::to_string(static_cast<int>(level)) + (keepAlpha ? " RGBA" : " RGB") +
+                        (view ? " bottom-up" : "");
+                    PngOptions options;
+                    options.level = level;
+                    options.keepAlpha = keepAlpha != 0;
+                    options.threads = view ? 1 : 0;
+                    REQUIRE(encoder.Encode(views[view], options, png));
+
+                    int decodedWidth = 0, decodedHeight = 0;
+                    if (!DecodeWithLibpng(png, decoded, decodedWidth, decodedHeight) || decodedWidth != width ||
+                        decodedHeight != height)
+                    {
+                        ReportFailure(__FILE__, __LINE__, "libpng rejects " + what);
+                        continue;
+                    }
+                    int wrong = 0;
+                    for (int y = 0; y < height; y++)
+                    {
+                        const uint8_t* expected = frame.View().Row(y);
+                        const uint8_t* actual = &decoded[static_cast<size_t>(y) * width * 4];
+                        for (int x = 0; x < width; x++)
+                        {
+                            wrong += memcmp(expected + x * 4, actual + x * 4, 3) != 0 ||
+                                actual[x * 4 + 3] != (keepAlpha ? expected[x * 4 + 3] : 0xFF);
+                        }
+                    }
+                    if (wrong != 0)
+                        ReportFailure(__FILE__, __LINE__, what + ": " + std::to_string(wrong) + " pixels differ");
+
+                    const size_t lineBytes = static_cast<size_t>(width) * (keepAlpha ? 4 : 3) + 1;
+                    if (!InflateScanlines(png, lineBytes * height, lines))
+                        ReportFailure(__FILE__, __LINE__, what + ": zlib cannot inflate the scanlines");
+                    else if (const int rows = WrongFilterRows(lines, frame.View(), keepAlpha != 0))
+                        ReportFailure(__FILE__, __LINE__, what + ": " + std::to_string(rows) + " rows filtered wrongly");
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,348 @@
+#include "TestHarness.h"
+
+#include "PngDecoder.h"
+#include "PngEncoder.h"
+#include "QoiCodec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+    const uint8_t kEndMarker[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+    // An image with padding after every row; pixels are BGRA words.
+    struct TestImage
+    {
+        TestImage(int w, int h, FrameFormat f)
+            : width(w), height(h), format(f), stride(static_cast<ptrdiff_t>(w) * 4 + 12),
+              bytes(static_cast<size_t>(stride) * h, 0xEE)
+        {
+        }
+
+        uint32_t Get(int i) const
+        {
+            uint32_t px;
+            memcpy(&px, &bytes[(i / width) * stride + (i % width) * 4], 4);
+            return px;
+        }
+
+        void Set(int i, uint32_t px)
+        {
+            memcpy(&bytes[(i / width) * stride + (i % width) * 4], &px, 4);
+        }
+
+        FrameView View() const
+        {
+            FrameView view;
+            view.data = const_cast<uint8_t*>(bytes.data());
+            view.width = width;
+            view.height = height;
+            view.stride = stride;
+            view.format = format;
+            return view;
+        }
+
+        int width;
+        int height;
+        FrameFormat format;
+        ptrdiff_t stride;
+        std::vector<uint8_t> bytes;
+    };
+
+    // Whether decoded (top-down BGRA) holds image's pixels; alpha is 255
+    // for Bgrx32 images, whatever their alpha bytes held.
+    bool DecodesTo(const std::vector<uint8_t>& decoded, const TestImage& image)
+    {
+        if (decoded.size() != static_cast<size_t>(image.width) * image.height * 4)
+            return false;
+        const uint32_t alpha = image.format == FrameFormat::Bgra32 ? 0 : 0xFF000000u;
+        for (int i = 0; i < image.width * image.height; i++)
+        {
+            uint32_t px;
+            memcpy(&px, &decoded[static_cast<size_t>(i) * 4], 4);
+            if (px != (image.Get(i) | alpha))
+                return false;
+        }
+        return true;
+    }
+
+    // Decode from a buffer of exactly the file's size, so a read past its
+    // end shows under the address sanitizer.
+    bool Decode(const std::vector<uint8_t>& file, size_t size, std::vector<uint8_t>& pixels, int& channels)
+    {
+        std::vector<uint8_t> exact(file.begin(), file.begin() + size);
+        int width = 0, height = 0;
+        return DecodeQoi(exact.data(), exact.size(), pixels, width, height, channels);
+    }
+
+    // One chunk of a QOI stream: its op ('R'gb, rgb'A', 'I'ndex, 'D'iff,
+    // 'L'uma or r'U'n) and, for runs, the run length.
+    struct Chunk
+    {
+        char op;
+        int run;
+    };
+
+    std::vector<Chunk> Chunks(const std::vector<uint8_t>& file)
+    {
+        std::vector<Chunk> chunks;
+        size_t p = 14;
+        while (p + sizeof(kEndMarker) < file.size())
+        {
+            const uint8_t op = file[p];
+            Chunk chunk = { 'U', 0 };
+            size_t length = 1;
+            if (op == 0xFE)
+            {
+                chunk.op = 'R';
+                length = 4;
+            }
+            else if (op == 0xFF)
+            {
+                chunk.op = 'A';
+                length = 5;
+            }
+            else if (op >= 0xC0)
+            {
+                chunk.run = (op & 0x3F) + 1;
+            }
+            else
+            {
+                const char ops[3] = { 'I', 'D', 'L' };
+                chunk.op = ops[op >> 6];
+                length = op >> 6 == 2 ? 2 : 1;
+            }
+            p += length;
+            chunks.push_back(chunk);
+        }
+        return chunks;
+    }
+
+    std::string Describe(const std::vector<Chunk>& chunks)
+    {
+        std::string text;
+        for (const Chunk& chunk : chunks)
+            text += chunk.op == 'U' ? "U" + std::to_string(chunk.run) + " " : std::string(1, chunk.op) + " ";
+        return text;
+    }
+
+    // Screen-like content: flat areas, gentle gradients that make DIFF and
+    // LUMA chunks, repeats of a few colours, and some noise.
+    void FillScreenLike(TestImage& image, uint32_t seed, bool varyAlpha)
+    {
+        TestRng rng(seed);
+        const uint32_t colors[4] = { 0xFFFFFFFFu, 0xFF1E1E1Eu, 0xFF3366CCu, 0xFFF0F0F0u };
+        uint32_t px = colors[0];
+        for (int i = 0; i < image.width * image.height; i++)
+        {
+            const int pick = rng.Range(16);
+            if (pick < 2)
+                px = colors[rng.Range(4)];
+            else if (pick == 2)
+                px = rng.Next();
+            else if (pick == 3)
+                px += 0x010101u * static_cast<uint32_t>(rng.Range(3)) - 0x000100u;
+            else if (pick == 4)
+                px += 0x0A0C0Eu;
+            if (varyAlpha && pick == 5)
+                px = (px & 0x00FFFFFFu) | (rng.Next() << 24);
+            image.Set(i, image.format == FrameFormat::Bgra32 ? px : (px & 0x00FFFFFFu) | (rng.Next() << 24));
+        }
+    }
+}
+
+TEST(QoiEncodesEveryOp)
+{
+    // 7 x 29 with padded rows; runs carry over row ends.
+    TestImage image(7, 29, FrameFormat::Bgra32);
+    int i = 0;
+    image.Set(i++, 0xFF102030u);                        // RGB: green is 32 away.
+    image.Set(i++, 0xFF111F30u);                        // DIFF: +1, -1, 0.
+    image.Set(i++, 0xFF1B2B3Eu);                        // LUMA: green +12, red and blue 2 off it.
+    image.Set(i++, 0xFF102030u);                        // INDEX
+    for (int n = 0; n < 63; n++)
+        image.Set(i++, 0x80102030u);                    // RGBA, then a run of exactly 62.
+    for (int n = 0; n < 64; n++)
+        image.Set(i++, 0x80405060u);                    // RGB, then runs of 62 and 1.
+    while (i < 7 * 29)
+        image.Set(i++, 0);                              // INDEX: the table starts out all zero.
+    std::vector<uint8_t> file;
+    REQUIRE(EncodeQoi(image.View(), file));
+
+    const uint8_t header[14] = { 'q', 'o', 'i', 'f', 0, 0, 0, 7, 0, 0, 0, 29, 4, 0 };
+    REQUIRE(file.size() > sizeof(header) + sizeof(kEndMarker));
+    CHECK(memcmp(file.data(), header, sizeof(header)) == 0);
+    CHECK(memcmp(file.data() + file.size() - 8, kEndMarker, 8) == 0);
+    const uint8_t firstChunks[] = { 0xFE, 0x10, 0x20, 0x30, 0x40 | (3 << 4) | (1 << 2) | 2, 0x80 | (12 + 32),
+        ((-2 + 8) << 4) | (2 + 8) };
+    CHECK(memcmp(file.data() + 14, firstChunks, sizeof(firstChunks)) == 0);
+    // The zeros at the end: an INDEX and a run of the other 71 pixels.
+    CHECK_EQ(Describe(Chunks(file)), std::string("R D L I A U62 R U62 U1 I U62 U9 "));
+
+    std::vector<uint8_t> decoded;
+    int channels = 0;
+    REQUIRE(Decode(file, file.size(), decoded, channels));
+    CHECK_EQ(channels, 4);
+    CHECK(DecodesTo(decoded, image));
+}
+
+TEST(QoiRoundTripsAnyContent)
+{
+    const int sizes[][2] = { { 1, 1 }, { 1, 9 }, { 9, 1 }, { 3, 5 }, { 31, 17 }, { 64, 9 }, { 257, 3 }, { 100, 70 } };
+    const FrameFormat formats[] = { FrameFormat::Bgra32, FrameFormat::Bgrx32 };
+    uint32_t seed = 1;
+    for (const auto& size : sizes)
+    {
+        for (FrameFormat format : formats)
+        {
+            for (int content = 0; content < 3; content++)
+            {
+                TestImage image(size[0], size[1], format);
+                if (content == 2)
+                {
+                    // Noise: mostly RGB and RGBA chunks.
+                    TestRng rng(seed);
+                    for (int i = 0; i < image.width * image.height; i++)
+                        image.Set(i, rng.Next());
+                }
+                else
+                {
+                    FillScreenLike(image, seed, content == 1);
+                }
+                seed++;
+
+                std::vector<uint8_t> file, banded, decoded;
+                int channels = 0;
+                const std::string what = std::to_string(size[0]) + "x" + std::to_string(size[1]) +
+                    (format == FrameFormat::Bgra32 ? " BGRA" : " BGRX") + ", content " + std::to_string(content);
+                if (!EncodeQoi(image.View(), file) || !Decode(file, file.size(), decoded, channels) ||
+                    channels != (format == FrameFormat::Bgra32 ? 4 : 3) || !DecodesTo(decoded, image))
+                {
+                    ReportFailure(__FILE__, __LINE__, what + " does not round trip");
+                    continue;
+                }
+
+                // Bands of any height make the same file.
+                QoiStreamEncoder stream;
+                REQUIRE(stream.Begin(image.width, image.height, format, banded));
+                TestRng rng(seed);
+                for (int top = 0; top < image.height;)
+                {
+                    const int rows = (std::min)(1 + rng.Range(4), image.height - top);
+                    REQUIRE(stream.AddRows(image.View().Crop(0, top, image.width, rows), banded));
+                    top += rows;
+                }
+                REQUIRE(stream.Finish(banded));
+                if (banded != file)
+                    ReportFailure(__FILE__, __LINE__, what + " encodes differently in bands");
+            }
+        }
+    }
+}
+
+TEST(QoiDecoderRejectsBadInput)
+{
+    TestImage image(23, 11, FrameFormat::Bgra32);
+    FillScreenLike(image, 7, true);
+    std::vector<uint8_t> file, decoded;
+    int channels = 0;
+    REQUIRE(EncodeQoi(image.View(), file));
+
+    // Cut anywhere, the end marker included.
+    for (size_t size = 0; size < file.size(); size++)
+    {
+        if (Decode(file, size, decoded, channels))
+            ReportFailure(__FILE__, __LINE__, "decoded " + std::to_string(size) + " of " +
+                std::to_string(file.size()) + " bytes");
+    }
+
+    // Bad headers: magic, sizes, channels, colour space, more pixels than
+    // the data could hold or than any file may have.
+    struct { size_t at; uint8_t value; } headers[] =
+    {
+        { 0, 'Q' }, { 7, 0 }, { 11, 0 }, { 12, 2 }, { 12, 5 }, { 13, 2 }, { 4, 0x01 }, { 4, 0x80 }, { 8, 0xFF },
+    };
+    for (const auto& change : headers)
+    {
+        std::vector<uint8_t> bad = file;
+        if (change.at == 7 || change.at == 11)
+            bad[change.at - 1] = bad[change.at - 2] = bad[change.at - 3] = 0;
+        bad[change.at] = change.value;
+        if (Decode(bad, bad.size(), decoded, channels))
+            ReportFailure(__FILE__, __LINE__, "decoded with header byte " + std::to_string(change.at) + " changed");
+    }
+
+    // The end marker must follow the last chunk, whole.
+    std::vector<uint8_t> bad = file;
+    bad.back() = 0;
+    CHECK(!Decode(bad, bad.size(), decoded, channels));
+    bad = file;
+    bad.insert(bad.end() - 8, 0x40 | 0x2A);
+    CHECK(!Decode(bad, bad.size(), decoded, channels));
+
+    // A run past the last pixel.
+    TestImage flat(2, 2, FrameFormat::Bgrx32);
+    for (int i = 0; i < 4; i++)
+        flat.Set(i, 0);
+    REQUIRE(EncodeQoi(flat.View(), file));
+    CHECK_EQ(Describe(Chunks(file)), std::string("U4 "));
+    REQUIRE(Decode(file, file.size(), decoded, channels));
+    file[14] = 0xC0 | 4;
+    CHECK(!Decode(file, file.size(), decoded, channels));
+
+    // Random damage decodes to something or fails, never reading past
+    // the data.
+    REQUIRE(EncodeQoi(image.View(), file));
+    TestRng rng(11);
+    for (int n = 0; n < 500; n++)
+    {
+        bad = file;
+        for (int k = 1 + rng.Range(4); k > 0; k--)
+            bad[14 + rng.Range(static_cast<int>(bad.size()) - 14)] = static_cast<uint8_t>(rng.Next());
+        Decode(bad, bad.size(), decoded, channels);
+    }
+}
+
+TEST(QoiDecodesForToPng)
+{
+    // What -topng does with each file: decode it as a frame and encode
+    // that as PNG, alpha kept for 4-channel files.
+    const FrameFormat formats[] = { FrameFormat::Bgra32, FrameFormat::Bgrx32 };
+    const PaletteMode palettes[] = { PaletteMode::Off, PaletteMode::Auto };
+    for (FrameFormat format : formats)
+    {
+        TestImage image(45, 19, format);
+        FillScreenLike(image, 21, true);
+        std::vector<uint8_t> qoi, pixels, png, decoded;
+        REQUIRE(EncodeQoi(image.View(), qoi));
+        FrameView frame;
+        REQUIRE(DecodeQoi(qoi.data(), qoi.size(), pixels, frame));
+        CHECK(frame.data == pixels.data());
+        CHECK_EQ(frame.width, 45);
+        CHECK_EQ(frame.height, 19);
+        CHECK_EQ(frame.stride, static_cast<ptrdiff_t>(45 * 4));
+        CHECK(frame.format == format);
+        CHECK(DecodesTo(pixels, image));
+
+        for (PaletteMode palette : palettes)
+        {
+            PngEncoder encoder;
+            PngOptions options;
+            options.keepAlpha = true;
+            options.palette = palette;
+            int width = 0, height = 0, channels = 0;
+            REQUIRE(encoder.Encode(frame, options, png));
+            REQUIRE(DecodePng(png.data(), png.size(), decoded, width, height, channels));
+            CHECK_EQ(channels, format == FrameFormat::Bgra32 ? 4 : 3);
+            CHECK(DecodesTo(decoded, image));
+        }
+    }
+
+    FrameView frame;
+    std::vector<uint8_t> pixels;
+    const uint8_t notQoi[32] = { 'q', 'o', 'i', 'f' };
+    CHECK(!DecodeQoi(notQoi, sizeof(notQoi), pixels, frame));
+}
@@ -0,0 +1,319 @@
+#include "TestHarness.h"
+
+#include "Redaction.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Every style is checked against a plain definition of it, run on the
+// part of each region that lies in the frame, or in one band or monitor
+// of a larger image.
+
+namespace
+{
+    // An image of width x height pixels with padding after every row
+    // that nothing may write to.
+    struct TestImage
+    {
+        TestImage(int w, int h, uint32_t seed)
+            : width(w), height(h), stride(static_cast<ptrdiff_t>(w) * 4 + 12),
+              bytes(static_cast<size_t>(stride) * h)
+        {
+            TestRng rng(seed);
+            for (uint8_t& b : bytes)
+                b = static_cast<uint8_t>(rng.Next());
+        }
+
+        FrameView Piece(int x, int y, int w, int h)
+        {
+            FrameView view;
+            view.data = bytes.data() + y * stride + x * 4;
+            view.width = w;
+            view.height = h;
+            view.stride = stride;
+            view.format = FrameFormat::Bgra32;
+            return view;
+        }
+
+        FrameView View() { return Piece(0, 0, width, height); }
+
+        uint8_t* Pixel(int x, int y) { return bytes.data() + y * stride + x * 4; }
+
+        int width;
+        int height;
+        ptrdiff_t stride;
+        std::vector<uint8_t> bytes;
+    };
+
+    DesktopRect Rect(int left, int top, int width, int height)
+    {
+        DesktopRect rect;
+        rect.left = left;
+        rect.top = top;
+        rect.right = left + width;
+        rect.bottom = top + height;
+        return rect;
+    }
+
+    RedactRegion Region(const DesktopRect& rect, RedactMode mode, int size, uint32_t colour = 0xFF102030)
+    {
+        RedactRegion region;
+        region.rect = rect;
+        region.style.mode = mode;
+        region.style.size = size;
+        region.style.colour = colour;
+        return region;
+    }
+
+    // Mean of samples i - radius .. i + radius of a line, the ends
+    // repeating, rounded to nearest.
+    void BoxPass(std::vector<int>& line, int radius)
+    {
+        const int n = static_cast<int>(line.size());
+        std::vector<int> out(n);
+        for (int i = 0; i < n; i++)
+        {
+            int sum = 0;
+            for (int k = -radius; k <= radius; k++)
+                sum += line[(std::min)(n - 1, (std::max)(0, i + k))];
+            out[i] = (sum + radius) / (2 * radius + 1);
+        }
+        line.swap(out);
+    }
+
+    // What ApplyRedactions should do to the piece of image at (x, y),
+    // w x h, which sits at that offset in image coordinates.
+    void ReferenceRedact(TestImage& image, int x, int y, int w, int h, const std::vector<RedactRegion>& regions)
+    {
+        for (const RedactRegion& region : regions)
+        {
+            const int left = (std::max)(region.rect.left, x);
+            const int top = (std::max)(region.rect.top, y);
+            const int right = (std::min)(region.rect.right, x + w);
+            const int bottom = (std::min)(region.rect.bottom, y + h);
+            if (left >= right || top >= bottom)
+                continue;
+            const RedactStyle& style = region.style;
+            if (style.mode == RedactMode::Fill)
+            {
+                for (int py = top; py < bottom; py++)
+                    for (int px = left; px < right; px++)
+                        memcpy(image.Pixel(px, py), &style.colour, 4);
+            }
+            else if (style.mode == RedactMode::Pixelate)
+            {
+                // Cells on the region's grid, cut to the part in the piece.
+                const int block = style.size > 0 ? style.size : kDefaultPixelateBlock;
+                for (int cellTop = region.rect.top; cellTop < bottom; cellTop += block)
+                {
+                    for (int cellLeft = region.rect.left; cellLeft < right; cellLeft += block)
+                    {
+                        const int x0 = (std::max)(cellLeft, left), x1 = (std::min)(cellLeft + block, right);
+                        const int y0 = (std::max)(cellTop, top), y1 = (std::min)(cellTop + block, bottom);
+                        if (x0 >= x1 || y0 >= y1)
+                            continue;
+                        const int count = (x1 - x0) * (y1 - y0);
+                        uint8_t mean[4];
+                        for (int c = 0; c < 4; c++)
+                        {
+                            int sum = 0;
+                            for (int py = y0; py < y1; py++)
+                                for (int px = x0; px < x1; px++)
+                                    sum += image.Pixel(px, py)[c];
+                            mean[c] = static_cast<uint8_t>((sum + count / 2) / count);
+                        }
+                        for (int py = y0; py < y1; py++)
+                            for (int px = x0; px < x1; px++)
+                                memcpy(image.Pixel(px, py), mean, 4);
+                    }
+                }
+            }
+            else
+            {
+                // Two passes across, then two down, each channel on its own.
+                const int radius = (std::min)(style.size > 0 ? style.size : kDefaultBlurRadius, kMaxRedactSize);
+                for (int c = 0; c < 4; c++)
+                {
+                    std::vector<int> line;
+                    for (int py = top; py < bottom; py++)
+                    {
+                        line.clear();
+                        for (int px = left; px < right; px++)
+                            line.push_back(image.Pixel(px, py)[c]);
+                        BoxPass(line, radius);
+                        BoxPass(line, radius);
+                        for (int px = left; px < right; px++)
+                            image.Pixel(px, py)[c] = static_cast<uint8_t>(line[px - left]);
+                    }
+                    for (int px = left; px < right; px++)
+                    {
+                        line.clear();
+                        for (int py = top; py < bottom; py++)
+                            line.push_back(image.Pixel(px, py)[c]);
+                        BoxPass(line, radius);
+                        BoxPass(line, radius);
+                        for (int py = top; py < bottom; py++)
+                            image.Pixel(px, py)[c] = static_cast<uint8_t>(line[py - top]);
+                    }
+                }
+            }
+        }
+    }
+
+    // Largest byte difference, padding included.
+    int MaxDifference(const TestImage& a, const TestImage& b)
+    {
+        int worst = 0;
+        for (size_t i = 0; i < a.bytes.size(); i++)
+            worst = (std::max)(worst, std::abs(a.bytes[i] - b.bytes[i]));
+        return worst;
+    }
+
+    // Regions at and across every edge of a width x height frame.
+    std::vector<DesktopRect> EdgeRects(int width, int height)
+    {
+        return {
+            Rect(0, 0, width, height),                  // Exactly the frame.
+            Rect(-40, -30, width + 80, height + 60),    // All of it and more.
+            Rect(-5, 10, 20, 17),                       // Off the left.
+            Rect(width - 13, 3, 40, 21),                // Off the right.
+            Rect(9, -9, 31, 25),                        // Off the top.
+            Rect(20, height - 6, 26, 30),               // Off the bottom.
+            Rect(width - 7, height - 5, 7, 5),          // Into the corner.
+            Rect(-3, -3, 4, 4),                         // One pixel of it in.
+            Rect(0, 0, 1, height),                      // The first column.
+            Rect(0, height - 1, width, 1),              // The last row.
+            Rect(width, 0, 10, 10),                     // Just outside.
+            Rect(-10, height, 10, 10),
+        };
+    }
+}
+
+TEST(RedactFillAndPixelateMatchReferenceAtEdges)
+{
+    const int width = 77, height = 53;
+    const int blocks[] = { 0, 1, 2, 3, 7, 16, 60, 127 };
+    for (const DesktopRect& rect : EdgeRects(width, height))
+    {
+        for (int block : blocks)
+        {
+            for (int threads = 0; threads <= 1; threads++)
+            {
+                TestImage actual(width, height, 3);
+                TestImage expected = actual;
+                std::vector<RedactRegion> regions = { Region(rect, RedactMode::Pixelate, block) };
+                if (block == 0)
+                    regions.push_back(Region(Rect(rect.left + 2, rect.top + 1, 9, 4), RedactMode::Fill, 0));
+                ApplyRedactions(actual.View(), 0, 0, regions, threads);
+                ReferenceRedact(expected, 0, 0, width, height, regions);
+                if (actual.bytes != expected.bytes)
+                {
+                    ReportFailure(__FILE__, __LINE__, "pixelate " + std::to_string(block) + " at " +
+                        std::to_string(rect.left) + "," + std::to_string(rect.top) + " " +
+                        std::to_string(rect.Width()) + "x" + std::to_string(rect.Height()));
+                }
+            }
+        }
+    }
+}
+
+TEST(RedactBlurMatchesReferenceAtEdges)
+{
+    // The blur divides by a rounded-up reciprocal: at most one off a true
+    // rounded mean per pass, four passes.
+    const int width = 77, height = 53;
+    const int radii[] = { 0, 1, 2, 5, 16, 40, 127 };
+    for (const DesktopRect& rect : EdgeRects(width, height))
+    {
+        for (int radius : radii)
+        {
+            TestImage actual(width, height, 5);
+            TestImage expected = actual;
+            const std::vector<RedactRegion> regions = { Region(rect, RedactMode::Blur, radius) };
+            ApplyRedactions(actual.View(), 0, 0, regions, 1);
+            ReferenceRedact(expected, 0, 0, width, height, regions);
+            const int difference = MaxDifference(actual, expected);
+            if (difference > 4)
+            {
+                ReportFailure(__FILE__, __LINE__, "blur " + std::to_string(radius) + " at " +
+                    std::to_string(rect.left) + "," + std::to_string(rect.top) + " is " +
+                    std::to_string(difference) + " off");
+            }
+        }
+    }
+
+    // A flat colour stays exactly that, right up to the edges.
+    TestImage flat(width, height, 6);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+            memcpy(flat.Pixel(x, y), "\x12\x80\xFE\xFF", 4);
+    TestImage blurred = flat;
+    ApplyRedactions(blurred.View(), 0, 0, { Region(Rect(-8, 5, width + 8, height), RedactMode::Blur, 9) }, 1);
+    CHECK(blurred.bytes == flat.bytes);
+
+    // The pool splits large areas into row tasks and column strips; the
+    // result does not depend on it.
+    TestImage large(600, 300, 7);
+    TestImage single = large;
+    const std::vector<RedactRegion> regions = { Region(Rect(-20, 3, 555, 400), RedactMode::Blur, 12) };
+    ApplyRedactions(large.View(), 0, 0, regions, 0);
+    ApplyRedactions(single.View(), 0, 0, regions, 1);
+    CHECK(large.bytes == single.bytes);
+}
+
+TEST(RedactBandsUseTheirOrigin)
+{
+    // One image redacted band by band and monitor by monitor, each piece
+    // passing its offset: every piece gets what the region covers of it.
+    const int width = 120, height = 90;
+    const std::vector<RedactRegion> regions = {
+        Region(Rect(5, 5, 50, 70), RedactMode::Pixelate, 8),
+        Region(Rect(-10, 30, 60, 20), RedactMode::Fill, 0, 0xFFFFFFFF),
+        Region(Rect(70, -4, 60, 61), RedactMode::Blur, 3),
+        Region(Rect(40, 60, 70, 40), RedactMode::Pixelate, 0),
+    };
+    const int bandHeights[] = { 1, 7, 16, 33, height };
+    for (int bandHeight : bandHeights)
+    {
+        TestImage actual(width, height, 11);
+        TestImage expected = actual;
+        for (int top = 0; top < height; top += bandHeight)
+        {
+            const int rows = (std::min)(bandHeight, height - top);
+            ApplyRedactions(actual.Piece(0, top, width, rows), 0, top, regions, 1);
+            ReferenceRedact(expected, 0, top, width, rows, regions);
+        }
+        if (MaxDifference(actual, expected) > 4)
+            ReportFailure(__FILE__, __LINE__, "bands of " + std::to_string(bandHeight) + " rows");
+    }
+
+    // Two monitors side by side, and a band of the right-hand one.
+    TestImage actual(width, height, 12);
+    TestImage expected = actual;
+    ApplyRedactions(actual.Piece(0, 0, 47, height), 0, 0, regions, 1);
+    ReferenceRedact(expected, 0, 0, 47, height, regions);
+    ApplyRedactions(actual.Piece(47, 0, width - 47, 40), 47, 0, regions, 1);
+    ReferenceRedact(expected, 47, 0, width - 47, 40, regions);
+    ApplyRedactions(actual.Piece(47, 40, width - 47, height - 40), 47, 40, regions, 1);
+    ReferenceRedact(expected, 47, 40, width - 47, height - 40, regions);
+    CHECK(MaxDifference(actual, expected) <= 4);
+
+    // Where the pieces cut along cell lines, fill and pixelate come out
+    // exactly as for the whole image: the grid follows the region, not the
+    // piece.
+    const std::vector<RedactRegion> cells = {
+        Region(Rect(5, 5, 50, 70), RedactMode::Pixelate, 8),
+        Region(Rect(-10, 30, 60, 20), RedactMode::Fill, 0),
+    };
+    TestImage whole(width, height, 13);
+    TestImage banded = whole;
+    ApplyRedactions(whole.View(), 0, 0, cells, 1);
+    const int cuts[] = { 0, 13, 21, 45, 61, height };
+    for (int i = 0; i + 1 < 6; i++)
+        ApplyRedactions(banded.Piece(0, cuts[i], width, cuts[i + 1] - cuts[i]), 0, cuts[i], cells, 1);
+    CHECK(banded.bytes == whole.bytes);
+}
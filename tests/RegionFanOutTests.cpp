@@ -0,0 +1,198 @@
+#include "TestHarness.h"
+
+#include "RegionFanOut.h"
+
+#include <atomic>
+#include <climits>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace
+{
+    DesktopRect Rect(int left, int top, int right, int bottom)
+    {
+        DesktopRect rect;
+        rect.left = left;
+        rect.top = top;
+        rect.right = right;
+        rect.bottom = bottom;
+        return rect;
+    }
+
+    bool SameRect(const DesktopRect& a, const DesktopRect& b)
+    {
+        return a.left == b.left && a.top == b.top && a.right == b.right && a.bottom == b.bottom;
+    }
+
+    RegionSpec Region(int left, int top, int right, int bottom)
+    {
+        RegionSpec region;
+        region.rect = Rect(left, top, right, bottom);
+        return region;
+    }
+}
+
+TEST(RegionParsesXYWH)
+{
+    DesktopRect rect;
+    REQUIRE(ParseRegion("10,20,300,200", rect));
+    CHECK(SameRect(rect, Rect(10, 20, 310, 220)));
+    REQUIRE(ParseRegion(" -1920 , -8,1920, 1080 ", rect));
+    CHECK(SameRect(rect, Rect(-1920, -8, 0, 1072)));
+    REQUIRE(ParseRegion("2147483000,0,647,10", rect));
+    CHECK_EQ(rect.right, INT_MAX);
+
+    // Sizes must be positive and the far edges must be ints.
+    const char* bad[] = { "", "1,2,3", "1,2,3,4,5", "1,2,3,4x", "1;2;3;4", "a,2,3,4", "1,2,0,4", "1,2,3,-4",
+        "2147483000,0,1000,10", "0,2147483647,1,1", "-2147483648,0,1,1x", "99999999999,0,1,1" };
+    for (const char* text : bad)
+    {
+        DesktopRect untouched = Rect(1, 2, 3, 4);
+        if (ParseRegion(text, untouched))
+            ReportFailure(__FILE__, __LINE__, std::string("accepted \"") + text + "\"");
+        CHECK(SameRect(untouched, Rect(1, 2, 3, 4)));
+    }
+    REQUIRE(ParseRegion("-2147483648,0,1,1", rect));
+    CHECK_EQ(rect.left, INT_MIN);
+}
+
+TEST(RegionManifestNamesAndErrors)
+{
+    const std::string manifest =
+        "# Toolbar and status bar\n"
+        "\n"
+        "0,0,1920,40\ttoolbar.png\n"
+        "   \r\n"
+        "  100,200,30,40  \r\n"
+        "0,1040,1920,40 status bar.jpg \n"
+        "   # Indented comment\n"
+        "-1920,0,1920,1080 left.qoi";
+    std::vector<RegionSpec> regions;
+    std::string error;
+    REQUIRE(ParseRegionManifest(manifest, regions, error));
+    REQUIRE(regions.size() == 4);
+    CHECK(SameRect(regions[0].rect, Rect(0, 0, 1920, 40)));
+    CHECK_EQ(regions[0].fileName, std::string("toolbar.png"));
+    CHECK(SameRect(regions[1].rect, Rect(100, 200, 130, 240)));
+    CHECK(regions[1].fileName.empty());
+    // The name runs to the end of the line, spaces and all; its extension
+    // picks the region's format.
+    CHECK_EQ(regions[2].fileName, std::string("status bar.jpg"));
+    CHECK(SameRect(regions[3].rect, Rect(-1920, 0, 0, 1080)));
+    CHECK_EQ(regions[3].fileName, std::string("left.qoi"));
+
+    // The first bad line is named, counting blank and comment lines.
+    struct { const char* text; const char* error; } cases[] =
+    {
+        { "0,0,10,10\n# fine\n0,0,10\n", "line 3: expected x,y,w,h" },
+        { "0,0,10,10 a.png\n\n0,0,0,10 b.png\n", "line 3: expected x,y,w,h" },
+        { "a.png 0,0,10,10\n", "line 1: expected x,y,w,h" },
+        { "0,0,10,10,a.png\n", "line 1: expected x,y,w,h" },
+        { "0,0,10,10\n2147483000,0,1000,10\n", "line 2: expected x,y,w,h" },
+        { "", "no regions" },
+        { "# only comments\n\n  \n", "no regions" },
+    };
+    for (const auto& test : cases)
+    {
+        regions.clear();
+        error.clear();
+        CHECK(!ParseRegionManifest(test.text, regions, error));
+        CHECK_EQ(error, std::string(test.error));
+    }
+}
+
+TEST(RegionViewsPointIntoTheGrab)
+{
+    // A grab of bounds (-100,-50)-(200,150) with padded rows.
+    const DesktopRect bounds = Rect(-100, -50, 200, 150);
+    Frame grab;
+    grab.Allocate(bounds.Width(), bounds.Height(), FrameFormat::Bgrx32);
+    const FrameView view = grab.View();
+
+    // Inside: the same pixels and stride, nothing copied.
+    FrameView crop = RegionView(view, bounds, Rect(-90, -40, -70, -10));
+    CHECK(crop.data == view.Row(10) + 10 * 4);
+    CHECK_EQ(crop.width, 20);
+    CHECK_EQ(crop.height, 30);
+    CHECK_EQ(crop.stride, view.stride);
+    CHECK(crop.format == view.format);
+    crop = RegionView(view, bounds, bounds);
+    CHECK(crop.data == view.data);
+    CHECK_EQ(crop.width, bounds.Width());
+    CHECK_EQ(crop.height, bounds.Height());
+
+    // Hanging over an edge: clipped to the grab.
+    crop = RegionView(view, bounds, Rect(-150, 100, -60, 400));
+    CHECK(crop.data == view.Row(150));
+    CHECK_EQ(crop.width, 40);
+    CHECK_EQ(crop.height, 50);
+    crop = RegionView(view, bounds, Rect(190, -60, 260, -40));
+    CHECK(crop.data == view.Row(0) + 290 * 4);
+    CHECK_EQ(crop.width, 10);
+    CHECK_EQ(crop.height, 10);
+
+    // Outside, or only touching an edge: empty.
+    CHECK(RegionView(view, bounds, Rect(200, 0, 300, 10)).Empty());
+    CHECK(RegionView(view, bounds, Rect(0, -80, 10, -50)).Empty());
+    CHECK(RegionView(view, bounds, Rect(-500, -500, -400, -400)).Empty());
+}
+
+TEST(RegionFanOutCallsEveryRegionOnce)
+{
+    const DesktopRect bounds = Rect(0, 0, 640, 480);
+    Frame grab;
+    grab.Allocate(bounds.Width(), bounds.Height(), FrameFormat::Bgrx32);
+
+    // Every fifth region fails its encode, and two lie outside the grab.
+    std::vector<RegionSpec> regions;
+    for (int i = 0; i < 37; i++)
+        regions.push_back(Region(i * 16, i * 12, i * 16 + 24, i * 12 + 20));
+    regions.push_back(Region(700, 0, 720, 20));
+    regions.push_back(Region(0, -30, 20, 0));
+    const int count = static_cast<int>(regions.size());
+
+    for (int threads = 0; threads <= 4; threads++)
+    {
+        std::vector<std::atomic<int>> calls(count);
+        for (std::atomic<int>& c : calls)
+            c = 0;
+        std::mutex lock;
+        std::vector<FrameView> crops(count);
+        const int failed = FanOutRegions(grab.View(), bounds, regions,
+            [&](int index, const FrameView& crop) -> bool
+            {
+                calls[index]++;
+                std::lock_guard<std::mutex> hold(lock);
+                crops[index] = crop;
+                return index % 5 != 0;
+            }, threads);
+
+        // 0, 5, ..., 35 fail; so do the two outside, without a call.
+        CHECK_EQ(failed, 8 + 2);
+        for (int i = 0; i < count; i++)
+        {
+            const int expected = i < 37 ? 1 : 0;
+            if (calls[i].load() != expected)
+            {
+                ReportFailure(__FILE__, __LINE__, "region " + std::to_string(i) + " called " +
+                    std::to_string(calls[i].load()) + " times with " + std::to_string(threads) + " threads");
+                continue;
+            }
+            if (expected == 0)
+                continue;
+            const FrameView want = RegionView(grab.View(), bounds, regions[i].rect);
+            CHECK(crops[i].data == want.data && crops[i].width == want.width && crops[i].height == want.height);
+        }
+    }
+
+    // One region runs on the caller.
+    int calls = 0;
+    CHECK_EQ(FanOutRegions(grab.View(), bounds, std::vector<RegionSpec>(1, Region(1, 1, 9, 9)),
+        [&](int index, const FrameView& crop) -> bool
+        {
+            calls++;
+            return index == 0 && crop.width == 8;
+        }), 0);
+    CHECK_EQ(calls, 1);
+}
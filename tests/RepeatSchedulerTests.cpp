@@ -0,0 +1,214 @@
+#include "TestHarness.h"
+
+#include "CapturePipeline.h"
+#include "ChangeDetector.h"
+#include "FakeClock.h"
+#include "RepeatScheduler.h"
+
+#include <cmath>
+#include <vector>
+
+namespace
+{
+    bool Near(double actual, double expected)
+    {
+        return std::fabs(actual - expected) < 1e-6;
+    }
+
+    // Run frames with the given work (milliseconds) after each one, on a
+    // 100 ms grid.
+    std::vector<FrameTiming> RunSchedule(OverrunPolicy policy, const std::vector<double>& workMs,
+        ScheduleSummary& summary)
+    {
+        FakeScheduleClock clock;
+        RepeatScheduler scheduler(0.1, policy, clock);
+        std::vector<FrameTiming> timings;
+        for (double work : workMs)
+        {
+            timings.push_back(scheduler.Next());
+            clock.AdvanceMs(work);
+        }
+        summary = scheduler.Summary();
+        return timings;
+    }
+
+    bool TimingIs(const FrameTiming& timing, int64_t slot, double scheduledMs, double grabMs, int skipped)
+    {
+        return timing.slot == slot && Near(timing.scheduledMs, scheduledMs) && Near(timing.grabMs, grabMs) &&
+            timing.slotsSkipped == skipped;
+    }
+
+    // The same still frame every poll, for a given number of polls.
+    class StillFrameSource : public FrameSource
+    {
+    public:
+        explicit StillFrameSource(int polls) : polls_(polls) {}
+
+        bool GrabFrame(Frame& frame) override
+        {
+            if (polls_-- <= 0)
+                return false;
+            frame.Allocate(64, 64, FrameFormat::Bgrx32);
+            for (int y = 0; y < 64; y++)
+                std::fill(frame.Data() + y * frame.Stride(), frame.Data() + y * frame.Stride() + 64 * 4, 0x40);
+            return true;
+        }
+
+    private:
+        int polls_;
+    };
+}
+
+// A 250 ms frame on a 100 ms grid, between short ones.
+static const std::vector<double> kOverrun = { 10, 250, 10, 10, 10 };
+
+TEST(RepeatSchedulerCatchUpBunchesMissedSlots)
+{
+    ScheduleSummary summary;
+    std::vector<FrameTiming> t = RunSchedule(OverrunPolicy::CatchUp, kOverrun, summary);
+    REQUIRE(t.size() == 5);
+    CHECK(TimingIs(t[0], 0, 0, 0, 0));
+    CHECK(TimingIs(t[1], 1, 100, 100, 0));
+    CHECK(TimingIs(t[2], 2, 200, 350, 0));     // Back to back after the long frame...
+    CHECK(TimingIs(t[3], 3, 300, 360, 0));
+    CHECK(TimingIs(t[4], 4, 400, 400, 0));     // ...until on time again.
+    CHECK_EQ(summary.frames, 5);
+    CHECK_EQ(summary.slotsSkipped, static_cast<int64_t>(0));
+    CHECK(Near(summary.meanLatenessMs, (150.0 + 60.0) / 5));
+    CHECK(Near(summary.maxLatenessMs, 150));
+    CHECK(Near(summary.driftMs, 0));
+}
+
+TEST(RepeatSchedulerSkipDropsPassedSlots)
+{
+    ScheduleSummary summary;
+    std::vector<FrameTiming> t = RunSchedule(OverrunPolicy::Skip, { 10, 250, 10, 10 }, summary);
+    REQUIRE(t.size() == 4);
+    CHECK(TimingIs(t[1], 1, 100, 100, 0));
+    CHECK(TimingIs(t[2], 3, 300, 350, 1));     // Slot 2 is gone; slot 3 is still running.
+    CHECK(TimingIs(t[3], 4, 400, 400, 0));
+    CHECK_EQ(summary.frames, 4);
+    CHECK_EQ(summary.slotsSkipped, static_cast<int64_t>(1));
+    CHECK(Near(summary.meanLatenessMs, 50.0 / 4));
+    CHECK(Near(summary.maxLatenessMs, 50));
+    // Four frames, but the last one is on slot 4 and on time: no drift.
+    CHECK(Near(summary.driftMs, 0));
+}
+
+TEST(RepeatSchedulerSkipCountsSeveralSlots)
+{
+    ScheduleSummary summary;
+    std::vector<FrameTiming> t = RunSchedule(OverrunPolicy::Skip, { 10, 480, 30 }, summary);
+    REQUIRE(t.size() == 3);
+    CHECK(TimingIs(t[2], 5, 500, 580, 3));     // Due at 200; 300 and 400 have passed as well.
+    CHECK_EQ(summary.slotsSkipped, static_cast<int64_t>(3));
+    CHECK(Near(summary.driftMs, 80));
+}
+
+TEST(RepeatSchedulerStretchShiftsTheGrid)
+{
+    ScheduleSummary summary;
+    std::vector<FrameTiming> t = RunSchedule(OverrunPolicy::Stretch, kOverrun, summary);
+    REQUIRE(t.size() == 5);
+    CHECK(TimingIs(t[1], 1, 100, 100, 0));
+    CHECK(TimingIs(t[2], 2, 200, 350, 0));     // Late against the slot it was meant for...
+    CHECK(TimingIs(t[3], 3, 450, 450, 0));     // ...and the grid restarts from it.
+    CHECK(TimingIs(t[4], 4, 550, 550, 0));
+    CHECK_EQ(summary.slotsSkipped, static_cast<int64_t>(0));
+    CHECK(Near(summary.meanLatenessMs, 150.0 / 5));
+    CHECK(Near(summary.maxLatenessMs, 150));
+    CHECK(Near(summary.driftMs, 150));
+}
+
+TEST(RepeatSchedulerZeroIntervalRunsBackToBack)
+{
+    FakeScheduleClock clock;
+    RepeatScheduler scheduler(0.0, OverrunPolicy::Skip, clock);
+    scheduler.Next();
+    clock.AdvanceMs(7);
+    FrameTiming timing = scheduler.Next();
+    CHECK(TimingIs(timing, 1, 0, 7, 0));
+    CHECK(Near(scheduler.Summary().driftMs, 7));
+}
+
+TEST(RepeatSchedulerTimingRows)
+{
+    FrameTiming timing;
+    timing.index = 3;
+    timing.slot = 5;
+    timing.scheduledMs = 500;
+    timing.grabMs = 512.25;
+    timing.slotsSkipped = 2;
+    CHECK(FormatTimingRow(TimingLogFormat::Csv, timing, 1700000000123LL, false) ==
+        "3,5,500.000,512.250,12.250,2,1700000000123\n");
+    ScheduleSummary summary;
+    summary.frames = 3;
+    summary.driftMs = 12.25;
+    CHECK(FormatTimingFooter(TimingLogFormat::Json, summary).find("\"drift_ms\": 12.250") != std::string::npos);
+    CHECK(FormatTimingFooter(TimingLogFormat::Csv, summary).empty());
+}
+
+//---------------------------------------------------------------------
+TEST(CapturePipelineTimesGrabsOnTheScheduleClock)
+{
+    FakeScheduleClock clock;
+    PipelineOptions options;
+    options.frameCount = 6;
+    options.interval = 0.1;
+    options.overrun = OverrunPolicy::Skip;
+    options.clock = &clock;
+    options.encoderThreads = 2;
+    std::vector<FrameTiming> timings(options.frameCount + 1);
+    PipelineStats stats = RunCapturePipeline(options,
+        [&](PipelineFrame& frame) -> bool
+        {
+            frame.image.Allocate(8, 8, FrameFormat::Bgrx32);
+            clock.AdvanceMs(frame.index == 2 ? 230 : 20);
+            return true;
+        },
+        [](PipelineFrame& frame) -> bool
+        {
+            frame.encoded.assign(1, static_cast<uint8_t>(frame.index));
+            return true;
+        },
+        [&](PipelineFrame& frame)
+        {
+            timings[frame.index] = frame.timing;
+        });
+
+    CHECK_EQ(stats.framesWritten, 6);
+    CHECK_EQ(stats.schedule.slotsSkipped, static_cast<int64_t>(1));
+    // The fake clock stands still while a frame waits for a pool slot, so
+    // every grab starts exactly when the scheduler released it.
+    CHECK(TimingIs(timings[1], 0, 0, 0, 0));
+    CHECK(TimingIs(timings[2], 1, 100, 100, 0));
+    CHECK(TimingIs(timings[3], 3, 300, 330, 1));
+    CHECK(TimingIs(timings[4], 4, 400, 400, 0));
+    CHECK(TimingIs(timings[6], 6, 600, 600, 0));
+    CHECK(Near(stats.schedule.driftMs, 0));
+}
+
+TEST(ChangeCaptureMaxGapFollowsTheScheduleClock)
+{
+    FakeScheduleClock clock;
+    StillFrameSource source(20);
+    ChangeCaptureOptions options;
+    options.pollInterval = 1.0;
+    options.maxGap = 2.5;
+    options.frameCount = 3;
+    options.clock = &clock;
+    std::vector<int64_t> slots;
+    int accepted = RunChangeCapture(source, options,
+        [&](Frame&, int, double, const FrameTiming& timing) -> bool
+        {
+            slots.push_back(timing.slot);
+            return true;
+        });
+    // Nothing changes, so frames after the first come from the gap alone:
+    // the first poll at least 2.5 s after the last accepted frame.
+    CHECK_EQ(accepted, 3);
+    REQUIRE(slots.size() == 3);
+    CHECK_EQ(slots[0], static_cast<int64_t>(0));
+    CHECK_EQ(slots[1], static_cast<int64_t>(3));
+    CHECK_EQ(slots[2], static_cast<int64_t>(6));
+}
@@ -0,0 +1,361 @@
+#include "TestHarness.h"
+
+#include "Resampler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Resample is checked against a plain double-precision definition of
+// each filter: every output pixel a normalised weighted sum over the
+// whole input axis, in linear light, rounded once at the end. The float
+// passes and 8-bit tables may differ from it by 1 in any channel.
+
+namespace
+{
+    const int kTolerance = 1;
+    const double kPi = 3.14159265358979323846;
+
+    double Kernel(ResampleFilter filter, double x)
+    {
+        switch (filter)
+        {
+        case ResampleFilter::Box:
+            return x >= -0.5 && x < 0.5 ? 1.0 : 0.0;
+        case ResampleFilter::Bilinear:
+            return std::fabs(x) < 1.0 ? 1.0 - std::fabs(x) : 0.0;
+        default:
+        {
+            if (x <= -3.0 || x >= 3.0)
+                return 0.0;
+            if (x == 0.0)
+                return 1.0;
+            const double a = kPi * x, b = kPi * x / 3.0;
+            return std::sin(a) / a * std::sin(b) / b;
+        }
+        }
+    }
+
+    // weights[i][x]: how much input x counts towards output i.
+    std::vector<std::vector<double>> AxisWeights(ResampleFilter filter, int srcSize, int dstSize)
+    {
+        const double scale = static_cast<double>(srcSize) / dstSize;
+        const double spread = (std::max)(scale, 1.0);
+        std::vector<std::vector<double>> weights(dstSize, std::vector<double>(srcSize, 0.0));
+        for (int i = 0; i < dstSize; i++)
+        {
+            const double center = (i + 0.5) * scale;
+            double total = 0.0;
+            for (int x = 0; x < srcSize; x++)
+                total += weights[i][x] = Kernel(filter, (x + 0.5 - center) / spread);
+            for (int x = 0; x < srcSize; x++)
+                weights[i][x] /= total;
+        }
+        return weights;
+    }
+
+    double ToLinear(int value, bool srgb)
+    {
+        const double v = value / 255.0;
+        return !srgb ? v : v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4);
+    }
+
+    double FromLinear(double v, bool srgb)
+    {
+        v = (std::min)((std::max)(v, 0.0), 1.0);
+        return 255.0 * (!srgb ? v : v <= 0.0031308 ? v * 12.92 : 1.055 * std::pow(v, 1.0 / 2.4) - 0.055);
+    }
+
+    // Top-down BGRA, width * 4 bytes a row.
+    std::vector<uint8_t> Reference(const std::vector<uint8_t>& src, int srcWidth, int srcHeight,
+        int dstWidth, int dstHeight, ResampleFilter filterX, ResampleFilter filterY, bool linearLight)
+    {
+        const std::vector<std::vector<double>> across = AxisWeights(filterX, srcWidth, dstWidth);
+        const std::vector<std::vector<double>> down = AxisWeights(filterY, srcHeight, dstHeight);
+        std::vector<double> rows(static_cast<size_t>(srcHeight) * dstWidth * 4, 0.0);
+        for (int y = 0; y < srcHeight; y++)
+        {
+            for (int i = 0; i < dstWidth; i++)
+            {
+                for (int x = 0; x < srcWidth; x++)
+                {
+                    const double w = across[i][x];
+                    if (w == 0.0)
+                        continue;
+                    for (int c = 0; c < 4; c++)
+                    {
+                        const int value = src[(static_cast<size_t>(y) * srcWidth + x) * 4 + c];
+                        rows[(static_cast<size_t>(y) * dstWidth + i) * 4 + c] += w * ToLinear(value, linearLight && c < 3);
+                    }
+                }
+            }
+        }
+        std::vector<uint8_t> dst(static_cast<size_t>(dstWidth) * dstHeight * 4);
+        for (int j = 0; j < dstHeight; j++)
+        {
+            for (int i = 0; i < dstWidth * 4; i++)
+            {
+                double sum = 0.0;
+                for (int y = 0; y < srcHeight; y++)
+                    sum += down[j][y] * rows[static_cast<size_t>(y) * dstWidth * 4 + i];
+                dst[static_cast<size_t>(j) * dstWidth * 4 + i] =
+                    static_cast<uint8_t>(std::lround(FromLinear(sum, linearLight && i % 4 < 3)));
+            }
+        }
+        return dst;
+    }
+
+    // Desktop-like content: flat panels, hard edges, thin lines, gradients
+    // and noise, with alpha that varies too.
+    std::vector<uint8_t> TestPixels(int width, int height, uint32_t seed)
+    {
+        TestRng rng(seed);
+        std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                uint8_t* p = &pixels[(static_cast<size_t>(y) * width + x) * 4];
+                const int area = (x / 13 + y / 11) % 4;
+                for (int c = 0; c < 3; c++)
+                {
+                    p[c] = static_cast<uint8_t>(area == 0 ? (x % 7 == 0 ? 255 : 16) : area == 1 ? x * 5 + c * 40 :
+                        area == 2 ? rng.Next() : y * 3 + c * 60);
+                }
+                p[3] = static_cast<uint8_t>(area == 3 ? rng.Next() : 255 - x);
+            }
+        }
+        return pixels;
+    }
+
+    // Resample into a destination with padded rows, and return it packed.
+    // The padding must come back untouched.
+    bool Run(Resampler& resampler, const std::vector<uint8_t>& src, int srcWidth, int srcHeight,
+        int dstWidth, int dstHeight, const ResampleOptions& options, std::vector<uint8_t>& out)
+    {
+        FrameView in;
+        in.data = const_cast<uint8_t*>(src.data());
+        in.width = srcWidth;
+        in.height = srcHeight;
+        in.stride = static_cast<ptrdiff_t>(srcWidth) * 4;
+        in.format = FrameFormat::Bgra32;
+        const ptrdiff_t stride = static_cast<ptrdiff_t>(dstWidth) * 4 + 16;
+        std::vector<uint8_t> padded(static_cast<size_t>(stride) * dstHeight, 0xA5);
+        FrameView dst = in;
+        dst.data = padded.data();
+        dst.width = dstWidth;
+        dst.height = dstHeight;
+        dst.stride = stride;
+        if (!resampler.Resample(in, dst, options))
+            return false;
+        out.clear();
+        for (int y = 0; y < dstHeight; y++)
+        {
+            const uint8_t* row = padded.data() + y * stride;
+            out.insert(out.end(), row, row + dstWidth * 4);
+            for (int i = dstWidth * 4; i < stride; i++)
+            {
+                if (row[i] != 0xA5)
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    // Largest channel difference, and where.
+    int LargestDifference(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, size_t& at)
+    {
+        int largest = 0;
+        for (size_t i = 0; i < a.size(); i++)
+        {
+            const int diff = std::abs(a[i] - b[i]);
+            if (diff > largest)
+            {
+                largest = diff;
+                at = i;
+            }
+        }
+        return largest;
+    }
+}
+
+TEST(ResampleChoosesFilterPerAxis)
+{
+    CHECK(ChooseResampleFilter(96, 24) == ResampleFilter::Box);
+    CHECK(ChooseResampleFilter(96, 48) == ResampleFilter::Box);
+    CHECK(ChooseResampleFilter(90, 60) == ResampleFilter::Lanczos3);
+    CHECK(ChooseResampleFilter(40, 100) == ResampleFilter::Bilinear);
+    CHECK(ChooseResampleFilter(40, 40) == ResampleFilter::Box);
+}
+
+TEST(ResampleMatchesReference)
+{
+    // Whole-factor, 2/3 and enlarging, each axis separately too, across
+    // several bands of output rows.
+    struct
+    {
+        int srcWidth, srcHeight, dstWidth, dstHeight;
+        ResampleFilter filterX, filterY;
+    } cases[] =
+    {
+        { 96, 160, 24, 40, ResampleFilter::Box, ResampleFilter::Box },
+        { 90, 150, 45, 75, ResampleFilter::Box, ResampleFilter::Box },
+        { 90, 99, 60, 66, ResampleFilter::Lanczos3, ResampleFilter::Lanczos3 },
+        { 40, 30, 100, 75, ResampleFilter::Bilinear, ResampleFilter::Bilinear },
+        { 33, 17, 34, 70, ResampleFilter::Bilinear, ResampleFilter::Bilinear },
+        { 90, 99, 45, 66, ResampleFilter::Box, ResampleFilter::Lanczos3 },
+        { 60, 90, 150, 30, ResampleFilter::Bilinear, ResampleFilter::Box },
+    };
+    uint32_t seed = 1;
+    for (const auto& test : cases)
+    {
+        const std::vector<uint8_t> src = TestPixels(test.srcWidth, test.srcHeight, seed++);
+        CHECK(ChooseResampleFilter(test.srcWidth, test.dstWidth) == test.filterX);
+        CHECK(ChooseResampleFilter(test.srcHeight, test.dstHeight) == test.filterY);
+        for (int linear = 0; linear < 2; linear++)
+        {
+            const std::vector<uint8_t> expected = Reference(src, test.srcWidth, test.srcHeight, test.dstWidth,
+                test.dstHeight, test.filterX, test.filterY, linear == 1);
+            // Auto, and each filter named outright where both axes use it.
+            for (int named = 0; named < (test.filterX == test.filterY ? 2 : 1); named++)
+            {
+                Resampler resampler;
+                ResampleOptions options;
+                options.linearLight = linear == 1;
+                options.filter = named ? test.filterX : ResampleFilter::Auto;
+                std::vector<uint8_t> out;
+                const std::string what = std::to_string(test.srcWidth) + "x" + std::to_string(test.srcHeight) +
+                    " to " + std::to_string(test.dstWidth) + "x" + std::to_string(test.dstHeight) +
+                    (linear ? ", linear" : ", sRGB values") + (named ? ", named filter" : ", auto");
+                if (!Run(resampler, src, test.srcWidth, test.srcHeight, test.dstWidth, test.dstHeight, options, out))
+                {
+                    ReportFailure(__FILE__, __LINE__, what + ": failed or wrote past its rows");
+                    continue;
+                }
+                size_t at = 0;
+                const int largest = LargestDifference(out, expected, at);
+                if (largest > kTolerance)
+                {
+                    const int x = static_cast<int>(at / 4 % test.dstWidth);
+                    const int y = static_cast<int>(at / 4 / test.dstWidth);
+                    ReportFailure(__FILE__, __LINE__, what + ": off by " + std::to_string(largest) + " at " +
+                        std::to_string(x) + "," + std::to_string(y) + " channel " + std::to_string(at % 4));
+                }
+            }
+        }
+    }
+
+    // Shrunk four times over, a one-pixel white line on black keeps a
+    // quarter of its light; averaging the sRGB values would give 64.
+    std::vector<uint8_t> line(static_cast<size_t>(8) * 8 * 4, 0);
+    for (int y = 0; y < 8; y++)
+        memset(&line[(static_cast<size_t>(y) * 8 + 3) * 4], 255, 4);
+    Resampler resampler;
+    std::vector<uint8_t> out;
+    REQUIRE(Run(resampler, line, 8, 8, 2, 2, ResampleOptions(), out));
+    CHECK_EQ(out[0], static_cast<uint8_t>(std::lround(FromLinear(0.25, true))));
+    CHECK_EQ(out[4 * 1], 0);
+}
+
+TEST(ResampleIsTheSameThreadedAndAtEveryLevel)
+{
+    // The bands over the pool and one band after another give the same
+    // bytes, for a frame much taller than a band.
+    const int sizes[][4] = { { 300, 400, 200, 267 }, { 320, 240, 160, 120 }, { 64, 48, 200, 150 } };
+    for (const auto& size : sizes)
+    {
+        const std::vector<uint8_t> src = TestPixels(size[0], size[1], 40);
+        Resampler pooled, single;
+        ResampleOptions options;
+        std::vector<uint8_t> a, b;
+        REQUIRE(Run(pooled, src, size[0], size[1], size[2], size[3], options, a));
+        options.threads = 1;
+        REQUIRE(Run(single, src, size[0], size[1], size[2], size[3], options, b));
+        if (a != b)
+        {
+            ReportFailure(__FILE__, __LINE__, std::to_string(size[0]) + "x" + std::to_string(size[1]) + " to " +
+                std::to_string(size[2]) + "x" + std::to_string(size[3]) + " differs with threads");
+        }
+        // A second frame of the same size reuses the taps.
+        REQUIRE(Run(single, src, size[0], size[1], size[2], size[3], options, a));
+        CHECK(a == b);
+    }
+
+    // Every vertical pass this CPU has against the scalar one, bit for
+    // bit, over tap counts and row lengths around each vector width.
+    const ResampleVerticalFunction scalar = ResampleVerticalKernelFor(ResampleKernelLevel::Scalar);
+    REQUIRE(scalar);
+    const ResampleKernelLevel levels[] = { ResampleKernelLevel::Sse2, ResampleKernelLevel::Avx2 };
+    TestRng rng(41);
+    std::vector<std::vector<float>> rows(13, std::vector<float>(80));
+    for (std::vector<float>& row : rows)
+        for (float& v : row)
+            v = static_cast<float>(rng.Next() % 100000) / 70000.0f - 0.2f;
+    std::vector<const float*> taps;
+    for (const std::vector<float>& row : rows)
+        taps.push_back(row.data());
+    std::vector<float> weights(13);
+    for (float& w : weights)
+        w = static_cast<float>(rng.Next() % 2000) / 1000.0f - 0.7f;
+    for (ResampleKernelLevel level : levels)
+    {
+        const ResampleVerticalFunction kernel = ResampleVerticalKernelFor(level);
+        if (!kernel)
+            continue;
+        for (int tapCount = 1; tapCount <= 13; tapCount++)
+        {
+            for (int count = 0; count <= 79; count++)
+            {
+                // Rows start one float in, so no load is aligned.
+                std::vector<const float*> shifted(taps);
+                for (const float*& row : shifted)
+                    row++;
+                std::vector<float> expected(count + 1, -1.0f), actual(count + 1, -1.0f);
+                scalar(shifted.data(), weights.data(), tapCount, expected.data(), count);
+                kernel(shifted.data(), weights.data(), tapCount, actual.data(), count);
+                if (memcmp(expected.data(), actual.data(), expected.size() * sizeof(float)) != 0)
+                {
+                    ReportFailure(__FILE__, __LINE__, "level " + std::to_string(static_cast<int>(level)) + ", " +
+                        std::to_string(tapCount) + " taps, " + std::to_string(count) + " floats");
+                }
+            }
+        }
+    }
+}
+
+TEST(ResampleScaleSpecs)
+{
+    ScaleSpec spec;
+    int width = 0, height = 0;
+    REQUIRE(ParseScaleSpec("0.5", spec));
+    CHECK(ScaledSize(spec, 1920, 1080, width, height));
+    CHECK_EQ(width, 960);
+    CHECK_EQ(height, 540);
+    REQUIRE(ParseScaleSpec("1280x0", spec));
+    CHECK(ScaledSize(spec, 1920, 1080, width, height));
+    CHECK_EQ(height, 720);
+    REQUIRE(ParseScaleSpec("0X100", spec));
+    CHECK(ScaledSize(spec, 300, 200, width, height));
+    CHECK_EQ(width, 150);
+    REQUIRE(ParseScaleSpec("0.0001", spec));
+    CHECK(!ScaledSize(spec, 1920, 1080, width, height));
+    const char* bad[] = { "", "0", "-1", "17", "x", "0x0", "10x", "x10", "10x10x", "70000x10", "1e" };
+    for (const char* text : bad)
+    {
+        if (ParseScaleSpec(text, spec))
+            ReportFailure(__FILE__, __LINE__, std::string("accepted \"") + text + "\"");
+    }
+
+    FitSize(256, 256, 1920, 1080, width, height);
+    CHECK_EQ(width, 256);
+    CHECK_EQ(height, 144);
+    FitSize(0, 100, 1920, 1080, width, height);
+    CHECK_EQ(width, 178);
+    FitSize(4000, 4000, 640, 480, width, height);
+    CHECK_EQ(width, 640);
+    CHECK_EQ(height, 480);
+}
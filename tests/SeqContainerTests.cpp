@@ -0,0 +1,283 @@
+#include "TestHarness.h"
+
+#include "SeqContainer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+    uint32_t GetU32(const uint8_t* p)
+    {
+        return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+    }
+
+    uint64_t GetU64(const uint8_t* p)
+    {
+        return uint64_t(GetU32(p)) | (uint64_t(GetU32(p + 4)) << 32);
+    }
+
+    SeqReadFunction ReadFrom(const std::vector<uint8_t>& file)
+    {
+        return [&file](uint64_t offset, void* buffer, size_t size)
+            {
+                if (offset > file.size() || size > file.size() - offset)
+                    return false;
+                memcpy(buffer, file.data() + offset, size);
+                return true;
+            };
+    }
+
+    // A run of frames that change the way a desktop does: a few small
+    // areas most of the time, sometimes nothing, now and then everything.
+    // Alpha is noise; the container drops it.
+    std::vector<std::vector<uint8_t>> MakeFrames(int width, int height, int count, uint32_t seed)
+    {
+        TestRng rng(seed);
+        std::vector<std::vector<uint8_t>> frames;
+        std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4);
+        for (uint8_t& b : pixels)
+            b = static_cast<uint8_t>(rng.Next());
+        for (int i = 0; i < count; i++)
+        {
+            if (i > 0 && i % 7 == 3)
+            {
+                for (uint8_t& b : pixels)
+                    b = static_cast<uint8_t>(rng.Next());
+            }
+            else if (i > 0 && i % 7 != 5)
+            {
+                const int areas = 1 + rng.Range(3);
+                for (int a = 0; a < areas; a++)
+                {
+                    const int w = 1 + rng.Range((std::min)(12, width)), h = 1 + rng.Range((std::min)(12, height));
+                    const int left = rng.Range(width - w + 1), top = rng.Range(height - h + 1);
+                    for (int y = top; y < top + h; y++)
+                        for (int x = left; x < left + w; x++)
+                            pixels[(static_cast<size_t>(y) * width + x) * 4 + rng.Range(3)] ^= 0x5A;
+                }
+            }
+            for (size_t p = 3; p < pixels.size(); p += 4)
+                pixels[p] = static_cast<uint8_t>(rng.Next());
+            frames.push_back(pixels);
+        }
+        return frames;
+    }
+
+    // What the reader gives back for a frame: the same colours, opaque.
+    std::vector<uint8_t> Opaque(std::vector<uint8_t> pixels)
+    {
+        for (size_t p = 3; p < pixels.size(); p += 4)
+            pixels[p] = 255;
+        return pixels;
+    }
+
+    int64_t TimestampOf(int frame)
+    {
+        return 1700000000000LL + frame * 997LL - (frame == 4 ? 5000 : 0);
+    }
+
+    std::vector<uint8_t> WriteSeq(const std::vector<std::vector<uint8_t>>& frames, int width, int height,
+        const SeqOptions& options, bool finish)
+    {
+        SeqWriter writer(options);
+        std::vector<uint8_t> file;
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            if (!writer.AddFrame(frames[i].data(), width, height, width * 4, TimestampOf(static_cast<int>(i)), file))
+                return std::vector<uint8_t>();
+        }
+        if (finish)
+            writer.Finish(file);
+        if (writer.BytesWritten() != file.size())
+            return std::vector<uint8_t>();
+        return file;
+    }
+
+    struct Record
+    {
+        uint8_t type;
+        uint32_t rawSize;
+        uint32_t payloadSize;
+        int64_t timestampMs;
+    };
+
+    Record RecordAt(const std::vector<uint8_t>& file, uint64_t offset)
+    {
+        const uint8_t* p = file.data() + offset;
+        Record record = { p[0], GetU32(p + 4), GetU32(p + 8), static_cast<int64_t>(GetU64(p + 12)) };
+        return record;
+    }
+}
+
+TEST(SeqRoundTripsDeltasAndIndex)
+{
+    // Tiles cut by both edges; keyframes every five frames, plus the ones
+    // where most of the frame changed.
+    const int width = 100, height = 70, count = 23;
+    const std::vector<std::vector<uint8_t>> frames = MakeFrames(width, height, count, 5);
+    SeqOptions options;
+    options.tileSize = 16;
+    options.keyframeInterval = 5;
+    const std::vector<uint8_t> file = WriteSeq(frames, width, height, options, true);
+    REQUIRE(!file.empty());
+
+    // The index: one entry per frame, pointing at its record, naming the
+    // keyframe it decodes from.
+    const uint8_t* trailer = file.data() + file.size() - 24;
+    CHECK(memcmp(trailer + 16, "SEQINDEX", 8) == 0);
+    const uint64_t indexOffset = GetU64(trailer);
+    REQUIRE(GetU32(trailer + 8) == static_cast<uint32_t>(count));
+    int deltas = 0;
+    uint32_t keyframe = 0;
+    for (int i = 0; i < count; i++)
+    {
+        const uint8_t* entry = file.data() + indexOffset + i * 20;
+        const Record record = RecordAt(file, GetU64(entry));
+        CHECK(record.type <= 1);
+        CHECK_EQ(record.timestampMs, TimestampOf(i));
+        CHECK_EQ(static_cast<int64_t>(GetU64(entry + 8)), TimestampOf(i));
+        // Keyframes at the interval, and wherever everything changed.
+        const bool expectKey = i == 0 || i - static_cast<int>(keyframe) >= 5 || i % 7 == 3;
+        CHECK_EQ(record.type == 0, expectKey);
+        if (record.type == 0)
+            keyframe = static_cast<uint32_t>(i);
+        else
+            deltas++;
+        CHECK_EQ(GetU32(entry + 16), keyframe);
+        if (record.type == 1)
+            CHECK(record.rawSize < static_cast<uint32_t>(width * height * 3 / 2));
+    }
+    CHECK(deltas >= count / 2);
+
+    SeqReader reader;
+    REQUIRE(reader.Open(ReadFrom(file), file.size()));
+    CHECK(!reader.IndexRecovered());
+    CHECK_EQ(reader.Width(), width);
+    CHECK_EQ(reader.Height(), height);
+    REQUIRE(reader.FrameCount() == count);
+
+    // In order, backwards and at random: each way decodes from the
+    // frame's keyframe or carries on from the last frame.
+    std::vector<int> order;
+    for (int i = 0; i < count; i++)
+        order.push_back(i);
+    for (int i = count - 1; i >= 0; i--)
+        order.push_back(i);
+    TestRng rng(6);
+    for (int i = 0; i < 40; i++)
+        order.push_back(rng.Range(count));
+    std::vector<uint8_t> pixels;
+    for (int frame : order)
+    {
+        CHECK_EQ(reader.Timestamp(frame), TimestampOf(frame));
+        if (!reader.ReadFrame(frame, pixels) || pixels != Opaque(frames[frame]))
+            ReportFailure(__FILE__, __LINE__, "frame " + std::to_string(frame) + " does not round trip");
+    }
+    CHECK(!reader.ReadFrame(count, pixels));
+    CHECK(!reader.ReadFrame(-1, pixels));
+}
+
+TEST(SeqRecoversWithoutIndex)
+{
+    const int width = 45, height = 37, count = 12;
+    const std::vector<std::vector<uint8_t>> frames = MakeFrames(width, height, count, 8);
+    SeqOptions options;
+    options.tileSize = 8;
+    options.keyframeInterval = 4;
+    const std::vector<uint8_t> finished = WriteSeq(frames, width, height, options, true);
+    const std::vector<uint8_t> unfinished = WriteSeq(frames, width, height, options, false);
+    REQUIRE(!finished.empty() && !unfinished.empty());
+    CHECK(std::equal(unfinished.begin(), unfinished.end(), finished.begin()));
+
+    // Never finished, then cut at points all through the last two records:
+    // the frames whose records are whole are read back.
+    const uint64_t lastRecords = GetU64(finished.data() + GetU64(finished.data() + finished.size() - 24) + 10 * 20);
+    std::vector<uint8_t> pixels;
+    for (size_t size = static_cast<size_t>(lastRecords) - 1; size <= unfinished.size(); size += 7)
+    {
+        const std::vector<uint8_t> cut(unfinished.begin(), unfinished.begin() + size);
+        int whole = 0;
+        for (uint64_t offset = 28; offset + 20 <= cut.size(); whole++)
+        {
+            offset += 20 + RecordAt(cut, offset).payloadSize;
+            if (offset > cut.size())
+                break;
+        }
+        SeqReader reader;
+        REQUIRE(reader.Open(ReadFrom(cut), cut.size()));
+        CHECK(reader.IndexRecovered());
+        if (reader.FrameCount() != whole)
+        {
+            ReportFailure(__FILE__, __LINE__, std::to_string(reader.FrameCount()) + " frames recovered from " +
+                std::to_string(size) + " bytes, " + std::to_string(whole) + " whole");
+            continue;
+        }
+        for (int frame = whole - 1; frame >= 0; frame -= 3)
+        {
+            CHECK_EQ(reader.Timestamp(frame), TimestampOf(frame));
+            CHECK(reader.ReadFrame(frame, pixels) && pixels == Opaque(frames[frame]));
+        }
+    }
+
+    // An index that names a later keyframe is not trusted.
+    std::vector<uint8_t> bad = finished;
+    const uint64_t indexOffset = GetU64(bad.data() + bad.size() - 24);
+    bad[indexOffset + 3 * 20 + 16] = 9;
+    SeqReader reader;
+    REQUIRE(reader.Open(ReadFrom(bad), bad.size()));
+    CHECK(reader.IndexRecovered());
+    CHECK_EQ(reader.FrameCount(), count);
+    CHECK(reader.ReadFrame(3, pixels) && pixels == Opaque(frames[3]));
+
+    // A damaged payload fails that frame and the deltas on it, not the
+    // frames of the next keyframe.
+    bad = finished;
+    const uint64_t record1 = GetU64(bad.data() + indexOffset + 1 * 20);
+    bad[record1 + 20 + RecordAt(bad, record1).payloadSize / 2] ^= 0xFF;
+    bad[record1 + 4] ^= 1;
+    REQUIRE(reader.Open(ReadFrom(bad), bad.size()));
+    CHECK(!reader.ReadFrame(1, pixels));
+    CHECK(!reader.ReadFrame(2, pixels));
+    CHECK(reader.ReadFrame(0, pixels) && pixels == Opaque(frames[0]));
+    CHECK(reader.ReadFrame(count - 1, pixels) && pixels == Opaque(frames[count - 1]));
+
+    // Not a sequence at all.
+    const std::vector<uint8_t> junk(64, 'S');
+    CHECK(!reader.Open(ReadFrom(junk), junk.size()));
+}
+
+TEST(SeqWriterRejectsMismatchedFrames)
+{
+    const int width = 20, height = 10;
+    const std::vector<std::vector<uint8_t>> frames = MakeFrames(width, height, 2, 9);
+    SeqWriter writer;
+    std::vector<uint8_t> file;
+    REQUIRE(writer.AddFrame(frames[0].data(), width, height, width * 4, 1, file));
+    const size_t size = file.size();
+    CHECK(!writer.AddFrame(frames[1].data(), width - 1, height, width * 4, 2, file));
+    CHECK(!writer.AddFrame(frames[1].data(), width, height, width * 4 - 1, 2, file));
+    CHECK(!writer.AddFrame(nullptr, width, height, width * 4, 2, file));
+    CHECK_EQ(file.size(), size);
+    CHECK_EQ(writer.FrameCount(), 1);
+
+    // Bottom-up rows come back top-down.
+    std::vector<uint8_t> flipped(frames[1].size());
+    for (int y = 0; y < height; y++)
+    {
+        memcpy(&flipped[static_cast<size_t>(height - 1 - y) * width * 4], &frames[1][static_cast<size_t>(y) * width * 4],
+            width * 4);
+    }
+    const uint8_t* top = flipped.data() + static_cast<size_t>(height - 1) * width * 4;
+    REQUIRE(writer.AddFrame(top, width, height, -width * 4, 2, file));
+    writer.Finish(file);
+    CHECK(!writer.AddFrame(frames[1].data(), width, height, width * 4, 3, file));
+
+    SeqReader reader;
+    std::vector<uint8_t> pixels;
+    REQUIRE(reader.Open(ReadFrom(file), file.size()));
+    CHECK_EQ(reader.FrameCount(), 2);
+    CHECK(reader.ReadFrame(1, pixels) && pixels == Opaque(frames[1]));
+}
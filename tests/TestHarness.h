@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+//---------------------------------------------------------------------
+// A minimal test runner for the modules that do not touch the screen.
+// Every TEST registers itself before main; shotcap-tests runs them all, or
+// those whose names contain one of its arguments, and exits non-zero when
+// a check failed.
+//
+//   TEST(PngRoundTrip)
+//   {
+//       CHECK(EncodePng(view, options, png));
+//       CHECK_EQ(width, 640);
+//   }
+//
+// CHECK and CHECK_EQ record the failure and carry on; REQUIRE returns
+// from the test, for checks the rest of it depends on.
+
+typedef void (*TestFunction)();
+
+struct TestRegistrar
+{
+    TestRegistrar(const char* name, TestFunction function);
+};
+
+void ReportFailure(const char* file, int line, const std::string& message);
+
+// Bytes print as numbers in CHECK_EQ messages.
+template <typename T>
+const T& TestPrintable(const T& value) { return value; }
+inline int TestPrintable(uint8_t value) { return value; }
+inline int TestPrintable(int8_t value) { return value; }
+inline int TestPrintable(char value) { return value; }
+
+#define TEST(name) \
+    static void name(); \
+    static TestRegistrar name##Registrar(#name, name); \
+    static void name()
+
+#define CHECK(condition) \
+    do { if (!(condition)) ReportFailure(__FILE__, __LINE__, #condition); } while (0)
+
+#define CHECK_EQ(actual, expected) \
+    do \
+    { \
+        auto actualValue_ = (actual); \
+        auto expectedValue_ = (expected); \
+        if (!(actualValue_ == expectedValue_)) \
+        { \
+            std::ostringstream message_; \
+            message_ << #actual << " == " << #expected << " (got " << TestPrintable(actualValue_) \
+                << ", expected " << TestPrintable(expectedValue_) << ")"; \
+            ReportFailure(__FILE__, __LINE__, message_.str()); \
+        } \
+    } while (0)
+
+#define REQUIRE(condition) \
+    do { if (!(condition)) { ReportFailure(__FILE__, __LINE__, #condition); return; } } while (0)
+
+//---------------------------------------------------------------------
+// Helpers shared by the tests.
+
+// xorshift32, as in the benchmark's synthetic frames.
+class TestRng
+{
+public:
+    explicit TestRng(uint32_t seed) : state_(seed ? seed : 0x9E3779B9u) {}
+
+    uint32_t Next()
+    {
+        state_ ^= state_ << 13;
+        state_ ^= state_ >> 17;
+        state_ ^= state_ << 5;
+        return state_;
+    }
+
+    int Range(int n) { return n > 0 ? static_cast<int>(Next() % static_cast<uint32_t>(n)) : 0; }
+
+private:
+    uint32_t state_;
+};
@@ -0,0 +1,61 @@
+#include "TestHarness.h"
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace
+{
+    struct TestCase
+    {
+        const char* name;
+        TestFunction function;
+    };
+
+    std::vector<TestCase>& Registry()
+    {
+        static std::vector<TestCase> tests;
+        return tests;
+    }
+
+    int failures = 0;
+}
+
+TestRegistrar::TestRegistrar(const char* name, TestFunction function)
+{
+    Registry().push_back({ name, function });
+}
+
+void ReportFailure(const char* file, int line, const std::string& message)
+{
+    std::cerr << file << ":" << line << ": check failed: " << message << "\n";
+    failures++;
+}
+
+int main(int argc, char* argv[])
+{
+    int run = 0, failed = 0;
+    for (const TestCase& test : Registry())
+    {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc && !selected; i++)
+            selected = std::strstr(test.name, argv[i]) != nullptr;
+        if (!selected)
+            continue;
+
+        int before = failures;
+        test.function();
+        run++;
+        if (failures != before)
+        {
+            failed++;
+            std::cout << "[FAIL] " << test.name << std::endl;
+        }
+        else
+        {
+            std::cout << "[ OK ] " << test.name << std::endl;
+        }
+    }
+    std::cout << run - failed << " of " << run << " tests passed." << std::endl;
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,216 @@
+#include "TestHarness.h"
+
+#include "TextOverlay.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+//---------------------------------------------------------------------
+// Text drawn with BuiltinFont in an opaque colour over a flat
+// background, so every pixel is exactly the text colour, the shadow
+// blended over the background, or the background untouched.
+
+namespace
+{
+    const uint8_t kBackground = 0x64;
+    const uint32_t kTextColor = 0xFF20C040;
+    const uint32_t kShadowColor = 0x80000000;
+
+    // A larger frame around the one drawn into, to catch writes past it.
+    const int kBorder = 8;
+
+    // Where each pixel of the text goes: 2 for text, 1 for shadow alone.
+    struct Expected
+    {
+        int width;
+        int height;
+        std::vector<uint8_t> mask;
+    };
+
+    Expected ExpectedText(const std::wstring& text, int scale, int shadow, int width, int height, int left, int top)
+    {
+        Expected expected = { width, height, std::vector<uint8_t>(static_cast<size_t>(width) * height, 0) };
+        BuiltinFont font(scale);
+        std::vector<uint8_t> coverage;
+        int pen = 0;
+        for (wchar_t ch : text)
+        {
+            int cellWidth = 0, advance = 0;
+            font.Rasterize(ch, coverage, cellWidth, advance);
+            for (int pass = 0; pass < (shadow > 0 ? 2 : 1); pass++)
+            {
+                // The shadow first, then the text over it.
+                const int shift = pass == 0 && shadow > 0 ? shadow : 0;
+                const uint8_t value = shift > 0 ? 1 : 2;
+                for (int y = 0; y < font.LineHeight(); y++)
+                {
+                    for (int x = 0; x < cellWidth; x++)
+                    {
+                        const int fx = left + pen + x + shift;
+                        const int fy = top + y + shift;
+                        if (coverage[static_cast<size_t>(y) * cellWidth + x] == 0 ||
+                            fx < 0 || fy < 0 || fx >= width || fy >= height)
+                            continue;
+                        uint8_t& out = expected.mask[static_cast<size_t>(fy) * width + fx];
+                        out = (std::max)(out, value);
+                    }
+                }
+            }
+            pen += advance;
+        }
+        return expected;
+    }
+
+    // Draw text into the middle of a bordered frame and count the pixels
+    // that differ from expected, the border included.
+    int WrongPixels(TextOverlay& overlay, const std::wstring& text, const Expected& expected)
+    {
+        Frame frame;
+        frame.Allocate(expected.width + 2 * kBorder, expected.height + 2 * kBorder, FrameFormat::Bgrx32);
+        for (int y = 0; y < frame.Height(); y++)
+            std::fill(frame.View().Row(y), frame.View().Row(y) + frame.Width() * 4, kBackground);
+        overlay.Draw(frame.View().Crop(kBorder, kBorder, expected.width, expected.height), text);
+
+        const uint8_t textBgra[4] = { static_cast<uint8_t>(kTextColor), static_cast<uint8_t>(kTextColor >> 8),
+            static_cast<uint8_t>(kTextColor >> 16), static_cast<uint8_t>(kTextColor >> 24) };
+        // The shadow is 50% black: the background at 127/255, rounded.
+        const uint8_t shade = static_cast<uint8_t>((kBackground * 127 + 127) / 255);
+        const uint8_t shadowBgra[4] = { shade, shade, shade, static_cast<uint8_t>(128 + shade) };
+        int wrong = 0;
+        for (int y = 0; y < frame.Height(); y++)
+        {
+            for (int x = 0; x < frame.Width(); x++)
+            {
+                const int ex = x - kBorder, ey = y - kBorder;
+                const bool inside = ex >= 0 && ey >= 0 && ex < expected.width && ey < expected.height;
+                const uint8_t kind = inside ? expected.mask[static_cast<size_t>(ey) * expected.width + ex] : 0;
+                const uint8_t* pixel = frame.View().Row(y) + x * 4;
+                for (int c = 0; c < 4; c++)
+                {
+                    const uint8_t want = kind == 2 ? textBgra[c] : kind == 1 ? shadowBgra[c] : kBackground;
+                    if (pixel[c] != want)
+                    {
+                        wrong++;
+                        break;
+                    }
+                }
+            }
+        }
+        return wrong;
+    }
+
+    TextStyle Style(TextAnchor anchor, int shadow)
+    {
+        TextStyle style;
+        style.anchor = anchor;
+        style.margin = 5;
+        style.color = kTextColor;
+        style.shadowColor = kShadowColor;
+        style.shadowOffset = shadow;
+        return style;
+    }
+}
+
+TEST(BuiltinFontGlyphShapes)
+{
+    BuiltinFont font(2);
+    CHECK_EQ(font.LineHeight(), 18);
+    std::vector<uint8_t> coverage;
+    int width = 0, advance = 0;
+    REQUIRE(font.Rasterize(L'|', coverage, width, advance));
+    CHECK_EQ(width, 12);
+    CHECK_EQ(advance, 12);
+    // '|' is the middle column, all seven rows, below one empty row.
+    for (int y = 0; y < 18; y++)
+    {
+        for (int x = 0; x < 12; x++)
+        {
+            const bool ink = x >= 4 && x < 6 && y >= 2 && y < 16;
+            CHECK_EQ(coverage[static_cast<size_t>(y) * width + x], ink ? 255 : 0);
+        }
+    }
+
+    // Anything outside printable ASCII is '?'.
+    std::vector<uint8_t> question;
+    REQUIRE(font.Rasterize(L'?', question, width, advance));
+    REQUIRE(font.Rasterize(L'\x00E9', coverage, width, advance));
+    CHECK(coverage == question);
+    REQUIRE(font.Rasterize(L'\n', coverage, width, advance));
+    CHECK(coverage == question);
+}
+
+TEST(TextOverlayAnchorsPlaceText)
+{
+    const std::wstring text = L"12:34 Ag";
+    const int width = 160, height = 70;
+    for (int scale = 1; scale <= 3; scale++)
+    {
+        const int textWidth = static_cast<int>(text.size()) * 6 * scale;
+        const int textHeight = 9 * scale;
+        for (int shadow = 0; shadow <= 2; shadow += 2)
+        {
+            struct { TextAnchor anchor; int left; int top; } cases[] =
+            {
+                { TextAnchor::TopLeft, 5, 5 },
+                { TextAnchor::TopRight, width - 5 - textWidth, 5 },
+                { TextAnchor::BottomLeft, 5, height - 5 - textHeight },
+                { TextAnchor::BottomRight, width - 5 - textWidth, height - 5 - textHeight },
+                { TextAnchor::Point, 17, 31 },
+            };
+            for (const auto& test : cases)
+            {
+                TextStyle style = Style(test.anchor, shadow);
+                style.x = 17;
+                style.y = 31;
+                TextOverlay overlay(std::unique_ptr<GlyphSource>(new BuiltinFont(scale)), style);
+                const Expected expected = ExpectedText(text, scale, shadow, width, height, test.left, test.top);
+                const int wrong = WrongPixels(overlay, text, expected);
+                if (wrong != 0)
+                {
+                    ReportFailure(__FILE__, __LINE__, std::to_string(wrong) + " wrong pixels at anchor " +
+                        std::to_string(static_cast<int>(test.anchor)) + ", scale " + std::to_string(scale) +
+                        ", shadow " + std::to_string(shadow));
+                }
+                // Drawing the same text again reuses the strip; it lands
+                // the same way on a fresh frame.
+                CHECK_EQ(WrongPixels(overlay, text, expected), 0);
+            }
+        }
+    }
+}
+
+TEST(TextOverlayClipsToFrame)
+{
+    // Text hanging off every side, and wholly outside; nothing may be
+    // written past the frame.
+    const std::wstring text = L"Clip#0";
+    const int width = 50, height = 30;
+    const int points[][2] = { { -7, 4 }, { 30, 3 }, { 10, -9 }, { 5, 22 }, { -20, -11 }, { 44, 27 },
+        { -200, 5 }, { 51, 5 }, { 5, 31 }, { 5, -60 } };
+    for (const auto& point : points)
+    {
+        TextStyle style = Style(TextAnchor::Point, 2);
+        style.x = point[0];
+        style.y = point[1];
+        TextOverlay overlay(std::unique_ptr<GlyphSource>(new BuiltinFont(2)), style);
+        const Expected expected = ExpectedText(text, 2, 2, width, height, point[0], point[1]);
+        const int wrong = WrongPixels(overlay, text, expected);
+        if (wrong != 0)
+        {
+            ReportFailure(__FILE__, __LINE__, std::to_string(wrong) + " wrong pixels at " +
+                std::to_string(point[0]) + "," + std::to_string(point[1]));
+        }
+    }
+
+    // A corner anchor on a frame narrower than the text puts it off the
+    // left edge.
+    TextOverlay overlay(std::unique_ptr<GlyphSource>(new BuiltinFont(1)), Style(TextAnchor::BottomRight, 1));
+    const int textWidth = static_cast<int>(text.size()) * 6;
+    CHECK_EQ(WrongPixels(overlay, text, ExpectedText(text, 1, 1, 20, 15, 20 - 5 - textWidth, 15 - 5 - 9)), 0);
+
+    // Each character is rasterized once.
+    CHECK_EQ(overlay.GlyphCount(), 6);
+    CHECK_EQ(WrongPixels(overlay, L"ClipClip", ExpectedText(L"ClipClip", 1, 1, 60, 15, 60 - 5 - 48, 1)), 0);
+    CHECK_EQ(overlay.GlyphCount(), 6);
+}